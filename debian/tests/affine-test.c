@@ -0,0 +1,198 @@
+/*
+ * Draw rotated and sheared images, with and without interpolation, onto
+ * gray, rgb and cmyk pixmaps with and without alpha, and print a digest
+ * of each result. The images have the colorspace of the pixmap (or are
+ * gray, onto rgb), with and without alpha, and are also used as clip
+ * masks. The output must be the same whichever SIMD code is used (see
+ * FZ_SIMD in the Makefile).
+ *
+ * With -b, time drawing scanned pages turned a little at 300dpi instead.
+ */
+
+#include "mupdf/fitz.h"
+
+#include "test-util.h"
+
+/* Random samples, with no color more than its alpha. Some pixels are
+ * left clear or opaque, as these have cases of their own. */
+static void fill_pixmap(fz_context *ctx, fz_pixmap *pix)
+{
+	unsigned char *s = fz_pixmap_samples(ctx, pix);
+	int n = fz_pixmap_components(ctx, pix);
+	int alpha = fz_pixmap_alpha(ctx, pix);
+	size_t i, len = (size_t)fz_pixmap_stride(ctx, pix) * fz_pixmap_height(ctx, pix);
+	int k;
+
+	for (i = 0; i < len; i++)
+		s[i] = rnd();
+	if (alpha)
+	{
+		for (i = 0; i < len; i += n)
+		{
+			switch (rnd() % 4)
+			{
+			case 0: s[i + n - 1] = 0; break;
+			case 1: s[i + n - 1] = 255; break;
+			}
+			for (k = 0; k < n - 1; k++)
+				if (s[i + k] > s[i + n - 1])
+					s[i + k] = s[i + n - 1];
+		}
+	}
+}
+
+static fz_image *random_image(fz_context *ctx, fz_colorspace *cs, int w, int h, int alpha)
+{
+	fz_pixmap *pix = fz_new_pixmap(ctx, cs, w, h, NULL, alpha);
+	fz_image *image = NULL;
+
+	fz_try(ctx)
+	{
+		fill_pixmap(ctx, pix);
+		image = fz_new_image_from_pixmap(ctx, pix, NULL);
+	}
+	fz_always(ctx)
+		fz_drop_pixmap(ctx, pix);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	return image;
+}
+
+/* The image a little larger than it is, turned by deg and sheared by
+ * shear about the middle of a w by h pixmap. */
+static fz_matrix place(fz_image *image, int w, int h, float deg, float shear)
+{
+	float sw = image->w * 1.1f;
+	float sh = image->h * 1.1f;
+	fz_matrix ctm = fz_make_matrix(sw, 0, shear * sh, sh, -sw / 2, -sh / 2);
+
+	ctm = fz_concat(ctm, fz_rotate(deg));
+	return fz_concat(ctm, fz_translate(w / 2.0f, h / 2.0f));
+}
+
+static const float turns[][2] = {
+	{ 7, 0 }, { -31, 0 }, { 93, 0 }, { 180, 0 }, { 0, 0.4f }, { 15, -0.3f },
+};
+
+static void draw(fz_context *ctx, fz_pixmap *pix, fz_image *image, fz_image *mask, int interpolate, float alpha)
+{
+	int w = fz_pixmap_width(ctx, pix);
+	int h = fz_pixmap_height(ctx, pix);
+	fz_device *dev = fz_new_draw_device(ctx, fz_identity, pix);
+	int i;
+
+	fz_try(ctx)
+	{
+		if (!interpolate)
+			fz_enable_device_hints(ctx, dev, FZ_DONT_INTERPOLATE_IMAGES);
+		for (i = 0; i < (int)nelem(turns); i++)
+		{
+			fz_matrix ctm = place(image, w, h, turns[i][0], turns[i][1]);
+			fz_fill_image(ctx, dev, image, ctm, alpha, fz_default_color_params);
+		}
+		fz_clip_image_mask(ctx, dev, mask, place(mask, w, h, 12, 0.1f), fz_infinite_rect);
+		fz_fill_image(ctx, dev, image, place(image, w, h, -5, 0), alpha, fz_default_color_params);
+		fz_pop_clip(ctx, dev);
+		fz_close_device(ctx, dev);
+	}
+	fz_always(ctx)
+		fz_drop_device(ctx, dev);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+static void check(fz_context *ctx)
+{
+	static const int sizes[][2] = { { 5, 7 }, { 23, 17 }, { 64, 40 } };
+	fz_colorspace *spaces[] = { fz_device_gray(ctx), fz_device_rgb(ctx), fz_device_cmyk(ctx) };
+	int c, da, from, sa, interpolate, i, a;
+
+	for (c = 0; c < 3; c++)
+	for (da = 0; da <= 1; da++)
+	for (from = 0; from <= (c == 1); from++)
+	for (sa = 0; sa <= 1; sa++)
+	for (interpolate = 0; interpolate <= 1; interpolate++)
+	for (i = 0; i < (int)nelem(sizes); i++)
+	for (a = 0; a <= 1; a++)
+	{
+		fz_colorspace *cs = from ? fz_device_gray(ctx) : spaces[c];
+		fz_pixmap *pix = NULL;
+		fz_image *image = NULL;
+		fz_image *mask = NULL;
+
+		fz_var(pix);
+		fz_var(image);
+		fz_var(mask);
+
+		fz_try(ctx)
+		{
+			pix = fz_new_pixmap(ctx, spaces[c], 80, 70, NULL, da);
+			fill_pixmap(ctx, pix);
+			image = random_image(ctx, cs, sizes[i][0], sizes[i][1], sa);
+			mask = random_image(ctx, NULL, sizes[i][1], sizes[i][0], 1);
+			draw(ctx, pix, image, mask, interpolate, a ? 1 : 0.6f);
+			printf("%s alpha %d from %s alpha %d %dx%d interpolate %d alpha %s:",
+				fz_colorspace_name(ctx, spaces[c]), da, fz_colorspace_name(ctx, cs), sa,
+				sizes[i][0], sizes[i][1], interpolate, a ? "1" : "0.6");
+			print_pixmap_digest(ctx, pix);
+		}
+		fz_always(ctx)
+		{
+			fz_drop_image(ctx, mask);
+			fz_drop_image(ctx, image);
+			fz_drop_pixmap(ctx, pix);
+		}
+		fz_catch(ctx)
+			fz_rethrow(ctx);
+	}
+}
+
+static void bench(fz_context *ctx)
+{
+	fz_colorspace *spaces[] = { fz_device_gray(ctx), fz_device_rgb(ctx), fz_device_cmyk(ctx) };
+	int c, interpolate;
+
+	for (c = 0; c < 3; c++)
+	{
+		for (interpolate = 0; interpolate <= 1; interpolate++)
+		{
+			fz_pixmap *pix = NULL;
+			fz_image *image = NULL;
+			fz_device *dev = NULL;
+			double t;
+
+			fz_var(pix);
+			fz_var(image);
+			fz_var(dev);
+
+			fz_try(ctx)
+			{
+				pix = fz_new_pixmap(ctx, spaces[c], 2550, 3300, NULL, 0);
+				fz_clear_pixmap_with_value(ctx, pix, 255);
+				image = random_image(ctx, spaces[c], 2500, 3250, 0);
+				dev = fz_new_draw_device(ctx, fz_identity, pix);
+				if (!interpolate)
+					fz_enable_device_hints(ctx, dev, FZ_DONT_INTERPOLATE_IMAGES);
+				t = now();
+				fz_fill_image(ctx, dev, image, place(image, 2550, 3300, 2, 0), 1, fz_default_color_params);
+				fz_close_device(ctx, dev);
+				t = now() - t;
+				printf("%-10s %-7s %6.1f ms\n", fz_colorspace_name(ctx, spaces[c]), interpolate ? "lerp" : "nearest", t * 1000);
+			}
+			fz_always(ctx)
+			{
+				fz_drop_device(ctx, dev);
+				fz_drop_image(ctx, image);
+				fz_drop_pixmap(ctx, pix);
+			}
+			fz_catch(ctx)
+				fz_rethrow(ctx);
+		}
+	}
+}
+
+int main(int argc, char **argv)
+{
+	return test_main("affine-test", argc, argv, 0, check, bench);
+}
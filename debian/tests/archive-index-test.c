@@ -0,0 +1,293 @@
+/*
+ * Look up entries in zip and tar archives, which go through a hash
+ * index of the entry names, and check that each lookup finds the same
+ * entry as a scan of the entry list would: the first whose name
+ * matches, ignoring case. The archives have names that differ only in
+ * case, an exact duplicate, and (in the tar archive) names too long
+ * for the header. The names looked up are every entry name with its
+ * case changed, and names that are not there.
+ */
+
+#include "mupdf/fitz.h"
+
+#include "test-util.h"
+
+#include <ctype.h>
+
+#define ENTRIES 2000
+
+static char *names[ENTRIES];
+
+static void make_names(fz_context *ctx)
+{
+	static const char *dirs[] = { "", "Pages/", "Documents/1/Pages/", "resources/fonts/" };
+	char name[300];
+	int i, k;
+
+	for (i = 0; i < ENTRIES; i++)
+	{
+		if (i > 0 && rnd() % 10 == 0)
+		{
+			/* The same as an earlier name, ignoring case. */
+			fz_strlcpy(name, names[rnd() % i], sizeof name);
+			for (k = 0; name[k]; k++)
+				if (isalpha((unsigned char)name[k]) && rnd() % 2)
+					name[k] ^= 32;
+		}
+		else if (i % 97 == 0)
+		{
+			/* Too long for a tar header. */
+			fz_snprintf(name, sizeof name, "%s%d", dirs[rnd() % nelem(dirs)], i);
+			while (strlen(name) < 150 + (size_t)i % 100)
+				fz_strlcat(name, "/Long", sizeof name);
+		}
+		else
+			fz_snprintf(name, sizeof name, "%s%c%d.%s", dirs[rnd() % nelem(dirs)], 'a' + rnd() % 26, rnd() % 5000, rnd() % 2 ? "xml" : "PNG");
+		names[i] = fz_strdup(ctx, name);
+	}
+
+	/* And one name exactly as before. */
+	fz_free(ctx, names[ENTRIES - 1]);
+	names[ENTRIES - 1] = fz_strdup(ctx, names[ENTRIES / 2]);
+}
+
+static fz_buffer *make_zip(fz_context *ctx)
+{
+	fz_buffer *buf = fz_new_buffer(ctx, 1 << 16);
+	fz_buffer *data = NULL;
+	fz_output *out = NULL;
+	fz_zip_writer *zip = NULL;
+	int i;
+
+	fz_var(data);
+	fz_var(out);
+	fz_var(zip);
+
+	fz_try(ctx)
+	{
+		out = fz_new_output_with_buffer(ctx, buf);
+		zip = fz_new_zip_writer_with_output(ctx, out);
+		out = NULL;
+		for (i = 0; i < ENTRIES; i++)
+		{
+			data = fz_new_buffer(ctx, 16);
+			fz_append_printf(ctx, data, "%d", i);
+			fz_write_zip_entry(ctx, zip, names[i], data, i & 1);
+			fz_drop_buffer(ctx, data);
+			data = NULL;
+		}
+		fz_close_zip_writer(ctx, zip);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_zip_writer(ctx, zip);
+		fz_drop_output(ctx, out);
+		fz_drop_buffer(ctx, data);
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_buffer(ctx, buf);
+		fz_rethrow(ctx);
+	}
+	return buf;
+}
+
+static void append_tar_record(fz_context *ctx, fz_buffer *buf, const char *name, int type, const char *data, size_t size)
+{
+	unsigned char record[512] = { 0 };
+	size_t pad = (512 - size % 512) % 512;
+	unsigned int sum = 0;
+	int i;
+
+	memcpy(record, name, strlen(name) < 100 ? strlen(name) : 100);
+	memcpy(record + 100, "0000644", 7);
+	snprintf((char *)record + 124, 12, "%011o", (unsigned int)size);
+	record[156] = type;
+	memcpy(record + 257, "ustar\00000", 8);
+	memset(record + 148, ' ', 8);
+	for (i = 0; i < 512; i++)
+		sum += record[i];
+	snprintf((char *)record + 148, 8, "%06o", sum);
+	fz_append_data(ctx, buf, record, sizeof record);
+	fz_append_data(ctx, buf, data, size);
+	memset(record, 0, sizeof record);
+	fz_append_data(ctx, buf, record, pad);
+}
+
+static fz_buffer *make_tar(fz_context *ctx, int count)
+{
+	fz_buffer *buf = fz_new_buffer(ctx, 1 << 16);
+	unsigned char end[1024] = { 0 };
+	char data[16];
+	int i;
+
+	fz_try(ctx)
+	{
+		for (i = 0; i < count; i++)
+		{
+			/* A long name comes in an entry of its own, NUL and all. */
+			if (strlen(names[i]) >= 100)
+				append_tar_record(ctx, buf, "././@LongLink", 'L', names[i], strlen(names[i]) + 1);
+			fz_snprintf(data, sizeof data, "%d", i);
+			append_tar_record(ctx, buf, names[i], '0', data, strlen(data));
+		}
+		fz_append_data(ctx, buf, end, sizeof end);
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_buffer(ctx, buf);
+		fz_rethrow(ctx);
+	}
+	return buf;
+}
+
+/* The entry a scan of the list finds, or -1. */
+static int scan(fz_context *ctx, fz_archive *arch, const char *name)
+{
+	int i, n = fz_count_archive_entries(ctx, arch);
+
+	for (i = 0; i < n; i++)
+		if (!fz_strcasecmp(name, fz_list_archive_entry(ctx, arch, i)))
+			return i;
+	return -1;
+}
+
+static void check_lookup(fz_context *ctx, fz_archive *arch, const char *name, const char *scan_name)
+{
+	int expect = scan(ctx, arch, scan_name);
+	fz_buffer *buf = NULL;
+	fz_stream *stm = NULL;
+	int found = -1;
+
+	fz_var(buf);
+	fz_var(stm);
+
+	if (fz_has_archive_entry(ctx, arch, name) != (expect >= 0))
+		fz_throw(ctx, FZ_ERROR_GENERIC, "%s: has entry '%s' disagrees with a scan", fz_archive_format(ctx, arch), name);
+	if (expect < 0)
+		return;
+
+	fz_try(ctx)
+	{
+		buf = fz_read_archive_entry(ctx, arch, name);
+		fz_terminate_buffer(ctx, buf);
+		found = atoi((char *)buf->data);
+		fz_drop_buffer(ctx, buf);
+		buf = NULL;
+		if (found != expect)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "%s: read '%s' from entry %d, expected %d", fz_archive_format(ctx, arch), name, found, expect);
+
+		stm = fz_open_archive_entry(ctx, arch, name);
+		buf = fz_read_all(ctx, stm, 16);
+		fz_terminate_buffer(ctx, buf);
+		found = atoi((char *)buf->data);
+		if (found != expect)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "%s: opened '%s' at entry %d, expected %d", fz_archive_format(ctx, arch), name, found, expect);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_stream(ctx, stm);
+		fz_drop_buffer(ctx, buf);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+static void check_archive(fz_context *ctx, fz_archive *arch, int count, int strips_slash)
+{
+	char name[310];
+	int i, k;
+
+	if (fz_count_archive_entries(ctx, arch) != count)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "%s: %d entries, expected %d", fz_archive_format(ctx, arch), fz_count_archive_entries(ctx, arch), count);
+
+	for (i = 0; i < count; i++)
+	{
+		if (strcmp(fz_list_archive_entry(ctx, arch, i), names[i]))
+			fz_throw(ctx, FZ_ERROR_GENERIC, "%s: entry %d is '%s'", fz_archive_format(ctx, arch), i, fz_list_archive_entry(ctx, arch, i));
+
+		check_lookup(ctx, arch, names[i], names[i]);
+
+		fz_strlcpy(name, names[i], sizeof name);
+		for (k = 0; name[k]; k++)
+			name[k] = rnd() % 2 ? toupper((unsigned char)name[k]) : tolower((unsigned char)name[k]);
+		check_lookup(ctx, arch, name, name);
+
+		/* Not there: longer, shorter, and one character changed. */
+		fz_strlcat(name, "x", sizeof name);
+		check_lookup(ctx, arch, name, name);
+		name[strlen(name) - 2] = 0;
+		check_lookup(ctx, arch, name, name);
+		fz_strlcpy(name, names[i], sizeof name);
+		name[rnd() % strlen(name)] ^= 1;
+		check_lookup(ctx, arch, name, name);
+	}
+
+	check_lookup(ctx, arch, "", "");
+	check_lookup(ctx, arch, "missing", "missing");
+
+	/* Zip entries may be asked for with a leading slash. */
+	fz_snprintf(name, sizeof name, "/%s", count ? names[0] : "");
+	check_lookup(ctx, arch, name, strips_slash ? name + 1 : name);
+}
+
+static void check_buffer(fz_context *ctx, fz_buffer *buf, int count, int zip)
+{
+	fz_stream *stm = fz_open_buffer(ctx, buf);
+	fz_archive *arch = NULL;
+
+	fz_var(arch);
+
+	fz_try(ctx)
+	{
+		arch = zip ? fz_open_zip_archive_with_stream(ctx, stm) : fz_open_tar_archive_with_stream(ctx, stm);
+		check_archive(ctx, arch, count, zip);
+		printf("%s: %d entries\n", fz_archive_format(ctx, arch), count);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_archive(ctx, arch);
+		fz_drop_stream(ctx, stm);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+static void check(fz_context *ctx)
+{
+	fz_buffer *buf = NULL;
+	int i;
+
+	fz_var(buf);
+
+	fz_try(ctx)
+	{
+		make_names(ctx);
+
+		buf = make_zip(ctx);
+		check_buffer(ctx, buf, ENTRIES, 1);
+		fz_drop_buffer(ctx, buf);
+		buf = NULL;
+
+		buf = make_tar(ctx, ENTRIES);
+		check_buffer(ctx, buf, ENTRIES, 0);
+		fz_drop_buffer(ctx, buf);
+		buf = NULL;
+
+		buf = make_tar(ctx, 0);
+		check_buffer(ctx, buf, 0, 0);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_buffer(ctx, buf);
+		for (i = 0; i < ENTRIES; i++)
+			fz_free(ctx, names[i]);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+int main(int argc, char **argv)
+{
+	return test_main("archive-index-test", argc, argv, 0, check, NULL);
+}
@@ -0,0 +1,522 @@
+/*
+ * Load every object of a PDF file, some from the file and some from
+ * object streams, both with and without object arenas, and check that
+ * they are the same: as loaded, after growing and deleting items of
+ * arrays and dicts, and when kept after the documents are dropped.
+ * Once everything is dropped, no memory must be left allocated.
+ *
+ * With -b, time loading every object of a file of 400000 objects, and
+ * count the allocations and memory taken; with -b arenas, do the same
+ * with arenas. The memory is the peak RSS of the process, as that is
+ * the only count that includes malloc's overhead for each block.
+ */
+
+#include "mupdf/fitz.h"
+#include "mupdf/pdf.h"
+
+#include "test-util.h"
+
+#include <sys/resource.h>
+
+#define PER_STM 100
+
+/* An allocator that counts what is allocated, to see that it is all
+ * freed. Each block starts with its size, padded to keep the rest
+ * aligned. */
+typedef union
+{
+	size_t size;
+	long double align;
+} block_head;
+
+static size_t mem_current, mem_count;
+
+static void *alloc_counted(void *user, size_t size)
+{
+	block_head *p = malloc(sizeof *p + size);
+	if (!p)
+		return NULL;
+	p->size = size;
+	mem_current += size;
+	mem_count++;
+	return p + 1;
+}
+
+static void *realloc_counted(void *user, void *old, size_t size)
+{
+	block_head *p;
+
+	if (!old)
+		return alloc_counted(user, size);
+	p = (block_head *)old - 1;
+	mem_current -= p->size;
+	p = realloc(p, sizeof *p + size);
+	if (!p)
+	{
+		mem_current += ((block_head *)old - 1)->size;
+		return NULL;
+	}
+	p->size = size;
+	mem_current += size;
+	mem_count++;
+	return p + 1;
+}
+
+static void free_counted(void *user, void *ptr)
+{
+	block_head *p;
+
+	if (!ptr)
+		return;
+	p = (block_head *)ptr - 1;
+	mem_current -= p->size;
+	free(p);
+}
+
+static fz_alloc_context counted = { NULL, alloc_counted, realloc_counted, free_counted };
+
+/* For timing, an allocator that only counts the calls made to it, and
+ * takes no more memory than malloc does. */
+static void *alloc_calls(void *user, size_t size)
+{
+	mem_count++;
+	return malloc(size);
+}
+
+static void *realloc_calls(void *user, void *old, size_t size)
+{
+	mem_count++;
+	return realloc(old, size);
+}
+
+static void free_calls(void *user, void *ptr)
+{
+	free(ptr);
+}
+
+static fz_alloc_context calls = { NULL, alloc_calls, realloc_calls, free_calls };
+
+/* A random value, which refers to objects below max. */
+static void write_value(fz_context *ctx, fz_buffer *buf, int depth, int max)
+{
+	int i, n;
+
+	switch (depth < 3 ? rnd() % 12 : rnd() % 6)
+	{
+	case 0:
+		fz_append_printf(ctx, buf, "%d ", (int)(rnd() % 200000) - 100000);
+		break;
+	case 1:
+		fz_append_printf(ctx, buf, "%g ", ((int)(rnd() % 200000) - 100000) / 64.0f);
+		break;
+	case 2:
+		if (rnd() & 1)
+			fz_append_printf(ctx, buf, "/N%d ", rnd() % 1000);
+		else
+			fz_append_printf(ctx, buf, "/A#20rather#20long#20name#20that#20goes#20on%d ", rnd());
+		break;
+	case 3:
+		if (rnd() & 1)
+			fz_append_printf(ctx, buf, "(string %d with \\(escapes\\) and \\101\\102)", rnd());
+		else
+			fz_append_printf(ctx, buf, "<%08x%08x>", rnd(), rnd());
+		break;
+	case 4:
+		fz_append_string(ctx, buf, rnd() & 1 ? "true " : "null ");
+		break;
+	case 5:
+		fz_append_printf(ctx, buf, "%d 0 R ", 1 + rnd() % max);
+		break;
+	case 6:
+	case 7:
+	case 8:
+		n = rnd() % 13;
+		fz_append_byte(ctx, buf, '[');
+		for (i = 0; i < n; i++)
+			write_value(ctx, buf, depth + 1, max);
+		fz_append_byte(ctx, buf, ']');
+		break;
+	default:
+		n = rnd() % 13;
+		fz_append_string(ctx, buf, "<<");
+		for (i = 0; i < n; i++)
+		{
+			fz_append_printf(ctx, buf, "/K%d ", i);
+			write_value(ctx, buf, depth + 1, max);
+		}
+		fz_append_string(ctx, buf, ">>");
+		break;
+	}
+}
+
+/* Most objects are arrays and dicts. The rest are not null, as a null
+ * object in an object stream reads as missing. */
+static void write_object(fz_context *ctx, fz_buffer *buf, int num, int max)
+{
+	if (num % 5 == 0)
+	{
+		switch (num / 5 % 4)
+		{
+		case 0: fz_append_printf(ctx, buf, "%d", (int)(rnd() % 200000) - 100000); break;
+		case 1: fz_append_printf(ctx, buf, "%g", num / 64.0f); break;
+		case 2: fz_append_printf(ctx, buf, "/N%d", num); break;
+		case 3: fz_append_printf(ctx, buf, "(string %d)", num); break;
+		}
+	}
+	else if (num & 1)
+		fz_append_printf(ctx, buf, "<</Type/Thing/Number %d/Array[%d 0 R %g (text)]/More ", num, 1 + rnd() % max, num / 8.0f);
+	else
+		fz_append_printf(ctx, buf, "[/Thing %d %d 0 R ", num, 1 + rnd() % max);
+	if (num % 5 != 0)
+	{
+		write_value(ctx, buf, 1, max);
+		fz_append_string(ctx, buf, num & 1 ? ">>" : "]");
+	}
+}
+
+static void put_xref_entry(unsigned char *p, int type, size_t ofs, int gen)
+{
+	p[0] = type;
+	p[1] = ofs >> 24;
+	p[2] = ofs >> 16;
+	p[3] = ofs >> 8;
+	p[4] = ofs;
+	p[5] = gen >> 8;
+	p[6] = gen;
+}
+
+/* Objects 3 to count+2 are in the file, some of them streams. The next
+ * count objects are in object streams, which follow them, and the last
+ * object is the cross reference stream. */
+static fz_buffer *make_file(fz_context *ctx, int count)
+{
+	int nstm = (count + PER_STM - 1) / PER_STM;
+	int size = 2 * count + nstm + 4;
+	int first = count + 3;
+	int stm = 2 * count + 3;
+	fz_buffer *buf = fz_new_buffer(ctx, (size_t)count * 200);
+	fz_buffer *head = NULL;
+	fz_buffer *body = NULL;
+	unsigned char *xref = NULL;
+	size_t ofs;
+	int i, k;
+
+	fz_var(head);
+	fz_var(body);
+	fz_var(xref);
+
+	fz_try(ctx)
+	{
+		xref = fz_malloc(ctx, (size_t)size * 7);
+		put_xref_entry(xref, 0, 0, 65535);
+
+		fz_append_string(ctx, buf, "%PDF-1.7\n");
+		put_xref_entry(xref + 7, 1, buf->len, 0);
+		fz_append_string(ctx, buf, "1 0 obj\n<</Type/Catalog/Pages 2 0 R>>\nendobj\n");
+		put_xref_entry(xref + 14, 1, buf->len, 0);
+		fz_append_string(ctx, buf, "2 0 obj\n<</Type/Pages/Count 0/Kids[]>>\nendobj\n");
+
+		for (i = 3; i < first; i++)
+		{
+			put_xref_entry(xref + i * 7, 1, buf->len, 0);
+			fz_append_printf(ctx, buf, "%d 0 obj\n", i);
+			if (i % 50 == 0)
+				fz_append_printf(ctx, buf, "<</Length 20/Number %d>>stream\n%020d\nendstream", i, i);
+			else
+				write_object(ctx, buf, i, size - 1);
+			fz_append_string(ctx, buf, "\nendobj\n");
+		}
+
+		head = fz_new_buffer(ctx, 1024);
+		body = fz_new_buffer(ctx, PER_STM * 200);
+		for (k = 0; k < nstm; k++, stm++)
+		{
+			int n = fz_mini(PER_STM, count - k * PER_STM);
+
+			fz_clear_buffer(ctx, head);
+			fz_clear_buffer(ctx, body);
+			for (i = 0; i < n; i++)
+			{
+				int num = first + k * PER_STM + i;
+				put_xref_entry(xref + num * 7, 2, stm, i);
+				fz_append_printf(ctx, head, "%d %zu ", num, body->len);
+				write_object(ctx, body, num, size - 1);
+				fz_append_byte(ctx, body, '\n');
+			}
+
+			put_xref_entry(xref + stm * 7, 1, buf->len, 0);
+			fz_append_printf(ctx, buf, "%d 0 obj\n<</Type/ObjStm/N %d/First %zu/Length %zu>>stream\n",
+				stm, n, head->len, head->len + body->len);
+			fz_append_buffer(ctx, buf, head);
+			fz_append_buffer(ctx, buf, body);
+			fz_append_string(ctx, buf, "\nendstream\nendobj\n");
+		}
+
+		ofs = buf->len;
+		put_xref_entry(xref + stm * 7, 1, ofs, 0);
+		fz_append_printf(ctx, buf, "%d 0 obj\n<</Type/XRef/Size %d/W[1 4 2]/Root 1 0 R/Length %d>>stream\n", stm, size, size * 7);
+		fz_append_data(ctx, buf, xref, (size_t)size * 7);
+		fz_append_printf(ctx, buf, "\nendstream\nendobj\nstartxref\n%zu\n%%%%EOF\n", ofs);
+	}
+	fz_always(ctx)
+	{
+		fz_free(ctx, xref);
+		fz_drop_buffer(ctx, head);
+		fz_drop_buffer(ctx, body);
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_buffer(ctx, buf);
+		fz_rethrow(ctx);
+	}
+
+	return buf;
+}
+
+static pdf_document *open_pdf(fz_context *ctx, fz_buffer *buf, int arenas)
+{
+	fz_stream *stm = fz_open_buffer(ctx, buf);
+	pdf_document *doc = NULL;
+
+	fz_try(ctx)
+	{
+		doc = pdf_open_document_with_stream(ctx, stm);
+		if (arenas)
+			pdf_enable_obj_arenas(ctx, doc);
+	}
+	fz_always(ctx)
+		fz_drop_stream(ctx, stm);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	return doc;
+}
+
+static pdf_obj *direct_container(fz_context *ctx, pdf_obj *obj)
+{
+	if (pdf_is_indirect(ctx, obj))
+		return NULL;
+	if (pdf_is_array(ctx, obj) || pdf_is_dict(ctx, obj))
+		return obj;
+	return NULL;
+}
+
+/* Grow arrays and dicts past what was loaded, delete and replace
+ * items, and do the same to the first array or dict within. */
+static void edit(fz_context *ctx, pdf_obj *obj, unsigned int r, int depth)
+{
+	pdf_obj *inner = NULL;
+	int i, n;
+
+	if (pdf_is_array(ctx, obj))
+	{
+		for (i = 0; i < (int)(r % 9); i++)
+			pdf_array_push_int(ctx, obj, r + i);
+		if (pdf_array_len(ctx, obj) > 1)
+			pdf_array_delete(ctx, obj, r % pdf_array_len(ctx, obj));
+		pdf_array_insert_drop(ctx, obj, pdf_new_real(ctx, r / 16.0f), pdf_array_len(ctx, obj) / 2);
+		pdf_array_put_drop(ctx, obj, 0, pdf_new_name(ctx, "Replaced"));
+		n = pdf_array_len(ctx, obj);
+		for (i = 0; i < n && !inner; i++)
+			inner = direct_container(ctx, pdf_array_get(ctx, obj, i));
+	}
+	else if (pdf_is_dict(ctx, obj))
+	{
+		for (i = 0; i < (int)(r % 9); i++)
+		{
+			char key[20];
+			fz_snprintf(key, sizeof key, "Added%d", i);
+			pdf_dict_puts_drop(ctx, obj, key, pdf_new_int(ctx, r + i));
+		}
+		if (pdf_dict_len(ctx, obj) > 1)
+			pdf_dict_del(ctx, obj, pdf_dict_get_key(ctx, obj, r % pdf_dict_len(ctx, obj)));
+		if (pdf_dict_len(ctx, obj) > 0)
+			pdf_dict_put_drop(ctx, obj, pdf_dict_get_key(ctx, obj, 0), pdf_new_string(ctx, "replaced", 8));
+		n = pdf_dict_len(ctx, obj);
+		for (i = 0; i < n && !inner; i++)
+			inner = direct_container(ctx, pdf_dict_get_val(ctx, obj, i));
+	}
+
+	if (inner && depth < 3)
+		edit(ctx, inner, r / 7, depth + 1);
+}
+
+static int compare(fz_context *ctx, pdf_obj **a, pdf_obj **b, int n, const char *what)
+{
+	int i, bad = 0;
+
+	for (i = 1; i < n && bad < 10; i++)
+	{
+		if (pdf_objcmp(ctx, a[i], b[i]))
+		{
+			fprintf(stderr, "object %d differs %s\n", i, what);
+			bad++;
+		}
+	}
+
+	return bad;
+}
+
+static void check(fz_context *ctx)
+{
+	size_t before = mem_current;
+	fz_buffer *buf = NULL;
+	pdf_document *heap = NULL;
+	pdf_document *arena = NULL;
+	pdf_obj **a = NULL;
+	pdf_obj **b = NULL;
+	int i, k, n = 0, bad = 0;
+
+	fz_var(buf);
+	fz_var(heap);
+	fz_var(arena);
+	fz_var(a);
+	fz_var(b);
+	fz_var(n);
+
+	fz_try(ctx)
+	{
+		buf = make_file(ctx, 3000);
+		heap = open_pdf(ctx, buf, 0);
+		arena = open_pdf(ctx, buf, 1);
+
+		n = pdf_xref_len(ctx, heap);
+		if (n != pdf_xref_len(ctx, arena))
+			fz_throw(ctx, FZ_ERROR_GENERIC, "xref lengths differ");
+		a = fz_calloc(ctx, n, sizeof *a);
+		b = fz_calloc(ctx, n, sizeof *b);
+
+		for (i = 1; i < n; i++)
+		{
+			a[i] = pdf_load_object(ctx, heap, i);
+			b[i] = pdf_load_object(ctx, arena, i);
+			if (pdf_is_stream(ctx, a[i]) && !pdf_objcmp(ctx, a[i], b[i]))
+			{
+				fz_buffer *sa = pdf_load_stream_number(ctx, heap, i);
+				fz_buffer *sb = pdf_load_stream_number(ctx, arena, i);
+				if (sa->len != sb->len || memcmp(sa->data, sb->data, sa->len))
+				{
+					fprintf(stderr, "stream %d differs\n", i);
+					bad++;
+				}
+				fz_drop_buffer(ctx, sa);
+				fz_drop_buffer(ctx, sb);
+			}
+		}
+		if (!arena->obj_arena)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "the objects were not loaded into arenas");
+		bad += compare(ctx, a, b, n, "as loaded");
+
+		/* Edit each object a few times, so that items loaded into
+		 * an arena move to the heap and are edited there. */
+		for (k = 0; k < 3; k++)
+		{
+			for (i = 1; i < n; i++)
+			{
+				unsigned int r = rnd();
+				edit(ctx, a[i], r, 0);
+				edit(ctx, b[i], r, 0);
+			}
+			bad += compare(ctx, a, b, n, "after editing");
+		}
+
+		/* The objects outlive the documents, and the arenas outlive
+		 * the documents until the last object in them is dropped. */
+		pdf_drop_document(ctx, heap);
+		heap = NULL;
+		pdf_drop_document(ctx, arena);
+		arena = NULL;
+		bad += compare(ctx, a, b, n, "after the documents are dropped");
+
+		if (bad)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "objects loaded into arenas are not the same");
+	}
+	fz_always(ctx)
+	{
+		/* Drop every other object first, so that each arena is
+		 * freed by the last of its objects wherever that is. */
+		for (k = 0; k < 2; k++)
+		{
+			for (i = k; i < n; i += 2)
+			{
+				pdf_drop_obj(ctx, a ? a[i] : NULL);
+				pdf_drop_obj(ctx, b ? b[i] : NULL);
+			}
+		}
+		fz_free(ctx, a);
+		fz_free(ctx, b);
+		pdf_drop_document(ctx, heap);
+		pdf_drop_document(ctx, arena);
+		fz_drop_buffer(ctx, buf);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	if (mem_current != before)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "%zu bytes were not freed", mem_current - before);
+}
+
+static void bench(fz_context *ctx, int arenas)
+{
+	const char *what = arenas ? "arenas" : "heap";
+	fz_buffer *buf = NULL;
+	pdf_document *doc = NULL;
+	struct rusage usage;
+	size_t count;
+	int i, n;
+	double t;
+
+	fz_var(buf);
+	fz_var(doc);
+
+	fz_try(ctx)
+	{
+		buf = make_file(ctx, 200000);
+		doc = open_pdf(ctx, buf, arenas);
+		n = pdf_xref_len(ctx, doc);
+
+		count = mem_count;
+		t = now();
+		for (i = 1; i < n; i++)
+			pdf_drop_obj(ctx, pdf_load_object(ctx, doc, i));
+		t = now() - t;
+		getrusage(RUSAGE_SELF, &usage);
+		printf("%-6s %d objects loaded in %.2f s, %.2fM allocations, %ld MB peak RSS with a %zu MB file\n", what, n - 1,
+			t, (mem_count - count) / 1e6, (long)usage.ru_maxrss / 1024, buf->len >> 20);
+
+		t = now();
+		pdf_drop_document(ctx, doc);
+		doc = NULL;
+		printf("%-6s dropped in %.2f s\n", what, now() - t);
+	}
+	fz_always(ctx)
+	{
+		pdf_drop_document(ctx, doc);
+		fz_drop_buffer(ctx, buf);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+int main(int argc, char **argv)
+{
+	int bench_mode = is_bench(argc, argv);
+	fz_context *ctx = new_test_context(bench_mode ? &calls : &counted, FZ_STORE_DEFAULT);
+	int ret = 0;
+
+	fz_try(ctx)
+	{
+		if (bench_mode)
+			bench(ctx, argc > 2 && !strcmp(argv[2], "arenas"));
+		else
+			check(ctx);
+	}
+	fz_catch(ctx)
+	{
+		fprintf(stderr, "arena-test: %s\n", fz_caught_message(ctx));
+		ret = 1;
+	}
+
+	fz_drop_context(ctx);
+	return ret;
+}
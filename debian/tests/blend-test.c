@@ -0,0 +1,172 @@
+/*
+ * Draw groups in every blend mode, isolated or not and knockout or not,
+ * on gray, rgb and cmyk pixmaps of many widths with and without alpha,
+ * and print a digest of each result. The output must be the same
+ * whichever SIMD code is used (see FZ_SIMD in the Makefile).
+ *
+ * With -b, time each blend mode on a large page instead.
+ */
+
+#include "mupdf/fitz.h"
+
+#include "test-util.h"
+
+/* Random samples, with no color more than its alpha. Some pixels are
+ * left clear or opaque, as these have cases of their own. */
+static void fill_pixmap(fz_context *ctx, fz_pixmap *pix)
+{
+	unsigned char *s = fz_pixmap_samples(ctx, pix);
+	int n = fz_pixmap_components(ctx, pix);
+	int alpha = fz_pixmap_alpha(ctx, pix);
+	size_t i, len = (size_t)fz_pixmap_stride(ctx, pix) * fz_pixmap_height(ctx, pix);
+	int k;
+
+	for (i = 0; i < len; i++)
+		s[i] = rnd();
+	if (alpha)
+	{
+		for (i = 0; i < len; i += n)
+		{
+			switch (rnd() % 4)
+			{
+			case 0: s[i + n - 1] = 0; break;
+			case 1: s[i + n - 1] = 255; break;
+			}
+			for (k = 0; k < n - 1; k++)
+				if (s[i + k] > s[i + n - 1])
+					s[i + k] = s[i + n - 1];
+		}
+	}
+}
+
+static void fill(fz_context *ctx, fz_device *dev, fz_colorspace *cs, int w, int h, float alpha)
+{
+	fz_path *path = fz_new_path(ctx);
+	float color[FZ_MAX_COLORS];
+	float x, y;
+	int i;
+
+	for (i = 0; i < fz_colorspace_n(ctx, cs); i++)
+		color[i] = rndf(1);
+
+	fz_try(ctx)
+	{
+		x = rndf(w);
+		y = rndf(h);
+		fz_moveto(ctx, path, x, y);
+		for (i = 0; i < 5; i++)
+		{
+			x = rndf(w);
+			y = rndf(h);
+			fz_lineto(ctx, path, x, y);
+		}
+		fz_closepath(ctx, path);
+		fz_fill_path(ctx, dev, path, 0, fz_identity, cs, color, alpha, fz_default_color_params);
+	}
+	fz_always(ctx)
+		fz_drop_path(ctx, path);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+static void draw(fz_context *ctx, fz_pixmap *pix, int blendmode, int isolated, int knockout, int shapes)
+{
+	fz_colorspace *cs = fz_pixmap_colorspace(ctx, pix);
+	int w = fz_pixmap_width(ctx, pix);
+	int h = fz_pixmap_height(ctx, pix);
+	fz_rect area = fz_make_rect(0, 0, w, h);
+	fz_device *dev = fz_new_draw_device(ctx, fz_identity, pix);
+	int i;
+
+	fz_try(ctx)
+	{
+		fz_begin_group(ctx, dev, area, NULL, isolated, knockout, blendmode, 1);
+		for (i = 0; i < shapes; i++)
+			fill(ctx, dev, cs, w, h, i & 1 ? 0.6f : 1);
+		fz_end_group(ctx, dev);
+
+		fz_begin_group(ctx, dev, area, NULL, isolated, knockout, blendmode, 0.7f);
+		for (i = 0; i < shapes; i++)
+			fill(ctx, dev, cs, w, h, 1);
+		fz_end_group(ctx, dev);
+
+		fz_close_device(ctx, dev);
+	}
+	fz_always(ctx)
+		fz_drop_device(ctx, dev);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+static void check(fz_context *ctx)
+{
+	static const int widths[] = { 1, 5, 16, 17, 40, 99 };
+	fz_colorspace *spaces[] = { fz_device_gray(ctx), fz_device_rgb(ctx), fz_device_cmyk(ctx) };
+	int c, alpha, i, mode, group;
+
+	for (c = 0; c < 3; c++)
+	{
+		for (alpha = 0; alpha <= 1; alpha++)
+		{
+			for (i = 0; i < (int)nelem(widths); i++)
+			{
+				for (mode = 0; mode < FZ_BLEND_MODEMASK + 1; mode++)
+				{
+					for (group = 0; group < 4; group++)
+					{
+						fz_pixmap *pix = fz_new_pixmap(ctx, spaces[c], widths[i], 12, NULL, alpha);
+						fz_try(ctx)
+						{
+							fill_pixmap(ctx, pix);
+							draw(ctx, pix, mode, group & 1, group >> 1, 3);
+							printf("%s alpha %d width %2d %-10s isolated %d knockout %d:",
+								fz_colorspace_name(ctx, spaces[c]), alpha, widths[i],
+								fz_blendmode_name(mode), group & 1, group >> 1);
+							print_pixmap_digest(ctx, pix);
+						}
+						fz_always(ctx)
+							fz_drop_pixmap(ctx, pix);
+						fz_catch(ctx)
+							fz_rethrow(ctx);
+					}
+				}
+			}
+		}
+	}
+}
+
+static void bench(fz_context *ctx)
+{
+	fz_colorspace *spaces[] = { fz_device_gray(ctx), fz_device_rgb(ctx), fz_device_cmyk(ctx) };
+	int c, mode, isolated;
+
+	for (c = 0; c < 3; c++)
+	{
+		for (isolated = 1; isolated >= 0; isolated--)
+		{
+			for (mode = 0; mode < FZ_BLEND_MODEMASK + 1; mode++)
+			{
+				fz_pixmap *pix = fz_new_pixmap(ctx, spaces[c], 1275, 1650, NULL, 0);
+				double t;
+				fz_try(ctx)
+				{
+					fz_clear_pixmap_with_value(ctx, pix, 255);
+					t = now();
+					draw(ctx, pix, mode, isolated, 0, 4);
+					t = now() - t;
+					printf("%-10s %-12s %-10s %6.1f ms\n", fz_colorspace_name(ctx, spaces[c]),
+						isolated ? "isolated" : "non-isolated", fz_blendmode_name(mode), t * 1000);
+				}
+				fz_always(ctx)
+					fz_drop_pixmap(ctx, pix);
+				fz_catch(ctx)
+					fz_rethrow(ctx);
+			}
+		}
+	}
+}
+
+int main(int argc, char **argv)
+{
+	return test_main("blend-test", argc, argv, 0, check, bench);
+}
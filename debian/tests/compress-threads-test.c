@@ -0,0 +1,242 @@
+/*
+ * Save documents with their streams compressed on several threads
+ * (compress_threads, or -T in mutool clean), and check that every
+ * save gives the same bytes as one that compresses on this thread.
+ * The streams are a mix of sizes, of content that compresses well and
+ * content that does not, of images (bitmaps among them, which are
+ * compressed differently) and fonts, and of streams that are already
+ * compressed, one of them badly. Each document is saved as made, and
+ * again after it has been written out uncompressed and read back, so
+ * that its streams come from a file.
+ */
+
+#include "mupdf/fitz.h"
+#include "mupdf/pdf.h"
+
+#include "test-util.h"
+
+#define STREAMS 120
+
+static void add_stream(fz_context *ctx, pdf_document *doc, pdf_obj *list, int i)
+{
+	pdf_obj *dict = pdf_new_dict(ctx, doc, 4);
+	pdf_obj *ref = NULL;
+	fz_buffer *buf = NULL, *deflated = NULL;
+	int compressed = 0;
+	int k, n;
+
+	fz_var(ref);
+	fz_var(buf);
+	fz_var(deflated);
+
+	fz_try(ctx)
+	{
+		/* Mostly small, with a few of up to half a megabyte. */
+		n = rnd() % 8 == 0 ? rnd() % (1 << 19) : rnd() % 4000;
+		buf = fz_new_buffer(ctx, n + 1);
+		switch (i % 6)
+		{
+		case 0:
+			/* Content streams. */
+			while (buf->len < (size_t)n)
+				fz_append_printf(ctx, buf, "q %d 0 0 %d %d %d cm /Im%d Do Q\n", rnd() % 100, rnd() % 100, rnd() % 600, rnd() % 800, rnd() % 10);
+			break;
+		case 1:
+			/* Noise, which deflate cannot make any smaller. */
+			for (k = 0; k < n; k++)
+				fz_append_byte(ctx, buf, rnd());
+			break;
+		case 2:
+			/* A 1 bit image, written with CCITT fax compression. */
+			pdf_dict_put(ctx, dict, PDF_NAME(Subtype), PDF_NAME(Image));
+			pdf_dict_put_int(ctx, dict, PDF_NAME(Width), 64 + i);
+			pdf_dict_put_int(ctx, dict, PDF_NAME(Height), 40);
+			pdf_dict_put_int(ctx, dict, PDF_NAME(BitsPerComponent), 1);
+			pdf_dict_put(ctx, dict, PDF_NAME(ColorSpace), PDF_NAME(DeviceGray));
+			for (k = 0; k < (64 + i + 7) / 8 * 40; k++)
+				fz_append_byte(ctx, buf, k % 7 == 0 ? rnd() : 0xff);
+			break;
+		case 3:
+			/* An RGB image. */
+			pdf_dict_put(ctx, dict, PDF_NAME(Subtype), PDF_NAME(Image));
+			pdf_dict_put_int(ctx, dict, PDF_NAME(Width), 32);
+			pdf_dict_put_int(ctx, dict, PDF_NAME(Height), n / 96 + 1);
+			pdf_dict_put_int(ctx, dict, PDF_NAME(BitsPerComponent), 8);
+			pdf_dict_put(ctx, dict, PDF_NAME(ColorSpace), PDF_NAME(DeviceRGB));
+			for (k = 0; k < (n / 96 + 1) * 96; k++)
+				fz_append_byte(ctx, buf, k / 96 * 3 + rnd() % 4);
+			break;
+		case 4:
+			/* Already deflated (or, once in a while, corrupt). */
+			while (buf->len < (size_t)n)
+				fz_append_printf(ctx, buf, "BT /F1 12 Tf %d %d Td (%d) Tj ET\n", rnd() % 600, rnd() % 800, rnd());
+			if (i != 4)
+			{
+				deflated = fz_new_buffer(ctx, fz_deflate_bound(ctx, buf->len));
+				deflated->len = deflated->cap;
+				fz_deflate(ctx, deflated->data, &deflated->len, buf->data, buf->len, FZ_DEFLATE_DEFAULT);
+				fz_drop_buffer(ctx, buf);
+				buf = deflated;
+				deflated = NULL;
+			}
+			pdf_dict_put(ctx, dict, PDF_NAME(Filter), PDF_NAME(FlateDecode));
+			compressed = 1;
+			break;
+		case 5:
+			/* A font program (with any bytes, as nothing reads it). */
+			for (k = 0; k < n; k++)
+				fz_append_byte(ctx, buf, k % 16 == 0 ? rnd() : k % 11);
+			pdf_dict_put_int(ctx, dict, PDF_NAME(Length1), n);
+			ref = pdf_new_dict(ctx, doc, 2);
+			pdf_dict_put(ctx, ref, PDF_NAME(Type), PDF_NAME(FontDescriptor));
+			pdf_array_push(ctx, list, ref);
+			pdf_drop_obj(ctx, ref);
+			ref = NULL;
+			break;
+		}
+
+		ref = pdf_add_stream(ctx, doc, buf, dict, compressed);
+		if (i % 6 == 5)
+			pdf_dict_put(ctx, pdf_array_get(ctx, list, pdf_array_len(ctx, list) - 1), PDF_NAME(FontFile2), ref);
+		else
+			pdf_array_push(ctx, list, ref);
+	}
+	fz_always(ctx)
+	{
+		pdf_drop_obj(ctx, ref);
+		fz_drop_buffer(ctx, deflated);
+		fz_drop_buffer(ctx, buf);
+		pdf_drop_obj(ctx, dict);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+/* A document with the streams listed in the catalog, so that garbage
+ * collection keeps them. */
+static pdf_document *make_document(fz_context *ctx)
+{
+	pdf_document *doc = pdf_create_document(ctx);
+	pdf_obj *list;
+	int i;
+
+	fz_try(ctx)
+	{
+		list = pdf_new_array(ctx, doc, STREAMS);
+		pdf_dict_puts_drop(ctx, pdf_dict_get(ctx, pdf_trailer(ctx, doc), PDF_NAME(Root)), "Test", list);
+		for (i = 0; i < STREAMS; i++)
+			add_stream(ctx, doc, list, i);
+	}
+	fz_catch(ctx)
+	{
+		pdf_drop_document(ctx, doc);
+		fz_rethrow(ctx);
+	}
+	return doc;
+}
+
+static fz_buffer *save(fz_context *ctx, pdf_document *doc, const char *options, int threads)
+{
+	pdf_write_options opts;
+	fz_buffer *buf = fz_new_buffer(ctx, 1 << 20);
+	fz_output *out = NULL;
+
+	fz_var(out);
+
+	fz_try(ctx)
+	{
+		pdf_parse_write_options(ctx, &opts, options);
+		opts.compress_threads = threads;
+		out = fz_new_output_with_buffer(ctx, buf);
+		pdf_write_document(ctx, doc, out, &opts);
+		fz_close_output(ctx, out);
+	}
+	fz_always(ctx)
+		fz_drop_output(ctx, out);
+	fz_catch(ctx)
+	{
+		fz_drop_buffer(ctx, buf);
+		fz_rethrow(ctx);
+	}
+	return buf;
+}
+
+static void check_document(fz_context *ctx, pdf_document *doc, const char *what)
+{
+	static const char *options[] = {
+		"compress",
+		"compress,garbage=deduplicate,objstms",
+		"decompress,compress-images,compress-fonts",
+		"compress,ascii",
+		"compress,decompress",
+	};
+	static const int threads[] = { 1, 2, 3, 8, 64 };
+	fz_buffer *expect = NULL;
+	fz_buffer *buf = NULL;
+	int i, k;
+
+	fz_var(expect);
+	fz_var(buf);
+
+	fz_try(ctx)
+	{
+		for (i = 0; i < (int)nelem(options); i++)
+		{
+			expect = save(ctx, doc, options[i], 0);
+			for (k = 0; k < (int)nelem(threads); k++)
+			{
+				buf = save(ctx, doc, options[i], threads[k]);
+				if (buf->len != expect->len || memcmp(buf->data, expect->data, buf->len))
+					fz_throw(ctx, FZ_ERROR_GENERIC, "%s, %s: %d threads changed the file", what, options[i], threads[k]);
+				fz_drop_buffer(ctx, buf);
+				buf = NULL;
+			}
+			printf("%s, %s: %zu bytes\n", what, options[i], expect->len);
+			fz_drop_buffer(ctx, expect);
+			expect = NULL;
+		}
+	}
+	fz_always(ctx)
+	{
+		fz_drop_buffer(ctx, buf);
+		fz_drop_buffer(ctx, expect);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+static void check(fz_context *ctx)
+{
+	pdf_document *doc = make_document(ctx);
+	pdf_document *loaded = NULL;
+	fz_buffer *buf = NULL;
+	fz_stream *stm = NULL;
+
+	fz_var(loaded);
+	fz_var(buf);
+	fz_var(stm);
+
+	fz_try(ctx)
+	{
+		check_document(ctx, doc, "made");
+
+		buf = save(ctx, doc, "", 0);
+		stm = fz_open_buffer(ctx, buf);
+		loaded = pdf_open_document_with_stream(ctx, stm);
+		check_document(ctx, loaded, "loaded");
+	}
+	fz_always(ctx)
+	{
+		pdf_drop_document(ctx, loaded);
+		fz_drop_stream(ctx, stm);
+		fz_drop_buffer(ctx, buf);
+		pdf_drop_document(ctx, doc);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+int main(int argc, char **argv)
+{
+	return test_main("compress-threads-test", argc, argv, 1, check, NULL);
+}
@@ -0,0 +1,345 @@
+/*
+ * Make a document with many objects that are equal or nearly equal
+ * (differing in one string byte, a number's kind, the length of an
+ * array, an indirect reference, or a stream's contents), save it with
+ * garbage collection, and check that the objects that were merged are
+ * exactly the ones that pdf_objcmp (and, for streams, a comparison of
+ * the contents) says are equal. Streams are only merged at garbage
+ * level 4, so level 3 must keep them all apart.
+ *
+ * With -b, time saving a document of 500000 objects, a third of them
+ * duplicates, at garbage level 2 (which does not look for duplicates)
+ * and at levels 3 and 4 (which do).
+ */
+
+#include "mupdf/fitz.h"
+#include "mupdf/pdf.h"
+
+#include "test-util.h"
+
+#define OBJECTS 600
+
+static int nums[OBJECTS];
+static int is_stream[OBJECTS];
+static int classes[OBJECTS];
+
+static pdf_obj *make_value(fz_context *ctx, pdf_document *doc, int depth)
+{
+	static const char *names[] = { "A", "B" };
+	static const char *strings[] = { "", "a", "ab", "ac" };
+	static const float reals[] = { 0.0f, -0.0f, 0.5f, 1.0f };
+	pdf_obj *obj;
+	int i, n;
+
+	switch (rnd() % (depth < 2 ? 9 : 7))
+	{
+	default:
+	case 0: return pdf_new_int(ctx, rnd() % 3);
+	case 1: return pdf_new_real(ctx, reals[rnd() % nelem(reals)]);
+	case 2: return pdf_new_name(ctx, names[rnd() % nelem(names)]);
+	case 3:
+		i = rnd() % nelem(strings);
+		return pdf_new_string(ctx, strings[i], strlen(strings[i]));
+	case 4: return pdf_new_indirect(ctx, doc, nums[rnd() % 4], 0);
+	case 5: return rnd() & 1 ? PDF_TRUE : PDF_NULL;
+	case 6: return pdf_new_name(ctx, "Type");
+	case 7:
+		n = rnd() % 3;
+		obj = pdf_new_array(ctx, doc, n);
+		for (i = 0; i < n; i++)
+			pdf_array_push_drop(ctx, obj, make_value(ctx, doc, depth + 1));
+		return obj;
+	case 8:
+		n = rnd() % 3;
+		obj = pdf_new_dict(ctx, doc, n);
+		for (i = 0; i < n; i++)
+			pdf_dict_put_drop(ctx, obj, pdf_new_name(ctx, names[rnd() % nelem(names)]), make_value(ctx, doc, depth + 1));
+		return obj;
+	}
+}
+
+/* Add the objects, and a /Test array in the catalog that uses them all. */
+static void make_objects(fz_context *ctx, pdf_document *doc)
+{
+	static const char *contents[] = { "", "q Q", "q Q " };
+	pdf_obj *test, *obj = NULL, *ref = NULL;
+	fz_buffer *buf = NULL;
+	int i;
+
+	fz_var(obj);
+	fz_var(ref);
+	fz_var(buf);
+
+	test = pdf_new_array(ctx, doc, OBJECTS);
+	pdf_dict_puts_drop(ctx, pdf_dict_get(ctx, pdf_trailer(ctx, doc), PDF_NAME(Root)), "Test", test);
+	fz_try(ctx)
+	{
+		for (i = 0; i < OBJECTS; i++)
+		{
+			/* The first few are simple, so others can refer to them. */
+			obj = i < 4 ? pdf_new_int(ctx, i % 2) : make_value(ctx, doc, 0);
+			is_stream[i] = i >= 4 && rnd() % 4 == 0;
+			if (is_stream[i])
+			{
+				if (!pdf_is_dict(ctx, obj))
+				{
+					pdf_drop_obj(ctx, obj);
+					obj = NULL;
+					obj = pdf_new_dict(ctx, doc, 1);
+				}
+				buf = fz_new_buffer(ctx, 16);
+				fz_append_string(ctx, buf, contents[rnd() % nelem(contents)]);
+				ref = pdf_add_stream(ctx, doc, buf, obj, 0);
+				fz_drop_buffer(ctx, buf);
+				buf = NULL;
+			}
+			else
+				ref = pdf_add_object(ctx, doc, obj);
+			pdf_drop_obj(ctx, obj);
+			obj = NULL;
+			nums[i] = pdf_to_num(ctx, ref);
+			pdf_array_push_drop(ctx, test, ref);
+			ref = NULL;
+		}
+	}
+	fz_always(ctx)
+	{
+		fz_drop_buffer(ctx, buf);
+		pdf_drop_obj(ctx, ref);
+		pdf_drop_obj(ctx, obj);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+static int same_stream(fz_context *ctx, pdf_document *doc, int a, int b)
+{
+	fz_buffer *sa = pdf_load_raw_stream_number(ctx, doc, a);
+	fz_buffer *sb = NULL;
+	int same = 0;
+
+	fz_try(ctx)
+	{
+		sb = pdf_load_raw_stream_number(ctx, doc, b);
+		same = sa->len == sb->len && !memcmp(sa->data, sb->data, sa->len);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_buffer(ctx, sa);
+		fz_drop_buffer(ctx, sb);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+	return same;
+}
+
+/* Put the objects into classes of ones that should be merged. */
+static int find_classes(fz_context *ctx, pdf_document *doc, int streams)
+{
+	int i, j, count = 0;
+
+	for (i = 0; i < OBJECTS; i++)
+	{
+		pdf_obj *a = pdf_load_object(ctx, doc, nums[i]);
+		classes[i] = count;
+		for (j = 0; j < i; j++)
+		{
+			pdf_obj *b;
+			int same;
+
+			if (is_stream[i] != is_stream[j] || (is_stream[i] && !streams))
+				continue;
+			b = pdf_load_object(ctx, doc, nums[j]);
+			same = !pdf_objcmp(ctx, a, b);
+			pdf_drop_obj(ctx, b);
+			if (same && is_stream[i])
+				same = same_stream(ctx, doc, nums[i], nums[j]);
+			if (same)
+			{
+				classes[i] = classes[j];
+				break;
+			}
+		}
+		pdf_drop_obj(ctx, a);
+		if (classes[i] == count)
+			count++;
+	}
+	return count;
+}
+
+/* Saving renumbers the objects in the document, so each level starts
+ * with a new one. */
+static void check_garbage(fz_context *ctx, int garbage)
+{
+	pdf_write_options opts = pdf_default_write_options;
+	pdf_document *doc = pdf_create_document(ctx);
+	fz_buffer *buf = NULL;
+	fz_output *out = NULL;
+	fz_stream *stm = NULL;
+	pdf_document *saved = NULL;
+	pdf_obj *test;
+	int *first = NULL;
+	int i, count, merged = 0;
+
+	fz_var(buf);
+	fz_var(out);
+	fz_var(stm);
+	fz_var(saved);
+	fz_var(first);
+
+	fz_try(ctx)
+	{
+		seed = 1;
+		make_objects(ctx, doc);
+		count = find_classes(ctx, doc, garbage >= 4);
+
+		opts.do_garbage = garbage;
+		buf = fz_new_buffer(ctx, 1 << 16);
+		out = fz_new_output_with_buffer(ctx, buf);
+		pdf_write_document(ctx, doc, out, &opts);
+		fz_close_output(ctx, out);
+
+		stm = fz_open_buffer(ctx, buf);
+		saved = pdf_open_document_with_stream(ctx, stm);
+		test = pdf_dict_getp(ctx, pdf_trailer(ctx, saved), "Root/Test");
+		if (pdf_array_len(ctx, test) != OBJECTS)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "garbage=%d: lost the test array", garbage);
+
+		/* Objects must share a number exactly when they are in the
+		 * same class. */
+		first = fz_calloc(ctx, pdf_xref_len(ctx, saved), sizeof *first);
+		for (i = 0; i < OBJECTS; i++)
+		{
+			int num = pdf_to_num(ctx, pdf_array_get(ctx, test, i));
+			int j = first[num] - 1;
+			if (j < 0)
+				first[num] = i + 1;
+			else
+			{
+				if (classes[j] != classes[i])
+					fz_throw(ctx, FZ_ERROR_GENERIC, "garbage=%d: objects %d and %d were merged", garbage, nums[j], nums[i]);
+				merged++;
+			}
+		}
+		if (OBJECTS - merged != count)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "garbage=%d: %d objects left, expected %d", garbage, OBJECTS - merged, count);
+		printf("garbage=%d: %d objects merged into %d\n", garbage, OBJECTS, count);
+	}
+	fz_always(ctx)
+	{
+		fz_free(ctx, first);
+		pdf_drop_document(ctx, saved);
+		fz_drop_stream(ctx, stm);
+		fz_drop_output(ctx, out);
+		fz_drop_buffer(ctx, buf);
+		pdf_drop_document(ctx, doc);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+static void check(fz_context *ctx)
+{
+	check_garbage(ctx, 3);
+	check_garbage(ctx, 4);
+}
+
+#define BENCH_OBJECTS 500000
+
+/* Fonts, images and the like as a generator might write them, with one
+ * in three repeating one of the others. */
+static void make_bench_objects(fz_context *ctx, pdf_document *doc)
+{
+	pdf_obj *test, *obj = NULL, *ref = NULL;
+	fz_buffer *buf = NULL;
+	int i;
+
+	fz_var(obj);
+	fz_var(ref);
+	fz_var(buf);
+
+	test = pdf_new_array(ctx, doc, BENCH_OBJECTS);
+	pdf_dict_puts_drop(ctx, pdf_dict_get(ctx, pdf_trailer(ctx, doc), PDF_NAME(Root)), "Test", test);
+	fz_try(ctx)
+	{
+		for (i = 0; i < BENCH_OBJECTS; i++)
+		{
+			int n = rnd() % 3 == 0 ? rnd() % (i + 1) : i;
+
+			obj = pdf_new_dict(ctx, doc, 4);
+			pdf_dict_put(ctx, obj, PDF_NAME(Type), n % 2 ? PDF_NAME(Font) : PDF_NAME(XObject));
+			pdf_dict_put_int(ctx, obj, PDF_NAME(Width), n % 1000);
+			pdf_dict_put_int(ctx, obj, PDF_NAME(Height), n / 1000);
+			pdf_dict_put_array(ctx, obj, PDF_NAME(BBox), 4);
+			pdf_array_push_real(ctx, pdf_dict_get(ctx, obj, PDF_NAME(BBox)), n % 7 / 2.0f);
+			if (n % 8 == 0)
+			{
+				buf = fz_new_buffer(ctx, 32);
+				fz_append_printf(ctx, buf, "q %d 0 0 %d 0 0 cm /Im Do Q", n % 1000, n / 1000);
+				ref = pdf_add_stream(ctx, doc, buf, obj, 0);
+				fz_drop_buffer(ctx, buf);
+				buf = NULL;
+			}
+			else
+				ref = pdf_add_object(ctx, doc, obj);
+			pdf_drop_obj(ctx, obj);
+			obj = NULL;
+			pdf_array_push_drop(ctx, test, ref);
+			ref = NULL;
+		}
+	}
+	fz_always(ctx)
+	{
+		fz_drop_buffer(ctx, buf);
+		pdf_drop_obj(ctx, ref);
+		pdf_drop_obj(ctx, obj);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+static void bench_garbage(fz_context *ctx, int garbage)
+{
+	pdf_write_options opts = pdf_default_write_options;
+	pdf_document *doc = pdf_create_document(ctx);
+	fz_buffer *buf = NULL;
+	fz_output *out = NULL;
+	double t;
+
+	fz_var(buf);
+	fz_var(out);
+
+	fz_try(ctx)
+	{
+		seed = 1;
+		make_bench_objects(ctx, doc);
+
+		opts.do_garbage = garbage;
+		buf = fz_new_buffer(ctx, 1 << 24);
+		out = fz_new_output_with_buffer(ctx, buf);
+		t = now();
+		pdf_write_document(ctx, doc, out, &opts);
+		fz_close_output(ctx, out);
+		printf("garbage=%d: %6.1f ms, %zu bytes\n", garbage, (now() - t) * 1000, buf->len);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_output(ctx, out);
+		fz_drop_buffer(ctx, buf);
+		pdf_drop_document(ctx, doc);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+static void bench(fz_context *ctx)
+{
+	bench_garbage(ctx, 2);
+	bench_garbage(ctx, 3);
+	bench_garbage(ctx, 4);
+}
+
+int main(int argc, char **argv)
+{
+	return test_main("dedup-test", argc, argv, 0, check, bench);
+}
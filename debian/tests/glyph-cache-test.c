@@ -0,0 +1,288 @@
+/*
+ * Draw a lot of text through a glyph cache that is far too small for
+ * it, so that every stripe of the cache fills up and evicts glyphs,
+ * and check that the result is the same as with a cache big enough to
+ * hold everything. The text is drawn twice, then on several threads at
+ * once, then again after the hash table has been grown. The cache
+ * statistics must show lookups that hit, evictions in every stripe,
+ * and no stripe over its share of the limit.
+ */
+
+#include "mupdf/fitz.h"
+
+#include "test-util.h"
+
+#define SMALL_CACHE (48 << 10)
+#define THREADS 4
+
+typedef struct
+{
+	size_t size, lookups, hits, evictions;
+	int stripes;
+	size_t stripe_size[FZ_GLYPH_CACHE_STRIPES];
+	size_t stripe_evictions[FZ_GLYPH_CACHE_STRIPES];
+} cache_stats;
+
+static void read_stats(fz_context *ctx, cache_stats *st)
+{
+	fz_buffer *buf = fz_new_buffer(ctx, 256);
+	fz_output *out = NULL;
+	const char *s;
+
+	fz_var(out);
+
+	memset(st, 0, sizeof *st);
+	fz_try(ctx)
+	{
+		out = fz_new_output_with_buffer(ctx, buf);
+		fz_dump_glyph_cache_stats(ctx, out);
+		fz_close_output(ctx, out);
+		s = fz_string_from_buffer(ctx, buf);
+		while (*s)
+		{
+			int i, count;
+			size_t bytes, evictions;
+			if (sscanf(s, "Glyph Cache Stripe %d: %zu bytes, %d glyphs, %zu evictions", &i, &bytes, &count, &evictions) == 4 && i < FZ_GLYPH_CACHE_STRIPES)
+			{
+				st->stripe_size[i] = bytes;
+				st->stripe_evictions[i] = evictions;
+				st->stripes++;
+			}
+			sscanf(s, "Glyph Cache Size: %zu", &st->size);
+			sscanf(s, "Glyph Cache Lookups: %zu (%zu hits)", &st->lookups, &st->hits);
+			sscanf(s, "Glyph Cache Evictions: %zu", &st->evictions);
+			s = strchr(s, '\n');
+			if (!s)
+				break;
+			s++;
+		}
+	}
+	fz_always(ctx)
+	{
+		fz_drop_output(ctx, out);
+		fz_drop_buffer(ctx, buf);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+/* Lines of text in four fonts at many sizes and subpixel positions.
+ * Each line uses a few characters many times, so some lookups hit
+ * even in a cache that is too small for the whole page. With last_only,
+ * just the last glyph of the page. */
+static fz_text *make_text(fz_context *ctx, int last_only)
+{
+	static const char *names[] = { "Times-Roman", "Helvetica-Bold", "Courier", "Times-Italic" };
+	fz_text *text = fz_new_text(ctx);
+	fz_font *font = NULL;
+	int f, line, i;
+
+	fz_var(font);
+
+	fz_try(ctx)
+	{
+		for (f = 0; f < (int)nelem(names); f++)
+		{
+			font = fz_new_base14_font(ctx, names[f]);
+			for (line = 0; line < 12; line++)
+			{
+				float size = 6 + line * 2.5f;
+				float x = 4 + line * 0.3f, y = 20 + f * 300 + line * 24;
+				for (i = 0; i < 60; i++)
+				{
+					int c = 33 + (i * 7 + line * 5 + f) % 24;
+					fz_matrix trm = fz_scale(size, -size);
+					trm.e = x;
+					trm.f = y;
+					x += size * 0.55f + (i % 4) * 0.125f;
+					if (last_only && (f < (int)nelem(names) - 1 || line < 11 || i < 59))
+						continue;
+					fz_show_glyph(ctx, text, font, trm, fz_encode_character(ctx, font, c), c, 0, 0, FZ_BIDI_LTR, FZ_LANG_UNSET);
+				}
+			}
+			fz_drop_font(ctx, font);
+			font = NULL;
+		}
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_font(ctx, font);
+		fz_drop_text(ctx, text);
+		fz_rethrow(ctx);
+	}
+	return text;
+}
+
+static void draw(fz_context *ctx, fz_text *text, unsigned char digest[16])
+{
+	fz_pixmap *pix = fz_new_pixmap(ctx, fz_device_gray(ctx), 1200, 1200, NULL, 0);
+	fz_device *dev = NULL;
+	float black = 0;
+
+	fz_var(dev);
+
+	fz_try(ctx)
+	{
+		fz_clear_pixmap_with_value(ctx, pix, 255);
+		dev = fz_new_draw_device(ctx, fz_identity, pix);
+		fz_fill_text(ctx, dev, text, fz_identity, fz_device_gray(ctx), &black, 1, fz_default_color_params);
+		fz_close_device(ctx, dev);
+		fz_md5_pixmap(ctx, pix, digest);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_device(ctx, dev);
+		fz_drop_pixmap(ctx, pix);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+typedef struct
+{
+	fz_context *ctx;
+	fz_text *text;
+	const unsigned char *expect;
+	int failed;
+} worker;
+
+static void *draw_worker(void *arg)
+{
+	worker *w = arg;
+	unsigned char digest[16];
+	int i;
+
+	fz_try(w->ctx)
+	{
+		for (i = 0; i < 3; i++)
+		{
+			draw(w->ctx, w->text, digest);
+			if (memcmp(digest, w->expect, 16))
+				w->failed = 1;
+		}
+	}
+	fz_catch(w->ctx)
+		w->failed = 1;
+	return NULL;
+}
+
+static void draw_on_threads(fz_context *ctx, fz_text *text, const unsigned char *expect)
+{
+	pthread_t thread[THREADS];
+	worker w[THREADS];
+	int i, failed = 0;
+
+	for (i = 0; i < THREADS; i++)
+	{
+		w[i].ctx = fz_clone_context(ctx);
+		w[i].text = text;
+		w[i].expect = expect;
+		w[i].failed = 0;
+		if (!w[i].ctx || pthread_create(&thread[i], NULL, draw_worker, &w[i]))
+			fz_throw(ctx, FZ_ERROR_GENERIC, "cannot start drawing thread");
+	}
+	for (i = 0; i < THREADS; i++)
+	{
+		pthread_join(thread[i], NULL);
+		fz_drop_context(w[i].ctx);
+		failed |= w[i].failed;
+	}
+	if (failed)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "text drawn on several threads was wrong");
+}
+
+static void check_stats(fz_context *ctx, const char *what)
+{
+	cache_stats st;
+	int i;
+
+	read_stats(ctx, &st);
+	printf("%s: %zu bytes, %zu lookups, %zu hits, %zu evictions\n", what, st.size, st.lookups, st.hits, st.evictions);
+	if (st.size > SMALL_CACHE)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "%s: cache holds %zu bytes", what, st.size);
+	if (st.hits == 0)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "%s: no lookups found a glyph", what);
+	if (st.stripes != FZ_GLYPH_CACHE_STRIPES)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "%s: cache has %d stripes", what, st.stripes);
+	for (i = 0; i < st.stripes; i++)
+	{
+		if (st.stripe_evictions[i] == 0)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "%s: stripe %d never filled up", what, i);
+		if (st.stripe_size[i] > SMALL_CACHE / st.stripes)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "%s: stripe %d holds %zu bytes", what, i, st.stripe_size[i]);
+	}
+}
+
+static void check(fz_context *ctx)
+{
+	fz_context *big = NULL;
+	fz_text *text = NULL, *last = NULL;
+	unsigned char expect[16], digest[16];
+	cache_stats st, after;
+
+	fz_var(big);
+	fz_var(text);
+	fz_var(last);
+
+	fz_try(ctx)
+	{
+		text = make_text(ctx, 0);
+		last = make_text(ctx, 1);
+
+		/* The expected result, from a cache that never evicts. */
+		big = fz_new_context(NULL, &test_locks, FZ_STORE_DEFAULT);
+		if (!big)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "cannot initialise context");
+		fz_set_glyph_cache_limits(big, 256 << 20, 0, 0);
+		draw(big, text, expect);
+		read_stats(big, &st);
+		if (st.evictions != 0)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "big cache evicted glyphs");
+
+		fz_set_glyph_cache_limits(ctx, SMALL_CACHE, 0, 0);
+		draw(ctx, text, digest);
+		if (memcmp(digest, expect, 16))
+			fz_throw(ctx, FZ_ERROR_GENERIC, "text drawn through a small cache was wrong");
+		draw(ctx, text, digest);
+		if (memcmp(digest, expect, 16))
+			fz_throw(ctx, FZ_ERROR_GENERIC, "text drawn again through a small cache was wrong");
+		check_stats(ctx, "small cache");
+
+		draw_on_threads(ctx, text, expect);
+		check_stats(ctx, "small cache on threads");
+
+		/* Rehash every stripe into more buckets; the glyphs in the
+		 * cache must still be found. The last glyph drawn is sure to
+		 * be there. */
+		draw(ctx, text, digest);
+		fz_set_glyph_cache_limits(ctx, 0, 0, 4001);
+		read_stats(ctx, &st);
+		draw(ctx, last, digest);
+		read_stats(ctx, &after);
+		if (after.lookups != st.lookups + 1 || after.hits != st.hits + 1)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "glyph was not found after growing the hash table");
+		draw(ctx, text, digest);
+		if (memcmp(digest, expect, 16))
+			fz_throw(ctx, FZ_ERROR_GENERIC, "text drawn after growing the hash table was wrong");
+		check_stats(ctx, "after growing the hash table");
+
+		/* Shrinking the limit evicts at once. */
+		fz_set_glyph_cache_limits(ctx, FZ_GLYPH_CACHE_STRIPES, 0, 0);
+		read_stats(ctx, &st);
+		if (st.size > FZ_GLYPH_CACHE_STRIPES)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "cache holds %zu bytes after shrinking", st.size);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_text(ctx, last);
+		fz_drop_text(ctx, text);
+		fz_drop_context(big);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+int main(int argc, char **argv)
+{
+	return test_main("glyph-cache-test", argc, argv, 0, check, NULL);
+}
@@ -0,0 +1,405 @@
+/*
+ * Deflate text, random bytes, runs and a mixture of them with zlib at
+ * every level, with each strategy (so there are stored, fixed and
+ * dynamic blocks, split by flushes) and both with and without the zlib
+ * header, and check that fz_inflate_data gives back exactly what went
+ * in. Then truncate them and flip bits in them: whenever
+ * fz_inflate_data returns anything, zlib must accept the same data and
+ * give the same bytes; otherwise it must return NULL so that the caller
+ * falls back to the flate filter. Last, put such streams in a PDF and
+ * check that pdf_load_stream gives what reading through the filters
+ * does, with and without a predictor.
+ *
+ * With -b, time fz_inflate_data against the flate filter and zlib.
+ */
+
+#include "mupdf/fitz.h"
+#include "mupdf/pdf.h"
+
+#include "test-util.h"
+
+#include <zlib.h>
+
+enum { TEXT, RANDOM, RUNS, MIXED, KINDS };
+
+static fz_buffer *make_corpus(fz_context *ctx, int kind, size_t len)
+{
+	static const char *words[] = { "m", "l", "c", "re", "f", "S", "q", "Q", "cm", "BT", "ET", "Tj" };
+	fz_buffer *buf = fz_new_buffer(ctx, len + 64);
+	size_t run;
+	int c;
+
+	while (buf->len < len)
+	{
+		int k = kind == MIXED ? rnd() % 3 : kind;
+		switch (k)
+		{
+		case TEXT:
+			fz_append_printf(ctx, buf, "%d %d %s\n", rnd() % 1000, rnd() % 100, words[rnd() % nelem(words)]);
+			break;
+		case RANDOM:
+			for (run = 0; run < 64; run++)
+				fz_append_byte(ctx, buf, rnd());
+			break;
+		case RUNS:
+			c = rnd() % 4 ? 255 : rnd();
+			for (run = 1 + rnd() % 300; run > 0; run--)
+				fz_append_byte(ctx, buf, c);
+			break;
+		}
+	}
+	buf->len = len;
+	return buf;
+}
+
+/* Deflate with zlib, flushing every so often if asked, which ends the
+ * block and may add an empty stored one. */
+static fz_buffer *deflate_data(fz_context *ctx, fz_buffer *in, int level, int strategy, int window_bits, int flush)
+{
+	fz_buffer *out = fz_new_buffer(ctx, deflateBound(NULL, in->len) + 1024 + in->len / 100);
+	z_stream z;
+	size_t done = 0;
+	int ret;
+
+	memset(&z, 0, sizeof z);
+	if (deflateInit2(&z, level, Z_DEFLATED, window_bits, 8, strategy) != Z_OK)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "deflateInit2 failed");
+	z.next_out = out->data;
+	z.avail_out = out->cap;
+	do
+	{
+		size_t n = flush ? fz_minz(in->len - done, 1 + rnd() % 20000) : in->len - done;
+		z.next_in = in->data + done;
+		z.avail_in = n;
+		done += n;
+		ret = deflate(&z, done < in->len ? flush : Z_FINISH);
+	}
+	while (done < in->len);
+	out->len = z.total_out;
+	deflateEnd(&z);
+	if (ret != Z_STREAM_END)
+	{
+		fz_drop_buffer(ctx, out);
+		fz_throw(ctx, FZ_ERROR_GENERIC, "deflate failed");
+	}
+	return out;
+}
+
+/* What zlib makes of the data: NULL unless it is a complete stream. */
+static fz_buffer *zlib_inflate(fz_context *ctx, const unsigned char *data, size_t len, int window_bits)
+{
+	fz_buffer *out = fz_new_buffer(ctx, 4096);
+	z_stream z;
+	int ret;
+
+	memset(&z, 0, sizeof z);
+	if (inflateInit2(&z, window_bits) != Z_OK)
+	{
+		fz_drop_buffer(ctx, out);
+		fz_throw(ctx, FZ_ERROR_GENERIC, "inflateInit2 failed");
+	}
+	z.next_in = (unsigned char *)data;
+	z.avail_in = len;
+	do
+	{
+		if (out->len == out->cap)
+			fz_resize_buffer(ctx, out, out->cap * 2);
+		z.next_out = out->data + out->len;
+		z.avail_out = out->cap - out->len;
+		ret = inflate(&z, Z_NO_FLUSH);
+		out->len = z.total_out;
+	}
+	while (ret == Z_OK && (z.avail_in > 0 || z.avail_out == 0));
+	inflateEnd(&z);
+	if (ret != Z_STREAM_END)
+	{
+		fz_drop_buffer(ctx, out);
+		return NULL;
+	}
+	return out;
+}
+
+static int same(fz_buffer *a, fz_buffer *b)
+{
+	return a->len == b->len && !memcmp(a->data, b->data, a->len);
+}
+
+/* fz_inflate_data must agree with zlib or give up. */
+static int check_damaged(fz_context *ctx, const unsigned char *data, size_t len, int window_bits, size_t initial)
+{
+	fz_buffer *ours = fz_inflate_data(ctx, data, len, window_bits, initial, 0);
+	fz_buffer *theirs = NULL;
+	int fail = 0;
+
+	if (ours)
+	{
+		theirs = zlib_inflate(ctx, data, len, window_bits);
+		fail = !theirs || !same(ours, theirs);
+	}
+	fz_drop_buffer(ctx, ours);
+	fz_drop_buffer(ctx, theirs);
+	return fail;
+}
+
+static int check_stream(fz_context *ctx, fz_buffer *in, fz_buffer *comp, int window_bits, const char *what)
+{
+	fz_buffer *out, *copy;
+	size_t initial = rnd() & 1 ? in->len : 0;
+	int i, fail = 0;
+
+	out = fz_inflate_data(ctx, comp->data, comp->len, window_bits, initial, 0);
+	if (!out || !same(out, in))
+	{
+		fprintf(stderr, "inflate-test: %s: %s\n", what, out ? "wrong data" : "rejected");
+		fz_drop_buffer(ctx, out);
+		return 1;
+	}
+	fz_drop_buffer(ctx, out);
+
+	/* Too big for the limit. */
+	if (in->len > 2048)
+	{
+		out = fz_inflate_data(ctx, comp->data, comp->len, window_bits, 0, in->len / 2);
+		if (out)
+		{
+			fprintf(stderr, "inflate-test: %s: inflated past the limit\n", what);
+			fz_drop_buffer(ctx, out);
+			return 1;
+		}
+	}
+
+	/* Truncated: everything but the last byte, the checksum, half. */
+	fail |= check_damaged(ctx, comp->data, comp->len - 1, window_bits, initial);
+	if (comp->len > 4)
+		fail |= check_damaged(ctx, comp->data, comp->len - 4, window_bits, initial);
+	fail |= check_damaged(ctx, comp->data, comp->len / 2, window_bits, initial);
+	fail |= check_damaged(ctx, comp->data, 1, window_bits, initial);
+
+	/* Corrupt: a bit flipped here and there. */
+	copy = fz_new_buffer_from_copied_data(ctx, comp->data, comp->len);
+	for (i = 0; i < 8 && !fail; i++)
+	{
+		size_t pos = i == 0 ? 0 : rnd() % comp->len;
+		unsigned char bit = 1 << (rnd() % 8);
+		copy->data[pos] ^= bit;
+		fail |= check_damaged(ctx, copy->data, copy->len, window_bits, initial);
+		copy->data[pos] ^= bit;
+	}
+	fz_drop_buffer(ctx, copy);
+
+	if (fail)
+		fprintf(stderr, "inflate-test: %s: damaged data was inflated differently from zlib\n", what);
+	return fail;
+}
+
+static void check_zlib(fz_context *ctx)
+{
+	static const size_t sizes[] = { 0, 1, 300, 70000, 300000 };
+	static const int strategies[] = { Z_DEFAULT_STRATEGY, Z_FIXED, Z_HUFFMAN_ONLY, Z_RLE, Z_FILTERED };
+	static const int windows[] = { 15, -15, 9, -9 };
+	static const int flushes[] = { Z_NO_FLUSH, Z_SYNC_FLUSH, Z_FULL_FLUSH, Z_BLOCK };
+	int kind, size, level, strategy, fail = 0, count = 0;
+
+	for (kind = 0; kind < KINDS; kind++)
+	for (size = 0; size < (int)nelem(sizes); size++)
+	{
+		fz_buffer *in = make_corpus(ctx, kind, sizes[size]);
+		fz_try(ctx)
+		{
+			for (level = 0; level <= 9; level++)
+			for (strategy = 0; strategy < (int)nelem(strategies); strategy++)
+			{
+				int window_bits = windows[rnd() % nelem(windows)];
+				int flush = flushes[rnd() % nelem(flushes)];
+				fz_buffer *comp;
+				char what[100];
+
+				/* The level makes no difference to these. */
+				if (strategy > 0 && (level == 0 || sizes[size] > 70000))
+					continue;
+
+				fz_snprintf(what, sizeof what, "kind %d, %zu bytes, level %d, strategy %d, window %d, flush %d",
+					kind, sizes[size], level, strategies[strategy], window_bits, flush);
+				comp = deflate_data(ctx, in, level, strategies[strategy], window_bits, flush);
+				fail |= check_stream(ctx, in, comp, window_bits, what);
+				fz_drop_buffer(ctx, comp);
+				count++;
+			}
+		}
+		fz_always(ctx)
+			fz_drop_buffer(ctx, in);
+		fz_catch(ctx)
+			fz_rethrow(ctx);
+	}
+
+	if (fail)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "fz_inflate_data disagrees with zlib");
+	printf("%d deflated streams checked\n", count);
+}
+
+/* What the flate (and predictor) filters make of the raw data. */
+static fz_buffer *read_filtered(fz_context *ctx, fz_buffer *raw, int predictor, int columns)
+{
+	fz_stream *stm = fz_open_buffer(ctx, raw);
+	fz_stream *flate = NULL, *pred = NULL;
+	fz_buffer *out = NULL;
+
+	fz_var(flate);
+	fz_var(pred);
+
+	fz_try(ctx)
+	{
+		flate = fz_open_flated(ctx, stm, 15);
+		if (predictor > 1)
+			pred = fz_open_predict(ctx, flate, predictor, columns, 1, 8);
+		out = fz_read_all(ctx, pred ? pred : flate, 0);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_stream(ctx, pred);
+		fz_drop_stream(ctx, flate);
+		fz_drop_stream(ctx, stm);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+	return out;
+}
+
+/* Whole, truncated and corrupt flate streams in a PDF must load the
+ * same as they read through the filters. */
+static void check_pdf(fz_context *ctx)
+{
+	pdf_document *doc = pdf_create_document(ctx);
+	fz_buffer *in = NULL, *comp = NULL, *expect = NULL, *got = NULL;
+	pdf_obj *dict = NULL, *ref = NULL;
+	int i, fail = 0;
+
+	fz_var(in);
+	fz_var(comp);
+	fz_var(expect);
+	fz_var(got);
+	fz_var(dict);
+	fz_var(ref);
+
+	fz_try(ctx)
+	{
+		for (i = 0; i < 60 && !fail; i++)
+		{
+			int predictor = i % 3 == 0 ? 12 : 1;
+			int columns = 1 + rnd() % 100;
+			size_t len = 1 + rnd() % 50000;
+
+			if (predictor > 1)
+				len -= len % (columns + 1);
+			in = make_corpus(ctx, i % KINDS, len);
+			if (predictor > 1)
+			{
+				size_t k;
+				for (k = 0; k < len; k += columns + 1)
+					in->data[k] = 2; /* Up */
+			}
+			comp = deflate_data(ctx, in, i % 10, Z_DEFAULT_STRATEGY, 15, Z_NO_FLUSH);
+			switch (i % 4)
+			{
+			case 1: comp->len -= 1 + rnd() % (comp->len / 2); break;
+			case 2: comp->data[rnd() % comp->len] ^= 1 << (rnd() % 8); break;
+			}
+
+			dict = pdf_new_dict(ctx, doc, 3);
+			pdf_dict_put(ctx, dict, PDF_NAME(Filter), PDF_NAME(FlateDecode));
+			pdf_dict_put_int(ctx, dict, PDF_NAME(Length), comp->len);
+			if (predictor > 1)
+			{
+				pdf_obj *parms = pdf_dict_put_dict(ctx, dict, PDF_NAME(DecodeParms), 2);
+				pdf_dict_put_int(ctx, parms, PDF_NAME(Predictor), predictor);
+				pdf_dict_put_int(ctx, parms, PDF_NAME(Columns), columns);
+			}
+			ref = pdf_add_stream(ctx, doc, comp, dict, 1);
+
+			expect = read_filtered(ctx, comp, predictor, columns);
+			got = pdf_load_stream(ctx, ref);
+			if (!same(expect, got))
+			{
+				fprintf(stderr, "inflate-test: stream %d loaded %zu bytes, filters read %zu\n", i, got->len, expect->len);
+				fail = 1;
+			}
+			if (i % 4 == 0 && predictor == 1 && !same(got, in))
+			{
+				fprintf(stderr, "inflate-test: stream %d was not loaded whole\n", i);
+				fail = 1;
+			}
+
+			fz_drop_buffer(ctx, got);
+			got = NULL;
+			fz_drop_buffer(ctx, expect);
+			expect = NULL;
+			pdf_drop_obj(ctx, ref);
+			ref = NULL;
+			pdf_drop_obj(ctx, dict);
+			dict = NULL;
+			fz_drop_buffer(ctx, comp);
+			comp = NULL;
+			fz_drop_buffer(ctx, in);
+			in = NULL;
+		}
+	}
+	fz_always(ctx)
+	{
+		fz_drop_buffer(ctx, got);
+		fz_drop_buffer(ctx, expect);
+		pdf_drop_obj(ctx, ref);
+		pdf_drop_obj(ctx, dict);
+		fz_drop_buffer(ctx, comp);
+		fz_drop_buffer(ctx, in);
+		pdf_drop_document(ctx, doc);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	if (fail)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "PDF streams loaded differently from the filters");
+}
+
+static void check(fz_context *ctx)
+{
+	check_zlib(ctx);
+	check_pdf(ctx);
+}
+
+static void bench(fz_context *ctx)
+{
+	static const char *names[] = { "text", "random", "runs", "mixed" };
+	int kind, level, i, loops = 20;
+
+	for (kind = 0; kind < KINDS; kind++)
+	for (level = 1; level <= 9; level += 4)
+	{
+		fz_buffer *in = make_corpus(ctx, kind, 4 << 20);
+		fz_buffer *comp = deflate_data(ctx, in, level, Z_DEFAULT_STRATEGY, 15, Z_NO_FLUSH);
+		double t0, t1, t2, t3;
+
+		t0 = now();
+		for (i = 0; i < loops; i++)
+			fz_drop_buffer(ctx, fz_inflate_data(ctx, comp->data, comp->len, 15, in->len, 0));
+		t1 = now();
+		for (i = 0; i < loops; i++)
+			fz_drop_buffer(ctx, read_filtered(ctx, comp, 1, 0));
+		t2 = now();
+		for (i = 0; i < loops; i++)
+			fz_drop_buffer(ctx, zlib_inflate(ctx, comp->data, comp->len, 15));
+		t3 = now();
+
+		printf("%-6s level %d: fz_inflate_data %6.0f MB/s, flate filter %6.0f MB/s, zlib %6.0f MB/s\n",
+			names[kind], level,
+			loops * 4 / (t1 - t0), loops * 4 / (t2 - t1), loops * 4 / (t3 - t2));
+
+		fz_drop_buffer(ctx, comp);
+		fz_drop_buffer(ctx, in);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	/* The filters complain about the damaged streams. */
+	return test_main("inflate-test", argc, argv, 1, check, bench);
+}
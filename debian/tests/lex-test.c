@@ -0,0 +1,361 @@
+/*
+ * Lex random mixes of PDF tokens, long names, strings, comments and
+ * runs of white space, and print a digest of the tokens of each. The
+ * tokens must be the same when the input comes in chunks of any size,
+ * and the output must be the same whichever SIMD code is used (see
+ * FZ_SIMD in the Makefile). Short real numbers must come out as fz_atof
+ * makes them.
+ *
+ * With -b, time lexing a megabyte of content streams and objects from
+ * memory and in 4k chunks instead.
+ */
+
+#include "mupdf/fitz.h"
+#include "mupdf/pdf.h"
+
+#include "test-util.h"
+
+/* A stream that hands out its data in chunks of random size up to max,
+ * so that tokens are split across the ends of the buffer. */
+typedef struct
+{
+	const unsigned char *data;
+	size_t len, pos;
+	int max;
+	unsigned int seed;
+	unsigned char buf[4096];
+} chunk_state;
+
+static int next_chunk(fz_context *ctx, fz_stream *stm, size_t max)
+{
+	chunk_state *state = stm->state;
+	size_t n;
+
+	if (state->pos >= state->len)
+		return EOF;
+
+	state->seed = state->seed * 1103515245 + 12345;
+	n = 1 + (state->seed >> 8) % state->max;
+	if (n > state->len - state->pos)
+		n = state->len - state->pos;
+	memcpy(state->buf, state->data + state->pos, n);
+	state->pos += n;
+
+	stm->rp = state->buf;
+	stm->wp = state->buf + n;
+	stm->pos += n;
+	return *stm->rp++;
+}
+
+static fz_stream *open_chunks(fz_context *ctx, const unsigned char *data, size_t len, int max)
+{
+	chunk_state *state = fz_malloc_struct(ctx, chunk_state);
+	state->data = data;
+	state->len = len;
+	state->max = fz_mini(max, sizeof state->buf);
+	state->seed = (unsigned int)len;
+	return fz_new_stream(ctx, state, next_chunk, fz_free);
+}
+
+/* Lex the whole stream, adding each token, its value and where it ends
+ * to a digest. */
+static void lex_digest(fz_context *ctx, fz_stream *stm, int no_string, unsigned char digest[16])
+{
+	fz_md5 md5;
+	pdf_lexbuf lb;
+	int tok;
+	int64_t pos;
+
+	fz_md5_init(&md5);
+	pdf_lexbuf_init(ctx, &lb, PDF_LEXBUF_SMALL);
+
+	fz_try(ctx)
+	{
+		do
+		{
+			fz_try(ctx)
+				tok = no_string ? pdf_lex_no_string(ctx, stm, &lb) : pdf_lex(ctx, stm, &lb);
+			fz_catch(ctx)
+				tok = -1;
+			pos = fz_tell(ctx, stm);
+			fz_md5_update(&md5, (unsigned char *)&tok, sizeof tok);
+			fz_md5_update(&md5, (unsigned char *)&pos, sizeof pos);
+			switch (tok)
+			{
+			case PDF_TOK_INT:
+				fz_md5_update(&md5, (unsigned char *)&lb.i, sizeof lb.i);
+				break;
+			case PDF_TOK_REAL:
+				fz_md5_update(&md5, (unsigned char *)&lb.f, sizeof lb.f);
+				break;
+			case PDF_TOK_NAME:
+			case PDF_TOK_STRING:
+				fz_md5_update(&md5, (unsigned char *)&lb.len, sizeof lb.len);
+				fz_md5_update(&md5, (unsigned char *)lb.scratch, lb.len);
+				break;
+			case PDF_TOK_KEYWORD:
+				fz_md5_update(&md5, (unsigned char *)lb.scratch, strlen(lb.scratch));
+				break;
+			}
+		}
+		while (tok != PDF_TOK_EOF && tok != -1);
+	}
+	fz_always(ctx)
+		pdf_lexbuf_fin(ctx, &lb);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	fz_md5_final(&md5, digest);
+}
+
+static const char *pieces[] = {
+	" ", "\n", "\r\n", "\t", "\f", "(", ")", "\\", "\\(", "\\)", "\\n", "\\1", "\\12",
+	"\\123", "\\\r\n", "<", ">", "<<", ">>", "[", "]", "{", "}", "/", "%", "#", "#4",
+	"#41", "#4g", "#00", "0", "1", "9", "123", "-", "--1", "+", ".", "1.5", "-.25",
+	"3.1415926", "abc", "Tj", "BT", "obj", "endstream", "R", "null", "true", "\xff", "\x80",
+	"<48656c6c6f20776f726c64>", "/Type/Page", "/ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnop",
+	"                                        ",
+	"%a comment that goes on for a long way, with (parens) and /names\n",
+	"(a string that is quite long, with no special characters in it at all)",
+	"(a string with \\(escapes\\) and (nested (parens)) and \\101\\102 octal)",
+};
+
+static size_t random_input(unsigned char *data, size_t size)
+{
+	size_t len = 0, n;
+	const char *s;
+	int i, count = rnd() % 400;
+
+	for (i = 0; i < count; i++)
+	{
+		/* Now and then a long run of one kind of character. */
+		if (rnd() % 40 == 0)
+		{
+			n = rnd() % 300;
+			while (n-- && len < size)
+				data[len++] = "aZ09 "[rnd() % 5];
+			continue;
+		}
+		if (rnd() % 200 == 0 && len < size)
+		{
+			data[len++] = 0;
+			continue;
+		}
+		s = pieces[rnd() % nelem(pieces)];
+		n = strlen(s);
+		if (len + n > size)
+			break;
+		memcpy(data + len, s, n);
+		len += n;
+	}
+
+	return len;
+}
+
+static void check_tokens(fz_context *ctx)
+{
+	static const int chunks[] = { 1, 3, 17, 4096 };
+	static unsigned char data[16384];
+	unsigned char da[16], db[16];
+	size_t len;
+	int i, k, no_string;
+	fz_stream *stm = NULL;
+
+	fz_var(stm);
+
+	fz_try(ctx)
+	{
+		for (i = 0; i < 500; i++)
+		{
+			len = random_input(data, sizeof data);
+			for (no_string = 0; no_string <= 1; no_string++)
+			{
+				stm = fz_open_memory(ctx, data, len);
+				lex_digest(ctx, stm, no_string, da);
+				fz_drop_stream(ctx, stm);
+				stm = NULL;
+
+				for (k = 0; k < (int)nelem(chunks); k++)
+				{
+					stm = open_chunks(ctx, data, len, chunks[k]);
+					lex_digest(ctx, stm, no_string, db);
+					fz_drop_stream(ctx, stm);
+					stm = NULL;
+					if (memcmp(da, db, 16))
+						fz_throw(ctx, FZ_ERROR_GENERIC, "input %d gives other tokens in chunks of %d", i, chunks[k]);
+				}
+
+				printf("input %d no_string %d:", i, no_string);
+				print_digest(da);
+			}
+		}
+	}
+	fz_always(ctx)
+		fz_drop_stream(ctx, stm);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+static void check_reals(fz_context *ctx)
+{
+	pdf_lexbuf lb;
+	char text[32];
+	fz_stream *stm = NULL;
+	int i, k, digits, dot, tok;
+	char *s;
+
+	fz_var(stm);
+
+	pdf_lexbuf_init(ctx, &lb, PDF_LEXBUF_SMALL);
+
+	fz_try(ctx)
+	{
+		for (i = 0; i < 100000; i++)
+		{
+			s = text;
+			switch (rnd() % 3)
+			{
+			case 0: *s++ = '-'; break;
+			case 1: *s++ = '+'; break;
+			}
+			digits = 1 + rnd() % 7;
+			dot = rnd() % (digits + 1);
+			for (k = 0; k < digits; k++)
+			{
+				if (k == dot)
+					*s++ = '.';
+				*s++ = '0' + rnd() % 10;
+			}
+			if (dot == digits)
+				*s++ = '.';
+			*s = 0;
+
+			stm = fz_open_memory(ctx, (unsigned char *)text, strlen(text));
+			tok = pdf_lex(ctx, stm, &lb);
+			fz_drop_stream(ctx, stm);
+			stm = NULL;
+
+			if (tok != PDF_TOK_REAL)
+				fz_throw(ctx, FZ_ERROR_GENERIC, "%s is not a real", text);
+			if (lb.f != fz_atof(text))
+				fz_throw(ctx, FZ_ERROR_GENERIC, "%s is %.9g, not %.9g", text, lb.f, fz_atof(text));
+		}
+	}
+	fz_always(ctx)
+	{
+		fz_drop_stream(ctx, stm);
+		pdf_lexbuf_fin(ctx, &lb);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+/* Something like the content streams and objects of a text heavy
+ * document. */
+static fz_buffer *make_content(fz_context *ctx, size_t size)
+{
+	fz_buffer *buf = fz_new_buffer(ctx, size + 1024);
+	int i, n = 1;
+
+	fz_try(ctx)
+	{
+		while (buf->len < size)
+		{
+			switch (rnd() % 6)
+			{
+			case 0:
+			case 1:
+			case 2:
+				fz_append_printf(ctx, buf, "BT\n/F%d %d Tf\n%g %g Td\n", rnd() % 9, 8 + rnd() % 6,
+					(rnd() % 61200) / 100.0f, (rnd() % 79200) / 100.0f);
+				for (i = rnd() % 8; i >= 0; i--)
+					fz_append_printf(ctx, buf, "[(Lorem ipsum dolor sit amet, consectetur)%d(adipiscing elit)]TJ\n0 -%g TD\n",
+						-(int)(rnd() % 300), 10 + (rnd() % 400) / 100.0f);
+				fz_append_string(ctx, buf, "ET\n");
+				break;
+			case 3:
+				fz_append_printf(ctx, buf, "q %g %g %g rg %g %g %g %g re f Q\n",
+					(rnd() % 1000) / 1000.0f, (rnd() % 1000) / 1000.0f, (rnd() % 1000) / 1000.0f,
+					(rnd() % 61200) / 100.0f, (rnd() % 79200) / 100.0f, (rnd() % 2000) / 100.0f, (rnd() % 2000) / 100.0f);
+				break;
+			case 4:
+				fz_append_printf(ctx, buf, "%d 0 obj\n<</Type/Page/Parent 3 0 R/Resources<</Font<</F1 %d 0 R/F2 %d 0 R>>/ProcSet[/PDF/Text/ImageC]>>/MediaBox[0 0 612 792]/Contents %d 0 R>>\nendobj\n",
+					n, n + 1, n + 2, n + 3);
+				n += 4;
+				break;
+			case 5:
+				fz_append_printf(ctx, buf, "%% page %d: a comment that somebody's software left behind\n/Artifact<</Type/Pagination/BBox[%d %d %d %d]>>BDC\n<%08x%08x>Tj EMC\n",
+					n, rnd() % 600, rnd() % 800, rnd() % 600, rnd() % 800, rnd(), rnd());
+				break;
+			}
+		}
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_buffer(ctx, buf);
+		fz_rethrow(ctx);
+	}
+
+	return buf;
+}
+
+static void bench(fz_context *ctx)
+{
+	fz_buffer *buf = NULL;
+	fz_stream *stm = NULL;
+	pdf_lexbuf lb;
+	int chunked, i, tok;
+	long tokens;
+	double t;
+
+	fz_var(buf);
+	fz_var(stm);
+
+	pdf_lexbuf_init(ctx, &lb, PDF_LEXBUF_SMALL);
+
+	fz_try(ctx)
+	{
+		buf = make_content(ctx, 1 << 20);
+		for (chunked = 0; chunked <= 1; chunked++)
+		{
+			tokens = 0;
+			t = now();
+			for (i = 0; i < 60; i++)
+			{
+				if (chunked)
+					stm = open_chunks(ctx, buf->data, buf->len, 4096);
+				else
+					stm = fz_open_buffer(ctx, buf);
+				do
+				{
+					tok = pdf_lex(ctx, stm, &lb);
+					tokens++;
+				}
+				while (tok != PDF_TOK_EOF);
+				fz_drop_stream(ctx, stm);
+				stm = NULL;
+			}
+			t = now() - t;
+			printf("%-10s %ld tokens %6.1f MB/s\n", chunked ? "4k chunks" : "memory", tokens, buf->len * 60 / t / 1e6);
+		}
+	}
+	fz_always(ctx)
+	{
+		fz_drop_stream(ctx, stm);
+		fz_drop_buffer(ctx, buf);
+		pdf_lexbuf_fin(ctx, &lb);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+static void check(fz_context *ctx)
+{
+	check_tokens(ctx);
+	check_reals(ctx);
+}
+
+int main(int argc, char **argv)
+{
+	return test_main("lex-test", argc, argv, 1, check, bench);
+}
@@ -0,0 +1,403 @@
+/*
+ * Record a page with thousands of small fills, strokes, text and
+ * images, inside nested clips, groups, soft masks and tiles, into a
+ * display list. Draw it a tile or a band at a time, at several scales
+ * and rotations, and check that each piece comes out the same once
+ * the list has been indexed (so that only the items the index finds
+ * are run, picking up the graphics state from its checkpoints) as it
+ * did when every node of the list was run.
+ *
+ * With -b, time drawing the page in small tiles with and without the
+ * index instead.
+ */
+
+#include "mupdf/fitz.h"
+
+#include "test-util.h"
+
+#define PAGE 1000
+#define PATHS 8
+#define STROKES 4
+
+typedef struct
+{
+	fz_path *path[PATHS];
+	fz_stroke_state *stroke[STROKES];
+	fz_text *text;
+	fz_image *image, *mask;
+} resources;
+
+static void drop_resources(fz_context *ctx, resources *res)
+{
+	int i;
+
+	for (i = 0; i < PATHS; i++)
+		fz_drop_path(ctx, res->path[i]);
+	for (i = 0; i < STROKES; i++)
+		fz_drop_stroke_state(ctx, res->stroke[i]);
+	fz_drop_text(ctx, res->text);
+	fz_drop_image(ctx, res->image);
+	fz_drop_image(ctx, res->mask);
+}
+
+/* A few small shapes that are used over and over at different places,
+ * so that the list device only records a path when it changes. */
+static void make_resources(fz_context *ctx, resources *res)
+{
+	fz_pixmap *pix = NULL;
+	fz_font *font = NULL;
+	int i, k;
+
+	fz_var(pix);
+	fz_var(font);
+
+	memset(res, 0, sizeof *res);
+	fz_try(ctx)
+	{
+		for (i = 0; i < PATHS; i++)
+		{
+			fz_path *path = res->path[i] = fz_new_path(ctx);
+			if (i % 2)
+				fz_rectto(ctx, path, 0, 0, 5 + i * 4, 3 + i * 3);
+			else
+			{
+				fz_moveto(ctx, path, 0, 0);
+				for (k = 0; k < 3 + i; k++)
+					fz_lineto(ctx, path, rndf(30), rndf(30));
+				fz_curveto(ctx, path, rndf(30), rndf(30), rndf(30), rndf(30), 0, 10);
+				fz_closepath(ctx, path);
+			}
+		}
+		for (i = 0; i < STROKES; i++)
+		{
+			fz_stroke_state *stroke = res->stroke[i] = fz_new_stroke_state(ctx);
+			stroke->linewidth = 0.5f + i * 1.5f;
+			stroke->linejoin = i % 3;
+			stroke->start_cap = stroke->end_cap = i % 3;
+		}
+
+		font = fz_new_base14_font(ctx, "Helvetica");
+		res->text = fz_new_text(ctx);
+		for (i = 0; i < 6; i++)
+		{
+			int c = 'a' + i * 3;
+			fz_matrix trm = fz_scale(9, -9);
+			trm.e = i * 6;
+			fz_show_glyph(ctx, res->text, font, trm, fz_encode_character(ctx, font, c), c, 0, 0, FZ_BIDI_LTR, FZ_LANG_UNSET);
+		}
+
+		pix = fz_new_pixmap(ctx, fz_device_rgb(ctx), 8, 8, NULL, 0);
+		for (i = 0; i < 8 * 8 * 3; i++)
+			pix->samples[i] = rnd() & 0xff;
+		res->image = fz_new_image_from_pixmap(ctx, pix, NULL);
+		fz_drop_pixmap(ctx, pix);
+		pix = NULL;
+
+		pix = fz_new_pixmap(ctx, NULL, 8, 8, NULL, 1);
+		for (i = 0; i < 8 * 8; i++)
+			pix->samples[i] = rnd() & 1 ? 255 : 0;
+		res->mask = fz_new_image_from_pixmap(ctx, pix, NULL);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_pixmap(ctx, pix);
+		fz_drop_font(ctx, font);
+	}
+	fz_catch(ctx)
+	{
+		drop_resources(ctx, res);
+		fz_rethrow(ctx);
+	}
+}
+
+/* Colors and alphas come from a few values, so that the same one is
+ * often used again and is left to the graphics state of the list. */
+static float random_level(void)
+{
+	return (rnd() % 3) * 0.5f;
+}
+
+static fz_colorspace *random_color(fz_context *ctx, float *color)
+{
+	switch (rnd() % 4)
+	{
+	default:
+	case 0:
+		color[0] = random_level();
+		return fz_device_gray(ctx);
+	case 1:
+	case 2:
+		color[0] = random_level();
+		color[1] = random_level();
+		color[2] = random_level();
+		return fz_device_rgb(ctx);
+	case 3:
+		color[0] = random_level();
+		color[1] = random_level();
+		color[2] = random_level();
+		color[3] = random_level();
+		return fz_device_cmyk(ctx);
+	}
+}
+
+static fz_rect random_area(float x, float y, float size)
+{
+	float x0 = x + rndf(size), y0 = y + rndf(size);
+	return fz_make_rect(x0, y0, x0 + 10 + rndf(size), y0 + 10 + rndf(size));
+}
+
+/* Emit count things around (x, y), nesting clips, groups, masks and
+ * tiles inside each other up to a few deep. */
+static void emit(fz_context *ctx, fz_device *dev, resources *res, int count, int depth, float x, float y, float spread)
+{
+	fz_color_params cp = fz_default_color_params;
+	float color[4], alpha;
+	fz_colorspace *cs;
+	fz_matrix ctm;
+	fz_rect area;
+	int i;
+
+	for (i = 0; i < count; i++)
+	{
+		float cx = x + rndf(spread), cy = y + rndf(spread);
+
+		ctm = fz_translate(cx, cy);
+		if (rnd() % 4 == 0)
+			ctm = fz_pre_rotate(ctm, rnd() % 360);
+		if (rnd() % 4 == 0)
+			ctm = fz_pre_scale(ctm, 0.5f + rndf(2), 0.5f + rndf(2));
+		alpha = rnd() % 3 ? 1 : 0.5f;
+		cs = random_color(ctx, color);
+
+		switch (rnd() % (depth < 3 ? 14 : 8))
+		{
+		default:
+		case 0:
+		case 1:
+		case 2:
+			fz_fill_path(ctx, dev, res->path[rnd() % PATHS], rnd() & 1, ctm, cs, color, alpha, cp);
+			break;
+		case 3:
+		case 4:
+			fz_stroke_path(ctx, dev, res->path[rnd() % PATHS], res->stroke[rnd() % STROKES], ctm, cs, color, alpha, cp);
+			break;
+		case 5:
+			fz_fill_text(ctx, dev, res->text, ctm, cs, color, alpha, cp);
+			break;
+		case 6:
+			fz_fill_image(ctx, dev, res->image, fz_pre_scale(ctm, 12 + rndf(20), 12 + rndf(20)), alpha, cp);
+			break;
+		case 7:
+			fz_fill_image_mask(ctx, dev, res->mask, fz_pre_scale(ctm, 16, 16), cs, color, alpha, cp);
+			break;
+		case 8:
+		case 9:
+			switch (rnd() % 3)
+			{
+			case 0:
+				fz_clip_path(ctx, dev, res->path[rnd() % PATHS], rnd() & 1, fz_pre_scale(ctm, 3, 3), fz_infinite_rect);
+				break;
+			case 1:
+				fz_clip_stroke_path(ctx, dev, res->path[rnd() % PATHS], res->stroke[3], fz_pre_scale(ctm, 3, 3), fz_infinite_rect);
+				break;
+			case 2:
+				fz_clip_text(ctx, dev, res->text, fz_pre_scale(ctm, 4, 4), fz_infinite_rect);
+				break;
+			}
+			emit(ctx, dev, res, 2 + rnd() % 6, depth + 1, cx - 20, cy - 20, 80);
+			fz_pop_clip(ctx, dev);
+			break;
+		case 10:
+		case 11:
+			area = random_area(cx - 40, cy - 40, 60);
+			fz_begin_group(ctx, dev, area, rnd() & 1 ? fz_device_rgb(ctx) : NULL, rnd() & 1, rnd() % 4 == 0, rnd() % 16, alpha);
+			emit(ctx, dev, res, 2 + rnd() % 6, depth + 1, cx - 30, cy - 30, 60);
+			fz_end_group(ctx, dev);
+			break;
+		case 12:
+			area = random_area(cx - 40, cy - 40, 60);
+			fz_begin_mask(ctx, dev, area, rnd() & 1, fz_device_gray(ctx), color, cp);
+			emit(ctx, dev, res, 1 + rnd() % 4, 3, cx - 30, cy - 30, 60);
+			fz_end_mask(ctx, dev);
+			emit(ctx, dev, res, 1 + rnd() % 6, depth + 1, cx - 30, cy - 30, 60);
+			fz_pop_clip(ctx, dev);
+			break;
+		case 13:
+			area = fz_make_rect(cx, cy, cx + 20 + rnd() % 80, cy + 20 + rnd() % 80);
+			if (!fz_begin_tile_id(ctx, dev, area, fz_make_rect(0, 0, 10, 10), 10, 10, fz_identity, 0))
+				emit(ctx, dev, res, 1 + rnd() % 3, depth + 1, 0, 0, 6);
+			fz_end_tile(ctx, dev);
+			break;
+		}
+	}
+}
+
+/* A page of count things, nested if depth is 0, or flat if it is 3. */
+static fz_display_list *make_list(fz_context *ctx, int count, int depth)
+{
+	fz_display_list *list = fz_new_display_list(ctx, fz_make_rect(0, 0, PAGE, PAGE));
+	fz_device *dev = NULL;
+	resources res;
+
+	fz_var(dev);
+
+	make_resources(ctx, &res);
+	fz_try(ctx)
+	{
+		dev = fz_new_list_device(ctx, list);
+		emit(ctx, dev, &res, count, depth, -20, -20, PAGE);
+		fz_close_device(ctx, dev);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_device(ctx, dev);
+		drop_resources(ctx, &res);
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_display_list(ctx, list);
+		fz_rethrow(ctx);
+	}
+	return list;
+}
+
+/* Draw the part of the list that falls in bbox (in device space). */
+static void draw(fz_context *ctx, fz_display_list *list, fz_matrix ctm, fz_irect bbox, unsigned char digest[16])
+{
+	fz_pixmap *pix = fz_new_pixmap_with_bbox(ctx, fz_device_rgb(ctx), bbox, NULL, 0);
+	fz_device *dev = NULL;
+
+	fz_var(dev);
+
+	fz_try(ctx)
+	{
+		fz_clear_pixmap_with_value(ctx, pix, 255);
+		dev = fz_new_draw_device(ctx, fz_identity, pix);
+		fz_run_display_list(ctx, list, dev, ctm, fz_rect_from_irect(bbox), NULL);
+		fz_close_device(ctx, dev);
+		if (digest)
+			fz_md5_pixmap(ctx, pix, digest);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_device(ctx, dev);
+		fz_drop_pixmap(ctx, pix);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+#define VIEWS 3
+#define GRID 6
+#define BANDS 5
+#define PIECES (GRID * GRID + BANDS)
+
+static fz_matrix view_ctm(int view)
+{
+	switch (view)
+	{
+	default:
+	case 0: return fz_identity;
+	case 1: return fz_scale(1.5f, 1.5f);
+	case 2: return fz_concat(fz_rotate(30), fz_scale(0.7f, 0.7f));
+	}
+}
+
+/* The pieces of a view: a grid of tiles over the page, and some thin
+ * bands right across it. */
+static fz_irect piece(fz_matrix ctm, int i)
+{
+	fz_irect page = fz_round_rect(fz_transform_rect(fz_make_rect(0, 0, PAGE, PAGE), ctm));
+	int w = page.x1 - page.x0, h = page.y1 - page.y0;
+
+	if (i < GRID * GRID)
+		return fz_make_irect(
+			page.x0 + w * (i % GRID) / GRID, page.y0 + h * (i / GRID) / GRID,
+			page.x0 + w * (i % GRID + 1) / GRID, page.y0 + h * (i / GRID + 1) / GRID);
+	i -= GRID * GRID;
+	return fz_make_irect(page.x0, page.y0 + h * (2 * i + 1) / (2 * BANDS + 1),
+		page.x1, page.y0 + h * (2 * i + 1) / (2 * BANDS + 1) + 17 + i * 11);
+}
+
+static void draw_pieces(fz_context *ctx, fz_display_list *list, unsigned char (*digest)[16])
+{
+	int v, i;
+
+	for (v = 0; v < VIEWS; v++)
+		for (i = 0; i < PIECES; i++)
+			draw(ctx, list, view_ctm(v), piece(view_ctm(v), i), digest ? digest[v * PIECES + i] : NULL);
+}
+
+static void check(fz_context *ctx)
+{
+	unsigned char expect[VIEWS * PIECES][16], digest[VIEWS * PIECES][16];
+	fz_display_list *list = make_list(ctx, 1500, 0);
+	int i, wrong = 0;
+
+	fz_try(ctx)
+	{
+		draw_pieces(ctx, list, expect);
+		fz_index_display_list(ctx, list);
+		draw_pieces(ctx, list, digest);
+		for (i = 0; i < VIEWS * PIECES; i++)
+		{
+			if (memcmp(expect[i], digest[i], 16))
+			{
+				fz_irect r = piece(view_ctm(i / PIECES), i % PIECES);
+				printf("view %d, piece %d,%d-%d,%d drawn differently with the index\n",
+					i / PIECES, r.x0, r.y0, r.x1, r.y1);
+				wrong++;
+			}
+		}
+		if (wrong)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "%d of %d pieces drawn differently with the index", wrong, VIEWS * PIECES);
+		printf("%d pieces drawn the same with and without the index\n", VIEWS * PIECES);
+	}
+	fz_always(ctx)
+		fz_drop_display_list(ctx, list);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+/* Draw a page of many flat things at twice its size in small tiles,
+ * so that finding the few items in each one matters more than drawing
+ * them. (Tiles, groups and masks are always run, and take far longer
+ * to draw than to find.) */
+#define BENCH_TILE 64
+
+static void draw_small_tiles(fz_context *ctx, fz_display_list *list)
+{
+	int x, y;
+
+	for (y = 0; y < 2 * PAGE; y += BENCH_TILE)
+		for (x = 0; x < 2 * PAGE; x += BENCH_TILE)
+			draw(ctx, list, fz_scale(2, 2), fz_make_irect(x, y, x + BENCH_TILE, y + BENCH_TILE), NULL);
+}
+
+static void bench(fz_context *ctx)
+{
+	fz_display_list *list = make_list(ctx, 20000, 3);
+	double t;
+
+	fz_try(ctx)
+	{
+		t = now();
+		draw_small_tiles(ctx, list);
+		printf("without index: %6.1f ms\n", (now() - t) * 1000);
+		t = now();
+		fz_index_display_list(ctx, list);
+		printf("indexing:      %6.1f ms\n", (now() - t) * 1000);
+		t = now();
+		draw_small_tiles(ctx, list);
+		printf("with index:    %6.1f ms\n", (now() - t) * 1000);
+	}
+	fz_always(ctx)
+		fz_drop_display_list(ctx, list);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+int main(int argc, char **argv)
+{
+	return test_main("list-index-test", argc, argv, 0, check, bench);
+}
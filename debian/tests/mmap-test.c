@@ -0,0 +1,278 @@
+/*
+ * Write files of awkward sizes, memory map them as fz_open_file does
+ * when the library is built with FZ_ENABLE_MMAP, and check that the
+ * mapping holds the same bytes as a buffered stdio read, and that
+ * streams over each give the same results for the same seeks and
+ * reads. Then save a PDF, open it from both kinds of stream, and
+ * compare the rendered pages. Files that cannot be mapped (empty,
+ * missing, or not regular files) must give NULL so that the caller can
+ * fall back to reading them.
+ */
+
+#include "mupdf/fitz.h"
+#include "mupdf/pdf.h"
+
+#include "test-util.h"
+
+#include <unistd.h>
+
+static char filename[] = "/tmp/mmap-test-XXXXXX";
+
+static void write_file(fz_context *ctx, size_t len)
+{
+	FILE *file = fopen(filename, "wb");
+	size_t i;
+
+	if (!file)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "cannot write %s", filename);
+	for (i = 0; i < len; i++)
+		putc(rnd() & 0xff, file);
+	fclose(file);
+}
+
+static FILE *open_stdio(fz_context *ctx)
+{
+	FILE *file = fopen(filename, "rb");
+	if (!file)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "cannot open %s", filename);
+	return file;
+}
+
+/* Read the whole file through stdio. */
+static fz_buffer *read_stdio(fz_context *ctx)
+{
+	FILE *file = open_stdio(ctx);
+	fz_stream *stm = NULL;
+	fz_buffer *buf = NULL;
+
+	fz_var(stm);
+
+	fz_try(ctx)
+	{
+		stm = fz_open_file_ptr_no_close(ctx, file);
+		buf = fz_read_all(ctx, stm, 0);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_stream(ctx, stm);
+		fclose(file);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+	return buf;
+}
+
+/* Seek about within the file and read the same way from both streams. */
+static void compare_streams(fz_context *ctx, fz_stream *a, fz_stream *b, size_t len)
+{
+	unsigned char x[5000], y[5000];
+	int i;
+
+	for (i = 0; i < 200; i++)
+	{
+		size_t n = rnd() % sizeof x, na, nb;
+		int64_t ofs = rnd() % (len + 1);
+
+		switch (rnd() % 3)
+		{
+		case 0:
+			fz_seek(ctx, a, ofs, SEEK_SET);
+			fz_seek(ctx, b, ofs, SEEK_SET);
+			break;
+		case 1:
+			fz_seek(ctx, a, -ofs, SEEK_END);
+			fz_seek(ctx, b, -ofs, SEEK_END);
+			break;
+		}
+		if (fz_tell(ctx, a) != fz_tell(ctx, b))
+			fz_throw(ctx, FZ_ERROR_GENERIC, "streams are at %ld and %ld", (long)fz_tell(ctx, a), (long)fz_tell(ctx, b));
+		na = fz_read(ctx, a, x, n);
+		nb = fz_read(ctx, b, y, n);
+		if (na != nb || memcmp(x, y, na))
+			fz_throw(ctx, FZ_ERROR_GENERIC, "streams read %zu and %zu different bytes", na, nb);
+		if (fz_read_byte(ctx, a) != fz_read_byte(ctx, b))
+			fz_throw(ctx, FZ_ERROR_GENERIC, "streams read different bytes");
+	}
+}
+
+static void check_size(fz_context *ctx, size_t len)
+{
+	fz_buffer *mapped = NULL, *expect = NULL, *opened = NULL;
+	fz_stream *a = NULL, *b = NULL;
+	FILE *file = NULL;
+
+	fz_var(mapped);
+	fz_var(expect);
+	fz_var(opened);
+	fz_var(a);
+	fz_var(b);
+	fz_var(file);
+
+	fz_try(ctx)
+	{
+		write_file(ctx, len);
+		expect = read_stdio(ctx);
+		if (expect->len != len)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "read %zu bytes of %zu", expect->len, len);
+
+		mapped = fz_new_buffer_from_mapped_file(ctx, filename);
+		if (!mapped)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "cannot map a file of %zu bytes", len);
+		if (mapped->len != len || memcmp(mapped->data, expect->data, len))
+			fz_throw(ctx, FZ_ERROR_GENERIC, "mapping of %zu bytes differs from the file", len);
+
+		/* However the library was built, fz_open_file must agree. */
+		a = fz_open_file(ctx, filename);
+		opened = fz_read_all(ctx, a, 0);
+		if (opened->len != len || memcmp(opened->data, expect->data, len))
+			fz_throw(ctx, FZ_ERROR_GENERIC, "fz_open_file of %zu bytes differs from the file", len);
+
+		fz_drop_stream(ctx, a);
+		a = NULL;
+		a = fz_open_buffer(ctx, mapped);
+		file = open_stdio(ctx);
+		b = fz_open_file_ptr_no_close(ctx, file);
+		compare_streams(ctx, a, b, len);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_stream(ctx, a);
+		fz_drop_stream(ctx, b);
+		if (file)
+			fclose(file);
+		fz_drop_buffer(ctx, opened);
+		fz_drop_buffer(ctx, expect);
+		fz_drop_buffer(ctx, mapped);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+/* Save a one page PDF to the file. */
+static void write_pdf(fz_context *ctx)
+{
+	pdf_document *doc = pdf_create_document(ctx);
+	fz_buffer *contents = NULL;
+	pdf_obj *page = NULL;
+	int i;
+
+	fz_var(contents);
+	fz_var(page);
+
+	fz_try(ctx)
+	{
+		contents = fz_new_buffer(ctx, 1024);
+		for (i = 0; i < 200; i++)
+			fz_append_printf(ctx, contents, "%g %g %g rg %d %d %d %d re f\n",
+				rndf(1), rndf(1), rndf(1), rnd() % 500, rnd() % 700, 10 + rnd() % 100, 10 + rnd() % 100);
+		page = pdf_add_page(ctx, doc, fz_make_rect(0, 0, 612, 792), 0, NULL, contents);
+		pdf_insert_page(ctx, doc, -1, page);
+		pdf_save_document(ctx, doc, filename, NULL);
+	}
+	fz_always(ctx)
+	{
+		pdf_drop_obj(ctx, page);
+		fz_drop_buffer(ctx, contents);
+		pdf_drop_document(ctx, doc);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+static void render_pdf(fz_context *ctx, fz_stream *stm, unsigned char digest[16])
+{
+	fz_document *doc = NULL;
+	fz_pixmap *pix = NULL;
+
+	fz_var(doc);
+	fz_var(pix);
+
+	fz_try(ctx)
+	{
+		doc = fz_open_document_with_stream(ctx, "application/pdf", stm);
+		pix = fz_new_pixmap_from_page_number(ctx, doc, 0, fz_identity, fz_device_rgb(ctx), 0);
+		fz_md5_pixmap(ctx, pix, digest);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_pixmap(ctx, pix);
+		fz_drop_document(ctx, doc);
+		fz_drop_stream(ctx, stm);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+static void check_pdf(fz_context *ctx)
+{
+	unsigned char mapped[16], buffered[16];
+	fz_buffer *buf;
+	fz_stream *stm;
+	FILE *file;
+
+	fz_register_document_handlers(ctx);
+	write_pdf(ctx);
+
+	buf = fz_new_buffer_from_mapped_file(ctx, filename);
+	if (!buf)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "cannot map the PDF file");
+	fz_try(ctx)
+		stm = fz_open_buffer(ctx, buf);
+	fz_always(ctx)
+		fz_drop_buffer(ctx, buf);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+	render_pdf(ctx, stm, mapped);
+
+	file = open_stdio(ctx);
+	fz_try(ctx)
+		render_pdf(ctx, fz_open_file_ptr_no_close(ctx, file), buffered);
+	fz_always(ctx)
+		fclose(file);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+	if (memcmp(mapped, buffered, 16))
+		fz_throw(ctx, FZ_ERROR_GENERIC, "PDF read from a mapping rendered differently");
+}
+
+static void check_unmappable(fz_context *ctx, const char *name)
+{
+	fz_buffer *buf = fz_new_buffer_from_mapped_file(ctx, name);
+	if (buf)
+	{
+		fz_drop_buffer(ctx, buf);
+		fz_throw(ctx, FZ_ERROR_GENERIC, "%s was mapped", name);
+	}
+}
+
+static void check(fz_context *ctx)
+{
+	static const size_t sizes[] = { 1, 2, 4095, 4096, 4097, 65536, 3000001 };
+	int fd, i;
+
+	fd = mkstemp(filename);
+	if (fd < 0)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "cannot create a temporary file");
+	close(fd);
+
+	fz_try(ctx)
+	{
+		for (i = 0; i < (int)nelem(sizes); i++)
+			check_size(ctx, sizes[i]);
+		check_pdf(ctx);
+
+		write_file(ctx, 0);
+		check_unmappable(ctx, filename);
+		check_unmappable(ctx, "/tmp");
+		check_unmappable(ctx, "/nonexistent/mmap-test");
+	}
+	fz_always(ctx)
+		remove(filename);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+int main(int argc, char **argv)
+{
+	return test_main("mmap-test", argc, argv, 0, check, NULL);
+}
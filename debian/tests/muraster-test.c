@@ -0,0 +1,128 @@
+/*
+ * Write a file for the muraster test (see the Makefile) to the path
+ * given. Its pages differ in size and in how long they take to draw,
+ * so that with several render threads some threads finish the bands
+ * of one page while others are still busy with it, and move on to the
+ * bands of the next. The Makefile checks that muraster writes the same
+ * bytes for it with any number of threads as with none.
+ */
+
+#include "mupdf/fitz.h"
+#include "mupdf/pdf.h"
+
+#include "test-util.h"
+
+static const char *path;
+
+/* Width, height and number of things drawn, for each page. */
+static const int pages[][3] = {
+	{ 612, 792, 3000 },
+	{ 300, 200, 10 },
+	{ 612, 792, 0 },
+	{ 792, 612, 1500 },
+	{ 200, 1000, 400 },
+	{ 612, 792, 5 },
+	{ 400, 400, 2000 },
+	{ 612, 792, 100 },
+};
+
+static fz_buffer *make_contents(fz_context *ctx, int w, int h, int count)
+{
+	fz_buffer *buf = fz_new_buffer(ctx, 1024);
+	int i, k;
+
+	fz_try(ctx)
+	{
+		for (i = 0; i < count; i++)
+		{
+			float x = rndf(w), y = rndf(h);
+
+			fz_append_printf(ctx, buf, "q %g %g %g rg %g %g %g RG ", rndf(1), rndf(1), rndf(1), rndf(1), rndf(1), rndf(1));
+			if (rnd() % 4 == 0)
+				fz_append_string(ctx, buf, "/Half gs ");
+			switch (rnd() % 3)
+			{
+			case 0:
+				fz_append_printf(ctx, buf, "%g w %g %g m ", rndf(4), x, y);
+				for (k = 0; k < 4; k++)
+					fz_append_printf(ctx, buf, "%g %g l ", x + rndf(120) - 60, y + rndf(120) - 60);
+				fz_append_string(ctx, buf, rnd() % 2 ? "b\n" : "s\n");
+				break;
+			case 1:
+				fz_append_printf(ctx, buf, "BT /F1 %g Tf %g %g Td (", 6 + rndf(30), x, y);
+				for (k = 0; k < 8; k++)
+					fz_append_byte(ctx, buf, 'A' + rnd() % 26);
+				fz_append_string(ctx, buf, ") Tj ET\n");
+				break;
+			case 2:
+				fz_append_printf(ctx, buf, "%g %g %g %g re f\n", x, y, rndf(80), rndf(80));
+				break;
+			}
+			fz_append_string(ctx, buf, "Q\n");
+		}
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_buffer(ctx, buf);
+		fz_rethrow(ctx);
+	}
+	return buf;
+}
+
+static void check(fz_context *ctx)
+{
+	pdf_document *doc = pdf_create_document(ctx);
+	fz_font *font = NULL;
+	pdf_obj *resources = NULL;
+	pdf_obj *page = NULL;
+	fz_buffer *contents = NULL;
+	int i;
+
+	fz_var(font);
+	fz_var(resources);
+	fz_var(page);
+	fz_var(contents);
+
+	fz_try(ctx)
+	{
+		font = fz_new_base14_font(ctx, "Helvetica");
+		resources = pdf_new_dict(ctx, doc, 2);
+		pdf_dict_putp_drop(ctx, resources, "Font/F1", pdf_add_simple_font(ctx, doc, font, PDF_SIMPLE_ENCODING_LATIN));
+		pdf_dict_putp_drop(ctx, resources, "ExtGState/Half", pdf_new_dict(ctx, doc, 1));
+		pdf_dict_put_real(ctx, pdf_dict_getp(ctx, resources, "ExtGState/Half"), PDF_NAME(ca), 0.5);
+
+		for (i = 0; i < (int)nelem(pages); i++)
+		{
+			contents = make_contents(ctx, pages[i][0], pages[i][1], pages[i][2]);
+			page = pdf_add_page(ctx, doc, fz_make_rect(0, 0, pages[i][0], pages[i][1]), 0, resources, contents);
+			pdf_insert_page(ctx, doc, -1, page);
+			pdf_drop_obj(ctx, page);
+			page = NULL;
+			fz_drop_buffer(ctx, contents);
+			contents = NULL;
+		}
+
+		pdf_save_document(ctx, doc, path, NULL);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_buffer(ctx, contents);
+		pdf_drop_obj(ctx, page);
+		pdf_drop_obj(ctx, resources);
+		fz_drop_font(ctx, font);
+		pdf_drop_document(ctx, doc);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+int main(int argc, char **argv)
+{
+	if (argc != 2)
+	{
+		fprintf(stderr, "usage: muraster-test output.pdf\n");
+		return 1;
+	}
+	path = argv[1];
+	return test_main("muraster-test", argc, argv, 0, check, NULL);
+}
@@ -0,0 +1,283 @@
+/*
+ * Save a document with object streams at each garbage collection
+ * level, with and without encryption, and check that it loads again
+ * without being repaired: that every object that can be was packed into
+ * an object stream, that it has a cross reference stream, and that every
+ * object reads back with the value it was saved with.
+ */
+
+#include "mupdf/fitz.h"
+#include "mupdf/pdf.h"
+
+#include "test-util.h"
+
+/* Enough for several object streams of up to 100 objects each. */
+#define OBJECTS 350
+
+static pdf_obj *make_value(fz_context *ctx, pdf_document *doc, pdf_obj *test, int depth)
+{
+	static const char *names[] = { "A", "B", "Length", "Type" };
+	static const float reals[] = { 0.0f, -0.5f, 0.25f, 1000.0f };
+	char str[16];
+	pdf_obj *obj;
+	int i, n;
+
+	switch (rnd() % (depth < 2 ? 9 : 7))
+	{
+	default:
+	case 0: return pdf_new_int(ctx, (int)(rnd() % 1000) - 500);
+	case 1: return pdf_new_real(ctx, reals[rnd() % nelem(reals)]);
+	case 2: return pdf_new_name(ctx, names[rnd() % nelem(names)]);
+	case 3:
+		/* Any bytes, as encryption must take them back exactly. */
+		n = rnd() % sizeof str;
+		for (i = 0; i < n; i++)
+			str[i] = rnd();
+		return pdf_new_string(ctx, str, n);
+	case 4:
+		/* Only ever refer back, so there are no cycles. */
+		n = pdf_array_len(ctx, test);
+		if (n == 0)
+			return pdf_new_int(ctx, 0);
+		return pdf_keep_obj(ctx, pdf_array_get(ctx, test, rnd() % n));
+	case 5: return rnd() & 1 ? PDF_TRUE : PDF_NULL;
+	case 6: return rnd() & 1 ? PDF_FALSE : pdf_new_int(ctx, 0);
+	case 7:
+		n = rnd() % 4;
+		obj = pdf_new_array(ctx, doc, n);
+		for (i = 0; i < n; i++)
+			pdf_array_push_drop(ctx, obj, make_value(ctx, doc, test, depth + 1));
+		return obj;
+	case 8:
+		n = rnd() % 4;
+		obj = pdf_new_dict(ctx, doc, n);
+		for (i = 0; i < n; i++)
+			pdf_dict_put_drop(ctx, obj, pdf_new_name(ctx, names[rnd() % nelem(names)]), make_value(ctx, doc, test, depth + 1));
+		return obj;
+	}
+}
+
+/* Add the objects, one in ten of them a stream, and a /Test array in
+ * the catalog that uses them all. */
+static void make_objects(fz_context *ctx, pdf_document *doc)
+{
+	pdf_obj *test, *obj = NULL, *ref = NULL;
+	fz_buffer *buf = NULL;
+	int i;
+
+	fz_var(obj);
+	fz_var(ref);
+	fz_var(buf);
+
+	test = pdf_new_array(ctx, doc, OBJECTS);
+	pdf_dict_puts_drop(ctx, pdf_dict_get(ctx, pdf_trailer(ctx, doc), PDF_NAME(Root)), "Test", test);
+	fz_try(ctx)
+	{
+		for (i = 0; i < OBJECTS; i++)
+		{
+			obj = make_value(ctx, doc, test, 0);
+			if (i % 10 == 9)
+			{
+				pdf_drop_obj(ctx, obj);
+				obj = NULL;
+				obj = pdf_new_dict(ctx, doc, 1);
+				pdf_dict_put_drop(ctx, obj, PDF_NAME(A), make_value(ctx, doc, test, 1));
+				buf = fz_new_buffer(ctx, 64);
+				fz_append_printf(ctx, buf, "q %d 0 0 %d 0 0 cm /Im%d Do Q", i, i, i);
+				ref = pdf_add_stream(ctx, doc, buf, obj, 0);
+				fz_drop_buffer(ctx, buf);
+				buf = NULL;
+			}
+			else
+				ref = pdf_add_object(ctx, doc, obj);
+			pdf_drop_obj(ctx, obj);
+			obj = NULL;
+			pdf_array_push_drop(ctx, test, ref);
+			ref = NULL;
+		}
+	}
+	fz_always(ctx)
+	{
+		fz_drop_buffer(ctx, buf);
+		pdf_drop_obj(ctx, ref);
+		pdf_drop_obj(ctx, obj);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+static int same_stream(fz_context *ctx, pdf_obj *a, pdf_obj *b)
+{
+	fz_buffer *sa = pdf_load_stream(ctx, a);
+	fz_buffer *sb = NULL;
+	int same = 0;
+
+	fz_try(ctx)
+	{
+		sb = pdf_load_stream(ctx, b);
+		same = sa->len == sb->len && !memcmp(sa->data, sb->data, sa->len);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_buffer(ctx, sa);
+		fz_drop_buffer(ctx, sb);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+	return same;
+}
+
+/* Compare values in two documents, following references, as the
+ * objects are renumbered when saving with garbage collection. An object
+ * may hold nothing but a reference to another. Reals with no fraction
+ * are written as integers. The Length of a stream may change, as it may
+ * be compressed differently. */
+static int same_value(fz_context *ctx, pdf_obj *a, pdf_obj *b, int stream)
+{
+	int i, n;
+
+	if (pdf_is_indirect(ctx, a) || pdf_is_indirect(ctx, b))
+	{
+		if (!pdf_is_indirect(ctx, a) || !pdf_is_indirect(ctx, b))
+			return 0;
+		stream = pdf_is_stream(ctx, a);
+		if (stream != pdf_is_stream(ctx, b))
+			return 0;
+		if (stream && !same_stream(ctx, a, b))
+			return 0;
+		return same_value(ctx, pdf_resolve_indirect(ctx, a), pdf_resolve_indirect(ctx, b), stream);
+	}
+
+	if (pdf_is_array(ctx, a))
+	{
+		if (!pdf_is_array(ctx, b) || pdf_array_len(ctx, a) != pdf_array_len(ctx, b))
+			return 0;
+		n = pdf_array_len(ctx, a);
+		for (i = 0; i < n; i++)
+			if (!same_value(ctx, pdf_array_get(ctx, a, i), pdf_array_get(ctx, b, i), 0))
+				return 0;
+		return 1;
+	}
+
+	if (pdf_is_dict(ctx, a))
+	{
+		if (!pdf_is_dict(ctx, b))
+			return 0;
+		n = pdf_dict_len(ctx, a);
+		for (i = 0; i < n; i++)
+		{
+			pdf_obj *key = pdf_dict_get_key(ctx, a, i);
+			if (stream && pdf_name_eq(ctx, key, PDF_NAME(Length)))
+				continue;
+			if (!same_value(ctx, pdf_dict_get_val(ctx, a, i), pdf_dict_get(ctx, b, key), 0))
+				return 0;
+		}
+		return 1;
+	}
+
+	if (pdf_is_number(ctx, a))
+		return pdf_is_number(ctx, b) && pdf_to_real(ctx, a) == pdf_to_real(ctx, b);
+
+	return !pdf_objcmp(ctx, a, b);
+}
+
+static void check_save(fz_context *ctx, pdf_document *doc, int garbage, int encrypt)
+{
+	pdf_write_options opts = pdf_default_write_options;
+	fz_buffer *buf = NULL;
+	fz_output *out = NULL;
+	fz_stream *stm = NULL;
+	pdf_document *saved = NULL;
+	pdf_obj *test, *saved_test;
+	int i, n, encrypt_num, packed = 0;
+
+	fz_var(buf);
+	fz_var(out);
+	fz_var(stm);
+	fz_var(saved);
+
+	fz_try(ctx)
+	{
+		opts.do_use_objstms = 1;
+		opts.do_garbage = garbage;
+		opts.do_compress = garbage & 1;
+		opts.do_encrypt = encrypt;
+		/* With no user password, the document can be read as soon as
+		 * it is opened, catalog and all. */
+		if (encrypt != PDF_ENCRYPT_NONE)
+			strcpy(opts.opwd_utf8, "owner");
+		buf = fz_new_buffer(ctx, 1 << 16);
+		out = fz_new_output_with_buffer(ctx, buf);
+		pdf_write_document(ctx, doc, out, &opts);
+		fz_close_output(ctx, out);
+
+		stm = fz_open_buffer(ctx, buf);
+		saved = pdf_open_document_with_stream(ctx, stm);
+		if ((encrypt != PDF_ENCRYPT_NONE) != !!pdf_dict_get(ctx, pdf_trailer(ctx, saved), PDF_NAME(Encrypt)))
+			fz_throw(ctx, FZ_ERROR_GENERIC, "garbage=%d encrypt=%d: wrong encryption", garbage, encrypt);
+		if (pdf_needs_password(ctx, saved))
+			fz_throw(ctx, FZ_ERROR_GENERIC, "garbage=%d encrypt=%d: needs a password", garbage, encrypt);
+		if (!pdf_name_eq(ctx, pdf_dict_get(ctx, pdf_trailer(ctx, saved), PDF_NAME(Type)), PDF_NAME(XRef)))
+			fz_throw(ctx, FZ_ERROR_GENERIC, "garbage=%d encrypt=%d: no cross reference stream", garbage, encrypt);
+
+		/* Every object but the streams and the encryption dictionary
+		 * must be in an object stream. Null objects are written as
+		 * free. */
+		encrypt_num = pdf_to_num(ctx, pdf_dict_get(ctx, pdf_trailer(ctx, saved), PDF_NAME(Encrypt)));
+		n = pdf_xref_len(ctx, saved);
+		for (i = 1; i < n; i++)
+		{
+			int type = pdf_get_xref_entry(ctx, saved, i)->type;
+			if (type == 'o')
+				packed++;
+			else if (type == 'n' && i != encrypt_num && !pdf_obj_num_is_stream(ctx, saved, i))
+				fz_throw(ctx, FZ_ERROR_GENERIC, "garbage=%d encrypt=%d: object %d not in an object stream", garbage, encrypt, i);
+		}
+
+		test = pdf_dict_getp(ctx, pdf_trailer(ctx, doc), "Root/Test");
+		saved_test = pdf_dict_getp(ctx, pdf_trailer(ctx, saved), "Root/Test");
+		if (pdf_array_len(ctx, saved_test) != OBJECTS)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "garbage=%d encrypt=%d: lost the test array", garbage, encrypt);
+		for (i = 0; i < OBJECTS; i++)
+			if (!same_value(ctx, pdf_array_get(ctx, test, i), pdf_array_get(ctx, saved_test, i), 0))
+				fz_throw(ctx, FZ_ERROR_GENERIC, "garbage=%d encrypt=%d: object %d changed", garbage, encrypt, i);
+
+		/* Last, as reading any object could have set off a repair. */
+		if (pdf_was_repaired(ctx, saved))
+			fz_throw(ctx, FZ_ERROR_GENERIC, "garbage=%d encrypt=%d: file was repaired", garbage, encrypt);
+		printf("garbage=%d encrypt=%d: %d objects in object streams\n", garbage, encrypt, packed);
+	}
+	fz_always(ctx)
+	{
+		pdf_drop_document(ctx, saved);
+		fz_drop_stream(ctx, stm);
+		fz_drop_output(ctx, out);
+		fz_drop_buffer(ctx, buf);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+static void check(fz_context *ctx)
+{
+	static const int encrypt[] = { PDF_ENCRYPT_NONE, PDF_ENCRYPT_RC4_128, PDF_ENCRYPT_AES_256 };
+	pdf_document *doc = pdf_create_document(ctx);
+	int garbage, i;
+
+	fz_try(ctx)
+	{
+		make_objects(ctx, doc);
+		for (garbage = 0; garbage <= 4; garbage++)
+			for (i = 0; i < (int)nelem(encrypt); i++)
+				check_save(ctx, doc, garbage, encrypt[i]);
+	}
+	fz_always(ctx)
+		pdf_drop_document(ctx, doc);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+int main(int argc, char **argv)
+{
+	return test_main("objstm-test", argc, argv, 0, check, NULL);
+}
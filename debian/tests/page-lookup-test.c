@@ -0,0 +1,418 @@
+/*
+ * Look up the pages of a large page tree in random order, and delete
+ * and insert pages, checking each lookup against a list of where the
+ * pages should be, both with the page map kept up to date and with it
+ * made again from the tree. Then point the catalog at another page
+ * tree, replace the catalog, and point the trailer at another catalog,
+ * and check that the map follows each change.
+ *
+ * With -b, time looking up and loading every page of a tree of 200000
+ * pages in random order, walking the tree and with the page map.
+ */
+
+#include "mupdf/fitz.h"
+#include "mupdf/pdf.h"
+
+#include "test-util.h"
+
+#define FANOUT 8
+
+/* Pages are objects 2 to count+1, in order. The nodes above them follow,
+ * each with up to FANOUT kids; some of them set Rotate for the pages
+ * below. */
+typedef struct
+{
+	fz_buffer *buf;
+	size_t *ofs;
+	int next;
+} tree_file;
+
+static int write_node(fz_context *ctx, tree_file *f, int first, int count, int parent)
+{
+	int num = f->next++;
+	int per = 1;
+	int i;
+
+	while (per * FANOUT < count)
+		per *= FANOUT;
+
+	f->ofs[num] = f->buf->len;
+	fz_append_printf(ctx, f->buf, "%d 0 obj\n<</Type/Pages/Count %d", num, count);
+	if (parent)
+		fz_append_printf(ctx, f->buf, "/Parent %d 0 R", parent);
+	else
+		fz_append_string(ctx, f->buf, "/MediaBox[0 0 612 792]");
+	if (num % 7 == 0)
+		fz_append_string(ctx, f->buf, "/Rotate 90");
+	fz_append_string(ctx, f->buf, "/Kids[");
+
+	if (per == 1)
+	{
+		for (i = 0; i < count; i++)
+			fz_append_printf(ctx, f->buf, "%d 0 R ", first + i + 2);
+		fz_append_string(ctx, f->buf, "]>>\nendobj\n");
+		for (i = 0; i < count; i++)
+		{
+			f->ofs[first + i + 2] = f->buf->len;
+			fz_append_printf(ctx, f->buf, "%d 0 obj\n<</Type/Page/Parent %d 0 R>>\nendobj\n", first + i + 2, num);
+		}
+	}
+	else
+	{
+		/* The kids are written after this node, so leave room for
+		 * their numbers and fill them in once they are known. */
+		size_t kids = f->buf->len;
+		int nkids = (count + per - 1) / per;
+		char ref[20];
+
+		for (i = 0; i < nkids; i++)
+			fz_append_string(ctx, f->buf, "           ");
+		fz_append_string(ctx, f->buf, "]>>\nendobj\n");
+		for (i = 0; i < nkids; i++)
+		{
+			int kid = write_node(ctx, f, first + i * per, fz_mini(per, count - i * per), num);
+			fz_snprintf(ref, sizeof ref, "%d 0 R", kid);
+			memcpy(f->buf->data + kids + i * 11, ref, strlen(ref));
+		}
+	}
+
+	return num;
+}
+
+static fz_buffer *make_file(fz_context *ctx, int count)
+{
+	tree_file f;
+	size_t startxref;
+	int i;
+
+	f.buf = fz_new_buffer(ctx, (size_t)count * 50);
+	f.ofs = NULL;
+	f.next = count + 2;
+
+	fz_try(ctx)
+	{
+		f.ofs = fz_malloc_array(ctx, count * 2 + 10, size_t);
+		fz_append_string(ctx, f.buf, "%PDF-1.7\n");
+		f.ofs[1] = f.buf->len;
+		fz_append_printf(ctx, f.buf, "1 0 obj\n<</Type/Catalog/Pages %d 0 R>>\nendobj\n", count + 2);
+		write_node(ctx, &f, 0, count, 0);
+
+		startxref = f.buf->len;
+		fz_append_printf(ctx, f.buf, "xref\n0 %d\n0000000000 65535 f \n", f.next);
+		for (i = 1; i < f.next; i++)
+			fz_append_printf(ctx, f.buf, "%010zu 00000 n \n", f.ofs[i]);
+		fz_append_printf(ctx, f.buf, "trailer\n<</Size %d/Root 1 0 R>>\nstartxref\n%zu\n%%%%EOF\n", f.next, startxref);
+	}
+	fz_always(ctx)
+		fz_free(ctx, f.ofs);
+	fz_catch(ctx)
+	{
+		fz_drop_buffer(ctx, f.buf);
+		fz_rethrow(ctx);
+	}
+
+	return f.buf;
+}
+
+static pdf_document *open_pdf(fz_context *ctx, fz_buffer *buf)
+{
+	fz_stream *stm = fz_open_buffer(ctx, buf);
+	pdf_document *doc = NULL;
+
+	fz_try(ctx)
+		doc = pdf_open_document_with_stream(ctx, stm);
+	fz_always(ctx)
+		fz_drop_stream(ctx, stm);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	return doc;
+}
+
+/* Look up every page in random order. */
+static int check_pages(fz_context *ctx, pdf_document *doc, const int *expect, int count, const char *what)
+{
+	int i, bad = 0;
+
+	if (pdf_count_pages(ctx, doc) != count)
+	{
+		fprintf(stderr, "%s: %d pages, not %d\n", what, pdf_count_pages(ctx, doc), count);
+		return 1;
+	}
+
+	for (i = 0; i < count && bad < 10; i++)
+	{
+		int k = rnd() % count;
+		int num = pdf_to_num(ctx, pdf_lookup_page_obj(ctx, doc, k));
+		if (num != expect[k])
+		{
+			fprintf(stderr, "%s: page %d is object %d, not %d\n", what, k, num, expect[k]);
+			bad++;
+		}
+	}
+
+	return bad;
+}
+
+static void check(fz_context *ctx)
+{
+	int count = 5000;
+	fz_buffer *buf = NULL;
+	pdf_document *doc = NULL;
+	pdf_obj *page = NULL;
+	int *expect = NULL;
+	int i, k, bad = 0;
+
+	fz_var(buf);
+	fz_var(doc);
+	fz_var(page);
+	fz_var(expect);
+
+	fz_try(ctx)
+	{
+		buf = make_file(ctx, count);
+		doc = open_pdf(ctx, buf);
+
+		expect = fz_malloc_array(ctx, count + 200, int);
+		for (i = 0; i < count; i++)
+			expect[i] = i + 2;
+
+		bad += check_pages(ctx, doc, expect, count, "loaded");
+		if (!doc->fwd_page_map)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "the page tree was not mapped");
+
+		/* Every other edit is to the same few pages, so that the
+		 * edits to a node follow on from each other. */
+		for (i = 0; i < 200 && !bad; i++)
+		{
+			if (i & 1)
+				k = rnd() % count;
+			else
+				k = 1000 + rnd() % 20;
+			if (i % 3 == 0)
+			{
+				pdf_delete_page(ctx, doc, k);
+				memmove(expect + k, expect + k + 1, (count - k - 1) * sizeof *expect);
+				count--;
+			}
+			else
+			{
+				page = pdf_add_page(ctx, doc, fz_make_rect(0, 0, 200, 200), 0, NULL, NULL);
+				pdf_insert_page(ctx, doc, k == count ? -1 : k, page);
+				memmove(expect + k + 1, expect + k, (count - k) * sizeof *expect);
+				expect[k] = pdf_to_num(ctx, page);
+				count++;
+				pdf_drop_obj(ctx, page);
+				page = NULL;
+			}
+			if (!doc->fwd_page_map)
+				fz_throw(ctx, FZ_ERROR_GENERIC, "editing the page tree dropped the page map");
+			bad += check_pages(ctx, doc, expect, count, "edited");
+
+			/* The map finds the pages where they should be; now
+			 * see that they are there in the tree itself. */
+			if (i % 10 == 9)
+			{
+				pdf_invalidate_page_map(ctx, doc, 0);
+				bad += check_pages(ctx, doc, expect, count, "remapped");
+			}
+		}
+
+		if (bad)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "pages are not where they should be");
+	}
+	fz_always(ctx)
+	{
+		fz_free(ctx, expect);
+		pdf_drop_obj(ctx, page);
+		pdf_drop_document(ctx, doc);
+		fz_drop_buffer(ctx, buf);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+/* A page tree node of its own, with a single new page. */
+static pdf_obj *new_tree(fz_context *ctx, pdf_document *doc, int *page_num)
+{
+	pdf_obj *node = pdf_add_new_dict(ctx, doc, 4);
+	pdf_obj *page = NULL;
+
+	fz_var(page);
+
+	fz_try(ctx)
+	{
+		page = pdf_add_page(ctx, doc, fz_make_rect(0, 0, 200, 200), 0, NULL, NULL);
+		pdf_dict_put(ctx, page, PDF_NAME(Parent), node);
+		pdf_dict_put(ctx, node, PDF_NAME(Type), PDF_NAME(Pages));
+		pdf_dict_put_int(ctx, node, PDF_NAME(Count), 1);
+		pdf_array_push(ctx, pdf_dict_put_array(ctx, node, PDF_NAME(Kids), 1), page);
+		*page_num = pdf_to_num(ctx, page);
+	}
+	fz_always(ctx)
+		pdf_drop_obj(ctx, page);
+	fz_catch(ctx)
+	{
+		pdf_drop_obj(ctx, node);
+		fz_rethrow(ctx);
+	}
+
+	return node;
+}
+
+/* Replace the page tree in the ways that pdfposter and mutool clean
+ * do, once the page map has been made. */
+static void check_replaced(fz_context *ctx)
+{
+	int count = 1000;
+	fz_buffer *buf = NULL;
+	pdf_document *doc = NULL;
+	pdf_obj *node = NULL;
+	pdf_obj *root = NULL;
+	pdf_obj *old_pages = NULL;
+	pdf_obj *old_root;
+	int *expect = NULL;
+	int i, num, bad = 0;
+
+	fz_var(buf);
+	fz_var(doc);
+	fz_var(node);
+	fz_var(root);
+	fz_var(old_pages);
+	fz_var(expect);
+
+	fz_try(ctx)
+	{
+		buf = make_file(ctx, count);
+		doc = open_pdf(ctx, buf);
+
+		expect = fz_malloc_array(ctx, count, int);
+		for (i = 0; i < count; i++)
+			expect[i] = i + 2;
+		bad += check_pages(ctx, doc, expect, count, "before replacing");
+		if (!doc->fwd_page_map)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "the page tree was not mapped");
+
+		old_root = pdf_dict_get(ctx, pdf_trailer(ctx, doc), PDF_NAME(Root));
+		old_pages = pdf_keep_obj(ctx, pdf_dict_get(ctx, old_root, PDF_NAME(Pages)));
+
+		/* A new tree in the catalog's Pages. */
+		node = new_tree(ctx, doc, &num);
+		pdf_dict_put(ctx, old_root, PDF_NAME(Pages), node);
+		pdf_drop_obj(ctx, node);
+		node = NULL;
+		bad += check_pages(ctx, doc, &num, 1, "new Pages");
+
+		/* A new catalog object, with the old tree. */
+		root = pdf_new_dict(ctx, doc, 2);
+		pdf_dict_put(ctx, root, PDF_NAME(Type), PDF_NAME(Catalog));
+		pdf_dict_put(ctx, root, PDF_NAME(Pages), old_pages);
+		pdf_update_object(ctx, doc, pdf_to_num(ctx, old_root), root);
+		pdf_drop_obj(ctx, root);
+		root = NULL;
+		bad += check_pages(ctx, doc, expect, count, "new catalog");
+
+		/* A new tree, in a catalog that the trailer is pointed at. */
+		node = new_tree(ctx, doc, &num);
+		root = pdf_add_new_dict(ctx, doc, 2);
+		pdf_dict_put(ctx, root, PDF_NAME(Type), PDF_NAME(Catalog));
+		pdf_dict_put(ctx, root, PDF_NAME(Pages), node);
+		pdf_dict_put(ctx, pdf_trailer(ctx, doc), PDF_NAME(Root), root);
+		bad += check_pages(ctx, doc, &num, 1, "new Root");
+
+		if (bad)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "pages are not where they should be");
+	}
+	fz_always(ctx)
+	{
+		fz_free(ctx, expect);
+		pdf_drop_obj(ctx, old_pages);
+		pdf_drop_obj(ctx, root);
+		pdf_drop_obj(ctx, node);
+		pdf_drop_document(ctx, doc);
+		fz_drop_buffer(ctx, buf);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+static void time_pages(fz_context *ctx, pdf_document *doc, const int *order, int count, const char *what)
+{
+	double t;
+	int i;
+
+	t = now();
+	for (i = 0; i < count; i++)
+		pdf_lookup_page_obj(ctx, doc, order[i]);
+	printf("%-5s %d random lookups        %6.2f s\n", what, count, now() - t);
+
+	t = now();
+	for (i = 0; i < count; i++)
+		fz_drop_page(ctx, fz_load_page(ctx, &doc->super, order[i]));
+	printf("%-5s %d random fz_load_page   %6.2f s\n", what, count, now() - t);
+}
+
+static void bench(fz_context *ctx)
+{
+	int count = 200000;
+	fz_buffer *buf = NULL;
+	pdf_document *doc = NULL;
+	int *order = NULL;
+	int i;
+
+	fz_var(buf);
+	fz_var(doc);
+	fz_var(order);
+
+	fz_try(ctx)
+	{
+		buf = make_file(ctx, count);
+		order = fz_malloc_array(ctx, count, int);
+		for (i = 0; i < count; i++)
+			order[i] = rnd() % count;
+
+		/* Never map the tree, so each lookup walks down it. */
+		doc = open_pdf(ctx, buf);
+		doc->fwd_page_map_failed = 1;
+		time_pages(ctx, doc, order, count, "walk");
+		pdf_drop_document(ctx, doc);
+		doc = NULL;
+
+		doc = open_pdf(ctx, buf);
+		time_pages(ctx, doc, order, count, "map");
+	}
+	fz_always(ctx)
+	{
+		fz_free(ctx, order);
+		pdf_drop_document(ctx, doc);
+		fz_drop_buffer(ctx, buf);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+int main(int argc, char **argv)
+{
+	fz_context *ctx = new_test_context(NULL, FZ_STORE_DEFAULT);
+	int ret = 0;
+
+	fz_try(ctx)
+	{
+		fz_register_document_handlers(ctx);
+		if (is_bench(argc, argv))
+			bench(ctx);
+		else
+		{
+			check(ctx);
+			check_replaced(ctx);
+		}
+	}
+	fz_catch(ctx)
+	{
+		fprintf(stderr, "page-lookup-test: %s\n", fz_caught_message(ctx));
+		ret = 1;
+	}
+
+	fz_drop_context(ctx);
+	return ret;
+}
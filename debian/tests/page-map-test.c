@@ -0,0 +1,284 @@
+/*
+ * Read the page map of a file back from its accelerator data, then
+ * delete and insert pages and check that the map still finds every
+ * page where it is in the page tree.
+ */
+
+#include "mupdf/fitz.h"
+#include "mupdf/pdf.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+/* The root has pages and a node of its own as kids, so the pages under
+ * it are not all together. The node is not generation 0, and holds the
+ * MediaBox and Rotate its pages inherit. */
+static const char *objects[] = {
+	"1 0 obj\n<</Type/Catalog/Pages 2 0 R>>\nendobj\n",
+	"2 0 obj\n<</Type/Pages/Count 6/MediaBox[0 0 612 792]/Kids[3 0 R 4 1 R 7 0 R 8 0 R]>>\nendobj\n",
+	"3 0 obj\n<</Type/Page/Parent 2 0 R>>\nendobj\n",
+	"4 1 obj\n<</Type/Pages/Count 3/Parent 2 0 R/MediaBox[0 0 300 400]/Rotate 90/Kids[5 0 R 6 0 R 9 0 R]>>\nendobj\n",
+	"5 0 obj\n<</Type/Page/Parent 4 1 R>>\nendobj\n",
+	"6 0 obj\n<</Type/Page/Parent 4 1 R/MediaBox[0 0 100 100]>>\nendobj\n",
+	"7 0 obj\n<</Type/Page/Parent 2 0 R>>\nendobj\n",
+	"8 0 obj\n<</Type/Page/Parent 2 0 R/Rotate 180>>\nendobj\n",
+	"9 0 obj\n<</Type/Page/Parent 4 1 R>>\nendobj\n",
+};
+
+#define OBJECTS (int)(sizeof objects / sizeof *objects)
+
+static fz_buffer *make_file(fz_context *ctx)
+{
+	fz_buffer *buf = fz_new_buffer(ctx, 4096);
+	size_t ofs[OBJECTS];
+	size_t startxref;
+	int i;
+
+	fz_append_string(ctx, buf, "%PDF-1.7\n");
+	for (i = 0; i < OBJECTS; i++)
+	{
+		ofs[i] = buf->len;
+		fz_append_string(ctx, buf, objects[i]);
+	}
+	startxref = buf->len;
+	fz_append_printf(ctx, buf, "xref\n0 %d\n0000000000 65535 f \n", OBJECTS + 1);
+	for (i = 0; i < OBJECTS; i++)
+		fz_append_printf(ctx, buf, "%010zu %05d n \n", ofs[i], i == 3 ? 1 : 0);
+	fz_append_printf(ctx, buf, "trailer\n<</Size %d/Root 1 0 R>>\nstartxref\n%zu\n%%%%EOF\n", OBJECTS + 1, startxref);
+
+	return buf;
+}
+
+static pdf_document *open_pdf(fz_context *ctx, fz_buffer *buf, fz_buffer *accel)
+{
+	fz_stream *stm = fz_open_buffer(ctx, buf);
+	fz_stream *acc = NULL;
+	fz_document *doc = NULL;
+
+	fz_var(acc);
+
+	fz_try(ctx)
+	{
+		if (accel)
+			acc = fz_open_buffer(ctx, accel);
+		doc = fz_open_accelerated_document_with_stream(ctx, "application/pdf", stm, acc);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_stream(ctx, acc);
+		fz_drop_stream(ctx, stm);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	return (pdf_document *)doc;
+}
+
+static fz_buffer *make_accelerator(fz_context *ctx, pdf_document *doc)
+{
+	fz_buffer *accel = fz_new_buffer(ctx, 1024);
+
+	fz_try(ctx)
+	{
+		/* This closes and drops the output. */
+		fz_output_accelerator(ctx, &doc->super, fz_new_output_with_buffer(ctx, accel));
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_buffer(ctx, accel);
+		fz_rethrow(ctx);
+	}
+
+	return accel;
+}
+
+/* Every page is the kid of its parent that the map says it is. */
+static int check_locations(fz_context *ctx, pdf_document *doc, const char *what)
+{
+	pdf_fwd_page_map *map = doc->fwd_page_map;
+	int i, n = pdf_count_pages(ctx, doc);
+	int bad = 0;
+
+	if (!map || map->count != n)
+	{
+		fprintf(stderr, "%s: no page map\n", what);
+		return 1;
+	}
+
+	for (i = 0; i < n; i++)
+	{
+		pdf_fwd_page *fwd = &map->pages[i];
+		pdf_obj *kid = pdf_array_get(ctx, pdf_dict_get(ctx, fwd->parent, PDF_NAME(Kids)), fwd->index);
+		if (pdf_to_num(ctx, kid) != pdf_to_num(ctx, fwd->page) ||
+			pdf_to_num(ctx, pdf_dict_get(ctx, kid, PDF_NAME(Parent))) != pdf_to_num(ctx, fwd->parent))
+		{
+			fprintf(stderr, "%s: page %d is not kid %d of its parent\n", what, i, fwd->index);
+			bad++;
+		}
+	}
+
+	return bad;
+}
+
+/* The pages are the same, with the same inherited attributes. */
+static int compare_pages(fz_context *ctx, pdf_document *a, pdf_document *b)
+{
+	int i, n = pdf_count_pages(ctx, a);
+	int bad = 0;
+
+	if (n != pdf_count_pages(ctx, b))
+	{
+		fprintf(stderr, "page counts differ\n");
+		return 1;
+	}
+
+	for (i = 0; i < n; i++)
+	{
+		fz_page *pa = fz_load_page(ctx, &a->super, i);
+		fz_page *pb = NULL;
+		fz_rect ra, rb;
+
+		fz_try(ctx)
+		{
+			pb = fz_load_page(ctx, &b->super, i);
+			ra = fz_bound_page(ctx, pa);
+			rb = fz_bound_page(ctx, pb);
+			if (pdf_to_num(ctx, ((pdf_page *)pa)->obj) != pdf_to_num(ctx, ((pdf_page *)pb)->obj) ||
+				memcmp(&ra, &rb, sizeof ra))
+			{
+				fprintf(stderr, "page %d differs\n", i);
+				bad++;
+			}
+		}
+		fz_always(ctx)
+		{
+			fz_drop_page(ctx, pa);
+			fz_drop_page(ctx, pb);
+		}
+		fz_catch(ctx)
+			fz_rethrow(ctx);
+	}
+
+	return bad;
+}
+
+/* An accelerator that is cut short must be ignored, and the file
+ * loaded as usual. */
+static int check_truncated(fz_context *ctx, fz_buffer *buf, fz_buffer *accel, pdf_document *plain)
+{
+	static const int cut[] = { 1, 2, 3, 8 };
+	fz_buffer *part = NULL;
+	pdf_document *doc = NULL;
+	int i, bad = 0;
+
+	fz_var(part);
+	fz_var(doc);
+
+	fz_try(ctx)
+	{
+		for (i = 0; i < (int)(sizeof cut / sizeof *cut); i++)
+		{
+			part = fz_new_buffer_from_copied_data(ctx, accel->data, accel->len * (cut[i] - 1) / cut[i] + 1);
+			doc = open_pdf(ctx, buf, part);
+			bad += compare_pages(ctx, plain, doc);
+			pdf_drop_document(ctx, doc);
+			doc = NULL;
+			fz_drop_buffer(ctx, part);
+			part = NULL;
+		}
+	}
+	fz_always(ctx)
+	{
+		pdf_drop_document(ctx, doc);
+		fz_drop_buffer(ctx, part);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	return bad;
+}
+
+int main(int argc, char **argv)
+{
+	fz_context *ctx;
+	fz_buffer *buf = NULL;
+	fz_buffer *accel = NULL;
+	pdf_document *plain = NULL;
+	pdf_document *doc = NULL;
+	pdf_obj *page = NULL;
+	int i, bad = 0, ret = 0;
+
+	ctx = fz_new_context(NULL, NULL, FZ_STORE_DEFAULT);
+	if (!ctx)
+	{
+		fprintf(stderr, "cannot initialise context\n");
+		exit(1);
+	}
+
+	fz_var(buf);
+	fz_var(accel);
+	fz_var(plain);
+	fz_var(doc);
+	fz_var(page);
+
+	fz_try(ctx)
+	{
+		fz_register_document_handlers(ctx);
+
+		buf = make_file(ctx);
+		plain = open_pdf(ctx, buf, NULL);
+		accel = make_accelerator(ctx, plain);
+
+		doc = open_pdf(ctx, buf, accel);
+		bad += check_locations(ctx, doc, "accelerated");
+		bad += compare_pages(ctx, plain, doc);
+		bad += check_truncated(ctx, buf, accel, plain);
+
+		/* A page of the root before the node, one in the node, and
+		 * the last of the root's pages after it. */
+		pdf_delete_page(ctx, doc, 0);
+		pdf_delete_page(ctx, plain, 0);
+		bad += check_locations(ctx, doc, "deleted first");
+		pdf_delete_page(ctx, doc, 1);
+		pdf_delete_page(ctx, plain, 1);
+		bad += check_locations(ctx, doc, "deleted in node");
+
+		for (i = 0; i < 2; i++)
+		{
+			page = pdf_add_page(ctx, doc, fz_make_rect(0, 0, 200, 200), 0, NULL, NULL);
+			pdf_insert_page(ctx, doc, i * 2, page);
+			pdf_drop_obj(ctx, page);
+			page = NULL;
+			page = pdf_add_page(ctx, plain, fz_make_rect(0, 0, 200, 200), 0, NULL, NULL);
+			pdf_insert_page(ctx, plain, i * 2, page);
+			pdf_drop_obj(ctx, page);
+			page = NULL;
+			bad += check_locations(ctx, doc, "inserted");
+		}
+
+		pdf_delete_page(ctx, doc, pdf_count_pages(ctx, doc) - 1);
+		pdf_delete_page(ctx, plain, pdf_count_pages(ctx, plain) - 1);
+		bad += check_locations(ctx, doc, "deleted last");
+
+		bad += compare_pages(ctx, plain, doc);
+		if (bad)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "page map does not match the page tree");
+	}
+	fz_always(ctx)
+	{
+		pdf_drop_obj(ctx, page);
+		pdf_drop_document(ctx, plain);
+		pdf_drop_document(ctx, doc);
+		fz_drop_buffer(ctx, accel);
+		fz_drop_buffer(ctx, buf);
+	}
+	fz_catch(ctx)
+	{
+		fprintf(stderr, "page-map-test: %s\n", fz_caught_message(ctx));
+		ret = 1;
+	}
+
+	fz_drop_context(ctx);
+	return ret;
+}
@@ -0,0 +1,188 @@
+/*
+ * Fill paths, with and without antialiasing, through clips and into
+ * groups, on gray, rgb and cmyk pixmaps of many widths with and without
+ * alpha, and print a digest of each result. The output must be the same
+ * whichever SIMD code is used (see FZ_SIMD in the Makefile).
+ *
+ * With -b, time drawing the same things on a large page instead.
+ */
+
+#include "mupdf/fitz.h"
+
+#include "test-util.h"
+
+/* Random samples, with no color more than its alpha. */
+static void fill_pixmap(fz_context *ctx, fz_pixmap *pix)
+{
+	unsigned char *s = fz_pixmap_samples(ctx, pix);
+	int n = fz_pixmap_components(ctx, pix);
+	int alpha = fz_pixmap_alpha(ctx, pix);
+	size_t i, len = (size_t)fz_pixmap_stride(ctx, pix) * fz_pixmap_height(ctx, pix);
+	int k;
+
+	for (i = 0; i < len; i++)
+		s[i] = rnd();
+	if (alpha)
+		for (i = 0; i < len; i += n)
+			for (k = 0; k < n - 1; k++)
+				if (s[i + k] > s[i + n - 1])
+					s[i + k] = s[i + n - 1];
+}
+
+static fz_path *random_path(fz_context *ctx, int w, int h)
+{
+	fz_path *path = fz_new_path(ctx);
+	int i;
+
+	fz_try(ctx)
+	{
+		fz_moveto(ctx, path, rndf(w), rndf(h));
+		for (i = 0; i < 6; i++)
+		{
+			if (i & 1)
+				fz_curveto(ctx, path, rndf(w), rndf(h), rndf(w), rndf(h), rndf(w), rndf(h));
+			else
+				fz_lineto(ctx, path, rndf(w), rndf(h));
+		}
+		fz_closepath(ctx, path);
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_path(ctx, path);
+		fz_rethrow(ctx);
+	}
+
+	return path;
+}
+
+static void fill(fz_context *ctx, fz_device *dev, fz_colorspace *cs, int w, int h, float alpha)
+{
+	fz_path *path = random_path(ctx, w, h);
+	float color[FZ_MAX_COLORS];
+	int i;
+
+	for (i = 0; i < fz_colorspace_n(ctx, cs); i++)
+		color[i] = rndf(1);
+
+	fz_try(ctx)
+		fz_fill_path(ctx, dev, path, rnd() & 1, fz_identity, cs, color, alpha, fz_default_color_params);
+	fz_always(ctx)
+		fz_drop_path(ctx, path);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+static void clip(fz_context *ctx, fz_device *dev, int w, int h)
+{
+	fz_path *path = random_path(ctx, w, h);
+
+	fz_try(ctx)
+		fz_clip_path(ctx, dev, path, 0, fz_identity, fz_infinite_rect);
+	fz_always(ctx)
+		fz_drop_path(ctx, path);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+static void draw(fz_context *ctx, fz_pixmap *pix, int shapes)
+{
+	fz_colorspace *cs = fz_pixmap_colorspace(ctx, pix);
+	int w = fz_pixmap_width(ctx, pix);
+	int h = fz_pixmap_height(ctx, pix);
+	fz_rect area = fz_make_rect(0, 0, w, h);
+	fz_device *dev = fz_new_draw_device(ctx, fz_identity, pix);
+	int i;
+
+	fz_try(ctx)
+	{
+		for (i = 0; i < shapes; i++)
+		{
+			fill(ctx, dev, cs, w, h, 1);
+			fill(ctx, dev, cs, w, h, 0.6f);
+
+			clip(ctx, dev, w, h);
+			fill(ctx, dev, cs, w, h, 1);
+			fz_pop_clip(ctx, dev);
+
+			fz_begin_group(ctx, dev, area, NULL, 1, 0, FZ_BLEND_NORMAL, 1);
+			fill(ctx, dev, cs, w, h, 1);
+			fill(ctx, dev, cs, w, h, 0.3f);
+			fz_end_group(ctx, dev);
+
+			fz_begin_group(ctx, dev, area, NULL, 0, 0, FZ_BLEND_NORMAL, 0.7f);
+			fill(ctx, dev, cs, w, h, 1);
+			fz_end_group(ctx, dev);
+		}
+		fz_close_device(ctx, dev);
+	}
+	fz_always(ctx)
+		fz_drop_device(ctx, dev);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+static void check(fz_context *ctx)
+{
+	static const int widths[] = { 1, 2, 5, 8, 15, 16, 17, 31, 33, 64, 99 };
+	fz_colorspace *spaces[] = { fz_device_gray(ctx), fz_device_rgb(ctx), fz_device_cmyk(ctx) };
+	int aa, c, alpha, i;
+
+	for (aa = 0; aa <= 8; aa += 8)
+	{
+		fz_set_aa_level(ctx, aa);
+		for (c = 0; c < 3; c++)
+		{
+			for (alpha = 0; alpha <= 1; alpha++)
+			{
+				for (i = 0; i < (int)nelem(widths); i++)
+				{
+					fz_pixmap *pix = fz_new_pixmap(ctx, spaces[c], widths[i], 24, NULL, alpha);
+					fz_try(ctx)
+					{
+						fill_pixmap(ctx, pix);
+						draw(ctx, pix, 3);
+						printf("aa %d %s alpha %d width %2d:", aa, fz_colorspace_name(ctx, spaces[c]), alpha, widths[i]);
+						print_pixmap_digest(ctx, pix);
+					}
+					fz_always(ctx)
+						fz_drop_pixmap(ctx, pix);
+					fz_catch(ctx)
+						fz_rethrow(ctx);
+				}
+			}
+		}
+	}
+}
+
+static void bench(fz_context *ctx)
+{
+	fz_colorspace *spaces[] = { fz_device_gray(ctx), fz_device_rgb(ctx), fz_device_cmyk(ctx) };
+	int c, alpha;
+
+	fz_set_aa_level(ctx, 8);
+	for (c = 0; c < 3; c++)
+	{
+		for (alpha = 0; alpha <= 1; alpha++)
+		{
+			fz_pixmap *pix = fz_new_pixmap(ctx, spaces[c], 1275, 1650, NULL, alpha);
+			double t;
+			fz_try(ctx)
+			{
+				fz_clear_pixmap_with_value(ctx, pix, 255);
+				t = now();
+				draw(ctx, pix, 20);
+				t = now() - t;
+				printf("%-10s alpha %d: %6.1f ms\n", fz_colorspace_name(ctx, spaces[c]), alpha, t * 1000);
+			}
+			fz_always(ctx)
+				fz_drop_pixmap(ctx, pix);
+			fz_catch(ctx)
+				fz_rethrow(ctx);
+		}
+	}
+}
+
+int main(int argc, char **argv)
+{
+	return test_main("paint-test", argc, argv, 0, check, bench);
+}
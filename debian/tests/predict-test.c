@@ -0,0 +1,115 @@
+/*
+ * Undo PNG predictors of every type, for every number of colors and bits
+ * per component, and print a digest of each result. The output must be
+ * the same whichever SIMD code is used (see FZ_SIMD in the Makefile).
+ *
+ * With -b, time the commonest cases instead.
+ */
+
+#include "mupdf/fitz.h"
+
+#include "test-util.h"
+
+static fz_buffer *unpredict(fz_context *ctx, fz_buffer *data, int predictor, int columns, int colors, int bpc)
+{
+	fz_stream *stm = fz_open_buffer(ctx, data);
+	fz_stream *pred = NULL;
+	fz_buffer *out = NULL;
+
+	fz_var(pred);
+
+	fz_try(ctx)
+	{
+		pred = fz_open_predict(ctx, stm, predictor, columns, colors, bpc);
+		out = fz_read_all(ctx, pred, data->len);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_stream(ctx, pred);
+		fz_drop_stream(ctx, stm);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	return out;
+}
+
+/* Random rows, each with a random filter type (or the one given by
+ * predictor 10 to 14), and sometimes a short last row. */
+static void check(fz_context *ctx)
+{
+	static const int bpcs[] = { 1, 2, 4, 8, 16 };
+	int i;
+
+	for (i = 0; i < 600; i++)
+	{
+		int colors = 1 + i % 5;
+		int bpc = bpcs[(i / 5) % 5];
+		int predictor = 10 + (i / 25) % 6;
+		int columns = 1 + rnd() % 90;
+		int rows = 1 + rnd() % 20;
+		int stride = (columns * colors * bpc + 7) / 8 + 1;
+		size_t len = (size_t)stride * rows;
+		fz_buffer *data, *out;
+		unsigned char digest[16];
+		size_t k;
+
+		if (i % 7 == 0)
+			len -= rnd() % stride;
+
+		data = fz_new_buffer(ctx, len);
+		for (k = 0; k < len; k++)
+			data->data[k] = k % stride == 0 ? rnd() % 5 : rnd();
+		data->len = len;
+
+		out = unpredict(ctx, data, predictor, columns, colors, bpc);
+		fz_md5_buffer(ctx, out, digest);
+		printf("predictor %d colors %d bpc %2d columns %2d rows %2d:", predictor, colors, bpc, columns, rows);
+		print_digest(digest);
+
+		fz_drop_buffer(ctx, out);
+		fz_drop_buffer(ctx, data);
+	}
+}
+
+static void bench(fz_context *ctx)
+{
+	static const char *names[] = { "none", "sub", "up", "average", "paeth" };
+	int colors, type;
+
+	for (colors = 1; colors <= 4; colors++)
+	{
+		for (type = 1; type <= 4; type++)
+		{
+			int columns = 2000, rows = 2000;
+			int stride = columns * colors + 1;
+			size_t len = (size_t)stride * rows;
+			fz_buffer *data = fz_new_buffer(ctx, len);
+			double best = 1e9;
+			size_t k;
+			int rep;
+
+			for (k = 0; k < len; k++)
+				data->data[k] = k % stride == 0 ? type : rnd();
+			data->len = len;
+
+			for (rep = 0; rep < 5; rep++)
+			{
+				double t = now();
+				fz_drop_buffer(ctx, unpredict(ctx, data, 15, columns, colors, 8));
+				t = now() - t;
+				if (t < best)
+					best = t;
+			}
+			printf("%d bytes per pixel, %-7s %7.1f MB/s\n", colors, names[type], len / best / 1e6);
+
+			fz_drop_buffer(ctx, data);
+		}
+	}
+}
+
+int main(int argc, char **argv)
+{
+	/* Unknown filter types are expected. */
+	return test_main("predict-test", argc, argv, 1, check, bench);
+}
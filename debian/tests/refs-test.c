@@ -0,0 +1,167 @@
+/*
+ * Keep and drop the same objects from 1 to 16 threads at once, each
+ * with its own clone of the context, and check that the reference
+ * counts end up exactly where they started. Counts of every width are
+ * tested: a buffer, a pixmap (which is storable) and bare 8 and 16 bit
+ * counts kept with fz_keep_imp8 and fz_keep_imp16.
+ *
+ * Built with -DFZ_ENABLE_ATOMIC_REFS=0 the bare counts use the locked
+ * code instead, which must give the same result.
+ *
+ * With -b, time keeping and dropping one count from each number of
+ * threads instead.
+ */
+
+#include "mupdf/fitz.h"
+
+#include "test-util.h"
+
+#define MAX_THREADS 16
+
+typedef struct
+{
+	fz_context *ctx;
+	fz_buffer *buf;
+	fz_pixmap *pix;
+	int *refs;
+	int8_t *refs8;
+	int16_t *refs16;
+	int loops;
+	double time;
+} worker;
+
+static pthread_barrier_t start;
+
+static void *check_worker(void *arg)
+{
+	worker *w = arg;
+	fz_context *ctx = w->ctx;
+	int i;
+
+	pthread_barrier_wait(&start);
+	for (i = 0; i < w->loops; i++)
+	{
+		fz_keep_buffer(ctx, w->buf);
+		fz_keep_pixmap(ctx, w->pix);
+		fz_keep_imp(ctx, w->refs, w->refs);
+		fz_keep_imp8(ctx, w->refs8, w->refs8);
+		fz_keep_imp16(ctx, w->refs16, w->refs16);
+		if (i & 1)
+		{
+			fz_keep_buffer(ctx, w->buf);
+			fz_keep_imp16(ctx, w->refs16, w->refs16);
+			fz_drop_buffer(ctx, w->buf);
+			fz_drop_imp16(ctx, w->refs16, w->refs16);
+		}
+		fz_drop_imp16(ctx, w->refs16, w->refs16);
+		fz_drop_imp8(ctx, w->refs8, w->refs8);
+		fz_drop_imp(ctx, w->refs, w->refs);
+		fz_drop_pixmap(ctx, w->pix);
+		fz_drop_buffer(ctx, w->buf);
+	}
+	return NULL;
+}
+
+static void *bench_worker(void *arg)
+{
+	worker *w = arg;
+	fz_context *ctx = w->ctx;
+	double t;
+	int i;
+
+	pthread_barrier_wait(&start);
+	t = now();
+	for (i = 0; i < w->loops; i++)
+	{
+		fz_keep_imp(ctx, w->refs, w->refs);
+		fz_drop_imp(ctx, w->refs, w->refs);
+	}
+	w->time = now() - t;
+	return NULL;
+}
+
+/* Run fn on count threads, with the same objects and a clone of ctx each. */
+static void run(fz_context *ctx, int count, void *(*fn)(void *), worker *proto)
+{
+	pthread_t thread[MAX_THREADS];
+	worker w[MAX_THREADS];
+	int i;
+
+	pthread_barrier_init(&start, NULL, count);
+	for (i = 0; i < count; i++)
+	{
+		w[i] = *proto;
+		w[i].ctx = fz_clone_context(ctx);
+		if (!w[i].ctx)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "cannot clone context");
+		if (pthread_create(&thread[i], NULL, fn, &w[i]))
+			fz_throw(ctx, FZ_ERROR_GENERIC, "cannot create thread");
+	}
+	proto->time = 0;
+	for (i = 0; i < count; i++)
+	{
+		pthread_join(thread[i], NULL);
+		fz_drop_context(w[i].ctx);
+		if (w[i].time > proto->time)
+			proto->time = w[i].time;
+	}
+	pthread_barrier_destroy(&start);
+}
+
+static void check(fz_context *ctx)
+{
+	int refs = 1;
+	int8_t refs8 = 1;
+	int16_t refs16 = 1;
+	worker w = { NULL };
+	int count;
+
+	w.buf = fz_new_buffer(ctx, 1);
+	w.pix = fz_new_pixmap(ctx, NULL, 1, 1, NULL, 1);
+	w.refs = &refs;
+	w.refs8 = &refs8;
+	w.refs16 = &refs16;
+	w.loops = 200000;
+
+	fz_try(ctx)
+	{
+		for (count = 1; count <= MAX_THREADS; count *= 2)
+		{
+			run(ctx, count, check_worker, &w);
+			if (w.buf->refs != 1 || w.pix->storable.refs != 1 || refs != 1 || refs8 != 1 || refs16 != 1)
+				fz_throw(ctx, FZ_ERROR_GENERIC, "%d threads: counts are %d %d %d %d %d, not 1",
+					count, w.buf->refs, w.pix->storable.refs, refs, refs8, refs16);
+		}
+	}
+	fz_always(ctx)
+	{
+		fz_drop_pixmap(ctx, w.pix);
+		fz_drop_buffer(ctx, w.buf);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+static void bench(fz_context *ctx)
+{
+	int refs = 1;
+	worker w = { NULL };
+	int count;
+
+	w.refs = &refs;
+	w.loops = 2000000;
+
+	for (count = 1; count <= MAX_THREADS; count *= 2)
+	{
+		run(ctx, count, bench_worker, &w);
+		printf("%s refs, %2d threads: %6.1f ns per keep and drop\n",
+			FZ_ATOMIC_REFS ? "atomic" : "locked", count, w.time * 1e9 / w.loops);
+	}
+	if (refs != 1)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "count is %d, not 1", refs);
+}
+
+int main(int argc, char **argv)
+{
+	return test_main("refs-test", argc, argv, 0, check, bench);
+}
@@ -0,0 +1,429 @@
+/*
+ * Render a display list on several threads, into a pixmap and in
+ * bands, with different numbers of threads and band heights, and check
+ * that every render matches the list drawn band by band on this thread.
+ * Also check that bands are written in order, that two renders queued
+ * at once both come out right, and that aborting through the cookie,
+ * or an error in a band, stops the render at the right place.
+ */
+
+#include "mupdf/fitz.h"
+
+#include "test-util.h"
+
+#define PAGE_W 600
+#define PAGE_H 800
+
+static fz_display_list *make_list(fz_context *ctx)
+{
+	fz_display_list *list = fz_new_display_list(ctx, fz_make_rect(0, 0, PAGE_W, PAGE_H));
+	fz_color_params cp = fz_default_color_params;
+	fz_device *dev = NULL;
+	fz_path *path = NULL;
+	fz_stroke_state *stroke = NULL;
+	fz_font *font = NULL;
+	fz_text *text = NULL;
+	fz_pixmap *pix = NULL;
+	fz_image *image = NULL;
+	float color[3];
+	fz_matrix ctm;
+	int i, k;
+
+	fz_var(dev);
+	fz_var(path);
+	fz_var(stroke);
+	fz_var(font);
+	fz_var(text);
+	fz_var(pix);
+	fz_var(image);
+
+	fz_try(ctx)
+	{
+		stroke = fz_new_stroke_state(ctx);
+		stroke->linewidth = 3;
+		font = fz_new_base14_font(ctx, "Times-Roman");
+		pix = fz_new_pixmap(ctx, fz_device_rgb(ctx), 16, 16, NULL, 0);
+		for (i = 0; i < 16 * 16 * 3; i++)
+			pix->samples[i] = rnd() & 0xff;
+		image = fz_new_image_from_pixmap(ctx, pix, NULL);
+
+		dev = fz_new_list_device(ctx, list);
+		for (i = 0; i < 400; i++)
+		{
+			float x = rndf(PAGE_W), y = rndf(PAGE_H);
+
+			color[0] = rndf(1);
+			color[1] = rndf(1);
+			color[2] = rndf(1);
+			switch (rnd() % 5)
+			{
+			case 0:
+			case 1:
+				path = fz_new_path(ctx);
+				fz_moveto(ctx, path, x, y);
+				for (k = 0; k < 4; k++)
+					fz_lineto(ctx, path, x + rndf(120) - 60, y + rndf(120) - 60);
+				fz_closepath(ctx, path);
+				if (i & 1)
+					fz_fill_path(ctx, dev, path, 0, fz_identity, fz_device_rgb(ctx), color, rnd() % 2 ? 1 : 0.6f, cp);
+				else
+					fz_stroke_path(ctx, dev, path, stroke, fz_identity, fz_device_rgb(ctx), color, 1, cp);
+				fz_drop_path(ctx, path);
+				path = NULL;
+				break;
+			case 2:
+				text = fz_new_text(ctx);
+				for (k = 0; k < 8; k++)
+				{
+					int c = 'A' + rnd() % 26;
+					fz_matrix trm = fz_make_matrix(14, 0, 0, -14, x + k * 9, y);
+					fz_show_glyph(ctx, text, font, trm, fz_encode_character(ctx, font, c), c, 0, 0, FZ_BIDI_LTR, FZ_LANG_UNSET);
+				}
+				fz_fill_text(ctx, dev, text, fz_identity, fz_device_rgb(ctx), color, 1, cp);
+				fz_drop_text(ctx, text);
+				text = NULL;
+				break;
+			case 3:
+				ctm = fz_pre_rotate(fz_translate(x, y), rnd() % 360);
+				fz_fill_image(ctx, dev, image, fz_pre_scale(ctm, 20 + rndf(60), 20 + rndf(60)), 1, cp);
+				break;
+			case 4:
+				fz_begin_group(ctx, dev, fz_make_rect(x, y, x + 80, y + 80), NULL, 0, 0, FZ_BLEND_MULTIPLY, 0.8f);
+				path = fz_new_path(ctx);
+				fz_rectto(ctx, path, x, y, x + 80, y + 80);
+				fz_fill_path(ctx, dev, path, 0, fz_identity, fz_device_rgb(ctx), color, 1, cp);
+				fz_drop_path(ctx, path);
+				path = NULL;
+				fz_end_group(ctx, dev);
+				break;
+			}
+		}
+		fz_close_device(ctx, dev);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_device(ctx, dev);
+		fz_drop_path(ctx, path);
+		fz_drop_text(ctx, text);
+		fz_drop_stroke_state(ctx, stroke);
+		fz_drop_font(ctx, font);
+		fz_drop_image(ctx, image);
+		fz_drop_pixmap(ctx, pix);
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_display_list(ctx, list);
+		fz_rethrow(ctx);
+	}
+
+	return list;
+}
+
+static fz_irect page_bbox(fz_matrix ctm)
+{
+	return fz_round_rect(fz_transform_rect(fz_make_rect(0, 0, PAGE_W, PAGE_H), ctm));
+}
+
+static fz_pixmap *new_page_pixmap(fz_context *ctx, fz_matrix ctm)
+{
+	fz_pixmap *pix = fz_new_pixmap_with_bbox(ctx, fz_device_rgb(ctx), page_bbox(ctm), NULL, 0);
+	fz_clear_pixmap_with_value(ctx, pix, 255);
+	return pix;
+}
+
+/* The list drawn on this thread, a band at a time, as the library
+ * does: into the part of the page's pixmap that the band covers, or
+ * (if shift is set) into a pixmap of band_height rows at the top of the
+ * page, with the band moved up into it. The draw device does not give
+ * exactly the same pixels whatever the pixmap it draws into and however
+ * the page is moved, so the reference must be drawn in the same way. */
+static fz_pixmap *draw_page(fz_context *ctx, fz_display_list *list, fz_matrix ctm, int band_height, int shift)
+{
+	fz_pixmap *pix = new_page_pixmap(ctx, ctm);
+	fz_pixmap *band = NULL;
+	fz_device *dev = NULL;
+	fz_matrix band_ctm;
+	fz_irect r;
+	int y, k, h;
+
+	fz_var(band);
+	fz_var(dev);
+
+	fz_try(ctx)
+	{
+		for (y = 0; y < pix->h; y += band_height)
+		{
+			h = fz_mini(band_height, pix->h - y);
+			band_ctm = ctm;
+			if (shift)
+			{
+				r = fz_make_irect(pix->x, pix->y, pix->x + pix->w, pix->y + band_height);
+				band = fz_new_pixmap_with_bbox(ctx, pix->colorspace, r, NULL, 0);
+				fz_clear_pixmap_with_value(ctx, band, 255);
+				band_ctm.f -= y;
+			}
+			else
+			{
+				r = fz_make_irect(pix->x, pix->y + y, pix->x + pix->w, pix->y + y + h);
+				band = fz_new_pixmap_from_pixmap(ctx, pix, &r);
+			}
+			dev = fz_new_draw_device(ctx, fz_identity, band);
+			fz_run_display_list(ctx, list, dev, band_ctm, fz_rect_from_irect(r), NULL);
+			fz_close_device(ctx, dev);
+			fz_drop_device(ctx, dev);
+			dev = NULL;
+			if (shift)
+				for (k = 0; k < h; k++)
+					memcpy(pix->samples + (y + k) * pix->stride, band->samples + k * band->stride, (size_t)pix->w * pix->n);
+			fz_drop_pixmap(ctx, band);
+			band = NULL;
+		}
+	}
+	fz_always(ctx)
+	{
+		fz_drop_device(ctx, dev);
+		fz_drop_pixmap(ctx, band);
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_pixmap(ctx, pix);
+		fz_rethrow(ctx);
+	}
+
+	return pix;
+}
+
+static void compare(fz_context *ctx, fz_pixmap *expect, fz_pixmap *pix, const char *what, int threads, int band_height)
+{
+	int y;
+
+	for (y = 0; y < expect->h; y++)
+		if (memcmp(expect->samples + y * expect->stride, pix->samples + y * pix->stride, (size_t)expect->w * expect->n))
+			fz_throw(ctx, FZ_ERROR_GENERIC, "%s on %d threads with bands of %d rows differs at row %d", what, threads, band_height, y);
+}
+
+static int is_blank(fz_pixmap *pix)
+{
+	int y, x;
+
+	for (y = 0; y < pix->h; y++)
+		for (x = 0; x < pix->w * pix->n; x++)
+			if (pix->samples[y * pix->stride + x] != 255)
+				return 0;
+	return 1;
+}
+
+/* Where the bands of a banded render are put together again. */
+typedef struct
+{
+	fz_pixmap *out;
+	int next; /* the band expected next */
+	int abort_after; /* abort the cookie after writing this band */
+	int fail_at; /* throw when drawing this band */
+	fz_cookie *cookie;
+} band_writer;
+
+static void write_band(fz_context *ctx, void *arg, fz_render_band *band)
+{
+	band_writer *w = arg;
+	int y;
+
+	if (band->num != w->next)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "band %d written when band %d was expected", band->num, w->next);
+	w->next++;
+
+	for (y = 0; y < band->h; y++)
+		memcpy(w->out->samples + (band->y + y) * w->out->stride, band->pix->samples + y * band->pix->stride, (size_t)w->out->w * w->out->n);
+
+	if (band->num == w->abort_after)
+		w->cookie->abort = 1;
+}
+
+/* Clear and draw a band as the library would, but fail on one of them. */
+static void draw_band(fz_context *ctx, void *arg, fz_display_list *list, fz_render_band *band, fz_cookie *cookie)
+{
+	band_writer *w = arg;
+	fz_device *dev;
+
+	if (band->num == w->fail_at)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "band %d failed", band->num);
+
+	fz_clear_pixmap_with_value(ctx, band->pix, 255);
+	dev = fz_new_draw_device(ctx, fz_identity, band->pix);
+	fz_try(ctx)
+	{
+		fz_run_display_list(ctx, list, dev, band->ctm, fz_rect_from_irect(fz_pixmap_bbox(ctx, band->pix)), cookie);
+		fz_close_device(ctx, dev);
+	}
+	fz_always(ctx)
+		fz_drop_device(ctx, dev);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+static void init_writer(band_writer *w, fz_pixmap *out, fz_cookie *cookie)
+{
+	w->out = out;
+	w->next = 0;
+	w->abort_after = -1;
+	w->fail_at = -1;
+	w->cookie = cookie;
+}
+
+static void render_bands(fz_context *ctx, fz_render_threads *threads, fz_display_list *list, fz_matrix ctm, int band_height, int own_draw, band_writer *w)
+{
+	fz_render_display_list_bands(ctx, threads, list, ctm, page_bbox(ctm), band_height,
+		fz_device_rgb(ctx), NULL, 0, own_draw ? draw_band : NULL, write_band, w, w->cookie);
+}
+
+static void check_view(fz_context *ctx, fz_display_list *list, fz_render_threads *threads, fz_matrix ctm)
+{
+	static const int heights[] = { 7, 13, 29, 100, 100000 };
+	int n = fz_count_render_threads(ctx, threads);
+	fz_pixmap *expect = NULL;
+	fz_pixmap *pix = NULL;
+	fz_pixmap *pix2 = NULL;
+	fz_render_job *job = NULL;
+	fz_render_job *job2 = NULL;
+	fz_cookie cookie = { 0 };
+	band_writer w, w2;
+	int i, failed;
+
+	fz_var(expect);
+	fz_var(pix);
+	fz_var(pix2);
+	fz_var(job);
+	fz_var(job2);
+
+	fz_try(ctx)
+	{
+		/* Into a pixmap. */
+		for (i = 0; i < (int)nelem(heights); i++)
+		{
+			expect = draw_page(ctx, list, ctm, heights[i], 0);
+			pix = new_page_pixmap(ctx, ctm);
+			fz_render_display_list_threaded(ctx, threads, list, ctm, pix, heights[i], NULL);
+			compare(ctx, expect, pix, "pixmap render", n, heights[i]);
+			fz_drop_pixmap(ctx, pix);
+			pix = NULL;
+			fz_drop_pixmap(ctx, expect);
+			expect = NULL;
+		}
+
+		/* In bands, drawn by the library and by a function of our
+		 * own. */
+		for (i = 0; i < (int)nelem(heights); i++)
+		{
+			expect = draw_page(ctx, list, ctm, heights[i], 1);
+			pix = new_page_pixmap(ctx, ctm);
+			init_writer(&w, pix, NULL);
+			render_bands(ctx, threads, list, ctm, heights[i], i & 1, &w);
+			compare(ctx, expect, pix, "banded render", n, heights[i]);
+			fz_drop_pixmap(ctx, pix);
+			pix = NULL;
+			fz_drop_pixmap(ctx, expect);
+			expect = NULL;
+		}
+
+		/* Two renders queued at once, collected in turn. */
+		expect = draw_page(ctx, list, ctm, 29, 1);
+		pix = new_page_pixmap(ctx, ctm);
+		pix2 = new_page_pixmap(ctx, ctm);
+		init_writer(&w, pix, NULL);
+		init_writer(&w2, pix2, NULL);
+		job = fz_begin_render_display_list_bands(ctx, threads, list, ctm, page_bbox(ctm), 29, fz_device_rgb(ctx), NULL, 0, NULL, write_band, &w, NULL);
+		job2 = fz_begin_render_display_list_bands(ctx, threads, list, ctm, page_bbox(ctm), 29, fz_device_rgb(ctx), NULL, 0, NULL, write_band, &w2, NULL);
+		fz_finish_render_display_list_bands(ctx, job);
+		fz_finish_render_display_list_bands(ctx, job2);
+		compare(ctx, expect, pix, "first of two renders", n, 29);
+		compare(ctx, expect, pix2, "second of two renders", n, 29);
+		fz_drop_render_job(ctx, job);
+		job = NULL;
+		fz_drop_render_job(ctx, job2);
+		job2 = NULL;
+		fz_drop_pixmap(ctx, pix2);
+		pix2 = NULL;
+
+		/* Aborted before it starts: nothing is drawn, and there is
+		 * no error. */
+		fz_clear_pixmap_with_value(ctx, pix, 255);
+		cookie.abort = 1;
+		fz_render_display_list_threaded(ctx, threads, list, ctm, pix, 29, &cookie);
+		if (!is_blank(pix))
+			fz_throw(ctx, FZ_ERROR_GENERIC, "render on %d threads drew after it was aborted", n);
+
+		/* Aborted after the third band is written: no more are. */
+		memset(&cookie, 0, sizeof cookie);
+		init_writer(&w, pix, &cookie);
+		w.abort_after = 2;
+		render_bands(ctx, threads, list, ctm, 29, 0, &w);
+		if (w.next != 3)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "%d bands written on %d threads, when the third aborted", w.next, n);
+
+		/* An error in the fifth band is passed on, once the four
+		 * before it have been written. */
+		memset(&cookie, 0, sizeof cookie);
+		init_writer(&w, pix, &cookie);
+		w.fail_at = 4;
+		failed = 0;
+		fz_try(ctx)
+			render_bands(ctx, threads, list, ctm, 29, 1, &w);
+		fz_catch(ctx)
+		{
+			if (strcmp(fz_caught_message(ctx), "band 4 failed"))
+				fz_rethrow(ctx);
+			failed = 1;
+		}
+		if (!failed || w.next != 4)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "%d bands written on %d threads before the fifth failed", w.next, n);
+
+		/* The threads are still fit for use. */
+		init_writer(&w, pix, NULL);
+		render_bands(ctx, threads, list, ctm, 29, 0, &w);
+		compare(ctx, expect, pix, "banded render after an error", n, 29);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_render_job(ctx, job);
+		fz_drop_render_job(ctx, job2);
+		fz_drop_pixmap(ctx, pix);
+		fz_drop_pixmap(ctx, pix2);
+		fz_drop_pixmap(ctx, expect);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+static void check(fz_context *ctx)
+{
+	static const int counts[] = { 1, 3, 8 };
+	fz_display_list *list = make_list(ctx);
+	fz_render_threads *threads = NULL;
+	int i;
+
+	fz_var(threads);
+
+	fz_try(ctx)
+	{
+		for (i = 0; i < (int)nelem(counts); i++)
+		{
+			threads = fz_new_render_threads(ctx, counts[i]);
+			check_view(ctx, list, threads, fz_identity);
+			check_view(ctx, list, threads, fz_pre_rotate(fz_scale(1.3f, 1.3f), 10));
+			fz_drop_render_threads(ctx, threads);
+			threads = NULL;
+		}
+	}
+	fz_always(ctx)
+	{
+		fz_drop_render_threads(ctx, threads);
+		fz_drop_display_list(ctx, list);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+int main(int argc, char **argv)
+{
+	return test_main("render-threads-test", argc, argv, 1, check, NULL);
+}
@@ -0,0 +1,266 @@
+/*
+ * Repair broken PDF files both on the calling thread and on a pool of
+ * rendering threads, and check that both find the same objects. One
+ * file is large, with streams of the wrong length. The other has
+ * object headers in comments between the objects and in strings inside
+ * them, and dictionaries between the objects that are not after
+ * 'trailer'.
+ */
+
+#include "mupdf/fitz.h"
+#include "mupdf/pdf.h"
+
+#include "test-util.h"
+
+#define OBJECTS 20000
+#define TRICKY_OBJECTS 2000
+
+/* Count the calls made to the pool, to be sure that it was used. */
+static fz_thread_pool render_pool;
+static int pool_calls;
+
+static void run_counted(void *user, int count, void (*fn)(void *arg, int i), void *arg)
+{
+	pool_calls++;
+	render_pool.run(render_pool.user, count, fn, arg);
+}
+
+/* Several megabytes of objects, with no usable xref. Some streams have
+ * the wrong length, some objects are defined twice, and some streams
+ * hold things that look like object headers. */
+static fz_buffer *make_broken_file(fz_context *ctx)
+{
+	fz_buffer *buf = fz_new_buffer(ctx, 8 << 20);
+	char filler[500];
+	int i;
+
+	memset(filler, '0', sizeof filler);
+
+	fz_append_string(ctx, buf, "%PDF-1.7\n%\xe2\xe3\xcf\xd3\n");
+	fz_append_string(ctx, buf, "1 0 obj\n<</Type/Catalog/Pages 2 0 R>>\nendobj\n");
+	fz_append_string(ctx, buf, "2 0 obj\n<</Type/Pages/Count 1/Kids[3 0 R]>>\nendobj\n");
+	fz_append_string(ctx, buf, "3 0 obj\n<</Type/Page/Parent 2 0 R/MediaBox[0 0 612 792]/Contents 4 0 R>>\nendobj\n");
+	fz_append_string(ctx, buf, "4 0 obj\n<</Length 999>>\nstream\n0 0 1 rg 100 100 400 600 re f\nendstream\nendobj\n");
+	for (i = 5; i < OBJECTS; i++)
+	{
+		switch (i % 5)
+		{
+		case 0:
+			fz_append_printf(ctx, buf, "%d 0 obj\n<</Length %d>>\nstream\n", i, 20 + i % 13);
+			fz_append_printf(ctx, buf, "%d 0 obj (not really) endobj ", i + 1);
+			fz_append_data(ctx, buf, filler, 40 + i % 77);
+			fz_append_byte(ctx, buf, '\n');
+			fz_append_string(ctx, buf, "endstream\nendobj\n");
+			break;
+		case 1:
+			fz_append_printf(ctx, buf, "%d 0 obj\n[%d 0 R (string %d) /Name%d %g]\nendobj\n", i, i - 1, i, i, i / 7.0f);
+			break;
+		case 2:
+			fz_append_printf(ctx, buf, "%d 0 obj<</Kind/Dict/Number %d/Text(", i, i);
+			fz_append_data(ctx, buf, filler, 100 + i % 50);
+			fz_append_string(ctx, buf, ")>>endobj\r\n");
+			break;
+		case 3:
+			fz_append_printf(ctx, buf, "%d 0 obj\n%d\nendobj\n", i, i * 3);
+			if (i % 1000 == 3)
+				fz_append_string(ctx, buf, "trailer\n<</Size 5/Root 1 0 R>>\n");
+			break;
+		case 4:
+			fz_append_printf(ctx, buf, "%d 0 obj\n<</Redefined %d>>\nendobj\n", i - 2, i);
+			fz_append_printf(ctx, buf, "%d 0 obj\n<</Length 0>>stream\n", i);
+			fz_append_data(ctx, buf, filler, 200 + i % 300);
+			fz_append_string(ctx, buf, "\nendstream\nendobj\n");
+			break;
+		}
+	}
+	fz_append_string(ctx, buf, "xref\n0 1\n0000000000 65535 f \ntrailer\n<</Size 5/Root 1 0 R>>\nstartxref\n123\n%%EOF\n");
+
+	return buf;
+}
+
+/* Objects with things between them that look like object headers, but
+ * which the lexer sees are in comments, and headers in strings inside
+ * the objects. A header in a comment redefines an object that came
+ * before it, so taking it as an object would change that object. */
+static fz_buffer *make_tricky_file(fz_context *ctx)
+{
+	fz_buffer *buf = fz_new_buffer(ctx, 256 << 10);
+	int i;
+
+	fz_append_string(ctx, buf, "%PDF-1.7\n%1 0 obj <</Type/Bogus>> endobj\n");
+	fz_append_string(ctx, buf, "1 0 obj\n<</Type/Catalog/Pages 2 0 R>>\nendobj\n");
+	fz_append_string(ctx, buf, "2 0 obj\n<</Type/Pages/Count 1/Kids[3 0 R]>>\nendobj\n");
+	fz_append_string(ctx, buf, "3 0 obj\n<</Type/Page/Parent 2 0 R/MediaBox[0 0 612 792]>>\nendobj\n");
+	for (i = 4; i < TRICKY_OBJECTS; i++)
+	{
+		switch (i % 6)
+		{
+		case 0:
+			fz_append_printf(ctx, buf, "%% %d 0 obj <</Commented true>> endobj\n", i - 1);
+			break;
+		case 1:
+			fz_append_printf(ctx, buf, "%%%d 0 obj\n%%endobj %% %d 0 obj 1\n", i - 3, i - 2);
+			break;
+		case 2:
+			fz_append_printf(ctx, buf, "(a string with endobj and <</Number %d>> in it)\n", i);
+			break;
+		case 3:
+			fz_append_string(ctx, buf, "<</Info 5 0 R>>\n");
+			break;
+		case 4:
+			fz_append_printf(ctx, buf, "%% trailer\n%% <</Root %d 0 R>>\n", i);
+			break;
+		case 5:
+			fz_append_printf(ctx, buf, "junk %d %% %d 0 obj\n", i, i - 1);
+			break;
+		}
+		fz_append_printf(ctx, buf, "%d 0 obj\n<</Number %d/Text(%d 0 obj)>>\nendobj\n", i, i, i - 1);
+	}
+	fz_append_string(ctx, buf, "trailer\n<</Size 5/Root 1 0 R>>\nstartxref\n123\n%%EOF\n");
+
+	return buf;
+}
+
+static pdf_document *open_repaired(fz_context *ctx, fz_buffer *buf)
+{
+	fz_stream *stm = fz_open_buffer(ctx, buf);
+	pdf_document *doc = NULL;
+
+	fz_try(ctx)
+	{
+		doc = pdf_open_document_with_stream(ctx, stm);
+		if (!pdf_was_repaired(ctx, doc))
+			fz_throw(ctx, FZ_ERROR_GENERIC, "file was not repaired");
+	}
+	fz_always(ctx)
+		fz_drop_stream(ctx, stm);
+	fz_catch(ctx)
+	{
+		pdf_drop_document(ctx, doc);
+		fz_rethrow(ctx);
+	}
+
+	return doc;
+}
+
+static int compare(fz_context *ctx, pdf_document *a, pdf_document *b)
+{
+	int i, n, bad = 0;
+
+	n = pdf_xref_len(ctx, a);
+	if (n != pdf_xref_len(ctx, b))
+	{
+		fprintf(stderr, "xref lengths differ: %d and %d\n", n, pdf_xref_len(ctx, b));
+		return 1;
+	}
+
+	for (i = 1; i < n && bad < 10; i++)
+	{
+		pdf_xref_entry *x = pdf_get_xref_entry(ctx, a, i);
+		pdf_xref_entry *y = pdf_get_xref_entry(ctx, b, i);
+		pdf_obj *ox, *oy;
+
+		/* The offsets of the objects themselves may differ by the
+		 * whitespace before them. */
+		if (x->type != y->type || x->gen != y->gen || x->stm_ofs != y->stm_ofs)
+		{
+			fprintf(stderr, "xref entries for object %d differ\n", i);
+			bad++;
+			continue;
+		}
+		if (x->type != 'n')
+			continue;
+
+		ox = pdf_load_object(ctx, a, i);
+		oy = pdf_load_object(ctx, b, i);
+		if (pdf_objcmp(ctx, ox, oy))
+		{
+			fprintf(stderr, "object %d differs\n", i);
+			bad++;
+		}
+		else if (pdf_is_stream(ctx, ox))
+		{
+			fz_buffer *sx = pdf_load_raw_stream_number(ctx, a, i);
+			fz_buffer *sy = pdf_load_raw_stream_number(ctx, b, i);
+			if (sx->len != sy->len || memcmp(sx->data, sy->data, sx->len))
+			{
+				fprintf(stderr, "stream %d differs\n", i);
+				bad++;
+			}
+			fz_drop_buffer(ctx, sx);
+			fz_drop_buffer(ctx, sy);
+		}
+		pdf_drop_obj(ctx, ox);
+		pdf_drop_obj(ctx, oy);
+	}
+
+	return bad;
+}
+
+/* Repair the file without and with the pool, and compare. */
+static void check_file(fz_context *ctx, fz_buffer *buf, const char *what)
+{
+	fz_render_threads *threads = NULL;
+	pdf_document *plain = NULL;
+	pdf_document *threaded = NULL;
+	fz_thread_pool pool;
+
+	fz_var(threads);
+	fz_var(plain);
+	fz_var(threaded);
+
+	fz_try(ctx)
+	{
+		plain = open_repaired(ctx, buf);
+
+		threads = fz_new_render_threads(ctx, 3);
+		render_pool = fz_render_thread_pool(ctx, threads);
+		pool = render_pool;
+		pool.run = run_counted;
+		pool_calls = 0;
+		fz_tune_thread_pool(ctx, &pool);
+		threaded = open_repaired(ctx, buf);
+		fz_tune_thread_pool(ctx, NULL);
+
+		if (pool_calls == 0)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "%s: repair did not use the thread pool", what);
+		if (compare(ctx, plain, threaded))
+			fz_throw(ctx, FZ_ERROR_GENERIC, "%s: repairs differ", what);
+		printf("%s: %d objects found\n", what, pdf_xref_len(ctx, plain));
+	}
+	fz_always(ctx)
+	{
+		fz_tune_thread_pool(ctx, NULL);
+		pdf_drop_document(ctx, plain);
+		pdf_drop_document(ctx, threaded);
+		fz_drop_render_threads(ctx, threads);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+static void check(fz_context *ctx)
+{
+	fz_buffer *buf = make_broken_file(ctx);
+
+	fz_var(buf);
+
+	fz_try(ctx)
+	{
+		check_file(ctx, buf, "broken");
+		fz_drop_buffer(ctx, buf);
+		buf = NULL;
+		buf = make_tricky_file(ctx);
+		check_file(ctx, buf, "tricky");
+	}
+	fz_always(ctx)
+		fz_drop_buffer(ctx, buf);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+int main(int argc, char **argv)
+{
+	/* Repairing is expected to complain. */
+	return test_main("repair-test", argc, argv, 1, check, NULL);
+}
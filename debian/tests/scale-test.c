@@ -0,0 +1,260 @@
+/*
+ * Draw images scaled up and down, flipped and turned, with 1 to 4
+ * colorants with and without alpha, and image masks, and print a
+ * digest of each result. The output must be the same whichever SIMD
+ * code is used (see FZ_SIMD in the Makefile). Each image is drawn both
+ * on the calling thread and on a pool of rendering threads, which must
+ * give the same result.
+ *
+ * With -b, time drawing a 300dpi scan at 200dpi instead (which is not
+ * simply subsampled), without and with the pool.
+ */
+
+#include "mupdf/fitz.h"
+
+#include "test-util.h"
+
+/* Count the calls made to the pool, to be sure that it was used. */
+static fz_thread_pool render_pool;
+static int pool_calls;
+
+static void run_counted(void *user, int count, void (*fn)(void *arg, int i), void *arg)
+{
+	pool_calls++;
+	render_pool.run(render_pool.user, count, fn, arg);
+}
+
+/* Scale images whenever they are drawn at another size, not only when
+ * they are made smaller. */
+static int always_scale(void *arg, int dst_w, int dst_h, int src_w, int src_h)
+{
+	return 1;
+}
+
+/* Random samples, with no color more than its alpha. */
+static fz_image *random_image(fz_context *ctx, fz_colorspace *cs, int w, int h, int alpha)
+{
+	fz_pixmap *pix = fz_new_pixmap(ctx, cs, w, h, NULL, alpha);
+	unsigned char *s = fz_pixmap_samples(ctx, pix);
+	int n = fz_pixmap_components(ctx, pix);
+	size_t i, len = (size_t)fz_pixmap_stride(ctx, pix) * h;
+	fz_image *image = NULL;
+	int k;
+
+	for (i = 0; i < len; i++)
+		s[i] = rnd();
+	if (alpha)
+		for (i = 0; i < len; i += n)
+			for (k = 0; k < n - 1; k++)
+				if (s[i + k] > s[i + n - 1])
+					s[i + k] = s[i + n - 1];
+
+	fz_try(ctx)
+		image = fz_new_image_from_pixmap(ctx, pix, NULL);
+	fz_always(ctx)
+		fz_drop_pixmap(ctx, pix);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	return image;
+}
+
+/* Sizes relative to the image, and turns: flips, quarter turns, and one
+ * that is not rectilinear. */
+static const float sizes[][2] = {
+	{ 0.13f, 0.21f }, { 0.5f, 0.5f }, { 0.77f, 0.34f }, { 1.6f, 0.9f }, { 2.3f, 3.1f },
+};
+
+static const fz_matrix turns[] = {
+	{ 1, 0, 0, 1, 0, 0 },
+	{ -1, 0, 0, 1, 0, 0 },
+	{ 1, 0, 0, -1, 0, 0 },
+	{ 0, 1, -1, 0, 0, 0 },
+	{ 0, -1, 1, 0, 0, 0 },
+	{ 0.94f, 0.34f, -0.34f, 0.94f, 0, 0 },
+};
+
+static fz_pixmap *draw(fz_context *ctx, fz_colorspace *cs, fz_image *image, int mask, float sx, float sy, fz_matrix turn, float alpha)
+{
+	fz_pixmap *pix = fz_new_pixmap(ctx, cs, 160, 140, NULL, 0);
+	fz_device *dev = NULL;
+	float color[FZ_MAX_COLORS] = { 0 };
+	fz_matrix ctm;
+
+	fz_var(dev);
+
+	fz_try(ctx)
+	{
+		fz_clear_pixmap_with_value(ctx, pix, 255);
+		dev = fz_new_draw_device(ctx, fz_identity, pix);
+
+		/* Scaled about the middle of the image, then turned and
+		 * moved to a fraction of a pixel off the middle of the
+		 * pixmap. */
+		ctm = fz_make_matrix(image->w * sx, 0, 0, image->h * sy, -image->w * sx / 2, -image->h * sy / 2);
+		ctm = fz_concat(ctm, turn);
+		ctm = fz_concat(ctm, fz_translate(80.3f, 70.6f));
+
+		if (mask)
+			fz_fill_image_mask(ctx, dev, image, ctm, cs, color, alpha, fz_default_color_params);
+		else
+			fz_fill_image(ctx, dev, image, ctm, alpha, fz_default_color_params);
+		fz_close_device(ctx, dev);
+	}
+	fz_always(ctx)
+		fz_drop_device(ctx, dev);
+	fz_catch(ctx)
+	{
+		fz_drop_pixmap(ctx, pix);
+		fz_rethrow(ctx);
+	}
+
+	return pix;
+}
+
+static void check(fz_context *ctx, const fz_thread_pool *pool)
+{
+	static const int dims[][2] = { { 3, 2 }, { 37, 29 }, { 150, 130 } };
+	fz_colorspace *spaces[] = { NULL, fz_device_gray(ctx), fz_device_rgb(ctx), fz_device_cmyk(ctx) };
+	int c, alpha, d, s, t, a;
+
+	for (c = 0; c < 4; c++)
+	for (alpha = !spaces[c]; alpha <= 1; alpha++)
+	for (d = 0; d < (int)nelem(dims); d++)
+	{
+		fz_colorspace *cs = spaces[c] ? spaces[c] : fz_device_gray(ctx);
+		fz_image *image = random_image(ctx, spaces[c], dims[d][0], dims[d][1], alpha);
+
+		fz_try(ctx)
+		{
+			for (s = 0; s < (int)nelem(sizes); s++)
+			for (t = 0; t < (int)nelem(turns); t++)
+			for (a = 0; a <= 1; a++)
+			{
+				/* Drawing at part alpha leaves the image where it
+				 * falls, rather than on whole pixels. */
+				float fill_alpha = a ? 1 : 0.7f;
+				fz_pixmap *pa = draw(ctx, cs, image, !spaces[c], sizes[s][0], sizes[s][1], turns[t], fill_alpha);
+				fz_pixmap *pb = NULL;
+				unsigned char da[16], db[16];
+				int i;
+
+				fz_var(pb);
+
+				fz_try(ctx)
+				{
+					fz_tune_thread_pool(ctx, pool);
+					pb = draw(ctx, cs, image, !spaces[c], sizes[s][0], sizes[s][1], turns[t], fill_alpha);
+					fz_tune_thread_pool(ctx, NULL);
+
+					fz_md5_pixmap(ctx, pa, da);
+					fz_md5_pixmap(ctx, pb, db);
+					if (memcmp(da, db, 16))
+						fz_throw(ctx, FZ_ERROR_GENERIC, "drawing on the thread pool gives another result");
+
+					printf("%s alpha %d %dx%d by %gx%g turn %d alpha %g:", spaces[c] ? fz_colorspace_name(ctx, cs) : "mask",
+						alpha, dims[d][0], dims[d][1], sizes[s][0], sizes[s][1], t, fill_alpha);
+					for (i = 0; i < 16; i++)
+						printf("%02x", da[i]);
+					printf("\n");
+				}
+				fz_always(ctx)
+				{
+					fz_tune_thread_pool(ctx, NULL);
+					fz_drop_pixmap(ctx, pa);
+					fz_drop_pixmap(ctx, pb);
+				}
+				fz_catch(ctx)
+					fz_rethrow(ctx);
+			}
+		}
+		fz_always(ctx)
+			fz_drop_image(ctx, image);
+		fz_catch(ctx)
+			fz_rethrow(ctx);
+	}
+}
+
+static void bench(fz_context *ctx, const fz_thread_pool *pool)
+{
+	fz_colorspace *spaces[] = { fz_device_gray(ctx), fz_device_rgb(ctx), fz_device_cmyk(ctx) };
+	int c, threaded;
+
+	for (c = 0; c < 3; c++)
+	{
+		fz_image *image = random_image(ctx, spaces[c], 2550, 3300, 0);
+
+		fz_try(ctx)
+		{
+			for (threaded = 0; threaded <= 1; threaded++)
+			{
+				fz_pixmap *pix = fz_new_pixmap(ctx, spaces[c], 1700, 2200, NULL, 0);
+				fz_device *dev = NULL;
+				double t;
+
+				fz_var(dev);
+
+				fz_try(ctx)
+				{
+					fz_tune_thread_pool(ctx, threaded ? pool : NULL);
+					dev = fz_new_draw_device(ctx, fz_identity, pix);
+					t = now();
+					fz_fill_image(ctx, dev, image, fz_scale(1700, 2200), 1, fz_default_color_params);
+					fz_close_device(ctx, dev);
+					t = now() - t;
+					printf("%-10s %-7s %6.1f ms\n", fz_colorspace_name(ctx, spaces[c]), threaded ? "pool" : "calling", t * 1000);
+				}
+				fz_always(ctx)
+				{
+					fz_tune_thread_pool(ctx, NULL);
+					fz_drop_device(ctx, dev);
+					fz_drop_pixmap(ctx, pix);
+				}
+				fz_catch(ctx)
+					fz_rethrow(ctx);
+			}
+		}
+		fz_always(ctx)
+			fz_drop_image(ctx, image);
+		fz_catch(ctx)
+			fz_rethrow(ctx);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	fz_context *ctx = new_test_context(NULL, FZ_STORE_DEFAULT);
+	fz_render_threads *threads = NULL;
+	fz_thread_pool pool;
+	int ret = 0;
+
+	fz_var(threads);
+
+	fz_try(ctx)
+	{
+		threads = fz_new_render_threads(ctx, 3);
+		render_pool = fz_render_thread_pool(ctx, threads);
+		pool = render_pool;
+		pool.run = run_counted;
+
+		if (is_bench(argc, argv))
+			bench(ctx, &pool);
+		else
+		{
+			fz_tune_image_scale(ctx, always_scale, NULL);
+			check(ctx, &pool);
+			if (pool_calls == 0)
+				fz_throw(ctx, FZ_ERROR_GENERIC, "scaling did not use the thread pool");
+		}
+	}
+	fz_always(ctx)
+		fz_drop_render_threads(ctx, threads);
+	fz_catch(ctx)
+	{
+		fprintf(stderr, "scale-test: %s\n", fz_caught_message(ctx));
+		ret = 1;
+	}
+
+	fz_drop_context(ctx);
+	return ret;
+}
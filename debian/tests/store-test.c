@@ -0,0 +1,648 @@
+/*
+ * Store items of different sizes and costs, look them up, keep and
+ * drop them, and check that the store evicts them in the order that
+ * its policy says: least recently used first for "lru", and lowest
+ * GreedyDual-Size priority (then least recently used) for "gds". The
+ * order is checked against a simple model of each policy, which finds
+ * the item to evict by looking at all of them, so a fault in the
+ * store's priority heap shows up as a difference.
+ *
+ * The context has no locks, so the store has one shard and a single
+ * eviction order. A second context, with locks, has a store split into
+ * shards. There the order is only kept within each shard, so just check
+ * that storing an item makes room for it from the store as a whole.
+ *
+ * In both, check the statistics kept for each type of item after a
+ * known run of insertions, lookups and evictions, and after a reset.
+ */
+
+#include "mupdf/fitz.h"
+
+#include "test-util.h"
+
+#define MAX_ITEMS 20000
+#define STORE_SIZE 100000
+
+typedef struct
+{
+	int id;
+	int cost; /* per byte */
+} test_key;
+
+typedef struct
+{
+	fz_storable storable;
+	int id;
+} test_val;
+
+/* What the model knows about each item. */
+typedef struct
+{
+	int stored;
+	int held; /* references held by the test */
+	size_t size;
+	double priority;
+	size_t stamp;
+} model_item;
+
+static test_key keys[MAX_ITEMS];
+static model_item model[MAX_ITEMS];
+static double inflation;
+static size_t clock_stamp;
+static size_t model_size;
+
+/* The ids of the items that the store has freed. */
+static int evicted[MAX_ITEMS];
+static int num_evicted;
+
+static int make_hash_key(fz_context *ctx, fz_store_hash *hash, void *key)
+{
+	hash->u.pi.i = ((test_key *)key)->id;
+	hash->u.pi.ptr = NULL;
+	return 1;
+}
+
+static void *keep_key(fz_context *ctx, void *key)
+{
+	return key;
+}
+
+static void drop_key(fz_context *ctx, void *key)
+{
+}
+
+static int cmp_key(fz_context *ctx, void *a, void *b)
+{
+	return ((test_key *)a)->id != ((test_key *)b)->id;
+}
+
+static void format_key(fz_context *ctx, char *buf, size_t size, void *key)
+{
+	fz_snprintf(buf, size, "(test %d)", ((test_key *)key)->id);
+}
+
+static size_t cost(fz_context *ctx, void *key, size_t size)
+{
+	return ((test_key *)key)->cost * size;
+}
+
+static const fz_store_type test_type =
+{
+	"test",
+	make_hash_key,
+	keep_key,
+	drop_key,
+	cmp_key,
+	format_key,
+	NULL,
+	cost
+};
+
+/* The same, counted apart in the statistics. */
+static const fz_store_type other_type =
+{
+	"other",
+	make_hash_key,
+	keep_key,
+	drop_key,
+	cmp_key,
+	format_key,
+	NULL,
+	cost
+};
+
+static void drop_val(fz_context *ctx, fz_storable *val)
+{
+	test_val *v = (test_val *)val;
+	if (num_evicted < MAX_ITEMS)
+		evicted[num_evicted++] = v->id;
+	fz_free(ctx, v);
+}
+
+static void reset(fz_context *ctx)
+{
+	fz_empty_store(ctx);
+	memset(model, 0, sizeof model);
+	inflation = 0;
+	clock_stamp = 0;
+	model_size = 0;
+	num_evicted = 0;
+}
+
+static void model_touch(int id)
+{
+	model_item *m = &model[id];
+	m->priority = inflation + (double)((size_t)keys[id].cost * m->size) / m->size;
+	m->stamp = clock_stamp++;
+}
+
+/* The next item the policy would evict, by looking at every item. */
+static int model_victim(fz_store_policy policy)
+{
+	int i, best = -1;
+
+	for (i = 0; i < MAX_ITEMS; i++)
+	{
+		model_item *m = &model[i];
+		if (!m->stored || m->held)
+			continue;
+		if (best < 0)
+			best = i;
+		else if (policy == FZ_STORE_POLICY_GDS && m->priority != model[best].priority)
+		{
+			if (m->priority < model[best].priority)
+				best = i;
+		}
+		else if (m->stamp < model[best].stamp)
+			best = i;
+	}
+	return best;
+}
+
+/* Make room for size more bytes, as the store would, and return the
+ * ids that it should evict. */
+static int model_make_room(fz_store_policy policy, size_t size, int *out)
+{
+	size_t free = 0, need;
+	int i, n = 0;
+
+	if (model_size + size <= STORE_SIZE)
+		return 0;
+	need = model_size + size - STORE_SIZE;
+
+	/* The store evicts nothing if it cannot free enough. */
+	for (i = 0; i < MAX_ITEMS; i++)
+		if (model[i].stored && !model[i].held)
+			free += model[i].size;
+	if (free < need)
+		return 0;
+
+	free = 0;
+	while (free < need)
+	{
+		int v = model_victim(policy);
+		if (policy == FZ_STORE_POLICY_GDS && model[v].priority > inflation)
+			inflation = model[v].priority;
+		model[v].stored = 0;
+		model_size -= model[v].size;
+		free += model[v].size;
+		out[n++] = v;
+	}
+	return n;
+}
+
+static int cmp_int(const void *a, const void *b)
+{
+	return *(const int *)a - *(const int *)b;
+}
+
+/* The store frees the items it evicts to make room for one more in no
+ * particular order, so compare them as sets. The greedy choice of each
+ * victim decides which set it is. */
+static int compare_evictions(fz_context *ctx, int *expect, int n, const char *what)
+{
+	int i;
+
+	qsort(expect, n, sizeof *expect, cmp_int);
+	qsort(evicted, num_evicted, sizeof *evicted, cmp_int);
+
+	if (num_evicted != n)
+	{
+		fprintf(stderr, "store-test: %s: evicted %d items, expected %d\n", what, num_evicted, n);
+		num_evicted = 0;
+		return 1;
+	}
+	for (i = 0; i < n; i++)
+	{
+		if (evicted[i] != expect[i])
+		{
+			fprintf(stderr, "store-test: %s: evicted item %d, expected %d\n", what, evicted[i], expect[i]);
+			num_evicted = 0;
+			return 1;
+		}
+	}
+	num_evicted = 0;
+	return 0;
+}
+
+/* Store a new item, holding a reference to it if hold is set. */
+static int store(fz_context *ctx, fz_store_policy policy, int id, size_t size, int cost, int hold, const char *what)
+{
+	test_val *val = fz_malloc_struct(ctx, test_val);
+	int expect[MAX_ITEMS];
+	int n;
+
+	FZ_INIT_STORABLE(val, 1, drop_val);
+	val->id = id;
+	keys[id].id = id;
+	keys[id].cost = cost;
+
+	model[id].size = size;
+	n = model_make_room(policy, size, expect);
+	model[id].stored = 1;
+	model[id].held = hold;
+	model_size += size;
+	model_touch(id);
+
+	fz_store_item(ctx, &keys[id], val, size, &test_type);
+	if (!hold)
+		fz_drop_storable(ctx, &val->storable);
+
+	return compare_evictions(ctx, expect, n, what);
+}
+
+/* Look an item up, keeping the reference if hold is set. */
+static int find(fz_context *ctx, int id, int hold)
+{
+	test_val *val = fz_find_item(ctx, drop_val, &keys[id], &test_type);
+
+	if (!val != !model[id].stored)
+	{
+		fprintf(stderr, "store-test: item %d was %sfound\n", id, val ? "" : "not ");
+		return 1;
+	}
+	if (!val)
+		return 0;
+	model_touch(id);
+	if (hold)
+		model[id].held++;
+	else
+		fz_drop_storable(ctx, &val->storable);
+	return 0;
+}
+
+static void release(fz_context *ctx, int id)
+{
+	test_val *val = fz_find_item(ctx, drop_val, &keys[id], &test_type);
+
+	/* Finding it touches it too. */
+	model_touch(id);
+	model[id].held--;
+	fz_drop_storable(ctx, &val->storable);
+	fz_drop_storable(ctx, &val->storable);
+}
+
+/* Fill the store with items of the same size, alternately cheap and 20
+ * times as costly to recreate, then store more cheap items. The cheap
+ * items must all go before any costly one. */
+static int check_cheap_first(fz_context *ctx)
+{
+	int i, id = 0, fail = 0;
+
+	reset(ctx);
+	fz_set_store_policy(ctx, FZ_STORE_POLICY_GDS);
+
+	for (i = 0; i < 100 && !fail; i++, id++)
+		fail |= store(ctx, FZ_STORE_POLICY_GDS, id, 1000, i & 1 ? 20 : 1, 0, "cheap first");
+	for (i = 0; i < 50 && !fail; i++, id++)
+		fail |= store(ctx, FZ_STORE_POLICY_GDS, id, 1000, 1, 0, "cheap first");
+
+	/* The first 50 evictions were the even (cheap) items, oldest first. */
+	for (i = 0; i < 50; i++)
+		if (model[i * 2].stored || !model[i * 2 + 1].stored)
+			fail = 1;
+
+	/* Unused costly items still age out, once enough cheap items
+	 * have passed through. */
+	for (i = 0; i < 2000 && !fail; i++, id++)
+		fail |= store(ctx, FZ_STORE_POLICY_GDS, id, 1000, 1, 0, "cheap first");
+	for (i = 0; i < 50; i++)
+		if (model[i * 2 + 1].stored)
+			fail = 1;
+
+	if (fail)
+		fprintf(stderr, "store-test: cheap items were not evicted first\n");
+	return fail;
+}
+
+/* Random stores, lookups, keeps and drops of items of random sizes and
+ * costs, switching policy every so often. */
+static int check_random(fz_context *ctx, fz_store_policy first)
+{
+	static const int costs[] = { 1, 2, 5, 10, 50 };
+	fz_store_policy policy = first;
+	int id = 0, fail = 0;
+	int op;
+
+	reset(ctx);
+	fz_set_store_policy(ctx, policy);
+
+	for (op = 0; op < 40000 && id < MAX_ITEMS && !fail; op++)
+	{
+		unsigned int r = rnd() % 100;
+
+		if (op % 5000 == 4999)
+		{
+			policy = policy == FZ_STORE_POLICY_LRU ? FZ_STORE_POLICY_GDS : FZ_STORE_POLICY_LRU;
+			fz_set_store_policy(ctx, policy);
+		}
+
+		if (r < 40 || id == 0)
+		{
+			size_t size = 100 + rnd() % 5000;
+			fail |= store(ctx, policy, id, size, costs[rnd() % nelem(costs)], rnd() % 20 == 0, fz_store_policy_name(policy));
+			id++;
+		}
+		else if (r < 90)
+		{
+			int i = rnd() % id;
+			fail |= find(ctx, i, rnd() % 10 == 0);
+		}
+		else
+		{
+			/* Give back a held reference. */
+			int i = rnd() % id;
+			while (i < id && !model[i].held)
+				i++;
+			if (i < id)
+				release(ctx, i);
+		}
+	}
+
+	for (id = 0; id < MAX_ITEMS; id++)
+		while (model[id].held)
+			release(ctx, id);
+
+	if (fail)
+		fprintf(stderr, "store-test: random operations starting with %s failed\n", fz_store_policy_name(first));
+	return fail;
+}
+
+static size_t sharded_size(fz_context *ctx)
+{
+	fz_store_stats stats;
+	fz_read_store_stats(ctx, &stats);
+	return stats.size;
+}
+
+/* Store an item of the given size in a sharded store, drop it, and
+ * check that the store is within its limit and still has the item. */
+static int sharded_store(fz_context *ctx, int id, size_t size, const char *what)
+{
+	test_val *val = fz_malloc_struct(ctx, test_val);
+
+	FZ_INIT_STORABLE(val, 1, drop_val);
+	val->id = id;
+	keys[id].id = id;
+	keys[id].cost = 1;
+
+	fz_store_item(ctx, &keys[id], val, size, &test_type);
+	fz_drop_storable(ctx, &val->storable);
+
+	if (sharded_size(ctx) > STORE_SIZE)
+	{
+		fprintf(stderr, "store-test: %s: store holds %zu bytes after storing item %d\n", what, sharded_size(ctx), id);
+		return 1;
+	}
+	val = fz_find_item(ctx, drop_val, &keys[id], &test_type);
+	if (!val)
+	{
+		fprintf(stderr, "store-test: %s: item %d was not kept\n", what, id);
+		return 1;
+	}
+	fz_drop_storable(ctx, &val->storable);
+	return 0;
+}
+
+/* Fill a sharded store with small items, then store items that are
+ * bigger than any one shard can make room for, and items of random
+ * sizes. Then hold every item, so that nothing can be freed, and check
+ * that storing one more evicts nothing. */
+static int check_sharded(fz_context *ctx)
+{
+	test_val *held[MAX_ITEMS];
+	int i, id = 0, nheld = 0, fail = 0;
+
+	for (i = 0; i < 100 && !fail; i++, id++)
+		fail |= sharded_store(ctx, id, 1000, "filling shards");
+	num_evicted = 0;
+	fail |= sharded_store(ctx, id++, 30000, "large item");
+	if (!fail && num_evicted < 30)
+	{
+		fprintf(stderr, "store-test: large item: evicted %d items, expected at least 30\n", num_evicted);
+		fail = 1;
+	}
+
+	for (i = 0; i < 2000 && !fail; i++, id++)
+		fail |= sharded_store(ctx, id, 100 + rnd() % (rnd() % 10 ? 5000 : 40000), "random sizes");
+
+	for (i = 0; i < id && !fail; i++)
+	{
+		test_val *val = fz_find_item(ctx, drop_val, &keys[i], &test_type);
+		if (val)
+			held[nheld++] = val;
+	}
+	if (!fail)
+	{
+		test_val *val = fz_malloc_struct(ctx, test_val);
+		FZ_INIT_STORABLE(val, 1, drop_val);
+		val->id = id;
+		keys[id].id = id;
+		keys[id].cost = 1;
+		num_evicted = 0;
+		fz_store_item(ctx, &keys[id], val, 50000, &test_type);
+		if (num_evicted != 0)
+		{
+			fprintf(stderr, "store-test: all held: evicted %d items, expected none\n", num_evicted);
+			fail = 1;
+		}
+		fz_drop_storable(ctx, &val->storable);
+	}
+	for (i = 0; i < nheld; i++)
+		fz_drop_storable(ctx, &held[i]->storable);
+
+	fz_empty_store(ctx);
+	num_evicted = 0;
+	return fail;
+}
+
+/* The statistics for one type, or all zero if it has none yet. */
+static fz_store_type_stats type_stats(fz_context *ctx, const char *name, fz_store_stats *stats)
+{
+	fz_store_type_stats none = { name };
+	int i;
+
+	fz_read_store_stats(ctx, stats);
+	for (i = 0; i < stats->num_types; i++)
+		if (!strcmp(stats->types[i].name, name))
+			return stats->types[i];
+	return none;
+}
+
+static int expect_count(const char *what, const char *name, size_t got, size_t expect)
+{
+	if (got == expect)
+		return 0;
+	fprintf(stderr, "store-test: stats: %s: %s was %zu, expected %zu\n", what, name, got, expect);
+	return 1;
+}
+
+static void stats_store(fz_context *ctx, int id, size_t size, const fz_store_type *type)
+{
+	test_val *val = fz_malloc_struct(ctx, test_val);
+
+	FZ_INIT_STORABLE(val, 1, drop_val);
+	val->id = id;
+	keys[id].id = id;
+	keys[id].cost = 1;
+	fz_store_item(ctx, &keys[id], val, size, type);
+	fz_drop_storable(ctx, &val->storable);
+}
+
+static int stats_find(fz_context *ctx, int id, const fz_store_type *type)
+{
+	test_val *val = fz_find_item(ctx, drop_val, &keys[id], type);
+	fz_drop_storable(ctx, val ? &val->storable : NULL);
+	return val != NULL;
+}
+
+/* Store, look up and evict items of two types, and check what the
+ * statistics say. With a single shard the store evicts exactly enough
+ * to make room; split into shards it may evict more. */
+static int check_stats(fz_context *ctx, int sharded)
+{
+	fz_store_stats stats;
+	fz_store_type_stats t, o;
+	size_t evictions;
+	int i, fail = 0;
+
+	fz_empty_store(ctx);
+	fz_reset_store_stats(ctx);
+	num_evicted = 0;
+
+	for (i = 0; i < 10; i++)
+		stats_store(ctx, i, 1000, &test_type);
+	for (i = 0; i < 3; i++)
+		stats_store(ctx, 100 + i, 500, &other_type);
+	for (i = 0; i < 10; i++)
+		fail |= !stats_find(ctx, i, &test_type) || !stats_find(ctx, i, &test_type);
+	for (i = 10; i < 15; i++)
+		fail |= stats_find(ctx, i, &test_type);
+	fail |= !stats_find(ctx, 100, &other_type) || stats_find(ctx, 103, &other_type);
+	if (fail)
+	{
+		fprintf(stderr, "store-test: stats: lookups did not find what was stored\n");
+		return 1;
+	}
+
+	t = type_stats(ctx, "test", &stats);
+	o = type_stats(ctx, "other", &stats);
+	fail |= expect_count("stored", "test insertions", t.insertions, 10);
+	fail |= expect_count("stored", "test lookups", t.lookups, 25);
+	fail |= expect_count("stored", "test hits", t.hits, 20);
+	fail |= expect_count("stored", "test misses", t.misses, 5);
+	fail |= expect_count("stored", "test evictions", t.evictions, 0);
+	fail |= expect_count("stored", "other insertions", o.insertions, 3);
+	fail |= expect_count("stored", "other lookups", o.lookups, 2);
+	fail |= expect_count("stored", "other hits", o.hits, 1);
+	fail |= expect_count("stored", "other misses", o.misses, 1);
+	fail |= expect_count("stored", "size", stats.size, 11500);
+	fail |= expect_count("stored", "max", stats.max, STORE_SIZE);
+
+	/* Needs 5000 bytes more than there is room for. */
+	stats_store(ctx, 20, 93500, &test_type);
+	t = type_stats(ctx, "test", &stats);
+	o = type_stats(ctx, "other", &stats);
+	fail |= expect_count("evicting", "test insertions", t.insertions, 11);
+	fail |= expect_count("evicting", "items freed", t.evictions + o.evictions, num_evicted);
+	fail |= expect_count("evicting", "test scavenge evictions", t.scavenge_evictions, 0);
+	if (sharded)
+	{
+		if (t.bytes_evicted + o.bytes_evicted < 5000)
+			fail |= expect_count("evicting", "bytes evicted", t.bytes_evicted + o.bytes_evicted, 5000);
+		fail |= expect_count("evicting", "test bytes evicted", t.bytes_evicted, t.evictions * 1000);
+		fail |= expect_count("evicting", "other bytes evicted", o.bytes_evicted, o.evictions * 500);
+	}
+	else
+	{
+		/* The least recently used go first: the other items that
+		 * were not looked up, then enough of the test items to make
+		 * up the rest. */
+		fail |= expect_count("evicting", "other evictions", o.evictions, 2);
+		fail |= expect_count("evicting", "test evictions", t.evictions, 4);
+		fail |= expect_count("evicting", "test bytes evicted", t.bytes_evicted, 4000);
+	}
+	evictions = t.evictions;
+
+	/* Shrinking the store scavenges. */
+	fz_shrink_store(ctx, 50);
+	t = type_stats(ctx, "test", &stats);
+	if (t.scavenge_evictions == 0)
+		fail |= expect_count("scavenging", "test scavenge evictions", t.scavenge_evictions, 1);
+	fail |= expect_count("scavenging", "test evictions", t.evictions - evictions, t.scavenge_evictions);
+	fail |= expect_count("scavenging", "scavenge passes", stats.scavenge_passes, 1);
+
+	fz_reset_store_stats(ctx);
+	t = type_stats(ctx, "test", &stats);
+	o = type_stats(ctx, "other", &stats);
+	fail |= expect_count("reset", "test lookups", t.lookups, 0);
+	fail |= expect_count("reset", "test hits", t.hits, 0);
+	fail |= expect_count("reset", "test misses", t.misses, 0);
+	fail |= expect_count("reset", "test insertions", t.insertions, 0);
+	fail |= expect_count("reset", "test evictions", t.evictions, 0);
+	fail |= expect_count("reset", "test bytes evicted", t.bytes_evicted, 0);
+	fail |= expect_count("reset", "test scavenge evictions", t.scavenge_evictions, 0);
+	fail |= expect_count("reset", "other evictions", o.evictions, 0);
+	fail |= expect_count("reset", "scavenge passes", stats.scavenge_passes, 0);
+	fail |= expect_count("reset", "max", stats.max, STORE_SIZE);
+	if (stats.size == 0)
+		fail |= expect_count("reset", "size", stats.size, 1);
+
+	/* Counting starts again from zero. */
+	stats_store(ctx, 30, 1000, &test_type);
+	stats_find(ctx, 30, &test_type);
+	stats_find(ctx, 31, &test_type);
+	t = type_stats(ctx, "test", &stats);
+	fail |= expect_count("after reset", "test insertions", t.insertions, 1);
+	fail |= expect_count("after reset", "test lookups", t.lookups, 2);
+	fail |= expect_count("after reset", "test hits", t.hits, 1);
+	fail |= expect_count("after reset", "test misses", t.misses, 1);
+
+	fz_empty_store(ctx);
+	num_evicted = 0;
+	return fail;
+}
+
+int main(int argc, char **argv)
+{
+	fz_context *ctx;
+	int ret = 0;
+
+	ctx = fz_new_context(NULL, NULL, STORE_SIZE);
+	if (!ctx)
+	{
+		fprintf(stderr, "cannot initialise context\n");
+		exit(1);
+	}
+
+	fz_try(ctx)
+	{
+		ret |= check_cheap_first(ctx);
+		ret |= check_random(ctx, FZ_STORE_POLICY_GDS);
+		ret |= check_random(ctx, FZ_STORE_POLICY_LRU);
+		reset(ctx);
+		ret |= check_stats(ctx, 0);
+	}
+	fz_catch(ctx)
+	{
+		fprintf(stderr, "store-test: %s\n", fz_caught_message(ctx));
+		ret = 1;
+	}
+
+	fz_drop_context(ctx);
+
+	ctx = new_test_context(NULL, STORE_SIZE);
+	fz_try(ctx)
+	{
+		ret |= check_sharded(ctx);
+		ret |= check_stats(ctx, 1);
+	}
+	fz_catch(ctx)
+	{
+		fprintf(stderr, "store-test: %s\n", fz_caught_message(ctx));
+		ret = 1;
+	}
+	fz_drop_context(ctx);
+
+	return ret;
+}
@@ -0,0 +1,126 @@
+/*
+ * Things the test programs have in common: a repeatable random number
+ * source, a clock for benchmarks, MD5 printing, locks for tests that
+ * use several threads, and a main that runs check (or bench, with -b).
+ */
+
+#ifndef DEBIAN_TESTS_TEST_UTIL_H
+#define DEBIAN_TESTS_TEST_UTIL_H
+
+#include "mupdf/fitz.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+static unsigned int seed = 1;
+
+static inline unsigned int rnd(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return seed >> 8;
+}
+
+static inline float rndf(float max)
+{
+	return (rnd() % 10000) * max / 10000;
+}
+
+static inline double now(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static inline void print_digest(const unsigned char digest[16])
+{
+	int i;
+
+	for (i = 0; i < 16; i++)
+		printf("%02x", digest[i]);
+	printf("\n");
+}
+
+static inline void print_pixmap_digest(fz_context *ctx, fz_pixmap *pix)
+{
+	unsigned char digest[16];
+
+	fz_md5_pixmap(ctx, pix, digest);
+	print_digest(digest);
+}
+
+static pthread_mutex_t test_mutexes[FZ_LOCK_MAX];
+
+static inline void test_lock(void *user, int lock)
+{
+	pthread_mutex_lock(&test_mutexes[lock]);
+}
+
+static inline void test_unlock(void *user, int lock)
+{
+	pthread_mutex_unlock(&test_mutexes[lock]);
+}
+
+static fz_locks_context test_locks = { NULL, test_lock, test_unlock };
+
+static inline int is_bench(int argc, char **argv)
+{
+	return argc > 1 && !strcmp(argv[1], "-b");
+}
+
+/* A context with locks (so it can be cloned for other threads), or
+ * exit if there is none to be had. */
+static inline fz_context *new_test_context(const fz_alloc_context *alloc, size_t max_store)
+{
+	fz_context *ctx;
+	int i;
+
+	for (i = 0; i < FZ_LOCK_MAX; i++)
+		pthread_mutex_init(&test_mutexes[i], NULL);
+
+	ctx = fz_new_context(alloc, &test_locks, max_store);
+	if (!ctx)
+	{
+		fprintf(stderr, "cannot initialise context\n");
+		exit(1);
+	}
+	return ctx;
+}
+
+/* Run check, or bench (if there is one) when the first argument is -b.
+ * Errors are reported as coming from name. When quiet is set, the
+ * warnings and caught errors that the test expects to provoke are not
+ * printed. */
+static inline int test_main(const char *name, int argc, char **argv, int quiet,
+	void (*check)(fz_context *ctx), void (*bench)(fz_context *ctx))
+{
+	fz_context *ctx = new_test_context(NULL, FZ_STORE_DEFAULT);
+	int ret = 0;
+
+	if (quiet)
+	{
+		fz_set_warning_callback(ctx, NULL, NULL);
+		fz_set_error_callback(ctx, NULL, NULL);
+	}
+
+	fz_try(ctx)
+	{
+		if (bench && is_bench(argc, argv))
+			bench(ctx);
+		else
+			check(ctx);
+	}
+	fz_catch(ctx)
+	{
+		fprintf(stderr, "%s: %s\n", name, fz_caught_message(ctx));
+		ret = 1;
+	}
+
+	fz_drop_context(ctx);
+	return ret;
+}
+
+#endif
@@ -0,0 +1,286 @@
+/*
+ * Draw text in all of the base 14 fonts, turned through many angles so
+ * that every glyph is rendered by FreeType rather than found in the
+ * glyph cache, on 1 to 8 threads at once, each with its own clone of
+ * the context. The pixmaps must be the same as when they are drawn one
+ * at a time. Fonts use different face locks, so the threads load and
+ * render glyphs (and FreeType allocates memory) at the same time.
+ * Finally the fonts must still work from a clone once the context that
+ * loaded them has been dropped.
+ *
+ * With -b, time how many pages each number of threads draws instead.
+ */
+
+#include "mupdf/fitz.h"
+
+#include "test-util.h"
+
+#define MAX_THREADS 8
+#define ANGLES 24
+#define SIZE 400
+
+static const char *names[] =
+{
+	"Times-Roman", "Times-Bold", "Times-Italic", "Times-BoldItalic",
+	"Helvetica", "Helvetica-Bold", "Helvetica-Oblique", "Helvetica-BoldOblique",
+	"Courier", "Courier-Bold", "Courier-Oblique", "Courier-BoldOblique",
+	"Symbol", "ZapfDingbats"
+};
+
+/* A line of text in each font. */
+static fz_text *make_text(fz_context *ctx)
+{
+	fz_text *text = fz_new_text(ctx);
+	fz_font *font = NULL;
+	int f, i;
+
+	fz_var(font);
+
+	fz_try(ctx)
+	{
+		for (f = 0; f < (int)nelem(names); f++)
+		{
+			float x = 10, y = 30 + f * 26;
+			font = fz_new_base14_font(ctx, names[f]);
+			for (i = 0; i < 40; i++)
+			{
+				int c = 'A' + (i * 11 + f) % 58;
+				fz_matrix trm = fz_scale(14, -14);
+				trm.e = x;
+				trm.f = y;
+				fz_show_glyph(ctx, text, font, trm, fz_encode_character(ctx, font, c), c, 0, 0, FZ_BIDI_LTR, FZ_LANG_UNSET);
+				x += 9;
+			}
+			fz_drop_font(ctx, font);
+			font = NULL;
+		}
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_font(ctx, font);
+		fz_drop_text(ctx, text);
+		fz_rethrow(ctx);
+	}
+	return text;
+}
+
+/* Draw the text turned through angle degrees about the middle. */
+static void draw(fz_context *ctx, fz_text *text, float angle, unsigned char digest[16])
+{
+	fz_pixmap *pix = fz_new_pixmap(ctx, fz_device_gray(ctx), SIZE, SIZE, NULL, 0);
+	fz_device *dev = NULL;
+	fz_matrix ctm;
+	float black = 0;
+
+	fz_var(dev);
+
+	ctm = fz_concat(fz_translate(-SIZE / 2, -SIZE / 2), fz_rotate(angle));
+	ctm = fz_concat(ctm, fz_translate(SIZE / 2, SIZE / 2));
+
+	fz_try(ctx)
+	{
+		fz_clear_pixmap_with_value(ctx, pix, 255);
+		dev = fz_new_draw_device(ctx, fz_identity, pix);
+		fz_fill_text(ctx, dev, text, ctm, fz_device_gray(ctx), &black, 1, fz_default_color_params);
+		fz_close_device(ctx, dev);
+		if (digest)
+			fz_md5_pixmap(ctx, pix, digest);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_device(ctx, dev);
+		fz_drop_pixmap(ctx, pix);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+typedef struct
+{
+	fz_context *ctx;
+	fz_text *text;
+	int index, count, pages;
+	unsigned char (*expect)[16];
+	int failed;
+	double time;
+} worker;
+
+static pthread_barrier_t start;
+
+/* Draw every angle, starting at a different one on each thread. */
+static void *check_worker(void *arg)
+{
+	worker *w = arg;
+	unsigned char digest[16];
+	int i, a;
+
+	pthread_barrier_wait(&start);
+	fz_try(w->ctx)
+	{
+		for (i = 0; i < ANGLES; i++)
+		{
+			a = (i + w->index * ANGLES / w->count) % ANGLES;
+			draw(w->ctx, w->text, a * 15.1f, digest);
+			if (memcmp(digest, w->expect[a], 16))
+				w->failed = 1;
+		}
+	}
+	fz_catch(w->ctx)
+		w->failed = 1;
+	return NULL;
+}
+
+/* Draw pages at angles no other thread uses, so nothing is cached. */
+static void *bench_worker(void *arg)
+{
+	worker *w = arg;
+	double t;
+	int i;
+
+	pthread_barrier_wait(&start);
+	t = now();
+	fz_try(w->ctx)
+	{
+		for (i = 0; i < w->pages; i++)
+			draw(w->ctx, w->text, (i * MAX_THREADS + w->index) * 0.37f, NULL);
+	}
+	fz_catch(w->ctx)
+		w->failed = 1;
+	w->time = now() - t;
+	return NULL;
+}
+
+/* Run fn on count threads, each with a clone of ctx. Returns the time
+ * the slowest one took. */
+static double run(fz_context *ctx, int count, void *(*fn)(void *), worker *proto)
+{
+	pthread_t thread[MAX_THREADS];
+	worker w[MAX_THREADS];
+	double time = 0;
+	int i, failed = 0;
+
+	pthread_barrier_init(&start, NULL, count);
+	for (i = 0; i < count; i++)
+	{
+		w[i] = *proto;
+		w[i].index = i;
+		w[i].count = count;
+		w[i].ctx = fz_clone_context(ctx);
+		if (!w[i].ctx || pthread_create(&thread[i], NULL, fn, &w[i]))
+			fz_throw(ctx, FZ_ERROR_GENERIC, "cannot start drawing thread");
+	}
+	for (i = 0; i < count; i++)
+	{
+		pthread_join(thread[i], NULL);
+		fz_drop_context(w[i].ctx);
+		failed |= w[i].failed;
+		if (w[i].time > time)
+			time = w[i].time;
+	}
+	pthread_barrier_destroy(&start);
+	if (failed)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "%d threads: text was drawn wrongly", count);
+	return time;
+}
+
+/* Load the fonts in one context and draw with a clone of it, after the
+ * first has gone. */
+static void check_clone(fz_context *ctx)
+{
+	fz_context *base, *clone;
+	fz_text *text = NULL;
+	unsigned char expect[16], digest[16];
+	int failed = 0;
+
+	base = fz_new_context(NULL, &test_locks, FZ_STORE_DEFAULT);
+	clone = base ? fz_clone_context(base) : NULL;
+	if (!clone)
+	{
+		fz_drop_context(base);
+		fz_throw(ctx, FZ_ERROR_GENERIC, "cannot clone context");
+	}
+
+	fz_try(base)
+	{
+		text = make_text(base);
+		draw(base, text, 45, expect);
+	}
+	fz_catch(base)
+		failed = 1;
+	fz_drop_context(base);
+
+	fz_try(clone)
+	{
+		if (!failed)
+		{
+			fz_purge_glyph_cache(clone);
+			draw(clone, text, 45, digest);
+			failed = memcmp(digest, expect, 16) != 0;
+		}
+	}
+	fz_always(clone)
+		fz_drop_text(clone, text);
+	fz_catch(clone)
+		failed = 1;
+	fz_drop_context(clone);
+
+	if (failed)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "text drawn by a clone was wrong");
+}
+
+static void check(fz_context *ctx)
+{
+	unsigned char expect[ANGLES][16];
+	fz_text *text = make_text(ctx);
+	worker w = { NULL };
+	int a, count;
+
+	fz_try(ctx)
+	{
+		for (a = 0; a < ANGLES; a++)
+			draw(ctx, text, a * 15.1f, expect[a]);
+
+		w.text = text;
+		w.expect = expect;
+		for (count = 1; count <= MAX_THREADS; count *= 2)
+		{
+			fz_purge_glyph_cache(ctx);
+			run(ctx, count, check_worker, &w);
+		}
+
+		check_clone(ctx);
+	}
+	fz_always(ctx)
+		fz_drop_text(ctx, text);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+static void bench(fz_context *ctx)
+{
+	fz_text *text = make_text(ctx);
+	worker w = { NULL };
+	double time;
+	int count;
+
+	fz_try(ctx)
+	{
+		w.text = text;
+		w.pages = 40;
+		for (count = 1; count <= MAX_THREADS; count *= 2)
+		{
+			fz_purge_glyph_cache(ctx);
+			time = run(ctx, count, bench_worker, &w);
+			printf("%d threads: %6.1f pages per second\n", count, count * w.pages / time);
+		}
+	}
+	fz_always(ctx)
+		fz_drop_text(ctx, text);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+int main(int argc, char **argv)
+{
+	return test_main("text-test", argc, argv, 0, check, bench);
+}
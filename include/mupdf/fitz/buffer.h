@@ -22,6 +22,7 @@ typedef struct
 	size_t cap, len;
 	int unused_bits;
 	int shared;
+	int mapped;
 } fz_buffer;
 
 /**
@@ -77,6 +78,24 @@ fz_buffer *fz_new_buffer_from_data(fz_context *ctx, unsigned char *data, size_t
 */
 fz_buffer *fz_new_buffer_from_shared_data(fz_context *ctx, const unsigned char *data, size_t size);
 
+/**
+	Create a new buffer wrapping a read-only memory mapping of a
+	file.
+
+	filename: Path to a file, as for fz_open_file.
+
+	The buffer has shared storage, so it cannot be resized or
+	appended to. The mapping is released when the buffer is
+	destroyed. The file must not be truncated while the buffer is
+	alive.
+
+	Returns NULL if the file cannot be mapped (because it does not
+	exist, is not a regular file, is empty, or the platform does
+	not support mapping), so that callers can fall back to reading
+	it. Throws exception on allocation failure.
+*/
+fz_buffer *fz_new_buffer_from_mapped_file(fz_context *ctx, const char *filename);
+
 /**
 	Create a new buffer containing a copy of the passed data.
 */
@@ -52,6 +52,57 @@
 */
 /* #define FZ_ENABLE_JS 1 */
 
+/**
+	Choose whether to use atomic operations for reference counting.
+	By default, reference counts are updated with lock-free atomic
+	instructions where the compiler supports them, rather than
+	under the FZ_LOCK_ALLOC lock. Define this to 0 to always use
+	the lock.
+*/
+/* #define FZ_ENABLE_ATOMIC_REFS 1 */
+
+/**
+	Choose whether to memory map files opened with fz_open_file.
+	Define this to 1 to map regular files read-only and parse them
+	directly from the mapping, falling back to buffered stdio reads
+	if the file cannot be mapped. This is off by default, as a file
+	that is truncated while it is mapped causes a SIGBUS rather than
+	a read error, so only enable it if the files being opened are
+	known not to change underneath us.
+*/
+/* #define FZ_ENABLE_MMAP 0 */
+
+/**
+	Choose whether to use SIMD code paths. By default, some inner
+	loops have SSE2/AVX2 (x86) or NEON (ARM) versions, chosen at
+	runtime according to what the CPU supports. Define this to 0
+	to only ever use the plain C versions.
+*/
+/* #define FZ_ENABLE_SIMD 1 */
+
+/**
+	Choose how many shards the resource store is split into.
+	Each shard has its own lock, so that threads looking up
+	different resources do not contend with each other. This
+	requires atomic reference counting; without it, the store
+	always uses a single shard.
+*/
+/* #define FZ_STORE_SHARDS 8 */
+
+/**
+	Choose how many stripes the glyph cache is split into. Each
+	stripe has its own lock, so that threads rendering text do not
+	contend with each other.
+*/
+/* #define FZ_GLYPH_CACHE_STRIPES 4 */
+
+/**
+	Choose how many locks are shared out between fonts to protect
+	their FreeType faces. Threads using fonts with different locks
+	can load and render glyphs at the same time.
+*/
+/* #define FZ_FONT_LOCKS 8 */
+
 /**
 	Choose which fonts to include.
 	By default we include the base 14 PDF fonts,
@@ -164,6 +215,30 @@
 #define FZ_ENABLE_ICC 1
 #endif /* FZ_ENABLE_ICC */
 
+#ifndef FZ_ENABLE_ATOMIC_REFS
+#define FZ_ENABLE_ATOMIC_REFS 1
+#endif /* FZ_ENABLE_ATOMIC_REFS */
+
+#ifndef FZ_ENABLE_MMAP
+#define FZ_ENABLE_MMAP 0
+#endif /* FZ_ENABLE_MMAP */
+
+#ifndef FZ_ENABLE_SIMD
+#define FZ_ENABLE_SIMD 1
+#endif /* FZ_ENABLE_SIMD */
+
+#ifndef FZ_STORE_SHARDS
+#define FZ_STORE_SHARDS 8
+#endif /* FZ_STORE_SHARDS */
+
+#ifndef FZ_GLYPH_CACHE_STRIPES
+#define FZ_GLYPH_CACHE_STRIPES 4
+#endif /* FZ_GLYPH_CACHE_STRIPES */
+
+#ifndef FZ_FONT_LOCKS
+#define FZ_FONT_LOCKS 8
+#endif /* FZ_FONT_LOCKS */
+
 /* If Epub and HTML are both disabled, disable SIL fonts */
 #if FZ_ENABLE_HTML == 0 && FZ_ENABLE_EPUB == 0
 #undef TOFU_SIL
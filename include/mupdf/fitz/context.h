@@ -2,6 +2,7 @@
 #define MUPDF_FITZ_CONTEXT_H
 
 #include "mupdf/fitz/version.h"
+#include "mupdf/fitz/config.h"
 #include "mupdf/fitz/system.h"
 #include "mupdf/fitz/geometry.h"
 
@@ -81,11 +82,36 @@ void fz_flush_warnings(fz_context *ctx);
 	If a client does not intend to use multiple threads, then it
 	may pass NULL instead of a lock structure.
 
+	The exceptions are fz_new_render_threads (see render-threads.h)
+	and the compress_threads option of pdf_write_options, which start
+	threads of their own with the mu-threads helpers. These are built
+	into the library, so programs linking with it statically must also
+	link with the system's thread library (-lpthread on POSIX systems,
+	as listed in Libs.private of mupdf.pc). Without threading support
+	(threading=no), the threads cannot be started: the rendering
+	threads throw, and saving compresses on the calling thread.
+
 	In order to avoid deadlocks, we have one simple rule
 	internally as to how we use locks: We can never take lock n
 	when we already hold any lock i, where 0 <= i <= n. In order
 	to verify this, we have some debugging code, that can be
 	enabled by defining FITZ_DEBUG_LOCKING.
+
+	The resource store is split into FZ_STORE_SHARDS shards, each
+	protected by its own lock, starting at FZ_LOCK_STORE. These
+	are the innermost locks, as the allocator may need to evict
+	items from the store while holding FZ_LOCK_ALLOC.
+
+	FZ_LOCK_FREETYPE protects the FreeType library itself (such as
+	the creation and destruction of faces). Each font with a
+	FreeType face is given one of FZ_FONT_LOCKS locks, starting at
+	FZ_LOCK_FONT, which must be held while using the face. A font
+	lock may be held while taking FZ_LOCK_FREETYPE, but not the
+	other way around.
+
+	Similarly, the glyph cache is split into FZ_GLYPH_CACHE_STRIPES
+	stripes, each protected by its own lock, starting at
+	FZ_LOCK_GLYPHCACHE. At most one of these is held at a time.
 */
 
 typedef struct
@@ -96,10 +122,12 @@ typedef struct
 } fz_locks_context;
 
 enum {
-	FZ_LOCK_ALLOC = 0,
+	FZ_LOCK_STORE = 0,
+	FZ_LOCK_ALLOC = FZ_LOCK_STORE + FZ_STORE_SHARDS,
 	FZ_LOCK_FREETYPE,
-	FZ_LOCK_GLYPHCACHE,
-	FZ_LOCK_MAX
+	FZ_LOCK_FONT,
+	FZ_LOCK_GLYPHCACHE = FZ_LOCK_FONT + FZ_FONT_LOCKS,
+	FZ_LOCK_MAX = FZ_LOCK_GLYPHCACHE + FZ_GLYPH_CACHE_STRIPES
 };
 
 #if defined(MEMENTO) || !defined(NDEBUG)
@@ -249,6 +277,27 @@ void fz_set_warning_callback(fz_context *ctx, void (*print)(void *user, const ch
 	(optionally) be provided by callers.
 */
 
+/**
+	A pool of threads, supplied by the caller, that functions able
+	to split their work into independent pieces can use.
+
+	run: Must call fn(arg, i) once for each i from 0 to count-1, in
+	any order and on any of the pool's threads, and return only when
+	all of the calls have finished. fn never throws, and does not use
+	the fz_context.
+
+	workers: The number of threads that run shares the work between.
+	This is the most pieces that the work will be split into.
+
+	user: Opaque data passed back to run.
+*/
+typedef struct
+{
+	void (*run)(void *user, int count, void (*fn)(void *arg, int i), void *arg);
+	int workers;
+	void *user;
+} fz_thread_pool;
+
 /**
 	Given the width and height of an image,
 	the subsample factor, and the subarea of the image actually
@@ -305,6 +354,21 @@ void fz_tune_image_decode(fz_context *ctx, fz_tune_image_decode_fn *image_decode
 */
 void fz_tune_image_scale(fz_context *ctx, fz_tune_image_scale_fn *image_scale, void *arg);
 
+/**
+	Set the pool of threads that functions able to split their work
+	into independent pieces (such as the repair of broken PDF files,
+	or the scaling of images by the draw device) may use. The pool is
+	copied; NULL (the default) to do all such work on the calling
+	thread.
+*/
+void fz_tune_thread_pool(fz_context *ctx, const fz_thread_pool *pool);
+
+/**
+	Return the pool set with fz_tune_thread_pool, or NULL if there
+	is none (or it has fewer than two workers).
+*/
+const fz_thread_pool *fz_tuned_thread_pool(fz_context *ctx);
+
 /**
 	Get the number of bits of antialiasing we are
 	using (for graphics). Between 0 and 8.
@@ -598,19 +662,128 @@ fz_unlock(fz_context *ctx, int lock)
 
 /* Lock-safe reference counting functions */
 
+/*
+	Reference counts are updated with atomic compare-and-swap
+	operations when the compiler offers them (and FZ_ENABLE_ATOMIC_REFS
+	has not been turned off). In that case FZ_ATOMIC_REFS is defined
+	to 1, and keeping or dropping a reference never takes
+	FZ_LOCK_ALLOC. Otherwise the counts are plain integers that must
+	only be touched with FZ_LOCK_ALLOC held.
+
+	fz_refs_inc increments a count, unless it is <= 0 (statically
+	allocated objects, or objects already being destroyed), and
+	returns the old value.
+
+	fz_refs_dec decrements a positive count and returns the new
+	value, or returns -1 (and leaves the count unchanged) if it
+	was <= 0.
+
+	Code that manipulates reference counts directly (such as the
+	store) must use these, even when holding FZ_LOCK_ALLOC, as
+	other threads may be updating the same counts without it.
+*/
+
+#if FZ_ENABLE_ATOMIC_REFS && defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 7))
+#define FZ_ATOMIC_REFS 1
+#define fz_refs_load(P) __atomic_load_n(P, __ATOMIC_RELAXED)
+static inline int fz_refs_cas(int *p, int o, int n) { return __atomic_compare_exchange_n(p, &o, n, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED); }
+static inline int fz_refs_cas8(int8_t *p, int8_t o, int8_t n) { return __atomic_compare_exchange_n(p, &o, n, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED); }
+static inline int fz_refs_cas16(int16_t *p, int16_t o, int16_t n) { return __atomic_compare_exchange_n(p, &o, n, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED); }
+#elif FZ_ENABLE_ATOMIC_REFS && defined(_MSC_VER) && (_MSC_VER >= 1700) /* MSVC 2012 or newer */
+#include <intrin.h>
+#define FZ_ATOMIC_REFS 1
+#define fz_refs_load(P) (*(P))
+static inline int fz_refs_cas(int *p, int o, int n) { return _InterlockedCompareExchange((volatile long *)p, n, o) == o; }
+static inline int fz_refs_cas8(int8_t *p, int8_t o, int8_t n) { return _InterlockedCompareExchange8((volatile char *)p, n, o) == o; }
+static inline int fz_refs_cas16(int16_t *p, int16_t o, int16_t n) { return _InterlockedCompareExchange16((volatile short *)p, n, o) == o; }
+#else
+#define FZ_ATOMIC_REFS 0
+#endif
+
+#if FZ_ATOMIC_REFS
+
+#define fz_lock_refs(ctx) do { } while (0)
+#define fz_unlock_refs(ctx) do { } while (0)
+
+static inline int fz_refs_inc(int *refs)
+{
+	int old;
+	do
+		old = fz_refs_load(refs);
+	while (old > 0 && !fz_refs_cas(refs, old, old + 1));
+	return old;
+}
+
+static inline int fz_refs_inc8(int8_t *refs)
+{
+	int8_t old;
+	do
+		old = fz_refs_load(refs);
+	while (old > 0 && !fz_refs_cas8(refs, old, old + 1));
+	return old;
+}
+
+static inline int fz_refs_inc16(int16_t *refs)
+{
+	int16_t old;
+	do
+		old = fz_refs_load(refs);
+	while (old > 0 && !fz_refs_cas16(refs, old, old + 1));
+	return old;
+}
+
+static inline int fz_refs_dec(int *refs)
+{
+	int old;
+	do
+		old = fz_refs_load(refs);
+	while (old > 0 && !fz_refs_cas(refs, old, old - 1));
+	return old > 0 ? old - 1 : -1;
+}
+
+static inline int fz_refs_dec8(int8_t *refs)
+{
+	int8_t old;
+	do
+		old = fz_refs_load(refs);
+	while (old > 0 && !fz_refs_cas8(refs, old, old - 1));
+	return old > 0 ? old - 1 : -1;
+}
+
+static inline int fz_refs_dec16(int16_t *refs)
+{
+	int16_t old;
+	do
+		old = fz_refs_load(refs);
+	while (old > 0 && !fz_refs_cas16(refs, old, old - 1));
+	return old > 0 ? old - 1 : -1;
+}
+
+#else
+
+#define fz_lock_refs(ctx) fz_lock(ctx, FZ_LOCK_ALLOC)
+#define fz_unlock_refs(ctx) fz_unlock(ctx, FZ_LOCK_ALLOC)
+#define fz_refs_load(P) (*(P))
+
+static inline int fz_refs_inc(int *refs) { return *refs > 0 ? (*refs)++ : *refs; }
+static inline int fz_refs_inc8(int8_t *refs) { return *refs > 0 ? (*refs)++ : *refs; }
+static inline int fz_refs_inc16(int16_t *refs) { return *refs > 0 ? (*refs)++ : *refs; }
+static inline int fz_refs_dec(int *refs) { return *refs > 0 ? --*refs : -1; }
+static inline int fz_refs_dec8(int8_t *refs) { return *refs > 0 ? --*refs : -1; }
+static inline int fz_refs_dec16(int16_t *refs) { return *refs > 0 ? --*refs : -1; }
+
+#endif /* FZ_ATOMIC_REFS */
+
 static inline void *
 fz_keep_imp(fz_context *ctx, void *p, int *refs)
 {
 	if (p)
 	{
 		(void)Memento_checkIntPointerOrNull(refs);
-		fz_lock(ctx, FZ_LOCK_ALLOC);
-		if (*refs > 0)
-		{
+		fz_lock_refs(ctx);
+		if (fz_refs_inc(refs) > 0)
 			(void)Memento_takeRef(p);
-			++*refs;
-		}
-		fz_unlock(ctx, FZ_LOCK_ALLOC);
+		fz_unlock_refs(ctx);
 	}
 	return p;
 }
@@ -621,13 +794,10 @@ fz_keep_imp8(fz_context *ctx, void *p, int8_t *refs)
 	if (p)
 	{
 		(void)Memento_checkBytePointerOrNull(refs);
-		fz_lock(ctx, FZ_LOCK_ALLOC);
-		if (*refs > 0)
-		{
+		fz_lock_refs(ctx);
+		if (fz_refs_inc8(refs) > 0)
 			(void)Memento_takeRef(p);
-			++*refs;
-		}
-		fz_unlock(ctx, FZ_LOCK_ALLOC);
+		fz_unlock_refs(ctx);
 	}
 	return p;
 }
@@ -638,13 +808,10 @@ fz_keep_imp16(fz_context *ctx, void *p, int16_t *refs)
 	if (p)
 	{
 		(void)Memento_checkShortPointerOrNull(refs);
-		fz_lock(ctx, FZ_LOCK_ALLOC);
-		if (*refs > 0)
-		{
+		fz_lock_refs(ctx);
+		if (fz_refs_inc16(refs) > 0)
 			(void)Memento_takeRef(p);
-			++*refs;
-		}
-		fz_unlock(ctx, FZ_LOCK_ALLOC);
+		fz_unlock_refs(ctx);
 	}
 	return p;
 }
@@ -654,18 +821,14 @@ fz_drop_imp(fz_context *ctx, void *p, int *refs)
 {
 	if (p)
 	{
-		int drop;
+		int num;
 		(void)Memento_checkIntPointerOrNull(refs);
-		fz_lock(ctx, FZ_LOCK_ALLOC);
-		if (*refs > 0)
-		{
+		fz_lock_refs(ctx);
+		num = fz_refs_dec(refs);
+		if (num >= 0)
 			(void)Memento_dropIntRef(p);
-			drop = --*refs == 0;
-		}
-		else
-			drop = 0;
-		fz_unlock(ctx, FZ_LOCK_ALLOC);
-		return drop;
+		fz_unlock_refs(ctx);
+		return num == 0;
 	}
 	return 0;
 }
@@ -675,18 +838,14 @@ fz_drop_imp8(fz_context *ctx, void *p, int8_t *refs)
 {
 	if (p)
 	{
-		int drop;
+		int num;
 		(void)Memento_checkBytePointerOrNull(refs);
-		fz_lock(ctx, FZ_LOCK_ALLOC);
-		if (*refs > 0)
-		{
+		fz_lock_refs(ctx);
+		num = fz_refs_dec8(refs);
+		if (num >= 0)
 			(void)Memento_dropByteRef(p);
-			drop = --*refs == 0;
-		}
-		else
-			drop = 0;
-		fz_unlock(ctx, FZ_LOCK_ALLOC);
-		return drop;
+		fz_unlock_refs(ctx);
+		return num == 0;
 	}
 	return 0;
 }
@@ -696,18 +855,14 @@ fz_drop_imp16(fz_context *ctx, void *p, int16_t *refs)
 {
 	if (p)
 	{
-		int drop;
+		int num;
 		(void)Memento_checkShortPointerOrNull(refs);
-		fz_lock(ctx, FZ_LOCK_ALLOC);
-		if (*refs > 0)
-		{
+		fz_lock_refs(ctx);
+		num = fz_refs_dec16(refs);
+		if (num >= 0)
 			(void)Memento_dropShortRef(p);
-			drop = --*refs == 0;
-		}
-		else
-			drop = 0;
-		fz_unlock(ctx, FZ_LOCK_ALLOC);
-		return drop;
+		fz_unlock_refs(ctx);
+		return num == 0;
 	}
 	return 0;
 }
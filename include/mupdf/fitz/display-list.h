@@ -74,6 +74,22 @@ fz_device *fz_new_list_device(fz_context *ctx, fz_display_list *list);
 */
 void fz_run_display_list(fz_context *ctx, fz_display_list *list, fz_device *dev, fz_matrix ctm, fz_rect scissor, fz_cookie *cookie);
 
+/**
+	Build an index of where on the page the contents of a display
+	list lie, so that running the list with a scissor rect that
+	covers only part of the page (such as a band or tile) can step
+	over whole runs of contents that lie outside it, rather than
+	looking at each in turn.
+
+	This is worth doing for large lists that will be run many times
+	a piece at a time. The index is kept with the list, and dropped
+	if anything more is added to it.
+
+	Call once the list is complete, and not while the list is being
+	run (on this or any other thread).
+*/
+void fz_index_display_list(fz_context *ctx, fz_display_list *list);
+
 /**
 	Increment the reference count for a display list. Returns the
 	same pointer.
@@ -379,6 +379,17 @@ fz_document *fz_open_accelerated_document_with_stream(fz_context *ctx, const cha
 */
 int fz_document_supports_accelerator(fz_context *ctx, fz_document *doc);
 
+/**
+	Make the name of the file in the temporary directory (from the
+	TEMP or TMP environment variables, or /var/tmp) that accelerator
+	data for the named document is kept in by default, as used by
+	mutool draw and mutool accel.
+
+	Returns 0 if the document cannot be found, or the name does not
+	fit in len bytes.
+*/
+int fz_default_accelerator_filename(fz_context *ctx, char *buf, size_t len, const char *filename);
+
 /**
 	Save accelerator data for the document to a given file.
 */
@@ -657,6 +657,22 @@ void fz_hb_lock(fz_context *ctx);
 */
 void fz_hb_unlock(fz_context *ctx);
 
+/**
+	Lock the FreeType face of a font, so that it can be used
+	without other threads changing its state. Each font is given
+	one of FZ_FONT_LOCKS locks, so fonts with different locks can
+	be used at the same time.
+
+	This must not be called while holding FZ_LOCK_FREETYPE (and so
+	must be called before fz_hb_lock, not after).
+*/
+void fz_ft_lock(fz_context *ctx, fz_font *font);
+
+/**
+	Unlock the FreeType face of a font.
+*/
+void fz_ft_unlock(fz_context *ctx, fz_font *font);
+
 struct fz_font
 {
 	int refs;
@@ -666,6 +682,7 @@ struct fz_font
 	fz_font_flags_t flags;
 
 	void *ft_face; /* has an FT_Face if used */
+	int ft_lock; /* the lock protecting ft_face */
 	fz_shaper_data_t shaper_data;
 
 	fz_matrix t3matrix;
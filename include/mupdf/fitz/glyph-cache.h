@@ -11,6 +11,28 @@
 */
 void fz_purge_glyph_cache(fz_context *ctx);
 
+/**
+	Set the limits for the glyph cache. This is normally called
+	just after the context has been created, but may be called at
+	any time; the cache is trimmed to fit the new limits. The
+	cache is shared with any cloned contexts.
+
+	max_size: The maximum total size (in bytes) of the glyphs held
+	in the cache (default 1MB). The least recently used glyphs are
+	evicted to stay within this.
+
+	max_glyph_size: The size (in pixels) of the largest glyph that
+	will be cached (default 256). Larger glyphs are rendered each
+	time they are used.
+
+	buckets: The number of hash buckets to start with. The hash
+	table grows as required, so this is only a hint for caches
+	that are expected to hold many glyphs.
+
+	Values of 0 leave the corresponding setting unchanged.
+*/
+void fz_set_glyph_cache_limits(fz_context *ctx, size_t max_size, int max_glyph_size, int buckets);
+
 /**
 	Create a pixmap containing a rendered glyph.
 
@@ -47,7 +69,10 @@ void fz_render_t3_glyph_direct(fz_context *ctx, fz_device *dev, fz_font *font, i
 void fz_prepare_t3_glyph(fz_context *ctx, fz_font *font, int gid);
 
 /**
-	Dump debug statistics for the glyph cache.
+	Dump statistics for the glyph cache: its size, the number of
+	lookups and how many found a glyph, and the number of glyphs
+	evicted. When the cache is split into stripes, the size, glyph
+	count and evictions of each stripe are listed first.
 */
 void fz_dump_glyph_cache_stats(fz_context *ctx, fz_output *out);
 
@@ -0,0 +1,181 @@
+#ifndef MUPDF_FITZ_RENDER_THREADS_H
+#define MUPDF_FITZ_RENDER_THREADS_H
+
+#include "mupdf/fitz/system.h"
+#include "mupdf/fitz/context.h"
+#include "mupdf/fitz/geometry.h"
+#include "mupdf/fitz/pixmap.h"
+#include "mupdf/fitz/bitmap.h"
+#include "mupdf/fitz/separation.h"
+#include "mupdf/fitz/display-list.h"
+
+/**
+	Rendering display lists on several threads at once.
+
+	A display list can safely be run by several threads at the same
+	time, each with its own clone of the context. The functions here
+	split the area to be rendered into bands, and hand the bands out
+	to a set of worker threads from a queue, so that a thread that
+	finishes a simple band moves straight on to the next one.
+
+	Several renders may share the same threads at once (from one
+	thread or several). The threads work on the oldest render that
+	has bands waiting to be started, and move on to the next render
+	as the bands of the first all get going.
+
+	An error in any band stops the others from being started, and is
+	rethrown to the caller once the bands already in progress have
+	finished. Setting abort in the caller's cookie stops the render
+	in the same way (without an error); bands already in progress are
+	aborted as the next band is collected. The errors of all the bands
+	are added to the caller's cookie as they finish.
+
+	Unlike the rest of the library, these start threads of their own
+	(with mu-threads), so programs that use them need the system's
+	thread library; see the locking functions in context.h.
+*/
+
+/**
+	A set of worker threads for rendering.
+*/
+typedef struct fz_render_threads fz_render_threads;
+
+/**
+	Start count threads for rendering, each with its own clone of
+	ctx.
+
+	Throws if ctx cannot be cloned (it needs locking functions, see
+	fz_new_context), or if the threads cannot be started (as in
+	builds without threading support). Callers should then render
+	on their own thread.
+*/
+fz_render_threads *fz_new_render_threads(fz_context *ctx, int count);
+
+/**
+	Stop the threads and free them. No renders may be in progress.
+*/
+void fz_drop_render_threads(fz_context *ctx, fz_render_threads *threads);
+
+/**
+	Return the number of worker threads.
+*/
+int fz_count_render_threads(fz_context *ctx, fz_render_threads *threads);
+
+/**
+	Make a thread pool (see fz_tune_thread_pool) that shares its work
+	between the rendering threads and the thread that asks for it. It
+	may be used while rendering on the same threads, and from within
+	a render.
+
+	The threads must not be dropped while the pool is in use.
+*/
+fz_thread_pool fz_render_thread_pool(fz_context *ctx, fz_render_threads *threads);
+
+/**
+	Render a display list into a pixmap.
+
+	The pixmap is divided into bands of band_height rows (or 0 to
+	pick a height from the size of the pixmap and the number of
+	threads), and each band is drawn with a draw device of its own.
+	As with fz_new_draw_device, the list is drawn over whatever the
+	pixmap already holds; clear it first as required.
+*/
+void fz_render_display_list_threaded(fz_context *ctx, fz_render_threads *threads, fz_display_list *list, fz_matrix ctm, fz_pixmap *pix, int band_height, fz_cookie *cookie);
+
+/**
+	One band of a banded render.
+
+	num: The band number, from 0.
+
+	y, h: The offset of the band from the top of the area being
+	rendered, and its height. All but the last band are band_height
+	rows high.
+
+	ctm: The transform that brings the band into the pixmap.
+
+	pix: The pixmap to render into. Every band of a render gets a
+	pixmap with the same band_height high bbox at the top of the area,
+	and the band is moved up into it by ctm. Pixmaps are reused from
+	one band to another.
+
+	bit: NULL, or a bitmap made from the band that the draw function
+	wants to be written in its place. It is dropped once the band has
+	been written.
+*/
+typedef struct
+{
+	int num;
+	int y, h;
+	fz_matrix ctm;
+	fz_pixmap *pix;
+	fz_bitmap *bit;
+} fz_render_band;
+
+/**
+	Draw a band, called on a worker thread with that worker's
+	context. Any error should be thrown.
+*/
+typedef void (fz_render_band_fn)(fz_context *ctx, void *arg, fz_display_list *list, fz_render_band *band, fz_cookie *cookie);
+
+/**
+	Do something with a band that has been drawn (typically pass it
+	to a band writer). Called on the calling thread, for each band in
+	turn, from top to bottom.
+*/
+typedef void (fz_output_band_fn)(fz_context *ctx, void *arg, fz_render_band *band);
+
+/**
+	Render a display list in bands, without ever holding all of the
+	rendered area in memory, and give each band to write in turn.
+
+	area: The area to render, in device space.
+
+	band_height: The height of the bands.
+
+	cs, seps, alpha: The format of the band pixmaps.
+
+	draw: The function to draw a band, or NULL to clear the band (to
+	transparent if it has alpha, or white otherwise) and draw the
+	list into it with a plain draw device.
+
+	At most twice as many bands as there are threads are held in
+	memory at once, so a band that takes a long time to draw does
+	not keep the other threads waiting unless it holds up writing
+	for that long.
+*/
+void fz_render_display_list_bands(fz_context *ctx, fz_render_threads *threads, fz_display_list *list, fz_matrix ctm, fz_irect area, int band_height, fz_colorspace *cs, fz_separations *seps, int alpha, fz_render_band_fn *draw, fz_output_band_fn *write, void *arg, fz_cookie *cookie);
+
+/**
+	A banded render that has been started but not yet written.
+*/
+typedef struct fz_render_job fz_render_job;
+
+/**
+	Start rendering a display list in bands, as for
+	fz_render_display_list_bands, but return without waiting for
+	any of the bands to be drawn.
+
+	This lets a caller queue the next page while it is still busy
+	with the last one, so that threads finishing the last bands of
+	one page go straight on to the first bands of the next.
+
+	The job holds a reference to the list. Call
+	fz_finish_render_display_list_bands to write the bands, and
+	fz_drop_render_job when done with it.
+*/
+fz_render_job *fz_begin_render_display_list_bands(fz_context *ctx, fz_render_threads *threads, fz_display_list *list, fz_matrix ctm, fz_irect area, int band_height, fz_colorspace *cs, fz_separations *seps, int alpha, fz_render_band_fn *draw, fz_output_band_fn *write, void *arg, fz_cookie *cookie);
+
+/**
+	Wait for each band of a job in turn, and pass it to the job's
+	write function. Throws (leaving the job to be dropped) if any
+	band failed.
+*/
+void fz_finish_render_display_list_bands(fz_context *ctx, fz_render_job *job);
+
+/**
+	Drop a job. Any bands not yet started are abandoned, and any in
+	progress are aborted and waited for.
+*/
+void fz_drop_render_job(fz_context *ctx, fz_render_job *job);
+
+#endif
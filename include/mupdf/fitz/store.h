@@ -222,6 +222,14 @@ typedef struct
 	Every type of object to be placed into the store defines an
 	fz_store_type. This contains the pointers to functions to
 	make hashes, manipulate keys, and check for needing reaping.
+
+	The optional cost function returns an estimate of how expensive
+	it would be to recreate a value of the given size for the given
+	key, measured in bytes of work (for instance the size of the
+	compressed data that must be decoded again). Types without a
+	cost function are assumed to cost their size. The cost is
+	calculated once, as the item is stored, and is used by the
+	FZ_STORE_POLICY_GDS eviction policy.
 */
 typedef struct
 {
@@ -232,8 +240,30 @@ typedef struct
 	int (*cmp_key)(fz_context *ctx, void *a, void *b);
 	void (*format_key)(fz_context *ctx, char *buf, size_t size, void *key);
 	int (*needs_reap)(fz_context *ctx, void *key);
+	size_t (*cost)(fz_context *ctx, void *key, size_t size);
 } fz_store_type;
 
+/**
+	Policies used to choose which items to evict from the store
+	when it needs to make space.
+
+	FZ_STORE_POLICY_LRU: Evict the least recently used items first.
+
+	FZ_STORE_POLICY_GDS: GreedyDual-Size. Each item is given a
+	priority of its recreation cost per byte, plus an 'inflation'
+	value that rises as items are evicted. The item with the lowest
+	priority is evicted first, and an item's priority is refreshed
+	each time it is used. This keeps expensive items (such as
+	images that are slow to decode) in the store for longer than
+	cheap ones of the same size, while still letting unused items
+	age out.
+*/
+typedef enum
+{
+	FZ_STORE_POLICY_LRU,
+	FZ_STORE_POLICY_GDS
+} fz_store_policy;
+
 /**
 	Create a new store inside the context
 
@@ -242,6 +272,116 @@ typedef struct
 */
 void fz_new_store_context(fz_context *ctx, size_t max);
 
+/**
+	Change the eviction policy of the store in the context. The
+	store starts out with FZ_STORE_POLICY_LRU.
+
+	The store is created along with the context, so this is how
+	callers choose another policy (as mudraw -E does). It may be
+	called at any time, and takes effect from the next eviction.
+*/
+void fz_set_store_policy(fz_context *ctx, fz_store_policy policy);
+
+/**
+	Return the eviction policy of the store in the context.
+*/
+fz_store_policy fz_store_policy_in_use(fz_context *ctx);
+
+/**
+	Map from a (case sensitive) policy name ("lru" or "gds") to an
+	fz_store_policy. Unknown names give FZ_STORE_POLICY_LRU.
+*/
+fz_store_policy fz_lookup_store_policy(const char *name);
+
+/**
+	Map from an fz_store_policy to its name.
+*/
+const char *fz_store_policy_name(fz_store_policy policy);
+
+/**
+	Read the number of lookups that have been made in the store,
+	and how many of them found the item they were looking for.
+
+	Either pointer may be NULL.
+*/
+void fz_store_hit_counts(fz_context *ctx, size_t *lookups, size_t *hits);
+
+/**
+	The maximum number of different fz_store_types for which
+	statistics are kept. Items of further types are not counted.
+*/
+enum { FZ_STORE_STATS_MAX_TYPES = 16 };
+
+/**
+	Statistics kept by the store for one fz_store_type.
+
+	name: The name of the type.
+
+	lookups: The number of calls to fz_find_item, of which hits
+	found an item and misses did not.
+
+	insertions: The number of items added by fz_store_item
+	(not counting those that were already in the store).
+
+	evictions: The number of items evicted to make space, either
+	when storing an item or when scavenging memory, and the number
+	of bytes that these items accounted for.
+
+	scavenge_evictions: How many of those evictions were made
+	while scavenging memory for the allocator.
+
+	ensure_space_time: The time spent (in microseconds) evicting
+	other items to make space when storing items of this type.
+*/
+typedef struct
+{
+	const char *name;
+	size_t lookups;
+	size_t hits;
+	size_t misses;
+	size_t insertions;
+	size_t evictions;
+	size_t bytes_evicted;
+	size_t scavenge_evictions;
+	int64_t ensure_space_time;
+} fz_store_type_stats;
+
+/**
+	Statistics kept by the store.
+
+	size, max: The current and maximum size of the store.
+
+	scavenge_passes: The number of times the store was scavenged,
+	either by the allocator or by fz_shrink_store, and managed to
+	free something.
+
+	num_types, types: The per type statistics.
+*/
+typedef struct
+{
+	size_t size;
+	size_t max;
+	size_t scavenge_passes;
+	int num_types;
+	fz_store_type_stats types[FZ_STORE_STATS_MAX_TYPES];
+} fz_store_stats;
+
+/**
+	Read the statistics kept by the store.
+*/
+void fz_read_store_stats(fz_context *ctx, fz_store_stats *stats);
+
+/**
+	Reset all the statistics kept by the store to zero.
+*/
+void fz_reset_store_stats(fz_context *ctx);
+
+/**
+	Print the statistics kept by the store to the given output
+	channel, one line per type.
+*/
+void fz_print_store_stats(fz_context *ctx, fz_output *out);
+
 /**
 	Increment the reference count for the store context. Returns
 	the same pointer.
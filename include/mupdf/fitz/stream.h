@@ -30,6 +30,11 @@ typedef struct fz_stream fz_stream;
 	characters can be represented. Other platforms do the encoding
 	as standard anyway (and in most cases, particularly for MacOS
 	and Linux, the encoding they use is UTF-8 anyway).
+
+	The file is read through stdio, unless the library is built with
+	FZ_ENABLE_MMAP, in which case it is memory mapped where possible
+	and the stream reads directly from the mapping (see
+	fz_new_buffer_from_mapped_file).
 */
 fz_stream *fz_open_file(fz_context *ctx, const char *filename);
 
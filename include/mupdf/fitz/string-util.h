@@ -70,6 +70,25 @@ size_t fz_strlcat(char *dst, const char *src, size_t n);
 */
 void *fz_memmem(const void *haystack, size_t haystacklen, const void *needle, size_t needlelen);
 
+/**
+	A set of bytes, as two tables indexed by the low and the high
+	nibble of a byte: the byte is in the set if the entries for its
+	two nibbles have a bit in common. Any set with no more than 8
+	different high nibbles can be given this way.
+*/
+typedef struct
+{
+	unsigned char lo[16];
+	unsigned char hi[16];
+} fz_byte_set;
+
+/**
+	Find the first byte from p up to end that is in the set, or
+	end if there is none. Long runs are searched with SIMD
+	instructions where the CPU has them.
+*/
+const unsigned char *fz_find_byte_in_set(const unsigned char *p, const unsigned char *end, const fz_byte_set *set);
+
 /**
 	extract the directory component from a path.
 */
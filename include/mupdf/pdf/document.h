@@ -74,6 +74,30 @@ pdf_document *pdf_open_document(fz_context *ctx, const char *filename);
 */
 pdf_document *pdf_open_document_with_stream(fz_context *ctx, fz_stream *file);
 
+/*
+	Open a PDF document, using accelerator data saved from an
+	earlier opening of the same file (see fz_save_accelerator) so
+	that the cross reference table and page tree need not be read
+	again.
+
+	The accelerator is only used if it was made for this very file
+	(going by its length, the offset of its last cross reference
+	table, its final bytes and its ID); otherwise, or if accel is
+	NULL or cannot be read, the file is opened as by
+	pdf_open_document.
+
+	filename: a path to a file as it would be given to open(2).
+
+	accel: a path to the accelerator file, or NULL.
+*/
+pdf_document *pdf_open_accel_document(fz_context *ctx, const char *filename, const char *accel);
+
+/*
+	Same as pdf_open_accel_document, but takes streams instead of
+	filenames. Neither stream is dropped.
+*/
+pdf_document *pdf_open_accel_document_with_stream(fz_context *ctx, fz_stream *file, fz_stream *accel);
+
 /*
 	Closes and frees an opened PDF document.
 
@@ -269,6 +293,23 @@ typedef struct
 	int object;
 } pdf_rev_page_map;
 
+typedef struct
+{
+	pdf_obj *page; /* As found in the Kids array of parent */
+	pdf_obj *parent;
+	int index; /* Of page in the Kids array of parent */
+	pdf_obj *mediabox, *cropbox, *rotate, *resources; /* Inherited from parent */
+} pdf_fwd_page;
+
+typedef struct
+{
+	int count, max;
+	pdf_fwd_page *pages;
+	int node_count, node_max;
+	int *nodes; /* Sorted numbers of the objects holding the catalog and page tree nodes */
+	pdf_obj *root; /* The catalog, as the trailer had it when the map was made */
+} pdf_fwd_page_map;
+
 typedef struct
 {
 	int number; /* Page object number */
@@ -321,6 +362,9 @@ struct pdf_document
 
 	int rev_page_count;
 	pdf_rev_page_map *rev_page_map;
+	pdf_fwd_page_map *fwd_page_map;
+	int fwd_page_map_failed;
+	int fwd_page_lookups;
 
 	int repair_attempted;
 
@@ -386,6 +430,9 @@ struct pdf_document
 	int orphans_count;
 	pdf_obj **orphans;
 
+	int use_obj_arenas;
+	pdf_obj_arena *obj_arena;
+
 	pdf_xfa xfa;
 };
 
@@ -565,20 +612,25 @@ typedef struct
 	int permissions; /* Document encryption permissions. */
 	char opwd_utf8[128]; /* Owner password. */
 	char upwd_utf8[128]; /* User password. */
+	int do_use_objstms; /* Pack objects into object streams and write a cross reference stream. */
+	int compress_threads; /* Number of worker threads to compress streams on (0 to compress on the calling thread, at most 64). */
 } pdf_write_options;
 
 extern const pdf_write_options pdf_default_write_options;
 
 /*
 	Parse option string into a pdf_write_options struct.
-	Matches the command line options to 'mutool clean':
-		g: garbage collect
-		d, i, f: expand all, fonts, images
-		l: linearize
-		a: ascii hex encode
-		z: deflate
-		c: clean content streams
-		s: sanitize content streams
+	The options are those listed in fz_pdf_write_options_usage,
+	and match the command line options to 'mutool clean':
+		garbage: garbage collect (g)
+		decompress: expand all streams (d)
+		compress: deflate (z)
+		compress-fonts, compress-images: deflate fonts, images (f, i)
+		linearize: linearize (l)
+		ascii: ascii hex encode (a)
+		clean: clean content streams (c)
+		sanitize: sanitize content streams (s)
+		objstms: use object streams (Z)
 */
 pdf_write_options *pdf_parse_write_options(fz_context *ctx, pdf_write_options *opts, const char *args);
 
@@ -39,6 +39,39 @@ pdf_obj *pdf_deep_copy_obj(fz_context *ctx, pdf_obj *obj);
 pdf_obj *pdf_keep_obj(fz_context *ctx, pdf_obj *obj);
 void pdf_drop_obj(fz_context *ctx, pdf_obj *obj);
 
+/*
+	Object arenas.
+
+	Objects loaded from a document's file can be allocated from
+	arenas built on fz_pool, a few thousand at a time, rather than
+	one by one from the heap. Otherwise they are like any other
+	object: they can be kept, changed (arrays and dicts move their
+	items to the heap when they need to grow), and outlive the
+	document. An arena's memory is freed once the document has moved
+	on to a new arena and every object in it has been dropped, so a
+	single object kept for long keeps up to 64k allocated. Arenas
+	are off unless enabled.
+
+	pdf_current_obj_arena returns the arena that the parser should
+	allocate from, or NULL if arenas are not enabled. Objects made
+	with a NULL arena come from the heap. pdf_new_array_in_arena and
+	pdf_new_dict_in_arena take ownership of their n items (2n keys
+	and values for dicts), even if they throw.
+*/
+typedef struct pdf_obj_arena pdf_obj_arena;
+
+void pdf_enable_obj_arenas(fz_context *ctx, pdf_document *doc);
+void pdf_disable_obj_arenas(fz_context *ctx, pdf_document *doc);
+pdf_obj_arena *pdf_current_obj_arena(fz_context *ctx, pdf_document *doc);
+
+pdf_obj *pdf_new_int_in_arena(fz_context *ctx, pdf_obj_arena *arena, int64_t i);
+pdf_obj *pdf_new_real_in_arena(fz_context *ctx, pdf_obj_arena *arena, float f);
+pdf_obj *pdf_new_name_in_arena(fz_context *ctx, pdf_obj_arena *arena, const char *str);
+pdf_obj *pdf_new_string_in_arena(fz_context *ctx, pdf_obj_arena *arena, const char *str, size_t len);
+pdf_obj *pdf_new_indirect_in_arena(fz_context *ctx, pdf_obj_arena *arena, pdf_document *doc, int num, int gen);
+pdf_obj *pdf_new_array_in_arena(fz_context *ctx, pdf_obj_arena *arena, pdf_document *doc, int n, pdf_obj **items);
+pdf_obj *pdf_new_dict_in_arena(fz_context *ctx, pdf_obj_arena *arena, pdf_document *doc, int n, pdf_obj **items);
+
 int pdf_is_null(fz_context *ctx, pdf_obj *obj);
 int pdf_is_bool(fz_context *ctx, pdf_obj *obj);
 int pdf_is_int(fz_context *ctx, pdf_obj *obj);
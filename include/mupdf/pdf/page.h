@@ -10,6 +10,26 @@ pdf_obj *pdf_lookup_page_obj(fz_context *ctx, pdf_document *doc, int needle);
 void pdf_load_page_tree(fz_context *ctx, pdf_document *doc);
 void pdf_drop_page_tree(fz_context *ctx, pdf_document *doc);
 
+/*
+	Drop the map from page numbers to page objects that is built the
+	first time a page is looked up, if object num is part of the
+	page tree (or whatever num is if it is 0). To be called when the
+	object has been changed; pdf_insert_page and pdf_delete_page keep
+	the map up to date themselves.
+*/
+void pdf_invalidate_page_map(fz_context *ctx, pdf_document *doc, int num);
+
+/*
+	Write the map from page numbers to page objects (mapping the
+	page tree first if need be) as part of a document's accelerator
+	data, or read such a map back in. Nothing is written to be read
+	back if the document has been changed since it was opened.
+	Reading never throws; any trouble and the map is simply not
+	there.
+*/
+void pdf_write_page_map(fz_context *ctx, pdf_document *doc, fz_output *out);
+void pdf_read_page_map(fz_context *ctx, pdf_document *doc, fz_stream *stm);
+
 /*
 	Find the page number of a named destination.
 
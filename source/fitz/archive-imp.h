@@ -0,0 +1,32 @@
+#ifndef FITZ_ARCHIVE_IMP_H
+#define FITZ_ARCHIVE_IMP_H
+
+/*
+	A case-insensitive hash index from entry names to entry numbers,
+	used by the archive formats to avoid a linear scan of their
+	directory on every lookup.
+*/
+typedef struct
+{
+	int mask;
+	int *slots;
+} fz_archive_index;
+
+typedef const char *(fz_archive_index_name_fn)(void *arg, int idx);
+
+/*
+	Build an index over 'count' entries, whose names are given by
+	calling name(arg, idx). Where several entries have the same
+	name (ignoring case), lookups find the first of them.
+*/
+void fz_build_archive_index(fz_context *ctx, fz_archive_index *index, int count, fz_archive_index_name_fn *name, void *arg);
+
+/*
+	Return the number of the entry called 'key' (ignoring case), or
+	-1 if there is no such entry.
+*/
+int fz_lookup_archive_index(fz_context *ctx, const fz_archive_index *index, const char *key, fz_archive_index_name_fn *name, void *arg);
+
+void fz_drop_archive_index(fz_context *ctx, fz_archive_index *index);
+
+#endif
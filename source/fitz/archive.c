@@ -1,5 +1,10 @@
 #include "mupdf/fitz.h"
 
+#include "archive-imp.h"
+
+#include <string.h>
+#include <limits.h>
+
 fz_stream *
 fz_open_archive_entry(fz_context *ctx, fz_archive *arch, const char *name)
 {
@@ -99,3 +104,75 @@ fz_drop_archive(fz_context *ctx, fz_archive *arch)
 	fz_drop_stream(ctx, arch->file);
 	fz_free(ctx, arch);
 }
+
+static unsigned int
+hash_name(const char *s)
+{
+	unsigned int h = 2166136261u;
+	int c;
+	/* Fold case the same way as fz_strcasecmp. */
+	while ((c = (unsigned char)*s++) != 0)
+	{
+		if (c >= 'A' && c <= 'Z')
+			c += 32;
+		h ^= c;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+void
+fz_build_archive_index(fz_context *ctx, fz_archive_index *index, int count, fz_archive_index_name_fn *name, void *arg)
+{
+	int size = 16;
+	int i, pos;
+
+	fz_drop_archive_index(ctx, index);
+
+	while (size < INT_MAX / 2 && size < count * 2)
+		size <<= 1;
+	index->slots = Memento_label(fz_calloc(ctx, size, sizeof(int)), "fz_archive_index");
+	index->mask = size - 1;
+
+	/* Slots hold entry numbers plus one, so that zero means empty. */
+	for (i = 0; i < count; i++)
+	{
+		const char *s = name(arg, i);
+		pos = hash_name(s) & index->mask;
+		while (index->slots[pos])
+		{
+			if (!fz_strcasecmp(s, name(arg, index->slots[pos] - 1)))
+				break;
+			pos = (pos + 1) & index->mask;
+		}
+		if (!index->slots[pos])
+			index->slots[pos] = i + 1;
+	}
+}
+
+int
+fz_lookup_archive_index(fz_context *ctx, const fz_archive_index *index, const char *key, fz_archive_index_name_fn *name, void *arg)
+{
+	int pos;
+
+	if (!index->slots)
+		return -1;
+
+	pos = hash_name(key) & index->mask;
+	while (index->slots[pos])
+	{
+		int idx = index->slots[pos] - 1;
+		if (!fz_strcasecmp(key, name(arg, idx)))
+			return idx;
+		pos = (pos + 1) & index->mask;
+	}
+	return -1;
+}
+
+void
+fz_drop_archive_index(fz_context *ctx, fz_archive_index *index)
+{
+	fz_free(ctx, index->slots);
+	index->slots = NULL;
+	index->mask = 0;
+}
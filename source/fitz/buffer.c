@@ -1,7 +1,23 @@
+#define _LARGEFILE_SOURCE
+#ifndef _FILE_OFFSET_BITS
+#define _FILE_OFFSET_BITS 64
+#endif
+
 #include "mupdf/fitz.h"
 
 #include <string.h>
 #include <stdarg.h>
+#include <stdint.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#endif
 
 fz_buffer *
 fz_new_buffer(fz_context *ctx, size_t size)
@@ -107,6 +123,114 @@ fz_new_buffer_from_base64(fz_context *ctx, const char *data, size_t size)
 	return buf;
 }
 
+#ifdef _WIN32
+
+static void *
+map_file(const char *filename, size_t *lenp)
+{
+	wchar_t *wname;
+	HANDLE file, mapping;
+	LARGE_INTEGER size;
+	void *data = NULL;
+
+	wname = fz_wchar_from_utf8(filename);
+	if (wname == NULL)
+		return NULL;
+	file = CreateFileW(wname, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	free(wname);
+	if (file == INVALID_HANDLE_VALUE)
+		return NULL;
+
+	if (GetFileType(file) == FILE_TYPE_DISK && GetFileSizeEx(file, &size) &&
+		size.QuadPart > 0 && (uint64_t)size.QuadPart <= SIZE_MAX)
+	{
+		mapping = CreateFileMappingW(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (mapping)
+		{
+			data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+			/* The view keeps the mapping object alive. */
+			CloseHandle(mapping);
+			*lenp = (size_t)size.QuadPart;
+		}
+	}
+
+	CloseHandle(file);
+	return data;
+}
+
+static void
+unmap_file(void *data, size_t len)
+{
+	UnmapViewOfFile(data);
+}
+
+#else
+
+static void *
+map_file(const char *filename, size_t *lenp)
+{
+	struct stat info;
+	void *data = NULL;
+	int fd;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) &&
+		info.st_size > 0 && (uint64_t)info.st_size <= SIZE_MAX)
+	{
+		data = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data == MAP_FAILED)
+			data = NULL;
+		else
+			*lenp = (size_t)info.st_size;
+	}
+
+	/* The mapping stays valid after the descriptor is closed. */
+	close(fd);
+	return data;
+}
+
+static void
+unmap_file(void *data, size_t len)
+{
+	munmap(data, len);
+}
+
+#endif
+
+fz_buffer *
+fz_new_buffer_from_mapped_file(fz_context *ctx, const char *filename)
+{
+	fz_buffer *b = NULL;
+	unsigned char *data;
+	size_t len = 0;
+
+	data = map_file(filename, &len);
+	if (data == NULL)
+		return NULL;
+
+	fz_try(ctx)
+	{
+		b = fz_malloc_struct(ctx, fz_buffer);
+		b->refs = 1;
+		b->data = data;
+		b->cap = len;
+		b->len = len;
+		b->unused_bits = 0;
+		b->shared = 1;
+		b->mapped = 1;
+	}
+	fz_catch(ctx)
+	{
+		unmap_file(data, len);
+		fz_rethrow(ctx);
+	}
+
+	return b;
+}
+
 fz_buffer *
 fz_keep_buffer(fz_context *ctx, fz_buffer *buf)
 {
@@ -118,7 +242,9 @@ fz_drop_buffer(fz_context *ctx, fz_buffer *buf)
 {
 	if (fz_drop_imp(ctx, buf, &buf->refs))
 	{
-		if (!buf->shared)
+		if (buf->mapped)
+			unmap_file(buf->data, buf->cap);
+		else if (!buf->shared)
 			fz_free(ctx, buf->data);
 		fz_free(ctx, buf);
 	}
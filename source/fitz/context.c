@@ -104,6 +104,21 @@ void fz_tune_image_scale(fz_context *ctx, fz_tune_image_scale_fn *image_scale, v
 	ctx->tuning->image_scale_arg = arg;
 }
 
+void fz_tune_thread_pool(fz_context *ctx, const fz_thread_pool *pool)
+{
+	if (pool)
+		ctx->tuning->thread_pool = *pool;
+	else
+		memset(&ctx->tuning->thread_pool, 0, sizeof ctx->tuning->thread_pool);
+}
+
+const fz_thread_pool *fz_tuned_thread_pool(fz_context *ctx)
+{
+	if (ctx->tuning->thread_pool.run && ctx->tuning->thread_pool.workers > 1)
+		return &ctx->tuning->thread_pool;
+	return NULL;
+}
+
 static void fz_init_random_context(fz_context *ctx)
 {
 	if (!ctx)
@@ -1,6 +1,12 @@
 #include "mupdf/fitz.h"
 
 #include <string.h>
+#include <limits.h>
+#include <stdlib.h>
+
+#ifndef PATH_MAX
+#define PATH_MAX 4096
+#endif
 
 enum
 {
@@ -225,6 +231,33 @@ fz_open_document(fz_context *ctx, const char *filename)
 	return fz_open_accelerated_document(ctx, filename, NULL);
 }
 
+int fz_default_accelerator_filename(fz_context *ctx, char *buf, size_t len, const char *filename)
+{
+	char absname[PATH_MAX];
+	char *tmpdir;
+	char *name, *s;
+
+	if (!fz_realpath(filename, absname))
+		return 0;
+
+	tmpdir = getenv("TEMP");
+	if (!tmpdir)
+		tmpdir = getenv("TMP");
+	if (!tmpdir)
+		tmpdir = "/var/tmp";
+	if (!fz_is_directory(ctx, tmpdir))
+		tmpdir = "/tmp";
+
+	name = absname;
+	if (*name == '/' || *name == '\\')
+		++name;
+	for (s = name; *s; ++s)
+		if (*s == '/' || *s == '\\' || *s == ':')
+			*s = '%';
+
+	return fz_snprintf(buf, len, "%s/%s.accel", tmpdir, name) < len;
+}
+
 void fz_save_accelerator(fz_context *ctx, fz_document *doc, const char *accel)
 {
 	if (doc == NULL)
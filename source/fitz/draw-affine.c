@@ -1,9 +1,11 @@
 #include "mupdf/fitz.h"
 #include "draw-imp.h"
+#include "simd-imp.h"
 
 #include <math.h>
 #include <float.h>
 #include <assert.h>
+#include <string.h>
 
 /* Number of fraction bits for fixed point math */
 #define PREC 14
@@ -1202,6 +1204,622 @@ template_affine_color_N_near_op(byte * FZ_RESTRICT dp, int da, const byte * FZ_R
 	while (--w);
 }
 
+/*
+	SIMD versions of the commonest affine painters.
+
+	These do 8 pixels of the destination at a time, one to each 32 bit
+	lane: the positions in the source are stepped along in the lanes,
+	the source pixels (or the 4 around each position, for lerp) are
+	gathered, and they are blended over the destination with exactly
+	the same sums as in template_affine_alpha_N_lerp and friends. Those
+	deal with the end of each row, and remain the reference.
+
+	Pixels are gathered as a 32 bit word each. To stay inside the
+	buffer, the word for a pixel of less than 4 bytes is read so that
+	it ends with the pixel (unless that would start before the buffer),
+	and then shifted down; the fifth byte of a cmyk + alpha pixel is
+	read as the top byte of the word one byte further on.
+*/
+
+#if defined(FZ_SIMD_X86)
+#define AFFINE_SIMD
+#define AFFINE_SIMD_TARGET FZ_SIMD_TARGET("avx2")
+#define AFFINE_SIMD_FEATURES FZ_CPU_AVX2
+#elif defined(FZ_SIMD_NEON) && defined(__aarch64__)
+#define AFFINE_SIMD
+#define AFFINE_SIMD_TARGET
+#define AFFINE_SIMD_FEATURES FZ_CPU_NEON
+#endif
+
+#ifdef AFFINE_SIMD
+
+/* For each byte of 4 pixels of bpp bytes packed together, the byte of
+ * their 4 words that it comes from. */
+static const byte affine_simd_pack[5][16] = {
+	{ 0, 4, 8, 12, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 },
+	{ 0, 1, 4, 5, 8, 9, 12, 13, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 },
+	{ 0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, 0x80, 0x80, 0x80, 0x80 },
+	{ 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 },
+	{ 0, 1, 2, 3, 0x80, 4, 5, 6, 7, 0x80, 8, 9, 10, 11, 0x80, 12 }
+};
+
+/* And for pixels of 5 bytes: the bytes of the first 16 that come from
+ * the fifth bytes, and the last 4 bytes from the words and the fifth
+ * bytes. */
+static const byte affine_simd_pack5[3][16] = {
+	{ 0x80, 0x80, 0x80, 0x80, 0, 0x80, 0x80, 0x80, 0x80, 4, 0x80, 0x80, 0x80, 0x80, 8, 0x80 },
+	{ 13, 14, 15, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 },
+	{ 0x80, 0x80, 0x80, 12, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 }
+};
+
+#ifdef FZ_SIMD_X86
+
+typedef __m256i av; /* 8 lanes of 32 bits */
+
+AFFINE_SIMD_TARGET static inline av av_set(int v) { return _mm256_set1_epi32(v); }
+AFFINE_SIMD_TARGET static inline av av_lanes(void) { return _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7); }
+AFFINE_SIMD_TARGET static inline av av_add(av a, av b) { return _mm256_add_epi32(a, b); }
+AFFINE_SIMD_TARGET static inline av av_sub(av a, av b) { return _mm256_sub_epi32(a, b); }
+AFFINE_SIMD_TARGET static inline av av_mul(av a, av b) { return _mm256_mullo_epi32(a, b); }
+AFFINE_SIMD_TARGET static inline av av_and(av a, av b) { return _mm256_and_si256(a, b); }
+AFFINE_SIMD_TARGET static inline av av_or(av a, av b) { return _mm256_or_si256(a, b); }
+AFFINE_SIMD_TARGET static inline av av_min(av a, av b) { return _mm256_min_epi32(a, b); }
+AFFINE_SIMD_TARGET static inline av av_max(av a, av b) { return _mm256_max_epi32(a, b); }
+AFFINE_SIMD_TARGET static inline av av_gt(av a, av b) { return _mm256_cmpgt_epi32(a, b); }
+AFFINE_SIMD_TARGET static inline av av_select(av mask, av t, av f) { return _mm256_blendv_epi8(f, t, mask); }
+AFFINE_SIMD_TARGET static inline av av_shl(av a, int n) { return _mm256_slli_epi32(a, n); }
+AFFINE_SIMD_TARGET static inline av av_sra(av a, int n) { return _mm256_srai_epi32(a, n); }
+AFFINE_SIMD_TARGET static inline av av_srl(av a, int n) { return _mm256_srli_epi32(a, n); }
+AFFINE_SIMD_TARGET static inline av av_srlv(av a, av n) { return _mm256_srlv_epi32(a, n); }
+AFFINE_SIMD_TARGET static inline int av_any(av mask) { return !_mm256_testz_si256(mask, mask); }
+AFFINE_SIMD_TARGET static inline int av_all(av mask) { return _mm256_movemask_epi8(mask) == -1; }
+AFFINE_SIMD_TARGET static inline av av_load(const byte *p) { return _mm256_loadu_si256((const __m256i *)p); }
+
+AFFINE_SIMD_TARGET static inline av
+av_gather(const byte *p, av off)
+{
+	return _mm256_i32gather_epi32((const int *)p, off, 1);
+}
+
+/* 8 bytes, one to a lane. */
+AFFINE_SIMD_TARGET static inline av
+av_load_bytes(const byte *p)
+{
+	return _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)p));
+}
+
+AFFINE_SIMD_TARGET static inline void
+av_store_bytes(byte *p, av a)
+{
+	av b = _mm256_shuffle_epi8(a, _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)affine_simd_pack[0])));
+	b = _mm256_permutevar8x32_epi32(b, _mm256_setr_epi32(0, 4, 0, 0, 0, 0, 0, 0));
+	_mm_storel_epi64((__m128i *)p, _mm256_castsi256_si128(b));
+}
+
+/* Pack 4 pixels of bpp bytes from their words (and fifth bytes), and
+ * store them. */
+AFFINE_SIMD_TARGET static inline void
+affine_simd_store4(byte *p, __m128i w, __m128i c4, int bpp)
+{
+	__m128i x = _mm_shuffle_epi8(w, _mm_loadu_si128((const __m128i *)affine_simd_pack[bpp - 1]));
+	int32_t y;
+
+	switch (bpp)
+	{
+	case 1:
+		y = _mm_cvtsi128_si32(x);
+		memcpy(p, &y, 4);
+		break;
+	case 2:
+		_mm_storel_epi64((__m128i *)p, x);
+		break;
+	case 3:
+		y = _mm_cvtsi128_si32(_mm_srli_si128(x, 8));
+		_mm_storel_epi64((__m128i *)p, x);
+		memcpy(p + 8, &y, 4);
+		break;
+	case 4:
+		_mm_storeu_si128((__m128i *)p, x);
+		break;
+	default:
+		x = _mm_or_si128(x, _mm_shuffle_epi8(c4, _mm_loadu_si128((const __m128i *)affine_simd_pack5[0])));
+		_mm_storeu_si128((__m128i *)p, x);
+		x = _mm_or_si128(_mm_shuffle_epi8(w, _mm_loadu_si128((const __m128i *)affine_simd_pack5[1])),
+			_mm_shuffle_epi8(c4, _mm_loadu_si128((const __m128i *)affine_simd_pack5[2])));
+		y = _mm_cvtsi128_si32(x);
+		memcpy(p + 16, &y, 4);
+		break;
+	}
+}
+
+AFFINE_SIMD_TARGET static inline void
+av_store_pixels(byte *p, av w, av c4, int bpp)
+{
+	affine_simd_store4(p, _mm256_castsi256_si128(w), _mm256_castsi256_si128(c4), bpp);
+	affine_simd_store4(p + 4 * bpp, _mm256_extracti128_si256(w, 1), _mm256_extracti128_si256(c4, 1), bpp);
+}
+
+#else /* FZ_SIMD_NEON */
+
+typedef int32x4x2_t av; /* 8 lanes of 32 bits */
+
+static inline av av_set(int v) { av r; r.val[0] = r.val[1] = vdupq_n_s32(v); return r; }
+
+static inline av
+av_load(const byte *p)
+{
+	av r;
+	r.val[0] = vreinterpretq_s32_u8(vld1q_u8(p));
+	r.val[1] = vreinterpretq_s32_u8(vld1q_u8(p + 16));
+	return r;
+}
+
+static inline av
+av_lanes(void)
+{
+	static const int32_t lanes[8] = { 0, 1, 2, 3, 4, 5, 6, 7 };
+	av r;
+	r.val[0] = vld1q_s32(lanes);
+	r.val[1] = vld1q_s32(lanes + 4);
+	return r;
+}
+
+#define AV_OP2(NAME, OP) \
+	static inline av NAME(av a, av b) { a.val[0] = OP(a.val[0], b.val[0]); a.val[1] = OP(a.val[1], b.val[1]); return a; }
+AV_OP2(av_add, vaddq_s32)
+AV_OP2(av_sub, vsubq_s32)
+AV_OP2(av_mul, vmulq_s32)
+AV_OP2(av_and, vandq_s32)
+AV_OP2(av_or, vorrq_s32)
+AV_OP2(av_min, vminq_s32)
+AV_OP2(av_max, vmaxq_s32)
+#undef AV_OP2
+
+static inline av
+av_gt(av a, av b)
+{
+	a.val[0] = vreinterpretq_s32_u32(vcgtq_s32(a.val[0], b.val[0]));
+	a.val[1] = vreinterpretq_s32_u32(vcgtq_s32(a.val[1], b.val[1]));
+	return a;
+}
+
+static inline av
+av_select(av mask, av t, av f)
+{
+	f.val[0] = vbslq_s32(vreinterpretq_u32_s32(mask.val[0]), t.val[0], f.val[0]);
+	f.val[1] = vbslq_s32(vreinterpretq_u32_s32(mask.val[1]), t.val[1], f.val[1]);
+	return f;
+}
+
+static inline av av_shl(av a, int n) { int32x4_t c = vdupq_n_s32(n); a.val[0] = vshlq_s32(a.val[0], c); a.val[1] = vshlq_s32(a.val[1], c); return a; }
+static inline av av_sra(av a, int n) { return av_shl(a, -n); }
+
+static inline av
+av_srlv(av a, av n)
+{
+	a.val[0] = vreinterpretq_s32_u32(vshlq_u32(vreinterpretq_u32_s32(a.val[0]), vnegq_s32(n.val[0])));
+	a.val[1] = vreinterpretq_s32_u32(vshlq_u32(vreinterpretq_u32_s32(a.val[1]), vnegq_s32(n.val[1])));
+	return a;
+}
+
+static inline av av_srl(av a, int n) { return av_srlv(a, av_set(n)); }
+
+static inline int
+av_any(av mask)
+{
+	return vmaxvq_u32(vorrq_u32(vreinterpretq_u32_s32(mask.val[0]), vreinterpretq_u32_s32(mask.val[1]))) != 0;
+}
+
+static inline int
+av_all(av mask)
+{
+	return vminvq_u32(vandq_u32(vreinterpretq_u32_s32(mask.val[0]), vreinterpretq_u32_s32(mask.val[1]))) == 0xffffffff;
+}
+
+/* There is no gather, so do the loads one by one. */
+static inline av
+av_gather(const byte *p, av off)
+{
+	int32_t o[8], x[8];
+	int i;
+	av r;
+
+	vst1q_s32(o, off.val[0]);
+	vst1q_s32(o + 4, off.val[1]);
+	for (i = 0; i < 8; i++)
+		memcpy(&x[i], p + o[i], 4);
+	r.val[0] = vld1q_s32(x);
+	r.val[1] = vld1q_s32(x + 4);
+	return r;
+}
+
+/* 8 bytes, one to a lane. */
+static inline av
+av_load_bytes(const byte *p)
+{
+	uint16x8_t h = vmovl_u8(vld1_u8(p));
+	av r;
+	r.val[0] = vreinterpretq_s32_u32(vmovl_u16(vget_low_u16(h)));
+	r.val[1] = vreinterpretq_s32_u32(vmovl_u16(vget_high_u16(h)));
+	return r;
+}
+
+static inline void
+av_store_bytes(byte *p, av a)
+{
+	int16x8_t h = vcombine_s16(vmovn_s32(a.val[0]), vmovn_s32(a.val[1]));
+	vst1_u8(p, vmovn_u16(vreinterpretq_u16_s16(h)));
+}
+
+/* Pack 4 pixels of bpp bytes from their words (and fifth bytes), and
+ * store them. */
+static inline void
+affine_simd_store4(byte *p, int32x4_t w, int32x4_t c4, int bpp)
+{
+	uint8x16_t wb = vreinterpretq_u8_s32(w);
+	uint8x16_t cb = vreinterpretq_u8_s32(c4);
+	uint8x16_t x = vqtbl1q_u8(wb, vld1q_u8(affine_simd_pack[bpp - 1]));
+
+	switch (bpp)
+	{
+	case 1:
+		vst1q_lane_u32((uint32_t *)(void *)p, vreinterpretq_u32_u8(x), 0);
+		break;
+	case 2:
+		vst1_u8(p, vget_low_u8(x));
+		break;
+	case 3:
+		vst1_u8(p, vget_low_u8(x));
+		vst1q_lane_u32((uint32_t *)(void *)(p + 8), vreinterpretq_u32_u8(x), 2);
+		break;
+	case 4:
+		vst1q_u8(p, x);
+		break;
+	default:
+		vst1q_u8(p, vorrq_u8(x, vqtbl1q_u8(cb, vld1q_u8(affine_simd_pack5[0]))));
+		x = vorrq_u8(vqtbl1q_u8(wb, vld1q_u8(affine_simd_pack5[1])), vqtbl1q_u8(cb, vld1q_u8(affine_simd_pack5[2])));
+		vst1q_lane_u32((uint32_t *)(void *)(p + 16), vreinterpretq_u32_u8(x), 0);
+		break;
+	}
+}
+
+static inline void
+av_store_pixels(byte *p, av w, av c4, int bpp)
+{
+	affine_simd_store4(p, w.val[0], c4.val[0], bpp);
+	affine_simd_store4(p + 4 * bpp, w.val[1], c4.val[1], bpp);
+}
+
+#endif /* FZ_SIMD_NEON */
+
+AFFINE_SIMD_TARGET static inline av
+av_mul255(av a, av b)
+{
+	av x = av_add(av_mul(a, b), av_set(128));
+	return av_srl(av_add(x, av_srl(x, 8)), 8);
+}
+
+AFFINE_SIMD_TARGET static inline av
+av_lerp(av a, av b, av t)
+{
+	return av_add(a, av_sra(av_mul(av_sub(b, a), t), PREC));
+}
+
+AFFINE_SIMD_TARGET static inline av
+av_clamp(av a, av lo, av hi)
+{
+	return av_min(av_max(a, lo), hi);
+}
+
+/* Byte k of each word. */
+AFFINE_SIMD_TARGET static inline av
+av_byte(av w, int k)
+{
+	return av_and(av_srl(w, 8 * k), av_set(255));
+}
+
+/* The first 4 bytes of the pixels of bpp bytes at p + off, in the low
+ * bytes of each lane. */
+AFFINE_SIMD_TARGET static inline av
+av_gather_pixels(const byte *p, av off, int bpp)
+{
+	if (bpp < 4)
+	{
+		av start = av_max(av_sub(off, av_set(4 - bpp)), av_set(0));
+		return av_srlv(av_gather(p, start), av_shl(av_sub(off, start), 3));
+	}
+	return av_gather(p, off);
+}
+
+/* The fifth bytes of the same. */
+AFFINE_SIMD_TARGET static inline av
+av_gather_fifth(const byte *p, av off)
+{
+	return av_srl(av_gather(p + 1, off), 24);
+}
+
+/* Gather the components of the source pixels at off into s. */
+AFFINE_SIMD_TARGET static FZ_SIMD_INLINE void
+affine_simd_sample(av *s, const byte *sp, av off, int sbpp)
+{
+	av x = av_gather_pixels(sp, off, sbpp);
+	int k;
+
+	for (k = 0; k < sbpp && k < 4; k++)
+		s[k] = av_byte(x, k);
+	if (sbpp == 5)
+		s[4] = av_gather_fifth(sp, off);
+}
+
+/* As template_affine_alpha_N_lerp (if lerp) or template_affine_alpha_N_near
+ * with sn == dn, or the g2rgb versions if sn1 == 1 and dn1 == 3, for as
+ * many whole blocks of 8 pixels as there are. Returns the number of
+ * pixels done. */
+AFFINE_SIMD_TARGET static FZ_SIMD_INLINE int
+affine_simd(byte * FZ_RESTRICT dp, int da, const byte * FZ_RESTRICT sp, int sw, int sh, int ss, int sa, int u, int v, int fa, int fb, int w, int dn1, int sn1, int alpha, byte * FZ_RESTRICT hp, byte * FZ_RESTRICT gp, int lerp)
+{
+	int sbpp = sn1 + sa;
+	int dbpp = dn1 + da;
+	int iw = lerp ? sw >> PREC : sw;
+	int ih = lerp ? sh >> PREC : sh;
+	av zero = av_set(0);
+	av vu, vv, du, dv, doff;
+	int i, k;
+
+	/* Every gather reads 4 bytes. */
+	if (iw <= 0 || ih <= 0 || (int64_t)(ih - 1) * ss + iw * sbpp < 4)
+		return 0;
+
+	/* u and v step along as in the C, wrapping around the same. */
+	vu = av_add(av_set(u), av_mul(av_lanes(), av_set(fa)));
+	vv = av_add(av_set(v), av_mul(av_lanes(), av_set(fb)));
+	du = av_set((int)((unsigned int)fa << 3));
+	dv = av_set((int)((unsigned int)fb << 3));
+	doff = av_mul(av_lanes(), av_set(dbpp));
+
+	for (i = 0; i + 8 <= w; i += 8, vu = av_add(vu, du), vv = av_add(vv, dv))
+	{
+		av ui = av_sra(vu, PREC);
+		av vi = av_sra(vv, PREC);
+		av s[5], a, aa, t, ok, paint, dw, dc4, rw, rc4;
+		byte *q = dp + i * dbpp;
+
+		if (lerp)
+			ok = av_and(av_and(av_gt(av_add(vu, av_set(HALF)), av_set(-1)), av_gt(av_set(sw), av_add(vu, av_set(ONE)))),
+				av_and(av_gt(av_add(vv, av_set(HALF)), av_set(-1)), av_gt(av_set(sh), av_add(vv, av_set(ONE)))));
+		else
+			ok = av_and(av_and(av_gt(ui, av_set(-1)), av_gt(av_set(sw), ui)),
+				av_and(av_gt(vi, av_set(-1)), av_gt(av_set(sh), vi)));
+		if (!av_any(ok))
+			continue;
+
+		/* Out of range lanes are clamped too, to keep the gathers
+		 * inside the image. */
+		if (lerp)
+		{
+			av uf = av_and(vu, av_set(MASK));
+			av vf = av_and(vv, av_set(MASK));
+			av c0 = av_mul(av_clamp(ui, zero, av_set(iw - 1)), av_set(sbpp));
+			av c1 = av_mul(av_clamp(av_add(ui, av_set(1)), zero, av_set(iw - 1)), av_set(sbpp));
+			av r0 = av_mul(av_clamp(vi, zero, av_set(ih - 1)), av_set(ss));
+			av r1 = av_mul(av_clamp(av_add(vi, av_set(1)), zero, av_set(ih - 1)), av_set(ss));
+			av s00[5], s01[5], s10[5], s11[5];
+
+			affine_simd_sample(s00, sp, av_add(r0, c0), sbpp);
+			affine_simd_sample(s01, sp, av_add(r0, c1), sbpp);
+			affine_simd_sample(s10, sp, av_add(r1, c0), sbpp);
+			affine_simd_sample(s11, sp, av_add(r1, c1), sbpp);
+			for (k = 0; k < sbpp; k++)
+				s[k] = av_lerp(av_lerp(s00[k], s01[k], uf), av_lerp(s10[k], s11[k], uf), vf);
+		}
+		else
+		{
+			av c = av_mul(av_clamp(ui, zero, av_set(iw - 1)), av_set(sbpp));
+			av r = av_mul(av_clamp(vi, zero, av_set(ih - 1)), av_set(ss));
+			affine_simd_sample(s, sp, av_add(r, c), sbpp);
+		}
+
+		if (sa)
+		{
+			a = s[sn1];
+			aa = alpha == 255 ? a : av_mul255(a, av_set(alpha));
+		}
+		else
+		{
+			a = av_set(255);
+			aa = av_set(alpha);
+		}
+		paint = av_and(ok, av_gt(aa, zero));
+		if (!av_any(paint))
+			continue;
+		t = av_sub(av_set(255), aa);
+
+		/* Opaque pixels over the whole block need nothing from the
+		 * destination. */
+		if (av_all(paint) && !av_any(t))
+			dw = dc4 = zero;
+		else
+		{
+			if (dbpp == 4)
+				dw = av_load(q);
+			else
+				dw = av_gather_pixels(q, doff, dbpp);
+			dc4 = dbpp == 5 ? av_gather_fifth(q, doff) : zero;
+		}
+
+		rw = zero;
+		rc4 = zero;
+		for (k = 0; k < dbpp; k++)
+		{
+			av d = k < 4 ? av_byte(dw, k) : dc4;
+			av r;
+			if (k == dn1)
+				r = aa;
+			else
+			{
+				r = s[k < sn1 ? k : 0];
+				if (alpha != 255)
+					r = av_mul255(r, av_set(alpha));
+			}
+			r = av_and(av_add(r, av_mul255(d, t)), av_set(255));
+			if (k < 4)
+				rw = av_or(rw, av_shl(r, 8 * k));
+			else
+				rc4 = r;
+		}
+		av_store_pixels(q, av_select(paint, rw, dw), av_select(paint, rc4, dc4), dbpp);
+
+		if (hp)
+		{
+			av h = av_load_bytes(hp + i);
+			av r = av_add(a, av_mul255(h, av_sub(av_set(255), a)));
+			av_store_bytes(hp + i, av_select(paint, r, h));
+		}
+		if (gp)
+		{
+			av g = av_load_bytes(gp + i);
+			av r = av_add(aa, av_mul255(g, t));
+			av_store_bytes(gp + i, av_select(paint, r, g));
+		}
+	}
+	return i;
+}
+
+/* Paint a row with affine_simd, and the rest of it with the C. */
+AFFINE_SIMD_TARGET static FZ_SIMD_INLINE void
+affine_simd_row(byte * FZ_RESTRICT dp, int da, const byte * FZ_RESTRICT sp, int sw, int sh, int ss, int sa, int u, int v, int fa, int fb, int w, int dn1, int sn1, int alpha, byte * FZ_RESTRICT hp, byte * FZ_RESTRICT gp, int lerp)
+{
+	int i = affine_simd(dp, da, sp, sw, sh, ss, sa, u, v, fa, fb, w, dn1, sn1, alpha, hp, gp, lerp);
+
+	if (i == w)
+		return;
+	dp += i * (dn1 + da);
+	u = (int)(u + (unsigned int)fa * i);
+	v = (int)(v + (unsigned int)fb * i);
+	if (hp)
+		hp += i;
+	if (gp)
+		gp += i;
+	if (dn1 != sn1)
+	{
+		if (lerp)
+			template_affine_alpha_g2rgb_lerp(dp, da, sp, sw, sh, ss, sa, u, v, fa, fb, w - i, alpha, hp, gp);
+		else
+			template_affine_alpha_g2rgb_near(dp, da, sp, sw, sh, ss, sa, u, v, fa, fb, w - i, alpha, hp, gp);
+	}
+	else
+	{
+		if (lerp)
+			template_affine_alpha_N_lerp(dp, da, sp, sw, sh, ss, sa, u, v, fa, fb, w - i, dn1, sn1, alpha, hp, gp);
+		else
+			template_affine_alpha_N_near(dp, da, sp, sw, sh, ss, sa, u, v, fa, fb, w - i, dn1, sn1, alpha, hp, gp);
+	}
+}
+
+#define AFFINE_SIMD_PAINTER(KIND, NAME, DA, SA, DN1, SN1, LERP) \
+	AFFINE_SIMD_TARGET static void \
+	paint_affine_##KIND##_##NAME##_simd(byte * FZ_RESTRICT dp, int da, const byte * FZ_RESTRICT sp, int sw, int sh, int ss, int sa, int u, int v, int fa, int fb, int w, int dn, int sn, int alpha, const byte * FZ_RESTRICT color, byte * FZ_RESTRICT hp, byte * FZ_RESTRICT gp, const fz_overprint * FZ_RESTRICT eop) \
+	{ \
+		TRACK_FN(); \
+		affine_simd_row(dp, DA, sp, sw, sh, ss, SA, u, v, fa, fb, w, DN1, SN1, alpha, hp, gp, LERP); \
+	}
+
+#define AFFINE_SIMD_PAINTERS(NAME, DA, SA, DN1, SN1) \
+	AFFINE_SIMD_PAINTER(lerp, NAME, DA, SA, DN1, SN1, 1) \
+	AFFINE_SIMD_PAINTER(near, NAME, DA, SA, DN1, SN1, 0)
+
+AFFINE_SIMD_PAINTERS(da_sa_0, 1, 1, 0, 0)
+AFFINE_SIMD_PAINTERS(da_1, 1, 0, 1, 1)
+AFFINE_SIMD_PAINTERS(1, 0, 0, 1, 1)
+#if FZ_PLOTTERS_G
+AFFINE_SIMD_PAINTERS(da_sa_1, 1, 1, 1, 1)
+AFFINE_SIMD_PAINTERS(sa_1, 0, 1, 1, 1)
+#endif /* FZ_PLOTTERS_G */
+#if FZ_PLOTTERS_RGB
+AFFINE_SIMD_PAINTERS(da_sa_3, 1, 1, 3, 3)
+AFFINE_SIMD_PAINTERS(da_3, 1, 0, 3, 3)
+AFFINE_SIMD_PAINTERS(sa_3, 0, 1, 3, 3)
+AFFINE_SIMD_PAINTERS(3, 0, 0, 3, 3)
+AFFINE_SIMD_PAINTERS(da_sa_g2rgb, 1, 1, 3, 1)
+AFFINE_SIMD_PAINTERS(da_g2rgb, 1, 0, 3, 1)
+AFFINE_SIMD_PAINTERS(sa_g2rgb, 0, 1, 3, 1)
+AFFINE_SIMD_PAINTERS(g2rgb, 0, 0, 3, 1)
+#endif /* FZ_PLOTTERS_RGB */
+#if FZ_PLOTTERS_CMYK
+AFFINE_SIMD_PAINTERS(da_sa_4, 1, 1, 4, 4)
+AFFINE_SIMD_PAINTERS(da_4, 1, 0, 4, 4)
+AFFINE_SIMD_PAINTERS(sa_4, 0, 1, 4, 4)
+/* Nearest sampling of opaque CMYK onto opaque CMYK is a word copy per
+ * pixel in C, which the gathers cannot beat. */
+AFFINE_SIMD_PAINTER(lerp, 4, 0, 0, 4, 4, 1)
+#endif /* FZ_PLOTTERS_CMYK */
+
+#undef AFFINE_SIMD_PAINTERS
+#undef AFFINE_SIMD_PAINTER
+
+static inline int
+affine_simd_enabled(void)
+{
+	return (fz_cpu_features() & AFFINE_SIMD_FEATURES) != 0;
+}
+
+#define AFFINE_SIMD_PICK(NAME) (lerp ? paint_affine_lerp_##NAME##_simd : paint_affine_near_##NAME##_simd)
+
+static paintfn_t *
+simd_affine_painter(int da, int sa, int n, int lerp)
+{
+	switch (n)
+	{
+	case 0:
+		if (da && sa)
+			return AFFINE_SIMD_PICK(da_sa_0);
+		break;
+	case 1:
+		if (sa)
+		{
+#if FZ_PLOTTERS_G
+			return da ? AFFINE_SIMD_PICK(da_sa_1) : AFFINE_SIMD_PICK(sa_1);
+#endif /* FZ_PLOTTERS_G */
+		}
+		else
+			return da ? AFFINE_SIMD_PICK(da_1) : AFFINE_SIMD_PICK(1);
+		break;
+#if FZ_PLOTTERS_RGB
+	case 3:
+		if (da)
+			return sa ? AFFINE_SIMD_PICK(da_sa_3) : AFFINE_SIMD_PICK(da_3);
+		else
+			return sa ? AFFINE_SIMD_PICK(sa_3) : AFFINE_SIMD_PICK(3);
+#endif /* FZ_PLOTTERS_RGB */
+#if FZ_PLOTTERS_CMYK
+	case 4:
+		if (da)
+			return sa ? AFFINE_SIMD_PICK(da_sa_4) : AFFINE_SIMD_PICK(da_4);
+		else if (sa)
+			return AFFINE_SIMD_PICK(sa_4);
+		else if (lerp)
+			return paint_affine_lerp_4_simd;
+		break;
+#endif /* FZ_PLOTTERS_CMYK */
+	}
+	return NULL;
+}
+
+#if FZ_PLOTTERS_RGB
+static paintfn_t *
+simd_affine_g2rgb_painter(int da, int sa, int lerp)
+{
+	if (da)
+		return sa ? AFFINE_SIMD_PICK(da_sa_g2rgb) : AFFINE_SIMD_PICK(da_g2rgb);
+	else
+		return sa ? AFFINE_SIMD_PICK(sa_g2rgb) : AFFINE_SIMD_PICK(g2rgb);
+}
+#endif /* FZ_PLOTTERS_RGB */
+
+#undef AFFINE_SIMD_PICK
+
+#endif /* AFFINE_SIMD */
+
 static void
 paint_affine_lerp_da_sa_0(byte * FZ_RESTRICT dp, int da, const byte * FZ_RESTRICT sp, int sw, int sh, int ss, int sa, int u, int v, int fa, int fb, int w, int dn, int sn, int alpha, const byte * FZ_RESTRICT color, byte * FZ_RESTRICT hp, byte * FZ_RESTRICT gp, const fz_overprint * FZ_RESTRICT eop)
 {
@@ -1492,6 +2110,14 @@ fz_paint_affine_lerp(int da, int sa, int fa, int fb, int n, int alpha, const fz_
 			return NULL;
 	}
 #endif /* FZ_ENABLE_SPOT_RENDERING */
+#ifdef AFFINE_SIMD
+	if (alpha > 0 && affine_simd_enabled())
+	{
+		paintfn_t *fn = simd_affine_painter(da, sa, n, 1);
+		if (fn)
+			return fn;
+	}
+#endif /* AFFINE_SIMD */
 
 	switch(n)
 	{
@@ -1788,6 +2414,15 @@ paint_affine_lerp_g2rgb_alpha(byte * FZ_RESTRICT dp, int da, const byte * FZ_RES
 static paintfn_t *
 fz_paint_affine_g2rgb_lerp(int da, int sa, int fa, int fb, int n, int alpha)
 {
+#ifdef AFFINE_SIMD
+	if (alpha > 0 && affine_simd_enabled())
+	{
+		paintfn_t *fn = simd_affine_g2rgb_painter(da, sa, 1);
+		if (fn)
+			return fn;
+	}
+#endif /* AFFINE_SIMD */
+
 	if (da)
 	{
 		if (sa)
@@ -2620,6 +3255,14 @@ fz_paint_affine_near(int da, int sa, int fa, int fb, int n, int alpha, const fz_
 			return NULL;
 	}
 #endif /* FZ_ENABLE_SPOT_RENDERING */
+#ifdef AFFINE_SIMD
+	if (alpha > 0 && affine_simd_enabled())
+	{
+		paintfn_t *fn = simd_affine_painter(da, sa, n, 0);
+		if (fn)
+			return fn;
+	}
+#endif /* AFFINE_SIMD */
 	switch(n)
 	{
 	case 0:
@@ -3335,6 +3978,15 @@ paint_affine_near_alpha_g2rgb(byte * FZ_RESTRICT dp, int da, const byte * FZ_RES
 static paintfn_t *
 fz_paint_affine_g2rgb_near(int da, int sa, int fa, int fb, int n, int alpha)
 {
+#ifdef AFFINE_SIMD
+	if (alpha > 0 && affine_simd_enabled())
+	{
+		paintfn_t *fn = simd_affine_g2rgb_painter(da, sa, 0);
+		if (fn)
+			return fn;
+	}
+#endif /* AFFINE_SIMD */
+
 	if (da)
 	{
 		if (sa)
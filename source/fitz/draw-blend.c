@@ -2,6 +2,7 @@
 
 #include "draw-imp.h"
 #include "pixmap-imp.h"
+#include "simd-imp.h"
 
 #include <string.h>
 #include <math.h>
@@ -278,12 +279,12 @@ fz_saturation_rgb(unsigned char *rd, unsigned char *gd, unsigned char *bd, int r
 		max = fz_maxi(r, fz_maxi(g, b));
 
 		if (min < 0)
-			scalemin = (y << 16) / (y - min);
+			scalemin = (y == min ? 0 : (y << 16) / (y - min));
 		else
 			scalemin = 0x10000;
 
 		if (max > 255)
-			scalemax = ((255 - y) << 16) / (max - y);
+			scalemax = (max == y ? 0 : ((255 - y) << 16) / (max - y));
 		else
 			scalemax = 0x10000;
 
@@ -1041,6 +1042,889 @@ fz_blend_nonseparable_nonisolated(byte * FZ_RESTRICT bp, int bal, const byte * F
 	while (--w);
 }
 
+/*
+	SIMD versions of the blending loops.
+
+	These work on blocks of 16 bytes, holding as many whole pixels (of
+	n1 colorants and an alpha) as will fit, of both the source and the
+	backdrop; when either has no alpha, its pixels are spread out to
+	match. Each byte is treated on its own, along with the alphas of its
+	pixel, in 32 bit lanes so that every step is the same integer sum as
+	in the plain C above (which also deals with the end of each row, any
+	spots, and any block holding badly premultiplied values).
+
+	For the separable modes, there is a kernel for each mode, for both
+	isolated and non-isolated groups. The non separable modes mix the
+	colorants of a pixel, so for those the rows are done in batches: the
+	values are unpremultiplied into buffers, the mode is applied to each
+	pixel of the buffers, and the results are composited back, all but
+	the middle step in SIMD.
+
+	The float divisions and square roots used here are exact enough
+	that truncating them gives the same answer as the integer sums.
+*/
+
+#if defined(FZ_SIMD_X86)
+#define BLEND_SIMD
+#define BLEND_SIMD_TARGET FZ_SIMD_TARGET("avx2")
+#define BLEND_SIMD_FEATURES FZ_CPU_AVX2
+#elif defined(FZ_SIMD_NEON) && defined(__aarch64__)
+#define BLEND_SIMD
+#define BLEND_SIMD_TARGET
+#define BLEND_SIMD_FEATURES FZ_CPU_NEON
+#endif
+
+#ifdef BLEND_SIMD
+
+/* Stands in for the blend mode when the blended values come from a
+ * buffer. */
+#define BLEND_SIMD_BUFFER -1
+
+/* Number of blocks in a batch for the non separable modes. */
+#define BLEND_SIMD_BATCH 16
+
+#ifdef FZ_SIMD_X86
+
+typedef __m128i bv8; /* 16 bytes */
+typedef __m256i bv; /* 8 lanes of 32 bits */
+
+BLEND_SIMD_TARGET static inline bv8 bv8_load(const byte *p) { return _mm_loadu_si128((const __m128i *)p); }
+BLEND_SIMD_TARGET static inline bv8 bv8_splat(int v) { return _mm_set1_epi8((char)v); }
+BLEND_SIMD_TARGET static inline bv8 bv8_shuffle(bv8 v, const byte *table) { return _mm_shuffle_epi8(v, bv8_load(table)); }
+BLEND_SIMD_TARGET static inline bv8 bv8_and(bv8 a, bv8 b) { return _mm_and_si128(a, b); }
+BLEND_SIMD_TARGET static inline bv8 bv8_eq_zero(bv8 v) { return _mm_cmpeq_epi8(v, _mm_setzero_si128()); }
+BLEND_SIMD_TARGET static inline bv8 bv8_select(bv8 mask, bv8 t, bv8 f) { return _mm_blendv_epi8(f, t, mask); }
+BLEND_SIMD_TARGET static inline int bv8_is_zero(bv8 v) { return _mm_testz_si128(v, v); }
+/* Is every byte of a no greater than the same byte of b? */
+BLEND_SIMD_TARGET static inline int bv8_all_le(bv8 a, bv8 b) { return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(a, b), b)) == 0xffff; }
+
+/* Load the first len (8, 4 or 3) bytes, and zeros. */
+BLEND_SIMD_TARGET static inline bv8
+bv8_load_bytes(const byte *p, int len)
+{
+	int32_t x;
+
+	switch (len)
+	{
+	case 8:
+		return _mm_loadl_epi64((const __m128i *)p);
+	case 4:
+		memcpy(&x, p, 4);
+		break;
+	default:
+		x = p[0] | (p[1] << 8) | (p[2] << 16);
+		break;
+	}
+	return _mm_cvtsi32_si128(x);
+}
+
+BLEND_SIMD_TARGET static inline void
+bv8_store(byte *p, bv8 v, int len)
+{
+	switch (len)
+	{
+	case 16:
+		_mm_storeu_si128((__m128i *)p, v);
+		break;
+	case 15:
+		_mm_storel_epi64((__m128i *)p, v);
+		_mm_storel_epi64((__m128i *)(p + 7), _mm_srli_si128(v, 7));
+		break;
+	case 12:
+	{
+		int32_t x = _mm_cvtsi128_si32(_mm_srli_si128(v, 8));
+		_mm_storel_epi64((__m128i *)p, v);
+		memcpy(p + 8, &x, 4);
+		break;
+	}
+	default:
+		_mm_storel_epi64((__m128i *)p, v);
+		break;
+	}
+}
+
+BLEND_SIMD_TARGET static inline bv bv_set(int v) { return _mm256_set1_epi32(v); }
+BLEND_SIMD_TARGET static inline bv bv_add(bv a, bv b) { return _mm256_add_epi32(a, b); }
+BLEND_SIMD_TARGET static inline bv bv_sub(bv a, bv b) { return _mm256_sub_epi32(a, b); }
+BLEND_SIMD_TARGET static inline bv bv_mul(bv a, bv b) { return _mm256_mullo_epi32(a, b); }
+BLEND_SIMD_TARGET static inline bv bv_min(bv a, bv b) { return _mm256_min_epi32(a, b); }
+BLEND_SIMD_TARGET static inline bv bv_max(bv a, bv b) { return _mm256_max_epi32(a, b); }
+BLEND_SIMD_TARGET static inline bv bv_abs(bv a) { return _mm256_abs_epi32(a); }
+BLEND_SIMD_TARGET static inline bv bv_gt(bv a, bv b) { return _mm256_cmpgt_epi32(a, b); }
+BLEND_SIMD_TARGET static inline bv bv_select(bv mask, bv t, bv f) { return _mm256_blendv_epi8(f, t, mask); }
+#define bv_sra(a, n) _mm256_srai_epi32(a, n)
+#define bv_shl(a, n) _mm256_slli_epi32(a, n)
+
+/* Truncated a / b, and sqrt(a). */
+BLEND_SIMD_TARGET static inline bv
+bv_div(bv a, bv b)
+{
+	return _mm256_cvttps_epi32(_mm256_div_ps(_mm256_cvtepi32_ps(a), _mm256_cvtepi32_ps(b)));
+}
+
+BLEND_SIMD_TARGET static inline bv
+bv_sqrt(bv a)
+{
+	return _mm256_cvttps_epi32(_mm256_sqrt_ps(_mm256_cvtepi32_ps(a)));
+}
+
+/* The low or high 8 bytes of a block, zero extended (or sign extended,
+ * for masks). */
+BLEND_SIMD_TARGET static inline bv
+bv_widen(bv8 v, int hi)
+{
+	return _mm256_cvtepu8_epi32(hi ? _mm_srli_si128(v, 8) : v);
+}
+
+BLEND_SIMD_TARGET static inline bv
+bv_widen_mask(bv8 v, int hi)
+{
+	return _mm256_cvtepi8_epi32(hi ? _mm_srli_si128(v, 8) : v);
+}
+
+/* The low byte of each lane, as a block. */
+BLEND_SIMD_TARGET static inline bv8
+bv_narrow(bv lo, bv hi)
+{
+	bv t = _mm256_packus_epi32(_mm256_and_si256(lo, bv_set(255)), _mm256_and_si256(hi, bv_set(255)));
+	t = _mm256_permute4x64_epi64(t, 0xd8);
+	return _mm_packus_epi16(_mm256_castsi256_si128(t), _mm256_extracti128_si256(t, 1));
+}
+
+#else /* FZ_SIMD_NEON */
+
+typedef uint8x16_t bv8; /* 16 bytes */
+typedef int32x4x2_t bv; /* 8 lanes of 32 bits */
+
+static inline bv8 bv8_load(const byte *p) { return vld1q_u8(p); }
+static inline bv8 bv8_splat(int v) { return vdupq_n_u8((uint8_t)v); }
+static inline bv8 bv8_shuffle(bv8 v, const byte *table) { return vqtbl1q_u8(v, vld1q_u8(table)); }
+static inline bv8 bv8_and(bv8 a, bv8 b) { return vandq_u8(a, b); }
+static inline bv8 bv8_eq_zero(bv8 v) { return vceqq_u8(v, vdupq_n_u8(0)); }
+static inline bv8 bv8_select(bv8 mask, bv8 t, bv8 f) { return vbslq_u8(mask, t, f); }
+static inline int bv8_is_zero(bv8 v) { return vmaxvq_u8(v) == 0; }
+/* Is every byte of a no greater than the same byte of b? */
+static inline int bv8_all_le(bv8 a, bv8 b) { return vminvq_u8(vcleq_u8(a, b)) == 0xff; }
+
+/* Load the first len (8, 4 or 3) bytes, and zeros. */
+static inline bv8
+bv8_load_bytes(const byte *p, int len)
+{
+	uint32_t x;
+
+	switch (len)
+	{
+	case 8:
+		return vcombine_u8(vld1_u8(p), vdup_n_u8(0));
+	case 4:
+		memcpy(&x, p, 4);
+		break;
+	default:
+		x = p[0] | (p[1] << 8) | (p[2] << 16);
+		break;
+	}
+	return vcombine_u8(vcreate_u8(x), vdup_n_u8(0));
+}
+
+static inline void
+bv8_store(byte *p, bv8 v, int len)
+{
+	switch (len)
+	{
+	case 16:
+		vst1q_u8(p, v);
+		break;
+	case 15:
+		vst1_u8(p, vget_low_u8(v));
+		vst1_u8(p + 7, vget_low_u8(vextq_u8(v, v, 7)));
+		break;
+	case 12:
+		vst1_u8(p, vget_low_u8(v));
+		vst1q_lane_u32((uint32_t *)(void *)(p + 8), vreinterpretq_u32_u8(v), 2);
+		break;
+	default:
+		vst1_u8(p, vget_low_u8(v));
+		break;
+	}
+}
+
+#define BV_OP2(NAME, OP) \
+	static inline bv NAME(bv a, bv b) { bv r; r.val[0] = OP(a.val[0], b.val[0]); r.val[1] = OP(a.val[1], b.val[1]); return r; }
+BV_OP2(bv_add, vaddq_s32)
+BV_OP2(bv_sub, vsubq_s32)
+BV_OP2(bv_mul, vmulq_s32)
+BV_OP2(bv_min, vminq_s32)
+BV_OP2(bv_max, vmaxq_s32)
+#undef BV_OP2
+
+static inline bv bv_set(int v) { bv r; r.val[0] = r.val[1] = vdupq_n_s32(v); return r; }
+static inline bv bv_abs(bv a) { a.val[0] = vabsq_s32(a.val[0]); a.val[1] = vabsq_s32(a.val[1]); return a; }
+
+static inline bv
+bv_gt(bv a, bv b)
+{
+	bv r;
+	r.val[0] = vreinterpretq_s32_u32(vcgtq_s32(a.val[0], b.val[0]));
+	r.val[1] = vreinterpretq_s32_u32(vcgtq_s32(a.val[1], b.val[1]));
+	return r;
+}
+
+static inline bv
+bv_select(bv mask, bv t, bv f)
+{
+	bv r;
+	r.val[0] = vbslq_s32(vreinterpretq_u32_s32(mask.val[0]), t.val[0], f.val[0]);
+	r.val[1] = vbslq_s32(vreinterpretq_u32_s32(mask.val[1]), t.val[1], f.val[1]);
+	return r;
+}
+
+static inline bv bv_shl(bv a, int n) { int32x4_t c = vdupq_n_s32(n); a.val[0] = vshlq_s32(a.val[0], c); a.val[1] = vshlq_s32(a.val[1], c); return a; }
+static inline bv bv_sra(bv a, int n) { return bv_shl(a, -n); }
+
+/* Truncated a / b, and sqrt(a). */
+static inline bv
+bv_div(bv a, bv b)
+{
+	a.val[0] = vcvtq_s32_f32(vdivq_f32(vcvtq_f32_s32(a.val[0]), vcvtq_f32_s32(b.val[0])));
+	a.val[1] = vcvtq_s32_f32(vdivq_f32(vcvtq_f32_s32(a.val[1]), vcvtq_f32_s32(b.val[1])));
+	return a;
+}
+
+static inline bv
+bv_sqrt(bv a)
+{
+	a.val[0] = vcvtq_s32_f32(vsqrtq_f32(vcvtq_f32_s32(a.val[0])));
+	a.val[1] = vcvtq_s32_f32(vsqrtq_f32(vcvtq_f32_s32(a.val[1])));
+	return a;
+}
+
+/* The low or high 8 bytes of a block, zero extended (or sign extended,
+ * for masks). */
+static inline bv
+bv_widen(bv8 v, int hi)
+{
+	uint16x8_t w = vmovl_u8(hi ? vget_high_u8(v) : vget_low_u8(v));
+	bv r;
+	r.val[0] = vreinterpretq_s32_u32(vmovl_u16(vget_low_u16(w)));
+	r.val[1] = vreinterpretq_s32_u32(vmovl_u16(vget_high_u16(w)));
+	return r;
+}
+
+static inline bv
+bv_widen_mask(bv8 v, int hi)
+{
+	int16x8_t w = vmovl_s8(vreinterpret_s8_u8(hi ? vget_high_u8(v) : vget_low_u8(v)));
+	bv r;
+	r.val[0] = vmovl_s16(vget_low_s16(w));
+	r.val[1] = vmovl_s16(vget_high_s16(w));
+	return r;
+}
+
+/* The low byte of each lane, as a block. */
+static inline bv8
+bv_narrow(bv lo, bv hi)
+{
+	uint16x8_t a = vcombine_u16(vmovn_u32(vreinterpretq_u32_s32(lo.val[0])), vmovn_u32(vreinterpretq_u32_s32(lo.val[1])));
+	uint16x8_t b = vcombine_u16(vmovn_u32(vreinterpretq_u32_s32(hi.val[0])), vmovn_u32(vreinterpretq_u32_s32(hi.val[1])));
+	return vcombine_u8(vmovn_u16(a), vmovn_u16(b));
+}
+
+#endif /* FZ_SIMD_NEON */
+
+/* The separable blend modes, as the fz_*_byte functions above. */
+
+BLEND_SIMD_TARGET static inline bv
+bv_mul255(bv a, bv b)
+{
+	bv x = bv_add(bv_mul(a, b), bv_set(128));
+	x = bv_add(x, bv_sra(x, 8));
+	return bv_sra(x, 8);
+}
+
+BLEND_SIMD_TARGET static inline bv
+bv_screen(bv b, bv s)
+{
+	return bv_sub(bv_add(b, s), bv_mul255(b, s));
+}
+
+BLEND_SIMD_TARGET static inline bv
+bv_hard_light(bv b, bv s)
+{
+	bv s2 = bv_shl(s, 1);
+	return bv_select(bv_gt(s, bv_set(127)), bv_screen(b, bv_sub(s2, bv_set(255))), bv_mul255(b, s2));
+}
+
+BLEND_SIMD_TARGET static inline bv
+bv_color_dodge(bv b, bv s)
+{
+	bv q;
+	s = bv_sub(bv_set(255), s);
+	q = bv_div(bv_add(bv_mul(b, bv_set(0x1fe)), s), bv_shl(bv_max(s, bv_set(1)), 1));
+	q = bv_select(bv_gt(s, b), q, bv_set(255));
+	return bv_select(bv_gt(b, bv_set(0)), q, bv_set(0));
+}
+
+BLEND_SIMD_TARGET static inline bv
+bv_color_burn(bv b, bv s)
+{
+	bv q;
+	b = bv_sub(bv_set(255), b);
+	q = bv_div(bv_add(bv_mul(b, bv_set(0x1fe)), s), bv_shl(bv_max(s, bv_set(1)), 1));
+	q = bv_select(bv_gt(s, b), bv_sub(bv_set(255), q), bv_set(0));
+	return bv_select(bv_gt(b, bv_set(0)), q, bv_set(255));
+}
+
+BLEND_SIMD_TARGET static inline bv
+bv_soft_light(bv b, bv s)
+{
+	bv lo, hi, dbd;
+
+	lo = bv_sub(b, bv_mul255(bv_mul255(bv_sub(bv_set(255), bv_shl(s, 1)), b), bv_sub(bv_set(255), b)));
+
+	dbd = bv_mul255(bv_add(bv_mul255(bv_sub(bv_shl(b, 4), bv_set(3060)), b), bv_set(1020)), b);
+	dbd = bv_select(bv_gt(bv_set(64), b), dbd, bv_sqrt(bv_mul(b, bv_set(255))));
+	hi = bv_add(b, bv_mul255(bv_sub(bv_shl(s, 1), bv_set(255)), bv_sub(dbd, b)));
+
+	return bv_select(bv_gt(bv_set(128), s), lo, hi);
+}
+
+BLEND_SIMD_TARGET static FZ_SIMD_INLINE bv
+bv_blend(bv b, bv s, int blendmode)
+{
+	switch (blendmode)
+	{
+	default:
+	case FZ_BLEND_NORMAL: return s;
+	case FZ_BLEND_MULTIPLY: return bv_mul255(b, s);
+	case FZ_BLEND_SCREEN: return bv_screen(b, s);
+	case FZ_BLEND_OVERLAY: return bv_hard_light(s, b);
+	case FZ_BLEND_DARKEN: return bv_min(b, s);
+	case FZ_BLEND_LIGHTEN: return bv_max(b, s);
+	case FZ_BLEND_COLOR_DODGE: return bv_color_dodge(b, s);
+	case FZ_BLEND_COLOR_BURN: return bv_color_burn(b, s);
+	case FZ_BLEND_HARD_LIGHT: return bv_hard_light(b, s);
+	case FZ_BLEND_SOFT_LIGHT: return bv_soft_light(b, s);
+	case FZ_BLEND_DIFFERENCE: return bv_abs(bv_sub(b, s));
+	case FZ_BLEND_EXCLUSION: return bv_sub(bv_add(b, s), bv_shl(bv_mul255(b, s), 1));
+	}
+}
+
+BLEND_SIMD_TARGET static inline bv
+bv_clamp(bv a, bv lo, bv hi)
+{
+	return bv_min(bv_max(a, lo), hi);
+}
+
+/* Shuffles for the blocks of a row, where the pixels are always laid
+ * out with an alpha byte: for each byte, the byte holding its pixel's
+ * alpha, the byte of a row without alpha that it matches (or the other
+ * way around for compact), and the number of its pixel. Unused bytes
+ * get 0x80, which shuffles in a zero. */
+typedef struct
+{
+	int n1, sal, bal, px, slen, dlen, step;
+	byte alpha[16];
+	byte expand[16];
+	byte compact[16];
+	byte pixel[16];
+	byte valid[16];
+	byte is_alpha[16];
+} blend_simd_row;
+
+static void
+blend_simd_init_row(blend_simd_row *row, int n1, int sal, int bal)
+{
+	int bpp = n1 + 1;
+	int j;
+
+	row->n1 = n1;
+	row->sal = sal;
+	row->bal = bal;
+	row->px = 16 / bpp;
+	row->slen = row->px * (n1 + sal);
+	row->dlen = row->px * (n1 + bal);
+	/* A block needs 16 bytes of both source and backdrop. */
+	row->step = n1 + (sal && bal);
+	for (j = 0; j < 16; j++)
+	{
+		int inside = j < row->px * bpp;
+		int k = j % bpp;
+		row->alpha[j] = inside ? j - k + n1 : 0x80;
+		row->expand[j] = inside && k < n1 ? j / bpp * n1 + k : 0x80;
+		row->compact[j] = j < row->px * n1 ? j / n1 * bpp + j % n1 : 0x80;
+		row->pixel[j] = inside ? j / bpp : 0x80;
+		row->valid[j] = inside ? 0xff : 0;
+		row->is_alpha[j] = inside && k == n1 ? 0xff : 0;
+	}
+}
+
+/* Load the next block of a row, with the alphas for each byte, and
+ * check that it is properly premultiplied. */
+BLEND_SIMD_TARGET static inline int
+blend_simd_load(const blend_simd_row *row, const byte * FZ_RESTRICT bp, const byte * FZ_RESTRICT sp, bv8 *b, bv8 *ba, bv8 *s, bv8 *sa)
+{
+	bv8 valid = bv8_load(row->valid);
+	int ok = 1;
+
+	if (row->sal)
+	{
+		*s = bv8_load(sp);
+		*sa = bv8_shuffle(*s, row->alpha);
+		ok = bv8_all_le(bv8_and(*s, valid), *sa);
+	}
+	else
+	{
+		*s = bv8_shuffle(bv8_load(sp), row->expand);
+		*sa = bv8_splat(255);
+	}
+	if (row->bal)
+	{
+		*b = bv8_load(bp);
+		*ba = bv8_shuffle(*b, row->alpha);
+		ok = ok && bv8_all_le(bv8_and(*b, valid), *ba);
+	}
+	else
+	{
+		*b = bv8_shuffle(bv8_load(bp), row->expand);
+		*ba = bv8_splat(255);
+	}
+	return ok;
+}
+
+/* The shape value for each byte of the block. */
+BLEND_SIMD_TARGET static inline bv8
+blend_simd_shape(const blend_simd_row *row, const byte * FZ_RESTRICT hp)
+{
+	return bv8_shuffle(bv8_load_bytes(hp, row->px), row->pixel);
+}
+
+BLEND_SIMD_TARGET static inline void
+blend_simd_store(const blend_simd_row *row, byte * FZ_RESTRICT bp, bv8 r)
+{
+	if (row->bal)
+		bv8_store(bp, r, row->dlen);
+	else
+		bv8_store(bp, bv8_shuffle(r, row->compact), row->dlen);
+}
+
+/* Unpremultiply a source (or backdrop) value. */
+BLEND_SIMD_TARGET static inline bv
+bv_unpremultiply(bv c, bv a)
+{
+	/* 255 * 256 / a, for a > 0 */
+	bv inv = bv_div(bv_set(255 * 256), bv_max(a, bv_set(1)));
+	return bv_sra(bv_mul(c, inv), 8);
+}
+
+/* Blend half a block, as the inner loop of fz_blend_separable: bc is
+ * the premultiplied backdrop with alpha ba, sc the premultiplied source
+ * with alpha sa, and rc_in the blended values (or NULL to work them out
+ * from the blend mode). */
+BLEND_SIMD_TARGET static FZ_SIMD_INLINE bv
+blend_simd_half(bv bc, bv ba, bv sc, bv sa, bv is_alpha, int opaque, int complement, int blendmode, const bv *rc_in)
+{
+	bv saba = bv_mul255(sa, ba);
+	bv rc, out;
+
+	if (rc_in)
+		rc = *rc_in;
+	else
+	{
+		/* Unpremultiplying by 255 changes nothing. */
+		bv s = opaque ? sc : bv_unpremultiply(sc, sa);
+		bv b = opaque ? bc : bv_unpremultiply(bc, ba);
+		if (complement)
+		{
+			s = bv_sub(bv_set(255), s);
+			b = bv_sub(bv_set(255), b);
+		}
+		rc = bv_blend(b, s, blendmode);
+		if (complement)
+			rc = bv_sub(bv_set(255), rc);
+	}
+
+	out = bv_add(bv_add(bv_mul255(bv_sub(bv_set(255), sa), bc), bv_mul255(bv_sub(bv_set(255), ba), sc)), bv_mul255(saba, rc));
+	return bv_select(is_alpha, bv_sub(bv_add(ba, sa), saba), out);
+}
+
+/* Blend a block, and store it. rp is the blended values (or NULL). */
+BLEND_SIMD_TARGET static FZ_SIMD_INLINE void
+blend_simd_block(const blend_simd_row *row, byte * FZ_RESTRICT bp, bv8 b, bv8 ba, bv8 s, bv8 sa, int complement, int blendmode, const byte *rp)
+{
+	bv8 is_alpha = bv8_load(row->is_alpha);
+	bv8 valid = bv8_load(row->valid);
+	int opaque = bv8_all_le(valid, sa) && bv8_all_le(valid, ba);
+	bv lo, hi, rc_lo, rc_hi;
+	bv8 r;
+
+	if (rp)
+	{
+		bv8 rb = bv8_load(rp);
+		rc_lo = bv_widen(rb, 0);
+		rc_hi = bv_widen(rb, 1);
+	}
+	lo = blend_simd_half(bv_widen(b, 0), bv_widen(ba, 0), bv_widen(s, 0), bv_widen(sa, 0), bv_widen_mask(is_alpha, 0), opaque, complement, blendmode, rp ? &rc_lo : NULL);
+	hi = blend_simd_half(bv_widen(b, 1), bv_widen(ba, 1), bv_widen(s, 1), bv_widen(sa, 1), bv_widen_mask(is_alpha, 1), opaque, complement, blendmode, rp ? &rc_hi : NULL);
+	r = bv_narrow(lo, hi);
+
+	/* Copy the source over a clear backdrop, and leave the backdrop
+	 * alone under a clear source. */
+	r = bv8_select(bv8_eq_zero(ba), s, r);
+	r = bv8_select(bv8_eq_zero(sa), b, r);
+
+	blend_simd_store(row, bp, r);
+}
+
+/* As fz_blend_separable, with a source alpha and no spots, for as many
+ * whole blocks as there are. Returns the number of pixels done. */
+BLEND_SIMD_TARGET static FZ_SIMD_INLINE int
+simd_blend_separable(byte * FZ_RESTRICT bp, int bal, const byte * FZ_RESTRICT sp, int n1, int w, int complement, int blendmode)
+{
+	blend_simd_row row;
+	int i;
+
+	blend_simd_init_row(&row, n1, 1, bal);
+	for (i = 0; (w - i) * row.step >= 16; i += row.px, bp += row.dlen, sp += row.slen)
+	{
+		bv8 b, ba, s, sa;
+		if (!blend_simd_load(&row, bp, sp, &b, &ba, &s, &sa))
+			fz_blend_separable(bp, bal, sp, 1, n1, row.px, blendmode, complement, n1);
+		else if (!bv8_is_zero(sa))
+			blend_simd_block(&row, bp, b, ba, s, sa, complement, blendmode, NULL);
+	}
+	return i;
+}
+
+/* Blend half a block, as the inner loop of fz_blend_separable_nonisolated,
+ * where ha is the shape and haa the shape times the group alpha. */
+BLEND_SIMD_TARGET static FZ_SIMD_INLINE bv
+blend_simd_half_nonisolated(bv bc, bv ba, bv sc, bv sa, bv ha, bv haa, bv is_alpha, int opaque, int complement, int blendmode)
+{
+	bv s = opaque ? sc : bv_unpremultiply(sc, sa);
+	bv b = opaque ? bc : bv_unpremultiply(bc, ba);
+	bv copy, bahaa, ra0, ra, rc, out;
+
+	/* What to do over a clear backdrop. */
+	copy = bv_select(is_alpha, haa, bv_mul255(s, haa));
+
+	if (complement)
+	{
+		s = bv_sub(bv_set(255), s);
+		b = bv_sub(bv_set(255), b);
+	}
+
+	/* Uncomposite; the scale is 0 for an opaque backdrop and shape. */
+	if (!opaque)
+	{
+		bv scale = bv_sub(bv_div(bv_add(bv_shl(ba, 9), ha), bv_shl(bv_max(ha, bv_set(1)), 1)), bv_add(ba, bv_sra(ba, 7)));
+		s = bv_clamp(bv_add(s, bv_sra(bv_mul(bv_sub(s, b), scale), 8)), bv_set(0), bv_set(255));
+	}
+
+	bahaa = bv_mul255(ba, haa);
+	ra0 = bv_sub(ba, bahaa);
+	ra = bv_add(ra0, haa);
+
+	rc = bv_blend(b, s, blendmode);
+	rc = bv_select(bv_gt(bv_set(255), bahaa), bv_mul255(bahaa, rc), rc);
+	rc = bv_select(bv_gt(bv_set(255), ba), bv_add(rc, bv_mul255(bv_mul255(bv_sub(bv_set(255), ba), haa), s)), rc);
+	rc = bv_select(bv_gt(ra0, bv_set(0)), bv_add(rc, bv_mul255(ra0, b)), rc);
+	if (complement)
+		rc = bv_sub(ra, rc);
+	out = bv_select(is_alpha, ra, bv_clamp(rc, bv_set(0), ra));
+
+	/* A zero result alpha leaves the colorants alone. */
+	out = bv_select(bv_gt(ra, bv_set(0)), out, bv_select(is_alpha, ra, bc));
+	out = bv_select(bv_gt(ba, bv_set(0)), out, copy);
+	/* As does a clear source. */
+	return bv_select(bv_gt(bv_min(sa, haa), bv_set(0)), out, bc);
+}
+
+BLEND_SIMD_TARGET static FZ_SIMD_INLINE void
+blend_simd_block_nonisolated(const blend_simd_row *row, byte * FZ_RESTRICT bp, bv8 b, bv8 ba, bv8 s, bv8 sa, bv8 ha, int alpha, int complement, int blendmode)
+{
+	bv8 is_alpha = bv8_load(row->is_alpha);
+	bv8 valid = bv8_load(row->valid);
+	int opaque = alpha == 255 && bv8_all_le(valid, sa) && bv8_all_le(valid, ba) && bv8_all_le(valid, ha);
+	bv ha_lo = bv_widen(ha, 0);
+	bv ha_hi = bv_widen(ha, 1);
+	bv lo, hi;
+
+	lo = blend_simd_half_nonisolated(bv_widen(b, 0), bv_widen(ba, 0), bv_widen(s, 0), bv_widen(sa, 0), ha_lo, bv_mul255(ha_lo, bv_set(alpha)), bv_widen_mask(is_alpha, 0), opaque, complement, blendmode);
+	hi = blend_simd_half_nonisolated(bv_widen(b, 1), bv_widen(ba, 1), bv_widen(s, 1), bv_widen(sa, 1), ha_hi, bv_mul255(ha_hi, bv_set(alpha)), bv_widen_mask(is_alpha, 1), opaque, complement, blendmode);
+	blend_simd_store(row, bp, bv_narrow(lo, hi));
+}
+
+/* As fz_blend_separable_nonisolated with no spots, for as many whole
+ * blocks as there are. Returns the number of pixels done. */
+BLEND_SIMD_TARGET static FZ_SIMD_INLINE int
+simd_blend_separable_nonisolated(byte * FZ_RESTRICT bp, int bal, const byte * FZ_RESTRICT sp, int sal, int n1, int w, int complement, const byte * FZ_RESTRICT hp, int alpha, int blendmode)
+{
+	blend_simd_row row;
+	int i;
+
+	blend_simd_init_row(&row, n1, sal, bal);
+	for (i = 0; (w - i) * row.step >= 16; i += row.px, bp += row.dlen, sp += row.slen, hp += row.px)
+	{
+		bv8 b, ba, s, sa, ha;
+		if (!blend_simd_load(&row, bp, sp, &b, &ba, &s, &sa))
+		{
+			fz_blend_separable_nonisolated(bp, bal, sp, sal, n1, row.px, blendmode, complement, hp, alpha, n1);
+			continue;
+		}
+		ha = blend_simd_shape(&row, hp);
+		if (!bv8_is_zero(ha) && !bv8_is_zero(sa))
+			blend_simd_block_nonisolated(&row, bp, b, ba, s, sa, ha, alpha, complement, blendmode);
+	}
+	return i;
+}
+
+typedef int (blend_simd_fn)(byte * FZ_RESTRICT bp, int bal, const byte * FZ_RESTRICT sp, int n1, int w, int complement);
+typedef int (blend_simd_nonisolated_fn)(byte * FZ_RESTRICT bp, int bal, const byte * FZ_RESTRICT sp, int sal, int n1, int w, int complement, const byte * FZ_RESTRICT hp, int alpha);
+
+#define BLEND_SIMD_MODE(NAME, MODE) \
+	BLEND_SIMD_TARGET static int \
+	simd_blend_##NAME(byte * FZ_RESTRICT bp, int bal, const byte * FZ_RESTRICT sp, int n1, int w, int complement) \
+	{ return simd_blend_separable(bp, bal, sp, n1, w, complement, MODE); } \
+	BLEND_SIMD_TARGET static int \
+	simd_blend_##NAME##_nonisolated(byte * FZ_RESTRICT bp, int bal, const byte * FZ_RESTRICT sp, int sal, int n1, int w, int complement, const byte * FZ_RESTRICT hp, int alpha) \
+	{ return simd_blend_separable_nonisolated(bp, bal, sp, sal, n1, w, complement, hp, alpha, MODE); }
+
+BLEND_SIMD_MODE(normal, FZ_BLEND_NORMAL)
+BLEND_SIMD_MODE(multiply, FZ_BLEND_MULTIPLY)
+BLEND_SIMD_MODE(screen, FZ_BLEND_SCREEN)
+BLEND_SIMD_MODE(overlay, FZ_BLEND_OVERLAY)
+BLEND_SIMD_MODE(darken, FZ_BLEND_DARKEN)
+BLEND_SIMD_MODE(lighten, FZ_BLEND_LIGHTEN)
+BLEND_SIMD_MODE(color_dodge, FZ_BLEND_COLOR_DODGE)
+BLEND_SIMD_MODE(color_burn, FZ_BLEND_COLOR_BURN)
+BLEND_SIMD_MODE(hard_light, FZ_BLEND_HARD_LIGHT)
+BLEND_SIMD_MODE(soft_light, FZ_BLEND_SOFT_LIGHT)
+BLEND_SIMD_MODE(difference, FZ_BLEND_DIFFERENCE)
+BLEND_SIMD_MODE(exclusion, FZ_BLEND_EXCLUSION)
+
+#undef BLEND_SIMD_MODE
+
+static blend_simd_fn *blend_simd_separable[] =
+{
+	simd_blend_normal,
+	simd_blend_multiply,
+	simd_blend_screen,
+	simd_blend_overlay,
+	simd_blend_darken,
+	simd_blend_lighten,
+	simd_blend_color_dodge,
+	simd_blend_color_burn,
+	simd_blend_hard_light,
+	simd_blend_soft_light,
+	simd_blend_difference,
+	simd_blend_exclusion,
+};
+
+static blend_simd_nonisolated_fn *blend_simd_separable_nonisolated[] =
+{
+	simd_blend_normal_nonisolated,
+	simd_blend_multiply_nonisolated,
+	simd_blend_screen_nonisolated,
+	simd_blend_overlay_nonisolated,
+	simd_blend_darken_nonisolated,
+	simd_blend_lighten_nonisolated,
+	simd_blend_color_dodge_nonisolated,
+	simd_blend_color_burn_nonisolated,
+	simd_blend_hard_light_nonisolated,
+	simd_blend_soft_light_nonisolated,
+	simd_blend_difference_nonisolated,
+	simd_blend_exclusion_nonisolated,
+};
+
+/* Apply a non separable blend mode to each pixel (of 4 bytes) in the
+ * buffers. */
+static void
+blend_simd_nonseparable_rgb(byte *rbuf, const byte *bbuf, const byte *sbuf, int m, int blendmode)
+{
+	int p;
+
+	switch (blendmode)
+	{
+	default:
+	case FZ_BLEND_HUE:
+		for (p = 0; p < m * 4; p += 4)
+			fz_hue_rgb(&rbuf[p], &rbuf[p+1], &rbuf[p+2], bbuf[p], bbuf[p+1], bbuf[p+2], sbuf[p], sbuf[p+1], sbuf[p+2]);
+		break;
+	case FZ_BLEND_SATURATION:
+		for (p = 0; p < m * 4; p += 4)
+			fz_saturation_rgb(&rbuf[p], &rbuf[p+1], &rbuf[p+2], bbuf[p], bbuf[p+1], bbuf[p+2], sbuf[p], sbuf[p+1], sbuf[p+2]);
+		break;
+	case FZ_BLEND_COLOR:
+		for (p = 0; p < m * 4; p += 4)
+			fz_color_rgb(&rbuf[p], &rbuf[p+1], &rbuf[p+2], bbuf[p], bbuf[p+1], bbuf[p+2], sbuf[p], sbuf[p+1], sbuf[p+2]);
+		break;
+	case FZ_BLEND_LUMINOSITY:
+		for (p = 0; p < m * 4; p += 4)
+			fz_luminosity_rgb(&rbuf[p], &rbuf[p+1], &rbuf[p+2], bbuf[p], bbuf[p+1], bbuf[p+2], sbuf[p], sbuf[p+1], sbuf[p+2]);
+		break;
+	}
+}
+
+/* As fz_blend_nonseparable for rgb with a source alpha and no spots,
+ * for as many whole blocks as there are. Returns the number of pixels
+ * done. */
+BLEND_SIMD_TARGET static int
+simd_blend_nonseparable(byte * FZ_RESTRICT bp, int bal, const byte * FZ_RESTRICT sp, int w, int blendmode)
+{
+	byte sbuf[BLEND_SIMD_BATCH * 16];
+	byte bbuf[BLEND_SIMD_BATCH * 16];
+	byte rbuf[BLEND_SIMD_BATCH * 16] = { 0 };
+	blend_simd_row row;
+	int i = 0;
+
+	blend_simd_init_row(&row, 3, 1, bal);
+	while ((w - i) * row.step >= 16)
+	{
+		const byte *sq = sp;
+		byte *bq = bp;
+		int m, k;
+
+		/* Unpremultiply a batch into the buffers. */
+		for (m = k = 0; k < BLEND_SIMD_BATCH && (w - i - m) * row.step >= 16; m += row.px, k++, bq += row.dlen, sq += row.slen)
+		{
+			bv8 b, ba, s, sa;
+			if (!blend_simd_load(&row, bq, sq, &b, &ba, &s, &sa))
+				break;
+			bv8_store(sbuf + k * 16, bv_narrow(bv_unpremultiply(bv_widen(s, 0), bv_widen(sa, 0)), bv_unpremultiply(bv_widen(s, 1), bv_widen(sa, 1))), 16);
+			bv8_store(bbuf + k * 16, bv_narrow(bv_unpremultiply(bv_widen(b, 0), bv_widen(ba, 0)), bv_unpremultiply(bv_widen(b, 1), bv_widen(ba, 1))), 16);
+		}
+
+		if (m == 0)
+		{
+			/* Leave a badly premultiplied block to the C. */
+			fz_blend_nonseparable(bp, bal, sp, 1, 3, row.px, blendmode, 0, 3);
+			m = row.px;
+		}
+		else
+		{
+			blend_simd_nonseparable_rgb(rbuf, bbuf, sbuf, m, blendmode);
+
+			/* Composite the results back. */
+			for (k = 0, bq = bp, sq = sp; k < m; k += row.px, bq += row.dlen, sq += row.slen)
+			{
+				bv8 b, ba, s, sa;
+				blend_simd_load(&row, bq, sq, &b, &ba, &s, &sa);
+				if (!bv8_is_zero(sa))
+					blend_simd_block(&row, bq, b, ba, s, sa, 0, BLEND_SIMD_BUFFER, rbuf + k * 4);
+			}
+		}
+		i += m;
+		bp += m / row.px * row.dlen;
+		sp += m / row.px * row.slen;
+	}
+	return i;
+}
+
+/* As fz_blend_nonseparable_nonisolated for rgb with no spots, for as
+ * many whole blocks as there are. Returns the number of pixels done. */
+BLEND_SIMD_TARGET static int
+simd_blend_nonseparable_nonisolated(byte * FZ_RESTRICT bp, int bal, const byte * FZ_RESTRICT sp, int sal, int w, const byte * FZ_RESTRICT hp, int alpha, int blendmode)
+{
+	byte sbuf[BLEND_SIMD_BATCH * 16];
+	byte bbuf[BLEND_SIMD_BATCH * 16];
+	byte rbuf[BLEND_SIMD_BATCH * 16] = { 0 };
+	blend_simd_row row;
+	int i = 0;
+
+	blend_simd_init_row(&row, 3, sal, bal);
+	while ((w - i) * row.step >= 16)
+	{
+		const byte *sq = sp;
+		byte *bq = bp;
+		int m, k;
+
+		/* Unpremultiply and uncomposite a batch into the buffers. */
+		for (m = k = 0; k < BLEND_SIMD_BATCH && (w - i - m) * row.step >= 16; m += row.px, k++, bq += row.dlen, sq += row.slen)
+		{
+			bv8 b, ba, s, sa, ha;
+			bv su[2], bu[2];
+			int h;
+			if (!blend_simd_load(&row, bq, sq, &b, &ba, &s, &sa))
+				break;
+			ha = blend_simd_shape(&row, hp + m);
+			for (h = 0; h < 2; h++)
+			{
+				bv invha = bv_div(bv_set(255 * 256), bv_max(bv_widen(ha, h), bv_set(1)));
+				su[h] = bv_unpremultiply(bv_widen(s, h), bv_widen(sa, h));
+				bu[h] = bv_unpremultiply(bv_widen(b, h), bv_widen(ba, h));
+				su[h] = bv_clamp(bv_add(bv_sra(bv_mul(bv_sub(su[h], bu[h]), invha), 8), bu[h]), bv_set(0), bv_set(255));
+			}
+			bv8_store(sbuf + k * 16, bv_narrow(su[0], su[1]), 16);
+			bv8_store(bbuf + k * 16, bv_narrow(bu[0], bu[1]), 16);
+		}
+
+		if (m == 0)
+		{
+			/* Leave a badly premultiplied block to the C. */
+			fz_blend_nonseparable_nonisolated(bp, bal, sp, sal, 3, row.px, blendmode, 0, hp, alpha, 3);
+			m = row.px;
+		}
+		else
+		{
+			blend_simd_nonseparable_rgb(rbuf, bbuf, sbuf, m, blendmode);
+
+			/* Composite the results back. */
+			for (k = 0, bq = bp, sq = sp; k < m; k += row.px, bq += row.dlen, sq += row.slen)
+			{
+				bv8 b, ba, s, sa, ha;
+				bv8 is_alpha = bv8_load(row.is_alpha);
+				bv out[2];
+				int h;
+
+				blend_simd_load(&row, bq, sq, &b, &ba, &s, &sa);
+				ha = blend_simd_shape(&row, hp + k);
+				if (bv8_is_zero(ha))
+					continue;
+				for (h = 0; h < 2; h++)
+				{
+					bv bc = bv_widen(b, h);
+					bv bah = bv_widen(ba, h);
+					bv haa = bv_mul255(bv_widen(ha, h), bv_set(alpha));
+					bv is_ah = bv_widen_mask(is_alpha, h);
+					bv su = bv_widen(bv8_load(sbuf + k * 4), h);
+					bv bu = bv_widen(bv8_load(bbuf + k * 4), h);
+					bv rc = bv_widen(bv8_load(rbuf + k * 4), h);
+					bv bahaa = bv_mul255(bah, haa);
+					bv ra0 = bv_sub(bah, bahaa);
+					bv ra = bv_add(ra0, haa);
+					bv o;
+
+					rc = bv_select(bv_gt(bv_set(255), bahaa), bv_mul255(bahaa, rc), rc);
+					rc = bv_select(bv_gt(bv_set(255), bah), bv_add(rc, bv_mul255(bv_mul255(bv_sub(bv_set(255), bah), haa), su)), rc);
+					rc = bv_select(bv_gt(ra0, bv_set(0)), bv_add(rc, bv_mul255(ra0, bu)), rc);
+					o = bv_select(is_ah, ra, rc);
+
+					/* A zero result alpha leaves the colorants alone. */
+					o = bv_select(bv_gt(ra, bv_set(0)), o, bv_select(is_ah, ra, bc));
+					/* Copy the source over a clear backdrop if opaque. */
+					if (alpha == 255)
+						o = bv_select(bv_gt(bah, bv_set(0)), o, bv_select(is_ah, bv_widen(sa, h), bv_widen(s, h)));
+					out[h] = bv_select(bv_gt(haa, bv_set(0)), o, bc);
+				}
+				blend_simd_store(&row, bq, bv_narrow(out[0], out[1]));
+			}
+		}
+		i += m;
+		hp += m;
+		bp += m / row.px * row.dlen;
+		sp += m / row.px * row.slen;
+	}
+	return i;
+}
+
+static inline int
+blend_simd_enabled(void)
+{
+	return (fz_cpu_features() & BLEND_SIMD_FEATURES) != 0;
+}
+
+#endif /* BLEND_SIMD */
+
 #ifdef PARANOID_PREMULTIPLY
 static void
 verify_premultiply(fz_context *ctx, const fz_pixmap * FZ_RESTRICT dst)
@@ -1076,6 +1960,11 @@ fz_blend_pixmap(fz_context *ctx, fz_pixmap * FZ_RESTRICT dst, fz_pixmap * FZ_RES
 	int x, y, w, h, n;
 	int da, sa;
 	int complement;
+#ifdef BLEND_SIMD
+	blend_simd_fn *simd_separable = NULL;
+	blend_simd_nonisolated_fn *simd_separable_nonisolated = NULL;
+	int simd_nonseparable = 0;
+#endif
 
 	/* TODO: fix this hack! */
 	if (isolated && alpha < 255)
@@ -1127,12 +2016,49 @@ fz_blend_pixmap(fz_context *ctx, fz_pixmap * FZ_RESTRICT dst, fz_pixmap * FZ_RES
 	n -= sa;
 	assert(n == dst->n - da);
 
+#ifdef BLEND_SIMD
+	/* Pick the SIMD kernel for the rows (if any) up front. */
+	if (isolated && sa && src->s == 0 && blend_simd_enabled())
+	{
+		if (blendmode < FZ_BLEND_HUE && (n == 1 || n == 3 || n == 4))
+			simd_separable = blend_simd_separable[blendmode];
+		else if (blendmode >= FZ_BLEND_HUE && n == 3 && !complement)
+			simd_nonseparable = 1;
+	}
+	else if (!isolated && src->s == 0 && blend_simd_enabled())
+	{
+		/* A normal blend of an opaque source is just a copy. */
+		if (blendmode < FZ_BLEND_HUE && (n == 1 || n == 3 || n == 4) && (sa || alpha < 255 || blendmode != FZ_BLEND_NORMAL))
+			simd_separable_nonisolated = blend_simd_separable_nonisolated[blendmode];
+		else if (blendmode >= FZ_BLEND_HUE && n == 3 && !complement)
+			simd_nonseparable = 1;
+	}
+#endif
+
 	if (!isolated)
 	{
 		const unsigned char *hp = shape->samples + (unsigned int)((y - shape->y) * shape->stride + (x - shape->x));
 
 		while (h--)
 		{
+#ifdef BLEND_SIMD
+			if (simd_separable_nonisolated || simd_nonseparable)
+			{
+				int i;
+				if (simd_separable_nonisolated)
+					i = simd_separable_nonisolated(dp, da, sp, sa, n, w, complement, hp, alpha);
+				else
+					i = simd_blend_nonseparable_nonisolated(dp, da, sp, sa, w, hp, alpha, blendmode);
+				if (i < w)
+				{
+					if (simd_separable_nonisolated)
+						fz_blend_separable_nonisolated(dp + i * (n + da), da, sp + i * (n + sa), sa, n, w - i, blendmode, complement, hp + i, alpha, n);
+					else
+						fz_blend_nonseparable_nonisolated(dp + i * (n + da), da, sp + i * (n + sa), sa, n, w - i, blendmode, 0, hp + i, alpha, n);
+				}
+			}
+			else
+#endif
 			if (blendmode >= FZ_BLEND_HUE)
 			{
 				if (complement || src->s > 0)
@@ -1189,6 +2115,24 @@ fz_blend_pixmap(fz_context *ctx, fz_pixmap * FZ_RESTRICT dst, fz_pixmap * FZ_RES
 	{
 		while (h--)
 		{
+#ifdef BLEND_SIMD
+			if (simd_separable || simd_nonseparable)
+			{
+				int i;
+				if (simd_separable)
+					i = simd_separable(dp, da, sp, n, w, complement);
+				else
+					i = simd_blend_nonseparable(dp, da, sp, w, blendmode);
+				if (i < w)
+				{
+					if (simd_separable)
+						fz_blend_separable(dp + i * (n + da), da, sp + i * (n + 1), 1, n, w - i, blendmode, complement, n);
+					else
+						fz_blend_nonseparable(dp + i * (n + da), da, sp + i * (n + 1), 1, n, w - i, blendmode, 0, n);
+				}
+			}
+			else
+#endif
 			if (blendmode >= FZ_BLEND_HUE)
 			{
 				if (complement || src->s > 0)
@@ -1,4 +1,5 @@
 #include "mupdf/fitz.h"
+#include "context-imp.h"
 #include "draw-imp.h"
 #include "glyph-imp.h"
 #include "pixmap-imp.h"
@@ -6,6 +7,7 @@
 #include <string.h>
 #include <math.h>
 
+/* Defaults, which can be changed with fz_set_glyph_cache_limits. */
 #define MAX_GLYPH_SIZE 256
 #define MAX_CACHE_SIZE (1024*1024)
 
@@ -32,17 +34,34 @@ typedef struct fz_glyph_cache_entry
 	fz_glyph *val;
 } fz_glyph_cache_entry;
 
-struct fz_glyph_cache
+/*
+	The cache is split into stripes, chosen by the hash of the key.
+	Each stripe has its own lock, hash table, LRU list, and an equal
+	share of the total size limit. Only one stripe lock is ever held
+	at a time.
+*/
+typedef struct
 {
-	int refs;
+	int lock;
 	size_t total;
-#ifndef NDEBUG
-	int num_evictions;
-	ptrdiff_t evicted;
-#endif
-	fz_glyph_cache_entry *entry[GLYPH_HASH_LEN];
+	int count;
+	int num_buckets;
+	fz_glyph_cache_entry **entry;
 	fz_glyph_cache_entry *lru_head;
 	fz_glyph_cache_entry *lru_tail;
+	size_t lookups;
+	size_t hits;
+	size_t num_evictions;
+	size_t evicted;
+} fz_glyph_cache_stripe;
+
+struct fz_glyph_cache
+{
+	int refs;
+	size_t max_size;
+	int max_glyph_size;
+	int nstripes;
+	fz_glyph_cache_stripe stripe[FZ_GLYPH_CACHE_STRIPES];
 };
 
 static size_t
@@ -53,91 +72,189 @@ fz_glyph_size(fz_context *ctx, fz_glyph *glyph)
 	return sizeof(fz_glyph) + glyph->size + fz_pixmap_size(ctx, glyph->pixmap);
 }
 
+static int
+stripe_buckets(fz_glyph_cache *cache, int buckets)
+{
+	/* Keep the number of buckets odd, so that it shares no factors
+	 * with the number of stripes. */
+	buckets /= cache->nstripes;
+	if (buckets < 1)
+		buckets = 1;
+	return buckets | 1;
+}
+
 void
 fz_new_glyph_cache_context(fz_context *ctx)
 {
 	fz_glyph_cache *cache;
+	int i;
 
 	cache = fz_malloc_struct(ctx, fz_glyph_cache);
-	cache->total = 0;
 	cache->refs = 1;
+	cache->max_size = MAX_CACHE_SIZE;
+	cache->max_glyph_size = MAX_GLYPH_SIZE;
+	cache->nstripes = 1;
+	if (ctx->locks.lock != fz_locks_default.lock)
+		cache->nstripes = FZ_GLYPH_CACHE_STRIPES;
+
+	fz_try(ctx)
+	{
+		for (i = 0; i < cache->nstripes; i++)
+		{
+			fz_glyph_cache_stripe *stripe = &cache->stripe[i];
+			stripe->lock = FZ_LOCK_GLYPHCACHE + i;
+			stripe->num_buckets = stripe_buckets(cache, GLYPH_HASH_LEN);
+			stripe->entry = fz_malloc_array(ctx, stripe->num_buckets, fz_glyph_cache_entry *);
+			memset(stripe->entry, 0, stripe->num_buckets * sizeof(fz_glyph_cache_entry *));
+		}
+	}
+	fz_catch(ctx)
+	{
+		for (i = 0; i < cache->nstripes; i++)
+			fz_free(ctx, cache->stripe[i].entry);
+		fz_free(ctx, cache);
+		fz_rethrow(ctx);
+	}
 
 	ctx->glyph_cache = cache;
 }
 
 static void
-drop_glyph_cache_entry(fz_context *ctx, fz_glyph_cache_entry *entry)
+drop_glyph_cache_entry(fz_context *ctx, fz_glyph_cache_stripe *stripe, fz_glyph_cache_entry *entry)
 {
-	fz_glyph_cache *cache = ctx->glyph_cache;
-
 	if (entry->lru_next)
 		entry->lru_next->lru_prev = entry->lru_prev;
 	else
-		cache->lru_tail = entry->lru_prev;
+		stripe->lru_tail = entry->lru_prev;
 	if (entry->lru_prev)
 		entry->lru_prev->lru_next = entry->lru_next;
 	else
-		cache->lru_head = entry->lru_next;
-	cache->total -= fz_glyph_size(ctx, entry->val);
+		stripe->lru_head = entry->lru_next;
+	stripe->total -= fz_glyph_size(ctx, entry->val);
+	stripe->count--;
 	if (entry->bucket_next)
 		entry->bucket_next->bucket_prev = entry->bucket_prev;
 	if (entry->bucket_prev)
 		entry->bucket_prev->bucket_next = entry->bucket_next;
 	else
-		cache->entry[entry->hash] = entry->bucket_next;
+		stripe->entry[entry->hash % stripe->num_buckets] = entry->bucket_next;
 	fz_drop_font(ctx, entry->key.font);
 	fz_drop_glyph(ctx, entry->val);
 	fz_free(ctx, entry);
 }
 
-/* The glyph cache lock is always held when this function is called. */
+/* The stripe lock is always held when this function is called. */
 static void
-do_purge(fz_context *ctx)
+evict_to_size(fz_context *ctx, fz_glyph_cache_stripe *stripe, size_t max)
 {
-	fz_glyph_cache *cache = ctx->glyph_cache;
+	while (stripe->lru_tail && stripe->total > max)
+	{
+		stripe->num_evictions++;
+		stripe->evicted += fz_glyph_size(ctx, stripe->lru_tail->val);
+		drop_glyph_cache_entry(ctx, stripe, stripe->lru_tail);
+	}
+}
+
+/*
+	Rehash the stripe into a table of the given size. If we can't
+	get the memory, we carry on with the table we have.
+	The stripe lock is always held when this function is called.
+*/
+static void
+resize_stripe(fz_context *ctx, fz_glyph_cache_stripe *stripe, int num_buckets)
+{
+	fz_glyph_cache_entry **entry, *e, *next;
 	int i;
 
-	for (i = 0; i < GLYPH_HASH_LEN; i++)
+	entry = fz_malloc_no_throw(ctx, num_buckets * sizeof(fz_glyph_cache_entry *));
+	if (entry == NULL)
+		return;
+	memset(entry, 0, num_buckets * sizeof(fz_glyph_cache_entry *));
+
+	for (i = 0; i < stripe->num_buckets; i++)
 	{
-		while (cache->entry[i])
-			drop_glyph_cache_entry(ctx, cache->entry[i]);
+		for (e = stripe->entry[i]; e; e = next)
+		{
+			unsigned h = e->hash % num_buckets;
+			next = e->bucket_next;
+			e->bucket_prev = NULL;
+			e->bucket_next = entry[h];
+			if (e->bucket_next)
+				e->bucket_next->bucket_prev = e;
+			entry[h] = e;
+		}
 	}
 
-	cache->total = 0;
+	fz_free(ctx, stripe->entry);
+	stripe->entry = entry;
+	stripe->num_buckets = num_buckets;
 }
 
 void
 fz_purge_glyph_cache(fz_context *ctx)
 {
-	fz_lock(ctx, FZ_LOCK_GLYPHCACHE);
-	do_purge(ctx);
-	fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
+	fz_glyph_cache *cache = ctx->glyph_cache;
+	int i;
+
+	for (i = 0; i < cache->nstripes; i++)
+	{
+		fz_glyph_cache_stripe *stripe = &cache->stripe[i];
+		fz_lock(ctx, stripe->lock);
+		evict_to_size(ctx, stripe, 0);
+		fz_unlock(ctx, stripe->lock);
+	}
+}
+
+void
+fz_set_glyph_cache_limits(fz_context *ctx, size_t max_size, int max_glyph_size, int buckets)
+{
+	fz_glyph_cache *cache = ctx->glyph_cache;
+	int i, n;
+
+	if (max_size > 0)
+		cache->max_size = max_size;
+	if (max_glyph_size > 0)
+		cache->max_glyph_size = max_glyph_size;
+
+	for (i = 0; i < cache->nstripes; i++)
+	{
+		fz_glyph_cache_stripe *stripe = &cache->stripe[i];
+		fz_lock(ctx, stripe->lock);
+		evict_to_size(ctx, stripe, cache->max_size / cache->nstripes);
+		if (buckets > 0)
+		{
+			n = stripe_buckets(cache, buckets);
+			if (n > stripe->num_buckets)
+				resize_stripe(ctx, stripe, n);
+		}
+		fz_unlock(ctx, stripe->lock);
+	}
 }
 
 void
 fz_drop_glyph_cache_context(fz_context *ctx)
 {
+	fz_glyph_cache *cache;
+	int i;
+
 	if (!ctx || !ctx->glyph_cache)
 		return;
 
-	fz_lock(ctx, FZ_LOCK_GLYPHCACHE);
-	ctx->glyph_cache->refs--;
-	if (ctx->glyph_cache->refs == 0)
+	cache = ctx->glyph_cache;
+	if (fz_drop_imp(ctx, cache, &cache->refs))
 	{
-		do_purge(ctx);
-		fz_free(ctx, ctx->glyph_cache);
-		ctx->glyph_cache = NULL;
+		fz_purge_glyph_cache(ctx);
+		for (i = 0; i < cache->nstripes; i++)
+			fz_free(ctx, cache->stripe[i].entry);
+		fz_free(ctx, cache);
 	}
-	fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
+	ctx->glyph_cache = NULL;
 }
 
 fz_glyph_cache *
 fz_keep_glyph_cache(fz_context *ctx)
 {
-	fz_lock(ctx, FZ_LOCK_GLYPHCACHE);
-	ctx->glyph_cache->refs++;
-	fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
-	return ctx->glyph_cache;
+	return fz_keep_imp(ctx, ctx->glyph_cache, &ctx->glyph_cache->refs);
 }
 
 float
@@ -215,7 +332,7 @@ static unsigned do_hash(unsigned char *s, int len)
 }
 
 static inline void
-move_to_front(fz_glyph_cache *cache, fz_glyph_cache_entry *entry)
+move_to_front(fz_glyph_cache_stripe *stripe, fz_glyph_cache_entry *entry)
 {
 	if (entry->lru_prev == NULL)
 		return; /* At front already */
@@ -225,36 +342,51 @@ move_to_front(fz_glyph_cache *cache, fz_glyph_cache_entry *entry)
 	if (entry->lru_next)
 		entry->lru_next->lru_prev = entry->lru_prev;
 	else
-		cache->lru_tail = entry->lru_prev;
+		stripe->lru_tail = entry->lru_prev;
 	/* Relink */
-	entry->lru_next = cache->lru_head;
+	entry->lru_next = stripe->lru_head;
 	if (entry->lru_next)
 		entry->lru_next->lru_prev = entry;
-	cache->lru_head = entry;
+	stripe->lru_head = entry;
 	entry->lru_prev = NULL;
 }
 
+static fz_glyph_cache_entry *
+find_entry(fz_glyph_cache_stripe *stripe, fz_glyph_key *key, unsigned hash)
+{
+	fz_glyph_cache_entry *entry = stripe->entry[hash % stripe->num_buckets];
+	while (entry)
+	{
+		if (entry->hash == hash && memcmp(&entry->key, key, sizeof(*key)) == 0)
+			return entry;
+		entry = entry->bucket_next;
+	}
+	return NULL;
+}
+
 fz_glyph *
 fz_render_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix *ctm, fz_colorspace *model, const fz_irect *scissor, int alpha, int aa)
 {
 	fz_glyph_cache *cache;
+	fz_glyph_cache_stripe *stripe;
 	fz_glyph_key key;
 	fz_matrix subpix_ctm;
 	fz_irect subpix_scissor;
 	float size;
 	fz_glyph *val;
-	int do_cache, locked, caching;
+	int do_cache, max_glyph_size;
 	fz_glyph_cache_entry *entry;
 	unsigned hash;
 	int is_ft_font = !!fz_font_ft_face(ctx, font);
 
-	fz_var(locked);
-	fz_var(caching);
 	fz_var(val);
 
+	cache = ctx->glyph_cache;
+	max_glyph_size = cache->max_glyph_size;
+
 	memset(&key, 0, sizeof key);
 	size = fz_subpixel_adjust(ctx, ctm, &subpix_ctm, &key.e, &key.f);
-	if (size <= MAX_GLYPH_SIZE)
+	if (size <= max_glyph_size)
 	{
 		scissor = &fz_infinite_irect;
 		do_cache = 1;
@@ -271,8 +403,6 @@ fz_render_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix *ctm, fz_colo
 		do_cache = 0;
 	}
 
-	cache = ctx->glyph_cache;
-
 	key.font = font;
 	key.gid = gid;
 	key.a = subpix_ctm.a * 65536;
@@ -281,120 +411,93 @@ fz_render_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix *ctm, fz_colo
 	key.d = subpix_ctm.d * 65536;
 	key.aa = aa;
 
-	hash = do_hash((unsigned char *)&key, sizeof(key)) % GLYPH_HASH_LEN;
-	fz_lock(ctx, FZ_LOCK_GLYPHCACHE);
-	entry = cache->entry[hash];
-	while (entry)
+	hash = do_hash((unsigned char *)&key, sizeof(key));
+	stripe = &cache->stripe[hash % cache->nstripes];
+	fz_lock(ctx, stripe->lock);
+	entry = find_entry(stripe, &key, hash);
+	stripe->lookups++;
+	if (entry)
 	{
-		if (memcmp(&entry->key, &key, sizeof(key)) == 0)
-		{
-			move_to_front(cache, entry);
-			val = fz_keep_glyph(ctx, entry->val);
-			fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
-			return val;
-		}
-		entry = entry->bucket_next;
+		stripe->hits++;
+		move_to_front(stripe, entry);
+		val = fz_keep_glyph(ctx, entry->val);
+		fz_unlock(ctx, stripe->lock);
+		return val;
+	}
+	fz_unlock(ctx, stripe->lock);
+
+	/* We render the glyph without holding the cache lock, so that
+	 * other threads can carry on using the cache meanwhile. The
+	 * danger here is that some other thread will come along, and
+	 * want the same glyph too. If it does, we may both end up
+	 * rendering pixmaps. We cope with this later on, by ensuring
+	 * that only one gets inserted into the cache. If we insert ours
+	 * to find one already there, we abandon ours, and use the one
+	 * there already. */
+	if (is_ft_font)
+	{
+		val = fz_render_ft_glyph(ctx, font, gid, subpix_ctm, aa);
+	}
+	else if (fz_font_t3_procs(ctx, font))
+	{
+		val = fz_render_t3_glyph(ctx, font, gid, subpix_ctm, model, scissor, aa);
+	}
+	else
+	{
+		fz_warn(ctx, "assert: uninitialized font structure");
+		val = NULL;
 	}
 
-	locked = 1;
-	caching = 0;
-	val = NULL;
+	if (val == NULL || !do_cache || val->w >= max_glyph_size || val->h >= max_glyph_size)
+		return val;
 
+	fz_lock(ctx, stripe->lock);
 	fz_try(ctx)
 	{
-		if (is_ft_font)
-		{
-			val = fz_render_ft_glyph(ctx, font, gid, subpix_ctm, aa);
-		}
-		else if (fz_font_t3_procs(ctx, font))
+		entry = find_entry(stripe, &key, hash);
+		if (entry)
 		{
-			/* We drop the glyphcache here, and execute the t3
-			 * glyph code. The danger here is that some other
-			 * thread will come along, and want the same glyph
-			 * too. If it does, we may both end up rendering
-			 * pixmaps. We cope with this later on, by ensuring
-			 * that only one gets inserted into the cache. If
-			 * we insert ours to find one already there, we
-			 * abandon ours, and use the one there already.
-			 */
-			fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
-			locked = 0;
-			val = fz_render_t3_glyph(ctx, font, gid, subpix_ctm, model, scissor, aa);
-			fz_lock(ctx, FZ_LOCK_GLYPHCACHE);
-			locked = 1;
+			fz_drop_glyph(ctx, val);
+			move_to_front(stripe, entry);
+			val = fz_keep_glyph(ctx, entry->val);
 		}
 		else
 		{
-			fz_warn(ctx, "assert: uninitialized font structure");
-		}
-		if (val && do_cache)
-		{
-			if (val->w < MAX_GLYPH_SIZE && val->h < MAX_GLYPH_SIZE)
-			{
-				/* If we throw an exception whilst caching,
-				 * just ignore the exception and carry on. */
-				caching = 1;
-				if (!is_ft_font)
-				{
-					/* We had to unlock. Someone else might
-					 * have rendered in the meantime */
-					entry = cache->entry[hash];
-					while (entry)
-					{
-						if (memcmp(&entry->key, &key, sizeof(key)) == 0)
-						{
-							fz_drop_glyph(ctx, val);
-							move_to_front(cache, entry);
-							val = fz_keep_glyph(ctx, entry->val);
-							goto unlock_and_return_val;
-						}
-						entry = entry->bucket_next;
-					}
-				}
-
-				entry = fz_malloc_struct(ctx, fz_glyph_cache_entry);
-				entry->key = key;
-				entry->hash = hash;
-				entry->bucket_next = cache->entry[hash];
-				if (entry->bucket_next)
-					entry->bucket_next->bucket_prev = entry;
-				cache->entry[hash] = entry;
-				entry->val = fz_keep_glyph(ctx, val);
-				fz_keep_font(ctx, key.font);
-
-				entry->lru_next = cache->lru_head;
-				if (entry->lru_next)
-					entry->lru_next->lru_prev = entry;
-				else
-					cache->lru_tail = entry;
-				cache->lru_head = entry;
-
-				cache->total += fz_glyph_size(ctx, val);
-				while (cache->total > MAX_CACHE_SIZE)
-				{
-#ifndef NDEBUG
-					cache->num_evictions++;
-					cache->evicted += fz_glyph_size(ctx, cache->lru_tail->val);
-#endif
-					drop_glyph_cache_entry(ctx, cache->lru_tail);
-				}
-			}
-		}
-unlock_and_return_val:
-		{
+			/* Grow the hash table as the cache fills up. */
+			if (stripe->count >= stripe->num_buckets)
+				resize_stripe(ctx, stripe, stripe->num_buckets * 2 + 1);
+
+			entry = fz_malloc_struct(ctx, fz_glyph_cache_entry);
+			entry->key = key;
+			entry->hash = hash;
+			entry->bucket_next = stripe->entry[hash % stripe->num_buckets];
+			if (entry->bucket_next)
+				entry->bucket_next->bucket_prev = entry;
+			stripe->entry[hash % stripe->num_buckets] = entry;
+			entry->val = fz_keep_glyph(ctx, val);
+			fz_keep_font(ctx, key.font);
+
+			entry->lru_next = stripe->lru_head;
+			if (entry->lru_next)
+				entry->lru_next->lru_prev = entry;
+			else
+				stripe->lru_tail = entry;
+			stripe->lru_head = entry;
+
+			stripe->total += fz_glyph_size(ctx, val);
+			stripe->count++;
+			evict_to_size(ctx, stripe, cache->max_size / cache->nstripes);
 		}
 	}
 	fz_always(ctx)
 	{
-		if (locked)
-			fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
+		fz_unlock(ctx, stripe->lock);
 	}
 	fz_catch(ctx)
 	{
-		if (caching)
-			fz_warn(ctx, "cannot encache glyph; continuing");
-		else
-			fz_rethrow(ctx);
+		/* If we throw an exception whilst caching,
+		 * just ignore the exception and carry on. */
+		fz_warn(ctx, "cannot encache glyph; continuing");
 	}
 
 	return val;
@@ -409,7 +512,7 @@ fz_render_glyph_pixmap(fz_context *ctx, fz_font *font, int gid, fz_matrix *ctm,
 	float size = fz_subpixel_adjust(ctx, ctm, &subpix_ctm, &qe, &qf);
 	int is_ft_font = !!fz_font_ft_face(ctx, font);
 
-	if (size <= MAX_GLYPH_SIZE)
+	if (size <= ctx->glyph_cache->max_glyph_size)
 	{
 		scissor = &fz_infinite_irect;
 	}
@@ -440,8 +543,31 @@ void
 fz_dump_glyph_cache_stats(fz_context *ctx, fz_output *out)
 {
 	fz_glyph_cache *cache = ctx->glyph_cache;
-	fz_write_printf(ctx, out, "Glyph Cache Size: %zu\n", cache->total);
-#ifndef NDEBUG
-	fz_write_printf(ctx, out, "Glyph Cache Evictions: %d (%zu bytes)\n", cache->num_evictions, cache->evicted);
-#endif
+	fz_glyph_cache_stripe copy[FZ_GLYPH_CACHE_STRIPES];
+	size_t total = 0, lookups = 0, hits = 0, num_evictions = 0, evicted = 0;
+	int i;
+
+	/* Copy the counts, so as not to write output with a lock held. */
+	for (i = 0; i < cache->nstripes; i++)
+	{
+		fz_lock(ctx, cache->stripe[i].lock);
+		copy[i] = cache->stripe[i];
+		fz_unlock(ctx, cache->stripe[i].lock);
+	}
+
+	for (i = 0; i < cache->nstripes; i++)
+	{
+		if (cache->nstripes > 1)
+			fz_write_printf(ctx, out, "Glyph Cache Stripe %d: %zu bytes, %d glyphs, %zu evictions\n",
+				i, copy[i].total, copy[i].count, copy[i].num_evictions);
+		total += copy[i].total;
+		lookups += copy[i].lookups;
+		hits += copy[i].hits;
+		num_evictions += copy[i].num_evictions;
+		evicted += copy[i].evicted;
+	}
+
+	fz_write_printf(ctx, out, "Glyph Cache Size: %zu\n", total);
+	fz_write_printf(ctx, out, "Glyph Cache Lookups: %zu (%zu hits)\n", lookups, hits);
+	fz_write_printf(ctx, out, "Glyph Cache Evictions: %zu (%zu bytes)\n", num_evictions, evicted);
 }
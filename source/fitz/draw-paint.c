@@ -3,6 +3,7 @@
 #include "draw-imp.h"
 #include "glyph-imp.h"
 #include "pixmap-imp.h"
+#include "simd-imp.h"
 
 #include <string.h>
 #include <assert.h>
@@ -116,6 +117,385 @@ static inline int isbigendian(void)
 	return u.c[0] != 1;
 }
 
+/*
+	SIMD versions of the commonest painters.
+
+	These work on blocks of 16 bytes, holding as many whole pixels of
+	bpp (1 to 5) bytes as will fit, and do their sums in 16 bit lanes
+	so that they give exactly the same answers as FZ_BLEND and friends
+	in the plain C templates. Those deal with whatever is left over at
+	the end of each span, and remain the reference.
+
+	For each byte of a block, paint_simd_pixel gives the pixel it is
+	part of, paint_simd_comp its component, and paint_simd_alpha the
+	byte holding its pixel's alpha. Bytes beyond the last whole pixel
+	get 0x80, which shuffles in a zero; they are never stored.
+
+	The kernels are written in terms of a handful of primitives (pv_*)
+	that have AVX2 and NEON versions.
+*/
+
+#if defined(FZ_SIMD_X86)
+#define PAINT_SIMD
+#define PAINT_SIMD_TARGET FZ_SIMD_TARGET("avx2")
+#define PAINT_SIMD_FEATURES FZ_CPU_AVX2
+#elif defined(FZ_SIMD_NEON)
+#define PAINT_SIMD
+#define PAINT_SIMD_TARGET
+#define PAINT_SIMD_FEATURES FZ_CPU_NEON
+#endif
+
+#ifdef PAINT_SIMD
+
+static const byte paint_simd_pixel[6][16] = {
+	{ 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 },
+	{ 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 },
+	{ 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7 },
+	{ 0, 0, 0, 1, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4, 4, 0x80 },
+	{ 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3 },
+	{ 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 2, 2, 2, 2, 2, 0x80 }
+};
+
+static const byte paint_simd_comp[6][16] = {
+	{ 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 },
+	{ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
+	{ 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1 },
+	{ 0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2, 0x80 },
+	{ 0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3 },
+	{ 0, 1, 2, 3, 4, 0, 1, 2, 3, 4, 0, 1, 2, 3, 4, 0x80 }
+};
+
+static const byte paint_simd_alpha[6][16] = {
+	{ 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 },
+	{ 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 },
+	{ 1, 1, 3, 3, 5, 5, 7, 7, 9, 9, 11, 11, 13, 13, 15, 15 },
+	{ 2, 2, 2, 5, 5, 5, 8, 8, 8, 11, 11, 11, 14, 14, 14, 0x80 },
+	{ 3, 3, 3, 3, 7, 7, 7, 7, 11, 11, 11, 11, 15, 15, 15, 15 },
+	{ 4, 4, 4, 4, 4, 9, 9, 9, 9, 9, 14, 14, 14, 14, 14, 0x80 }
+};
+
+/* Gather the one byte per pixel (of a block of bpp > 1 byte pixels)
+ * that pv_load_pixels wants, lowest first. Compilers turn this into
+ * a load or two; going via a variable length memcpy would cost more
+ * than all the rest of a kernel. */
+static inline uint64_t
+paint_simd_mask_bytes(const byte *p, int bpp)
+{
+	uint32_t lo = p[0] | (p[1] << 8) | (p[2] << 16);
+	if (bpp == 5)
+		return lo;
+	lo |= (uint32_t)p[3] << 24;
+	if (bpp == 4)
+		return lo;
+	if (bpp == 3)
+		return lo | ((uint64_t)p[4] << 32);
+	return lo | ((uint64_t)(p[4] | (p[5] << 8) | (p[6] << 16) | ((uint32_t)p[7] << 24)) << 32);
+}
+
+#ifdef FZ_SIMD_X86
+
+typedef __m128i pv8; /* 16 bytes */
+typedef __m256i pv16; /* 16 bytes widened to 16 bits */
+
+PAINT_SIMD_TARGET static inline pv8 pv_load(const byte *p) { return _mm_loadu_si128((const __m128i *)p); }
+PAINT_SIMD_TARGET static inline void pv_store(byte *p, pv8 v) { _mm_storeu_si128((__m128i *)p, v); }
+PAINT_SIMD_TARGET static inline pv8 pv_splat(int v) { return _mm_set1_epi8((char)v); }
+PAINT_SIMD_TARGET static inline pv8 pv_shuffle(pv8 v, const byte *table) { return _mm_shuffle_epi8(v, pv_load(table)); }
+PAINT_SIMD_TARGET static inline int pv_is_zero(pv8 v) { return _mm_testz_si128(v, v); }
+PAINT_SIMD_TARGET static inline pv8 pv_eq_zero(pv8 v) { return _mm_cmpeq_epi8(v, _mm_setzero_si128()); }
+PAINT_SIMD_TARGET static inline pv8 pv_select(pv8 mask, pv8 t, pv8 f) { return _mm_blendv_epi8(f, t, mask); }
+PAINT_SIMD_TARGET static inline pv16 pv_widen(pv8 v) { return _mm256_cvtepu8_epi16(v); }
+PAINT_SIMD_TARGET static inline pv16 pv_mul(pv16 a, int b) { return _mm256_mullo_epi16(a, _mm256_set1_epi16((short)b)); }
+PAINT_SIMD_TARGET static inline pv16 pv_sub_from(int a, pv16 b) { return _mm256_sub_epi16(_mm256_set1_epi16((short)a), b); }
+
+PAINT_SIMD_TARGET static inline pv8
+pv_load_pixels(const byte *p, int bpp)
+{
+	if (bpp == 1)
+		return pv_load(p);
+	return _mm_set_epi64x(0, (int64_t)paint_simd_mask_bytes(p, bpp));
+}
+
+/* Store just the whole pixels of a block, so that when they do not
+ * fill it the next block's load does not overlap this store (which
+ * would stall until the store was done). */
+PAINT_SIMD_TARGET static inline void
+pv_store_pixels(byte *p, pv8 v, int bpp)
+{
+	if (16 % bpp == 0)
+		pv_store(p, v);
+	else
+	{
+		_mm_storel_epi64((__m128i *)p, v);
+		_mm_storel_epi64((__m128i *)(p + 7), _mm_srli_si128(v, 7));
+	}
+}
+
+/* FZ_EXPAND */
+PAINT_SIMD_TARGET static inline pv16
+pv_expand(pv8 v)
+{
+	pv16 a = pv_widen(v);
+	return _mm256_add_epi16(a, _mm256_srli_epi16(a, 7));
+}
+
+/* FZ_COMBINE */
+PAINT_SIMD_TARGET static inline pv16
+pv_combine(pv16 a, int b)
+{
+	return _mm256_srli_epi16(pv_mul(a, b), 8);
+}
+
+PAINT_SIMD_TARGET static inline pv8
+pv_narrow(pv16 a)
+{
+	return _mm_packus_epi16(_mm256_castsi256_si128(a), _mm256_extracti128_si256(a, 1));
+}
+
+/* FZ_BLEND(s, d, a) = (s * a + d * (256 - a)) >> 8, where neither
+ * product nor the sum overflows 16 bits. */
+PAINT_SIMD_TARGET static inline pv8
+pv_blend(pv8 s, pv8 d, pv16 a)
+{
+	pv16 r = _mm256_add_epi16(_mm256_mullo_epi16(pv_widen(s), a),
+		_mm256_mullo_epi16(pv_widen(d), pv_sub_from(256, a)));
+	return pv_narrow(_mm256_srli_epi16(r, 8));
+}
+
+/* s + FZ_COMBINE(d, t), wrapping as the C does. */
+PAINT_SIMD_TARGET static inline pv8
+pv_over(pv8 s, pv8 d, pv16 t)
+{
+	return _mm_add_epi8(s, pv_narrow(_mm256_srli_epi16(_mm256_mullo_epi16(pv_widen(d), t), 8)));
+}
+
+#else /* FZ_SIMD_NEON */
+
+typedef uint8x16_t pv8; /* 16 bytes */
+typedef uint16x8x2_t pv16; /* 16 bytes widened to 16 bits */
+
+static inline pv8 pv_load(const byte *p) { return vld1q_u8(p); }
+static inline void pv_store(byte *p, pv8 v) { vst1q_u8(p, v); }
+static inline pv8 pv_splat(int v) { return vdupq_n_u8((uint8_t)v); }
+static inline pv8 pv_eq_zero(pv8 v) { return vceqq_u8(v, vdupq_n_u8(0)); }
+static inline pv8 pv_select(pv8 mask, pv8 t, pv8 f) { return vbslq_u8(mask, t, f); }
+
+static inline pv8
+pv_shuffle(pv8 v, const byte *table)
+{
+	pv8 idx = vld1q_u8(table);
+#ifdef __aarch64__
+	return vqtbl1q_u8(v, idx);
+#else
+	uint8x8x2_t t;
+	t.val[0] = vget_low_u8(v);
+	t.val[1] = vget_high_u8(v);
+	return vcombine_u8(vtbl2_u8(t, vget_low_u8(idx)), vtbl2_u8(t, vget_high_u8(idx)));
+#endif
+}
+
+static inline int
+pv_is_zero(pv8 v)
+{
+	uint64x2_t x = vreinterpretq_u64_u8(v);
+	return (vgetq_lane_u64(x, 0) | vgetq_lane_u64(x, 1)) == 0;
+}
+
+static inline pv16
+pv_widen(pv8 v)
+{
+	pv16 r;
+	r.val[0] = vmovl_u8(vget_low_u8(v));
+	r.val[1] = vmovl_u8(vget_high_u8(v));
+	return r;
+}
+
+static inline pv16
+pv_mul(pv16 a, int b)
+{
+	a.val[0] = vmulq_n_u16(a.val[0], (uint16_t)b);
+	a.val[1] = vmulq_n_u16(a.val[1], (uint16_t)b);
+	return a;
+}
+
+static inline pv16
+pv_sub_from(int a, pv16 b)
+{
+	b.val[0] = vsubq_u16(vdupq_n_u16((uint16_t)a), b.val[0]);
+	b.val[1] = vsubq_u16(vdupq_n_u16((uint16_t)a), b.val[1]);
+	return b;
+}
+
+static inline pv8
+pv_load_pixels(const byte *p, int bpp)
+{
+	if (bpp == 1)
+		return pv_load(p);
+	return vcombine_u8(vcreate_u8(paint_simd_mask_bytes(p, bpp)), vdup_n_u8(0));
+}
+
+/* Store just the whole pixels of a block, so that when they do not
+ * fill it the next block's load does not overlap this store (which
+ * would stall until the store was done). */
+static inline void
+pv_store_pixels(byte *p, pv8 v, int bpp)
+{
+	if (16 % bpp == 0)
+		pv_store(p, v);
+	else
+	{
+		vst1_u8(p, vget_low_u8(v));
+		vst1_u8(p + 7, vget_low_u8(vextq_u8(v, v, 7)));
+	}
+}
+
+/* FZ_EXPAND */
+static inline pv16
+pv_expand(pv8 v)
+{
+	pv16 a = pv_widen(v);
+	a.val[0] = vaddq_u16(a.val[0], vshrq_n_u16(a.val[0], 7));
+	a.val[1] = vaddq_u16(a.val[1], vshrq_n_u16(a.val[1], 7));
+	return a;
+}
+
+/* FZ_COMBINE */
+static inline pv16
+pv_combine(pv16 a, int b)
+{
+	a = pv_mul(a, b);
+	a.val[0] = vshrq_n_u16(a.val[0], 8);
+	a.val[1] = vshrq_n_u16(a.val[1], 8);
+	return a;
+}
+
+/* FZ_BLEND(s, d, a) = (s * a + d * (256 - a)) >> 8, where neither
+ * product nor the sum overflows 16 bits. */
+static inline pv8
+pv_blend(pv8 s, pv8 d, pv16 a)
+{
+	pv16 s16 = pv_widen(s);
+	pv16 d16 = pv_widen(d);
+	pv16 na = pv_sub_from(256, a);
+	uint16x8_t lo = vmlaq_u16(vmulq_u16(d16.val[0], na.val[0]), s16.val[0], a.val[0]);
+	uint16x8_t hi = vmlaq_u16(vmulq_u16(d16.val[1], na.val[1]), s16.val[1], a.val[1]);
+	return vcombine_u8(vshrn_n_u16(lo, 8), vshrn_n_u16(hi, 8));
+}
+
+/* s + FZ_COMBINE(d, t), wrapping as the C does. */
+static inline pv8
+pv_over(pv8 s, pv8 d, pv16 t)
+{
+	pv16 d16 = pv_widen(d);
+	uint16x8_t lo = vmulq_u16(d16.val[0], t.val[0]);
+	uint16x8_t hi = vmulq_u16(d16.val[1], t.val[1]);
+	return vaddq_u8(s, vcombine_u8(vshrn_n_u16(lo, 8), vshrn_n_u16(hi, 8)));
+}
+
+#endif /* FZ_SIMD_NEON */
+
+static inline int
+paint_simd_enabled(void)
+{
+	return (fz_cpu_features() & PAINT_SIMD_FEATURES) != 0;
+}
+
+/* Set up a block's worth of copies of a color, with 255 for the alpha
+ * if there is one. */
+PAINT_SIMD_TARGET static inline pv8
+paint_simd_color(const byte * FZ_RESTRICT color, int bpp, int da)
+{
+	byte c[16] = { 0 };
+	int k, n1 = bpp - da;
+	for (k = 0; k < n1; k++)
+		c[k] = color[k];
+	if (da)
+		c[n1] = 255;
+	return pv_shuffle(pv_load(c), paint_simd_comp[bpp]);
+}
+
+/* The kernels below each return the number of pixels that they have
+ * painted, which is always a whole number of blocks. */
+
+/* As template_solid_color_N_sa, for any sa. */
+PAINT_SIMD_TARGET static inline int
+simd_solid_color(byte * FZ_RESTRICT dp, int w, const byte * FZ_RESTRICT color, int bpp, int da, int sa)
+{
+	int i, px = 16 / bpp;
+	pv8 col = paint_simd_color(color, bpp, da);
+	pv16 f = pv_mul(pv_widen(pv_shuffle(pv_splat(1), paint_simd_pixel[bpp])), sa);
+
+	for (i = 0; (w - i) * bpp >= 16; i += px, dp += px * bpp)
+		pv_store_pixels(dp, pv_blend(col, pv_load(dp), f), bpp);
+	return i;
+}
+
+/* As template_span_with_color_N_general. */
+PAINT_SIMD_TARGET static inline int
+simd_span_with_color(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT mp, int w, const byte * FZ_RESTRICT color, int bpp, int da)
+{
+	int i, px = 16 / bpp;
+	int sa = FZ_EXPAND(color[bpp - da]);
+	pv8 col = paint_simd_color(color, bpp, da);
+
+	for (i = 0; (w - i) * bpp >= 16; i += px, dp += px * bpp, mp += px)
+	{
+		pv8 m = pv_load_pixels(mp, bpp);
+		pv16 ma;
+		if (pv_is_zero(m))
+			continue;
+		ma = pv_expand(pv_shuffle(m, paint_simd_pixel[bpp]));
+		if (sa != 256)
+			ma = pv_combine(ma, sa);
+		pv_store_pixels(dp, pv_blend(col, pv_load(dp), ma), bpp);
+	}
+	return i;
+}
+
+/* As template_span_with_mask_N_general, where bpp includes the alpha
+ * (if a). */
+PAINT_SIMD_TARGET static inline int
+simd_span_with_mask(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT sp, const byte * FZ_RESTRICT mp, int w, int bpp, int a)
+{
+	int i, px = 16 / bpp;
+
+	for (i = 0; (w - i) * bpp >= 16; i += px, dp += px * bpp, sp += px * bpp, mp += px)
+	{
+		pv8 m = pv_load_pixels(mp, bpp);
+		pv8 s, ma;
+		if (pv_is_zero(m))
+			continue;
+		s = pv_load(sp);
+		ma = pv_shuffle(m, paint_simd_pixel[bpp]);
+		if (a)
+			ma = pv_select(pv_eq_zero(pv_shuffle(s, paint_simd_alpha[bpp])), pv_splat(0), ma);
+		pv_store_pixels(dp, pv_blend(s, pv_load(dp), pv_expand(ma)), bpp);
+	}
+	return i;
+}
+
+/* As template_span_N_general with both source and destination alpha
+ * (the alpha being included in bpp). */
+PAINT_SIMD_TARGET static inline int
+simd_span_over(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT sp, int w, int bpp)
+{
+	int i, px = 16 / bpp;
+
+	for (i = 0; (w - i) * bpp >= 16; i += px, dp += px * bpp, sp += px * bpp)
+	{
+		pv8 s = pv_load(sp);
+		pv8 sa = pv_shuffle(s, paint_simd_alpha[bpp]);
+		pv8 d;
+		if (pv_is_zero(sa))
+			continue;
+		d = pv_load(dp);
+		pv_store_pixels(dp, pv_select(pv_eq_zero(sa), d, pv_over(s, d, pv_sub_from(256, pv_expand(sa)))), bpp);
+	}
+	return i;
+}
+
+#endif /* PAINT_SIMD */
+
 static inline void
 template_solid_color_3_da(byte * FZ_RESTRICT dp, int n, int w, const byte * FZ_RESTRICT color, int da)
 {
@@ -234,7 +614,7 @@ template_solid_color_4_da(byte * FZ_RESTRICT dp, int n, int w, const byte * FZ_R
 			dp[1] = FZ_BLEND(color[1], dp[1], sa);
 			dp[2] = FZ_BLEND(color[2], dp[2], sa);
 			dp[3] = FZ_BLEND(color[3], dp[3], sa);
-			dp[4] = FZ_BLEND(255, dp[5], sa);
+			dp[4] = FZ_BLEND(255, dp[4], sa);
 			dp += 5;
 		}
 		while (--w);
@@ -571,6 +951,110 @@ static void paint_solid_color_N_da_op(byte * FZ_RESTRICT dp, int n, int w, const
 }
 #endif /* FZ_ENABLE_SPOT_RENDERING */
 
+#ifdef PAINT_SIMD
+#if FZ_PLOTTERS_G
+PAINT_SIMD_TARGET static void
+paint_solid_color_1_simd(byte * FZ_RESTRICT dp, int n, int w, const byte * FZ_RESTRICT color, int da, const fz_overprint * FZ_RESTRICT eop)
+{
+	int sa = FZ_EXPAND(color[1]);
+	int i;
+	TRACK_FN();
+	if (sa == 0)
+		return;
+	i = simd_solid_color(dp, w, color, 1, 0, sa);
+	if (i < w)
+		(sa == 256 ? paint_solid_color_1 : paint_solid_color_1_alpha)(dp + i, n, w - i, color, da, eop);
+}
+
+PAINT_SIMD_TARGET static void
+paint_solid_color_1_da_simd(byte * FZ_RESTRICT dp, int n, int w, const byte * FZ_RESTRICT color, int da, const fz_overprint * FZ_RESTRICT eop)
+{
+	int sa = FZ_EXPAND(color[1]);
+	int i;
+	TRACK_FN();
+	if (sa == 0)
+		return;
+	i = simd_solid_color(dp, w, color, 2, 1, sa);
+	if (i < w)
+		paint_solid_color_1_da(dp + i * 2, n, w - i, color, da, eop);
+}
+#endif /* FZ_PLOTTERS_G */
+
+#if FZ_PLOTTERS_RGB
+PAINT_SIMD_TARGET static void
+paint_solid_color_3_simd(byte * FZ_RESTRICT dp, int n, int w, const byte * FZ_RESTRICT color, int da, const fz_overprint * FZ_RESTRICT eop)
+{
+	int sa = FZ_EXPAND(color[3]);
+	int i;
+	TRACK_FN();
+	if (sa == 0)
+		return;
+	i = simd_solid_color(dp, w, color, 3, 0, sa);
+	if (i < w)
+		(sa == 256 ? paint_solid_color_3 : paint_solid_color_3_alpha)(dp + i * 3, n, w - i, color, da, eop);
+}
+
+PAINT_SIMD_TARGET static void
+paint_solid_color_3_da_simd(byte * FZ_RESTRICT dp, int n, int w, const byte * FZ_RESTRICT color, int da, const fz_overprint * FZ_RESTRICT eop)
+{
+	int sa = FZ_EXPAND(color[3]);
+	int i;
+	TRACK_FN();
+	if (sa == 0)
+		return;
+	i = simd_solid_color(dp, w, color, 4, 1, sa);
+	if (i < w)
+		paint_solid_color_3_da(dp + i * 4, n, w - i, color, da, eop);
+}
+#endif /* FZ_PLOTTERS_RGB */
+
+#if FZ_PLOTTERS_CMYK
+PAINT_SIMD_TARGET static void
+paint_solid_color_4_simd(byte * FZ_RESTRICT dp, int n, int w, const byte * FZ_RESTRICT color, int da, const fz_overprint * FZ_RESTRICT eop)
+{
+	int sa = FZ_EXPAND(color[4]);
+	int i;
+	TRACK_FN();
+	if (sa == 0)
+		return;
+	i = simd_solid_color(dp, w, color, 4, 0, sa);
+	if (i < w)
+		(sa == 256 ? paint_solid_color_4 : paint_solid_color_4_alpha)(dp + i * 4, n, w - i, color, da, eop);
+}
+
+PAINT_SIMD_TARGET static void
+paint_solid_color_4_da_simd(byte * FZ_RESTRICT dp, int n, int w, const byte * FZ_RESTRICT color, int da, const fz_overprint * FZ_RESTRICT eop)
+{
+	int sa = FZ_EXPAND(color[4]);
+	int i;
+	TRACK_FN();
+	if (sa == 0)
+		return;
+	i = simd_solid_color(dp, w, color, 5, 1, sa);
+	if (i < w)
+		paint_solid_color_4_da(dp + i * 5, n, w - i, color, da, eop);
+}
+#endif /* FZ_PLOTTERS_CMYK */
+
+static fz_solid_color_painter_t *
+simd_solid_color_painter(int n, int da)
+{
+	switch (n - da)
+	{
+#if FZ_PLOTTERS_G
+	case 1: return da ? paint_solid_color_1_da_simd : paint_solid_color_1_simd;
+#endif /* FZ_PLOTTERS_G */
+#if FZ_PLOTTERS_RGB
+	case 3: return da ? paint_solid_color_3_da_simd : paint_solid_color_3_simd;
+#endif /* FZ_PLOTTERS_RGB */
+#if FZ_PLOTTERS_CMYK
+	case 4: return da ? paint_solid_color_4_da_simd : paint_solid_color_4_simd;
+#endif /* FZ_PLOTTERS_CMYK */
+	}
+	return NULL;
+}
+#endif /* PAINT_SIMD */
+
 fz_solid_color_painter_t *
 fz_get_solid_color_painter(int n, const byte * FZ_RESTRICT color, int da, const fz_overprint * FZ_RESTRICT eop)
 {
@@ -585,6 +1069,14 @@ fz_get_solid_color_painter(int n, const byte * FZ_RESTRICT color, int da, const
 			return paint_solid_color_N_alpha_op;
 	}
 #endif /* FZ_ENABLE_SPOT_RENDERING */
+#ifdef PAINT_SIMD
+	if (paint_simd_enabled())
+	{
+		fz_solid_color_painter_t *fn = simd_solid_color_painter(n, da);
+		if (fn)
+			return fn;
+	}
+#endif /* PAINT_SIMD */
 	switch (n-da)
 	{
 		case 0:
@@ -993,6 +1485,99 @@ paint_span_with_color_N_da_op(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT mp
 }
 #endif /* FZ_ENABLE_SPOT_RENDERING */
 
+#ifdef PAINT_SIMD
+PAINT_SIMD_TARGET static void
+paint_span_with_color_0_da_simd(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT mp, int n, int w, const byte * FZ_RESTRICT color, int da, const fz_overprint * FZ_RESTRICT eop)
+{
+	int i;
+	TRACK_FN();
+	i = simd_span_with_color(dp, mp, w, color, 1, 1);
+	if (i < w)
+		paint_span_with_color_0_da(dp + i, mp + i, n, w - i, color, da, eop);
+}
+
+PAINT_SIMD_TARGET static void
+paint_span_with_color_1_simd(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT mp, int n, int w, const byte * FZ_RESTRICT color, int da, const fz_overprint * FZ_RESTRICT eop)
+{
+	int i;
+	TRACK_FN();
+	i = simd_span_with_color(dp, mp, w, color, 1, 0);
+	if (i < w)
+		paint_span_with_color_1(dp + i, mp + i, n, w - i, color, da, eop);
+}
+
+PAINT_SIMD_TARGET static void
+paint_span_with_color_1_da_simd(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT mp, int n, int w, const byte * FZ_RESTRICT color, int da, const fz_overprint * FZ_RESTRICT eop)
+{
+	int i;
+	TRACK_FN();
+	i = simd_span_with_color(dp, mp, w, color, 2, 1);
+	if (i < w)
+		paint_span_with_color_1_da(dp + i * 2, mp + i, n, w - i, color, da, eop);
+}
+
+#if FZ_PLOTTERS_RGB
+PAINT_SIMD_TARGET static void
+paint_span_with_color_3_simd(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT mp, int n, int w, const byte * FZ_RESTRICT color, int da, const fz_overprint * FZ_RESTRICT eop)
+{
+	int i;
+	TRACK_FN();
+	i = simd_span_with_color(dp, mp, w, color, 3, 0);
+	if (i < w)
+		paint_span_with_color_3(dp + i * 3, mp + i, n, w - i, color, da, eop);
+}
+
+PAINT_SIMD_TARGET static void
+paint_span_with_color_3_da_simd(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT mp, int n, int w, const byte * FZ_RESTRICT color, int da, const fz_overprint * FZ_RESTRICT eop)
+{
+	int i;
+	TRACK_FN();
+	i = simd_span_with_color(dp, mp, w, color, 4, 1);
+	if (i < w)
+		paint_span_with_color_3_da(dp + i * 4, mp + i, n, w - i, color, da, eop);
+}
+#endif /* FZ_PLOTTERS_RGB */
+
+#if FZ_PLOTTERS_CMYK
+PAINT_SIMD_TARGET static void
+paint_span_with_color_4_simd(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT mp, int n, int w, const byte * FZ_RESTRICT color, int da, const fz_overprint * FZ_RESTRICT eop)
+{
+	int i;
+	TRACK_FN();
+	i = simd_span_with_color(dp, mp, w, color, 4, 0);
+	if (i < w)
+		paint_span_with_color_4(dp + i * 4, mp + i, n, w - i, color, da, eop);
+}
+
+PAINT_SIMD_TARGET static void
+paint_span_with_color_4_da_simd(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT mp, int n, int w, const byte * FZ_RESTRICT color, int da, const fz_overprint * FZ_RESTRICT eop)
+{
+	int i;
+	TRACK_FN();
+	i = simd_span_with_color(dp, mp, w, color, 5, 1);
+	if (i < w)
+		paint_span_with_color_4_da(dp + i * 5, mp + i, n, w - i, color, da, eop);
+}
+#endif /* FZ_PLOTTERS_CMYK */
+
+static fz_span_color_painter_t *
+simd_span_color_painter(int n, int da)
+{
+	switch (n - da)
+	{
+	case 0: return da ? paint_span_with_color_0_da_simd : NULL;
+	case 1: return da ? paint_span_with_color_1_da_simd : paint_span_with_color_1_simd;
+#if FZ_PLOTTERS_RGB
+	case 3: return da ? paint_span_with_color_3_da_simd : paint_span_with_color_3_simd;
+#endif /* FZ_PLOTTERS_RGB */
+#if FZ_PLOTTERS_CMYK
+	case 4: return da ? paint_span_with_color_4_da_simd : paint_span_with_color_4_simd;
+#endif /* FZ_PLOTTERS_CMYK */
+	}
+	return NULL;
+}
+#endif /* PAINT_SIMD */
+
 fz_span_color_painter_t *
 fz_get_span_color_painter(int n, int da, const byte * FZ_RESTRICT color, const fz_overprint * FZ_RESTRICT eop)
 {
@@ -1002,6 +1587,14 @@ fz_get_span_color_painter(int n, int da, const byte * FZ_RESTRICT color, const f
 		return da ? paint_span_with_color_N_da_op : paint_span_with_color_N_op;
 	}
 #endif /* FZ_ENABLE_SPOT_RENDERING */
+#ifdef PAINT_SIMD
+	if (paint_simd_enabled())
+	{
+		fz_span_color_painter_t *fn = simd_span_color_painter(n, da);
+		if (fn)
+			return fn;
+	}
+#endif /* PAINT_SIMD */
 	switch(n-da)
 	{
 	case 0: return da ? paint_span_with_color_0_da : NULL;
@@ -1288,9 +1881,99 @@ paint_span_with_mask_N(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT sp, const
 
 typedef void (fz_span_mask_painter_t)(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT sp, const byte * FZ_RESTRICT mp, int w, int n, int a, const fz_overprint * FZ_RESTRICT eop);
 
+#ifdef PAINT_SIMD
+PAINT_SIMD_TARGET static void
+paint_span_with_mask_1_simd(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT sp, const byte * FZ_RESTRICT mp, int w, int n, int a, const fz_overprint * FZ_RESTRICT eop)
+{
+	int i;
+	TRACK_FN();
+	i = simd_span_with_mask(dp, sp, mp, w, 1, 0);
+	if (i < w)
+		paint_span_with_mask_1(dp + i, sp + i, mp + i, w - i, n, a, eop);
+}
+
+PAINT_SIMD_TARGET static void
+paint_span_with_mask_1_a_simd(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT sp, const byte * FZ_RESTRICT mp, int w, int n, int a, const fz_overprint * FZ_RESTRICT eop)
+{
+	int i;
+	TRACK_FN();
+	i = simd_span_with_mask(dp, sp, mp, w, 2, 1);
+	if (i < w)
+		paint_span_with_mask_1_a(dp + i * 2, sp + i * 2, mp + i, w - i, n, a, eop);
+}
+
+#if FZ_PLOTTERS_RGB
+PAINT_SIMD_TARGET static void
+paint_span_with_mask_3_simd(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT sp, const byte * FZ_RESTRICT mp, int w, int n, int a, const fz_overprint * FZ_RESTRICT eop)
+{
+	int i;
+	TRACK_FN();
+	i = simd_span_with_mask(dp, sp, mp, w, 3, 0);
+	if (i < w)
+		paint_span_with_mask_3(dp + i * 3, sp + i * 3, mp + i, w - i, n, a, eop);
+}
+
+PAINT_SIMD_TARGET static void
+paint_span_with_mask_3_a_simd(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT sp, const byte * FZ_RESTRICT mp, int w, int n, int a, const fz_overprint * FZ_RESTRICT eop)
+{
+	int i;
+	TRACK_FN();
+	i = simd_span_with_mask(dp, sp, mp, w, 4, 1);
+	if (i < w)
+		paint_span_with_mask_3_a(dp + i * 4, sp + i * 4, mp + i, w - i, n, a, eop);
+}
+#endif /* FZ_PLOTTERS_RGB */
+
+#if FZ_PLOTTERS_CMYK
+PAINT_SIMD_TARGET static void
+paint_span_with_mask_4_simd(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT sp, const byte * FZ_RESTRICT mp, int w, int n, int a, const fz_overprint * FZ_RESTRICT eop)
+{
+	int i;
+	TRACK_FN();
+	i = simd_span_with_mask(dp, sp, mp, w, 4, 0);
+	if (i < w)
+		paint_span_with_mask_4(dp + i * 4, sp + i * 4, mp + i, w - i, n, a, eop);
+}
+
+PAINT_SIMD_TARGET static void
+paint_span_with_mask_4_a_simd(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT sp, const byte * FZ_RESTRICT mp, int w, int n, int a, const fz_overprint * FZ_RESTRICT eop)
+{
+	int i;
+	TRACK_FN();
+	i = simd_span_with_mask(dp, sp, mp, w, 5, 1);
+	if (i < w)
+		paint_span_with_mask_4_a(dp + i * 5, sp + i * 5, mp + i, w - i, n, a, eop);
+}
+#endif /* FZ_PLOTTERS_CMYK */
+
+static fz_span_mask_painter_t *
+simd_span_mask_painter(int a, int n)
+{
+	switch (n)
+	{
+	case 1: return a ? paint_span_with_mask_1_a_simd : paint_span_with_mask_1_simd;
+#if FZ_PLOTTERS_RGB
+	case 3: return a ? paint_span_with_mask_3_a_simd : paint_span_with_mask_3_simd;
+#endif /* FZ_PLOTTERS_RGB */
+#if FZ_PLOTTERS_CMYK
+	case 4: return a ? paint_span_with_mask_4_a_simd : paint_span_with_mask_4_simd;
+#endif /* FZ_PLOTTERS_CMYK */
+	}
+	return NULL;
+}
+#endif /* PAINT_SIMD */
+
 static fz_span_mask_painter_t *
 fz_get_span_mask_painter(int a, int n)
 {
+#ifdef PAINT_SIMD
+	if (paint_simd_enabled())
+	{
+		fz_span_mask_painter_t *fn = simd_span_mask_painter(a, n);
+		if (fn)
+			return fn;
+	}
+#endif /* PAINT_SIMD */
 	switch(n)
 	{
 		case 0:
@@ -1974,6 +2657,73 @@ paint_span_N_general_alpha_op(byte * FZ_RESTRICT dp, int da, const byte * FZ_RES
 }
 #endif /* FZ_ENABLE_SPOT_RENDERING */
 
+#ifdef PAINT_SIMD
+PAINT_SIMD_TARGET static void
+paint_span_0_da_sa_simd(byte * FZ_RESTRICT dp, int da, const byte * FZ_RESTRICT sp, int sa, int n, int w, int alpha, const fz_overprint * FZ_RESTRICT eop)
+{
+	int i;
+	TRACK_FN();
+	i = simd_span_over(dp, sp, w, 1);
+	if (i < w)
+		paint_span_0_da_sa(dp + i, da, sp + i, sa, n, w - i, alpha, eop);
+}
+
+PAINT_SIMD_TARGET static void
+paint_span_1_da_sa_simd(byte * FZ_RESTRICT dp, int da, const byte * FZ_RESTRICT sp, int sa, int n, int w, int alpha, const fz_overprint * FZ_RESTRICT eop)
+{
+	int i;
+	TRACK_FN();
+	i = simd_span_over(dp, sp, w, 2);
+	if (i < w)
+		paint_span_1_da_sa(dp + i * 2, da, sp + i * 2, sa, n, w - i, alpha, eop);
+}
+
+#if FZ_PLOTTERS_RGB
+PAINT_SIMD_TARGET static void
+paint_span_3_da_sa_simd(byte * FZ_RESTRICT dp, int da, const byte * FZ_RESTRICT sp, int sa, int n, int w, int alpha, const fz_overprint * FZ_RESTRICT eop)
+{
+	int i;
+	TRACK_FN();
+	i = simd_span_over(dp, sp, w, 4);
+	if (i < w)
+		paint_span_3_da_sa(dp + i * 4, da, sp + i * 4, sa, n, w - i, alpha, eop);
+}
+#endif /* FZ_PLOTTERS_RGB */
+
+#if FZ_PLOTTERS_CMYK
+PAINT_SIMD_TARGET static void
+paint_span_4_da_sa_simd(byte * FZ_RESTRICT dp, int da, const byte * FZ_RESTRICT sp, int sa, int n, int w, int alpha, const fz_overprint * FZ_RESTRICT eop)
+{
+	int i;
+	TRACK_FN();
+	i = simd_span_over(dp, sp, w, 5);
+	if (i < w)
+		paint_span_4_da_sa(dp + i * 5, da, sp + i * 5, sa, n, w - i, alpha, eop);
+}
+#endif /* FZ_PLOTTERS_CMYK */
+
+/* Only the commonest case of all, compositing with alpha throughout, is
+ * done with SIMD. */
+static fz_span_painter_t *
+simd_span_painter(int da, int sa, int n, int alpha)
+{
+	if (!da || !sa || alpha != 255)
+		return NULL;
+	switch (n)
+	{
+	case 0: return paint_span_0_da_sa_simd;
+	case 1: return paint_span_1_da_sa_simd;
+#if FZ_PLOTTERS_RGB
+	case 3: return paint_span_3_da_sa_simd;
+#endif /* FZ_PLOTTERS_RGB */
+#if FZ_PLOTTERS_CMYK
+	case 4: return paint_span_4_da_sa_simd;
+#endif /* FZ_PLOTTERS_CMYK */
+	}
+	return NULL;
+}
+#endif /* PAINT_SIMD */
+
 fz_span_painter_t *
 fz_get_span_painter(int da, int sa, int n, int alpha, const fz_overprint * FZ_RESTRICT eop)
 {
@@ -1988,6 +2738,14 @@ fz_get_span_painter(int da, int sa, int n, int alpha, const fz_overprint * FZ_RE
 			return NULL;
 	}
 #endif /* FZ_ENABLE_SPOT_RENDERING */
+#ifdef PAINT_SIMD
+	if (paint_simd_enabled())
+	{
+		fz_span_painter_t *fn = simd_span_painter(da, sa, n, alpha);
+		if (fn)
+			return fn;
+	}
+#endif /* PAINT_SIMD */
 	switch (n)
 	{
 	case 0:
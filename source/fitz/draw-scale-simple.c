@@ -14,6 +14,7 @@ intermediate results rather than ints.
 
 #include "draw-imp.h"
 #include "pixmap-imp.h"
+#include "simd-imp.h"
 
 #include <math.h>
 #include <string.h>
@@ -1257,6 +1258,393 @@ scale_row_from_temp_alpha(unsigned char * FZ_RESTRICT dst, const unsigned char *
 }
 #endif
 
+/*
+	SIMD versions of the row scalers.
+
+	scale_row_to_temp_simd takes the source pixels for each output
+	pixel 8 bytes at a time (8 taps of gray, 4 of gray+alpha, 2 of RGB
+	or RGBA/CMYK), multiplies them by their weights in 32 bit lanes
+	and adds the lanes together at the end. The last block of a pixel
+	masks off the weights beyond its last tap. Blocks may read source
+	bytes beyond a pixel's taps, but never beyond the furthest tap of
+	any pixel in the row.
+
+	scale_row_from_temp_simd works 16 bytes along the row at a time,
+	running down the temp rows with each weight in turn.
+
+	The sums are the same integer sums as in the C, so the results are
+	identical. The weights from the filters here are never more than
+	a few hundred, so they fit in 16 bits.
+*/
+
+#if defined(FZ_SIMD_X86)
+#define SCALE_SIMD
+#define SCALE_SIMD_TARGET FZ_SIMD_TARGET("avx2")
+#define SCALE_SIMD_FEATURES FZ_CPU_AVX2
+#elif defined(FZ_SIMD_NEON)
+#define SCALE_SIMD
+#define SCALE_SIMD_TARGET
+#define SCALE_SIMD_FEATURES FZ_CPU_NEON
+#endif
+
+#ifdef SCALE_SIMD
+
+/* How far into a source row the taps of any output pixel go. */
+static inline int
+scale_simd_extent(const fz_weights *weights)
+{
+	int i, e, extent = 0;
+
+	for (i = 0; i < weights->count; i++)
+	{
+		const int *contrib = &weights->index[weights->index[i]];
+		e = contrib[0] + contrib[1];
+		if (extent < e)
+			extent = e;
+	}
+	return extent;
+}
+
+#ifdef FZ_SIMD_X86
+
+/* Move the 2 RGB pixels of a block into 4 byte slots. */
+static const unsigned char scale_simd_rgb[16] = { 0, 1, 2, 0x80, 3, 4, 5, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 };
+
+/* Spread the weights of a block out over the components they apply to. */
+static const int scale_simd_spread[5][8] = {
+	{ 0 },
+	{ 0, 1, 2, 3, 4, 5, 6, 7 },
+	{ 0, 0, 1, 1, 2, 2, 3, 3 },
+	{ 0, 0, 0, 0, 1, 1, 1, 1 },
+	{ 0, 0, 0, 0, 1, 1, 1, 1 }
+};
+
+SCALE_SIMD_TARGET static FZ_SIMD_INLINE void
+scale_simd_to_temp(unsigned char * FZ_RESTRICT dst, const unsigned char * FZ_RESTRICT src, const fz_weights * FZ_RESTRICT weights, int n)
+{
+	const int *contrib = &weights->index[weights->index[0]];
+	const __m256i spread = _mm256_loadu_si256((const __m256i *)scale_simd_spread[n]);
+	const __m128i rgb = _mm_loadu_si128((const __m128i *)scale_simd_rgb);
+	const unsigned char *end = src + n * scale_simd_extent(weights);
+	int taps = n == 3 ? 2 : 8 / n;
+	int step = n;
+	int i, j, k, len;
+	int t[4];
+
+	if (weights->flip)
+	{
+		dst += (weights->count-1)*n;
+		step = -n;
+	}
+	for (i = weights->count; i > 0; i--)
+	{
+		const unsigned char *min = &src[n * *contrib++];
+		__m256i acc = _mm256_setzero_si256();
+		__m256i s, w;
+		__m128i x;
+
+		len = *contrib++;
+		for (k = 0; k < len && min + 8 <= end; k += taps)
+		{
+			x = _mm_loadl_epi64((const __m128i *)min);
+			if (n == 3)
+				x = _mm_shuffle_epi8(x, rgb);
+			s = _mm256_cvtepu8_epi32(x);
+			if (n == 1)
+				w = _mm256_loadu_si256((const __m256i *)contrib);
+			else if (n == 2)
+				w = _mm256_permutevar8x32_epi32(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)contrib)), spread);
+			else
+				w = _mm256_permutevar8x32_epi32(_mm256_castsi128_si256(_mm_loadl_epi64((const __m128i *)contrib)), spread);
+			if (len - k < taps)
+			{
+				/* The last few taps: drop the ones beyond the end
+				 * (the weights there belong to the next pixel). */
+				w = _mm256_and_si256(w, _mm256_cmpgt_epi32(_mm256_set1_epi32(len - k), spread));
+				min += (len - k) * n;
+				contrib += len - k;
+				k = len;
+			}
+			else
+			{
+				min += taps * n;
+				contrib += taps;
+			}
+			acc = _mm256_add_epi32(acc, _mm256_mullo_epi32(s, w));
+		}
+		x = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+		if (n <= 2)
+			x = _mm_add_epi32(x, _mm_shuffle_epi32(x, 0x4e));
+		if (n == 1)
+			x = _mm_add_epi32(x, _mm_shuffle_epi32(x, 0xb1));
+		_mm_storeu_si128((__m128i *)t, x);
+		for (; k < len; k++)
+		{
+			for (j = 0; j < n; j++)
+				t[j] += *min++ * *contrib;
+			contrib++;
+		}
+		for (j = 0; j < n; j++)
+			dst[j] = (unsigned char)((t[j] + 128)>>8);
+		dst += step;
+	}
+}
+
+/* 16 bytes of an output row. */
+SCALE_SIMD_TARGET static FZ_SIMD_INLINE __m128i
+scale_simd_from_temp16(const unsigned char * FZ_RESTRICT src, const int * FZ_RESTRICT contrib, int len, int width)
+{
+	__m256i lo = _mm256_set1_epi32(128);
+	__m256i hi = lo;
+	__m256i a, b, w, mask = _mm256_set1_epi32(255);
+	int k;
+
+	/* Take the rows in pairs, interleaved, with the pair of weights
+	 * in each 32 bit lane, so each pair is one multiply-add. */
+	for (k = 0; k + 1 < len; k += 2)
+	{
+		a = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)src));
+		b = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(src + width)));
+		w = _mm256_set1_epi32((contrib[k] & 0xffff) | ((unsigned int)contrib[k+1] << 16));
+		lo = _mm256_add_epi32(lo, _mm256_madd_epi16(_mm256_unpacklo_epi16(a, b), w));
+		hi = _mm256_add_epi32(hi, _mm256_madd_epi16(_mm256_unpackhi_epi16(a, b), w));
+		src += 2 * width;
+	}
+	if (k < len)
+	{
+		a = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)src));
+		w = _mm256_set1_epi32(contrib[k] & 0xffff);
+		b = _mm256_setzero_si256();
+		lo = _mm256_add_epi32(lo, _mm256_madd_epi16(_mm256_unpacklo_epi16(a, b), w));
+		hi = _mm256_add_epi32(hi, _mm256_madd_epi16(_mm256_unpackhi_epi16(a, b), w));
+	}
+	lo = _mm256_and_si256(_mm256_srai_epi32(lo, 8), mask);
+	hi = _mm256_and_si256(_mm256_srai_epi32(hi, 8), mask);
+	a = _mm256_packus_epi32(lo, hi);
+	a = _mm256_packus_epi16(a, a);
+	return _mm256_castsi256_si128(_mm256_permute4x64_epi64(a, 0x08));
+}
+
+#define scale_simd_store16(p, x) _mm_storeu_si128((__m128i *)(p), x)
+
+#else /* FZ_SIMD_NEON */
+
+static const unsigned char scale_simd_rgb[8] = { 0, 1, 2, 8, 3, 4, 5, 8 };
+
+/* The tap that each lane of the two halves of a block belongs to. */
+static const int scale_simd_spread[5][8] = {
+	{ 0 },
+	{ 0, 1, 2, 3, 4, 5, 6, 7 },
+	{ 0, 0, 1, 1, 2, 2, 3, 3 },
+	{ 0, 0, 0, 0, 1, 1, 1, 1 },
+	{ 0, 0, 0, 0, 1, 1, 1, 1 }
+};
+
+static FZ_SIMD_INLINE void
+scale_simd_to_temp(unsigned char * FZ_RESTRICT dst, const unsigned char * FZ_RESTRICT src, const fz_weights * FZ_RESTRICT weights, int n)
+{
+	const int *contrib = &weights->index[weights->index[0]];
+	const uint8x8_t rgb = vld1_u8(scale_simd_rgb);
+	const int32x4_t spread0 = vld1q_s32(scale_simd_spread[n]);
+	const int32x4_t spread1 = vld1q_s32(scale_simd_spread[n] + 4);
+	const unsigned char *end = src + n * scale_simd_extent(weights);
+	int taps = n == 3 ? 2 : 8 / n;
+	int step = n;
+	int i, j, k, len;
+	int t[4];
+
+	if (weights->flip)
+	{
+		dst += (weights->count-1)*n;
+		step = -n;
+	}
+	for (i = weights->count; i > 0; i--)
+	{
+		const unsigned char *min = &src[n * *contrib++];
+		int32x4_t acc0 = vdupq_n_s32(0);
+		int32x4_t acc1 = acc0;
+
+		len = *contrib++;
+		for (k = 0; k < len && min + 8 <= end; k += taps)
+		{
+			uint8x8_t s8 = vld1_u8(min);
+			int16x8_t s;
+			int32x4_t w0, w1;
+
+			if (n == 3)
+				s8 = vtbl1_u8(s8, rgb);
+			s = vreinterpretq_s16_u16(vmovl_u8(s8));
+			if (n == 1)
+			{
+				w0 = vld1q_s32(contrib);
+				w1 = vld1q_s32(contrib + 4);
+			}
+			else if (n == 2)
+			{
+				int32x4_t q = vld1q_s32(contrib);
+				int32x4x2_t z = vzipq_s32(q, q);
+				w0 = z.val[0];
+				w1 = z.val[1];
+			}
+			else
+			{
+				w0 = vdupq_n_s32(contrib[0]);
+				w1 = vdupq_n_s32(contrib[1]);
+			}
+			if (len - k < taps)
+			{
+				/* The last few taps: drop the ones beyond the end
+				 * (the weights there belong to the next pixel). */
+				int32x4_t r = vdupq_n_s32(len - k);
+				w0 = vandq_s32(w0, vreinterpretq_s32_u32(vcltq_s32(spread0, r)));
+				w1 = vandq_s32(w1, vreinterpretq_s32_u32(vcltq_s32(spread1, r)));
+				min += (len - k) * n;
+				contrib += len - k;
+				k = len;
+			}
+			else
+			{
+				min += taps * n;
+				contrib += taps;
+			}
+			acc0 = vmlaq_s32(acc0, vmovl_s16(vget_low_s16(s)), w0);
+			acc1 = vmlaq_s32(acc1, vmovl_s16(vget_high_s16(s)), w1);
+		}
+		vst1q_s32(t, vaddq_s32(acc0, acc1));
+		if (n == 1)
+			t[0] += t[1] + t[2] + t[3];
+		else if (n == 2)
+		{
+			t[0] += t[2];
+			t[1] += t[3];
+		}
+		for (; k < len; k++)
+		{
+			for (j = 0; j < n; j++)
+				t[j] += *min++ * *contrib;
+			contrib++;
+		}
+		for (j = 0; j < n; j++)
+			dst[j] = (unsigned char)((t[j] + 128)>>8);
+		dst += step;
+	}
+}
+
+static FZ_SIMD_INLINE uint8x16_t
+scale_simd_from_temp16(const unsigned char * FZ_RESTRICT src, const int * FZ_RESTRICT contrib, int len, int width)
+{
+	int32x4_t a0 = vdupq_n_s32(128);
+	int32x4_t a1 = a0, a2 = a0, a3 = a0;
+	int32x4_t mask = vdupq_n_s32(255);
+	int k;
+
+	for (k = 0; k < len; k++)
+	{
+		uint8x16_t s = vld1q_u8(src);
+		int16x8_t lo = vreinterpretq_s16_u16(vmovl_u8(vget_low_u8(s)));
+		int16x8_t hi = vreinterpretq_s16_u16(vmovl_u8(vget_high_u8(s)));
+		int16_t w = (int16_t)contrib[k];
+		a0 = vmlal_n_s16(a0, vget_low_s16(lo), w);
+		a1 = vmlal_n_s16(a1, vget_high_s16(lo), w);
+		a2 = vmlal_n_s16(a2, vget_low_s16(hi), w);
+		a3 = vmlal_n_s16(a3, vget_high_s16(hi), w);
+		src += width;
+	}
+	a0 = vandq_s32(vshrq_n_s32(a0, 8), mask);
+	a1 = vandq_s32(vshrq_n_s32(a1, 8), mask);
+	a2 = vandq_s32(vshrq_n_s32(a2, 8), mask);
+	a3 = vandq_s32(vshrq_n_s32(a3, 8), mask);
+	return vcombine_u8(
+		vmovn_u16(vcombine_u16(vmovn_u32(vreinterpretq_u32_s32(a0)), vmovn_u32(vreinterpretq_u32_s32(a1)))),
+		vmovn_u16(vcombine_u16(vmovn_u32(vreinterpretq_u32_s32(a2)), vmovn_u32(vreinterpretq_u32_s32(a3)))));
+}
+
+#define scale_simd_store16(p, x) vst1q_u8(p, x)
+
+#endif
+
+/* Fewer taps per pixel than this are quicker in the C. The last block
+ * of a pixel may read up to 7 weights beyond its own, which is only
+ * safe within the spare room that new_weights leaves if there are at
+ * least 4 taps. */
+#define SCALE_SIMD_MIN_TAPS 4
+
+SCALE_SIMD_TARGET static void
+scale_row_to_temp1_simd(unsigned char * FZ_RESTRICT dst, const unsigned char * FZ_RESTRICT src, const fz_weights * FZ_RESTRICT weights)
+{
+	scale_simd_to_temp(dst, src, weights, 1);
+}
+
+SCALE_SIMD_TARGET static void
+scale_row_to_temp2_simd(unsigned char * FZ_RESTRICT dst, const unsigned char * FZ_RESTRICT src, const fz_weights * FZ_RESTRICT weights)
+{
+	scale_simd_to_temp(dst, src, weights, 2);
+}
+
+SCALE_SIMD_TARGET static void
+scale_row_to_temp3_simd(unsigned char * FZ_RESTRICT dst, const unsigned char * FZ_RESTRICT src, const fz_weights * FZ_RESTRICT weights)
+{
+	scale_simd_to_temp(dst, src, weights, 3);
+}
+
+SCALE_SIMD_TARGET static void
+scale_row_to_temp4_simd(unsigned char * FZ_RESTRICT dst, const unsigned char * FZ_RESTRICT src, const fz_weights * FZ_RESTRICT weights)
+{
+	scale_simd_to_temp(dst, src, weights, 4);
+}
+
+SCALE_SIMD_TARGET static void
+scale_row_from_temp_simd(unsigned char * FZ_RESTRICT dst, const unsigned char * FZ_RESTRICT src, const fz_weights * FZ_RESTRICT weights, int w, int n, int row)
+{
+	const int *contrib = &weights->index[weights->index[row]];
+	int len, x;
+	int width = w * n;
+
+	contrib++; /* Skip min */
+	len = *contrib++;
+	for (x = 0; x + 16 <= width; x += 16)
+		scale_simd_store16(dst + x, scale_simd_from_temp16(src + x, contrib, len, width));
+	for (; x < width; x++)
+	{
+		const unsigned char *min = src + x;
+		int val = 128;
+		int k;
+
+		for (k = 0; k < len; k++)
+		{
+			val += *min * contrib[k];
+			min += width;
+		}
+		dst[x] = (unsigned char)(val>>8);
+	}
+}
+
+SCALE_SIMD_TARGET static void
+scale_row_from_temp_alpha_simd(unsigned char * FZ_RESTRICT dst, const unsigned char * FZ_RESTRICT src, const fz_weights * FZ_RESTRICT weights, int w, int n, int row)
+{
+	unsigned char *s = dst + w;
+	int x, j;
+
+	/* Scale into the last w*n bytes of the row, then move the pixels
+	 * down to make room for the alphas. Each pixel moves down by less
+	 * than the distance to the next one still to be read. */
+	scale_row_from_temp_simd(s, src, weights, w, n, row);
+	for (x = w; x > 0; x--)
+	{
+		for (j = n; j > 0; j--)
+			*dst++ = *s++;
+		*dst++ = 255;
+	}
+}
+
+static inline int
+scale_simd_enabled(void)
+{
+	return (fz_cpu_features() & SCALE_SIMD_FEATURES) != 0;
+}
+
+#endif /* SCALE_SIMD */
+
 #ifdef SINGLE_PIXEL_SPECIALS
 static void
 duplicate_single_pixel(unsigned char * FZ_RESTRICT dst, const unsigned char * FZ_RESTRICT src, int n, int forcealpha, int w, int h, int stride)
@@ -1523,21 +1911,76 @@ adjust_alpha_edges(fz_pixmap * FZ_RESTRICT pix, const fz_weights * FZ_RESTRICT r
 	}
 }
 
-fz_pixmap *
-fz_scale_pixmap(fz_context *ctx, fz_pixmap *src, float x, float y, float w, float h, const fz_irect *clip)
+/* The least number of output rows worth giving a thread of its own. */
+#define SCALE_MIN_JOB_ROWS 16
+
+typedef void (scale_row_in_fn)(unsigned char * FZ_RESTRICT dst, const unsigned char * FZ_RESTRICT src, const fz_weights * FZ_RESTRICT weights);
+typedef void (scale_row_out_fn)(unsigned char * FZ_RESTRICT dst, const unsigned char * FZ_RESTRICT src, const fz_weights * FZ_RESTRICT weights, int w, int n, int row);
+
+/* A range of output rows, scaled with a temporary buffer of its own. */
+typedef struct
+{
+	const fz_pixmap *src;
+	fz_pixmap *output;
+	const fz_weights *rows;
+	const fz_weights *cols;
+	scale_row_in_fn *row_scale_in;
+	scale_row_out_fn *row_scale_out;
+	int flip_y;
+	unsigned char *temp;
+	int temp_span;
+	int temp_rows;
+	int row0, row1;
+} scale_job;
+
+static void
+scale_rows(const scale_job *job)
 {
-	return fz_scale_pixmap_cached(ctx, src, x, y, w, h, clip, NULL, NULL);
+	const fz_pixmap *src = job->src;
+	const fz_weights *contrib_rows = job->rows;
+	unsigned char *temp = job->temp;
+	int temp_span = job->temp_span;
+	int temp_rows = job->temp_rows;
+	int row, max_row;
+
+	max_row = contrib_rows->index[contrib_rows->index[job->row0]];
+	for (row = job->row0; row < job->row1; row++)
+	{
+		/*
+		Which source rows do we need to have scaled into the
+		temporary buffer in order to be able to do the final
+		scale?
+		*/
+		int row_index = contrib_rows->index[row];
+		int row_min = contrib_rows->index[row_index++];
+		int row_len = contrib_rows->index[row_index];
+		while (max_row < row_min+row_len)
+		{
+			/* Scale another row */
+			assert(max_row < src->h);
+			(*job->row_scale_in)(&temp[temp_span*(max_row % temp_rows)], &src->samples[(job->flip_y ? (src->h-1-max_row): max_row)*src->stride], job->cols);
+			max_row++;
+		}
+
+		(*job->row_scale_out)(&job->output->samples[row*job->output->stride], temp, contrib_rows, job->cols->count, src->n, row);
+	}
 }
 
-fz_pixmap *
-fz_scale_pixmap_cached(fz_context *ctx, const fz_pixmap *src, float x, float y, float w, float h, const fz_irect *clip, fz_scale_cache *cache_x, fz_scale_cache *cache_y)
+static void
+scale_rows_worker(void *arg, int i)
+{
+	scale_rows(&((const scale_job *)arg)[i]);
+}
+
+static fz_pixmap *
+scale_pixmap(fz_context *ctx, const fz_pixmap *src, float x, float y, float w, float h, const fz_irect *clip, fz_scale_cache *cache_x, fz_scale_cache *cache_y, const fz_thread_pool *pool)
 {
 	fz_scale_filter *filter = &fz_scale_filter_simple;
 	fz_weights *contrib_rows = NULL;
 	fz_weights *contrib_cols = NULL;
 	fz_pixmap *output = NULL;
 	unsigned char *temp = NULL;
-	int max_row, temp_span, temp_rows, row;
+	int temp_span, temp_rows;
 	int dst_w_int, dst_h_int, dst_x_int, dst_y_int;
 	int flip_x, flip_y, forcealpha;
 	fz_rect patch;
@@ -1751,19 +2194,40 @@ fz_scale_pixmap_cached(fz_context *ctx, const fz_pixmap *src, float x, float y,
 	else
 #endif /* SINGLE_PIXEL_SPECIALS */
 	{
-		void (*row_scale_in)(unsigned char * FZ_RESTRICT dst, const unsigned char * FZ_RESTRICT src, const fz_weights * FZ_RESTRICT weights);
-		void (*row_scale_out)(unsigned char * FZ_RESTRICT dst, const unsigned char * FZ_RESTRICT src, const fz_weights * FZ_RESTRICT weights, int w, int n, int row);
+		scale_row_in_fn *row_scale_in;
+		scale_row_out_fn *row_scale_out;
+		scale_job *jobs = NULL;
+		size_t temp_size;
+		int njobs = 1;
+		int i;
 
 		temp_span = contrib_cols->count * src->n;
 		temp_rows = contrib_rows->max_len;
 		if (temp_span <= 0 || temp_rows > INT_MAX / temp_span)
 			goto cleanup;
+		temp_size = (size_t)temp_span * temp_rows;
+
+		/* Each piece of a split scale redoes the horizontal scaling of
+		 * up to temp_rows-1 source rows that the piece before it has
+		 * already done, so don't cut it too finely. */
+		if (pool && pool->run && pool->workers > 1)
+		{
+			njobs = contrib_rows->count / SCALE_MIN_JOB_ROWS;
+			if (njobs > pool->workers)
+				njobs = pool->workers;
+			if (njobs < 1)
+				njobs = 1;
+		}
+
+		fz_var(jobs);
 		fz_try(ctx)
 		{
-			temp = fz_calloc(ctx, (size_t)temp_span*temp_rows, sizeof(unsigned char));
+			temp = fz_calloc(ctx, temp_size, njobs);
+			jobs = fz_malloc_array(ctx, njobs, scale_job);
 		}
 		fz_catch(ctx)
 		{
+			fz_free(ctx, temp);
 			fz_drop_pixmap(ctx, output);
 			if (!cache_x)
 				fz_free(ctx, contrib_cols);
@@ -1790,27 +2254,46 @@ fz_scale_pixmap_cached(fz_context *ctx, const fz_pixmap *src, float x, float y,
 			break;
 		}
 		row_scale_out = forcealpha ? scale_row_from_temp_alpha : scale_row_from_temp;
-		max_row = contrib_rows->index[contrib_rows->index[0]];
-		for (row = 0; row < contrib_rows->count; row++)
+#ifdef SCALE_SIMD
+		if (scale_simd_enabled())
 		{
-			/*
-			Which source rows do we need to have scaled into the
-			temporary buffer in order to be able to do the final
-			scale?
-			*/
-			int row_index = contrib_rows->index[row];
-			int row_min = contrib_rows->index[row_index++];
-			int row_len = contrib_rows->index[row_index];
-			while (max_row < row_min+row_len)
+			/* Only worth it when there are several taps per pixel,
+			 * as there are when scaling down. */
+			if (contrib_cols->max_len >= SCALE_SIMD_MIN_TAPS)
 			{
-				/* Scale another row */
-				assert(max_row < src->h);
-				(*row_scale_in)(&temp[temp_span*(max_row % temp_rows)], &src->samples[(flip_y ? (src->h-1-max_row): max_row)*src->stride], contrib_cols);
-				max_row++;
+				switch (src->n)
+				{
+				case 1: row_scale_in = scale_row_to_temp1_simd; break;
+				case 2: row_scale_in = scale_row_to_temp2_simd; break;
+				case 3: row_scale_in = scale_row_to_temp3_simd; break;
+				case 4: row_scale_in = scale_row_to_temp4_simd; break;
+				}
 			}
+			row_scale_out = forcealpha ? scale_row_from_temp_alpha_simd : scale_row_from_temp_simd;
+		}
+#endif /* SCALE_SIMD */
 
-			(*row_scale_out)(&output->samples[row*output->stride], temp, contrib_rows, contrib_cols->count, src->n, row);
+		for (i = 0; i < njobs; i++)
+		{
+			scale_job *job = &jobs[i];
+			job->src = src;
+			job->output = output;
+			job->rows = contrib_rows;
+			job->cols = contrib_cols;
+			job->row_scale_in = row_scale_in;
+			job->row_scale_out = row_scale_out;
+			job->flip_y = flip_y;
+			job->temp = temp + temp_size * i;
+			job->temp_span = temp_span;
+			job->temp_rows = temp_rows;
+			job->row0 = (int)((int64_t)contrib_rows->count * i / njobs);
+			job->row1 = (int)((int64_t)contrib_rows->count * (i + 1) / njobs);
 		}
+		if (njobs > 1)
+			pool->run(pool->user, njobs, scale_rows_worker, jobs);
+		else
+			scale_rows(jobs);
+		fz_free(ctx, jobs);
 		fz_free(ctx, temp);
 
 		if (forcealpha)
@@ -1828,6 +2311,18 @@ cleanup:
 	return output;
 }
 
+fz_pixmap *
+fz_scale_pixmap(fz_context *ctx, fz_pixmap *src, float x, float y, float w, float h, const fz_irect *clip)
+{
+	return scale_pixmap(ctx, src, x, y, w, h, clip, NULL, NULL, NULL);
+}
+
+fz_pixmap *
+fz_scale_pixmap_cached(fz_context *ctx, const fz_pixmap *src, float x, float y, float w, float h, const fz_irect *clip, fz_scale_cache *cache_x, fz_scale_cache *cache_y)
+{
+	return scale_pixmap(ctx, src, x, y, w, h, clip, cache_x, cache_y, fz_tuned_thread_pool(ctx));
+}
+
 void
 fz_drop_scale_cache(fz_context *ctx, fz_scale_cache *sc)
 {
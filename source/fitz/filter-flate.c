@@ -121,3 +121,487 @@ fz_open_flated(fz_context *ctx, fz_stream *chain, int window_bits)
 
 	return fz_new_stream(ctx, state, next_flated, close_flated);
 }
+
+/*
+	One-shot inflate.
+
+	When a whole flate stream is held in memory there is no need to
+	feed it through zlib a few kilobytes at a time. Instead we decode
+	it in one go straight into the output buffer, keeping up to 64 bits
+	of input at hand so that one refill covers a whole literal/length
+	and distance pair, resolving most codes with a single table lookup,
+	and copying matches a word at a time.
+
+	The decoder is deliberately strict. Anything it does not like
+	(damaged or truncated data, a bad checksum, a set of codes that is
+	not complete) makes it give up, and the caller falls back to reading
+	through fz_open_flated, which is lenient and warns about problems.
+*/
+
+#define INFLATE_LITLEN_BITS 10
+#define INFLATE_DIST_BITS 8
+#define INFLATE_SLACK 8 /* matches may be copied up to 8 bytes too far */
+
+typedef struct
+{
+	int bits;
+	uint16_t count[16];
+	uint16_t symbol[288];
+	uint16_t table[1 << INFLATE_LITLEN_BITS]; /* symbol << 4 | length, or 0 for longer codes */
+} inflate_huff;
+
+typedef struct
+{
+	inflate_huff litlen;
+	inflate_huff dist;
+	int fixed;
+} inflate_tables;
+
+static const uint16_t inflate_len_base[29] = {
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+	35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+
+static const unsigned char inflate_len_extra[29] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+	3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+
+static const uint16_t inflate_dist_base[30] = {
+	1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+	257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+
+static const unsigned char inflate_dist_extra[30] = {
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+	7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+static const unsigned char inflate_clen_order[19] = {
+	16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+/* Build the decoding tables for a canonical Huffman code. Accepts the
+ * same codes as zlib does: complete codes, empty codes (trying to decode
+ * with one fails) and, unless this is the code length code, a single
+ * code of length 1. Returns -1 for anything else. */
+static int
+inflate_build(inflate_huff *h, const unsigned char *length, int n, int bits, int clen)
+{
+	int left, len, sym, code, rev, i, j, k, size = 1 << bits;
+	uint16_t offs[16];
+
+	h->bits = bits;
+	memset(h->count, 0, sizeof h->count);
+	for (sym = 0; sym < n; sym++)
+		h->count[length[sym]]++;
+
+	left = 1;
+	for (len = 1; len < 16; len++)
+	{
+		left <<= 1;
+		left -= h->count[len];
+		if (left < 0)
+			return -1;
+	}
+	if (left > 0 && h->count[0] != n && (clen || h->count[0] + 1 != n || h->count[1] != 1))
+		return -1;
+
+	offs[1] = 0;
+	for (len = 1; len < 15; len++)
+		offs[len + 1] = offs[len] + h->count[len];
+	for (sym = 0; sym < n; sym++)
+		if (length[sym])
+			h->symbol[offs[length[sym]]++] = sym;
+
+	memset(h->table, 0, size * sizeof h->table[0]);
+	code = 0;
+	i = 0;
+	for (len = 1; len <= bits; len++)
+	{
+		for (k = 0; k < h->count[len]; k++)
+		{
+			sym = h->symbol[i++];
+			rev = 0;
+			for (j = 0; j < len; j++)
+				rev |= ((code >> j) & 1) << (len - 1 - j);
+			for (j = rev; j < size; j += 1 << len)
+				h->table[j] = (uint16_t)(sym << 4 | len);
+			code++;
+		}
+		code <<= 1;
+	}
+
+	return 0;
+}
+
+/* Decode a code that is too long for the table, bit by bit. */
+static int
+inflate_slow(const inflate_huff *h, uint64_t bits, int *lenp)
+{
+	int code = 0, first = 0, index = 0, len, count;
+
+	for (len = 1; len < 16; len++)
+	{
+		code |= (int)(bits & 1);
+		bits >>= 1;
+		count = h->count[len];
+		if (code - count < first)
+		{
+			*lenp = len;
+			return h->symbol[index + (code - first)];
+		}
+		index += count;
+		first += count;
+		first <<= 1;
+		code <<= 1;
+	}
+	return -1;
+}
+
+static void
+inflate_fixed(inflate_tables *t)
+{
+	unsigned char length[288];
+	int i;
+
+	for (i = 0; i < 144; i++)
+		length[i] = 8;
+	for (; i < 256; i++)
+		length[i] = 9;
+	for (; i < 280; i++)
+		length[i] = 7;
+	for (; i < 288; i++)
+		length[i] = 8;
+	inflate_build(&t->litlen, length, 288, INFLATE_LITLEN_BITS, 0);
+	/* Distance codes 30 and 31 take part in the code, but are invalid. */
+	for (i = 0; i < 32; i++)
+		length[i] = 5;
+	inflate_build(&t->dist, length, 32, INFLATE_DIST_BITS, 0);
+	t->fixed = 1;
+}
+
+static inline uint64_t
+inflate_load64(const unsigned char *p)
+{
+	return (uint64_t)p[0] | (uint64_t)p[1] << 8 | (uint64_t)p[2] << 16 | (uint64_t)p[3] << 24 |
+		(uint64_t)p[4] << 32 | (uint64_t)p[5] << 40 | (uint64_t)p[6] << 48 | (uint64_t)p[7] << 56;
+}
+
+/* Make sure there are at least 56 bits in the bit buffer. Past the end
+ * of the input we shift in zero bytes, counting them in overrun, and
+ * check later that none of them have been used. More than 8 of them
+ * means we are decoding padding. */
+#define INFLATE_REFILL() \
+	do { \
+		if (in_end - in >= 8) \
+		{ \
+			bits |= inflate_load64(in) << nbits; \
+			in += (63 - nbits) >> 3; \
+			nbits |= 56; \
+		} \
+		else \
+		{ \
+			while (nbits <= 56) \
+			{ \
+				if (in < in_end) \
+					bits |= (uint64_t)*in++ << nbits; \
+				else if (++overrun > 8) \
+					goto fail; \
+				nbits += 8; \
+			} \
+		} \
+	} while (0)
+
+#define INFLATE_DROP(n) \
+	do { bits >>= (n); nbits -= (n); } while (0)
+
+#define INFLATE_DECODE(h, sym) \
+	do { \
+		int len_; \
+		unsigned int e_ = (h)->table[bits & ((1 << (h)->bits) - 1)]; \
+		if (e_) \
+		{ \
+			sym = e_ >> 4; \
+			len_ = e_ & 15; \
+		} \
+		else if ((sym = inflate_slow((h), bits, &len_)) < 0) \
+			goto fail; \
+		INFLATE_DROP(len_); \
+	} while (0)
+
+/* Make room for at least n more bytes of output. */
+#define INFLATE_ROOM(n) \
+	do { \
+		if ((size_t)(out_end - out) < (size_t)(n)) \
+		{ \
+			size_t pos_ = out - buf->data; \
+			size_t cap_ = buf->cap * 2; \
+			if (cap_ < pos_ + (n)) \
+				cap_ = pos_ + (n); \
+			if (max && pos_ + (n) > max + INFLATE_SLACK) \
+				goto fail; \
+			fz_resize_buffer(ctx, buf, cap_); \
+			out = buf->data + pos_; \
+			out_end = buf->data + buf->cap; \
+		} \
+	} while (0)
+
+fz_buffer *
+fz_inflate_data(fz_context *ctx, const unsigned char *data, size_t len, int window_bits, size_t initial, size_t max)
+{
+	const unsigned char *in = data;
+	const unsigned char *in_end = data + len;
+	uint64_t bits = 0;
+	int nbits = 0;
+	int overrun = 0;
+	inflate_tables *t = NULL;
+	fz_buffer *buf = NULL;
+	unsigned char *out, *out_end;
+	unsigned char length[288 + 32];
+	int final, type, sym, i, n, ok = 0;
+	size_t window = (size_t)1 << 15;
+
+	if (window_bits > 15 || window_bits < -15)
+		return NULL;
+	if (window_bits > 0)
+	{
+		if (len < 6)
+			return NULL;
+		if ((in[0] & 15) != 8 || (in[0] >> 4) + 8 > window_bits || (in[1] & 0x20) || ((in[0] << 8) | in[1]) % 31)
+			return NULL;
+		/* zlib refuses distances beyond the window the header gives. */
+		window = (size_t)1 << ((in[0] >> 4) + 8);
+		in += 2;
+	}
+	else if (window_bits < 0)
+		window = (size_t)1 << -window_bits;
+
+	if (initial < 1024)
+		initial = 1024;
+	if (max && initial > max)
+		initial = max;
+
+	fz_var(t);
+	fz_var(buf);
+	fz_var(ok);
+
+	fz_try(ctx)
+	{
+		t = fz_malloc_struct(ctx, inflate_tables);
+		buf = fz_new_buffer(ctx, initial + INFLATE_SLACK);
+		out = buf->data;
+		out_end = buf->data + buf->cap;
+
+		do
+		{
+			INFLATE_REFILL();
+			final = bits & 1;
+			type = (bits >> 1) & 3;
+			INFLATE_DROP(3);
+
+			if (type == 0)
+			{
+				/* Stored block: put back the whole bytes left in
+				 * the bit buffer and copy straight from the input. */
+				INFLATE_DROP(nbits & 7);
+				if (overrun * 8 > nbits)
+					goto fail;
+				in -= nbits / 8 - overrun;
+				bits = 0;
+				nbits = 0;
+				overrun = 0;
+				if (in_end - in < 4)
+					goto fail;
+				n = in[0] | in[1] << 8;
+				if ((in[2] | in[3] << 8) != (n ^ 0xffff))
+					goto fail;
+				in += 4;
+				if (in_end - in < n)
+					goto fail;
+				INFLATE_ROOM(n + INFLATE_SLACK);
+				memcpy(out, in, n);
+				out += n;
+				in += n;
+			}
+			else if (type == 1 || type == 2)
+			{
+				if (type == 1)
+				{
+					if (!t->fixed)
+						inflate_fixed(t);
+				}
+				else
+				{
+					int nlen, ndist, ncode;
+
+					t->fixed = 0;
+					nlen = (bits & 31) + 257;
+					ndist = ((bits >> 5) & 31) + 1;
+					ncode = ((bits >> 10) & 15) + 4;
+					INFLATE_DROP(14);
+					if (nlen > 286 || ndist > 30)
+						goto fail;
+
+					memset(length, 0, 19);
+					for (i = 0; i < ncode; i++)
+					{
+						INFLATE_REFILL();
+						length[inflate_clen_order[i]] = bits & 7;
+						INFLATE_DROP(3);
+					}
+					if (inflate_build(&t->litlen, length, 19, 7, 1) < 0)
+						goto fail;
+
+					for (i = 0; i < nlen + ndist; )
+					{
+						INFLATE_REFILL();
+						INFLATE_DECODE(&t->litlen, sym);
+						if (sym < 16)
+							length[i++] = sym;
+						else
+						{
+							int rep, val = 0;
+							if (sym == 16)
+							{
+								if (i == 0)
+									goto fail;
+								val = length[i - 1];
+								rep = 3 + (bits & 3);
+								INFLATE_DROP(2);
+							}
+							else if (sym == 17)
+							{
+								rep = 3 + (bits & 7);
+								INFLATE_DROP(3);
+							}
+							else
+							{
+								rep = 11 + (bits & 127);
+								INFLATE_DROP(7);
+							}
+							if (i + rep > nlen + ndist)
+								goto fail;
+							while (rep--)
+								length[i++] = val;
+						}
+					}
+					if (length[256] == 0)
+						goto fail;
+					if (inflate_build(&t->litlen, length, nlen, INFLATE_LITLEN_BITS, 0) < 0)
+						goto fail;
+					if (inflate_build(&t->dist, length + nlen, ndist, INFLATE_DIST_BITS, 0) < 0)
+						goto fail;
+				}
+
+				for (;;)
+				{
+					unsigned int dist, extra;
+					const unsigned char *src;
+
+					INFLATE_REFILL();
+					INFLATE_DECODE(&t->litlen, sym);
+					if (sym < 256)
+					{
+						INFLATE_ROOM(1 + INFLATE_SLACK);
+						*out++ = (unsigned char)sym;
+						continue;
+					}
+					if (sym == 256)
+						break;
+
+					sym -= 257;
+					if (sym >= 29)
+						goto fail;
+					extra = inflate_len_extra[sym];
+					n = inflate_len_base[sym] + (int)(bits & ((1u << extra) - 1));
+					INFLATE_DROP(extra);
+
+					INFLATE_DECODE(&t->dist, sym);
+					if (sym >= 30)
+						goto fail;
+					extra = inflate_dist_extra[sym];
+					dist = inflate_dist_base[sym] + (unsigned int)(bits & ((1u << extra) - 1));
+					INFLATE_DROP(extra);
+
+					if (dist > window || dist > (size_t)(out - buf->data))
+						goto fail;
+					INFLATE_ROOM(n + INFLATE_SLACK);
+					src = out - dist;
+					if (dist >= 8)
+					{
+						unsigned char *end = out + n;
+						do
+						{
+							memcpy(out, src, 8);
+							out += 8;
+							src += 8;
+						}
+						while (out < end);
+						out = end;
+					}
+					else if (dist == 1)
+					{
+						memset(out, *src, n);
+						out += n;
+					}
+					else
+					{
+						while (n--)
+							*out++ = *src++;
+					}
+				}
+			}
+			else
+				goto fail;
+
+			if (overrun * 8 > nbits)
+				goto fail;
+		}
+		while (!final);
+
+		buf->len = out - buf->data;
+		if (max && buf->len > max)
+			goto fail;
+
+		if (window_bits > 0)
+		{
+			/* Check the adler32 checksum that follows the data. */
+			uLong check = adler32(0, NULL, 0);
+			size_t done = 0;
+			unsigned char *p;
+
+			INFLATE_DROP(nbits & 7);
+			in -= nbits / 8 - overrun;
+			if (in_end - in < 4)
+				goto fail;
+			while (done < buf->len)
+			{
+				uInt chunk = (uInt)fz_minz(buf->len - done, 1 << 30);
+				check = adler32(check, buf->data + done, chunk);
+				done += chunk;
+			}
+			p = (unsigned char *)in;
+			if (check != ((uLong)p[0] << 24 | (uLong)p[1] << 16 | (uLong)p[2] << 8 | p[3]))
+				goto fail;
+		}
+
+		ok = 1;
+fail:
+		;
+	}
+	fz_always(ctx)
+		fz_free(ctx, t);
+	fz_catch(ctx)
+	{
+		fz_drop_buffer(ctx, buf);
+		fz_rethrow(ctx);
+	}
+
+	if (!ok)
+	{
+		fz_drop_buffer(ctx, buf);
+		return NULL;
+	}
+	return buf;
+}
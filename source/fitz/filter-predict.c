@@ -1,10 +1,13 @@
 #include "mupdf/fitz.h"
+#include "simd-imp.h"
 
 #include <string.h>
 #include <limits.h>
 
 /* TODO: check if this works with 16bpp images */
 
+typedef size_t (png_simd_fn)(unsigned char *out, const unsigned char *in, const unsigned char *ref, size_t len, int bpp);
+
 typedef struct
 {
 	fz_stream *chain;
@@ -20,6 +23,7 @@ typedef struct
 	unsigned char *out;
 	unsigned char *ref;
 	unsigned char *rp, *wp;
+	png_simd_fn *simd[5];
 
 	unsigned char buffer[4096];
 } fz_predict;
@@ -95,16 +99,274 @@ fz_predict_tiff(fz_predict *state, unsigned char *out, unsigned char *in)
 	}
 }
 
+/*
+	SIMD versions of the PNG filters. Each one decodes as much of the
+	row as it can (whole pixels, or whole vectors), and returns how many
+	bytes it has done; the plain C code in fz_predict_png does the rest.
+	Sub, Average and Paeth depend on the previous pixel, so those only
+	work a pixel at a time and are only provided for 3 and 4 bytes per
+	pixel, where they pay off.
+*/
+
+#ifdef FZ_SIMD_X86
+
+/* Pixels are loaded and stored 4 bytes at a time. For 3 byte pixels
+ * the 4th byte is nonsense, but it only ever affects itself, and it is
+ * overwritten by the next pixel; the last pixel is left to the plain C
+ * code so as not to run off the end of the row. */
+
+FZ_SIMD_TARGET("sse2") static inline __m128i
+png_load_sse2(const unsigned char *p)
+{
+	int v;
+	memcpy(&v, p, 4);
+	return _mm_cvtsi32_si128(v);
+}
+
+FZ_SIMD_TARGET("sse2") static inline void
+png_store_sse2(unsigned char *p, __m128i x)
+{
+	int v = _mm_cvtsi128_si32(x);
+	memcpy(p, &v, 4);
+}
+
+FZ_SIMD_TARGET("sse2") static size_t
+png_sub_sse2(unsigned char *out, const unsigned char *in, const unsigned char *ref, size_t len, int bpp)
+{
+	__m128i a = _mm_setzero_si128();
+	size_t i;
+
+	for (i = 0; i + 4 <= len; i += bpp)
+	{
+		a = _mm_add_epi8(a, png_load_sse2(in + i));
+		png_store_sse2(out + i, a);
+	}
+	return i;
+}
+
+FZ_SIMD_TARGET("sse2") static size_t
+png_up_sse2(unsigned char *out, const unsigned char *in, const unsigned char *ref, size_t len, int bpp)
+{
+	size_t i;
+
+	for (i = 0; i + 16 <= len; i += 16)
+	{
+		__m128i x = _mm_loadu_si128((const __m128i *)(in + i));
+		__m128i b = _mm_loadu_si128((const __m128i *)(ref + i));
+		_mm_storeu_si128((__m128i *)(out + i), _mm_add_epi8(x, b));
+	}
+	return i;
+}
+
+FZ_SIMD_TARGET("avx2") static size_t
+png_up_avx2(unsigned char *out, const unsigned char *in, const unsigned char *ref, size_t len, int bpp)
+{
+	size_t i;
+
+	for (i = 0; i + 32 <= len; i += 32)
+	{
+		__m256i x = _mm256_loadu_si256((const __m256i *)(in + i));
+		__m256i b = _mm256_loadu_si256((const __m256i *)(ref + i));
+		_mm256_storeu_si256((__m256i *)(out + i), _mm256_add_epi8(x, b));
+	}
+	return i;
+}
+
+FZ_SIMD_TARGET("sse2") static size_t
+png_average_sse2(unsigned char *out, const unsigned char *in, const unsigned char *ref, size_t len, int bpp)
+{
+	const __m128i one = _mm_set1_epi8(1);
+	__m128i a = _mm_setzero_si128();
+	size_t i;
+
+	for (i = 0; i + 4 <= len; i += bpp)
+	{
+		__m128i b = png_load_sse2(ref + i);
+		/* pavgb rounds up, and we want to round down. */
+		__m128i avg = _mm_avg_epu8(a, b);
+		avg = _mm_sub_epi8(avg, _mm_and_si128(_mm_xor_si128(a, b), one));
+		a = _mm_add_epi8(png_load_sse2(in + i), avg);
+		png_store_sse2(out + i, a);
+	}
+	return i;
+}
+
+FZ_SIMD_TARGET("sse2") static inline __m128i
+png_abs_sse2(__m128i x)
+{
+	return _mm_max_epi16(x, _mm_sub_epi16(_mm_setzero_si128(), x));
+}
+
+FZ_SIMD_TARGET("sse2") static inline __m128i
+png_select_sse2(__m128i mask, __m128i t, __m128i f)
+{
+	return _mm_or_si128(_mm_and_si128(mask, t), _mm_andnot_si128(mask, f));
+}
+
+FZ_SIMD_TARGET("sse2") static size_t
+png_paeth_sse2(unsigned char *out, const unsigned char *in, const unsigned char *ref, size_t len, int bpp)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i mask = _mm_set1_epi16(0xff);
+	__m128i a = zero, b, c = zero, x, pa, pb, pc, smallest, nearest;
+	size_t i;
+
+	/* As paeth() above, with the components in 16 bit lanes. */
+	for (i = 0; i + 4 <= len; i += bpp)
+	{
+		b = _mm_unpacklo_epi8(png_load_sse2(ref + i), zero);
+		x = _mm_unpacklo_epi8(png_load_sse2(in + i), zero);
+		pa = _mm_sub_epi16(b, c);
+		pb = _mm_sub_epi16(a, c);
+		pc = png_abs_sse2(_mm_add_epi16(pa, pb));
+		pa = png_abs_sse2(pa);
+		pb = png_abs_sse2(pb);
+		smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+		nearest = png_select_sse2(_mm_cmpeq_epi16(smallest, pa), a,
+			png_select_sse2(_mm_cmpeq_epi16(smallest, pb), b, c));
+		a = _mm_and_si128(_mm_add_epi16(x, nearest), mask);
+		png_store_sse2(out + i, _mm_packus_epi16(a, a));
+		c = b;
+	}
+	return i;
+}
+
+#endif /* FZ_SIMD_X86 */
+
+#ifdef FZ_SIMD_NEON
+
+/* Pixels are loaded and stored 4 bytes at a time, as for SSE2. */
+
+static inline uint8x8_t
+png_load_neon(const unsigned char *p)
+{
+	uint32_t v;
+	memcpy(&v, p, 4);
+	return vreinterpret_u8_u32(vdup_n_u32(v));
+}
+
+static inline void
+png_store_neon(unsigned char *p, uint8x8_t x)
+{
+	uint32_t v = vget_lane_u32(vreinterpret_u32_u8(x), 0);
+	memcpy(p, &v, 4);
+}
+
+static size_t
+png_sub_neon(unsigned char *out, const unsigned char *in, const unsigned char *ref, size_t len, int bpp)
+{
+	uint8x8_t a = vdup_n_u8(0);
+	size_t i;
+
+	for (i = 0; i + 4 <= len; i += bpp)
+	{
+		a = vadd_u8(a, png_load_neon(in + i));
+		png_store_neon(out + i, a);
+	}
+	return i;
+}
+
+static size_t
+png_up_neon(unsigned char *out, const unsigned char *in, const unsigned char *ref, size_t len, int bpp)
+{
+	size_t i;
+
+	for (i = 0; i + 16 <= len; i += 16)
+		vst1q_u8(out + i, vaddq_u8(vld1q_u8(in + i), vld1q_u8(ref + i)));
+	return i;
+}
+
+static size_t
+png_average_neon(unsigned char *out, const unsigned char *in, const unsigned char *ref, size_t len, int bpp)
+{
+	uint8x8_t a = vdup_n_u8(0);
+	size_t i;
+
+	for (i = 0; i + 4 <= len; i += bpp)
+	{
+		/* vhadd rounds down, just as we want. */
+		a = vadd_u8(png_load_neon(in + i), vhadd_u8(a, png_load_neon(ref + i)));
+		png_store_neon(out + i, a);
+	}
+	return i;
+}
+
+static size_t
+png_paeth_neon(unsigned char *out, const unsigned char *in, const unsigned char *ref, size_t len, int bpp)
+{
+	int16x4_t a = vdup_n_s16(0), b, c = vdup_n_s16(0), x, pa, pb, pc, smallest, nearest;
+	size_t i;
+
+	/* As paeth() above, with the components in 16 bit lanes. */
+	for (i = 0; i + 4 <= len; i += bpp)
+	{
+		b = vreinterpret_s16_u16(vget_low_u16(vmovl_u8(png_load_neon(ref + i))));
+		x = vreinterpret_s16_u16(vget_low_u16(vmovl_u8(png_load_neon(in + i))));
+		pa = vsub_s16(b, c);
+		pb = vsub_s16(a, c);
+		pc = vabs_s16(vadd_s16(pa, pb));
+		pa = vabs_s16(pa);
+		pb = vabs_s16(pb);
+		smallest = vmin_s16(pc, vmin_s16(pa, pb));
+		nearest = vbsl_s16(vceq_s16(smallest, pa), a,
+			vbsl_s16(vceq_s16(smallest, pb), b, c));
+		a = vand_s16(vadd_s16(x, nearest), vdup_n_s16(0xff));
+		png_store_neon(out + i, vmovn_u16(vcombine_u16(vreinterpret_u16_s16(a), vreinterpret_u16_s16(a))));
+		c = b;
+	}
+	return i;
+}
+
+#endif /* FZ_SIMD_NEON */
+
+static void
+choose_png_simd(fz_predict *state)
+{
+	int features = fz_cpu_features();
+	int pixel = state->bpp == 3 || state->bpp == 4;
+
+	(void)features;
+	(void)pixel;
+
+#ifdef FZ_SIMD_X86
+	if (features & FZ_CPU_SSE2)
+	{
+		if (pixel)
+		{
+			state->simd[1] = png_sub_sse2;
+			state->simd[3] = png_average_sse2;
+			state->simd[4] = png_paeth_sse2;
+		}
+		state->simd[2] = (features & FZ_CPU_AVX2) ? png_up_avx2 : png_up_sse2;
+	}
+#endif
+#ifdef FZ_SIMD_NEON
+	if (features & FZ_CPU_NEON)
+	{
+		if (pixel)
+		{
+			state->simd[1] = png_sub_neon;
+			state->simd[3] = png_average_neon;
+			state->simd[4] = png_paeth_neon;
+		}
+		state->simd[2] = png_up_neon;
+	}
+#endif
+}
+
 static void
 fz_predict_png(fz_context *ctx, fz_predict *state, unsigned char *out, unsigned char *in, size_t len, int predictor)
 {
 	int bpp = state->bpp;
-	size_t i;
+	size_t i = 0;
 	unsigned char *ref = state->ref;
 
 	if ((size_t)bpp > len)
 		bpp = (int)len;
 
+	if (predictor >= 1 && predictor <= 4 && state->simd[predictor])
+		i = state->simd[predictor](out, in, ref, len, state->bpp);
+
 	switch (predictor)
 	{
 	default:
@@ -114,48 +376,26 @@ fz_predict_png(fz_context *ctx, fz_predict *state, unsigned char *out, unsigned
 		memcpy(out, in, len);
 		break;
 	case 1:
-		for (i = bpp; i > 0; i--)
-		{
-			*out++ = *in++;
-		}
-		for (i = len - bpp; i > 0; i--)
-		{
-			*out = *in++ + out[-bpp];
-			out++;
-		}
+		for (; i < (size_t)bpp; i++)
+			out[i] = in[i];
+		for (; i < len; i++)
+			out[i] = in[i] + out[i - bpp];
 		break;
 	case 2:
-		for (i = bpp; i > 0; i--)
-		{
-			*out++ = *in++ + *ref++;
-		}
-		for (i = len - bpp; i > 0; i--)
-		{
-			*out++ = *in++ + *ref++;
-		}
+		for (; i < len; i++)
+			out[i] = in[i] + ref[i];
 		break;
 	case 3:
-		for (i = bpp; i > 0; i--)
-		{
-			*out++ = *in++ + (*ref++) / 2;
-		}
-		for (i = len - bpp; i > 0; i--)
-		{
-			*out = *in++ + (out[-bpp] + *ref++) / 2;
-			out++;
-		}
+		for (; i < (size_t)bpp; i++)
+			out[i] = in[i] + ref[i] / 2;
+		for (; i < len; i++)
+			out[i] = in[i] + (out[i - bpp] + ref[i]) / 2;
 		break;
 	case 4:
-		for (i = bpp; i > 0; i--)
-		{
-			*out++ = *in++ + paeth(0, *ref++, 0);
-		}
-		for (i = len - bpp; i > 0; i --)
-		{
-			*out = *in++ + paeth(out[-bpp], *ref, ref[-bpp]);
-			ref++;
-			out++;
-		}
+		for (; i < (size_t)bpp; i++)
+			out[i] = in[i] + paeth(0, ref[i], 0);
+		for (; i < len; i++)
+			out[i] = in[i] + paeth(out[i - bpp], ref[i], ref[i - bpp]);
 		break;
 	}
 }
@@ -269,6 +509,9 @@ fz_open_predict(fz_context *ctx, fz_stream *chain, int predictor, int columns, i
 
 		memset(state->ref, 0, state->stride);
 
+		if (predictor >= 10)
+			choose_png_simd(state);
+
 		state->chain = fz_keep_stream(ctx, chain);
 	}
 	fz_catch(ctx)
@@ -87,6 +87,7 @@ fz_new_font(fz_context *ctx, const char *name, int use_glyph_bbox, int glyph_cou
 		fz_strlcpy(font->name, "(null)", sizeof font->name);
 
 	font->ft_face = NULL;
+	font->ft_lock = FZ_LOCK_FONT;
 	font->flags.ft_substitute = 0;
 	font->flags.fake_bold = 0;
 	font->flags.fake_italic = 0;
@@ -289,7 +290,10 @@ struct fz_font_context
 	int ctx_refs;
 	FT_Library ftlib;
 	struct FT_MemoryRec_ ftmemory;
+	fz_alloc_context alloc;
+	fz_locks_context locks;
 	int ftlib_refs;
+	int next_ft_lock;
 	fz_load_system_font_fn *load_font;
 	fz_load_system_cjk_font_fn *load_cjk_font;
 	fz_load_system_fallback_font_fn *load_fallback_font;
@@ -313,30 +317,48 @@ struct ft_error
 	char *str;
 };
 
+/* FreeType allocates through the font context, which is shared by every
+ * clone of the context that created it, and so cannot call back into any
+ * one fz_context: faces are used by many threads at once, each holding
+ * only its font's lock. The allocator and locks are the same for every
+ * clone, so we call them directly. Nothing is scavenged from the store,
+ * as that would need a context (and could drop fonts while a face lock
+ * is held). */
 static void *ft_alloc(FT_Memory memory, long size)
 {
-	fz_context *ctx = (fz_context *) memory->user;
-	return Memento_label(fz_malloc_no_throw(ctx, size), "ft_alloc");
+	fz_font_context *font = (fz_font_context *) memory->user;
+	void *p;
+	font->locks.lock(font->locks.user, FZ_LOCK_ALLOC);
+	p = font->alloc.malloc(font->alloc.user, size);
+	font->locks.unlock(font->locks.user, FZ_LOCK_ALLOC);
+	return Memento_label(p, "ft_alloc");
 }
 
 static void ft_free(FT_Memory memory, void *block)
 {
-	fz_context *ctx = (fz_context *) memory->user;
-	fz_free(ctx, block);
+	fz_font_context *font = (fz_font_context *) memory->user;
+	if (block == NULL)
+		return;
+	font->locks.lock(font->locks.user, FZ_LOCK_ALLOC);
+	font->alloc.free(font->alloc.user, block);
+	font->locks.unlock(font->locks.user, FZ_LOCK_ALLOC);
 }
 
 static void *ft_realloc(FT_Memory memory, long cur_size, long new_size, void *block)
 {
-	fz_context *ctx = (fz_context *) memory->user;
-	void *newblock = NULL;
+	fz_font_context *font = (fz_font_context *) memory->user;
+	void *newblock;
 	if (new_size == 0)
 	{
-		fz_free(ctx, block);
-		return newblock;
+		ft_free(memory, block);
+		return NULL;
 	}
 	if (block == NULL)
 		return ft_alloc(memory, new_size);
-	return fz_realloc_no_throw(ctx, block, new_size);
+	font->locks.lock(font->locks.user, FZ_LOCK_ALLOC);
+	newblock = font->alloc.realloc(font->alloc.user, block, new_size);
+	font->locks.unlock(font->locks.user, FZ_LOCK_ALLOC);
+	return newblock;
 }
 
 void fz_new_font_context(fz_context *ctx)
@@ -346,7 +368,9 @@ void fz_new_font_context(fz_context *ctx)
 	ctx->font->ftlib = NULL;
 	ctx->font->ftlib_refs = 0;
 	ctx->font->load_font = NULL;
-	ctx->font->ftmemory.user = ctx;
+	ctx->font->alloc = ctx->alloc;
+	ctx->font->locks = ctx->locks;
+	ctx->font->ftmemory.user = ctx->font;
 	ctx->font->ftmemory.alloc = ft_alloc;
 	ctx->font->ftmemory.free = ft_free;
 	ctx->font->ftmemory.realloc = ft_realloc;
@@ -639,11 +663,15 @@ fz_new_font_from_buffer(fz_context *ctx, const char *name, fz_buffer *buffer, in
 	int fterr;
 	FT_ULong tag, size, i, n;
 	char namebuf[sizeof(font->name)];
+	int ft_lock;
 
 	fz_keep_freetype(ctx);
 
 	fz_lock(ctx, FZ_LOCK_FREETYPE);
 	fterr = FT_New_Memory_Face(ctx->font->ftlib, buffer->data, (FT_Long)buffer->len, index, &face);
+	/* Share the font locks out between faces in turn. */
+	ft_lock = FZ_LOCK_FONT + ctx->font->next_ft_lock;
+	ctx->font->next_ft_lock = (ctx->font->next_ft_lock + 1) % FZ_FONT_LOCKS;
 	fz_unlock(ctx, FZ_LOCK_FREETYPE);
 	if (fterr)
 	{
@@ -688,6 +716,7 @@ fz_new_font_from_buffer(fz_context *ctx, const char *name, fz_buffer *buffer, in
 	}
 
 	font->ft_face = face;
+	font->ft_lock = ft_lock;
 	fz_set_font_bbox(ctx, font,
 		(float) face->bbox.xMin / face->units_per_EM,
 		(float) face->bbox.yMin / face->units_per_EM,
@@ -843,9 +872,9 @@ fz_adjust_ft_glyph_width(fz_context *ctx, fz_font *font, int gid, fz_matrix *trm
 		float subw;
 		float realw;
 
-		fz_lock(ctx, FZ_LOCK_FREETYPE);
+		fz_lock(ctx, font->ft_lock);
 		fterr = FT_Get_Advance(font->ft_face, gid, FT_LOAD_NO_SCALE | FT_LOAD_NO_HINTING | FT_LOAD_IGNORE_TRANSFORM, &adv);
-		fz_unlock(ctx, FZ_LOCK_FREETYPE);
+		fz_unlock(ctx, font->ft_lock);
 		if (fterr && fterr != FT_Err_Invalid_Argument)
 			fz_warn(ctx, "FT_Get_Advance(%s,%d): %s", font->name, gid, ft_error_string(fterr));
 
@@ -899,7 +928,7 @@ do_ft_render_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix trm, int a
 	if (font->flags.fake_italic)
 		trm = fz_pre_shear(trm, SHEAR, 0);
 
-	fz_lock(ctx, FZ_LOCK_FREETYPE);
+	fz_lock(ctx, font->ft_lock);
 
 	if (aa == 0)
 	{
@@ -984,7 +1013,7 @@ fz_render_ft_glyph_pixmap(fz_context *ctx, fz_font *font, int gid, fz_matrix trm
 
 	if (slot == NULL)
 	{
-		fz_unlock(ctx, FZ_LOCK_FREETYPE);
+		fz_unlock(ctx, font->ft_lock);
 		return NULL;
 	}
 
@@ -994,7 +1023,7 @@ fz_render_ft_glyph_pixmap(fz_context *ctx, fz_font *font, int gid, fz_matrix trm
 	}
 	fz_always(ctx)
 	{
-		fz_unlock(ctx, FZ_LOCK_FREETYPE);
+		fz_unlock(ctx, font->ft_lock);
 	}
 	fz_catch(ctx)
 	{
@@ -1004,7 +1033,6 @@ fz_render_ft_glyph_pixmap(fz_context *ctx, fz_font *font, int gid, fz_matrix trm
 	return pixmap;
 }
 
-/* The glyph cache lock is always taken when this is called. */
 fz_glyph *
 fz_render_ft_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix trm, int aa)
 {
@@ -1013,7 +1041,7 @@ fz_render_ft_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix trm, int a
 
 	if (slot == NULL)
 	{
-		fz_unlock(ctx, FZ_LOCK_FREETYPE);
+		fz_unlock(ctx, font->ft_lock);
 		return NULL;
 	}
 
@@ -1023,7 +1051,7 @@ fz_render_ft_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix trm, int a
 	}
 	fz_always(ctx)
 	{
-		fz_unlock(ctx, FZ_LOCK_FREETYPE);
+		fz_unlock(ctx, font->ft_lock);
 	}
 	fz_catch(ctx)
 	{
@@ -1060,7 +1088,7 @@ do_render_ft_stroked_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix tr
 	v.x = trm.e * 64;
 	v.y = trm.f * 64;
 
-	fz_lock(ctx, FZ_LOCK_FREETYPE);
+	fz_lock(ctx, font->ft_lock);
 	fterr = FT_Set_Char_Size(face, 65536, 65536, 72, 72); /* should be 64, 64 */
 	if (fterr)
 	{
@@ -1136,7 +1164,7 @@ fz_render_ft_stroked_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix tr
 
 	if (bitmap == NULL)
 	{
-		fz_unlock(ctx, FZ_LOCK_FREETYPE);
+		fz_unlock(ctx, font->ft_lock);
 		return NULL;
 	}
 
@@ -1147,7 +1175,7 @@ fz_render_ft_stroked_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix tr
 	fz_always(ctx)
 	{
 		FT_Done_Glyph(glyph);
-		fz_unlock(ctx, FZ_LOCK_FREETYPE);
+		fz_unlock(ctx, font->ft_lock);
 	}
 	fz_catch(ctx)
 	{
@@ -1187,7 +1215,7 @@ fz_bound_ft_glyph(fz_context *ctx, fz_font *font, int gid)
 	v.x = trm.e * 65536;
 	v.y = trm.f * 65536;
 
-	fz_lock(ctx, FZ_LOCK_FREETYPE);
+	fz_lock(ctx, font->ft_lock);
 	/* Set the char size to scale=face->units_per_EM to effectively give
 	 * us unscaled results. This avoids quantisation. We then apply the
 	 * scale ourselves below. */
@@ -1200,7 +1228,7 @@ fz_bound_ft_glyph(fz_context *ctx, fz_font *font, int gid)
 	if (fterr)
 	{
 		fz_warn(ctx, "FT_Load_Glyph(%s,%d,FT_LOAD_NO_HINTING): %s", font->name, gid, ft_error_string(fterr));
-		fz_unlock(ctx, FZ_LOCK_FREETYPE);
+		fz_unlock(ctx, font->ft_lock);
 		bounds->x0 = bounds->x1 = trm.e;
 		bounds->y0 = bounds->y1 = trm.f;
 		return bounds;
@@ -1213,7 +1241,7 @@ fz_bound_ft_glyph(fz_context *ctx, fz_font *font, int gid)
 	}
 
 	FT_Outline_Get_CBox(&face->glyph->outline, &cbox);
-	fz_unlock(ctx, FZ_LOCK_FREETYPE);
+	fz_unlock(ctx, font->ft_lock);
 	bounds->x0 = cbox.xMin * recip;
 	bounds->y0 = cbox.yMin * recip;
 	bounds->x1 = cbox.xMax * recip;
@@ -1309,13 +1337,13 @@ fz_outline_ft_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix trm)
 	if (font->flags.fake_italic)
 		trm = fz_pre_shear(trm, SHEAR, 0);
 
-	fz_lock(ctx, FZ_LOCK_FREETYPE);
+	fz_lock(ctx, font->ft_lock);
 
 	fterr = FT_Load_Glyph(face, gid, FT_LOAD_NO_SCALE | FT_LOAD_IGNORE_TRANSFORM);
 	if (fterr)
 	{
 		fz_warn(ctx, "FT_Load_Glyph(%s,%d,FT_LOAD_NO_SCALE|FT_LOAD_IGNORE_TRANSFORM): %s", font->name, gid, ft_error_string(fterr));
-		fz_unlock(ctx, FZ_LOCK_FREETYPE);
+		fz_unlock(ctx, font->ft_lock);
 		return NULL;
 	}
 
@@ -1337,7 +1365,7 @@ fz_outline_ft_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix trm)
 	}
 	fz_always(ctx)
 	{
-		fz_unlock(ctx, FZ_LOCK_FREETYPE);
+		fz_unlock(ctx, font->ft_lock);
 	}
 	fz_catch(ctx)
 	{
@@ -1700,9 +1728,9 @@ fz_advance_ft_glyph(fz_context *ctx, fz_font *font, int gid, int wmode)
 	mask = FT_LOAD_NO_SCALE | FT_LOAD_NO_HINTING | FT_LOAD_IGNORE_TRANSFORM;
 	if (wmode)
 		mask |= FT_LOAD_VERTICAL_LAYOUT;
-	fz_lock(ctx, FZ_LOCK_FREETYPE);
+	fz_lock(ctx, font->ft_lock);
 	fterr = FT_Get_Advance(font->ft_face, gid, mask, &adv);
-	fz_unlock(ctx, FZ_LOCK_FREETYPE);
+	fz_unlock(ctx, font->ft_lock);
 	if (fterr && fterr != FT_Err_Invalid_Argument)
 	{
 		fz_warn(ctx, "FT_Get_Advance(%s,%d): %s", font->name, gid, ft_error_string(fterr));
@@ -1991,6 +2019,16 @@ fz_rect fz_font_bbox(fz_context *ctx, fz_font *font)
 	return font->bbox;
 }
 
+void fz_ft_lock(fz_context *ctx, fz_font *font)
+{
+	fz_lock(ctx, font->ft_lock);
+}
+
+void fz_ft_unlock(fz_context *ctx, fz_font *font)
+{
+	fz_unlock(ctx, font->ft_lock);
+}
+
 void *fz_font_ft_face(fz_context *ctx, fz_font *font)
 {
 	return font ? font->ft_face : NULL;
@@ -20,6 +20,9 @@ fz_key_storable_needs_reaping(fz_context *ctx, const fz_key_storable *ks)
 
 #define SCALABLE_IMAGE_DPI 96
 
+/* The largest image (in decompressed bytes) that we inflate in one go. */
+#define MAX_INFLATE_IN_ONE_GO (32 << 20)
+
 struct fz_compressed_image
 {
 	fz_image super;
@@ -109,6 +112,36 @@ fz_needs_reap_image_key(fz_context *ctx, void *key_)
 	return fz_key_storable_needs_reaping(ctx, &key->image->key_storable);
 }
 
+/*
+	Estimate the cost of decoding an image again, as the size of the
+	decoded pixmap plus the size of the compressed data, weighted by
+	how slow the decoder is per input byte.
+*/
+static size_t
+fz_image_key_cost(fz_context *ctx, void *key_, size_t size)
+{
+	fz_image_key *key = (fz_image_key *)key_;
+	fz_compressed_buffer *buf = fz_compressed_image_buffer(ctx, key->image);
+	size_t len;
+
+	if (buf == NULL || buf->buffer == NULL)
+		return size;
+
+	len = buf->buffer->len;
+	switch (buf->params.type)
+	{
+	case FZ_IMAGE_JPX:
+		return size + len * 16;
+	case FZ_IMAGE_JBIG2:
+		return size + len * 8;
+	case FZ_IMAGE_JPEG:
+	case FZ_IMAGE_FAX:
+		return size + len * 4;
+	default:
+		return size + len;
+	}
+}
+
 static const fz_store_type fz_image_store_type =
 {
 	"fz_image",
@@ -117,7 +150,8 @@ static const fz_store_type fz_image_store_type =
 	fz_drop_image_key,
 	fz_cmp_image_key,
 	fz_format_image_key,
-	fz_needs_reap_image_key
+	fz_needs_reap_image_key,
+	fz_image_key_cost
 };
 
 void
@@ -503,6 +537,63 @@ drop_pixmap_image(fz_context *ctx, fz_image *image_)
 	fz_drop_pixmap(ctx, image->tile);
 }
 
+/* Flate compressed images are inflated in one go when possible, as that
+ * is much quicker than reading them through the flate filter. That means
+ * holding all the decompressed data at once though, so we only do it for
+ * moderately sized images that are wanted whole and at full resolution;
+ * otherwise the filter lets us skip the rows we don't need. Returns NULL
+ * if the caller should use the filter after all. */
+static fz_stream *
+open_inflated_image(fz_context *ctx, fz_compressed_image *image, const fz_irect *subarea, const int *l2factor)
+{
+	fz_compression_params *params = &image->buffer->params;
+	fz_buffer *buf = image->buffer->buffer;
+	fz_buffer *inflated;
+	fz_stream *stm, *head = NULL;
+	size_t stride, size;
+
+	if (l2factor && *l2factor > 0)
+		return NULL;
+	if (subarea && (subarea->x0 > 0 || subarea->y0 > 0 || subarea->x1 < image->super.w || subarea->y1 < image->super.h))
+		return NULL;
+
+	/* Allow for the tag byte at the start of each row that the PNG
+	 * predictors use. */
+	stride = ((size_t)image->super.w * image->super.n * image->super.bpc + 7) / 8 + 1;
+	if (image->super.h <= 0 || stride > SIZE_MAX / image->super.h)
+		return NULL;
+	size = stride * image->super.h;
+	if (size > MAX_INFLATE_IN_ONE_GO)
+		return NULL;
+
+	inflated = fz_inflate_data(ctx, buf->data, buf->len, 15, size, size);
+	if (!inflated)
+		return NULL;
+
+	fz_try(ctx)
+		stm = fz_open_buffer(ctx, inflated);
+	fz_always(ctx)
+		fz_drop_buffer(ctx, inflated);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	if (params->u.flate.predictor <= 1)
+		return stm;
+
+	fz_try(ctx)
+		head = fz_open_predict(ctx, stm,
+				params->u.flate.predictor,
+				params->u.flate.columns,
+				params->u.flate.colors,
+				params->u.flate.bpc);
+	fz_always(ctx)
+		fz_drop_stream(ctx, stm);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	return head;
+}
+
 static fz_pixmap *
 compressed_image_get_pixmap(fz_context *ctx, fz_image *image_, fz_irect *subarea, int w, int h, int *l2factor)
 {
@@ -569,7 +660,11 @@ compressed_image_get_pixmap(fz_context *ctx, fz_image *image_, fz_irect *subarea
 
 	default:
 		native_l2factor = l2factor ? *l2factor : 0;
-		stm = fz_open_image_decomp_stream_from_buffer(ctx, image->buffer, l2factor);
+		stm = NULL;
+		if (image->buffer->params.type == FZ_IMAGE_FLATE)
+			stm = open_inflated_image(ctx, image, subarea, l2factor);
+		if (!stm)
+			stm = fz_open_image_decomp_stream_from_buffer(ctx, image->buffer, l2factor);
 		fz_try(ctx)
 		{
 			if (l2factor)
@@ -1,6 +1,7 @@
 #include "mupdf/fitz.h"
 
 #include <assert.h>
+#include <math.h>
 #include <string.h>
 
 #define STACK_SIZE 96
@@ -112,6 +113,8 @@ enum {
 	MAX_NODE_SIZE = (1<<9)-sizeof(fz_display_node)
 };
 
+typedef struct fz_display_index fz_display_index;
+
 struct fz_display_list
 {
 	fz_storable storable;
@@ -119,8 +122,96 @@ struct fz_display_list
 	fz_rect mediabox;
 	size_t max;
 	size_t len;
+	fz_display_index *index;
+};
+
+/* The index of a display list (see fz_index_display_list) is an R-tree
+ * of the items on the page, where an item is a single command at any
+ * depth, or a tile together with everything up to its end. Items that
+ * are never culled by the index (tiles, layers and so on) are kept to
+ * one side, and always run. These include the nodes that begin and end
+ * clips, masks and groups, so that the nesting is always seen in full;
+ * when one of those is culled by fz_run_display_list, so is everything
+ * up to its end, whatever the index says.
+ *
+ * To run a subset of the items in order, the graphics state is picked
+ * up from a checkpoint taken every INDEX_CHECKPOINT commands, and the
+ * nodes from there to the start of the item.
+ */
+enum
+{
+	INDEX_FANOUT = 16,
+	INDEX_MAX_LEVELS = 16,
+	INDEX_CHECKPOINT = 32
 };
 
+typedef struct
+{
+	fz_rect bounds;
+	int first, count;
+} fz_display_rnode;
+
+typedef struct
+{
+	/* The offset of the node whose graphics state this is (before
+	 * the node itself is looked at). color is the offset of the
+	 * color values in the list, or 0 when they are the defaults for
+	 * cs. */
+	size_t start;
+	fz_rect rect;
+	fz_colorspace *colorspace;
+	int cs;
+	size_t color;
+	float alpha;
+	fz_matrix ctm;
+	fz_stroke_state *stroke;
+	fz_path *path;
+} fz_display_checkpoint;
+
+struct fz_display_index
+{
+	/* The offsets of the items, plus one for the end of the list. */
+	int item_count;
+	size_t *items;
+
+	/* The items that are always run. */
+	int always_count;
+	int *always;
+
+	/* The tree. Level 0 are the items themselves (with first set to
+	 * the item number), and the nodes of each level above point to a
+	 * range of nodes in the level below. */
+	int levels;
+	int count[INDEX_MAX_LEVELS];
+	fz_display_rnode *level[INDEX_MAX_LEVELS];
+
+	int checkpoint_count;
+	fz_display_checkpoint *checkpoints;
+};
+
+static void
+free_display_index(fz_context *ctx, fz_display_index *index)
+{
+	int k;
+
+	for (k = 0; k < index->levels; k++)
+		fz_free(ctx, index->level[k]);
+	fz_free(ctx, index->items);
+	fz_free(ctx, index->always);
+	fz_free(ctx, index->checkpoints);
+	fz_free(ctx, index);
+}
+
+static void
+drop_display_index(fz_context *ctx, fz_display_list *list)
+{
+	if (list->index)
+	{
+		free_display_index(ctx, list->index);
+		list->index = NULL;
+	}
+}
+
 typedef struct
 {
 	fz_device super;
@@ -185,6 +276,10 @@ fz_append_display_node(
 	fz_rect local_rect;
 	size_t path_size = 0;
 
+	/* Anything added to the list (including the rect updates below)
+	 * makes the index out of date. */
+	drop_display_index(ctx, list);
+
 	switch (cmd)
 	{
 	case FZ_CMD_CLIP_PATH:
@@ -1434,6 +1529,7 @@ fz_drop_display_list_imp(fz_context *ctx, fz_storable *list_)
 		}
 		node = next;
 	}
+	drop_display_index(ctx, list);
 	fz_free(ctx, list->list);
 	fz_free(ctx, list);
 }
@@ -1447,6 +1543,7 @@ fz_new_display_list(fz_context *ctx, fz_rect mediabox)
 	list->mediabox = mediabox;
 	list->max = 0;
 	list->len = 0;
+	list->index = NULL;
 	return list;
 }
 
@@ -1475,6 +1572,424 @@ int fz_display_list_is_empty(fz_context *ctx, const fz_display_list *list)
 	return !list || list->len == 0;
 }
 
+static fz_rect
+union_bounds(fz_rect a, fz_rect b)
+{
+	/* Unlike fz_union_rect, keep zero width (or height) rects, as
+	 * they may not be empty once transformed. */
+	if (a.x0 > b.x0)
+		a.x0 = b.x0;
+	if (a.y0 > b.y0)
+		a.y0 = b.y0;
+	if (a.x1 < b.x1)
+		a.x1 = b.x1;
+	if (a.y1 < b.y1)
+		a.y1 = b.y1;
+	return a;
+}
+
+static int
+cmp_rnode_x(const void *a_, const void *b_)
+{
+	const fz_display_rnode *a = a_;
+	const fz_display_rnode *b = b_;
+	float ca = a->bounds.x0 + a->bounds.x1;
+	float cb = b->bounds.x0 + b->bounds.x1;
+	return ca < cb ? -1 : ca > cb ? 1 : 0;
+}
+
+static int
+cmp_rnode_y(const void *a_, const void *b_)
+{
+	const fz_display_rnode *a = a_;
+	const fz_display_rnode *b = b_;
+	float ca = a->bounds.y0 + a->bounds.y1;
+	float cb = b->bounds.y0 + b->bounds.y1;
+	return ca < cb ? -1 : ca > cb ? 1 : 0;
+}
+
+/* Add a level to the top of the tree, by sorting the nodes of the
+ * current top level into vertical slices, and each slice from top to
+ * bottom, and grouping them in turn ("sort tile recursive" packing). */
+static void
+pack_display_index(fz_context *ctx, fz_display_index *index)
+{
+	int k = index->levels - 1;
+	fz_display_rnode *nodes = index->level[k];
+	int n = index->count[k];
+	int parents = (n + INDEX_FANOUT - 1) / INDEX_FANOUT;
+	int slices = (int)ceilf(sqrtf(parents));
+	int per_slice = (parents + slices - 1) / slices * INDEX_FANOUT;
+	fz_display_rnode *up;
+	int i, j, c;
+
+	qsort(nodes, n, sizeof(*nodes), cmp_rnode_x);
+	for (i = 0; i < n; i += per_slice)
+		qsort(nodes + i, fz_mini(per_slice, n - i), sizeof(*nodes), cmp_rnode_y);
+
+	up = fz_malloc_array(ctx, parents, fz_display_rnode);
+	for (i = 0, j = 0; i < n; i += INDEX_FANOUT, j++)
+	{
+		up[j].first = i;
+		up[j].count = fz_mini(INDEX_FANOUT, n - i);
+		up[j].bounds = nodes[i].bounds;
+		for (c = 1; c < up[j].count; c++)
+			up[j].bounds = union_bounds(up[j].bounds, nodes[i + c].bounds);
+	}
+
+	index->level[k + 1] = up;
+	index->count[k + 1] = parents;
+	index->levels++;
+}
+
+void
+fz_index_display_list(fz_context *ctx, fz_display_list *list)
+{
+	fz_display_index *index;
+	fz_display_node *node;
+	fz_display_node *node_end = list->list + list->len;
+	int item_max = 0, always_max = 0, leaf_max = 0, checkpoint_max = 0;
+	int cmds = 0;
+	int tile_depth = 0;
+
+	/* Current graphics state as unpacked from list */
+	fz_rect rect = { 0 };
+	fz_colorspace *colorspace = fz_device_gray(ctx);
+	int cs = CS_GRAY_0;
+	int cs_n = 1;
+	size_t color = 0;
+	float alpha = 1.0f;
+	fz_matrix ctm = fz_identity;
+	fz_stroke_state *stroke = NULL;
+	fz_path *path = NULL;
+
+	if (list->index || list->len == 0)
+		return;
+
+	index = fz_malloc_struct(ctx, fz_display_index);
+	index->levels = 1;
+
+	fz_try(ctx)
+	{
+		for (node = list->list; node != node_end; cmds++)
+		{
+			fz_display_node n = *node;
+			fz_display_node *next = node + n.size;
+			size_t start = node - list->list;
+
+			if (cmds % INDEX_CHECKPOINT == 0)
+			{
+				fz_display_checkpoint *chk;
+				if (index->checkpoint_count == checkpoint_max)
+				{
+					checkpoint_max = checkpoint_max ? checkpoint_max * 2 : 64;
+					index->checkpoints = fz_realloc_array(ctx, index->checkpoints, checkpoint_max, fz_display_checkpoint);
+				}
+				chk = &index->checkpoints[index->checkpoint_count++];
+				chk->start = start;
+				chk->rect = rect;
+				chk->colorspace = colorspace;
+				chk->cs = cs;
+				chk->color = color;
+				chk->alpha = alpha;
+				chk->ctm = ctm;
+				chk->stroke = stroke;
+				chk->path = path;
+			}
+
+			node++;
+			if (n.rect)
+			{
+				rect = *(fz_rect *)node;
+				node += SIZE_IN_NODES(sizeof(fz_rect));
+			}
+			if (n.cs)
+			{
+				switch (n.cs)
+				{
+				default:
+				case CS_GRAY_0:
+				case CS_GRAY_1:
+					colorspace = fz_device_gray(ctx);
+					break;
+				case CS_RGB_0:
+				case CS_RGB_1:
+					colorspace = fz_device_rgb(ctx);
+					break;
+				case CS_CMYK_0:
+				case CS_CMYK_1:
+					colorspace = fz_device_cmyk(ctx);
+					break;
+				case CS_OTHER_0:
+					colorspace = *(fz_colorspace **)node;
+					node += SIZE_IN_NODES(sizeof(fz_colorspace *));
+					break;
+				}
+				cs = n.cs;
+				cs_n = fz_colorspace_n(ctx, colorspace);
+				color = 0;
+			}
+			if (n.color)
+			{
+				color = node - list->list;
+				node += SIZE_IN_NODES(cs_n * sizeof(float));
+			}
+			if (n.alpha)
+			{
+				switch (n.alpha)
+				{
+				default:
+				case ALPHA_0:
+					alpha = 0.0f;
+					break;
+				case ALPHA_1:
+					alpha = 1.0f;
+					break;
+				case ALPHA_PRESENT:
+					alpha = *(float *)node;
+					node += SIZE_IN_NODES(sizeof(float));
+					break;
+				}
+			}
+			if (n.ctm != 0)
+			{
+				float *packed_ctm = (float *)node;
+				if (n.ctm & CTM_CHANGE_AD)
+				{
+					ctm.a = *packed_ctm++;
+					ctm.d = *packed_ctm++;
+					node += SIZE_IN_NODES(2*sizeof(float));
+				}
+				if (n.ctm & CTM_CHANGE_BC)
+				{
+					ctm.b = *packed_ctm++;
+					ctm.c = *packed_ctm++;
+					node += SIZE_IN_NODES(2*sizeof(float));
+				}
+				if (n.ctm & CTM_CHANGE_EF)
+				{
+					ctm.e = *packed_ctm++;
+					ctm.f = *packed_ctm;
+					node += SIZE_IN_NODES(2*sizeof(float));
+				}
+			}
+			if (n.stroke)
+				stroke = *(fz_stroke_state **)node;
+			if (n.path)
+				path = (fz_path *)node;
+
+			node = next;
+
+			/* Find the ends of the items. */
+			if (tile_depth > 0)
+			{
+				/* Nothing in a tile is culled, so only the end of
+				 * the tile matters. */
+				if (n.cmd == FZ_CMD_BEGIN_TILE)
+					tile_depth++;
+				else if (n.cmd == FZ_CMD_END_TILE)
+					tile_depth--;
+			}
+			else
+			{
+				int item = index->item_count;
+				int always = 0;
+
+				if (index->item_count + 1 >= item_max)
+				{
+					item_max = item_max ? item_max * 2 : 256;
+					index->items = fz_realloc_array(ctx, index->items, item_max, size_t);
+				}
+				index->items[index->item_count++] = start;
+
+				switch (n.cmd)
+				{
+				case FZ_CMD_BEGIN_TILE:
+					tile_depth = 1;
+					always = 1;
+					break;
+				case FZ_CMD_CLIP_PATH:
+				case FZ_CMD_CLIP_STROKE_PATH:
+				case FZ_CMD_CLIP_TEXT:
+				case FZ_CMD_CLIP_STROKE_TEXT:
+				case FZ_CMD_CLIP_IMAGE_MASK:
+				case FZ_CMD_BEGIN_MASK:
+				case FZ_CMD_BEGIN_GROUP:
+				case FZ_CMD_POP_CLIP:
+				case FZ_CMD_END_GROUP:
+				case FZ_CMD_END_MASK:
+					/* Left for fz_run_display_list to cull. */
+				case FZ_CMD_END_TILE:
+				case FZ_CMD_RENDER_FLAGS:
+				case FZ_CMD_DEFAULT_COLORSPACES:
+				case FZ_CMD_BEGIN_LAYER:
+				case FZ_CMD_END_LAYER:
+					always = 1;
+					break;
+				}
+
+				if (!always && fz_is_infinite_rect(rect))
+					always = 1;
+
+				if (always)
+				{
+					if (index->always_count == always_max)
+					{
+						always_max = always_max ? always_max * 2 : 64;
+						index->always = fz_realloc_array(ctx, index->always, always_max, int);
+					}
+					index->always[index->always_count++] = item;
+				}
+				else if (rect.x0 != rect.x1 || rect.y0 != rect.y1)
+				{
+					/* (A rect that is a single point stays one
+					 * whatever the transform, so is always culled.) */
+					fz_display_rnode *leaf;
+					if (index->count[0] == leaf_max)
+					{
+						leaf_max = leaf_max ? leaf_max * 2 : 256;
+						index->level[0] = fz_realloc_array(ctx, index->level[0], leaf_max, fz_display_rnode);
+					}
+					leaf = &index->level[0][index->count[0]++];
+					leaf->bounds = rect;
+					leaf->first = item;
+					leaf->count = 0;
+				}
+			}
+		}
+		index->items[index->item_count] = list->len;
+
+		while (index->count[index->levels - 1] > 1 && index->levels < INDEX_MAX_LEVELS)
+			pack_display_index(ctx, index);
+	}
+	fz_catch(ctx)
+	{
+		free_display_index(ctx, index);
+		fz_rethrow(ctx);
+	}
+
+	list->index = index;
+}
+
+static int
+index_bounds_visible(fz_rect bounds, fz_matrix ctm, fz_rect scissor)
+{
+	/* Allow some slack for rounding, as the transformed bounds of a
+	 * group of nodes may not quite cover the nodes transformed. */
+	fz_rect r = fz_expand_rect(fz_transform_rect(bounds, ctm), 1);
+	if (fz_is_infinite_rect(r))
+		return 1;
+	return !fz_is_empty_rect(fz_intersect_rect(r, scissor));
+}
+
+/* Gather the items below a node of the tree that may be visible. Returns
+ * 0 if there are more than max of them. */
+static int
+find_visible_items(fz_display_index *index, int level, fz_display_rnode *rn, fz_matrix ctm, fz_rect scissor, int *items, int *len, int max)
+{
+	int i;
+
+	if (!index_bounds_visible(rn->bounds, ctm, scissor))
+		return 1;
+	if (level == 0)
+	{
+		if (*len == max)
+			return 0;
+		items[(*len)++] = rn->first;
+		return 1;
+	}
+	for (i = 0; i < rn->count; i++)
+		if (!find_visible_items(index, level - 1, &index->level[level - 1][rn->first + i], ctm, scissor, items, len, max))
+			return 0;
+	return 1;
+}
+
+static int
+cmp_item(const void *a_, const void *b_)
+{
+	int a = *(const int *)a_;
+	int b = *(const int *)b_;
+	return a - b;
+}
+
+/* Make a list (in order) of the items of a display list that may be
+ * visible within scissor. Returns NULL when it would be no quicker to
+ * use the list than to look at every item. */
+static int *
+list_visible_items(fz_context *ctx, fz_display_index *index, fz_matrix ctm, fz_rect scissor, int *len)
+{
+	int top = index->levels - 1;
+	int max = index->item_count / 2;
+	int *items;
+	int i;
+
+	if (index->always_count > max)
+		return NULL;
+
+	items = fz_malloc_array(ctx, max + 1, int);
+	memcpy(items, index->always, index->always_count * sizeof(int));
+	*len = index->always_count;
+	for (i = 0; i < index->count[top]; i++)
+	{
+		if (!find_visible_items(index, top, &index->level[top][i], ctm, scissor, items, len, max))
+		{
+			fz_free(ctx, items);
+			return NULL;
+		}
+	}
+
+	qsort(items, *len, sizeof(int), cmp_item);
+	return items;
+}
+
+/* Find the last checkpoint at or before the node at offset start. */
+static fz_display_checkpoint *
+find_checkpoint(fz_display_index *index, size_t start)
+{
+	int lo = 0, hi = index->checkpoint_count - 1;
+
+	while (lo < hi)
+	{
+		int mid = (lo + hi + 1) / 2;
+		if (index->checkpoints[mid].start <= start)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+	return &index->checkpoints[lo];
+}
+
+static void
+restore_checkpoint(fz_context *ctx, fz_display_list *list, fz_display_checkpoint *chk,
+	fz_rect *rect, fz_colorspace **colorspace, float *color, float *alpha, fz_matrix *ctm,
+	fz_stroke_state **stroke, fz_path **path)
+{
+	int nc;
+
+	*rect = chk->rect;
+	fz_drop_colorspace(ctx, *colorspace);
+	*colorspace = fz_keep_colorspace(ctx, chk->colorspace);
+	nc = fz_colorspace_n(ctx, *colorspace);
+	if (chk->color)
+		memcpy(color, (float *)&list->list[chk->color], nc * sizeof(float));
+	else
+	{
+		memset(color, 0, nc * sizeof(float));
+		if (chk->cs == CS_GRAY_1)
+			color[0] = 1.0f;
+		else if (chk->cs == CS_RGB_1)
+			color[0] = color[1] = color[2] = 1.0f;
+		else if (chk->cs == CS_CMYK_1)
+			color[3] = 1.0f;
+	}
+	*alpha = chk->alpha;
+	*ctm = chk->ctm;
+	fz_drop_stroke_state(ctx, *stroke);
+	*stroke = fz_keep_stroke_state(ctx, chk->stroke);
+	fz_drop_path(ctx, *path);
+	*path = fz_keep_path(ctx, chk->path);
+}
+
 void
 fz_run_display_list(fz_context *ctx, fz_display_list *list, fz_device *dev, fz_matrix top_ctm, fz_rect scissor, fz_cookie *cookie)
 {
@@ -1500,6 +2015,16 @@ fz_run_display_list(fz_context *ctx, fz_display_list *list, fz_device *dev, fz_m
 	fz_matrix trans_ctm;
 	int tile_skip_depth = 0;
 
+	/* The items that the index shows may be visible, the end of the
+	 * one being run, and the start of it (nodes before which are only
+	 * looked at to bring the graphics state up to date). */
+	fz_display_index *index = NULL;
+	int *visible = NULL;
+	int visible_len = 0;
+	int next_visible = 0;
+	fz_display_node *visible_end = NULL;
+	fz_display_node *quiet_end = list->list;
+
 	if (cookie)
 	{
 		cookie->progress_max = list->len;
@@ -1508,13 +2033,54 @@ fz_run_display_list(fz_context *ctx, fz_display_list *list, fz_device *dev, fz_m
 
 	color_params = fz_default_color_params;
 
+	if (list->index && !fz_is_infinite_rect(scissor))
+	{
+		fz_try(ctx)
+			visible = list_visible_items(ctx, list->index, top_ctm, scissor, &visible_len);
+		fz_catch(ctx)
+			visible = NULL; /* Just look at every node instead. */
+		if (visible)
+		{
+			index = list->index;
+			visible_end = list->list;
+		}
+	}
+
 	node = list->list;
 	node_end = &list->list[list->len];
 	for (; node != node_end ; node = next_node)
 	{
 		int empty;
-		fz_display_node n = *node;
+		fz_display_node n;
+
+		if (node == visible_end)
+		{
+			size_t start;
+			fz_display_checkpoint *chk;
+			int item;
+
+			if (next_visible == visible_len)
+			{
+				progress = list->len;
+				break;
+			}
+
+			/* Move on to the next item that may be visible, jumping
+			 * over the nodes in between if there are enough of them. */
+			item = visible[next_visible++];
+			start = index->items[item];
+			chk = find_checkpoint(index, start);
+			if (&list->list[chk->start] > node)
+			{
+				restore_checkpoint(ctx, list, chk, &rect, &colorspace, color, &alpha, &ctm, &stroke, &path);
+				node = &list->list[chk->start];
+				progress = chk->start;
+			}
+			quiet_end = &list->list[start];
+			visible_end = &list->list[index->items[item + 1]];
+		}
 
+		n = *node;
 		next_node = node + n.size;
 
 		/* Check the cookie for aborting */
@@ -1641,6 +2207,9 @@ fz_run_display_list(fz_context *ctx, fz_display_list *list, fz_device *dev, fz_m
 			node += SIZE_IN_NODES(fz_packed_path_size(path));
 		}
 
+		if (next_node <= quiet_end)
+			continue;
+
 		if (tile_skip_depth > 0)
 		{
 			if (n.cmd == FZ_CMD_BEGIN_TILE)
@@ -1810,6 +2379,7 @@ visible:
 	fz_drop_colorspace(ctx, colorspace);
 	fz_drop_stroke_state(ctx, stroke);
 	fz_drop_path(ctx, path);
+	fz_free(ctx, visible);
 	if (cookie)
 		cookie->progress = progress;
 }
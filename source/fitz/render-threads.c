@@ -0,0 +1,625 @@
+#include "mupdf/fitz.h"
+#include "mupdf/helpers/mu-threads.h"
+
+#include <string.h>
+
+/*
+	The workers share a queue of jobs: whenever a worker is free, it
+	takes the next band that has not been started from the oldest job
+	that has one. Bands are collected by the job's caller in order.
+	When rendering in bands, only nslots bands beyond the last one
+	collected may be started, so that no more than nslots band pixmaps
+	are ever needed; the workers move on to the next job (the next
+	page, say) when they reach that limit.
+
+	Each band has a slot, with a semaphore that the worker triggers when
+	it has finished with the band. Idle workers wait on a semaphore of
+	their own, which is triggered (once) when there may be more work.
+
+	The same queue serves as a thread pool (see fz_render_thread_pool),
+	where the pieces of work take the place of bands. The thread that
+	asks for the work takes pieces as well, so the work gets done even
+	if every worker is busy, or is itself waiting for the pool.
+*/
+
+typedef struct
+{
+	fz_render_band band;
+	fz_cookie cookie;
+	int failed;
+	int errcode;
+	char errmsg[256];
+	mu_semaphore done;
+} render_slot;
+
+struct fz_render_job
+{
+	fz_render_threads *threads;
+	fz_display_list *list;
+	fz_matrix ctm;
+	fz_irect area;
+	int band_height;
+	int bands;
+	fz_pixmap *target; /* the pixmap we render into, if not in bands */
+	fz_render_band_fn *draw;
+	fz_output_band_fn *write;
+	void *arg;
+	fz_cookie *cookie;
+	int nslots;
+	render_slot *slot;
+	int collected; /* bands before this have been collected */
+
+	/* For thread pool work, which has no slots. */
+	void (*task)(void *arg, int i);
+	void *task_arg;
+	mu_semaphore finished;
+
+	/* These are protected by the mutex */
+	int queued;
+	fz_render_job *next; /* the next job in the queue */
+	int started; /* bands before this have been started */
+	int limit; /* bands before this may be started */
+	int stop; /* start no more bands */
+	int done; /* pieces of thread pool work finished */
+};
+
+typedef struct
+{
+	fz_render_threads *threads;
+	fz_context *ctx;
+	int idle;
+	mu_semaphore wake;
+	mu_thread thread;
+} render_worker;
+
+struct fz_render_threads
+{
+	int count;
+	render_worker *worker;
+	mu_mutex mutex;
+	fz_render_job *jobs;
+	int quit;
+};
+
+static void
+draw_band(fz_context *ctx, fz_display_list *list, fz_render_band *band, int clear, fz_cookie *cookie)
+{
+	fz_device *dev;
+
+	if (clear)
+	{
+		if (band->pix->alpha)
+			fz_clear_pixmap(ctx, band->pix);
+		else
+			fz_clear_pixmap_with_value(ctx, band->pix, 255);
+	}
+
+	dev = fz_new_draw_device(ctx, fz_identity, band->pix);
+	fz_try(ctx)
+	{
+		fz_run_display_list(ctx, list, dev, band->ctm, fz_rect_from_irect(fz_pixmap_bbox(ctx, band->pix)), cookie);
+		fz_close_device(ctx, dev);
+	}
+	fz_always(ctx)
+		fz_drop_device(ctx, dev);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+/* Called on a worker thread, once the slot has been claimed (and its
+ * cookie cleared) with the mutex held; never throws. Bands started
+ * after an abort are skipped, but still reported as done to the
+ * calling thread. */
+static void
+render_band(fz_context *ctx, fz_render_job *job, int b, int skip)
+{
+	render_slot *slot = &job->slot[b % job->nslots];
+	fz_render_band *band = &slot->band;
+
+	band->num = b;
+	band->y = b * job->band_height;
+	band->h = fz_mini(job->band_height, job->area.y1 - job->area.y0 - band->y);
+	band->ctm = job->ctm;
+	band->bit = NULL;
+	slot->failed = 0;
+
+	fz_try(ctx)
+	{
+		if (job->target)
+		{
+			fz_irect r = job->area;
+			r.y0 += band->y;
+			r.y1 = r.y0 + band->h;
+			band->pix = fz_new_pixmap_from_pixmap(ctx, job->target, &r);
+		}
+		else
+			band->ctm.f -= band->y;
+
+		if (skip)
+			slot->cookie.abort = 1;
+		else if (job->draw)
+			job->draw(ctx, job->arg, job->list, band, &slot->cookie);
+		else
+			draw_band(ctx, job->list, band, !job->target, &slot->cookie);
+	}
+	fz_always(ctx)
+	{
+		if (job->target)
+		{
+			fz_drop_pixmap(ctx, band->pix);
+			band->pix = NULL;
+		}
+	}
+	fz_catch(ctx)
+	{
+		slot->failed = 1;
+		slot->errcode = fz_caught(ctx);
+		fz_strlcpy(slot->errmsg, fz_caught_message(ctx), sizeof slot->errmsg);
+	}
+
+	mu_trigger_semaphore(&slot->done);
+}
+
+static void
+render_worker_thread(void *arg)
+{
+	render_worker *me = arg;
+	fz_render_threads *threads = me->threads;
+	fz_render_job *job;
+
+	mu_lock_mutex(&threads->mutex);
+	while (!threads->quit)
+	{
+		for (job = threads->jobs; job; job = job->next)
+			if (!job->stop && job->started < job->limit)
+				break;
+		if (job)
+		{
+			int b = job->started++;
+			int skip = 0;
+			if (!job->task)
+			{
+				/* Clear the cookie before unqueue_job can see
+				 * the band as started, and abort it. */
+				memset(&job->slot[b % job->nslots].cookie, 0, sizeof(fz_cookie));
+				skip = job->cookie && job->cookie->abort;
+			}
+			mu_unlock_mutex(&threads->mutex);
+			if (job->task)
+			{
+				job->task(job->task_arg, b);
+				mu_lock_mutex(&threads->mutex);
+				if (++job->done == job->bands)
+					mu_trigger_semaphore(&job->finished);
+			}
+			else
+			{
+				render_band(me->ctx, job, b, skip);
+				mu_lock_mutex(&threads->mutex);
+			}
+		}
+		else
+		{
+			me->idle = 1;
+			mu_unlock_mutex(&threads->mutex);
+			mu_wait_semaphore(&me->wake);
+			mu_lock_mutex(&threads->mutex);
+		}
+	}
+	mu_unlock_mutex(&threads->mutex);
+}
+
+/* Call with the mutex held. */
+static void
+wake_workers(fz_render_threads *threads)
+{
+	int i;
+
+	for (i = 0; i < threads->count; i++)
+	{
+		render_worker *w = &threads->worker[i];
+		if (w->idle)
+		{
+			w->idle = 0;
+			mu_trigger_semaphore(&w->wake);
+		}
+	}
+}
+
+fz_render_threads *
+fz_new_render_threads(fz_context *ctx, int count)
+{
+	fz_render_threads *threads;
+
+	if (count < 1)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "need at least one rendering thread");
+
+	threads = fz_malloc_struct(ctx, fz_render_threads);
+	fz_try(ctx)
+	{
+		threads->worker = fz_calloc(ctx, count, sizeof(render_worker));
+		if (mu_create_mutex(&threads->mutex))
+			fz_throw(ctx, FZ_ERROR_GENERIC, "cannot create rendering threads");
+		while (threads->count < count)
+		{
+			render_worker *w = &threads->worker[threads->count];
+			w->threads = threads;
+			w->ctx = fz_clone_context(ctx);
+			if (!w->ctx)
+				fz_throw(ctx, FZ_ERROR_GENERIC, "cannot clone context for rendering threads");
+			if (mu_create_semaphore(&w->wake))
+			{
+				fz_drop_context(w->ctx);
+				fz_throw(ctx, FZ_ERROR_GENERIC, "cannot create rendering threads");
+			}
+			if (mu_create_thread(&w->thread, render_worker_thread, w))
+			{
+				mu_destroy_semaphore(&w->wake);
+				fz_drop_context(w->ctx);
+				fz_throw(ctx, FZ_ERROR_GENERIC, "cannot create rendering threads");
+			}
+			threads->count++;
+		}
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_render_threads(ctx, threads);
+		fz_rethrow(ctx);
+	}
+
+	return threads;
+}
+
+void
+fz_drop_render_threads(fz_context *ctx, fz_render_threads *threads)
+{
+	int i;
+
+	if (!threads)
+		return;
+
+	if (threads->count > 0)
+	{
+		mu_lock_mutex(&threads->mutex);
+		threads->quit = 1;
+		wake_workers(threads);
+		mu_unlock_mutex(&threads->mutex);
+	}
+	for (i = 0; i < threads->count; i++)
+	{
+		render_worker *w = &threads->worker[i];
+		mu_destroy_thread(&w->thread);
+		mu_destroy_semaphore(&w->wake);
+		fz_drop_context(w->ctx);
+	}
+	mu_destroy_mutex(&threads->mutex);
+	fz_free(ctx, threads->worker);
+	fz_free(ctx, threads);
+}
+
+int
+fz_count_render_threads(fz_context *ctx, fz_render_threads *threads)
+{
+	return threads ? threads->count : 0;
+}
+
+static void
+drop_slots(fz_context *ctx, fz_render_job *job)
+{
+	int i;
+
+	for (i = 0; i < job->nslots; i++)
+	{
+		fz_drop_pixmap(ctx, job->slot[i].band.pix);
+		mu_destroy_semaphore(&job->slot[i].done);
+	}
+	fz_free(ctx, job->slot);
+	job->slot = NULL;
+}
+
+static void
+new_slots(fz_context *ctx, fz_render_job *job, int nslots)
+{
+	job->slot = fz_calloc(ctx, nslots, sizeof(render_slot));
+	job->nslots = 0;
+	fz_try(ctx)
+	{
+		while (job->nslots < nslots)
+		{
+			if (mu_create_semaphore(&job->slot[job->nslots].done))
+				fz_throw(ctx, FZ_ERROR_GENERIC, "cannot create semaphore");
+			job->nslots++;
+		}
+	}
+	fz_catch(ctx)
+	{
+		drop_slots(ctx, job);
+		fz_rethrow(ctx);
+	}
+}
+
+/* Add the job to the end of the queue. */
+static void
+queue_job(fz_render_threads *threads, fz_render_job *job)
+{
+	fz_render_job **tail;
+
+	mu_lock_mutex(&threads->mutex);
+	for (tail = &threads->jobs; *tail; tail = &(*tail)->next)
+		;
+	*tail = job;
+	job->next = NULL;
+	job->queued = 1;
+	job->started = 0;
+	job->limit = job->task ? job->bands : fz_mini(job->nslots, job->bands);
+	job->stop = 0;
+	job->done = 0;
+	wake_workers(threads);
+	mu_unlock_mutex(&threads->mutex);
+}
+
+/* Take the job off the queue. Call with the mutex held. */
+static void
+remove_job(fz_render_threads *threads, fz_render_job *job)
+{
+	fz_render_job **link;
+
+	for (link = &threads->jobs; *link; link = &(*link)->next)
+	{
+		if (*link == job)
+		{
+			*link = job->next;
+			break;
+		}
+	}
+	job->queued = 0;
+}
+
+/* Collect the bands in order, until the end or an abort. */
+static void
+collect_job(fz_context *ctx, fz_render_job *job)
+{
+	fz_render_threads *threads = job->threads;
+
+	while (job->collected < job->bands)
+	{
+		render_slot *slot = &job->slot[job->collected % job->nslots];
+
+		mu_wait_semaphore(&slot->done);
+		job->collected++;
+		if (job->cookie)
+		{
+			job->cookie->errors += slot->cookie.errors;
+			job->cookie->incomplete |= slot->cookie.incomplete;
+		}
+
+		/* The band counts as collected now, so unqueue_job won't
+		 * wait for it again; we must drop its bitmap here whatever
+		 * happens. */
+		if (slot->failed || (job->cookie && job->cookie->abort))
+		{
+			fz_drop_bitmap(ctx, slot->band.bit);
+			slot->band.bit = NULL;
+			if (slot->failed)
+				fz_throw(ctx, slot->errcode, "%s", slot->errmsg);
+			break;
+		}
+
+		fz_try(ctx)
+		{
+			if (job->write)
+				job->write(ctx, job->arg, &slot->band);
+		}
+		fz_always(ctx)
+		{
+			fz_drop_bitmap(ctx, slot->band.bit);
+			slot->band.bit = NULL;
+		}
+		fz_catch(ctx)
+			fz_rethrow(ctx);
+
+		mu_lock_mutex(&threads->mutex);
+		job->limit = fz_mini(job->collected + job->nslots, job->bands);
+		wake_workers(threads);
+		mu_unlock_mutex(&threads->mutex);
+	}
+}
+
+/* Stop, wait for the bands still in progress, and take the job off
+ * the queue. */
+static void
+unqueue_job(fz_context *ctx, fz_render_job *job)
+{
+	fz_render_threads *threads = job->threads;
+	int b, started;
+
+	if (!job->queued)
+		return;
+
+	mu_lock_mutex(&threads->mutex);
+	job->stop = 1;
+	started = job->started;
+	for (b = job->collected; b < started; b++)
+		job->slot[b % job->nslots].cookie.abort = 1;
+	mu_unlock_mutex(&threads->mutex);
+	for (b = job->collected; b < started; b++)
+	{
+		render_slot *slot = &job->slot[b % job->nslots];
+		mu_wait_semaphore(&slot->done);
+		fz_drop_bitmap(ctx, slot->band.bit);
+		slot->band.bit = NULL;
+	}
+	job->collected = started;
+
+	mu_lock_mutex(&threads->mutex);
+	remove_job(threads, job);
+	mu_unlock_mutex(&threads->mutex);
+}
+
+static void
+run_thread_pool(void *user, int count, void (*fn)(void *arg, int i), void *arg)
+{
+	fz_render_threads *threads = user;
+	fz_render_job job = { 0 };
+	int i, wait;
+
+	if (count <= 0)
+		return;
+	if (count == 1 || mu_create_semaphore(&job.finished))
+	{
+		for (i = 0; i < count; i++)
+			fn(arg, i);
+		return;
+	}
+
+	job.threads = threads;
+	job.task = fn;
+	job.task_arg = arg;
+	job.bands = count;
+	queue_job(threads, &job);
+
+	mu_lock_mutex(&threads->mutex);
+	while (job.started < job.bands)
+	{
+		i = job.started++;
+		mu_unlock_mutex(&threads->mutex);
+		fn(arg, i);
+		mu_lock_mutex(&threads->mutex);
+		job.done++;
+	}
+	/* If a worker finishes the last piece, it triggers the semaphore. */
+	wait = job.done < job.bands;
+	mu_unlock_mutex(&threads->mutex);
+
+	if (wait)
+		mu_wait_semaphore(&job.finished);
+
+	mu_lock_mutex(&threads->mutex);
+	remove_job(threads, &job);
+	mu_unlock_mutex(&threads->mutex);
+	mu_destroy_semaphore(&job.finished);
+}
+
+fz_thread_pool
+fz_render_thread_pool(fz_context *ctx, fz_render_threads *threads)
+{
+	fz_thread_pool pool;
+
+	pool.run = run_thread_pool;
+	pool.workers = threads->count + 1;
+	pool.user = threads;
+
+	return pool;
+}
+
+void
+fz_render_display_list_threaded(fz_context *ctx, fz_render_threads *threads, fz_display_list *list, fz_matrix ctm, fz_pixmap *pix, int band_height, fz_cookie *cookie)
+{
+	fz_render_job job = { 0 };
+
+	job.threads = threads;
+	job.list = list;
+	job.ctm = ctm;
+	job.area = fz_pixmap_bbox(ctx, pix);
+	job.target = pix;
+	job.cookie = cookie;
+	if (band_height <= 0)
+	{
+		/* A few bands per thread evens out the work. */
+		band_height = (pix->h + threads->count * 4 - 1) / (threads->count * 4);
+		if (band_height < 16)
+			band_height = 16;
+	}
+	job.band_height = band_height;
+	job.bands = (pix->h + band_height - 1) / band_height;
+	if (job.bands == 0)
+		return;
+
+	/* Every band renders into a pixmap of its own, so no band needs to
+	 * wait for another to be collected. */
+	new_slots(ctx, &job, job.bands);
+	fz_try(ctx)
+	{
+		queue_job(threads, &job);
+		collect_job(ctx, &job);
+	}
+	fz_always(ctx)
+	{
+		unqueue_job(ctx, &job);
+		drop_slots(ctx, &job);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+fz_render_job *
+fz_begin_render_display_list_bands(fz_context *ctx, fz_render_threads *threads, fz_display_list *list, fz_matrix ctm, fz_irect area, int band_height, fz_colorspace *cs, fz_separations *seps, int alpha, fz_render_band_fn *draw, fz_output_band_fn *write, void *arg, fz_cookie *cookie)
+{
+	fz_render_job *job;
+	fz_irect bbox = area;
+	int i;
+
+	if (band_height <= 0)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "band height must be positive");
+
+	job = fz_malloc_struct(ctx, fz_render_job);
+	job->threads = threads;
+	job->list = fz_keep_display_list(ctx, list);
+	job->ctm = ctm;
+	job->area = area;
+	job->band_height = band_height;
+	job->bands = fz_is_empty_irect(area) ? 0 : (area.y1 - area.y0 + band_height - 1) / band_height;
+	job->draw = draw;
+	job->write = write;
+	job->arg = arg;
+	job->cookie = cookie;
+	if (job->bands == 0)
+		return job;
+
+	bbox.y1 = bbox.y0 + band_height;
+	fz_try(ctx)
+	{
+		new_slots(ctx, job, fz_mini(threads->count * 2, job->bands));
+		for (i = 0; i < job->nslots; i++)
+			job->slot[i].band.pix = fz_new_pixmap_with_bbox(ctx, cs, bbox, seps, alpha);
+		queue_job(threads, job);
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_render_job(ctx, job);
+		fz_rethrow(ctx);
+	}
+
+	return job;
+}
+
+void
+fz_finish_render_display_list_bands(fz_context *ctx, fz_render_job *job)
+{
+	if (job && job->bands > 0)
+		collect_job(ctx, job);
+}
+
+void
+fz_drop_render_job(fz_context *ctx, fz_render_job *job)
+{
+	if (!job)
+		return;
+	unqueue_job(ctx, job);
+	if (job->slot)
+		drop_slots(ctx, job);
+	fz_drop_display_list(ctx, job->list);
+	fz_free(ctx, job);
+}
+
+void
+fz_render_display_list_bands(fz_context *ctx, fz_render_threads *threads, fz_display_list *list, fz_matrix ctm, fz_irect area, int band_height, fz_colorspace *cs, fz_separations *seps, int alpha, fz_render_band_fn *draw, fz_output_band_fn *write, void *arg, fz_cookie *cookie)
+{
+	fz_render_job *job = fz_begin_render_display_list_bands(ctx, threads, list, ctm, area, band_height, cs, seps, alpha, draw, write, arg, cookie);
+	fz_try(ctx)
+		fz_finish_render_display_list_bands(ctx, job);
+	fz_always(ctx)
+		fz_drop_render_job(ctx, job);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
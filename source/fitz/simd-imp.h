@@ -0,0 +1,73 @@
+#ifndef FITZ_SIMD_IMP_H
+#define FITZ_SIMD_IMP_H
+
+#include "mupdf/fitz.h"
+
+/*
+	SIMD versions of inner loops.
+
+	FZ_SIMD_X86 is defined when we can build SSE2, SSSE3, SSE4.1 and
+	AVX2 code regardless of the -m flags in use. With gcc and clang each
+	such function is marked with FZ_SIMD_TARGET("avx2") (or whichever);
+	MSVC allows the intrinsics anywhere.
+
+	FZ_SIMD_NEON is defined when the target always has NEON (AArch64,
+	or 32-bit ARM built with -mfpu=neon).
+
+	FZ_SIMD_INLINE marks the parts of a kernel that must be inlined
+	for it to be specialised (on a blend mode, say) at all.
+
+	The SIMD versions are only ever called if fz_cpu_features says the
+	CPU supports them, and the plain C versions are always kept as the
+	reference that they must match bit for bit.
+*/
+
+#if FZ_ENABLE_SIMD
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 5))
+#define FZ_SIMD_X86
+#define FZ_SIMD_TARGET(T) __attribute__((target(T)))
+#elif (defined(_M_X64) || defined(_M_IX86)) && defined(_MSC_VER) && _MSC_VER >= 1800
+#define FZ_SIMD_X86
+#define FZ_SIMD_TARGET(T)
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__) || defined(_M_ARM64)
+#define FZ_SIMD_NEON
+#endif
+
+#endif /* FZ_ENABLE_SIMD */
+
+#if defined(__GNUC__) || defined(__clang__)
+#define FZ_SIMD_INLINE inline __attribute__((always_inline))
+#elif defined(_MSC_VER)
+#define FZ_SIMD_INLINE __forceinline
+#else
+#define FZ_SIMD_INLINE inline
+#endif
+
+#ifdef FZ_SIMD_X86
+#include <immintrin.h>
+#endif
+#ifdef FZ_SIMD_NEON
+#include <arm_neon.h>
+#endif
+
+enum
+{
+	FZ_CPU_SSE2 = 1,
+	FZ_CPU_SSSE3 = 2,
+	FZ_CPU_SSE41 = 4,
+	FZ_CPU_AVX2 = 8,
+	FZ_CPU_NEON = 16
+};
+
+/*
+	Return the FZ_CPU_... flags for the SIMD code that can be used on
+	this machine. Detection is done once; the result may be restricted
+	by setting the FZ_SIMD environment variable to a mask of flags
+	(FZ_SIMD=0 to use the plain C code throughout).
+*/
+int fz_cpu_features(void);
+
+#endif
@@ -0,0 +1,136 @@
+#include "mupdf/fitz.h"
+#include "simd-imp.h"
+
+#include <stdlib.h>
+
+#if defined(FZ_SIMD_X86) && defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+static int
+detect_cpu_features(void)
+{
+	int features = 0;
+	char *env;
+
+#if defined(FZ_SIMD_X86) && defined(_MSC_VER)
+	int info[4];
+	int nids;
+
+	__cpuid(info, 0);
+	nids = info[0];
+	__cpuid(info, 1);
+	if (info[3] & (1 << 26))
+		features |= FZ_CPU_SSE2;
+	if (info[2] & (1 << 9))
+		features |= FZ_CPU_SSSE3;
+	if (info[2] & (1 << 19))
+		features |= FZ_CPU_SSE41;
+	/* AVX2 also needs the OS to save the upper halves of the registers. */
+	if (nids >= 7 && (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (_xgetbv(0) & 6) == 6)
+	{
+		__cpuidex(info, 7, 0);
+		if (info[1] & (1 << 5))
+			features |= FZ_CPU_AVX2;
+	}
+#elif defined(FZ_SIMD_X86)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse2"))
+		features |= FZ_CPU_SSE2;
+	if (__builtin_cpu_supports("ssse3"))
+		features |= FZ_CPU_SSSE3;
+	if (__builtin_cpu_supports("sse4.1"))
+		features |= FZ_CPU_SSE41;
+	if (__builtin_cpu_supports("avx2"))
+		features |= FZ_CPU_AVX2;
+#endif
+
+#ifdef FZ_SIMD_NEON
+	features |= FZ_CPU_NEON;
+#endif
+
+	env = getenv("FZ_SIMD");
+	if (env)
+		features &= (int)strtol(env, NULL, 0);
+
+	return features;
+}
+
+int
+fz_cpu_features(void)
+{
+	/* Every thread that races to fill this in computes the same value. */
+	static volatile int features = -1;
+	int f = features;
+	if (f < 0)
+		features = f = detect_cpu_features();
+	return f;
+}
+
+static inline int
+in_byte_set(const fz_byte_set *set, unsigned char c)
+{
+	return set->lo[c & 15] & set->hi[c >> 4];
+}
+
+/* These search whole 16 byte blocks, and return the start of the block
+ * holding the first match (or of the partial block at the end) for the
+ * plain C loop to finish. */
+
+#ifdef FZ_SIMD_X86
+
+FZ_SIMD_TARGET("ssse3") static const unsigned char *
+find_byte_in_set_ssse3(const unsigned char *p, const unsigned char *end, const fz_byte_set *set)
+{
+	const __m128i lo_tab = _mm_loadu_si128((const __m128i *)set->lo);
+	const __m128i hi_tab = _mm_loadu_si128((const __m128i *)set->hi);
+	const __m128i nibble = _mm_set1_epi8(0x0f);
+	const __m128i zero = _mm_setzero_si128();
+
+	for (; end - p >= 16; p += 16)
+	{
+		__m128i x = _mm_loadu_si128((const __m128i *)p);
+		__m128i lo = _mm_shuffle_epi8(lo_tab, _mm_and_si128(x, nibble));
+		__m128i hi = _mm_shuffle_epi8(hi_tab, _mm_and_si128(_mm_srli_epi16(x, 4), nibble));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(lo, hi), zero)) != 0xffff)
+			break;
+	}
+	return p;
+}
+
+#elif defined(FZ_SIMD_NEON) && defined(__aarch64__)
+
+static const unsigned char *
+find_byte_in_set_neon(const unsigned char *p, const unsigned char *end, const fz_byte_set *set)
+{
+	const uint8x16_t lo_tab = vld1q_u8(set->lo);
+	const uint8x16_t hi_tab = vld1q_u8(set->hi);
+	const uint8x16_t nibble = vdupq_n_u8(0x0f);
+
+	for (; end - p >= 16; p += 16)
+	{
+		uint8x16_t x = vld1q_u8(p);
+		uint8x16_t lo = vqtbl1q_u8(lo_tab, vandq_u8(x, nibble));
+		uint8x16_t hi = vqtbl1q_u8(hi_tab, vshrq_n_u8(x, 4));
+		if (vmaxvq_u8(vandq_u8(lo, hi)))
+			break;
+	}
+	return p;
+}
+
+#endif
+
+const unsigned char *
+fz_find_byte_in_set(const unsigned char *p, const unsigned char *end, const fz_byte_set *set)
+{
+#ifdef FZ_SIMD_X86
+	if (end - p >= 16 && (fz_cpu_features() & FZ_CPU_SSSE3))
+		p = find_byte_in_set_ssse3(p, end, set);
+#elif defined(FZ_SIMD_NEON) && defined(__aarch64__)
+	if (end - p >= 16 && (fz_cpu_features() & FZ_CPU_NEON))
+		p = find_byte_in_set_neon(p, end, set);
+#endif
+	while (p < end && !in_byte_set(set, *p))
+		p++;
+	return p;
+}
@@ -1,9 +1,16 @@
 #include "mupdf/fitz.h"
 
+#include "context-imp.h"
+
 #include <assert.h>
 #include <limits.h>
 #include <stdio.h>
 #include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/time.h>
+#endif
 
 typedef struct fz_item
 {
@@ -14,14 +21,34 @@ typedef struct fz_item
 	struct fz_item *prev;
 	fz_store *store;
 	const fz_store_type *type;
+	size_t cost;
+	double priority;
+	size_t stamp;
+	struct fz_item *heap_child;
+	struct fz_item *heap_next;
+	struct fz_item *heap_prev;
 } fz_item;
 
-/* Every entry in fz_store is protected by the alloc lock */
-struct fz_store
+/*
+	The store is split into a number of shards, each with its own lock,
+	LRU list and hash table. Items are assigned to shards according to
+	the hash of their keys, so that threads looking up different
+	resources do not contend for the same lock. Items whose keys cannot
+	be hashed always live in the first shard.
+
+	The shard locks are the innermost locks. They may be taken while
+	holding FZ_LOCK_ALLOC (as happens when the allocator scavenges), but
+	nothing may be allocated or freed while holding one, and no more
+	than one may be held at a time.
+
+	Without atomic reference counts (or without any locking at all),
+	we use a single shard that is protected by FZ_LOCK_ALLOC itself.
+*/
+typedef struct
 {
-	int refs;
+	int lock;
 
-	/* Every item in the store is kept in a doubly linked list, ordered
+	/* Every item in the shard is kept in a doubly linked list, ordered
 	 * by usage (so LRU entries are at the end). */
 	fz_item *head;
 	fz_item *tail;
@@ -30,39 +57,360 @@ struct fz_store
 	 * entries (those whose keys are indirect objects). */
 	fz_hash_table *hash;
 
-	/* We keep track of the size of the store, and keep it below max. */
-	size_t max;
+	/* The size of the items in this shard. */
 	size_t size;
 
+	/* The GreedyDual-Size 'inflation' value; the priority of the
+	 * last item evicted. */
+	double inflation;
+
+	/* Every item in the list is also kept in a pairing heap, ordered
+	 * by priority (and then by age), so that the cheapest item can
+	 * be found without walking the list. The heap links live in the
+	 * items, so nothing is allocated under the lock. */
+	fz_item *heap;
+	size_t clock;
+
+	/* Statistics for each type of item, in the order in which the
+	 * types were first seen by this shard. */
+	int num_types;
+	const fz_store_type *types[FZ_STORE_STATS_MAX_TYPES];
+	fz_store_type_stats stats[FZ_STORE_STATS_MAX_TYPES];
+} fz_store_shard;
+
+struct fz_store
+{
+	int refs;
+
+	int nshards;
+	fz_store_shard shard[FZ_STORE_SHARDS];
+
+	/* We keep track of the size of the store, and keep it below max.
+	 * Each shard gets an equal share of this. */
+	size_t max;
+
+	fz_store_policy policy;
+
+	/* These are protected by the alloc lock. */
 	int defer_reap_count;
 	int needs_reaping;
 	int scavenging;
+	int scavenge_start;
+	size_t scavenge_passes;
 };
 
 void
 fz_new_store_context(fz_context *ctx, size_t max)
 {
 	fz_store *store;
+	int i;
+
 	store = fz_malloc_struct(ctx, fz_store);
+	store->nshards = 1;
+#if FZ_ATOMIC_REFS
+	if (ctx->locks.lock != fz_locks_default.lock)
+		store->nshards = FZ_STORE_SHARDS;
+#endif
 	fz_try(ctx)
 	{
-		store->hash = fz_new_hash_table(ctx, 4096, sizeof(fz_store_hash), FZ_LOCK_ALLOC, NULL);
+		for (i = 0; i < store->nshards; i++)
+		{
+			store->shard[i].lock = store->nshards > 1 ? FZ_LOCK_STORE + i : FZ_LOCK_ALLOC;
+			store->shard[i].hash = fz_new_hash_table(ctx, 4096 / store->nshards, sizeof(fz_store_hash), store->shard[i].lock, NULL);
+		}
 	}
 	fz_catch(ctx)
 	{
+		for (i = 0; i < store->nshards; i++)
+			fz_drop_hash_table(ctx, store->shard[i].hash);
 		fz_free(ctx, store);
 		fz_rethrow(ctx);
 	}
 	store->refs = 1;
-	store->head = NULL;
-	store->tail = NULL;
-	store->size = 0;
 	store->max = max;
+	store->policy = FZ_STORE_POLICY_LRU;
 	store->defer_reap_count = 0;
 	store->needs_reaping = 0;
 	ctx->store = store;
 }
 
+/*
+	Lock a shard. If alloc_held is set, the caller already holds
+	FZ_LOCK_ALLOC, which may be the lock for the shard.
+*/
+static void
+lock_shard(fz_context *ctx, fz_store_shard *shard, int alloc_held)
+{
+	if (!alloc_held || shard->lock != FZ_LOCK_ALLOC)
+		fz_lock(ctx, shard->lock);
+}
+
+static void
+unlock_shard(fz_context *ctx, fz_store_shard *shard, int alloc_held)
+{
+	if (!alloc_held || shard->lock != FZ_LOCK_ALLOC)
+		fz_unlock(ctx, shard->lock);
+}
+
+static fz_store_shard *
+find_shard(fz_store *store, fz_store_hash *hash)
+{
+	const unsigned char *s = (const unsigned char *)hash;
+	unsigned val = 0;
+	size_t i;
+
+	if (hash == NULL || store->nshards == 1)
+		return &store->shard[0];
+
+	for (i = 0; i < sizeof(*hash); i++)
+	{
+		val += s[i];
+		val += (val << 10);
+		val ^= (val >> 6);
+	}
+	val += (val << 3);
+	val ^= (val >> 11);
+	val += (val << 15);
+
+	return &store->shard[val % store->nshards];
+}
+
+/*
+	The total size of the store. This reads the shard sizes without
+	taking their locks, so is only an estimate if other threads are
+	busy with the store.
+*/
+static size_t
+store_size(fz_store *store)
+{
+	size_t size = 0;
+	int i;
+	for (i = 0; i < store->nshards; i++)
+		size += store->shard[i].size;
+	return size;
+}
+
+static int
+heap_before(fz_item *a, fz_item *b)
+{
+	if (a->priority != b->priority)
+		return a->priority < b->priority;
+	return a->stamp < b->stamp;
+}
+
+/* Meld two detached heaps, returning the new root. */
+static fz_item *
+heap_meld(fz_item *a, fz_item *b)
+{
+	fz_item *t;
+
+	if (a == NULL)
+		return b;
+	if (b == NULL)
+		return a;
+	if (heap_before(b, a))
+	{
+		t = a;
+		a = b;
+		b = t;
+	}
+
+	/* b becomes the first child of a. The first child's heap_prev
+	 * points to its parent, the others' to their previous sibling. */
+	b->heap_prev = a;
+	b->heap_next = a->heap_child;
+	if (a->heap_child)
+		a->heap_child->heap_prev = b;
+	a->heap_child = b;
+
+	return a;
+}
+
+/* Meld a list of siblings into a single heap, in two passes. */
+static fz_item *
+heap_merge_pairs(fz_item *first)
+{
+	fz_item *pairs = NULL;
+	fz_item *a, *b, *next;
+
+	/* Meld them in pairs from left to right, collecting the results
+	 * in reverse order... */
+	while (first)
+	{
+		a = first;
+		b = a->heap_next;
+		next = b ? b->heap_next : NULL;
+		a->heap_next = a->heap_prev = NULL;
+		if (b)
+		{
+			b->heap_next = b->heap_prev = NULL;
+			a = heap_meld(a, b);
+		}
+		a->heap_next = pairs;
+		pairs = a;
+		first = next;
+	}
+
+	/* ...then meld those from right to left. */
+	first = NULL;
+	while (pairs)
+	{
+		next = pairs->heap_next;
+		pairs->heap_next = NULL;
+		first = heap_meld(first, pairs);
+		pairs = next;
+	}
+
+	return first;
+}
+
+static void
+heap_insert(fz_store_shard *shard, fz_item *item)
+{
+	item->heap_child = item->heap_next = item->heap_prev = NULL;
+	shard->heap = heap_meld(shard->heap, item);
+}
+
+static void
+heap_remove(fz_store_shard *shard, fz_item *item)
+{
+	fz_item *children;
+
+	if (item == shard->heap)
+	{
+		children = item->heap_child;
+		item->heap_child = NULL;
+		shard->heap = heap_merge_pairs(children);
+		return;
+	}
+
+	/* Not in the heap at all. */
+	if (item->heap_prev == NULL)
+		return;
+
+	/* Cut it (and its children) out of its list of siblings. */
+	if (item->heap_prev->heap_child == item)
+		item->heap_prev->heap_child = item->heap_next;
+	else
+		item->heap_prev->heap_next = item->heap_next;
+	if (item->heap_next)
+		item->heap_next->heap_prev = item->heap_prev;
+
+	children = item->heap_child;
+	item->heap_child = item->heap_next = item->heap_prev = NULL;
+	shard->heap = heap_meld(shard->heap, heap_merge_pairs(children));
+}
+
+static void
+unlink_item(fz_store_shard *shard, fz_item *item)
+{
+	heap_remove(shard, item);
+	shard->size -= item->size;
+	if (item->next)
+		item->next->prev = item->prev;
+	else
+		shard->tail = item->prev;
+	if (item->prev)
+		item->prev->next = item->next;
+	else
+		shard->head = item->next;
+}
+
+static void
+remove_hashed_item(fz_context *ctx, fz_store_shard *shard, fz_item *item)
+{
+	if (item->type->make_hash_key)
+	{
+		fz_store_hash hash = { NULL };
+		hash.drop = item->val->drop;
+		if (item->type->make_hash_key(ctx, &hash, item->key))
+			fz_hash_remove(ctx, shard->hash, &hash);
+	}
+}
+
+/*
+	Find the statistics for a type within a shard, adding them if
+	this is the first time we have seen the type. Returns NULL if we
+	have run out of space. Called with the shard locked.
+*/
+static fz_store_type_stats *
+type_stats(fz_store_shard *shard, const fz_store_type *type)
+{
+	int i;
+
+	for (i = 0; i < shard->num_types; i++)
+		if (shard->types[i] == type)
+			return &shard->stats[i];
+	if (i == FZ_STORE_STATS_MAX_TYPES)
+		return NULL;
+	shard->types[i] = type;
+	shard->stats[i].name = type->name;
+	shard->num_types++;
+	return &shard->stats[i];
+}
+
+/* Called with the shard locked, as item is about to be evicted. */
+static void
+count_eviction(fz_store_shard *shard, fz_item *item, int scavenging)
+{
+	fz_store_type_stats *stats = type_stats(shard, item->type);
+
+	if (stats)
+	{
+		stats->evictions++;
+		stats->bytes_evicted += item->size;
+		if (scavenging)
+			stats->scavenge_evictions++;
+	}
+}
+
+/* A microsecond clock, for timing evictions. */
+static int64_t
+store_clock(void)
+{
+#ifdef _WIN32
+	return (int64_t)GetTickCount() * 1000;
+#else
+	struct timeval tp;
+	gettimeofday(&tp, NULL);
+	return (int64_t)tp.tv_sec * 1000000 + tp.tv_usec;
+#endif
+}
+
+/*
+	Find the evictable item with the lowest GreedyDual-Size priority.
+	Ties go to the least recently used. Raises the shard's inflation
+	value to the priority of the item, as it is about to be evicted.
+
+	Items that are in use are popped off the heap (and chained
+	through heap_next) until we find one that is not, and then
+	put back.
+*/
+static fz_item *
+cheapest_item(fz_store_shard *shard)
+{
+	fz_item *best, *busy = NULL, *next;
+
+	while ((best = shard->heap) != NULL && fz_refs_load(&best->val->refs) != 1)
+	{
+		heap_remove(shard, best);
+		best->heap_next = busy;
+		busy = best;
+	}
+
+	while (busy)
+	{
+		next = busy->heap_next;
+		heap_insert(shard, busy);
+		busy = next;
+	}
+
+	if (best && best->priority > shard->inflation)
+		shard->inflation = best->priority;
+
+	return best;
+}
+
 void *
 fz_keep_storable(fz_context *ctx, const fz_storable *sc)
 {
@@ -86,7 +434,9 @@ static void
 do_reap(fz_context *ctx)
 {
 	fz_store *store = ctx->store;
+	fz_store_shard *shard;
 	fz_item *item, *prev, *remove;
+	int i, num;
 
 	if (store == NULL)
 	{
@@ -102,43 +452,34 @@ do_reap(fz_context *ctx)
 
 	/* Reap the items */
 	remove = NULL;
-	for (item = store->tail; item; item = prev)
+	for (i = 0; i < store->nshards; i++)
 	{
-		prev = item->prev;
+		shard = &store->shard[i];
+		lock_shard(ctx, shard, 1);
+		for (item = shard->tail; item; item = prev)
+		{
+			prev = item->prev;
 
-		if (item->type->needs_reap == NULL || item->type->needs_reap(ctx, item->key) == 0)
-			continue;
+			if (item->type->needs_reap == NULL || item->type->needs_reap(ctx, item->key) == 0)
+				continue;
 
-		/* We have to drop it */
-		store->size -= item->size;
+			/* We have to drop it */
+			unlink_item(shard, item);
 
-		/* Unlink from the linked list */
-		if (item->next)
-			item->next->prev = item->prev;
-		else
-			store->tail = item->prev;
-		if (item->prev)
-			item->prev->next = item->next;
-		else
-			store->head = item->next;
-
-		/* Remove from the hash table */
-		if (item->type->make_hash_key)
-		{
-			fz_store_hash hash = { NULL };
-			hash.drop = item->val->drop;
-			if (item->type->make_hash_key(ctx, &hash, item->key))
-				fz_hash_remove(ctx, store->hash, &hash);
-		}
+			/* Remove from the hash table */
+			remove_hashed_item(ctx, shard, item);
 
-		/* Store whether to drop this value or not in 'prev' */
-		if (item->val->refs > 0)
-			(void)Memento_dropRef(item->val);
-		item->prev = (item->val->refs > 0 && --item->val->refs == 0) ? item : NULL;
+			/* Store whether to drop this value or not in 'prev' */
+			num = fz_refs_dec(&item->val->refs);
+			if (num >= 0)
+				(void)Memento_dropRef(item->val);
+			item->prev = (num == 0) ? item : NULL;
 
-		/* Store it in our removal chain - just singly linked */
-		item->next = remove;
-		remove = item;
+			/* Store it in our removal chain - just singly linked */
+			item->next = remove;
+			remove = item;
+		}
+		unlock_shard(ctx, shard, 1);
 	}
 	fz_unlock(ctx, FZ_LOCK_ALLOC);
 
@@ -163,19 +504,22 @@ void fz_drop_key_storable(fz_context *ctx, const fz_key_storable *sc)
 	/* Explicitly drop const to allow us to use const
 	 * sanely throughout the code. */
 	fz_key_storable *s = (fz_key_storable *)sc;
-	int drop;
+	int drop, num;
 	int unlock = 1;
 
 	if (s == NULL)
 		return;
 
+	/* Even with atomic reference counts, we need the lock here so
+	 * that we see refs and store_key_refs consistently. */
 	fz_lock(ctx, FZ_LOCK_ALLOC);
-	assert(s->storable.refs != 0);
-	if (s->storable.refs > 0)
+	assert(fz_refs_load(&s->storable.refs) != 0);
+	num = fz_refs_dec(&s->storable.refs);
+	if (num >= 0)
 	{
 		(void)Memento_dropRef(s);
-		drop = --s->storable.refs == 0;
-		if (!drop && s->storable.refs == s->store_key_refs)
+		drop = num == 0;
+		if (!drop && num == s->store_key_refs)
 		{
 			if (ctx->store->defer_reap_count > 0)
 			{
@@ -213,10 +557,9 @@ void *fz_keep_key_storable_key(fz_context *ctx, const fz_key_storable *sc)
 		return NULL;
 
 	fz_lock(ctx, FZ_LOCK_ALLOC);
-	if (s->storable.refs > 0)
+	if (fz_refs_inc(&s->storable.refs) > 0)
 	{
 		(void)Memento_takeRef(s);
-		++s->storable.refs;
 		++s->store_key_refs;
 	}
 	fz_unlock(ctx, FZ_LOCK_ALLOC);
@@ -236,7 +579,7 @@ void fz_drop_key_storable_key(fz_context *ctx, const fz_key_storable *sc)
 	fz_lock(ctx, FZ_LOCK_ALLOC);
 	assert(s->store_key_refs > 0 && s->storable.refs >= s->store_key_refs);
 	(void)Memento_dropRef(s);
-	drop = --s->storable.refs == 0;
+	drop = fz_refs_dec(&s->storable.refs) == 0;
 	--s->store_key_refs;
 	fz_unlock(ctx, FZ_LOCK_ALLOC);
 	/*
@@ -250,111 +593,135 @@ void fz_drop_key_storable_key(fz_context *ctx, const fz_key_storable *sc)
 		s->storable.drop(ctx, &s->storable);
 }
 
+/*
+	Entered with the shard locked (and with FZ_LOCK_ALLOC held if
+	alloc_held is set). Removes the item from the shard, then drops
+	the locks while destroying it, and retakes them before returning.
+*/
 static void
-evict(fz_context *ctx, fz_item *item)
+evict(fz_context *ctx, fz_store_shard *shard, fz_item *item, int alloc_held)
 {
-	fz_store *store = ctx->store;
 	int drop;
 
-	store->size -= item->size;
-	/* Unlink from the linked list */
-	if (item->next)
-		item->next->prev = item->prev;
-	else
-		store->tail = item->prev;
-	if (item->prev)
-		item->prev->next = item->next;
-	else
-		store->head = item->next;
+	unlink_item(shard, item);
 
 	/* Drop a reference to the value (freeing if required) */
-	if (item->val->refs > 0)
+	drop = fz_refs_dec(&item->val->refs);
+	if (drop >= 0)
 		(void)Memento_dropRef(item->val);
-	drop = (item->val->refs > 0 && --item->val->refs == 0);
+	drop = (drop == 0);
 
 	/* Remove from the hash table */
-	if (item->type->make_hash_key)
-	{
-		fz_store_hash hash = { NULL };
-		hash.drop = item->val->drop;
-		if (item->type->make_hash_key(ctx, &hash, item->key))
-			fz_hash_remove(ctx, store->hash, &hash);
-	}
-	fz_unlock(ctx, FZ_LOCK_ALLOC);
+	remove_hashed_item(ctx, shard, item);
+
+	unlock_shard(ctx, shard, alloc_held);
+	if (alloc_held)
+		fz_unlock(ctx, FZ_LOCK_ALLOC);
 	if (drop)
 		item->val->drop(ctx, item->val);
 
 	/* Always drops the key and drop the item */
 	item->type->drop_key(ctx, item->key);
 	fz_free(ctx, item);
-	fz_lock(ctx, FZ_LOCK_ALLOC);
+	if (alloc_held)
+		fz_lock(ctx, FZ_LOCK_ALLOC);
+	lock_shard(ctx, shard, alloc_held);
 }
 
+/*
+	Entered with the shard locked. Counts the bytes that could be freed
+	from the shard, stopping once there are tofree of them.
+*/
 static size_t
-ensure_space(fz_context *ctx, size_t tofree)
+evictable_size(fz_context *ctx, fz_store_shard *shard, size_t tofree)
 {
-	fz_item *item, *prev;
-	size_t count;
-	fz_store *store = ctx->store;
-	fz_item *to_be_freed = NULL;
+	fz_item *item;
+	size_t count = 0;
 
-	fz_assert_lock_held(ctx, FZ_LOCK_ALLOC);
+	fz_assert_lock_held(ctx, shard->lock);
 
-	/* First check that we *can* free tofree; if not, we'd rather not
-	 * cache this. */
-	count = 0;
-	for (item = store->tail; item; item = item->prev)
-	{
-		if (item->val->refs == 1)
-		{
+	for (item = shard->tail; item && count < tofree; item = item->prev)
+		if (fz_refs_load(&item->val->refs) == 1)
 			count += item->size;
-			if (count >= tofree)
-				break;
-		}
-	}
 
-	/* If we ran out of items to search, then we can never free enough */
-	if (item == NULL)
+	return count;
+}
+
+/*
+	Entered with 'shard' locked. Counts the bytes that could be freed
+	from the whole store, stopping once there are tofree of them. We
+	may only hold one shard lock at a time, so 'shard' is unlocked
+	while we look at the others.
+*/
+static size_t
+evictable_size_in_store(fz_context *ctx, fz_store_shard *shard, size_t tofree)
+{
+	fz_store *store = ctx->store;
+	size_t count;
+	int i, k;
+
+	count = evictable_size(ctx, shard, tofree);
+	if (count >= tofree || store->nshards == 1)
+		return count;
+
+	k = (int)(shard - store->shard);
+	fz_unlock(ctx, shard->lock);
+	for (i = 1; i < store->nshards && count < tofree; i++)
 	{
-		return 0;
+		fz_store_shard *other = &store->shard[(k + i) % store->nshards];
+		fz_lock(ctx, other->lock);
+		count += evictable_size(ctx, other, tofree - count);
+		fz_unlock(ctx, other->lock);
 	}
+	fz_lock(ctx, shard->lock);
 
-	/* Now move all the items to be freed onto 'to_be_freed' */
-	count = 0;
-	for (item = store->tail; item; item = prev)
-	{
-		prev = item->prev;
-		if (item->val->refs != 1)
-			continue;
+	return count;
+}
 
-		store->size -= item->size;
+/*
+	Entered with the shard locked. Frees as much of tofree bytes from
+	the shard as it can, evicting least recently used items first.
+	The caller checks that the store as a whole can free enough, as
+	the shard on its own may not.
+*/
+static size_t
+ensure_space(fz_context *ctx, fz_store_shard *shard, size_t tofree)
+{
+	fz_item *item, *prev;
+	size_t count;
+	fz_item *to_be_freed = NULL;
 
-		/* Unlink from the linked list */
-		if (item->next)
-			item->next->prev = item->prev;
-		else
-			store->tail = item->prev;
-		if (item->prev)
-			item->prev->next = item->next;
-		else
-			store->head = item->next;
+	fz_assert_lock_held(ctx, shard->lock);
 
-		/* Remove from the hash table */
-		if (item->type->make_hash_key)
+	/* Move all the items to be freed onto 'to_be_freed' */
+	count = 0;
+	prev = shard->tail;
+	while (count < tofree)
+	{
+		if (ctx->store->policy == FZ_STORE_POLICY_GDS)
+			item = cheapest_item(shard);
+		else
 		{
-			fz_store_hash hash = { NULL };
-			hash.drop = item->val->drop;
-			if (item->type->make_hash_key(ctx, &hash, item->key))
-				fz_hash_remove(ctx, store->hash, &hash);
+			for (item = prev; item; item = item->prev)
+				if (fz_refs_load(&item->val->refs) == 1)
+					break;
+			if (item)
+				prev = item->prev;
 		}
+		if (item == NULL)
+			break;
+
+		count_eviction(shard, item, 0);
+		unlink_item(shard, item);
+
+		/* Remove from the hash table */
+		remove_hashed_item(ctx, shard, item);
 
 		/* Link into to_be_freed */
 		item->next = to_be_freed;
 		to_be_freed = item;
 
 		count += item->size;
-		if (count >= tofree)
-			break;
 	}
 
 	/* Now we can safely drop the lock and free our pending items. These
@@ -369,46 +736,84 @@ ensure_space(fz_context *ctx, size_t tofree)
 		to_be_freed = to_be_freed->next;
 
 		/* Drop a reference to the value (freeing if required) */
-		if (item->val->refs > 0)
+		drop = fz_refs_dec(&item->val->refs);
+		if (drop >= 0)
 			(void)Memento_dropRef(item->val);
-		drop = (item->val->refs > 0 && --item->val->refs == 0);
+		drop = (drop == 0);
 
-		fz_unlock(ctx, FZ_LOCK_ALLOC);
+		fz_unlock(ctx, shard->lock);
 		if (drop)
 			item->val->drop(ctx, item->val);
 
 		/* Always drops the key and drop the item */
 		item->type->drop_key(ctx, item->key);
 		fz_free(ctx, item);
-		fz_lock(ctx, FZ_LOCK_ALLOC);
+		fz_lock(ctx, shard->lock);
 	}
 
 	return count;
 }
 
+/*
+	Entered with 'shard' locked. Tries to free tofree bytes from the
+	other shards, visiting each in turn. We may only hold one shard
+	lock at a time, so 'shard' is unlocked while we do this.
+*/
+static size_t
+ensure_space_in_other_shards(fz_context *ctx, fz_store_shard *shard, size_t tofree)
+{
+	fz_store *store = ctx->store;
+	size_t saved = 0;
+	int i, k;
+
+	if (store->nshards == 1)
+		return 0;
+
+	k = (int)(shard - store->shard);
+	fz_unlock(ctx, shard->lock);
+	for (i = 1; i < store->nshards && saved < tofree; i++)
+	{
+		fz_store_shard *other = &store->shard[(k + i) % store->nshards];
+		fz_lock(ctx, other->lock);
+		saved += ensure_space(ctx, other, tofree - saved);
+		fz_unlock(ctx, other->lock);
+	}
+	fz_lock(ctx, shard->lock);
+
+	return saved;
+}
+
 static void
-touch(fz_store *store, fz_item *item)
+touch(fz_store_shard *shard, fz_item *item)
 {
+	/* Refresh the priority used by FZ_STORE_POLICY_GDS. We do this
+	 * whatever the policy, so that the policy can be changed at
+	 * any time. */
+	item->priority = shard->inflation + (double)item->cost / (item->size ? item->size : 1);
+	item->stamp = shard->clock++;
+
 	if (item->next != item)
 	{
 		/* Already in the list - unlink it */
+		heap_remove(shard, item);
 		if (item->next)
 			item->next->prev = item->prev;
 		else
-			store->tail = item->prev;
+			shard->tail = item->prev;
 		if (item->prev)
 			item->prev->next = item->next;
 		else
-			store->head = item->next;
+			shard->head = item->next;
 	}
 	/* Now relink it at the start of the LRU chain */
-	item->next = store->head;
+	item->next = shard->head;
 	if (item->next)
 		item->next->prev = item;
 	else
-		store->tail = item;
-	store->head = item;
+		shard->tail = item;
+	shard->head = item;
 	item->prev = NULL;
+	heap_insert(shard, item);
 }
 
 void *
@@ -418,7 +823,10 @@ fz_store_item(fz_context *ctx, void *key, void *val_, size_t itemsize, const fz_
 	size_t size;
 	fz_storable *val = (fz_storable *)val_;
 	fz_store *store = ctx->store;
+	fz_store_shard *shard;
 	fz_store_hash hash = { NULL };
+	fz_store_type_stats *stats;
+	int64_t start, elapsed = 0;
 	int use_hash = 0;
 
 	if (!store)
@@ -438,9 +846,11 @@ fz_store_item(fz_context *ctx, void *key, void *val_, size_t itemsize, const fz_
 		hash.drop = val->drop;
 		use_hash = type->make_hash_key(ctx, &hash, key);
 	}
+	shard = find_shard(store, use_hash ? &hash : NULL);
+	item->cost = type->cost ? type->cost(ctx, key, itemsize) : itemsize;
 
 	type->keep_key(ctx, key);
-	fz_lock(ctx, FZ_LOCK_ALLOC);
+	lock_shard(ctx, shard, 0);
 
 	/* Fill out the item. To start with, we always set item->next == item
 	 * and item->prev == item. This is so that we can spot items that have
@@ -462,13 +872,13 @@ fz_store_item(fz_context *ctx, void *key, void *val_, size_t itemsize, const fz_
 		fz_try(ctx)
 		{
 			/* May drop and retake the lock */
-			existing = fz_hash_insert(ctx, store->hash, &hash, item);
+			existing = fz_hash_insert(ctx, shard->hash, &hash, item);
 		}
 		fz_catch(ctx)
 		{
 			/* Any error here means that item never made it into the
 			 * hash - so no one else can have a reference. */
-			fz_unlock(ctx, FZ_LOCK_ALLOC);
+			unlock_shard(ctx, shard, 0);
 			fz_free(ctx, item);
 			type->drop_key(ctx, key);
 			return NULL;
@@ -477,14 +887,11 @@ fz_store_item(fz_context *ctx, void *key, void *val_, size_t itemsize, const fz_
 		{
 			/* There was one there already! Take a new reference
 			 * to the existing one, and drop our current one. */
-			fz_warn(ctx, "found duplicate %s in the store", type->name);
-			touch(store, existing);
-			if (existing->val->refs > 0)
-			{
+			touch(shard, existing);
+			if (fz_refs_inc(&existing->val->refs) > 0)
 				(void)Memento_takeRef(existing->val);
-				existing->val->refs++;
-			}
-			fz_unlock(ctx, FZ_LOCK_ALLOC);
+			unlock_shard(ctx, shard, 0);
+			fz_warn(ctx, "found duplicate %s in the store", type->name);
 			fz_free(ctx, item);
 			type->drop_key(ctx, key);
 			return existing->val;
@@ -492,37 +899,50 @@ fz_store_item(fz_context *ctx, void *key, void *val_, size_t itemsize, const fz_
 	}
 
 	/* Now bump the ref */
-	if (val->refs > 0)
-	{
+	if (fz_refs_inc(&val->refs) > 0)
 		(void)Memento_takeRef(val);
-		val->refs++;
-	}
 
 	/* If we haven't got an infinite store, check for space within it */
 	if (store->max != FZ_STORE_UNLIMITED)
 	{
 		/* FIXME: Overflow? */
-		size = store->size + itemsize;
+		size = store_size(store) + itemsize;
 		if (size > store->max)
 		{
 			FZ_LOG_STORE(ctx, "Store size exceeded: item=%zu, size=%zu, max=%zu\n",
-				itemsize, store->size, store->max);
+				itemsize, size - itemsize, store->max);
+			start = store_clock();
 			while (size > store->max)
 			{
-				size_t saved;
+				size_t saved = 0;
 
-				/* First, do any outstanding reaping, even if defer_reap_count > 0 */
+				/* First, do any outstanding reaping, even if defer_reap_count > 0.
+				 * The flag is only to be read with FZ_LOCK_ALLOC held, and
+				 * that must be taken before the shard's lock. */
+				unlock_shard(ctx, shard, 0);
+				fz_lock(ctx, FZ_LOCK_ALLOC);
 				if (store->needs_reaping)
-				{
 					do_reap(ctx); /* Drops alloc lock */
-					fz_lock(ctx, FZ_LOCK_ALLOC);
-				}
-				size = store->size + itemsize;
+				else
+					fz_unlock(ctx, FZ_LOCK_ALLOC);
+				lock_shard(ctx, shard, 0);
+				size = store_size(store) + itemsize;
 				if (size <= store->max)
 					break;
 
-				/* ensure_space may drop, then retake the lock */
-				saved = ensure_space(ctx, size - store->max);
+				/* If we cannot free enough, we'd rather not evict
+				 * anything for this. Otherwise evict from our own shard
+				 * first if it is over its share of the store, and take
+				 * from the others first if not. */
+				if (evictable_size_in_store(ctx, shard, size - store->max) >= size - store->max)
+				{
+					if (shard->size + itemsize > store->max / store->nshards)
+						saved = ensure_space(ctx, shard, size - store->max);
+					if (saved < size - store->max)
+						saved += ensure_space_in_other_shards(ctx, shard, size - store->max - saved);
+					if (saved < size - store->max && shard->size + itemsize <= store->max / store->nshards)
+						saved += ensure_space(ctx, shard, size - store->max - saved);
+				}
 				size -= saved;
 				if (saved == 0)
 				{
@@ -540,13 +960,21 @@ fz_store_item(fz_context *ctx, void *key, void *val_, size_t itemsize, const fz_
 				}
 			}
 			FZ_LOG_DUMP_STORE(ctx, "After eviction:\n");
+			elapsed = store_clock() - start;
 		}
 	}
-	store->size += itemsize;
+	shard->size += itemsize;
+
+	stats = type_stats(shard, type);
+	if (stats)
+	{
+		stats->insertions++;
+		stats->ensure_space_time += elapsed;
+	}
 
 	/* Regardless of whether it's indexed, it goes into the linked list */
-	touch(store, item);
-	fz_unlock(ctx, FZ_LOCK_ALLOC);
+	touch(shard, item);
+	unlock_shard(ctx, shard, 0);
 
 	return NULL;
 }
@@ -556,7 +984,9 @@ fz_find_item(fz_context *ctx, fz_store_drop_fn *drop, void *key, const fz_store_
 {
 	fz_item *item;
 	fz_store *store = ctx->store;
+	fz_store_shard *shard;
 	fz_store_hash hash = { NULL };
+	fz_store_type_stats *stats;
 	int use_hash = 0;
 
 	if (!store)
@@ -570,17 +1000,19 @@ fz_find_item(fz_context *ctx, fz_store_drop_fn *drop, void *key, const fz_store_
 		hash.drop = drop;
 		use_hash = type->make_hash_key(ctx, &hash, key);
 	}
+	shard = find_shard(store, use_hash ? &hash : NULL);
 
-	fz_lock(ctx, FZ_LOCK_ALLOC);
+	lock_shard(ctx, shard, 0);
+	stats = type_stats(shard, type);
 	if (use_hash)
 	{
 		/* We can find objects keyed on indirected objects quickly */
-		item = fz_hash_find(ctx, store->hash, &hash);
+		item = fz_hash_find(ctx, shard->hash, &hash);
 	}
 	else
 	{
 		/* Others we have to hunt for slowly */
-		for (item = store->head; item; item = item->next)
+		for (item = shard->head; item; item = item->next)
 		{
 			if (item->val->drop == drop && !type->cmp_key(ctx, item->key, key))
 				break;
@@ -592,17 +1024,24 @@ fz_find_item(fz_context *ctx, fz_store_drop_fn *drop, void *key, const fz_store_
 		 * picked up from the hash before it has made it into the
 		 * linked list does not get whipped out again due to the
 		 * store being full. */
-		touch(store, item);
-		/* And bump the refcount before returning */
-		if (item->val->refs > 0)
+		touch(shard, item);
+		if (stats)
 		{
-			(void)Memento_takeRef(item->val);
-			item->val->refs++;
+			stats->lookups++;
+			stats->hits++;
 		}
-		fz_unlock(ctx, FZ_LOCK_ALLOC);
+		/* And bump the refcount before returning */
+		if (fz_refs_inc(&item->val->refs) > 0)
+			(void)Memento_takeRef(item->val);
+		unlock_shard(ctx, shard, 0);
 		return (void *)item->val;
 	}
-	fz_unlock(ctx, FZ_LOCK_ALLOC);
+	if (stats)
+	{
+		stats->lookups++;
+		stats->misses++;
+	}
+	unlock_shard(ctx, shard, 0);
 
 	return NULL;
 }
@@ -612,6 +1051,7 @@ fz_remove_item(fz_context *ctx, fz_store_drop_fn *drop, void *key, const fz_stor
 {
 	fz_item *item;
 	fz_store *store = ctx->store;
+	fz_store_shard *shard;
 	int dodrop;
 	fz_store_hash hash = { NULL };
 	int use_hash = 0;
@@ -621,19 +1061,20 @@ fz_remove_item(fz_context *ctx, fz_store_drop_fn *drop, void *key, const fz_stor
 		hash.drop = drop;
 		use_hash = type->make_hash_key(ctx, &hash, key);
 	}
+	shard = find_shard(store, use_hash ? &hash : NULL);
 
-	fz_lock(ctx, FZ_LOCK_ALLOC);
+	lock_shard(ctx, shard, 0);
 	if (use_hash)
 	{
 		/* We can find objects keyed on indirect objects quickly */
-		item = fz_hash_find(ctx, store->hash, &hash);
+		item = fz_hash_find(ctx, shard->hash, &hash);
 		if (item)
-			fz_hash_remove(ctx, store->hash, &hash);
+			fz_hash_remove(ctx, shard->hash, &hash);
 	}
 	else
 	{
 		/* Others we have to hunt for slowly */
-		for (item = store->head; item; item = item->next)
+		for (item = shard->head; item; item = item->next)
 			if (item->val->drop == drop && !type->cmp_key(ctx, item->key, key))
 				break;
 	}
@@ -643,42 +1084,39 @@ fz_remove_item(fz_context *ctx, fz_store_drop_fn *drop, void *key, const fz_stor
 		 * in the list. Don't attempt to unlink these. We indicate
 		 * such items by setting item->next == item. */
 		if (item->next != item)
-		{
-			if (item->next)
-				item->next->prev = item->prev;
-			else
-				store->tail = item->prev;
-			if (item->prev)
-				item->prev->next = item->next;
-			else
-				store->head = item->next;
-		}
-		if (item->val->refs > 0)
+			unlink_item(shard, item);
+		dodrop = fz_refs_dec(&item->val->refs);
+		if (dodrop >= 0)
 			(void)Memento_dropRef(item->val);
-		dodrop = (item->val->refs > 0 && --item->val->refs == 0);
-		fz_unlock(ctx, FZ_LOCK_ALLOC);
+		dodrop = (dodrop == 0);
+		unlock_shard(ctx, shard, 0);
 		if (dodrop)
 			item->val->drop(ctx, item->val);
 		type->drop_key(ctx, item->key);
 		fz_free(ctx, item);
 	}
 	else
-		fz_unlock(ctx, FZ_LOCK_ALLOC);
+		unlock_shard(ctx, shard, 0);
 }
 
 void
 fz_empty_store(fz_context *ctx)
 {
 	fz_store *store = ctx->store;
+	int i;
 
 	if (store == NULL)
 		return;
 
-	fz_lock(ctx, FZ_LOCK_ALLOC);
 	/* Run through all the items in the store */
-	while (store->head)
-		evict(ctx, store->head); /* Drops then retakes lock */
-	fz_unlock(ctx, FZ_LOCK_ALLOC);
+	for (i = 0; i < store->nshards; i++)
+	{
+		fz_store_shard *shard = &store->shard[i];
+		lock_shard(ctx, shard, 0);
+		while (shard->head)
+			evict(ctx, shard, shard->head, 0); /* Drops then retakes lock */
+		unlock_shard(ctx, shard, 0);
+	}
 }
 
 fz_store *
@@ -692,32 +1130,44 @@ fz_keep_store_context(fz_context *ctx)
 void
 fz_drop_store_context(fz_context *ctx)
 {
+	int i;
+
 	if (!ctx)
 		return;
 	if (fz_drop_imp(ctx, ctx->store, &ctx->store->refs))
 	{
 		fz_empty_store(ctx);
-		fz_drop_hash_table(ctx, ctx->store->hash);
+		for (i = 0; i < ctx->store->nshards; i++)
+			fz_drop_hash_table(ctx, ctx->store->shard[i].hash);
 		fz_free(ctx, ctx->store);
 		ctx->store = NULL;
 	}
 }
 
+typedef struct
+{
+	fz_output *out;
+	fz_store_shard *shard;
+} fz_debug_store_state;
+
 static void
-fz_debug_store_item(fz_context *ctx, void *state, void *key_, int keylen, void *item_)
+fz_debug_store_item(fz_context *ctx, void *state_, void *key_, int keylen, void *item_)
 {
 	unsigned char *key = key_;
 	fz_item *item = item_;
 	int i;
 	char buf[256];
-	fz_output *out = (fz_output *)state;
+	fz_debug_store_state *state = (fz_debug_store_state *)state_;
+	fz_output *out = state->out;
+	unlock_shard(ctx, state->shard, 1);
 	fz_unlock(ctx, FZ_LOCK_ALLOC);
 	item->type->format_key(ctx, buf, sizeof buf, item->key);
 	fz_lock(ctx, FZ_LOCK_ALLOC);
+	lock_shard(ctx, state->shard, 1);
 	fz_write_printf(ctx, out, "STORE\thash[");
 	for (i=0; i < keylen; ++i)
 		fz_write_printf(ctx, out,"%02x", key[i]);
-	fz_write_printf(ctx, out, "][refs=%d][size=%d] key=%s val=%p\n", item->val->refs, (int)item->size, buf, (void *)item->val);
+	fz_write_printf(ctx, out, "][refs=%d][size=%d] key=%s val=%p\n", fz_refs_load(&item->val->refs), (int)item->size, buf, (void *)item->val);
 }
 
 static void
@@ -726,36 +1176,48 @@ fz_debug_store_locked(fz_context *ctx, fz_output *out)
 	fz_item *item, *next;
 	char buf[256];
 	fz_store *store = ctx->store;
+	fz_store_shard *shard;
+	fz_debug_store_state state;
 	size_t list_total = 0;
+	int i;
 
 	fz_write_printf(ctx, out, "STORE\t-- resource store contents --\n");
 
-	for (item = store->head; item; item = next)
+	for (i = 0; i < store->nshards; i++)
 	{
-		next = item->next;
-		if (next)
+		shard = &store->shard[i];
+		lock_shard(ctx, shard, 1);
+		for (item = shard->head; item; item = next)
 		{
-			(void)Memento_takeRef(next->val);
-			next->val->refs++;
-		}
-		fz_unlock(ctx, FZ_LOCK_ALLOC);
-		item->type->format_key(ctx, buf, sizeof buf, item->key);
-		fz_lock(ctx, FZ_LOCK_ALLOC);
-		fz_write_printf(ctx, out, "STORE\tstore[*][refs=%d][size=%d] key=%s val=%p\n",
-				item->val->refs, (int)item->size, buf, (void *)item->val);
-		list_total += item->size;
-		if (next)
-		{
-			(void)Memento_dropRef(next->val);
-			next->val->refs--;
+			next = item->next;
+			if (next && fz_refs_inc(&next->val->refs) > 0)
+				(void)Memento_takeRef(next->val);
+			unlock_shard(ctx, shard, 1);
+			fz_unlock(ctx, FZ_LOCK_ALLOC);
+			item->type->format_key(ctx, buf, sizeof buf, item->key);
+			fz_lock(ctx, FZ_LOCK_ALLOC);
+			lock_shard(ctx, shard, 1);
+			fz_write_printf(ctx, out, "STORE\tstore[%d][refs=%d][size=%d] key=%s val=%p\n",
+					i, fz_refs_load(&item->val->refs), (int)item->size, buf, (void *)item->val);
+			list_total += item->size;
+			if (next && fz_refs_dec(&next->val->refs) >= 0)
+				(void)Memento_dropRef(next->val);
 		}
+		unlock_shard(ctx, shard, 1);
 	}
 
 	fz_write_printf(ctx, out, "STORE\t-- resource store hash contents --\n");
-	fz_hash_for_each(ctx, store->hash, out, fz_debug_store_item);
+	state.out = out;
+	for (i = 0; i < store->nshards; i++)
+	{
+		state.shard = &store->shard[i];
+		lock_shard(ctx, state.shard, 1);
+		fz_hash_for_each(ctx, state.shard->hash, &state, fz_debug_store_item);
+		unlock_shard(ctx, state.shard, 1);
+	}
 	fz_write_printf(ctx, out, "STORE\t-- end --\n");
 
-	fz_write_printf(ctx, out, "STORE\tmax=%zu, size=%zu, actual size=%zu\n", store->max, store->size, list_total);
+	fz_write_printf(ctx, out, "STORE\tmax=%zu, size=%zu, actual size=%zu\n", store->max, store_size(store), list_total);
 }
 
 void
@@ -794,48 +1256,68 @@ scavenge(fz_context *ctx, size_t tofree)
 {
 	fz_store *store = ctx->store;
 	size_t freed = 0;
+	size_t last_freed;
+	fz_store_shard *shard;
 	fz_item *item;
+	int i;
 
 	if (store->scavenging)
 		return 0;
 
 	store->scavenging = 1;
 
+	/* Each shard keeps its own LRU list, so we visit them in turn,
+	 * starting where the last scavenge left off to spread the pain. */
 	do
 	{
-		/* Count through a suffix of objects in the store until
-		 * we find enough to give us what we need to evict. */
-		size_t suffix_size = 0;
-		fz_item *largest = NULL;
-
-		for (item = store->tail; item; item = item->prev)
+		last_freed = freed;
+		for (i = 0; i < store->nshards && freed < tofree; i++)
 		{
-			if (item->val->refs == 1)
+			/* Count through a suffix of objects in the shard until
+			 * we find enough to give us what we need to evict. */
+			size_t suffix_size = 0;
+			fz_item *largest = NULL;
+
+			shard = &store->shard[store->scavenge_start];
+			store->scavenge_start = (store->scavenge_start + 1) % store->nshards;
+
+			lock_shard(ctx, shard, 1);
+			if (store->policy == FZ_STORE_POLICY_GDS)
 			{
-				/* This one is evictable */
-				suffix_size += item->size;
-				if (largest == NULL || item->size > largest->size)
-					largest = item;
-				if (suffix_size >= tofree - freed)
-					break;
+				/* Cost matters more than size here. */
+				largest = cheapest_item(shard);
+			}
+			else
+			{
+				for (item = shard->tail; item; item = item->prev)
+				{
+					if (fz_refs_load(&item->val->refs) == 1)
+					{
+						/* This one is evictable */
+						suffix_size += item->size;
+						if (largest == NULL || item->size > largest->size)
+							largest = item;
+						if (suffix_size >= tofree - freed)
+							break;
+					}
+				}
 			}
-		}
-
-		/* If there are no evictable blocks, we can't find anything to free. */
-		if (largest == NULL)
-			break;
 
-		/* Free largest. */
-		if (freed == 0) {
-			FZ_LOG_DUMP_STORE(ctx, "Before scavenge:\n");
+			/* Free largest. */
+			if (largest != NULL)
+			{
+				freed += largest->size;
+				count_eviction(shard, largest, 1);
+				evict(ctx, shard, largest, 1); /* Drops then retakes locks */
+			}
+			unlock_shard(ctx, shard, 1);
 		}
-		freed += largest->size;
-		evict(ctx, largest); /* Drops then retakes lock */
 	}
-	while (freed < tofree);
+	while (freed < tofree && freed != last_freed);
 
 	if (freed != 0) {
 		FZ_LOG_DUMP_STORE(ctx, "After scavenge:\n");
+		store->scavenge_passes++;
 	}
 	store->scavenging = 0;
 	/* Success is managing to evict any blocks */
@@ -853,26 +1335,28 @@ fz_drop_storable(fz_context *ctx, const fz_storable *sc)
 	if (s == NULL)
 		return;
 
-	fz_lock(ctx, FZ_LOCK_ALLOC);
 	/* Drop the ref, and leave num as being the number of
 	 * refs left (-1 meaning, "statically allocated"). */
-	if (s->refs > 0)
-	{
+	fz_lock_refs(ctx);
+	num = fz_refs_dec(&s->refs);
+	if (num >= 0)
 		(void)Memento_dropIntRef(s);
-		num = --s->refs;
-	}
-	else
-		num = -1;
+	fz_unlock_refs(ctx);
 
 	/* If we have just 1 ref left, it's possible that
 	 * this ref is held by the store. If the store is
 	 * oversized, we ought to throw any such references
 	 * away to try to bring the store down to a "legal"
 	 * size. Run a scavenge to check for this case. */
-	if (ctx->store->max != FZ_STORE_UNLIMITED)
-		if (num == 1 && ctx->store->size > ctx->store->max)
-			scavenge(ctx, ctx->store->size - ctx->store->max);
-	fz_unlock(ctx, FZ_LOCK_ALLOC);
+	if (num == 1 && ctx->store->max != FZ_STORE_UNLIMITED)
+	{
+		size_t size;
+		fz_lock(ctx, FZ_LOCK_ALLOC);
+		size = store_size(ctx->store);
+		if (size > ctx->store->max)
+			scavenge(ctx, size - ctx->store->max);
+		fz_unlock(ctx, FZ_LOCK_ALLOC);
+	}
 
 	/* If we have no references to an object left, then
 	 * it cannot possibly be in the store (as the store always
@@ -905,13 +1389,14 @@ int fz_store_scavenge(fz_context *ctx, size_t size, int *phase)
 		return 0;
 
 #ifdef DEBUG_SCAVENGING
-	fz_write_printf(ctx, fz_stdout(ctx), "Scavenging: store=%zu size=%zu phase=%d\n", store->size, size, *phase);
+	fz_write_printf(ctx, fz_stdout(ctx), "Scavenging: store=%zu size=%zu phase=%d\n", store_size(store), size, *phase);
 	fz_debug_store_locked(ctx, fz_stdout(ctx));
 	Memento_stats();
 #endif
 	do
 	{
 		size_t tofree;
+		size_t current = store_size(store);
 
 		/* Calculate 'max' as the maximum size of the store for this phase */
 		if (*phase >= 16)
@@ -919,21 +1404,21 @@ int fz_store_scavenge(fz_context *ctx, size_t size, int *phase)
 		else if (store->max != FZ_STORE_UNLIMITED)
 			max = store->max / 16 * (16 - *phase);
 		else
-			max = store->size / (16 - *phase) * (15 - *phase);
+			max = current / (16 - *phase) * (15 - *phase);
 		(*phase)++;
 
 		/* Slightly baroque calculations to avoid overflow */
-		if (size > SIZE_MAX - store->size)
+		if (size > SIZE_MAX - current)
 			tofree = SIZE_MAX - max;
-		else if (size + store->size > max)
+		else if (size + current > max)
 			continue;
 		else
-			tofree = size + store->size - max;
+			tofree = size + current - max;
 
 		if (scavenge(ctx, tofree))
 		{
 #ifdef DEBUG_SCAVENGING
-			fz_write_printf(ctx, fz_stdout(ctx), "scavenged: store=%zu\n", store->size);
+			fz_write_printf(ctx, fz_stdout(ctx), "scavenged: store=%zu\n", store_size(store));
 			fz_debug_store(ctx, fz_stdout(ctx));
 			Memento_stats();
 #endif
@@ -955,7 +1440,7 @@ fz_shrink_store(fz_context *ctx, unsigned int percent)
 {
 	int success;
 	fz_store *store;
-	size_t new_size;
+	size_t size, new_size;
 
 	if (percent >= 100)
 		return 1;
@@ -965,18 +1450,19 @@ fz_shrink_store(fz_context *ctx, unsigned int percent)
 		return 0;
 
 #ifdef DEBUG_SCAVENGING
-	fz_write_printf(ctx, fz_stdout(ctx), "fz_shrink_store: %zu\n", store->size/(1024*1024));
+	fz_write_printf(ctx, fz_stdout(ctx), "fz_shrink_store: %zu\n", store_size(store)/(1024*1024));
 #endif
 	fz_lock(ctx, FZ_LOCK_ALLOC);
 
-	new_size = (size_t)(((uint64_t)store->size * percent) / 100);
-	if (store->size > new_size)
-		scavenge(ctx, store->size - new_size);
+	size = store_size(store);
+	new_size = (size_t)(((uint64_t)size * percent) / 100);
+	if (size > new_size)
+		scavenge(ctx, size - new_size);
 
-	success = (store->size <= new_size) ? 1 : 0;
+	success = (store_size(store) <= new_size) ? 1 : 0;
 	fz_unlock(ctx, FZ_LOCK_ALLOC);
 #ifdef DEBUG_SCAVENGING
-	fz_write_printf(ctx, fz_stdout(ctx), "fz_shrink_store after: %zu\n", store->size/(1024*1024));
+	fz_write_printf(ctx, fz_stdout(ctx), "fz_shrink_store after: %zu\n", store_size(store)/(1024*1024));
 #endif
 
 	return success;
@@ -985,57 +1471,47 @@ fz_shrink_store(fz_context *ctx, unsigned int percent)
 void fz_filter_store(fz_context *ctx, fz_store_filter_fn *fn, void *arg, const fz_store_type *type)
 {
 	fz_store *store;
+	fz_store_shard *shard;
 	fz_item *item, *prev, *remove;
+	int i, num;
 
 	store = ctx->store;
 	if (store == NULL)
 		return;
 
-	fz_lock(ctx, FZ_LOCK_ALLOC);
-
 	/* Filter the items */
 	remove = NULL;
-	for (item = store->tail; item; item = prev)
+	for (i = 0; i < store->nshards; i++)
 	{
-		prev = item->prev;
-		if (item->type != type)
-			continue;
+		shard = &store->shard[i];
+		lock_shard(ctx, shard, 0);
+		for (item = shard->tail; item; item = prev)
+		{
+			prev = item->prev;
+			if (item->type != type)
+				continue;
 
-		if (fn(ctx, arg, item->key) == 0)
-			continue;
+			if (fn(ctx, arg, item->key) == 0)
+				continue;
 
-		/* We have to drop it */
-		store->size -= item->size;
+			/* We have to drop it */
+			unlink_item(shard, item);
 
-		/* Unlink from the linked list */
-		if (item->next)
-			item->next->prev = item->prev;
-		else
-			store->tail = item->prev;
-		if (item->prev)
-			item->prev->next = item->next;
-		else
-			store->head = item->next;
+			/* Remove from the hash table */
+			remove_hashed_item(ctx, shard, item);
 
-		/* Remove from the hash table */
-		if (item->type->make_hash_key)
-		{
-			fz_store_hash hash = { NULL };
-			hash.drop = item->val->drop;
-			if (item->type->make_hash_key(ctx, &hash, item->key))
-				fz_hash_remove(ctx, store->hash, &hash);
-		}
-
-		/* Store whether to drop this value or not in 'prev' */
-		if (item->val->refs > 0)
-			(void)Memento_dropRef(item->val);
-		item->prev = (item->val->refs > 0 && --item->val->refs == 0) ? item : NULL;
+			/* Store whether to drop this value or not in 'prev' */
+			num = fz_refs_dec(&item->val->refs);
+			if (num >= 0)
+				(void)Memento_dropRef(item->val);
+			item->prev = (num == 0) ? item : NULL;
 
-		/* Store it in our removal chain - just singly linked */
-		item->next = remove;
-		remove = item;
+			/* Store it in our removal chain - just singly linked */
+			item->next = remove;
+			remove = item;
+		}
+		unlock_shard(ctx, shard, 0);
 	}
-	fz_unlock(ctx, FZ_LOCK_ALLOC);
 
 	/* Now drop the remove chain */
 	for (item = remove; item != NULL; item = remove)
@@ -1052,6 +1528,165 @@ void fz_filter_store(fz_context *ctx, fz_store_filter_fn *fn, void *arg, const f
 	}
 }
 
+static const char *fz_store_policy_names[] =
+{
+	"lru",
+	"gds",
+};
+
+fz_store_policy fz_lookup_store_policy(const char *name)
+{
+	int i;
+	for (i = 0; i < (int)nelem(fz_store_policy_names); i++)
+		if (!strcmp(name, fz_store_policy_names[i]))
+			return (fz_store_policy)i;
+	return FZ_STORE_POLICY_LRU;
+}
+
+const char *fz_store_policy_name(fz_store_policy policy)
+{
+	if (policy >= 0 && policy < (int)nelem(fz_store_policy_names))
+		return fz_store_policy_names[policy];
+	return "unknown";
+}
+
+void fz_set_store_policy(fz_context *ctx, fz_store_policy policy)
+{
+	if (ctx->store == NULL)
+		return;
+
+	/* Item priorities are kept up to date whatever the policy, so
+	 * there is nothing else to do here. */
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	ctx->store->policy = policy;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+}
+
+fz_store_policy fz_store_policy_in_use(fz_context *ctx)
+{
+	if (ctx->store == NULL)
+		return FZ_STORE_POLICY_LRU;
+	return ctx->store->policy;
+}
+
+void fz_store_hit_counts(fz_context *ctx, size_t *lookups, size_t *hits)
+{
+	fz_store_stats stats;
+	size_t l = 0, h = 0;
+	int i;
+
+	fz_read_store_stats(ctx, &stats);
+	for (i = 0; i < stats.num_types; i++)
+	{
+		l += stats.types[i].lookups;
+		h += stats.types[i].hits;
+	}
+	if (lookups)
+		*lookups = l;
+	if (hits)
+		*hits = h;
+}
+
+void fz_read_store_stats(fz_context *ctx, fz_store_stats *stats)
+{
+	fz_store *store = ctx->store;
+	fz_store_shard *shard;
+	fz_store_type_stats *src, *dst;
+	int i, j, k;
+
+	memset(stats, 0, sizeof(*stats));
+	if (store == NULL)
+		return;
+
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	stats->max = store->max;
+	stats->scavenge_passes = store->scavenge_passes;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+
+	for (i = 0; i < store->nshards; i++)
+	{
+		shard = &store->shard[i];
+		fz_lock(ctx, shard->lock);
+		stats->size += shard->size;
+		for (j = 0; j < shard->num_types; j++)
+		{
+			src = &shard->stats[j];
+
+			/* Merge by name, as that is all the caller sees. */
+			for (k = 0; k < stats->num_types; k++)
+				if (!strcmp(stats->types[k].name, src->name))
+					break;
+			if (k == FZ_STORE_STATS_MAX_TYPES)
+				continue;
+			if (k == stats->num_types)
+			{
+				stats->types[k].name = src->name;
+				stats->num_types++;
+			}
+			dst = &stats->types[k];
+			dst->lookups += src->lookups;
+			dst->hits += src->hits;
+			dst->misses += src->misses;
+			dst->insertions += src->insertions;
+			dst->evictions += src->evictions;
+			dst->bytes_evicted += src->bytes_evicted;
+			dst->scavenge_evictions += src->scavenge_evictions;
+			dst->ensure_space_time += src->ensure_space_time;
+		}
+		fz_unlock(ctx, shard->lock);
+	}
+}
+
+void fz_reset_store_stats(fz_context *ctx)
+{
+	fz_store *store = ctx->store;
+	fz_store_shard *shard;
+	int i, j;
+
+	if (store == NULL)
+		return;
+
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	store->scavenge_passes = 0;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+
+	for (i = 0; i < store->nshards; i++)
+	{
+		shard = &store->shard[i];
+		fz_lock(ctx, shard->lock);
+		for (j = 0; j < shard->num_types; j++)
+		{
+			const char *name = shard->stats[j].name;
+			memset(&shard->stats[j], 0, sizeof(shard->stats[j]));
+			shard->stats[j].name = name;
+		}
+		fz_unlock(ctx, shard->lock);
+	}
+}
+
+void fz_print_store_stats(fz_context *ctx, fz_output *out)
+{
+	fz_store_stats stats;
+	fz_store_type_stats *t;
+	int i;
+
+	fz_read_store_stats(ctx, &stats);
+
+	fz_write_printf(ctx, out, "Store: policy=%s size=%zu max=%zu scavenges=%zu\n",
+		fz_store_policy_name(fz_store_policy_in_use(ctx)), stats.size, stats.max, stats.scavenge_passes);
+	for (i = 0; i < stats.num_types; i++)
+	{
+		t = &stats.types[i];
+		fz_write_printf(ctx, out, "Store: %s: lookups=%zu hits=%zu misses=%zu hit rate=%.1f%% insertions=%zu evictions=%zu (%zu scavenged) bytes evicted=%zu ensure space=%.3fms\n",
+			t->name,
+			t->lookups, t->hits, t->misses,
+			t->lookups ? t->hits * 100.0 / t->lookups : 0.0,
+			t->insertions,
+			t->evictions, t->scavenge_evictions, t->bytes_evicted,
+			t->ensure_space_time / 1000.0);
+	}
+}
+
 void fz_defer_reap_start(fz_context *ctx)
 {
 	if (ctx->store == NULL)
@@ -8,6 +8,7 @@
 #include <string.h>
 #include <errno.h>
 #include <stdio.h>
+#include <stddef.h>
 
 int
 fz_file_exists(fz_context *ctx, const char *path)
@@ -156,6 +157,20 @@ fz_stream *
 fz_open_file(fz_context *ctx, const char *name)
 {
 	FILE *file;
+#if FZ_ENABLE_MMAP
+	fz_buffer *buf = fz_new_buffer_from_mapped_file(ctx, name);
+	if (buf)
+	{
+		fz_stream *stm = NULL;
+		fz_try(ctx)
+			stm = fz_open_buffer(ctx, buf);
+		fz_always(ctx)
+			fz_drop_buffer(ctx, buf);
+		fz_catch(ctx)
+			fz_rethrow(ctx);
+		return stm;
+	}
+#endif
 #ifdef _WIN32
 	file = fz_fopen_utf8(name, "rb");
 #else
@@ -201,7 +216,7 @@ static void seek_buffer(fz_context *ctx, fz_stream *stm, int64_t offset, int whe
 		offset = 0;
 	if (offset > stm->pos)
 		offset = stm->pos;
-	stm->rp += (int)(offset - pos);
+	stm->rp += (ptrdiff_t)(offset - pos);
 }
 
 static void drop_buffer(fz_context *ctx, void *state_)
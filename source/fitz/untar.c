@@ -3,6 +3,8 @@
 #include <string.h>
 #include <limits.h>
 
+#include "archive-imp.h"
+
 #define TYPE_NORMAL_OLD '\0'
 #define TYPE_NORMAL '0'
 #define TYPE_CONTIGUOUS '7'
@@ -21,6 +23,7 @@ typedef struct
 
 	int count;
 	tar_entry *entries;
+	fz_archive_index index;
 } fz_tar_archive;
 
 static inline int isoctdigit(char c)
@@ -49,6 +52,13 @@ static void drop_tar_archive(fz_context *ctx, fz_archive *arch)
 	for (i = 0; i < tar->count; ++i)
 		fz_free(ctx, tar->entries[i].name);
 	fz_free(ctx, tar->entries);
+	fz_drop_archive_index(ctx, &tar->index);
+}
+
+static const char *tar_entry_name(void *arg, int idx)
+{
+	fz_tar_archive *tar = arg;
+	return tar->entries[idx].name;
 }
 
 static int is_zeroed(fz_context *ctx, unsigned char *buf, size_t size)
@@ -137,10 +147,8 @@ static void ensure_tar_entries(fz_context *ctx, fz_tar_archive *tar)
 static tar_entry *lookup_tar_entry(fz_context *ctx, fz_tar_archive *tar, const char *name)
 {
 	int i;
-	for (i = 0; i < tar->count; i++)
-		if (!fz_strcasecmp(name, tar->entries[i].name))
-			return &tar->entries[i];
-	return NULL;
+	i = fz_lookup_archive_index(ctx, &tar->index, name, tar_entry_name, tar);
+	return i < 0 ? NULL : &tar->entries[i];
 }
 
 static fz_stream *open_tar_entry(fz_context *ctx, fz_archive *arch, const char *name)
@@ -250,6 +258,7 @@ fz_open_tar_archive_with_stream(fz_context *ctx, fz_stream *file)
 	fz_try(ctx)
 	{
 		ensure_tar_entries(ctx, tar);
+		fz_build_archive_index(ctx, &tar->index, tar->count, tar_entry_name, tar);
 	}
 	fz_catch(ctx)
 	{
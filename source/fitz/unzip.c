@@ -4,6 +4,7 @@
 #include <limits.h>
 
 #include "z-imp.h"
+#include "archive-imp.h"
 
 #if !defined (INT32_MAX)
 #define INT32_MAX 2147483647L
@@ -32,6 +33,7 @@ typedef struct
 
 	int count;
 	zip_entry *entries;
+	fz_archive_index index;
 } fz_zip_archive;
 
 static void drop_zip_archive(fz_context *ctx, fz_archive *arch)
@@ -41,6 +43,13 @@ static void drop_zip_archive(fz_context *ctx, fz_archive *arch)
 	for (i = 0; i < zip->count; ++i)
 		fz_free(ctx, zip->entries[i].name);
 	fz_free(ctx, zip->entries);
+	fz_drop_archive_index(ctx, &zip->index);
+}
+
+static const char *zip_entry_name(void *arg, int idx)
+{
+	fz_zip_archive *zip = arg;
+	return zip->entries[idx].name;
 }
 
 static void read_zip_dir_imp(fz_context *ctx, fz_zip_archive *zip, int64_t start_offset)
@@ -265,10 +274,8 @@ static zip_entry *lookup_zip_entry(fz_context *ctx, fz_zip_archive *zip, const c
 	int i;
 	if (name[0] == '/')
 		++name;
-	for (i = 0; i < zip->count; i++)
-		if (!fz_strcasecmp(name, zip->entries[i].name))
-			return &zip->entries[i];
-	return NULL;
+	i = fz_lookup_archive_index(ctx, &zip->index, name, zip_entry_name, zip);
+	return i < 0 ? NULL : &zip->entries[i];
 }
 
 static fz_stream *open_zip_entry(fz_context *ctx, fz_archive *arch, const char *name)
@@ -438,6 +445,7 @@ fz_open_zip_archive_with_stream(fz_context *ctx, fz_stream *file)
 	fz_try(ctx)
 	{
 		ensure_zip_entries(ctx, zip);
+		fz_build_archive_index(ctx, &zip->index, zip->count, zip_entry_name, zip);
 	}
 	fz_catch(ctx)
 	{
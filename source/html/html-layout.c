@@ -143,6 +143,8 @@ static int walk_string(string_walker *walker)
 	if (walker->script <= 3 && !walker->rtl && !fz_font_flags(walker->font)->has_opentype)
 		quickshape = 1;
 
+	/* The face lock must be taken before the harfbuzz one. */
+	fz_ft_lock(ctx, walker->font);
 	fz_hb_lock(ctx);
 	fz_try(ctx)
 	{
@@ -191,6 +193,7 @@ static int walk_string(string_walker *walker)
 	fz_always(ctx)
 	{
 		fz_hb_unlock(ctx);
+		fz_ft_unlock(ctx, walker->font);
 	}
 	fz_catch(ctx)
 	{
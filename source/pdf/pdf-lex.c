@@ -41,10 +41,124 @@ static inline int lex_byte(fz_context *ctx, fz_stream *stm)
 		fz_write_printf(ctx, fz_stdout(ctx), "<%02x>", c);
 	return c;
 }
+#define lex_span_end(S) ((S)->rp)
 #else
-#define lex_byte(C,S) fz_read_byte(C,S)
+/* fz_read_byte cannot be inlined (it has to catch errors when it
+ * refills the buffer), so only call it when the buffer is empty. */
+static inline int lex_byte(fz_context *ctx, fz_stream *stm)
+{
+	if (stm->rp != stm->wp)
+		return *stm->rp++;
+	return fz_read_byte(ctx, stm);
+}
+#define lex_span_end(S) ((S)->wp)
 #endif
 
+/*
+	Fast paths.
+
+	Most of the time the rest of a token is already in the stream's
+	buffer, so rather than reading it a byte at a time, the lexer looks
+	at the span of buffered bytes directly: it finds where the run of
+	whitespace, comment text, or plain name, digit or string bytes ends,
+	copies the run in one go, and moves the read pointer past it. The
+	byte that ends the run, anything unusual (an escape in a string, '#'
+	in a name) and the end of the buffer are all left to the byte at a
+	time code, which carries on from where the fast path stopped.
+
+	Runs of 16 bytes or more are searched with fz_find_byte_in_set,
+	which uses SSSE3 or NEON when the CPU has them. When dumping the
+	lexer stream the spans are empty, so that every byte is still
+	dumped.
+*/
+
+enum
+{
+	LEX_WHITE = 1,
+	LEX_DELIM = 2,
+	LEX_HASH = 4,
+	LEX_DIGIT = 8,
+	LEX_STRING = 16, /* parentheses and backslash */
+	LEX_EOL = 32
+};
+
+#define W LEX_WHITE
+#define D LEX_DELIM
+#define H LEX_HASH
+#define N LEX_DIGIT
+#define S (LEX_DELIM|LEX_STRING)
+#define E (LEX_WHITE|LEX_EOL)
+static const unsigned char lex_class[256] =
+{
+	W,0,0,0,0,0,0,0,0,W,E,0,W,E,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	W,0,0,H,0,D,0,0,S,S,0,0,0,0,0,D,
+	N,N,N,N,N,N,N,N,N,N,0,0,D,0,D,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,D,LEX_STRING,D,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,D,0,D,0,0,
+};
+#undef W
+#undef D
+#undef H
+#undef N
+#undef S
+#undef E
+
+/* The bytes that end each kind of run, as sets for fz_find_byte_in_set.
+ * For white space, delimiters and '#', the high nibbles 0, 2, 3, 5 and
+ * 7 have bits 1, 2, 4, 8 and 8. */
+static const fz_byte_set name_end_set =
+{
+	{ 3, 0, 0, 2, 0, 2, 0, 0, 2, 3, 1, 8, 5, 9, 4, 2 },
+	{ 1, 0, 2, 4, 0, 8, 0, 8 }
+};
+static const fz_byte_set string_special_set =
+{
+	{ 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 0, 0, 2 }, /* '(', ')', '\\' */
+	{ 0, 0, 1, 0, 0, 2 }
+};
+static const fz_byte_set eol_set =
+{
+	{ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 1 }, /* LF, CR */
+	{ 1 }
+};
+
+/* The end of a run of bytes that are neither white space, delimiters,
+ * nor '#'. */
+static inline const unsigned char *
+find_name_end(const unsigned char *p, const unsigned char *end)
+{
+	if (end - p >= 16)
+		return fz_find_byte_in_set(p, end, &name_end_set);
+	while (p < end && !(lex_class[*p] & (LEX_WHITE|LEX_DELIM|LEX_HASH)))
+		p++;
+	return p;
+}
+
+/* The first '(', ')' or '\\'. */
+static inline const unsigned char *
+find_string_special(const unsigned char *p, const unsigned char *end)
+{
+	if (end - p >= 16)
+		return fz_find_byte_in_set(p, end, &string_special_set);
+	while (p < end && !(lex_class[*p] & LEX_STRING))
+		p++;
+	return p;
+}
+
+/* The first CR or LF. */
+static inline const unsigned char *
+find_eol(const unsigned char *p, const unsigned char *end)
+{
+	if (end - p >= 16)
+		return fz_find_byte_in_set(p, end, &eol_set);
+	while (p < end && !(lex_class[*p] & LEX_EOL))
+		p++;
+	return p;
+}
+
 static inline int iswhite(int ch)
 {
 	return
@@ -74,6 +188,10 @@ lex_white(fz_context *ctx, fz_stream *f)
 {
 	int c;
 	do {
+		const unsigned char *p = f->rp, *end = lex_span_end(f);
+		while (p < end && (lex_class[*p] & LEX_WHITE))
+			p++;
+		f->rp = (unsigned char *)p;
 		c = lex_byte(ctx, f);
 	} while ((c <= 32) && (iswhite(c)));
 	if (c != EOF)
@@ -85,6 +203,7 @@ lex_comment(fz_context *ctx, fz_stream *f)
 {
 	int c;
 	do {
+		f->rp = (unsigned char *)find_eol(f->rp, lex_span_end(f));
 		c = lex_byte(ctx, f);
 	} while ((c != '\012') && (c != '\015') && (c != EOF));
 }
@@ -136,6 +255,50 @@ static float acrobat_compatible_atof(char *s)
 	}
 }
 
+/* Fast and exact atof for the commonest numbers in content streams:
+ * decimals with at most 7 digits. Both the digits and the power of ten
+ * are exact as floats, so a single division rounds the value just as
+ * fz_atof does. Returns 0 for anything else. */
+static int fast_atof(const char *s, float *f)
+{
+	static const float pow10[] = { 1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f };
+	int neg = 0;
+	int m = 0;
+	int digits = 0;
+	int frac = -1;
+	float v;
+
+	if (*s == '-')
+	{
+		neg = 1;
+		++s;
+	}
+	else if (*s == '+')
+		++s;
+
+	for (; *s; ++s)
+	{
+		if (*s >= '0' && *s <= '9')
+		{
+			if (++digits > 7)
+				return 0;
+			m = m * 10 + (*s - '0');
+			if (frac >= 0)
+				++frac;
+		}
+		else if (*s == '.' && frac < 0)
+			frac = 0;
+		else
+			return 0;
+	}
+	if (digits == 0)
+		return 0;
+
+	v = (float)m / pow10[frac < 0 ? 0 : frac];
+	*f = neg ? -v : v;
+	return 1;
+}
+
 /* Fast but inaccurate atoi. */
 static int fast_atoi(char *s)
 {
@@ -200,6 +363,13 @@ lex_number(fz_context *ctx, fz_stream *f, pdf_lexbuf *buf, int c)
 			break;
 		case RANGE_0_9:
 			*s++ = c;
+			{
+				const unsigned char *p = f->rp;
+				const unsigned char *end = p + fz_minz(lex_span_end(f) - p, e - s);
+				while (p < end && (lex_class[*p] & LEX_DIGIT))
+					*s++ = *p++;
+				f->rp = (unsigned char *)p;
+			}
 			break;
 		default:
 			isbad = 1;
@@ -222,7 +392,7 @@ end:
 		 * acrobat compatible routine where required. */
 		if (neg > 1 || isreal - buf->scratch >= 10)
 			buf->f = acrobat_compatible_atof(buf->scratch);
-		else
+		else if (!fast_atof(buf->scratch, &buf->f))
 			buf->f = fz_atof(buf->scratch);
 		return PDF_TOK_REAL;
 	}
@@ -238,6 +408,7 @@ lex_name(fz_context *ctx, fz_stream *f, pdf_lexbuf *lb)
 {
 	char *s = lb->scratch;
 	char *e = s + fz_minz(127, lb->size);
+	int held = 0;
 	int c;
 
 	while (1)
@@ -258,6 +429,24 @@ lex_name(fz_context *ctx, fz_stream *f, pdf_lexbuf *lb)
 				s = NULL;
 			}
 		}
+		if (held)
+		{
+			if (s) *s++ = held;
+			held = 0;
+			continue;
+		}
+		if (s)
+		{
+			const unsigned char *p = f->rp;
+			size_t n = find_name_end(p, p + fz_minz(lex_span_end(f) - p, e - s)) - p;
+			memcpy(s, p, n);
+			s += n;
+			f->rp += n;
+			if (s == e)
+				continue;
+		}
+		else
+			f->rp = (unsigned char *)find_name_end(f->rp, lex_span_end(f));
 		c = lex_byte(ctx, f);
 		switch (c)
 		{
@@ -270,10 +459,13 @@ lex_name(fz_context *ctx, fz_stream *f, pdf_lexbuf *lb)
 		case '#':
 		{
 			int hex[2];
+			int digit = 0;
 			int i;
 			for (i = 0; i < 2; i++)
 			{
 				c = fz_peek_byte(ctx, f);
+				if (i == 0)
+					digit = c;
 				switch (c)
 				{
 				case RANGE_0_9:
@@ -295,9 +487,11 @@ lex_name(fz_context *ctx, fz_stream *f, pdf_lexbuf *lb)
 			if (s) *s++ = (hex[0] << 4) + hex[1];
 			break;
 illegal:
-			if (i == 1)
-				fz_unread_byte(ctx, f);
 			if (s) *s++ = '#';
+			/* The peek may have moved the buffer on past a lone
+			 * digit, so it cannot be unread; add it next time round. */
+			if (i == 1)
+				held = digit;
 			continue;
 		}
 		default:
@@ -329,6 +523,15 @@ lex_string(fz_context *ctx, fz_stream *f, pdf_lexbuf *lb)
 			s += pdf_lexbuf_grow(ctx, lb);
 			e = lb->scratch + lb->size;
 		}
+		{
+			const unsigned char *p = f->rp;
+			size_t n = find_string_special(p, p + fz_minz(lex_span_end(f) - p, e - s)) - p;
+			memcpy(s, p, n);
+			s += n;
+			f->rp += n;
+			if (s == e)
+				continue;
+		}
 		c = lex_byte(ctx, f);
 		switch (c)
 		{
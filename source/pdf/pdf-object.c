@@ -36,7 +36,8 @@ enum
 	PDF_FLAGS_SORTED = 2,
 	PDF_FLAGS_DIRTY = 4,
 	PDF_FLAGS_MEMO_BASE = 8,
-	PDF_FLAGS_MEMO_BASE_BOOL = 16
+	PDF_FLAGS_MEMO_BASE_BOOL = 16,
+	PDF_FLAGS_ARENA = 128
 };
 
 struct pdf_obj
@@ -105,32 +106,146 @@ typedef struct
 #define ARRAY(obj) ((pdf_obj_array *)(obj))
 #define REF(obj) ((pdf_obj_ref *)(obj))
 
+/*
+	Objects in an arena are preceded by a pointer to it, and arrays and
+	dicts in an arena have their items right after them, until they need
+	more room and move them to the heap. Each object holds a reference
+	to its arena, so that the arena's memory is freed when the document
+	has moved on to another arena and the last of its objects is
+	dropped.
+*/
+struct pdf_obj_arena
+{
+	int refs; /* one for each object, and one for the document while it is current */
+	fz_pool *pool;
+};
+
+#define ARENA_SIZE (64<<10) /* size at which a document moves on to a new arena */
+
+#define ARENA(obj) (((pdf_obj_arena **)(obj))[-1])
+#define ITEMS_IN_ARENA(obj) (((obj)->flags & PDF_FLAGS_ARENA) && (void *)ARRAY(obj)->items == (void *)(ARRAY(obj) + 1))
+
+static void
+pdf_drop_obj_arena(fz_context *ctx, pdf_obj_arena *arena)
+{
+	if (fz_drop_imp(ctx, arena, &arena->refs))
+	{
+		fz_drop_pool(ctx, arena->pool);
+		fz_free(ctx, arena);
+	}
+}
+
+void
+pdf_enable_obj_arenas(fz_context *ctx, pdf_document *doc)
+{
+	doc->use_obj_arenas = 1;
+}
+
+void
+pdf_disable_obj_arenas(fz_context *ctx, pdf_document *doc)
+{
+	doc->use_obj_arenas = 0;
+	if (doc->obj_arena)
+	{
+		pdf_drop_obj_arena(ctx, doc->obj_arena);
+		doc->obj_arena = NULL;
+	}
+}
+
+pdf_obj_arena *
+pdf_current_obj_arena(fz_context *ctx, pdf_document *doc)
+{
+	pdf_obj_arena *arena;
+
+	if (!doc || !doc->use_obj_arenas)
+		return NULL;
+
+	if (doc->obj_arena && fz_pool_size(ctx, doc->obj_arena->pool) >= ARENA_SIZE)
+	{
+		pdf_drop_obj_arena(ctx, doc->obj_arena);
+		doc->obj_arena = NULL;
+	}
+
+	if (!doc->obj_arena)
+	{
+		arena = fz_malloc_struct(ctx, pdf_obj_arena);
+		arena->refs = 1;
+		fz_try(ctx)
+			arena->pool = fz_new_pool(ctx);
+		fz_catch(ctx)
+		{
+			fz_free(ctx, arena);
+			fz_rethrow(ctx);
+		}
+		doc->obj_arena = arena;
+	}
+
+	return doc->obj_arena;
+}
+
+static void *
+pdf_new_obj(fz_context *ctx, pdf_obj_arena *arena, size_t size, int kind, const char *label)
+{
+	pdf_obj *obj;
+
+	if (arena)
+	{
+		pdf_obj_arena **p = fz_pool_alloc(ctx, arena->pool, sizeof *p + size);
+		*p = fz_keep_imp(ctx, arena, &arena->refs);
+		obj = (pdf_obj *)(p + 1);
+		obj->flags = PDF_FLAGS_ARENA;
+	}
+	else
+	{
+		obj = Memento_label(fz_malloc(ctx, size), label);
+		obj->flags = 0;
+	}
+	obj->refs = 1;
+	obj->kind = kind;
+	return obj;
+}
+
+static void
+pdf_free_obj(fz_context *ctx, pdf_obj *obj)
+{
+	if (obj->flags & PDF_FLAGS_ARENA)
+		pdf_drop_obj_arena(ctx, ARENA(obj));
+	else
+		fz_free(ctx, obj);
+}
+
 pdf_obj *
-pdf_new_int(fz_context *ctx, int64_t i)
+pdf_new_int_in_arena(fz_context *ctx, pdf_obj_arena *arena, int64_t i)
 {
 	pdf_obj_num *obj;
-	obj = Memento_label(fz_malloc(ctx, sizeof(pdf_obj_num)), "pdf_obj(int)");
-	obj->super.refs = 1;
-	obj->super.kind = PDF_INT;
-	obj->super.flags = 0;
+	obj = pdf_new_obj(ctx, arena, sizeof(pdf_obj_num), PDF_INT, "pdf_obj(int)");
 	obj->u.i = i;
 	return &obj->super;
 }
 
 pdf_obj *
-pdf_new_real(fz_context *ctx, float f)
+pdf_new_int(fz_context *ctx, int64_t i)
+{
+	return pdf_new_int_in_arena(ctx, NULL, i);
+}
+
+pdf_obj *
+pdf_new_real_in_arena(fz_context *ctx, pdf_obj_arena *arena, float f)
 {
 	pdf_obj_num *obj;
-	obj = Memento_label(fz_malloc(ctx, sizeof(pdf_obj_num)), "pdf_obj(real)");
-	obj->super.refs = 1;
-	obj->super.kind = PDF_REAL;
-	obj->super.flags = 0;
+	obj = pdf_new_obj(ctx, arena, sizeof(pdf_obj_num), PDF_REAL, "pdf_obj(real)");
 	obj->u.f = f;
 	return &obj->super;
 }
 
 pdf_obj *
-pdf_new_string(fz_context *ctx, const char *str, size_t len)
+pdf_new_real(fz_context *ctx, float f)
+{
+	return pdf_new_real_in_arena(ctx, NULL, f);
+}
+
+pdf_obj *
+pdf_new_string_in_arena(fz_context *ctx, pdf_obj_arena *arena, const char *str, size_t len)
 {
 	pdf_obj_string *obj;
 	unsigned int l = (unsigned int)len;
@@ -138,10 +253,7 @@ pdf_new_string(fz_context *ctx, const char *str, size_t len)
 	if ((size_t)l != len)
 		fz_throw(ctx, FZ_ERROR_GENERIC, "Overflow in pdf string");
 
-	obj = Memento_label(fz_malloc(ctx, offsetof(pdf_obj_string, buf) + len + 1), "pdf_obj(string)");
-	obj->super.refs = 1;
-	obj->super.kind = PDF_STRING;
-	obj->super.flags = 0;
+	obj = pdf_new_obj(ctx, arena, offsetof(pdf_obj_string, buf) + len + 1, PDF_STRING, "pdf_obj(string)");
 	obj->text = NULL;
 	obj->len = l;
 	memcpy(obj->buf, str, len);
@@ -150,7 +262,13 @@ pdf_new_string(fz_context *ctx, const char *str, size_t len)
 }
 
 pdf_obj *
-pdf_new_name(fz_context *ctx, const char *str)
+pdf_new_string(fz_context *ctx, const char *str, size_t len)
+{
+	return pdf_new_string_in_arena(ctx, NULL, str, len);
+}
+
+pdf_obj *
+pdf_new_name_in_arena(fz_context *ctx, pdf_obj_arena *arena, const char *str)
 {
 	pdf_obj_name *obj;
 	int l = 3; /* skip dummy slots */
@@ -167,32 +285,38 @@ pdf_new_name(fz_context *ctx, const char *str)
 			return (pdf_obj*)(intptr_t)m;
 	}
 
-	obj = Memento_label(fz_malloc(ctx, offsetof(pdf_obj_name, n) + strlen(str) + 1), "pdf_obj(name)");
-	obj->super.refs = 1;
-	obj->super.kind = PDF_NAME;
-	obj->super.flags = 0;
+	obj = pdf_new_obj(ctx, arena, offsetof(pdf_obj_name, n) + strlen(str) + 1, PDF_NAME, "pdf_obj(name)");
 	strcpy(obj->n, str);
 	return &obj->super;
 }
 
 pdf_obj *
-pdf_new_indirect(fz_context *ctx, pdf_document *doc, int num, int gen)
+pdf_new_name(fz_context *ctx, const char *str)
+{
+	return pdf_new_name_in_arena(ctx, NULL, str);
+}
+
+pdf_obj *
+pdf_new_indirect_in_arena(fz_context *ctx, pdf_obj_arena *arena, pdf_document *doc, int num, int gen)
 {
 	pdf_obj_ref *obj;
 	if (num < 0 || num > PDF_MAX_OBJECT_NUMBER)
 		fz_throw(ctx, FZ_ERROR_SYNTAX, "invalid object number (%d)", num);
 	if (gen < 0 || gen > PDF_MAX_GEN_NUMBER)
 		fz_throw(ctx, FZ_ERROR_SYNTAX, "invalid generation number (%d)", gen);
-	obj = Memento_label(fz_malloc(ctx, sizeof(pdf_obj_ref)), "pdf_obj(indirect)");
-	obj->super.refs = 1;
-	obj->super.kind = PDF_INDIRECT;
-	obj->super.flags = 0;
+	obj = pdf_new_obj(ctx, arena, sizeof(pdf_obj_ref), PDF_INDIRECT, "pdf_obj(indirect)");
 	obj->doc = doc;
 	obj->num = num;
 	obj->gen = gen;
 	return &obj->super;
 }
 
+pdf_obj *
+pdf_new_indirect(fz_context *ctx, pdf_document *doc, int num, int gen)
+{
+	return pdf_new_indirect_in_arena(ctx, NULL, doc, num, gen);
+}
+
 #define OBJ_IS_NULL(obj) (obj == PDF_NULL)
 #define OBJ_IS_BOOL(obj) (obj == PDF_TRUE || obj == PDF_FALSE)
 #define OBJ_IS_NAME(obj) ((obj > PDF_FALSE && obj < PDF_LIMIT) || (obj >= PDF_LIMIT && obj->kind == PDF_NAME))
@@ -585,13 +709,57 @@ pdf_new_array(fz_context *ctx, pdf_document *doc, int initialcap)
 	return &obj->super;
 }
 
+pdf_obj *
+pdf_new_array_in_arena(fz_context *ctx, pdf_obj_arena *arena, pdf_document *doc, int n, pdf_obj **items)
+{
+	pdf_obj_array *obj = NULL;
+	int i;
+
+	fz_var(obj);
+
+	fz_try(ctx)
+	{
+		if (arena)
+		{
+			obj = pdf_new_obj(ctx, arena, sizeof(pdf_obj_array) + n * sizeof(pdf_obj*), PDF_ARRAY, NULL);
+			obj->doc = doc;
+			obj->parent_num = 0;
+			obj->len = 0;
+			obj->cap = n;
+			obj->items = (pdf_obj **)(obj + 1);
+		}
+		else
+			obj = ARRAY(pdf_new_array(ctx, doc, n));
+
+		for (i = 0; i < n; i++)
+			pdf_array_push(ctx, (pdf_obj *)obj, items[i]);
+	}
+	fz_always(ctx)
+		for (i = 0; i < n; i++)
+			pdf_drop_obj(ctx, items[i]);
+	fz_catch(ctx)
+	{
+		pdf_drop_obj(ctx, (pdf_obj *)obj);
+		fz_rethrow(ctx);
+	}
+
+	return (pdf_obj *)obj;
+}
+
 static void
 pdf_array_grow(fz_context *ctx, pdf_obj_array *obj)
 {
 	int i;
-	int new_cap = (obj->cap * 3) / 2;
+	int new_cap = obj->cap < 4 ? 6 : (obj->cap * 3) / 2;
 
-	obj->items = fz_realloc_array(ctx, obj->items, new_cap, pdf_obj*);
+	if (ITEMS_IN_ARENA(&obj->super))
+	{
+		pdf_obj **items = Memento_label(fz_malloc_array(ctx, new_cap, pdf_obj*), "pdf_array_items");
+		memcpy(items, obj->items, obj->len * sizeof(pdf_obj*));
+		obj->items = items;
+	}
+	else
+		obj->items = fz_realloc_array(ctx, obj->items, new_cap, pdf_obj*);
 	obj->cap = new_cap;
 
 	for (i = obj->len ; i < obj->cap; i++)
@@ -683,7 +851,12 @@ static void prepare_object_for_alteration(fz_context *ctx, pdf_obj *obj, pdf_obj
 		parent_num == 0 while an object is being parsed from the file.
 		No further action is necessary.
 	*/
-	if (parent == 0 || doc->save_in_progress || doc->repair_attempted)
+	if (parent == 0)
+		return;
+
+	pdf_invalidate_page_map(ctx, doc, parent);
+
+	if (doc->save_in_progress || doc->repair_attempted)
 		return;
 
 	/*
@@ -932,13 +1105,58 @@ pdf_new_dict(fz_context *ctx, pdf_document *doc, int initialcap)
 	return &obj->super;
 }
 
+pdf_obj *
+pdf_new_dict_in_arena(fz_context *ctx, pdf_obj_arena *arena, pdf_document *doc, int n, pdf_obj **items)
+{
+	pdf_obj_dict *obj = NULL;
+	int i;
+
+	fz_var(obj);
+
+	fz_try(ctx)
+	{
+		if (arena)
+		{
+			obj = pdf_new_obj(ctx, arena, sizeof(pdf_obj_dict) + n * sizeof(struct keyval), PDF_DICT, NULL);
+			obj->doc = doc;
+			obj->parent_num = 0;
+			obj->len = 0;
+			obj->cap = n;
+			obj->items = (struct keyval *)(obj + 1);
+		}
+		else
+			obj = DICT(pdf_new_dict(ctx, doc, n));
+
+		/* Put them one by one, for the same handling of repeated keys. */
+		for (i = 0; i < n; i++)
+			pdf_dict_put(ctx, (pdf_obj *)obj, items[2*i], items[2*i+1]);
+	}
+	fz_always(ctx)
+		for (i = 0; i < 2*n; i++)
+			pdf_drop_obj(ctx, items[i]);
+	fz_catch(ctx)
+	{
+		pdf_drop_obj(ctx, (pdf_obj *)obj);
+		fz_rethrow(ctx);
+	}
+
+	return (pdf_obj *)obj;
+}
+
 static void
 pdf_dict_grow(fz_context *ctx, pdf_obj *obj)
 {
 	int i;
-	int new_cap = (DICT(obj)->cap * 3) / 2;
+	int new_cap = DICT(obj)->cap < 4 ? 6 : (DICT(obj)->cap * 3) / 2;
 
-	DICT(obj)->items = fz_realloc_array(ctx, DICT(obj)->items, new_cap, struct keyval);
+	if (ITEMS_IN_ARENA(obj))
+	{
+		struct keyval *items = Memento_label(fz_malloc_array(ctx, new_cap, struct keyval), "dict_items");
+		memcpy(items, DICT(obj)->items, DICT(obj)->len * sizeof(struct keyval));
+		DICT(obj)->items = items;
+	}
+	else
+		DICT(obj)->items = fz_realloc_array(ctx, DICT(obj)->items, new_cap, struct keyval);
 	DICT(obj)->cap = new_cap;
 
 	for (i = DICT(obj)->len; i < DICT(obj)->cap; i++)
@@ -1684,8 +1902,9 @@ pdf_drop_array(fz_context *ctx, pdf_obj *obj)
 	for (i = 0; i < DICT(obj)->len; i++)
 		pdf_drop_obj(ctx, ARRAY(obj)->items[i]);
 
-	fz_free(ctx, DICT(obj)->items);
-	fz_free(ctx, obj);
+	if (!ITEMS_IN_ARENA(obj))
+		fz_free(ctx, DICT(obj)->items);
+	pdf_free_obj(ctx, obj);
 }
 
 static void
@@ -1698,8 +1917,9 @@ pdf_drop_dict(fz_context *ctx, pdf_obj *obj)
 		pdf_drop_obj(ctx, DICT(obj)->items[i].v);
 	}
 
-	fz_free(ctx, DICT(obj)->items);
-	fz_free(ctx, obj);
+	if (!ITEMS_IN_ARENA(obj))
+		fz_free(ctx, DICT(obj)->items);
+	pdf_free_obj(ctx, obj);
 }
 
 pdf_obj *
@@ -1724,10 +1944,10 @@ pdf_drop_obj(fz_context *ctx, pdf_obj *obj)
 			else if (obj->kind == PDF_STRING)
 			{
 				fz_free(ctx, STRING(obj)->text);
-				fz_free(ctx, obj);
+				pdf_free_obj(ctx, obj);
 			}
 			else
-				fz_free(ctx, obj);
+				pdf_free_obj(ctx, obj);
 		}
 	}
 }
@@ -82,6 +82,544 @@ pdf_drop_page_tree(fz_context *ctx, pdf_document *doc)
 	doc->rev_page_count = 0;
 }
 
+enum
+{
+	/* Number of page lookups before the page tree is mapped */
+	FWD_PAGE_MAP_AFTER = 8
+};
+
+static void
+drop_fwd_page_map(fz_context *ctx, pdf_fwd_page_map *map)
+{
+	int i;
+
+	if (!map)
+		return;
+	for (i = 0; i < map->count; i++)
+	{
+		pdf_fwd_page *fwd = &map->pages[i];
+		pdf_drop_obj(ctx, fwd->page);
+		pdf_drop_obj(ctx, fwd->parent);
+		pdf_drop_obj(ctx, fwd->mediabox);
+		pdf_drop_obj(ctx, fwd->cropbox);
+		pdf_drop_obj(ctx, fwd->rotate);
+		pdf_drop_obj(ctx, fwd->resources);
+	}
+	fz_free(ctx, map->pages);
+	fz_free(ctx, map->nodes);
+	pdf_drop_obj(ctx, map->root);
+	fz_free(ctx, map);
+}
+
+static void
+add_fwd_page_node(fz_context *ctx, pdf_fwd_page_map *map, pdf_obj *obj)
+{
+	int num = pdf_obj_parent_num(ctx, obj);
+	if (num == 0)
+		return;
+	if (map->node_count == map->node_max)
+	{
+		map->node_max = map->node_max ? map->node_max * 2 : 64;
+		map->nodes = fz_realloc_array(ctx, map->nodes, map->node_max, int);
+	}
+	map->nodes[map->node_count++] = num;
+}
+
+static pdf_fwd_page *
+insert_fwd_page(fz_context *ctx, pdf_fwd_page_map *map, int at)
+{
+	if (map->count == map->max)
+	{
+		map->max = map->max ? map->max * 2 : 64;
+		map->pages = fz_realloc_array(ctx, map->pages, map->max, pdf_fwd_page);
+	}
+	memmove(&map->pages[at + 1], &map->pages[at], (map->count - at) * sizeof(*map->pages));
+	map->count++;
+	memset(&map->pages[at], 0, sizeof(*map->pages));
+	return &map->pages[at];
+}
+
+static void
+set_fwd_page(fz_context *ctx, pdf_fwd_page *fwd, pdf_obj *page, pdf_obj *parent, int index,
+	pdf_obj *mediabox, pdf_obj *cropbox, pdf_obj *rotate, pdf_obj *resources)
+{
+	fwd->page = pdf_keep_obj(ctx, page);
+	fwd->parent = pdf_keep_obj(ctx, parent);
+	fwd->index = index;
+	fwd->mediabox = pdf_keep_obj(ctx, mediabox);
+	fwd->cropbox = pdf_keep_obj(ctx, cropbox);
+	fwd->rotate = pdf_keep_obj(ctx, rotate);
+	fwd->resources = pdf_keep_obj(ctx, resources);
+}
+
+/* Whether a and b are the same page tree node, even if they are not the
+ * same reference to it. */
+static int
+same_page_node(fz_context *ctx, pdf_obj *a, pdf_obj *b)
+{
+	if (a == b)
+		return 1;
+	if (pdf_is_indirect(ctx, a) && pdf_is_indirect(ctx, b))
+		return pdf_to_num(ctx, a) == pdf_to_num(ctx, b);
+	return pdf_resolve_indirect(ctx, a) == pdf_resolve_indirect(ctx, b);
+}
+
+static pdf_obj *
+inherit(fz_context *ctx, pdf_obj *node, pdf_obj *key, pdf_obj *inherited)
+{
+	pdf_obj *val = pdf_dict_get(ctx, node, key);
+	return val ? val : inherited;
+}
+
+/* The attributes passed in are those the kids of node inherit. As the
+ * parent of each node is checked to be the node above it, these are the
+ * same as pdf_dict_get_inheritable would find. */
+static int
+pdf_load_fwd_page_map_imp(fz_context *ctx, pdf_fwd_page_map *map, pdf_obj *node,
+	pdf_obj *mediabox, pdf_obj *cropbox, pdf_obj *rotate, pdf_obj *resources)
+{
+	pdf_obj *kids = pdf_dict_get(ctx, node, PDF_NAME(Kids));
+	int i, n = pdf_array_len(ctx, kids);
+	int count = 0;
+
+	add_fwd_page_node(ctx, map, node);
+	add_fwd_page_node(ctx, map, kids);
+
+	if (pdf_mark_obj(ctx, node))
+		fz_throw(ctx, FZ_ERROR_GENERIC, "cycle in page tree");
+	fz_try(ctx)
+	{
+		for (i = 0; i < n; i++)
+		{
+			pdf_obj *kid = pdf_array_get(ctx, kids, i);
+			pdf_obj *type = pdf_dict_get(ctx, kid, PDF_NAME(Type));
+
+			/* Tell the nodes from the pages as pdf_lookup_page_loc
+			 * does, and only map trees whose counts let it find
+			 * the same pages in the same order. */
+			if (type ? pdf_name_eq(ctx, type, PDF_NAME(Pages)) : pdf_dict_get(ctx, kid, PDF_NAME(Kids)) && !pdf_dict_get(ctx, kid, PDF_NAME(MediaBox)))
+			{
+				int got;
+				if (pdf_resolve_indirect(ctx, pdf_dict_get(ctx, kid, PDF_NAME(Parent))) != pdf_resolve_indirect(ctx, node))
+					fz_throw(ctx, FZ_ERROR_GENERIC, "page tree node with wrong parent");
+				got = pdf_load_fwd_page_map_imp(ctx, map, kid,
+					inherit(ctx, kid, PDF_NAME(MediaBox), mediabox),
+					inherit(ctx, kid, PDF_NAME(CropBox), cropbox),
+					inherit(ctx, kid, PDF_NAME(Rotate), rotate),
+					inherit(ctx, kid, PDF_NAME(Resources), resources));
+				if (got != pdf_dict_get_int(ctx, kid, PDF_NAME(Count)))
+					fz_throw(ctx, FZ_ERROR_GENERIC, "page tree node with wrong count");
+				count += got;
+			}
+			else
+			{
+				pdf_fwd_page *fwd = insert_fwd_page(ctx, map, map->count);
+				set_fwd_page(ctx, fwd, kid, node, i, mediabox, cropbox, rotate, resources);
+				count++;
+			}
+		}
+	}
+	fz_always(ctx)
+		pdf_unmark_obj(ctx, node);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	return count;
+}
+
+static int
+cmp_int(const void *va, const void *vb)
+{
+	int a = *(const int *)va;
+	int b = *(const int *)vb;
+	return a < b ? -1 : a > b ? 1 : 0;
+}
+
+/* Map each page number to its page object (and where it is in the page
+ * tree), so that looking up a page does not mean walking down the tree
+ * each time. */
+static void
+pdf_load_fwd_page_map(fz_context *ctx, pdf_document *doc)
+{
+	pdf_obj *root = pdf_dict_get(ctx, pdf_trailer(ctx, doc), PDF_NAME(Root));
+	pdf_obj *node = pdf_dict_get(ctx, root, PDF_NAME(Pages));
+	int repaired = doc->repair_attempted;
+	pdf_fwd_page_map *map;
+
+	if (!node)
+		return;
+
+	map = fz_malloc_struct(ctx, pdf_fwd_page_map);
+	fz_try(ctx)
+	{
+		/* Replacing the catalog, or its Pages entry, changes the
+		 * page tree as much as editing the nodes does. */
+		map->root = pdf_keep_obj(ctx, root);
+		add_fwd_page_node(ctx, map, root);
+		pdf_load_fwd_page_map_imp(ctx, map, node,
+			pdf_dict_get_inheritable(ctx, node, PDF_NAME(MediaBox)),
+			pdf_dict_get_inheritable(ctx, node, PDF_NAME(CropBox)),
+			pdf_dict_get_inheritable(ctx, node, PDF_NAME(Rotate)),
+			pdf_dict_get_inheritable(ctx, node, PDF_NAME(Resources)));
+		qsort(map->nodes, map->node_count, sizeof(int), cmp_int);
+	}
+	fz_catch(ctx)
+	{
+		drop_fwd_page_map(ctx, map);
+		map = NULL;
+		/* Not worth trying again, unless it was just not loaded yet. */
+		if (fz_caught(ctx) != FZ_ERROR_TRYLATER)
+			doc->fwd_page_map_failed = 1;
+	}
+
+	/* Objects loaded while the map was being made may have repaired
+	 * the file, and changed the page tree under our feet. */
+	if (map && doc->repair_attempted != repaired)
+	{
+		drop_fwd_page_map(ctx, map);
+		map = NULL;
+	}
+
+	if (map)
+	{
+		drop_fwd_page_map(ctx, doc->fwd_page_map);
+		doc->fwd_page_map = map;
+	}
+}
+
+/* Where num is in the (sorted) list of page tree objects, or -1. */
+static int
+find_fwd_page_node(pdf_fwd_page_map *map, int num)
+{
+	int l = 0;
+	int r = map->node_count - 1;
+	while (l <= r)
+	{
+		int m = (l + r) >> 1;
+		if (num < map->nodes[m])
+			r = m - 1;
+		else if (num > map->nodes[m])
+			l = m + 1;
+		else
+			return m;
+	}
+	return -1;
+}
+
+/* Drop the page map if the trailer no longer points to the catalog it
+ * was made from. Editing the trailer does not tell us, as it is not an
+ * object of its own. */
+static void
+check_fwd_page_map_root(fz_context *ctx, pdf_document *doc, pdf_obj *root)
+{
+	if (doc->fwd_page_map && !same_page_node(ctx, doc->fwd_page_map->root, root))
+		pdf_invalidate_page_map(ctx, doc, 0);
+}
+
+void
+pdf_invalidate_page_map(fz_context *ctx, pdf_document *doc, int num)
+{
+	pdf_fwd_page_map *map = doc->fwd_page_map;
+
+	if (num == 0)
+		doc->fwd_page_map_failed = 0;
+
+	if (map && num != 0 && find_fwd_page_node(map, num) < 0)
+		return;
+
+	doc->fwd_page_map = NULL;
+	doc->fwd_page_lookups = 0;
+	drop_fwd_page_map(ctx, map);
+}
+
+/* The number (and generation) of the page tree node that a page
+ * inherits val (its key attribute) from, 0 if it inherits nothing, or -1
+ * if the node is not an object of its own. */
+static int
+page_map_holder(fz_context *ctx, pdf_obj *node, pdf_obj *key, pdf_obj *val, int *gen)
+{
+	int depth = 0;
+
+	*gen = 0;
+	if (!val)
+		return 0;
+	while (node && depth++ < 64)
+	{
+		if (pdf_dict_get(ctx, node, key) == val)
+		{
+			if (!pdf_is_indirect(ctx, node))
+				return -1;
+			*gen = pdf_to_gen(ctx, node);
+			return pdf_to_num(ctx, node);
+		}
+		node = pdf_dict_get(ctx, node, PDF_NAME(Parent));
+	}
+	return -1;
+}
+
+enum
+{
+	/* Per page: page and parent (number and generation), index, and
+	 * the nodes (number and generation) its MediaBox, CropBox, Rotate
+	 * and Resources come from. */
+	PAGE_MAP_FIELDS = 13
+};
+
+static inline void put_int32_le(unsigned char *p, int x)
+{
+	p[0] = x;
+	p[1] = x >> 8;
+	p[2] = x >> 16;
+	p[3] = x >> 24;
+}
+
+static inline int get_int32_le(const unsigned char *p)
+{
+	return (int)(p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24));
+}
+
+void
+pdf_write_page_map(fz_context *ctx, pdf_document *doc, fz_output *out)
+{
+	pdf_fwd_page_map *map = NULL;
+	unsigned char *data = NULL;
+	int i, k, count = -1;
+	int v[PAGE_MAP_FIELDS];
+
+	fz_var(data);
+	fz_var(count);
+	fz_var(map);
+
+	fz_try(ctx)
+	{
+		/* The map must be of the page tree in the file. */
+		if (doc->num_incremental_sections > 0)
+			break;
+		check_fwd_page_map_root(ctx, doc, pdf_dict_get(ctx, pdf_trailer(ctx, doc), PDF_NAME(Root)));
+		if (!doc->fwd_page_map && !doc->fwd_page_map_failed)
+			pdf_load_fwd_page_map(ctx, doc);
+		map = doc->fwd_page_map;
+		if (!map)
+			break;
+
+		data = fz_malloc(ctx, ((size_t)map->node_count + (size_t)map->count * PAGE_MAP_FIELDS) * 4);
+		for (i = 0; i < map->node_count; i++)
+			put_int32_le(&data[i * 4], map->nodes[i]);
+		for (i = 0; i < map->count; i++)
+		{
+			pdf_fwd_page *fwd = &map->pages[i];
+			if (!pdf_is_indirect(ctx, fwd->page) || !pdf_is_indirect(ctx, fwd->parent))
+				break;
+			v[0] = pdf_to_num(ctx, fwd->page);
+			v[1] = pdf_to_gen(ctx, fwd->page);
+			v[2] = pdf_to_num(ctx, fwd->parent);
+			v[3] = pdf_to_gen(ctx, fwd->parent);
+			v[4] = fwd->index;
+			v[5] = page_map_holder(ctx, fwd->parent, PDF_NAME(MediaBox), fwd->mediabox, &v[6]);
+			v[7] = page_map_holder(ctx, fwd->parent, PDF_NAME(CropBox), fwd->cropbox, &v[8]);
+			v[9] = page_map_holder(ctx, fwd->parent, PDF_NAME(Rotate), fwd->rotate, &v[10]);
+			v[11] = page_map_holder(ctx, fwd->parent, PDF_NAME(Resources), fwd->resources, &v[12]);
+			if (v[5] < 0 || v[7] < 0 || v[9] < 0 || v[11] < 0)
+				break;
+			for (k = 0; k < PAGE_MAP_FIELDS; k++)
+				put_int32_le(&data[(map->node_count + i * PAGE_MAP_FIELDS + k) * 4], v[k]);
+		}
+		if (i == map->count)
+			count = map->count;
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow_if(ctx, FZ_ERROR_TRYLATER);
+		count = -1;
+	}
+
+	fz_try(ctx)
+	{
+		fz_write_int32_le(ctx, out, count);
+		if (count >= 0)
+		{
+			fz_write_int32_le(ctx, out, map->node_count);
+			fz_write_data(ctx, out, data, ((size_t)map->node_count + (size_t)count * PAGE_MAP_FIELDS) * 4);
+		}
+	}
+	fz_always(ctx)
+		fz_free(ctx, data);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+void
+pdf_read_page_map(fz_context *ctx, pdf_document *doc, fz_stream *stm)
+{
+	pdf_obj *keys[4] = { PDF_NAME(MediaBox), PDF_NAME(CropBox), PDF_NAME(Rotate), PDF_NAME(Resources) };
+	pdf_obj *holder[4] = { NULL, NULL, NULL, NULL };
+	pdf_obj *last[4] = { NULL, NULL, NULL, NULL };
+	pdf_obj *val[4];
+	pdf_obj **parents = NULL;
+	pdf_obj *page = NULL;
+	pdf_fwd_page_map *map = NULL;
+	unsigned char *data = NULL;
+	int repaired = doc->repair_attempted;
+	int len = pdf_xref_len(ctx, doc);
+	int i, k, n, count, node_count = 0, nparents = 0;
+	int v[PAGE_MAP_FIELDS];
+	size_t size;
+
+	fz_var(map);
+	fz_var(page);
+	fz_var(parents);
+	fz_var(nparents);
+	fz_var(data);
+
+	fz_try(ctx)
+	{
+		count = fz_read_int32_le(ctx, stm);
+		if (count < 0)
+			break;
+		node_count = fz_read_int32_le(ctx, stm);
+		if (count > len || node_count < 0 || node_count > len * 2)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "bad page map");
+
+		size = ((size_t)node_count + (size_t)count * PAGE_MAP_FIELDS) * 4;
+		data = fz_malloc(ctx, size);
+		if (fz_read(ctx, stm, data, size) != size)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "truncated page map");
+
+		map = fz_malloc_struct(ctx, pdf_fwd_page_map);
+		map->nodes = fz_malloc_array(ctx, node_count, int);
+		map->node_max = node_count;
+		for (i = 0; i < node_count; i++)
+		{
+			map->nodes[i] = get_int32_le(&data[i * 4]);
+			if (map->nodes[i] <= 0 || map->nodes[i] >= len || (i > 0 && map->nodes[i] < map->nodes[i-1]))
+				fz_throw(ctx, FZ_ERROR_GENERIC, "bad page map");
+		}
+		map->node_count = node_count;
+
+		/* Maps written before the catalog was among the nodes lack
+		 * it. */
+		map->root = pdf_keep_obj(ctx, pdf_dict_get(ctx, pdf_trailer(ctx, doc), PDF_NAME(Root)));
+		if (find_fwd_page_node(map, pdf_obj_parent_num(ctx, map->root)) < 0)
+		{
+			add_fwd_page_node(ctx, map, map->root);
+			qsort(map->nodes, map->node_count, sizeof(int), cmp_int);
+		}
+
+		/* One reference to each node for all the pages under it, as
+		 * walking the page tree would give. */
+		parents = fz_calloc(ctx, map->node_count, sizeof(*parents));
+		nparents = map->node_count;
+
+		map->pages = fz_malloc_array(ctx, count, pdf_fwd_page);
+		map->max = count;
+		for (i = 0; i < count; i++)
+		{
+			for (k = 0; k < PAGE_MAP_FIELDS; k++)
+				v[k] = get_int32_le(&data[(node_count + i * PAGE_MAP_FIELDS + k) * 4]);
+			if (v[0] <= 0 || v[0] >= len || v[2] <= 0 || v[2] >= len)
+				fz_throw(ctx, FZ_ERROR_GENERIC, "bad page map");
+
+			n = find_fwd_page_node(map, v[2]);
+			if (n < 0)
+				fz_throw(ctx, FZ_ERROR_GENERIC, "bad page map");
+			if (!parents[n])
+				parents[n] = pdf_new_indirect(ctx, doc, v[2], v[3]);
+			else if (pdf_to_gen(ctx, parents[n]) != v[3])
+				fz_throw(ctx, FZ_ERROR_GENERIC, "bad page map");
+
+			/* The inherited attributes are taken from the nodes
+			 * that hold them, so they are the very objects a walk
+			 * of the page tree would find. */
+			for (k = 0; k < 4; k++)
+			{
+				int num = v[5 + k * 2];
+				val[k] = NULL;
+				if (num == 0)
+					continue;
+				if (num < 0 || num >= len)
+					fz_throw(ctx, FZ_ERROR_GENERIC, "bad page map");
+				if (!holder[k] || pdf_to_num(ctx, holder[k]) != num)
+				{
+					pdf_drop_obj(ctx, holder[k]);
+					holder[k] = NULL;
+					holder[k] = pdf_new_indirect(ctx, doc, num, v[6 + k * 2]);
+					last[k] = pdf_dict_get(ctx, holder[k], keys[k]);
+					if (!last[k])
+						fz_throw(ctx, FZ_ERROR_GENERIC, "bad page map");
+				}
+				val[k] = last[k];
+			}
+
+			page = pdf_new_indirect(ctx, doc, v[0], v[1]);
+			set_fwd_page(ctx, &map->pages[i], page, parents[n], v[4], val[0], val[1], val[2], val[3]);
+			map->count++;
+			pdf_drop_obj(ctx, page);
+			page = NULL;
+		}
+	}
+	fz_always(ctx)
+	{
+		fz_free(ctx, data);
+		pdf_drop_obj(ctx, page);
+		if (parents)
+			for (i = 0; i < nparents; i++)
+				pdf_drop_obj(ctx, parents[i]);
+		fz_free(ctx, parents);
+		for (k = 0; k < 4; k++)
+			pdf_drop_obj(ctx, holder[k]);
+	}
+	fz_catch(ctx)
+	{
+		drop_fwd_page_map(ctx, map);
+		map = NULL;
+	}
+
+	/* Reading the nodes may have repaired the file. */
+	if (map && doc->repair_attempted != repaired)
+	{
+		drop_fwd_page_map(ctx, map);
+		map = NULL;
+	}
+
+	if (map)
+	{
+		drop_fwd_page_map(ctx, doc->fwd_page_map);
+		doc->fwd_page_map = map;
+	}
+}
+
+/* An inheritable attribute of a page, from the forward page map if the
+ * page is found there (as page number) with the same parent. */
+static pdf_obj *
+pdf_page_get_inheritable(fz_context *ctx, pdf_document *doc, int number, pdf_obj *pageobj, pdf_obj *key)
+{
+	pdf_fwd_page_map *map = doc ? doc->fwd_page_map : NULL;
+	pdf_obj *val = pdf_dict_get(ctx, pageobj, key);
+	pdf_fwd_page *fwd;
+
+	if (val)
+		return val;
+
+	if (map && number >= 0 && number < map->count)
+	{
+		fwd = &map->pages[number];
+		if (pdf_resolve_indirect(ctx, fwd->page) == pdf_resolve_indirect(ctx, pageobj) &&
+			pdf_resolve_indirect(ctx, fwd->parent) == pdf_resolve_indirect(ctx, pdf_dict_get(ctx, pageobj, PDF_NAME(Parent))))
+		{
+			if (key == PDF_NAME(MediaBox))
+				return fwd->mediabox;
+			if (key == PDF_NAME(CropBox))
+				return fwd->cropbox;
+			if (key == PDF_NAME(Rotate))
+				return fwd->rotate;
+			if (key == PDF_NAME(Resources))
+				return fwd->resources;
+		}
+	}
+
+	return pdf_dict_get_inheritable(ctx, pageobj, key);
+}
+
 enum
 {
 	LOCAL_STACK_SIZE = 16
@@ -201,6 +739,23 @@ pdf_lookup_page_loc(fz_context *ctx, pdf_document *doc, int needle, pdf_obj **pa
 	if (!node)
 		fz_throw(ctx, FZ_ERROR_GENERIC, "cannot find page tree");
 
+	/* Walking down the tree for the odd page is cheaper than mapping
+	 * all of a large tree, so only map it once it is being used. */
+	check_fwd_page_map_root(ctx, doc, root);
+	if (!doc->fwd_page_map && !doc->fwd_page_map_failed && !doc->file_reading_linearly)
+		if (++doc->fwd_page_lookups > FWD_PAGE_MAP_AFTER)
+			pdf_load_fwd_page_map(ctx, doc);
+	if (doc->fwd_page_map)
+	{
+		pdf_fwd_page *fwd;
+		if (needle < 0 || needle >= doc->fwd_page_map->count)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "cannot find page %d in page tree", needle+1);
+		fwd = &doc->fwd_page_map->pages[needle];
+		if (parentp) *parentp = fwd->parent;
+		if (indexp) *indexp = fwd->index;
+		return fwd->page;
+	}
+
 	hit = pdf_lookup_page_loc_imp(ctx, doc, node, &skip, parentp, indexp);
 	if (!hit)
 		fz_throw(ctx, FZ_ERROR_GENERIC, "cannot find page %d in page tree", needle+1);
@@ -605,7 +1160,7 @@ pdf_load_links(fz_context *ctx, pdf_page *page)
 pdf_obj *
 pdf_page_resources(fz_context *ctx, pdf_page *page)
 {
-	return pdf_dict_get_inheritable(ctx, page->obj, PDF_NAME(Resources));
+	return pdf_page_get_inheritable(ctx, page->doc, page->super.number, page->obj, PDF_NAME(Resources));
 }
 
 pdf_obj *
@@ -620,8 +1175,8 @@ pdf_page_group(fz_context *ctx, pdf_page *page)
 	return pdf_dict_get(ctx, page->obj, PDF_NAME(Group));
 }
 
-void
-pdf_page_obj_transform(fz_context *ctx, pdf_obj *pageobj, fz_rect *page_mediabox, fz_matrix *page_ctm)
+static void
+pdf_page_obj_transform_imp(fz_context *ctx, pdf_document *doc, int number, pdf_obj *pageobj, fz_rect *page_mediabox, fz_matrix *page_ctm)
 {
 	pdf_obj *obj;
 	fz_rect mediabox, cropbox, realbox, pagebox;
@@ -635,7 +1190,7 @@ pdf_page_obj_transform(fz_context *ctx, pdf_obj *pageobj, fz_rect *page_mediabox
 	if (pdf_is_real(ctx, obj))
 		userunit = pdf_to_real(ctx, obj);
 
-	mediabox = pdf_to_rect(ctx, pdf_dict_get_inheritable(ctx, pageobj, PDF_NAME(MediaBox)));
+	mediabox = pdf_to_rect(ctx, pdf_page_get_inheritable(ctx, doc, number, pageobj, PDF_NAME(MediaBox)));
 	if (fz_is_empty_rect(mediabox))
 	{
 		mediabox.x0 = 0;
@@ -644,7 +1199,7 @@ pdf_page_obj_transform(fz_context *ctx, pdf_obj *pageobj, fz_rect *page_mediabox
 		mediabox.y1 = 792;
 	}
 
-	cropbox = pdf_to_rect(ctx, pdf_dict_get_inheritable(ctx, pageobj, PDF_NAME(CropBox)));
+	cropbox = pdf_to_rect(ctx, pdf_page_get_inheritable(ctx, doc, number, pageobj, PDF_NAME(CropBox)));
 	if (!fz_is_empty_rect(cropbox))
 		mediabox = fz_intersect_rect(mediabox, cropbox);
 
@@ -656,7 +1211,7 @@ pdf_page_obj_transform(fz_context *ctx, pdf_obj *pageobj, fz_rect *page_mediabox
 	if (page_mediabox->x1 - page_mediabox->x0 < 1 || page_mediabox->y1 - page_mediabox->y0 < 1)
 		*page_mediabox = fz_unit_rect;
 
-	rotate = pdf_to_int(ctx, pdf_dict_get_inheritable(ctx, pageobj, PDF_NAME(Rotate)));
+	rotate = pdf_to_int(ctx, pdf_page_get_inheritable(ctx, doc, number, pageobj, PDF_NAME(Rotate)));
 
 	/* Snap page rotation to 0, 90, 180 or 270 */
 	if (rotate < 0)
@@ -681,10 +1236,16 @@ pdf_page_obj_transform(fz_context *ctx, pdf_obj *pageobj, fz_rect *page_mediabox
 	*page_ctm = fz_concat(*page_ctm, fz_translate(-realbox.x0, -realbox.y0));
 }
 
+void
+pdf_page_obj_transform(fz_context *ctx, pdf_obj *pageobj, fz_rect *page_mediabox, fz_matrix *page_ctm)
+{
+	pdf_page_obj_transform_imp(ctx, NULL, -1, pageobj, page_mediabox, page_ctm);
+}
+
 void
 pdf_page_transform(fz_context *ctx, pdf_page *page, fz_rect *page_mediabox, fz_matrix *page_ctm)
 {
-	pdf_page_obj_transform(ctx, page->obj, page_mediabox, page_ctm);
+	pdf_page_obj_transform_imp(ctx, page->doc, page->super.number, page->obj, page_mediabox, page_ctm);
 }
 
 static void
@@ -1147,18 +1708,52 @@ fz_page *pdf_load_page_imp(fz_context *ctx, fz_document *doc, int chapter, int n
 void
 pdf_delete_page(fz_context *ctx, pdf_document *doc, int at)
 {
+	pdf_fwd_page_map *map;
 	pdf_obj *parent, *kids;
-	int i;
+	int i, k;
 
 	pdf_lookup_page_loc(ctx, doc, at, &parent, &i);
-	kids = pdf_dict_get(ctx, parent, PDF_NAME(Kids));
-	pdf_array_delete(ctx, kids, i);
 
-	while (parent)
+	/* Take the page map out of the way of the changes to the page
+	 * tree, and bring it up to date once they are made. */
+	map = doc->fwd_page_map;
+	doc->fwd_page_map = NULL;
+
+	fz_try(ctx)
+	{
+		kids = pdf_dict_get(ctx, parent, PDF_NAME(Kids));
+		pdf_array_delete(ctx, kids, i);
+
+		while (parent)
+		{
+			int count = pdf_dict_get_int(ctx, parent, PDF_NAME(Count));
+			pdf_dict_put_int(ctx, parent, PDF_NAME(Count), count - 1);
+			parent = pdf_dict_get(ctx, parent, PDF_NAME(Parent));
+		}
+	}
+	fz_catch(ctx)
+	{
+		drop_fwd_page_map(ctx, map);
+		fz_rethrow(ctx);
+	}
+
+	if (map)
 	{
-		int count = pdf_dict_get_int(ctx, parent, PDF_NAME(Count));
-		pdf_dict_put_int(ctx, parent, PDF_NAME(Count), count - 1);
-		parent = pdf_dict_get(ctx, parent, PDF_NAME(Parent));
+		pdf_fwd_page *fwd = &map->pages[at];
+		parent = fwd->parent;
+		for (k = at + 1; k < map->count; k++)
+			if (map->pages[k].index > i && same_page_node(ctx, map->pages[k].parent, parent))
+				map->pages[k].index--;
+		pdf_drop_obj(ctx, fwd->page);
+		pdf_drop_obj(ctx, fwd->parent);
+		pdf_drop_obj(ctx, fwd->mediabox);
+		pdf_drop_obj(ctx, fwd->cropbox);
+		pdf_drop_obj(ctx, fwd->rotate);
+		pdf_drop_obj(ctx, fwd->resources);
+		memmove(fwd, fwd + 1, (map->count - at - 1) * sizeof(*fwd));
+		map->count--;
+		drop_fwd_page_map(ctx, doc->fwd_page_map);
+		doc->fwd_page_map = map;
 	}
 }
 
@@ -1210,8 +1805,9 @@ void
 pdf_insert_page(fz_context *ctx, pdf_document *doc, int at, pdf_obj *page_ref)
 {
 	int count = pdf_count_pages(ctx, doc);
+	pdf_fwd_page_map *map;
 	pdf_obj *parent, *kids;
-	int i;
+	int i, k;
 
 	if (at < 0)
 		at = count;
@@ -1229,30 +1825,69 @@ pdf_insert_page(fz_context *ctx, pdf_document *doc, int at, pdf_obj *page_ref)
 		kids = pdf_dict_get(ctx, parent, PDF_NAME(Kids));
 		if (!kids)
 			fz_throw(ctx, FZ_ERROR_GENERIC, "malformed page tree");
-		pdf_array_insert(ctx, kids, page_ref, 0);
+		i = 0;
 	}
 	else if (at == count)
 	{
 		/* append after last page */
 		pdf_lookup_page_loc(ctx, doc, count - 1, &parent, &i);
 		kids = pdf_dict_get(ctx, parent, PDF_NAME(Kids));
-		pdf_array_insert(ctx, kids, page_ref, i + 1);
+		i++;
 	}
 	else
 	{
 		/* insert before found page */
 		pdf_lookup_page_loc(ctx, doc, at, &parent, &i);
 		kids = pdf_dict_get(ctx, parent, PDF_NAME(Kids));
-		pdf_array_insert(ctx, kids, page_ref, i);
 	}
 
-	pdf_dict_put(ctx, page_ref, PDF_NAME(Parent), parent);
+	/* Take the page map out of the way of the changes to the page
+	 * tree, and bring it up to date once they are made. */
+	map = doc->fwd_page_map;
+	doc->fwd_page_map = NULL;
+
+	fz_try(ctx)
+	{
+		pdf_obj *node;
+
+		pdf_array_insert(ctx, kids, page_ref, i);
+		pdf_dict_put(ctx, page_ref, PDF_NAME(Parent), parent);
+
+		/* Adjust page counts */
+		for (node = parent; node; node = pdf_dict_get(ctx, node, PDF_NAME(Parent)))
+		{
+			count = pdf_dict_get_int(ctx, node, PDF_NAME(Count));
+			pdf_dict_put_int(ctx, node, PDF_NAME(Count), count + 1);
+		}
+
+		if (map && at <= map->count)
+		{
+			pdf_fwd_page *fwd;
+			for (k = at; k < map->count; k++)
+				if (map->pages[k].index >= i && same_page_node(ctx, map->pages[k].parent, parent))
+					map->pages[k].index++;
+			fwd = insert_fwd_page(ctx, map, at);
+			set_fwd_page(ctx, fwd, page_ref, parent, i,
+				pdf_dict_get_inheritable(ctx, parent, PDF_NAME(MediaBox)),
+				pdf_dict_get_inheritable(ctx, parent, PDF_NAME(CropBox)),
+				pdf_dict_get_inheritable(ctx, parent, PDF_NAME(Rotate)),
+				pdf_dict_get_inheritable(ctx, parent, PDF_NAME(Resources)));
+		}
+		else
+		{
+			drop_fwd_page_map(ctx, map);
+			map = NULL;
+		}
+	}
+	fz_catch(ctx)
+	{
+		drop_fwd_page_map(ctx, map);
+		fz_rethrow(ctx);
+	}
 
-	/* Adjust page counts */
-	while (parent)
+	if (map)
 	{
-		count = pdf_dict_get_int(ctx, parent, PDF_NAME(Count));
-		pdf_dict_put_int(ctx, parent, PDF_NAME(Count), count + 1);
-		parent = pdf_dict_get(ctx, parent, PDF_NAME(Parent));
+		drop_fwd_page_map(ctx, doc->fwd_page_map);
+		doc->fwd_page_map = map;
 	}
 }
@@ -486,18 +486,71 @@ pdf_new_text_string(fz_context *ctx, const char *s)
 	return pdf_new_string(ctx, s, i);
 }
 
-pdf_obj *
-pdf_parse_array(fz_context *ctx, pdf_document *doc, fz_stream *file, pdf_lexbuf *buf)
+/*
+	The items of an array or dict are collected as they are parsed, so
+	that it can be made at its final size when it is closed.
+*/
+typedef struct
+{
+	int len, cap;
+	pdf_obj **items;
+	pdf_obj *local[16];
+} parse_list;
+
+static void
+parse_list_init(parse_list *list)
+{
+	list->len = 0;
+	list->cap = nelem(list->local);
+	list->items = list->local;
+}
+
+static void
+parse_list_fin(fz_context *ctx, parse_list *list)
+{
+	int i;
+	for (i = 0; i < list->len; i++)
+		pdf_drop_obj(ctx, list->items[i]);
+	if (list->items != list->local)
+		fz_free(ctx, list->items);
+}
+
+/* Takes ownership of obj, even if it throws. */
+static void
+parse_list_push(fz_context *ctx, parse_list *list, pdf_obj *obj)
+{
+	if (list->len == list->cap)
+	{
+		pdf_obj **items;
+		fz_try(ctx)
+			items = fz_malloc_array(ctx, list->cap * 2, pdf_obj *);
+		fz_catch(ctx)
+		{
+			pdf_drop_obj(ctx, obj);
+			fz_rethrow(ctx);
+		}
+		memcpy(items, list->items, list->len * sizeof *items);
+		if (list->items != list->local)
+			fz_free(ctx, list->items);
+		list->items = items;
+		list->cap *= 2;
+	}
+	list->items[list->len++] = obj;
+}
+
+static pdf_obj *parse_dict(fz_context *ctx, pdf_document *doc, pdf_obj_arena *arena, fz_stream *file, pdf_lexbuf *buf);
+
+static pdf_obj *
+parse_array(fz_context *ctx, pdf_document *doc, pdf_obj_arena *arena, fz_stream *file, pdf_lexbuf *buf)
 {
 	pdf_obj *ary = NULL;
-	pdf_obj *obj = NULL;
+	parse_list list;
 	int64_t a = 0, b = 0, n = 0;
 	pdf_token tok;
-	pdf_obj *op = NULL;
+	int len;
 
-	fz_var(obj);
-
-	ary = pdf_new_array(ctx, doc, 4);
+	parse_list_init(&list);
+	fz_var(list);
 
 	fz_try(ctx)
 	{
@@ -508,15 +561,15 @@ pdf_parse_array(fz_context *ctx, pdf_document *doc, fz_stream *file, pdf_lexbuf
 			if (tok != PDF_TOK_INT && tok != PDF_TOK_R)
 			{
 				if (n > 0)
-					pdf_array_push_int(ctx, ary, a);
+					parse_list_push(ctx, &list, pdf_new_int_in_arena(ctx, arena, a));
 				if (n > 1)
-					pdf_array_push_int(ctx, ary, b);
+					parse_list_push(ctx, &list, pdf_new_int_in_arena(ctx, arena, b));
 				n = 0;
 			}
 
 			if (tok == PDF_TOK_INT && n == 2)
 			{
-				pdf_array_push_int(ctx, ary, a);
+				parse_list_push(ctx, &list, pdf_new_int_in_arena(ctx, arena, a));
 				a = b;
 				n --;
 			}
@@ -527,7 +580,6 @@ pdf_parse_array(fz_context *ctx, pdf_document *doc, fz_stream *file, pdf_lexbuf
 				fz_throw(ctx, FZ_ERROR_SYNTAX, "array not closed before end of file");
 
 			case PDF_TOK_CLOSE_ARRAY:
-				op = ary;
 				goto end;
 
 			case PDF_TOK_INT:
@@ -541,68 +593,65 @@ pdf_parse_array(fz_context *ctx, pdf_document *doc, fz_stream *file, pdf_lexbuf
 			case PDF_TOK_R:
 				if (n != 2)
 					fz_throw(ctx, FZ_ERROR_SYNTAX, "cannot parse indirect reference in array");
-				pdf_array_push_drop(ctx, ary, pdf_new_indirect(ctx, doc, a, b));
+				parse_list_push(ctx, &list, pdf_new_indirect_in_arena(ctx, arena, doc, a, b));
 				n = 0;
 				break;
 
 			case PDF_TOK_OPEN_ARRAY:
-				obj = pdf_parse_array(ctx, doc, file, buf);
-				pdf_array_push_drop(ctx, ary, obj);
+				parse_list_push(ctx, &list, parse_array(ctx, doc, arena, file, buf));
 				break;
 
 			case PDF_TOK_OPEN_DICT:
-				obj = pdf_parse_dict(ctx, doc, file, buf);
-				pdf_array_push_drop(ctx, ary, obj);
+				parse_list_push(ctx, &list, parse_dict(ctx, doc, arena, file, buf));
 				break;
 
 			case PDF_TOK_NAME:
-				pdf_array_push_name(ctx, ary, buf->scratch);
+				parse_list_push(ctx, &list, pdf_new_name_in_arena(ctx, arena, buf->scratch));
 				break;
 			case PDF_TOK_REAL:
-				pdf_array_push_real(ctx, ary, buf->f);
+				parse_list_push(ctx, &list, pdf_new_real_in_arena(ctx, arena, buf->f));
 				break;
 			case PDF_TOK_STRING:
-				pdf_array_push_string(ctx, ary, buf->scratch, buf->len);
+				parse_list_push(ctx, &list, pdf_new_string_in_arena(ctx, arena, buf->scratch, buf->len));
 				break;
 			case PDF_TOK_TRUE:
-				pdf_array_push_bool(ctx, ary, 1);
+				parse_list_push(ctx, &list, PDF_TRUE);
 				break;
 			case PDF_TOK_FALSE:
-				pdf_array_push_bool(ctx, ary, 0);
+				parse_list_push(ctx, &list, PDF_FALSE);
 				break;
 			case PDF_TOK_NULL:
-				pdf_array_push(ctx, ary, PDF_NULL);
+				parse_list_push(ctx, &list, PDF_NULL);
 				break;
 
 			default:
-				pdf_array_push(ctx, ary, PDF_NULL);
+				parse_list_push(ctx, &list, PDF_NULL);
 				break;
 			}
 		}
 end:
-		{}
+		len = list.len;
+		list.len = 0; /* the items now belong to the array */
+		ary = pdf_new_array_in_arena(ctx, arena, doc, len, list.items);
 	}
+	fz_always(ctx)
+		parse_list_fin(ctx, &list);
 	fz_catch(ctx)
-	{
-		pdf_drop_obj(ctx, ary);
 		fz_rethrow(ctx);
-	}
-	return op;
+	return ary;
 }
 
-pdf_obj *
-pdf_parse_dict(fz_context *ctx, pdf_document *doc, fz_stream *file, pdf_lexbuf *buf)
+static pdf_obj *
+parse_dict(fz_context *ctx, pdf_document *doc, pdf_obj_arena *arena, fz_stream *file, pdf_lexbuf *buf)
 {
-	pdf_obj *dict;
-	pdf_obj *key = NULL;
-	pdf_obj *val = NULL;
+	pdf_obj *dict = NULL;
+	parse_list list;
 	pdf_token tok;
 	int64_t a, b;
+	int len;
 
-	dict = pdf_new_dict(ctx, doc, 8);
-
-	fz_var(key);
-	fz_var(val);
+	parse_list_init(&list);
+	fz_var(list);
 
 	fz_try(ctx)
 	{
@@ -620,26 +669,26 @@ pdf_parse_dict(fz_context *ctx, pdf_document *doc, fz_stream *file, pdf_lexbuf *
 			if (tok != PDF_TOK_NAME)
 				fz_throw(ctx, FZ_ERROR_SYNTAX, "invalid key in dict");
 
-			key = pdf_new_name(ctx, buf->scratch);
+			parse_list_push(ctx, &list, pdf_new_name_in_arena(ctx, arena, buf->scratch));
 
 			tok = pdf_lex(ctx, file, buf);
 
 			switch (tok)
 			{
 			case PDF_TOK_OPEN_ARRAY:
-				val = pdf_parse_array(ctx, doc, file, buf);
+				parse_list_push(ctx, &list, parse_array(ctx, doc, arena, file, buf));
 				break;
 
 			case PDF_TOK_OPEN_DICT:
-				val = pdf_parse_dict(ctx, doc, file, buf);
+				parse_list_push(ctx, &list, parse_dict(ctx, doc, arena, file, buf));
 				break;
 
-			case PDF_TOK_NAME: val = pdf_new_name(ctx, buf->scratch); break;
-			case PDF_TOK_REAL: val = pdf_new_real(ctx, buf->f); break;
-			case PDF_TOK_STRING: val = pdf_new_string(ctx, buf->scratch, buf->len); break;
-			case PDF_TOK_TRUE: val = PDF_TRUE; break;
-			case PDF_TOK_FALSE: val = PDF_FALSE; break;
-			case PDF_TOK_NULL: val = PDF_NULL; break;
+			case PDF_TOK_NAME: parse_list_push(ctx, &list, pdf_new_name_in_arena(ctx, arena, buf->scratch)); break;
+			case PDF_TOK_REAL: parse_list_push(ctx, &list, pdf_new_real_in_arena(ctx, arena, buf->f)); break;
+			case PDF_TOK_STRING: parse_list_push(ctx, &list, pdf_new_string_in_arena(ctx, arena, buf->scratch, buf->len)); break;
+			case PDF_TOK_TRUE: parse_list_push(ctx, &list, PDF_TRUE); break;
+			case PDF_TOK_FALSE: parse_list_push(ctx, &list, PDF_FALSE); break;
+			case PDF_TOK_NULL: parse_list_push(ctx, &list, PDF_NULL); break;
 
 			case PDF_TOK_INT:
 				/* 64-bit to allow for numbers > INT_MAX and overflow */
@@ -648,12 +697,7 @@ pdf_parse_dict(fz_context *ctx, pdf_document *doc, fz_stream *file, pdf_lexbuf *
 				if (tok == PDF_TOK_CLOSE_DICT || tok == PDF_TOK_NAME ||
 					(tok == PDF_TOK_KEYWORD && !strcmp(buf->scratch, "ID")))
 				{
-					val = pdf_new_int(ctx, a);
-					pdf_dict_put(ctx, dict, key, val);
-					pdf_drop_obj(ctx, val);
-					val = NULL;
-					pdf_drop_obj(ctx, key);
-					key = NULL;
+					parse_list_push(ctx, &list, pdf_new_int_in_arena(ctx, arena, a));
 					goto skip;
 				}
 				if (tok == PDF_TOK_INT)
@@ -662,39 +706,51 @@ pdf_parse_dict(fz_context *ctx, pdf_document *doc, fz_stream *file, pdf_lexbuf *
 					tok = pdf_lex(ctx, file, buf);
 					if (tok == PDF_TOK_R)
 					{
-						val = pdf_new_indirect(ctx, doc, a, b);
+						parse_list_push(ctx, &list, pdf_new_indirect_in_arena(ctx, arena, doc, a, b));
 						break;
 					}
 				}
 				fz_warn(ctx, "invalid indirect reference in dict");
-				val = PDF_NULL;
+				parse_list_push(ctx, &list, PDF_NULL);
 				break;
 
 			default:
-				val = PDF_NULL;
+				parse_list_push(ctx, &list, PDF_NULL);
 				break;
 			}
-
-			pdf_dict_put(ctx, dict, key, val);
-			pdf_drop_obj(ctx, val);
-			val = NULL;
-			pdf_drop_obj(ctx, key);
-			key = NULL;
 		}
+
+		len = list.len;
+		list.len = 0; /* the items now belong to the dict */
+		dict = pdf_new_dict_in_arena(ctx, arena, doc, len / 2, list.items);
 	}
+	fz_always(ctx)
+		parse_list_fin(ctx, &list);
 	fz_catch(ctx)
-	{
-		pdf_drop_obj(ctx, dict);
-		pdf_drop_obj(ctx, key);
-		pdf_drop_obj(ctx, val);
 		fz_rethrow(ctx);
-	}
 	return dict;
 }
 
+pdf_obj *
+pdf_parse_array(fz_context *ctx, pdf_document *doc, fz_stream *file, pdf_lexbuf *buf)
+{
+	return parse_array(ctx, doc, NULL, file, buf);
+}
+
+pdf_obj *
+pdf_parse_dict(fz_context *ctx, pdf_document *doc, fz_stream *file, pdf_lexbuf *buf)
+{
+	return parse_dict(ctx, doc, NULL, file, buf);
+}
+
+/*
+	Objects parsed from object streams and from the file itself (but not
+	from content streams) go into the document's object arena, if any.
+*/
 pdf_obj *
 pdf_parse_stm_obj(fz_context *ctx, pdf_document *doc, fz_stream *file, pdf_lexbuf *buf)
 {
+	pdf_obj_arena *arena = pdf_current_obj_arena(ctx, doc);
 	pdf_token tok;
 
 	tok = pdf_lex(ctx, file, buf);
@@ -702,16 +758,16 @@ pdf_parse_stm_obj(fz_context *ctx, pdf_document *doc, fz_stream *file, pdf_lexbu
 	switch (tok)
 	{
 	case PDF_TOK_OPEN_ARRAY:
-		return pdf_parse_array(ctx, doc, file, buf);
+		return parse_array(ctx, doc, arena, file, buf);
 	case PDF_TOK_OPEN_DICT:
-		return pdf_parse_dict(ctx, doc, file, buf);
-	case PDF_TOK_NAME: return pdf_new_name(ctx, buf->scratch);
-	case PDF_TOK_REAL: return pdf_new_real(ctx, buf->f);
-	case PDF_TOK_STRING: return pdf_new_string(ctx, buf->scratch, buf->len);
+		return parse_dict(ctx, doc, arena, file, buf);
+	case PDF_TOK_NAME: return pdf_new_name_in_arena(ctx, arena, buf->scratch);
+	case PDF_TOK_REAL: return pdf_new_real_in_arena(ctx, arena, buf->f);
+	case PDF_TOK_STRING: return pdf_new_string_in_arena(ctx, arena, buf->scratch, buf->len);
 	case PDF_TOK_TRUE: return PDF_TRUE;
 	case PDF_TOK_FALSE: return PDF_FALSE;
 	case PDF_TOK_NULL: return PDF_NULL;
-	case PDF_TOK_INT: return pdf_new_int(ctx, buf->i);
+	case PDF_TOK_INT: return pdf_new_int_in_arena(ctx, arena, buf->i);
 	default: fz_throw(ctx, FZ_ERROR_SYNTAX, "unknown token in object stream");
 	}
 }
@@ -721,6 +777,7 @@ pdf_parse_ind_obj(fz_context *ctx, pdf_document *doc,
 	fz_stream *file, pdf_lexbuf *buf,
 	int *onum, int *ogen, int64_t *ostmofs, int *try_repair)
 {
+	pdf_obj_arena *arena;
 	pdf_obj *obj = NULL;
 	int num = 0, gen = 0;
 	int64_t stm_ofs;
@@ -758,21 +815,23 @@ pdf_parse_ind_obj(fz_context *ctx, pdf_document *doc,
 		fz_throw(ctx, FZ_ERROR_SYNTAX, "expected 'obj' keyword (%d %d ?)", num, gen);
 	}
 
+	arena = pdf_current_obj_arena(ctx, doc);
+
 	tok = pdf_lex(ctx, file, buf);
 
 	switch (tok)
 	{
 	case PDF_TOK_OPEN_ARRAY:
-		obj = pdf_parse_array(ctx, doc, file, buf);
+		obj = parse_array(ctx, doc, arena, file, buf);
 		break;
 
 	case PDF_TOK_OPEN_DICT:
-		obj = pdf_parse_dict(ctx, doc, file, buf);
+		obj = parse_dict(ctx, doc, arena, file, buf);
 		break;
 
-	case PDF_TOK_NAME: obj = pdf_new_name(ctx, buf->scratch); break;
-	case PDF_TOK_REAL: obj = pdf_new_real(ctx, buf->f); break;
-	case PDF_TOK_STRING: obj = pdf_new_string(ctx, buf->scratch, buf->len); break;
+	case PDF_TOK_NAME: obj = pdf_new_name_in_arena(ctx, arena, buf->scratch); break;
+	case PDF_TOK_REAL: obj = pdf_new_real_in_arena(ctx, arena, buf->f); break;
+	case PDF_TOK_STRING: obj = pdf_new_string_in_arena(ctx, arena, buf->scratch, buf->len); break;
 	case PDF_TOK_TRUE: obj = PDF_TRUE; break;
 	case PDF_TOK_FALSE: obj = PDF_FALSE; break;
 	case PDF_TOK_NULL: obj = PDF_NULL; break;
@@ -783,7 +842,7 @@ pdf_parse_ind_obj(fz_context *ctx, pdf_document *doc,
 
 		if (tok == PDF_TOK_STREAM || tok == PDF_TOK_ENDOBJ)
 		{
-			obj = pdf_new_int(ctx, a);
+			obj = pdf_new_int_in_arena(ctx, arena, a);
 			read_next_token = 0;
 			break;
 		}
@@ -793,7 +852,7 @@ pdf_parse_ind_obj(fz_context *ctx, pdf_document *doc,
 			tok = pdf_lex(ctx, file, buf);
 			if (tok == PDF_TOK_R)
 			{
-				obj = pdf_new_indirect(ctx, doc, a, b);
+				obj = pdf_new_indirect_in_arena(ctx, arena, doc, a, b);
 				break;
 			}
 		}
@@ -1,6 +1,7 @@
 #include "mupdf/fitz.h"
 #include "mupdf/pdf.h"
 
+#include <limits.h>
 #include <string.h>
 
 /* Scan file for objects and reconstruct xref table */
@@ -27,8 +28,11 @@ static void add_root(fz_context *ctx, pdf_obj *obj, pdf_obj ***roots, int *num_r
 	(*roots)[(*num_roots)++] = pdf_keep_obj(ctx, obj);
 }
 
-int
-pdf_repair_obj(fz_context *ctx, pdf_document *doc, pdf_lexbuf *buf, int64_t *stmofsp, int *stmlenp, pdf_obj **encrypt, pdf_obj **id, pdf_obj **page, int64_t *tmpofs, pdf_obj **root)
+/* endstm, if not NULL, lists the offset of every 'endstream' in the
+ * file in order, so that a stream without a usable length need not be
+ * read through to find its end. */
+static int
+repair_obj(fz_context *ctx, pdf_document *doc, pdf_lexbuf *buf, int64_t *stmofsp, int *stmlenp, pdf_obj **encrypt, pdf_obj **id, pdf_obj **page, int64_t *tmpofs, pdf_obj **root, const int64_t *endstm, int nendstm)
 {
 	fz_stream *file = doc->file;
 	pdf_token tok;
@@ -159,15 +163,34 @@ pdf_repair_obj(fz_context *ctx, pdf_document *doc, pdf_lexbuf *buf, int64_t *stm
 			fz_seek(ctx, file, *stmofsp, 0);
 		}
 
-		(void)fz_read(ctx, file, (unsigned char *) buf->scratch, 9);
-
-		while (memcmp(buf->scratch, "endstream", 9) != 0)
+		if (endstm)
 		{
-			c = fz_read_byte(ctx, file);
-			if (c == EOF)
-				break;
-			memmove(&buf->scratch[0], &buf->scratch[1], 8);
-			buf->scratch[8] = c;
+			int lo = 0, hi = nendstm;
+			while (lo < hi)
+			{
+				int mid = lo + (hi - lo) / 2;
+				if (endstm[mid] < *stmofsp)
+					lo = mid + 1;
+				else
+					hi = mid;
+			}
+			if (lo < nendstm)
+				fz_seek(ctx, file, endstm[lo] + 9, 0);
+			else
+				fz_seek(ctx, file, 0, SEEK_END);
+		}
+		else
+		{
+			(void)fz_read(ctx, file, (unsigned char *) buf->scratch, 9);
+
+			while (memcmp(buf->scratch, "endstream", 9) != 0)
+			{
+				c = fz_read_byte(ctx, file);
+				if (c == EOF)
+					break;
+				memmove(&buf->scratch[0], &buf->scratch[1], 8);
+				buf->scratch[8] = c;
+			}
 		}
 
 		if (stmlenp)
@@ -192,6 +215,12 @@ atobjend:
 	return tok;
 }
 
+int
+pdf_repair_obj(fz_context *ctx, pdf_document *doc, pdf_lexbuf *buf, int64_t *stmofsp, int *stmlenp, pdf_obj **encrypt, pdf_obj **id, pdf_obj **page, int64_t *tmpofs, pdf_obj **root)
+{
+	return repair_obj(ctx, doc, buf, stmofsp, stmlenp, encrypt, id, page, tmpofs, root, NULL, 0);
+}
+
 static void
 pdf_repair_obj_stm(fz_context *ctx, pdf_document *doc, int stm_num)
 {
@@ -286,6 +315,489 @@ static int is_white(int c)
 	return c == '\x00' || c == '\x09' || c == '\x0a' || c == '\x0c' || c == '\x0d' || c == '\x20';
 }
 
+/* If we find a dictionary outside of an object it is probably the
+ * trailer, but could be a stream (or bogus) dictionary caused by a
+ * corrupt file. */
+static void
+repair_trailer(fz_context *ctx, pdf_document *doc, pdf_lexbuf *buf, pdf_obj **encrypt, pdf_obj **id, pdf_obj **info, pdf_obj ***roots, int *num_roots, int *max_roots)
+{
+	pdf_obj *dict, *dictobj;
+
+	fz_try(ctx)
+	{
+		dict = pdf_parse_dict(ctx, doc, doc->file, buf);
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow_if(ctx, FZ_ERROR_TRYLATER);
+		/* If this was the real trailer dict
+		 * it was broken, in which case we are
+		 * in trouble. Keep going though in
+		 * case this was just a bogus dict. */
+		return;
+	}
+
+	fz_try(ctx)
+	{
+		dictobj = pdf_dict_get(ctx, dict, PDF_NAME(Encrypt));
+		if (dictobj)
+		{
+			pdf_drop_obj(ctx, *encrypt);
+			*encrypt = pdf_keep_obj(ctx, dictobj);
+		}
+
+		dictobj = pdf_dict_get(ctx, dict, PDF_NAME(ID));
+		if (dictobj && (!*id || !*encrypt || pdf_dict_get(ctx, dict, PDF_NAME(Encrypt))))
+		{
+			pdf_drop_obj(ctx, *id);
+			*id = pdf_keep_obj(ctx, dictobj);
+		}
+
+		dictobj = pdf_dict_get(ctx, dict, PDF_NAME(Root));
+		if (dictobj)
+			add_root(ctx, dictobj, roots, num_roots, max_roots);
+
+		dictobj = pdf_dict_get(ctx, dict, PDF_NAME(Info));
+		if (dictobj)
+		{
+			pdf_drop_obj(ctx, *info);
+			*info = pdf_keep_obj(ctx, dictobj);
+		}
+	}
+	fz_always(ctx)
+		pdf_drop_obj(ctx, dict);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+static void
+add_entry(fz_context *ctx, struct entry **list, int *listlen, int *listcap, int num, int gen, int64_t ofs, int64_t stm_ofs, int stm_len)
+{
+	if (*listlen + 1 == *listcap)
+	{
+		*listcap = (*listcap * 3) / 2;
+		*list = fz_realloc_array(ctx, *list, *listcap, struct entry);
+	}
+
+	(*list)[*listlen].num = num;
+	(*list)[*listlen].gen = gen;
+	(*list)[*listlen].ofs = ofs;
+	(*list)[*listlen].stm_ofs = stm_ofs;
+	(*list)[*listlen].stm_len = stm_len;
+	(*listlen)++;
+}
+
+/*
+	Scanning for objects on several threads.
+
+	The file is read in batches, and each batch is split into chunks
+	that the threads of the tuned pool search for the bytes of object
+	headers ('<num> <gen> obj') and every 'endstream'. No lexer is
+	needed for this, so what is found does not depend on where the
+	chunks start and end: a match belongs to the chunk holding its
+	keyword, and the few bytes either side of a chunk that a match may
+	need to look at are read along with it.
+
+	The serial pass then parses each object in turn in file order, as
+	the single threaded scan does, skipping any match that falls inside
+	the object (or stream) before it. A stream with no usable length is
+	ended at the next 'endstream' in the list rather than by reading
+	through it. What lies between objects is lexed just as the single
+	threaded scan lexes it, from the end of one object up to the next
+	match, so a match inside a comment there is not taken as an object,
+	and any dictionary there is looked at for trailer entries.
+*/
+
+enum
+{
+	REPAIR_CHUNK = 1 << 20,
+	REPAIR_MARKS = REPAIR_CHUNK / 64,
+	REPAIR_HEADER_MAX = 48, /* furthest back from 'obj' that a header may start */
+	REPAIR_BEHIND = REPAIR_HEADER_MAX + 1,
+	REPAIR_AHEAD = 16,
+};
+
+enum { MARK_OBJ, MARK_ENDSTREAM };
+
+typedef struct
+{
+	int64_t ofs;
+	int kind;
+	int len; /* of the object header, up to the end of 'obj' */
+	int num_len; /* of the object number */
+	int num, gen;
+} repair_mark;
+
+typedef struct
+{
+	const unsigned char *data; /* the batch, from file offset base */
+	int64_t base;
+	size_t len;
+	size_t start, end; /* keywords in this range belong to the chunk */
+	repair_mark *mark;
+	int cap;
+	int count; /* or -1 if there were more than cap marks */
+} repair_chunk;
+
+static int is_regular(int c)
+{
+	return !is_white(c) && !strchr("()<>[]{}/%", c);
+}
+
+static int is_digit(int c)
+{
+	return c >= '0' && c <= '9';
+}
+
+static int
+scan_int(const unsigned char *s, size_t a, size_t b)
+{
+	int v = 0;
+	for (; a < b; a++)
+		v = v < 214748364 ? v * 10 + (s[a] - '0') : INT_MAX;
+	return v;
+}
+
+static int
+scan_header(repair_chunk *chunk, size_t p, repair_mark *mark)
+{
+	const unsigned char *s = chunk->data;
+	size_t lo = p > REPAIR_HEADER_MAX ? p - REPAIR_HEADER_MAX : 0;
+	size_t q = p, gen_end, num_end;
+
+	if (p + 3 > chunk->len || s[p+1] != 'b' || s[p+2] != 'j')
+		return 0;
+	if (p + 3 < chunk->len && is_regular(s[p+3]))
+		return 0;
+
+	while (q > lo && is_white(s[q-1]))
+		q--;
+	gen_end = q;
+	while (q > lo && is_digit(s[q-1]))
+		q--;
+	if (q == gen_end)
+		return 0;
+	mark->gen = scan_int(s, q, gen_end);
+	if (q == lo || !is_white(s[q-1]))
+		return 0;
+	while (q > lo && is_white(s[q-1]))
+		q--;
+	num_end = q;
+	while (q > lo && is_digit(s[q-1]))
+		q--;
+	if (q == num_end)
+		return 0;
+	mark->num = scan_int(s, q, num_end);
+	mark->num_len = (int)(num_end - q);
+	if (q == lo ? !(q == 0 && chunk->base == 0) : is_regular(s[q-1]))
+		return 0;
+
+	mark->kind = MARK_OBJ;
+	mark->ofs = chunk->base + q;
+	mark->len = (int)(p + 3 - q);
+	return 1;
+}
+
+static void
+scan_chunk(void *arg, int i)
+{
+	repair_chunk *chunk = (repair_chunk *)arg + i;
+	const unsigned char *s = chunk->data;
+	repair_mark mark;
+	size_t p;
+
+	chunk->count = 0;
+	for (p = chunk->start; p < chunk->end; p++)
+	{
+		switch (s[p])
+		{
+		default:
+			continue;
+		case 'o':
+			if (!scan_header(chunk, p, &mark))
+				continue;
+			break;
+		case 'e':
+			/* Any 'endstream' ends a stream, as when scanning for one. */
+			if (p + 9 > chunk->len || memcmp(s + p, "endstream", 9))
+				continue;
+			mark.kind = MARK_ENDSTREAM;
+			mark.ofs = chunk->base + p;
+			break;
+		}
+		if (chunk->count == chunk->cap)
+		{
+			chunk->count = -1;
+			return;
+		}
+		chunk->mark[chunk->count++] = mark;
+	}
+}
+
+/* Find every object header, trailer and endstream in the file, in order. */
+static void
+scan_file(fz_context *ctx, pdf_document *doc, const fz_thread_pool *pool, repair_mark **marksp, int *nmarksp, int64_t **endstmp, int *nendstmp)
+{
+	repair_chunk *chunk = NULL;
+	repair_mark *bigmark = NULL;
+	unsigned char *data = NULL;
+	repair_mark *marks = NULL;
+	int64_t *endstm = NULL;
+	int nmarks = 0, maxmarks = 0;
+	int nendstm = 0, maxendstm = 0;
+	int64_t file_len, start, end, read_start, read_end;
+	size_t len;
+	int workers = fz_clampi(pool->workers, 1, 64);
+	int i, k, n;
+
+	fz_var(chunk);
+	fz_var(bigmark);
+	fz_var(data);
+	fz_var(marks);
+	fz_var(endstm);
+
+	fz_seek(ctx, doc->file, 0, SEEK_END);
+	file_len = fz_tell(ctx, doc->file);
+	if (file_len < 0)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "cannot tell in file");
+
+	fz_try(ctx)
+	{
+		data = fz_malloc(ctx, REPAIR_BEHIND + (size_t)workers * REPAIR_CHUNK + REPAIR_AHEAD);
+		chunk = fz_malloc_array(ctx, workers, repair_chunk);
+		for (i = 0; i < workers; i++)
+		{
+			chunk[i].mark = NULL;
+			chunk[i].cap = REPAIR_MARKS;
+		}
+		for (i = 0; i < workers; i++)
+			chunk[i].mark = fz_malloc_array(ctx, REPAIR_MARKS, repair_mark);
+
+		for (start = 0; start < file_len; start = end)
+		{
+			end = start + (int64_t)workers * REPAIR_CHUNK;
+			if (end > file_len)
+				end = file_len;
+			read_start = fz_maxi64(start - REPAIR_BEHIND, 0);
+			read_end = end + REPAIR_AHEAD;
+			if (read_end > file_len)
+				read_end = file_len;
+			fz_seek(ctx, doc->file, read_start, 0);
+			len = fz_read(ctx, doc->file, data, (size_t)(read_end - read_start));
+			if (read_start + (int64_t)len < read_end)
+			{
+				/* The file is shorter than it claimed to be. */
+				file_len = read_start + len;
+				if (end > file_len)
+					end = file_len;
+				if (end <= start)
+					break;
+			}
+
+			n = 0;
+			for (i = 0; i < workers && start + (int64_t)i * REPAIR_CHUNK < end; i++, n++)
+			{
+				chunk[i].data = data;
+				chunk[i].base = read_start;
+				chunk[i].len = len;
+				chunk[i].start = (size_t)(start - read_start) + (size_t)i * REPAIR_CHUNK;
+				chunk[i].end = fz_minz(chunk[i].start + REPAIR_CHUNK, (size_t)(end - read_start));
+			}
+			pool->run(pool->user, n, scan_chunk, chunk);
+
+			for (i = 0; i < n; i++)
+			{
+				repair_chunk *c = &chunk[i];
+				repair_chunk big;
+
+				if (c->count < 0)
+				{
+					/* Unlikely, but each match takes at least 4 bytes. */
+					big = *c;
+					big.cap = (int)((c->end - c->start) / 4 + 2);
+					bigmark = big.mark = fz_malloc_array(ctx, big.cap, repair_mark);
+					scan_chunk(&big, 0);
+					c = &big;
+				}
+
+				for (k = 0; k < c->count; k++)
+				{
+					if (c->mark[k].kind == MARK_ENDSTREAM)
+					{
+						if (nendstm == maxendstm)
+						{
+							maxendstm = maxendstm ? maxendstm * 2 : 256;
+							endstm = fz_realloc_array(ctx, endstm, maxendstm, int64_t);
+						}
+						endstm[nendstm++] = c->mark[k].ofs;
+					}
+					else
+					{
+						if (nmarks == maxmarks)
+						{
+							maxmarks = maxmarks ? maxmarks * 2 : 1024;
+							marks = fz_realloc_array(ctx, marks, maxmarks, repair_mark);
+						}
+						marks[nmarks++] = c->mark[k];
+					}
+				}
+
+				fz_free(ctx, bigmark);
+				bigmark = NULL;
+			}
+		}
+	}
+	fz_always(ctx)
+	{
+		if (chunk)
+			for (i = 0; i < workers; i++)
+				fz_free(ctx, chunk[i].mark);
+		fz_free(ctx, chunk);
+		fz_free(ctx, bigmark);
+		fz_free(ctx, data);
+	}
+	fz_catch(ctx)
+	{
+		fz_free(ctx, marks);
+		fz_free(ctx, endstm);
+		fz_rethrow(ctx);
+	}
+
+	*marksp = marks;
+	*nmarksp = nmarks;
+	*endstmp = endstm;
+	*nendstmp = nendstm;
+}
+
+/* Lex the file from *pos as the single threaded scan does, looking at
+ * any dictionary for trailer entries, until reaching the object header
+ * at mark (or the end of the file if mark is NULL). Returns 1 if the
+ * header starts a token there, with the file just after its object
+ * number. Otherwise (the header is inside a comment, say) returns 0,
+ * with *pos before the token that went past it, which is lexed again
+ * on the way to the next header. */
+static int
+lex_to_mark(fz_context *ctx, pdf_document *doc, pdf_lexbuf *buf, int64_t *pos, repair_mark *mark,
+	pdf_obj **encrypt, pdf_obj **id, pdf_obj **info, pdf_obj ***roots, int *num_roots, int *max_roots)
+{
+	pdf_token tok;
+	int64_t end;
+	int c;
+
+	fz_seek(ctx, doc->file, *pos, 0);
+	while (1)
+	{
+		*pos = fz_tell(ctx, doc->file);
+
+		fz_try(ctx)
+			tok = pdf_lex_no_string(ctx, doc->file, buf);
+		fz_catch(ctx)
+		{
+			fz_rethrow_if(ctx, FZ_ERROR_TRYLATER);
+			fz_warn(ctx, "skipping ahead to next token");
+			do
+				c = fz_read_byte(ctx, doc->file);
+			while (c != EOF && !is_white(c));
+			tok = c == EOF ? PDF_TOK_EOF : PDF_TOK_ERROR;
+		}
+
+		if (tok == PDF_TOK_EOF)
+			return 0;
+		end = fz_tell(ctx, doc->file);
+		if (mark && end > mark->ofs)
+			return tok == PDF_TOK_INT && end == mark->ofs + mark->num_len;
+		if (tok == PDF_TOK_OPEN_DICT)
+			repair_trailer(ctx, doc, buf, encrypt, id, info, roots, num_roots, max_roots);
+	}
+}
+
+/* Fill in the list of objects from a scan of the file on several threads. */
+static void
+repair_threaded(fz_context *ctx, pdf_document *doc, const fz_thread_pool *pool, pdf_lexbuf *buf,
+	struct entry **list, int *listlen, int *listcap, int *maxnum,
+	pdf_obj **encrypt, pdf_obj **id, pdf_obj **info, pdf_obj ***roots, int *num_roots, int *max_roots)
+{
+	repair_mark *marks = NULL;
+	int64_t *endstm = NULL;
+	int nmarks = 0, nendstm = 0;
+	int64_t pos = 0, tmpofs, stm_ofs;
+	int stm_len;
+	int k;
+
+	scan_file(ctx, doc, pool, &marks, &nmarks, &endstm, &nendstm);
+
+	fz_try(ctx)
+	{
+		for (k = 0; k < nmarks; k++)
+		{
+			repair_mark *mark = &marks[k];
+			pdf_obj *root = NULL;
+			int num = mark->num;
+			int gen = mark->gen;
+
+			/* Inside the last object, or its stream. */
+			if (mark->ofs < pos)
+				continue;
+
+			if (!lex_to_mark(ctx, doc, buf, &pos, mark, encrypt, id, info, roots, num_roots, max_roots))
+				continue;
+
+			fz_seek(ctx, doc->file, mark->ofs + mark->len, 0);
+			tmpofs = mark->ofs + mark->len;
+
+			fz_try(ctx)
+			{
+				stm_len = 0;
+				stm_ofs = 0;
+				(void)repair_obj(ctx, doc, buf, &stm_ofs, &stm_len, encrypt, id, NULL, &tmpofs, &root, endstm, nendstm);
+				if (root)
+					add_root(ctx, root, roots, num_roots, max_roots);
+			}
+			fz_always(ctx)
+			{
+				pdf_drop_obj(ctx, root);
+			}
+			fz_catch(ctx)
+			{
+				/* If we haven't seen a root yet, there is nothing
+				 * we can do, but give up. Otherwise, we'll make
+				 * do. */
+				if (!*roots)
+					fz_rethrow(ctx);
+				fz_warn(ctx, "cannot parse object (%d %d R) - ignoring rest of file", num, gen);
+				break;
+			}
+
+			/* The object ends before the token that repair_obj stopped at. */
+			pos = tmpofs;
+
+			if (num <= 0 || num > PDF_MAX_OBJECT_NUMBER)
+			{
+				fz_warn(ctx, "ignoring object with invalid object number (%d %d R)", num, gen);
+				continue;
+			}
+
+			gen = fz_clampi(gen, 0, 65535);
+
+			add_entry(ctx, list, listlen, listcap, num, gen, mark->ofs, stm_ofs, stm_len);
+
+			if (num > *maxnum)
+				*maxnum = num;
+		}
+
+		/* The trailer is usually after the last object. */
+		if (k == nmarks)
+			lex_to_mark(ctx, doc, buf, &pos, NULL, encrypt, id, info, roots, num_roots, max_roots);
+	}
+	fz_always(ctx)
+	{
+		fz_free(ctx, marks);
+		fz_free(ctx, endstm);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
 void
 pdf_repair_xref(fz_context *ctx, pdf_document *doc)
 {
@@ -314,6 +826,7 @@ pdf_repair_xref(fz_context *ctx, pdf_document *doc)
 	pdf_lexbuf *buf = &doc->lexbuf.base;
 	int num_roots = 0;
 	int max_roots = 0;
+	const fz_thread_pool *pool;
 
 	fz_var(encrypt);
 	fz_var(id);
@@ -343,6 +856,14 @@ pdf_repair_xref(fz_context *ctx, pdf_document *doc)
 		listcap = 1024;
 		list = fz_malloc_array(ctx, listcap, struct entry);
 
+		/* Progressively loaded files can only be scanned in order. */
+		pool = doc->file->progressive ? NULL : fz_tuned_thread_pool(ctx);
+		if (pool)
+		{
+			repair_threaded(ctx, doc, pool, buf, &list, &listlen, &listcap, &maxnum, &encrypt, &id, &info, &roots, &num_roots, &max_roots);
+			goto have_objects;
+		}
+
 		/* look for '%PDF' version marker within first kilobyte of file */
 		n = fz_read(ctx, doc->file, (unsigned char *)buf->scratch, fz_minz(buf->size, 1024));
 
@@ -442,18 +963,7 @@ pdf_repair_xref(fz_context *ctx, pdf_document *doc)
 
 				gen = fz_clampi(gen, 0, 65535);
 
-				if (listlen + 1 == listcap)
-				{
-					listcap = (listcap * 3) / 2;
-					list = fz_realloc_array(ctx, list, listcap, struct entry);
-				}
-
-				list[listlen].num = num;
-				list[listlen].gen = gen;
-				list[listlen].ofs = numofs;
-				list[listlen].stm_ofs = stm_ofs;
-				list[listlen].stm_len = stm_len;
-				listlen ++;
+				add_entry(ctx, &list, &listlen, &listcap, num, gen, numofs, stm_ofs, stm_len);
 
 				if (num > maxnum)
 					maxnum = num;
@@ -466,53 +976,7 @@ pdf_repair_xref(fz_context *ctx, pdf_document *doc)
 			 * by a corrupt file. */
 			else if (tok == PDF_TOK_OPEN_DICT)
 			{
-				pdf_obj *dictobj;
-
-				fz_try(ctx)
-				{
-					dict = pdf_parse_dict(ctx, doc, doc->file, buf);
-				}
-				fz_catch(ctx)
-				{
-					fz_rethrow_if(ctx, FZ_ERROR_TRYLATER);
-					/* If this was the real trailer dict
-					 * it was broken, in which case we are
-					 * in trouble. Keep going though in
-					 * case this was just a bogus dict. */
-					continue;
-				}
-
-				fz_try(ctx)
-				{
-					dictobj = pdf_dict_get(ctx, dict, PDF_NAME(Encrypt));
-					if (dictobj)
-					{
-						pdf_drop_obj(ctx, encrypt);
-						encrypt = pdf_keep_obj(ctx, dictobj);
-					}
-
-					dictobj = pdf_dict_get(ctx, dict, PDF_NAME(ID));
-					if (dictobj && (!id || !encrypt || pdf_dict_get(ctx, dict, PDF_NAME(Encrypt))))
-					{
-						pdf_drop_obj(ctx, id);
-						id = pdf_keep_obj(ctx, dictobj);
-					}
-
-					dictobj = pdf_dict_get(ctx, dict, PDF_NAME(Root));
-					if (dictobj)
-						add_root(ctx, dictobj, &roots, &num_roots, &max_roots);
-
-					dictobj = pdf_dict_get(ctx, dict, PDF_NAME(Info));
-					if (dictobj)
-					{
-						pdf_drop_obj(ctx, info);
-						info = pdf_keep_obj(ctx, dictobj);
-					}
-				}
-				fz_always(ctx)
-					pdf_drop_obj(ctx, dict);
-				fz_catch(ctx)
-					fz_rethrow(ctx);
+				repair_trailer(ctx, doc, buf, &encrypt, &id, &info, &roots, &num_roots, &max_roots);
 			}
 
 			else if (tok == PDF_TOK_EOF)
@@ -527,6 +991,7 @@ pdf_repair_xref(fz_context *ctx, pdf_document *doc)
 			}
 		}
 
+have_objects:
 		if (listlen == 0)
 			fz_throw(ctx, FZ_ERROR_GENERIC, "no objects found");
 
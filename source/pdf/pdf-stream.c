@@ -559,6 +559,78 @@ can_reuse_buffer(fz_context *ctx, pdf_xref_entry *entry, fz_compression_params *
 	return (params->type == FZ_IMAGE_RAW) ? 0 : 1;
 }
 
+/* Flate is by far the most common filter, and a stream held in memory
+ * can be inflated in one go much quicker than it can be read through the
+ * flate filter. Returns NULL if the stream does not use (only) flate, or
+ * if fz_inflate_data does not like it, in which case the caller should
+ * read it through the filters as usual. */
+static fz_buffer *
+pdf_load_flated_stream(fz_context *ctx, pdf_document *doc, int num, pdf_obj *dict, size_t len)
+{
+	fz_compression_params params;
+	fz_buffer *raw, *buf = NULL, *tmp;
+	fz_stream *stm, *pstm = NULL;
+	pdf_obj *f, *p;
+	size_t max;
+
+	f = pdf_dict_geta(ctx, dict, PDF_NAME(Filter), PDF_NAME(F));
+	p = pdf_dict_geta(ctx, dict, PDF_NAME(DecodeParms), PDF_NAME(DP));
+	if (pdf_is_array(ctx, f))
+	{
+		if (pdf_array_len(ctx, f) != 1)
+			return NULL;
+		f = pdf_array_get(ctx, f, 0);
+		p = pdf_array_get(ctx, p, 0);
+	}
+	if (!pdf_name_eq(ctx, f, PDF_NAME(FlateDecode)) && !pdf_name_eq(ctx, f, PDF_NAME(Fl)))
+		return NULL;
+	build_compression_params(ctx, f, p, &params);
+
+	raw = pdf_load_raw_stream_number(ctx, doc, num);
+
+	/* Leave compression bombs for fz_read_all to detect. */
+	max = len < SIZE_MAX / 200 ? fz_maxz(100 << 20, len * 200) : 0;
+
+	fz_var(buf);
+	fz_var(pstm);
+
+	fz_try(ctx)
+	{
+		buf = fz_inflate_data(ctx, raw->data, raw->len, 15, len, max);
+		if (buf && params.u.flate.predictor > 1)
+		{
+			stm = fz_open_buffer(ctx, buf);
+			fz_try(ctx)
+			{
+				pstm = fz_open_predict(ctx, stm,
+					params.u.flate.predictor,
+					params.u.flate.columns,
+					params.u.flate.colors,
+					params.u.flate.bpc);
+				tmp = fz_read_all(ctx, pstm, buf->len);
+				fz_drop_buffer(ctx, buf);
+				buf = tmp;
+			}
+			fz_always(ctx)
+			{
+				fz_drop_stream(ctx, pstm);
+				fz_drop_stream(ctx, stm);
+			}
+			fz_catch(ctx)
+				fz_rethrow(ctx);
+		}
+	}
+	fz_always(ctx)
+		fz_drop_buffer(ctx, raw);
+	fz_catch(ctx)
+	{
+		fz_drop_buffer(ctx, buf);
+		fz_rethrow(ctx);
+	}
+
+	return buf;
+}
+
 static fz_buffer *
 pdf_load_image_stream(fz_context *ctx, pdf_document *doc, int num, fz_compression_params *params, int *truncated)
 {
@@ -587,6 +659,10 @@ pdf_load_image_stream(fz_context *ctx, pdf_document *doc, int num, fz_compressio
 		n = pdf_array_len(ctx, obj);
 		for (i = 0; i < n; i++)
 			len = pdf_guess_filter_length(len, pdf_to_name(ctx, pdf_array_get(ctx, obj, i)));
+
+		buf = NULL;
+		if (!params)
+			buf = pdf_load_flated_stream(ctx, doc, num, dict, len > 0 ? len : 0);
 	}
 	fz_always(ctx)
 	{
@@ -597,6 +673,13 @@ pdf_load_image_stream(fz_context *ctx, pdf_document *doc, int num, fz_compressio
 		fz_rethrow(ctx);
 	}
 
+	if (buf)
+	{
+		if (truncated)
+			*truncated = 0;
+		return buf;
+	}
+
 	stm = pdf_open_image_stream(ctx, doc, num, params);
 
 	fz_try(ctx)
@@ -1,5 +1,6 @@
 #include "mupdf/fitz.h"
 #include "mupdf/pdf.h"
+#include "mupdf/helpers/mu-threads.h"
 
 #include <zlib.h>
 
@@ -56,6 +57,8 @@ typedef struct {
 	page_objects *page[1];
 } page_objects_list;
 
+typedef struct pdf_compressor pdf_compressor;
+
 typedef struct
 {
 	fz_output *out;
@@ -71,6 +74,8 @@ typedef struct
 	int do_linear;
 	int do_clean;
 	int do_encrypt;
+	int do_use_objstms;
+	int compress_threads;
 
 	int list_len;
 	int *use_list;
@@ -78,6 +83,13 @@ typedef struct
 	int *gen_list;
 	int *renumber_map;
 
+	/* The following extras are required for object streams */
+	int *objstm_list;
+	int *objstm_index;
+
+	/* Worker threads deflating streams ahead of the writer */
+	pdf_compressor *compressor;
+
 	/* The following extras are required for linearization */
 	int *rev_renumber_map;
 	int start;
@@ -142,6 +154,11 @@ expand_lists(fz_context *ctx, pdf_write_state *opts, int num)
 	opts->gen_list = fz_realloc_array(ctx, opts->gen_list, num, int);
 	opts->renumber_map = fz_realloc_array(ctx, opts->renumber_map, num, int);
 	opts->rev_renumber_map = fz_realloc_array(ctx, opts->rev_renumber_map, num, int);
+	if (opts->do_use_objstms)
+	{
+		opts->objstm_list = fz_realloc_array(ctx, opts->objstm_list, num, int);
+		opts->objstm_index = fz_realloc_array(ctx, opts->objstm_index, num, int);
+	}
 
 	for (i = opts->list_len; i < num; i++)
 	{
@@ -150,6 +167,11 @@ expand_lists(fz_context *ctx, pdf_write_state *opts, int num)
 		opts->gen_list[i] = 0;
 		opts->renumber_map[i] = i;
 		opts->rev_renumber_map[i] = i;
+		if (opts->do_use_objstms)
+		{
+			opts->objstm_list[i] = 0;
+			opts->objstm_index[i] = 0;
+		}
 	}
 	opts->list_len = num;
 }
@@ -666,87 +688,212 @@ static int markobj(fz_context *ctx, pdf_document *doc, pdf_write_state *opts, pd
 }
 
 /*
- * Scan for and remove duplicate objects (slow)
+ * Scan for and remove duplicate objects. Candidates are found by a
+ * structural hash that is consistent with pdf_objcmp: objects that
+ * compare equal hash to the same value. Indirect references are hashed
+ * by number, not resolved.
+ */
+
+static uint32_t hashbytes(uint32_t h, const void *p, size_t n)
+{
+	const unsigned char *s = p;
+	while (n--)
+		h = (h ^ *s++) * 16777619u;
+	return h;
+}
+
+static uint32_t hashint(uint32_t h, int64_t i)
+{
+	return hashbytes(h, &i, sizeof i);
+}
+
+static uint32_t hashobj(fz_context *ctx, pdf_obj *obj, uint32_t h)
+{
+	const char *str;
+	size_t len;
+	float f;
+	int i, n;
+
+	if (pdf_is_indirect(ctx, obj))
+	{
+		h = hashint(h, 'R');
+		h = hashint(h, pdf_to_num(ctx, obj));
+		return hashint(h, pdf_to_gen(ctx, obj));
+	}
+	if (pdf_is_int(ctx, obj))
+		return hashint(hashint(h, 'i'), pdf_to_int64(ctx, obj));
+	if (pdf_is_real(ctx, obj))
+	{
+		/* 0 and -0 compare equal. */
+		f = pdf_to_real(ctx, obj);
+		if (f == 0)
+			f = 0;
+		return hashbytes(hashint(h, 'f'), &f, sizeof f);
+	}
+	if (pdf_is_name(ctx, obj))
+	{
+		str = pdf_to_name(ctx, obj);
+		return hashbytes(hashint(h, '/'), str, strlen(str));
+	}
+	if (pdf_is_string(ctx, obj))
+	{
+		str = pdf_to_string(ctx, obj, &len);
+		return hashbytes(hashint(h, '('), str, len);
+	}
+	if (pdf_is_array(ctx, obj))
+	{
+		n = pdf_array_len(ctx, obj);
+		h = hashint(hashint(h, '['), n);
+		for (i = 0; i < n; i++)
+			h = hashobj(ctx, pdf_array_get(ctx, obj, i), h);
+		return h;
+	}
+	if (pdf_is_dict(ctx, obj))
+	{
+		n = pdf_dict_len(ctx, obj);
+		h = hashint(hashint(h, '<'), n);
+		for (i = 0; i < n; i++)
+		{
+			h = hashobj(ctx, pdf_dict_get_key(ctx, obj, i), h);
+			h = hashobj(ctx, pdf_dict_get_val(ctx, obj, i), h);
+		}
+		return h;
+	}
+	if (pdf_is_bool(ctx, obj))
+		return hashint(h, pdf_to_bool(ctx, obj) ? 't' : 'F');
+	return hashint(h, '0');
+}
+
+static uint32_t hashobjnum(fz_context *ctx, pdf_document *doc, int num, int stream)
+{
+	uint32_t h = hashobj(ctx, pdf_get_xref_entry(ctx, doc, num)->obj, 2166136261u);
+
+	if (stream)
+	{
+		fz_buffer *buf = pdf_load_raw_stream_number(ctx, doc, num);
+		unsigned char *data;
+		size_t len = fz_buffer_storage(ctx, buf, &data);
+		h = hashbytes(hashint(h, 'S'), data, len);
+		fz_drop_buffer(ctx, buf);
+	}
+
+	return h;
+}
+
+static int sameobjnum(fz_context *ctx, pdf_document *doc, int num, int other, int stream)
+{
+	fz_buffer *sa = NULL;
+	fz_buffer *sb = NULL;
+	int same = 0;
+
+	if (pdf_obj_num_is_stream(ctx, doc, other) != stream)
+		return 0;
+
+	if (pdf_objcmp(ctx, pdf_get_xref_entry(ctx, doc, num)->obj, pdf_get_xref_entry(ctx, doc, other)->obj))
+		return 0;
+
+	if (!stream)
+		return 1;
+
+	/* Check to see if streams match too. */
+	fz_var(sa);
+	fz_var(sb);
+
+	fz_try(ctx)
+	{
+		unsigned char *dataa, *datab;
+		size_t lena, lenb;
+		sa = pdf_load_raw_stream_number(ctx, doc, num);
+		sb = pdf_load_raw_stream_number(ctx, doc, other);
+		lena = fz_buffer_storage(ctx, sa, &dataa);
+		lenb = fz_buffer_storage(ctx, sb, &datab);
+		if (lena == lenb && memcmp(dataa, datab, lena) == 0)
+			same = 1;
+	}
+	fz_always(ctx)
+	{
+		fz_drop_buffer(ctx, sa);
+		fz_drop_buffer(ctx, sb);
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow(ctx);
+	}
+
+	return same;
+}
+
+/*
+ * Coalesce duplicate objects. Each object in use is looked up by its
+ * structural hash among the objects kept so far, and if an identical
+ * one is found it is mapped onto that (lower numbered) object.
+ * Streams are only considered at garbage level 4 and above, since
+ * their contents have to be loaded to be hashed.
  */
 
 static void removeduplicateobjs(fz_context *ctx, pdf_document *doc, pdf_write_state *opts)
 {
-	int num, other, max_num;
+	int num, other, newnum, max_num;
 	int xref_len = pdf_xref_len(ctx, doc);
+	int size = 1024;
+	int *heads = NULL;
+	int *next = NULL;
+	uint32_t *hashes = NULL;
+	uint32_t h = 0;
+	int stream = 0;
+	int skip;
 
-	for (num = 1; num < xref_len; num++)
+	while (size < xref_len && size < INT_MAX / 2)
+		size <<= 1;
+
+	fz_var(heads);
+	fz_var(next);
+	fz_var(hashes);
+
+	fz_try(ctx)
 	{
-		/* Only compare an object to objects preceding it */
-		for (other = 1; other < num; other++)
-		{
-			pdf_obj *a, *b;
-			int newnum, streama = 0, streamb = 0, differ = 0;
+		heads = fz_calloc(ctx, size, sizeof(int));
+		next = fz_calloc(ctx, xref_len, sizeof(int));
+		hashes = fz_calloc(ctx, xref_len, sizeof(uint32_t));
 
-			if (num == other || !opts->use_list[num] || !opts->use_list[other])
+		for (num = 1; num < xref_len; num++)
+		{
+			if (!opts->use_list[num])
 				continue;
 
 			/* TODO: resolve indirect references to see if we can omit them */
 
 			/*
-			 * Comparing stream objects data contents would take too long.
-			 *
 			 * pdf_obj_num_is_stream calls pdf_cache_object and ensures
 			 * that the xref table has the objects loaded.
 			 */
+			skip = 0;
 			fz_try(ctx)
 			{
-				streama = pdf_obj_num_is_stream(ctx, doc, num);
-				streamb = pdf_obj_num_is_stream(ctx, doc, other);
-				differ = streama || streamb;
-				if (streama && streamb && opts->do_garbage >= 4)
-					differ = 0;
+				stream = pdf_obj_num_is_stream(ctx, doc, num);
+				if (stream && opts->do_garbage < 4)
+					skip = 1;
+				else
+					h = hashobjnum(ctx, doc, num, stream);
 			}
 			fz_catch(ctx)
 			{
 				/* Assume different */
-				differ = 1;
+				skip = 1;
 			}
-			if (differ)
+			if (skip)
 				continue;
 
-			a = pdf_get_xref_entry(ctx, doc, num)->obj;
-			b = pdf_get_xref_entry(ctx, doc, other)->obj;
-
-			if (pdf_objcmp(ctx, a, b))
-				continue;
+			for (other = heads[h & (size - 1)]; other; other = next[other])
+				if (hashes[other] == h && sameobjnum(ctx, doc, num, other, stream))
+					break;
 
-			if (streama && streamb)
+			if (!other)
 			{
-				/* Check to see if streams match too. */
-				fz_buffer *sa = NULL;
-				fz_buffer *sb = NULL;
-
-				fz_var(sa);
-				fz_var(sb);
-
-				differ = 1;
-				fz_try(ctx)
-				{
-					unsigned char *dataa, *datab;
-					size_t lena, lenb;
-					sa = pdf_load_raw_stream_number(ctx, doc, num);
-					sb = pdf_load_raw_stream_number(ctx, doc, other);
-					lena = fz_buffer_storage(ctx, sa, &dataa);
-					lenb = fz_buffer_storage(ctx, sb, &datab);
-					if (lena == lenb && memcmp(dataa, datab, lena) == 0)
-						differ = 0;
-				}
-				fz_always(ctx)
-				{
-					fz_drop_buffer(ctx, sa);
-					fz_drop_buffer(ctx, sb);
-				}
-				fz_catch(ctx)
-				{
-					fz_rethrow(ctx);
-				}
-				if (differ)
-					continue;
+				hashes[num] = h;
+				next[num] = heads[h & (size - 1)];
+				heads[h & (size - 1)] = num;
+				continue;
 			}
 
 			/* Keep the lowest numbered object */
@@ -758,11 +905,18 @@ static void removeduplicateobjs(fz_context *ctx, pdf_document *doc, pdf_write_st
 			opts->renumber_map[other] = newnum;
 			opts->rev_renumber_map[newnum] = num; /* Either will do */
 			opts->use_list[fz_maxi(num, other)] = 0;
-
-			/* One duplicate was found, do not look for another */
-			break;
 		}
 	}
+	fz_always(ctx)
+	{
+		fz_free(ctx, heads);
+		fz_free(ctx, next);
+		fz_free(ctx, hashes);
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow(ctx);
+	}
 }
 
 /*
@@ -1790,114 +1944,74 @@ static void write_data(fz_context *ctx, void *arg, const unsigned char *data, si
 	fz_write_data(ctx, (fz_output *)arg, data, len);
 }
 
-static void copystream(fz_context *ctx, pdf_document *doc, pdf_write_state *opts, pdf_obj *obj_orig, int num, int gen, int do_deflate, int unenc)
+/* Load the data of a stream object as it is to be written, up to the
+ * point of compression. Returns a copy of the stream dictionary in
+ * *objp, and whether the data is to be compressed in *compressp. */
+static fz_buffer *preparestream(fz_context *ctx, pdf_document *doc, pdf_obj *obj_orig, int num, int do_deflate, int do_expand, pdf_obj **objp, int *compressp)
 {
-	fz_buffer *tmp_unhex = NULL, *tmp_comp = NULL, *tmp_hex = NULL, *buf = NULL;
+	fz_buffer *buf = NULL, *tmp_unhex;
 	pdf_obj *obj = NULL;
-	pdf_obj *dp;
 	size_t len;
 	unsigned char *data;
-	int w, h;
 
 	fz_var(buf);
-	fz_var(tmp_comp);
-	fz_var(tmp_hex);
 	fz_var(obj);
 
 	fz_try(ctx)
 	{
-		buf = pdf_load_raw_stream_number(ctx, doc, num);
-		obj = pdf_copy_dict(ctx, obj_orig);
-
-		len = fz_buffer_storage(ctx, buf, &data);
-
-		if (do_deflate && striphexfilter(ctx, doc, obj))
+		if (do_expand)
 		{
-			tmp_unhex = unhexbuf(ctx, data, len);
-			len = fz_buffer_storage(ctx, tmp_unhex, &data);
+			buf = pdf_load_stream_number(ctx, doc, num);
+			obj = pdf_copy_dict(ctx, obj_orig);
+			pdf_dict_del(ctx, obj, PDF_NAME(Filter));
+			pdf_dict_del(ctx, obj, PDF_NAME(DecodeParms));
 		}
-
-		if (do_deflate && !pdf_dict_get(ctx, obj, PDF_NAME(Filter)))
+		else
 		{
-			if (is_bitmap_stream(ctx, obj, len, &w, &h))
-			{
-				tmp_comp = fz_compress_ccitt_fax_g4(ctx, data, w, h);
-				pdf_dict_put(ctx, obj, PDF_NAME(Filter), PDF_NAME(CCITTFaxDecode));
-				dp = pdf_dict_put_dict(ctx, obj, PDF_NAME(DecodeParms), 1);
-				pdf_dict_put_int(ctx, dp, PDF_NAME(K), -1);
-				pdf_dict_put_int(ctx, dp, PDF_NAME(Columns), w);
-			}
-			else
+			buf = pdf_load_raw_stream_number(ctx, doc, num);
+			obj = pdf_copy_dict(ctx, obj_orig);
+
+			if (do_deflate && striphexfilter(ctx, doc, obj))
 			{
-				tmp_comp = deflatebuf(ctx, data, len);
-				pdf_dict_put(ctx, obj, PDF_NAME(Filter), PDF_NAME(FlateDecode));
+				len = fz_buffer_storage(ctx, buf, &data);
+				tmp_unhex = unhexbuf(ctx, data, len);
+				fz_drop_buffer(ctx, buf);
+				buf = tmp_unhex;
 			}
-			len = fz_buffer_storage(ctx, tmp_comp, &data);
 		}
 
-		if (opts->do_ascii && isbinarystream(ctx, data, len))
-		{
-			tmp_hex = hexbuf(ctx, data, len);
-			len = fz_buffer_storage(ctx, tmp_hex, &data);
-			addhexfilter(ctx, doc, obj);
-		}
-
-		fz_write_printf(ctx, opts->out, "%d %d obj\n", num, gen);
-
-		if (unenc)
-		{
-			pdf_dict_put_int(ctx, obj, PDF_NAME(Length), len);
-			pdf_print_obj(ctx, opts->out, obj, opts->do_tight, opts->do_ascii);
-			fz_write_string(ctx, opts->out, "\nstream\n");
-			fz_write_data(ctx, opts->out, data, len);
-		}
-		else
-		{
-			pdf_dict_put_int(ctx, obj, PDF_NAME(Length), pdf_encrypted_len(ctx, opts->crypt, num, gen, len));
-			pdf_print_encrypted_obj(ctx, opts->out, obj, opts->do_tight, opts->do_ascii, opts->crypt, num, gen);
-			fz_write_string(ctx, opts->out, "\nstream\n");
-			pdf_encrypt_data(ctx, opts->crypt, num, gen, write_data, opts->out, data, len);
-		}
-
-		fz_write_string(ctx, opts->out, "\nendstream\nendobj\n\n");
+		*compressp = do_deflate && !pdf_dict_get(ctx, obj, PDF_NAME(Filter));
 	}
-	fz_always(ctx)
+	fz_catch(ctx)
 	{
-		fz_drop_buffer(ctx, tmp_unhex);
-		fz_drop_buffer(ctx, tmp_hex);
-		fz_drop_buffer(ctx, tmp_comp);
 		fz_drop_buffer(ctx, buf);
 		pdf_drop_obj(ctx, obj);
-	}
-	fz_catch(ctx)
-	{
 		fz_rethrow(ctx);
 	}
+
+	*objp = obj;
+	return buf;
 }
 
-static void expandstream(fz_context *ctx, pdf_document *doc, pdf_write_state *opts, pdf_obj *obj_orig, int num, int gen, int do_deflate, int unenc)
+/* Compress (if asked to), hex encode (if asked to) and write a stream
+ * object prepared by preparestream. If the data has already been
+ * deflated, comp holds the result. */
+static void writestream(fz_context *ctx, pdf_document *doc, pdf_write_state *opts, pdf_obj *obj, fz_buffer *buf, fz_buffer *comp, int do_compress, int num, int gen, int unenc)
 {
-	fz_buffer *buf = NULL, *tmp_comp = NULL, *tmp_hex = NULL;
-	pdf_obj *obj = NULL;
+	fz_buffer *tmp_comp = NULL, *tmp_hex = NULL;
 	pdf_obj *dp;
 	size_t len;
 	unsigned char *data;
 	int w, h;
 
-	fz_var(buf);
 	fz_var(tmp_comp);
 	fz_var(tmp_hex);
-	fz_var(obj);
 
 	fz_try(ctx)
 	{
-		buf = pdf_load_stream_number(ctx, doc, num);
-		obj = pdf_copy_dict(ctx, obj_orig);
-		pdf_dict_del(ctx, obj, PDF_NAME(Filter));
-		pdf_dict_del(ctx, obj, PDF_NAME(DecodeParms));
-
 		len = fz_buffer_storage(ctx, buf, &data);
-		if (do_deflate)
+
+		if (do_compress)
 		{
 			if (is_bitmap_stream(ctx, obj, len, &w, &h))
 			{
@@ -1909,7 +2023,10 @@ static void expandstream(fz_context *ctx, pdf_document *doc, pdf_write_state *op
 			}
 			else
 			{
-				tmp_comp = deflatebuf(ctx, data, len);
+				if (comp)
+					tmp_comp = fz_keep_buffer(ctx, comp);
+				else
+					tmp_comp = deflatebuf(ctx, data, len);
 				pdf_dict_put(ctx, obj, PDF_NAME(Filter), PDF_NAME(FlateDecode));
 			}
 			len = fz_buffer_storage(ctx, tmp_comp, &data);
@@ -1933,7 +2050,7 @@ static void expandstream(fz_context *ctx, pdf_document *doc, pdf_write_state *op
 		}
 		else
 		{
-			pdf_dict_put_int(ctx, obj, PDF_NAME(Length), pdf_encrypted_len(ctx, opts->crypt, num, gen, (int)len));
+			pdf_dict_put_int(ctx, obj, PDF_NAME(Length), pdf_encrypted_len(ctx, opts->crypt, num, gen, len));
 			pdf_print_encrypted_obj(ctx, opts->out, obj, opts->do_tight, opts->do_ascii, opts->crypt, num, gen);
 			fz_write_string(ctx, opts->out, "\nstream\n");
 			pdf_encrypt_data(ctx, opts->crypt, num, gen, write_data, opts->out, data, len);
@@ -1945,8 +2062,6 @@ static void expandstream(fz_context *ctx, pdf_document *doc, pdf_write_state *op
 	{
 		fz_drop_buffer(ctx, tmp_hex);
 		fz_drop_buffer(ctx, tmp_comp);
-		fz_drop_buffer(ctx, buf);
-		pdf_drop_obj(ctx, obj);
 	}
 	fz_catch(ctx)
 	{
@@ -2044,12 +2159,389 @@ static int is_xml_metadata(fz_context *ctx, pdf_obj *obj)
 	return 0;
 }
 
+/* Object and cross reference streams generated while writing are
+ * marked with -1 in objstm_list. */
+static int is_new_objstm(pdf_write_state *opts, int num)
+{
+	return opts->do_use_objstms && opts->objstm_list[num] < 0;
+}
+
+/* Decide whether the data of a stream object is to be compressed or
+ * decompressed when written. */
+static void streamflags(fz_context *ctx, pdf_write_state *opts, pdf_obj *obj, int num, int *do_deflate, int *do_expand)
+{
+	*do_deflate = opts->do_compress;
+	*do_expand = opts->do_expand;
+	if (opts->do_compress_images && is_image_stream(ctx, obj))
+		*do_deflate = 1, *do_expand = 0;
+	if (opts->do_compress_fonts && is_font_stream(ctx, obj))
+		*do_deflate = 1, *do_expand = 0;
+	if (is_xml_metadata(ctx, obj))
+		*do_deflate = 0, *do_expand = 0;
+	if (is_jpx_stream(ctx, obj))
+		*do_deflate = 0, *do_expand = 0;
+	if (is_new_objstm(opts, num))
+		*do_deflate = !opts->do_expand, *do_expand = 0;
+}
+
+/*
+	Deflating streams is where most of the time goes when saving a
+	compressed file. If asked to, we prepare the streams of the next
+	few objects ahead of the writer, and deflate them on a pool of
+	worker threads. Each worker deflates one stream at a time. Streams
+	are handed out to the workers, and collected from them, in object
+	order, so the output is the same as that of a single threaded save.
+
+	The workers only ever call zlib on memory that the writer has
+	allocated for them; they never touch the context or the document.
+	If a worker fails to deflate a stream, the writer warns and
+	deflates it again itself.
+*/
+#define MAX_COMPRESS_THREADS 64
+
+typedef struct
+{
+	int num; /* object number, or 0 if the slot is empty */
+	pdf_obj *obj;
+	fz_buffer *buf;
+	int do_compress;
+	int busy;
+
+	unsigned char *comp;
+	size_t comp_cap;
+	uLongf comp_len;
+	int status;
+
+	int quit;
+	mu_thread thread;
+	mu_semaphore start;
+	mu_semaphore stop;
+} pdf_compress_slot;
+
+struct pdf_compressor
+{
+	int count;
+	pdf_compress_slot *slot;
+	int head; /* slot holding the next object to be written */
+	int used; /* number of slots in use */
+	int next; /* next object to look at */
+	int end; /* end of the run of objects being written */
+};
+
+static void compress_worker(void *arg)
+{
+	pdf_compress_slot *slot = arg;
+	unsigned char *data;
+	size_t len;
+
+	for (;;)
+	{
+		mu_wait_semaphore(&slot->start);
+		if (slot->quit)
+			break;
+		len = slot->buf->len;
+		data = slot->buf->data;
+		slot->comp_len = (uLongf)slot->comp_cap;
+		slot->status = compress(slot->comp, &slot->comp_len, data, (uLong)len);
+		mu_trigger_semaphore(&slot->stop);
+	}
+}
+
+static void empty_compress_slot(fz_context *ctx, pdf_compress_slot *slot)
+{
+	if (slot->busy)
+	{
+		mu_wait_semaphore(&slot->stop);
+		slot->busy = 0;
+	}
+	pdf_drop_obj(ctx, slot->obj);
+	fz_drop_buffer(ctx, slot->buf);
+	fz_free(ctx, slot->comp);
+	slot->obj = NULL;
+	slot->buf = NULL;
+	slot->comp = NULL;
+	slot->num = 0;
+}
+
+static void drop_compressor(fz_context *ctx, pdf_compressor *comp)
+{
+	int i;
+
+	if (!comp)
+		return;
+
+	for (i = 0; i < comp->count; i++)
+	{
+		pdf_compress_slot *slot = &comp->slot[i];
+		empty_compress_slot(ctx, slot);
+		slot->quit = 1;
+		mu_trigger_semaphore(&slot->start);
+		mu_destroy_thread(&slot->thread);
+		mu_destroy_semaphore(&slot->start);
+		mu_destroy_semaphore(&slot->stop);
+	}
+	fz_free(ctx, comp->slot);
+	fz_free(ctx, comp);
+}
+
+/* Returns NULL if the worker threads cannot be started, in which case
+ * streams are compressed by the writer as usual. */
+static pdf_compressor *new_compressor(fz_context *ctx, int count)
+{
+	pdf_compressor *comp;
+	int i;
+
+	comp = fz_malloc_struct(ctx, pdf_compressor);
+	fz_try(ctx)
+		comp->slot = fz_calloc(ctx, count, sizeof(pdf_compress_slot));
+	fz_catch(ctx)
+	{
+		fz_free(ctx, comp);
+		fz_rethrow(ctx);
+	}
+
+	for (i = 0; i < count; i++)
+	{
+		pdf_compress_slot *slot = &comp->slot[i];
+		if (mu_create_semaphore(&slot->start))
+			break;
+		if (mu_create_semaphore(&slot->stop))
+		{
+			mu_destroy_semaphore(&slot->start);
+			break;
+		}
+		if (mu_create_thread(&slot->thread, compress_worker, slot))
+		{
+			mu_destroy_semaphore(&slot->start);
+			mu_destroy_semaphore(&slot->stop);
+			break;
+		}
+		comp->count++;
+	}
+
+	if (comp->count < count)
+	{
+		fz_warn(ctx, "cannot start compression threads");
+		drop_compressor(ctx, comp);
+		return NULL;
+	}
+
+	return comp;
+}
+
+/* Set the run of objects that the writer is about to write, and throw
+ * away anything left over from the previous run. */
+static void compress_ahead(fz_context *ctx, pdf_write_state *opts, int from, int to)
+{
+	pdf_compressor *comp = opts->compressor;
+
+	if (!comp)
+		return;
+
+	while (comp->used > 0)
+	{
+		empty_compress_slot(ctx, &comp->slot[comp->head]);
+		comp->head = (comp->head + 1) % comp->count;
+		comp->used--;
+	}
+	comp->next = from;
+	comp->end = to;
+}
+
+/* Returns the object if dowriteobject will write num as a stream
+ * object, or NULL otherwise. */
+static pdf_obj *lookahead_stream(fz_context *ctx, pdf_document *doc, pdf_write_state *opts, int num)
+{
+	pdf_xref_entry *entry;
+	pdf_obj *obj, *type;
+
+	if (opts->do_use_objstms && opts->objstm_list[num] != 0)
+		return NULL;
+	if (opts->do_garbage && !opts->use_list[num])
+		return NULL;
+	entry = pdf_get_xref_entry(ctx, doc, num);
+	if (entry->type != 'n' && entry->type != 'o')
+		return NULL;
+	if (opts->do_incremental && !pdf_xref_is_incremental(ctx, doc, num))
+		return NULL;
+	if (!pdf_obj_num_is_stream(ctx, doc, num))
+		return NULL;
+
+	obj = pdf_load_object(ctx, doc, num);
+	type = pdf_dict_get(ctx, obj, PDF_NAME(Type));
+	if (type == PDF_NAME(ObjStm) || type == PDF_NAME(XRef))
+	{
+		pdf_drop_obj(ctx, obj);
+		return NULL;
+	}
+	return obj;
+}
+
+/* Fill the empty slots with the next streams to be written, and start
+ * deflating them. Any object we fail to prepare here (other than for
+ * lack of memory, which would only fail again) is left for the writer
+ * to try again on its own when it gets to it. */
+static void compress_fill(fz_context *ctx, pdf_document *doc, pdf_write_state *opts)
+{
+	pdf_compressor *comp = opts->compressor;
+	pdf_compress_slot *slot;
+	pdf_obj *obj = NULL;
+	int num, do_deflate, do_expand, w, h;
+
+	fz_var(obj);
+
+	while (comp->used < comp->count && comp->next < comp->end)
+	{
+		num = comp->next++;
+		slot = &comp->slot[(comp->head + comp->used) % comp->count];
+
+		fz_try(ctx)
+		{
+			obj = lookahead_stream(ctx, doc, opts, num);
+			if (obj)
+			{
+				streamflags(ctx, opts, obj, num, &do_deflate, &do_expand);
+				slot->buf = preparestream(ctx, doc, obj, num, do_deflate, do_expand, &slot->obj, &slot->do_compress);
+				slot->num = num;
+				if (slot->do_compress && slot->buf->len == (uLong)slot->buf->len &&
+					!is_bitmap_stream(ctx, slot->obj, slot->buf->len, &w, &h))
+				{
+					slot->comp_cap = compressBound((uLong)slot->buf->len);
+					slot->comp = Memento_label(fz_malloc(ctx, slot->comp_cap), "pdf_write_deflate");
+					slot->busy = 1;
+					mu_trigger_semaphore(&slot->start);
+				}
+				comp->used++;
+			}
+		}
+		fz_always(ctx)
+		{
+			pdf_drop_obj(ctx, obj);
+			obj = NULL;
+		}
+		fz_catch(ctx)
+		{
+			empty_compress_slot(ctx, slot);
+			fz_rethrow_if(ctx, FZ_ERROR_MEMORY);
+			fz_warn(ctx, "cannot prepare stream (%d 0 R) for compression: %s", num, fz_caught_message(ctx));
+		}
+	}
+}
+
+/* If the stream of object num has been prepared ahead of the writer,
+ * hand it (and the deflated data, if any) over to the caller. */
+static int take_prepared_stream(fz_context *ctx, pdf_document *doc, pdf_write_state *opts, int num, pdf_obj **objp, fz_buffer **bufp, fz_buffer **compp, int *compressp)
+{
+	pdf_compressor *comp = opts->compressor;
+	pdf_compress_slot *slot;
+	fz_buffer *deflated = NULL;
+
+	if (!comp)
+		return 0;
+
+	compress_fill(ctx, doc, opts);
+
+	while (comp->used > 0)
+	{
+		slot = &comp->slot[comp->head];
+		if (slot->num > num)
+			return 0;
+		if (slot->num == num)
+			break;
+		empty_compress_slot(ctx, slot);
+		comp->head = (comp->head + 1) % comp->count;
+		comp->used--;
+	}
+	if (comp->used == 0)
+		return 0;
+
+	if (slot->busy)
+	{
+		mu_wait_semaphore(&slot->stop);
+		slot->busy = 0;
+	}
+
+	if (slot->comp && slot->status != Z_OK)
+	{
+		fz_warn(ctx, "cannot deflate stream %d on a worker thread (%d); retrying", num, slot->status);
+		empty_compress_slot(ctx, slot);
+		comp->head = (comp->head + 1) % comp->count;
+		comp->used--;
+		return 0;
+	}
+
+	fz_try(ctx)
+	{
+		if (slot->comp)
+		{
+			unsigned char *data = slot->comp;
+			/* fz_new_buffer_from_data frees the data if it fails,
+			 * so the slot must let go of it first. */
+			slot->comp = NULL;
+			deflated = fz_new_buffer_from_data(ctx, data, slot->comp_cap);
+			fz_resize_buffer(ctx, deflated, slot->comp_len);
+		}
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_buffer(ctx, deflated);
+		empty_compress_slot(ctx, slot);
+		comp->head = (comp->head + 1) % comp->count;
+		comp->used--;
+		fz_rethrow(ctx);
+	}
+
+	*objp = slot->obj;
+	*bufp = slot->buf;
+	*compp = deflated;
+	*compressp = slot->do_compress;
+	slot->obj = NULL;
+	slot->buf = NULL;
+	slot->num = 0;
+	comp->head = (comp->head + 1) % comp->count;
+	comp->used--;
+
+	/* Keep the workers busy while we write this one out. */
+	compress_fill(ctx, doc, opts);
+
+	return 1;
+}
+
+static void writestreamobject(fz_context *ctx, pdf_document *doc, pdf_write_state *opts, pdf_obj *obj_orig, int num, int gen, int unenc)
+{
+	fz_buffer *buf = NULL, *comp = NULL;
+	pdf_obj *obj = NULL;
+	int do_deflate, do_expand, do_compress;
+
+	fz_var(buf);
+	fz_var(comp);
+	fz_var(obj);
+
+	fz_try(ctx)
+	{
+		if (!take_prepared_stream(ctx, doc, opts, num, &obj, &buf, &comp, &do_compress))
+		{
+			streamflags(ctx, opts, obj_orig, num, &do_deflate, &do_expand);
+			buf = preparestream(ctx, doc, obj_orig, num, do_deflate, do_expand, &obj, &do_compress);
+		}
+		writestream(ctx, doc, opts, obj, buf, comp, do_compress, num, gen, unenc);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_buffer(ctx, comp);
+		fz_drop_buffer(ctx, buf);
+		pdf_drop_obj(ctx, obj);
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow(ctx);
+	}
+}
+
 static void writeobject(fz_context *ctx, pdf_document *doc, pdf_write_state *opts, int num, int gen, int skip_xrefs, int unenc)
 {
 	pdf_obj *obj = NULL;
 	fz_buffer *buf = NULL;
-	int do_deflate = 0;
-	int do_expand = 0;
 	int skip = 0;
 
 	fz_var(obj);
@@ -2066,7 +2558,7 @@ static void writeobject(fz_context *ctx, pdf_document *doc, pdf_write_state *opt
 		if (pdf_is_dict(ctx, obj))
 		{
 			pdf_obj *type = pdf_dict_get(ctx, obj, PDF_NAME(Type));
-			if (type == PDF_NAME(ObjStm))
+			if (type == PDF_NAME(ObjStm) && !is_new_objstm(opts, num))
 			{
 				opts->use_list[num] = 0;
 				skip = 1;
@@ -2082,21 +2574,7 @@ static void writeobject(fz_context *ctx, pdf_document *doc, pdf_write_state *opt
 		{
 			if (pdf_obj_num_is_stream(ctx, doc, num))
 			{
-				do_deflate = opts->do_compress;
-				do_expand = opts->do_expand;
-				if (opts->do_compress_images && is_image_stream(ctx, obj))
-					do_deflate = 1, do_expand = 0;
-				if (opts->do_compress_fonts && is_font_stream(ctx, obj))
-					do_deflate = 1, do_expand = 0;
-				if (is_xml_metadata(ctx, obj))
-					do_deflate = 0, do_expand = 0;
-				if (is_jpx_stream(ctx, obj))
-					do_deflate = 0, do_expand = 0;
-
-				if (do_expand)
-					expandstream(ctx, doc, opts, obj, num, gen, do_deflate, unenc);
-				else
-					copystream(ctx, doc, opts, obj, num, gen, do_deflate, unenc);
+				writestreamobject(ctx, doc, opts, obj, num, gen, unenc);
 			}
 			else
 			{
@@ -2220,31 +2698,62 @@ static void writexref(fz_context *ctx, pdf_document *doc, pdf_write_state *opts,
 	doc->has_xref_streams = 0;
 }
 
-static void writexrefstreamsubsect(fz_context *ctx, pdf_document *doc, pdf_write_state *opts, pdf_obj *index, fz_buffer *fzbuf, int from, int to)
+static void xrefstreamentry(pdf_write_state *opts, int num, int *type, int64_t *f2, int *f3)
 {
-	int num;
+	if (opts->do_use_objstms && opts->objstm_list[num] > 0)
+	{
+		*type = 2;
+		*f2 = opts->objstm_list[num];
+		*f3 = opts->objstm_index[num];
+	}
+	else
+	{
+		*type = opts->use_list[num] ? 1 : 0;
+		*f2 = opts->ofs_list[num];
+		*f3 = fz_mini(opts->gen_list[num], 65535);
+	}
+}
+
+static int xrefstreamwidth(int64_t v)
+{
+	int w = 1;
+	while (w < 8 && (v >> (8 * w)) != 0)
+		w++;
+	return w;
+}
+
+static void appendxrefstreamfield(fz_context *ctx, fz_buffer *fzbuf, int64_t v, int w)
+{
+	while (w-- > 0)
+		fz_append_byte(ctx, fzbuf, (int)(v >> (8 * w)));
+}
+
+static void writexrefstreamsubsect(fz_context *ctx, pdf_document *doc, pdf_write_state *opts, pdf_obj *index, fz_buffer *fzbuf, int from, int to, int w2, int w3)
+{
+	int num, type, f3;
+	int64_t f2;
 
 	pdf_array_push_int(ctx, index, from);
 	pdf_array_push_int(ctx, index, to - from);
 	for (num = from; num < to; num++)
 	{
-		fz_append_byte(ctx, fzbuf, opts->use_list[num] ? 1 : 0);
-		fz_append_byte(ctx, fzbuf, opts->ofs_list[num]>>24);
-		fz_append_byte(ctx, fzbuf, opts->ofs_list[num]>>16);
-		fz_append_byte(ctx, fzbuf, opts->ofs_list[num]>>8);
-		fz_append_byte(ctx, fzbuf, opts->ofs_list[num]);
-		fz_append_byte(ctx, fzbuf, opts->gen_list[num]);
+		xrefstreamentry(opts, num, &type, &f2, &f3);
+		fz_append_byte(ctx, fzbuf, type);
+		appendxrefstreamfield(ctx, fzbuf, f2, w2);
+		appendxrefstreamfield(ctx, fzbuf, f3, w3);
 	}
 }
 
 static void writexrefstream(fz_context *ctx, pdf_document *doc, pdf_write_state *opts, int from, int to, int first, int64_t main_xref_offset, int64_t startxref)
 {
-	int num;
+	int num, i;
 	pdf_obj *dict = NULL;
 	pdf_obj *obj;
 	pdf_obj *w = NULL;
 	pdf_obj *index;
 	fz_buffer *fzbuf = NULL;
+	int64_t max2 = 0, f2;
+	int max3 = 0, f3, type, w2, w3;
 
 	fz_var(dict);
 	fz_var(w);
@@ -2254,6 +2763,8 @@ static void writexrefstream(fz_context *ctx, pdf_document *doc, pdf_write_state
 		num = pdf_create_object(ctx, doc);
 		dict = pdf_new_dict(ctx, doc, 6);
 		pdf_update_object(ctx, doc, num, dict);
+		if (opts->do_use_objstms)
+			opts->objstm_list[num] = -1;
 
 		opts->first_xref_entry_offset = fz_tell_output(ctx, opts->out);
 
@@ -2273,12 +2784,9 @@ static void writexrefstream(fz_context *ctx, pdf_document *doc, pdf_write_state
 			if (obj)
 				pdf_dict_put(ctx, dict, PDF_NAME(ID), obj);
 
-			if (opts->do_incremental)
-			{
-				obj = pdf_dict_get(ctx, pdf_trailer(ctx, doc), PDF_NAME(Encrypt));
-				if (obj)
-					pdf_dict_put(ctx, dict, PDF_NAME(Encrypt), obj);
-			}
+			obj = pdf_dict_get(ctx, pdf_trailer(ctx, doc), PDF_NAME(Encrypt));
+			if (obj)
+				pdf_dict_put(ctx, dict, PDF_NAME(Encrypt), obj);
 		}
 
 		pdf_dict_put_int(ctx, dict, PDF_NAME(Size), to);
@@ -2296,20 +2804,30 @@ static void writexrefstream(fz_context *ctx, pdf_document *doc, pdf_write_state
 
 		pdf_dict_put(ctx, dict, PDF_NAME(Type), PDF_NAME(XRef));
 
+		/* opts->gen_list[num] is already initialized by fz_calloc. */
+		opts->use_list[num] = 1;
+		opts->ofs_list[num] = opts->first_xref_entry_offset;
+
+		/* Make the offset and generation fields just wide enough. */
+		for (i = from; i < to; i++)
+		{
+			xrefstreamentry(opts, i, &type, &f2, &f3);
+			max2 = fz_maxi64(max2, f2);
+			max3 = fz_maxi(max3, f3);
+		}
+		w2 = xrefstreamwidth(max2);
+		w3 = xrefstreamwidth(max3);
+
 		w = pdf_new_array(ctx, doc, 3);
 		pdf_dict_put(ctx, dict, PDF_NAME(W), w);
 		pdf_array_push_int(ctx, w, 1);
-		pdf_array_push_int(ctx, w, 4);
-		pdf_array_push_int(ctx, w, 1);
+		pdf_array_push_int(ctx, w, w2);
+		pdf_array_push_int(ctx, w, w3);
 
 		index = pdf_new_array(ctx, doc, 2);
 		pdf_dict_put_drop(ctx, dict, PDF_NAME(Index), index);
 
-		/* opts->gen_list[num] is already initialized by fz_calloc. */
-		opts->use_list[num] = 1;
-		opts->ofs_list[num] = opts->first_xref_entry_offset;
-
-		fzbuf = fz_new_buffer(ctx, (1 + 4 + 1) * (to-from));
+		fzbuf = fz_new_buffer(ctx, (1 + w2 + w3) * (to-from));
 
 		if (opts->do_incremental)
 		{
@@ -2326,14 +2844,14 @@ static void writexrefstream(fz_context *ctx, pdf_document *doc, pdf_write_state
 					subto++;
 
 				if (subfrom < subto)
-					writexrefstreamsubsect(ctx, doc, opts, index, fzbuf, subfrom, subto);
+					writexrefstreamsubsect(ctx, doc, opts, index, fzbuf, subfrom, subto, w2, w3);
 
 				subfrom = subto;
 			}
 		}
 		else
 		{
-			writexrefstreamsubsect(ctx, doc, opts, index, fzbuf, from, to);
+			writexrefstreamsubsect(ctx, doc, opts, index, fzbuf, from, to, w2, w3);
 		}
 
 		pdf_update_stream(ctx, doc, dict, fzbuf, 0);
@@ -2368,10 +2886,161 @@ padto(fz_context *ctx, fz_output *out, int64_t target)
 	}
 }
 
+/*
+ * Object streams
+ *
+ * Objects that may live in an object stream (non-stream objects with a
+ * zero generation number, other than the encryption dictionary and
+ * signature values, whose offsets must be known) are packed in object
+ * number order into streams of at most OBJSTM_MAXOBJS objects. Each
+ * object stream gets a fresh object number, recorded as -1 in
+ * objstm_list; each member records the number of its object stream in
+ * objstm_list and its position within it in objstm_index. The stream
+ * contents are only generated when the object stream is written.
+ */
+
+#define OBJSTM_MAXOBJS 100
+
+static int can_use_objstm(fz_context *ctx, pdf_document *doc, pdf_write_state *opts, int num)
+{
+	pdf_xref_entry *entry = pdf_get_xref_entry(ctx, doc, num);
+	pdf_obj *obj;
+	int ok;
+
+	if (!opts->use_list[num] || num == opts->crypt_object_number)
+		return 0;
+	if (entry->type != 'n' && entry->type != 'o')
+		return 0;
+	if (entry->type == 'n' && entry->gen != 0 && opts->do_garbage < 2)
+		return 0;
+	if (pdf_obj_num_is_stream(ctx, doc, num))
+		return 0;
+
+	obj = pdf_load_object(ctx, doc, num);
+	ok = !pdf_dict_get(ctx, obj, PDF_NAME(ByteRange));
+	pdf_drop_obj(ctx, obj);
+	return ok;
+}
+
+static void build_objstms(fz_context *ctx, pdf_document *doc, pdf_write_state *opts, int xref_len)
+{
+	int *members;
+	int i, n = 0, num, stm = 0;
+
+	members = fz_malloc_array(ctx, xref_len, int);
+	fz_try(ctx)
+	{
+		for (num = 1; num < xref_len; num++)
+			if (can_use_objstm(ctx, doc, opts, num))
+				members[n++] = num;
+
+		expand_lists(ctx, opts, pdf_xref_len(ctx, doc) + (n + OBJSTM_MAXOBJS - 1) / OBJSTM_MAXOBJS);
+
+		for (i = 0; i < n; i++)
+		{
+			if (i % OBJSTM_MAXOBJS == 0)
+			{
+				stm = pdf_create_object(ctx, doc);
+				opts->use_list[stm] = 1;
+				opts->objstm_list[stm] = -1;
+				/* Remember where to start looking for members. */
+				opts->objstm_index[stm] = members[i];
+			}
+			opts->objstm_list[members[i]] = stm;
+			opts->objstm_index[members[i]] = i % OBJSTM_MAXOBJS;
+		}
+	}
+	fz_always(ctx)
+		fz_free(ctx, members);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+static void writeobjstm(fz_context *ctx, pdf_document *doc, pdf_write_state *opts, int stm)
+{
+	fz_buffer *head = NULL;
+	fz_buffer *body = NULL;
+	fz_output *out = NULL;
+	pdf_obj *dict = NULL;
+	pdf_obj *obj = NULL;
+	int num, n = 0;
+	int xref_len = pdf_xref_len(ctx, doc);
+
+	fz_var(head);
+	fz_var(body);
+	fz_var(out);
+	fz_var(dict);
+	fz_var(obj);
+
+	fz_try(ctx)
+	{
+		head = fz_new_buffer(ctx, 1024);
+		body = fz_new_buffer(ctx, 8192);
+		out = fz_new_output_with_buffer(ctx, body);
+
+		/* Members are consecutive in object number order, interleaved
+		 * only with objects that are not in any object stream. */
+		for (num = opts->objstm_index[stm]; num < xref_len; num++)
+		{
+			if (opts->objstm_list[num] == 0)
+				continue;
+			if (opts->objstm_list[num] != stm)
+				break;
+			fz_append_printf(ctx, head, "%d %zu ", num, body->len);
+			obj = pdf_load_object(ctx, doc, num);
+			pdf_print_obj(ctx, out, obj, opts->do_tight, opts->do_ascii);
+			pdf_drop_obj(ctx, obj);
+			obj = NULL;
+			fz_write_byte(ctx, out, '\n');
+			n++;
+		}
+		fz_close_output(ctx, out);
+
+		dict = pdf_new_dict(ctx, doc, 4);
+		pdf_dict_put(ctx, dict, PDF_NAME(Type), PDF_NAME(ObjStm));
+		pdf_dict_put_int(ctx, dict, PDF_NAME(N), n);
+		pdf_dict_put_int(ctx, dict, PDF_NAME(First), head->len);
+		fz_append_buffer(ctx, head, body);
+
+		pdf_update_object(ctx, doc, stm, dict);
+		pdf_update_stream(ctx, doc, dict, head, 0);
+		writeobject(ctx, doc, opts, stm, 0, 1, 0);
+
+		/* Release the contents now they have been written. */
+		pdf_delete_object(ctx, doc, stm);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_output(ctx, out);
+		fz_drop_buffer(ctx, head);
+		fz_drop_buffer(ctx, body);
+		pdf_drop_obj(ctx, dict);
+		pdf_drop_obj(ctx, obj);
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow(ctx);
+	}
+}
+
 static void
 dowriteobject(fz_context *ctx, pdf_document *doc, pdf_write_state *opts, int num, int pass)
 {
-	pdf_xref_entry *entry = pdf_get_xref_entry(ctx, doc, num);
+	pdf_xref_entry *entry;
+
+	if (opts->do_use_objstms && opts->objstm_list[num] != 0)
+	{
+		/* Object streams are written in place of their members. */
+		opts->gen_list[num] = 0;
+		if (opts->objstm_list[num] < 0)
+		{
+			opts->ofs_list[num] = fz_tell_output(ctx, opts->out);
+			writeobjstm(ctx, doc, opts, num);
+		}
+		return;
+	}
+
+	entry = pdf_get_xref_entry(ctx, doc, num);
 	if (entry->type == 'f')
 		opts->gen_list[num] = entry->gen;
 	if (entry->type == 'n')
@@ -2413,6 +3082,8 @@ writeobjects(fz_context *ctx, pdf_document *doc, pdf_write_state *opts, int pass
 	if (!opts->do_incremental)
 	{
 		int version = pdf_version(ctx, doc);
+		if (opts->do_use_objstms && version < 15)
+			version = 15;
 		fz_write_printf(ctx, opts->out, "%%PDF-%d.%d\n", version / 10, version % 10);
 		fz_write_string(ctx, opts->out, "%\xC2\xB5\xC2\xB6\n\n");
 	}
@@ -2429,6 +3100,7 @@ writeobjects(fz_context *ctx, pdf_document *doc, pdf_write_state *opts, int pass
 		writexref(ctx, doc, opts, opts->start, pdf_xref_len(ctx, doc), 1, opts->main_xref_offset, 0);
 	}
 
+	compress_ahead(ctx, opts, opts->start+1, xref_len);
 	for (num = opts->start+1; num < xref_len; num++)
 		dowriteobject(ctx, doc, opts, num, pass);
 	if (opts->do_linear && pass == 1)
@@ -2436,12 +3108,14 @@ writeobjects(fz_context *ctx, pdf_document *doc, pdf_write_state *opts, int pass
 		int64_t offset = (opts->start == 1 ? opts->main_xref_offset : opts->ofs_list[1] + opts->hintstream_len);
 		padto(ctx, opts->out, offset);
 	}
+	compress_ahead(ctx, opts, 1, opts->start);
 	for (num = 1; num < opts->start; num++)
 	{
 		if (pass == 1)
 			opts->ofs_list[num] += opts->hintstream_len;
 		dowriteobject(ctx, doc, opts, num, pass);
 	}
+	compress_ahead(ctx, opts, 0, 0);
 }
 
 static int
@@ -2979,6 +3653,8 @@ static void initialise_write_state(fz_context *ctx, pdf_document *doc, const pdf
 	opts->do_linear = in_opts->do_linear;
 	opts->do_clean = in_opts->do_clean;
 	opts->do_encrypt = in_opts->do_encrypt;
+	opts->do_use_objstms = in_opts->do_use_objstms;
+	opts->compress_threads = in_opts->compress_threads;
 	opts->start = 0;
 	opts->main_xref_offset = INT_MIN;
 
@@ -2995,8 +3671,16 @@ static void initialise_write_state(fz_context *ctx, pdf_document *doc, const pdf
 	opts->gen_list = NULL;
 	opts->renumber_map = NULL;
 	opts->rev_renumber_map = NULL;
+	opts->objstm_list = NULL;
+	opts->objstm_index = NULL;
+	opts->compressor = NULL;
 
 	expand_lists(ctx, opts, xref_len);
+
+	if (opts->compress_threads > MAX_COMPRESS_THREADS)
+		opts->compress_threads = MAX_COMPRESS_THREADS;
+	if (opts->compress_threads > 0)
+		opts->compressor = new_compressor(ctx, opts->compress_threads);
 }
 
 /* Free the resources held by the dynamic write options */
@@ -3007,6 +3691,9 @@ static void finalise_write_state(fz_context *ctx, pdf_write_state *opts)
 	fz_free(ctx, opts->gen_list);
 	fz_free(ctx, opts->renumber_map);
 	fz_free(ctx, opts->rev_renumber_map);
+	fz_free(ctx, opts->objstm_list);
+	fz_free(ctx, opts->objstm_index);
+	drop_compressor(ctx, opts->compressor);
 	pdf_drop_obj(ctx, opts->linear_l);
 	pdf_drop_obj(ctx, opts->linear_h0);
 	pdf_drop_obj(ctx, opts->linear_h1);
@@ -3036,6 +3723,8 @@ const pdf_write_options pdf_default_write_options = {
 	~0, /* permissions */
 	"", /* opwd_utf8[128] */
 	"", /* upwd_utf8[128] */
+	0, /* do_use_objstms */
+	0, /* compress_threads */
 };
 
 const char *fz_pdf_write_options_usage =
@@ -3051,6 +3740,8 @@ const char *fz_pdf_write_options_usage =
 	"\tsanitize: sanitize graphics commands in content streams\n"
 	"\tgarbage: garbage collect unused objects\n"
 	"\tincremental: write changes as incremental update\n"
+	"\tobjstms: use object streams and cross reference streams\n"
+	"\tcompress-threads=NUMBER: number of threads to compress streams on (at most 64)\n"
 	"\tcontinue-on-error: continue saving the document even if there is an error\n"
 	"\tor garbage=compact: ... and compact cross reference table\n"
 	"\tor garbage=deduplicate: ... and remove duplicate objects\n"
@@ -3088,6 +3779,10 @@ pdf_parse_write_options(fz_context *ctx, pdf_write_options *opts, const char *ar
 		opts->do_sanitize = fz_option_eq(val, "yes");
 	if (fz_has_option(ctx, args, "incremental", &val))
 		opts->do_incremental = fz_option_eq(val, "yes");
+	if (fz_has_option(ctx, args, "objstms", &val))
+		opts->do_use_objstms = fz_option_eq(val, "yes");
+	if (fz_has_option(ctx, args, "compress-threads", &val))
+		opts->compress_threads = fz_atoi(val);
 	if (fz_has_option(ctx, args, "decrypt", &val))
 		opts->do_encrypt = fz_option_eq(val, "yes") ? PDF_ENCRYPT_NONE : PDF_ENCRYPT_KEEP;
 	if (fz_has_option(ctx, args, "encrypt", &val))
@@ -3420,6 +4115,12 @@ do_pdf_save_document(fz_context *ctx, pdf_document *doc, pdf_write_state *opts,
 		if (opts->do_linear)
 			linearize(ctx, doc, opts);
 
+		if (opts->do_use_objstms)
+		{
+			build_objstms(ctx, doc, opts, xref_len);
+			xref_len = pdf_xref_len(ctx, doc);
+		}
+
 		if (opts->do_incremental)
 		{
 			int i;
@@ -3502,7 +4203,10 @@ do_pdf_save_document(fz_context *ctx, pdf_document *doc, pdf_write_state *opts,
 			else
 			{
 				opts->first_xref_offset = fz_tell_output(ctx, opts->out);
-				writexref(ctx, doc, opts, 0, xref_len, 1, 0, opts->first_xref_offset);
+				if (opts->do_use_objstms)
+					writexrefstream(ctx, doc, opts, 0, xref_len, 1, 0, opts->first_xref_offset);
+				else
+					writexref(ctx, doc, opts, 0, xref_len, 1, 0, opts->first_xref_offset);
 			}
 
 			doc->xref_sections[0].end_ofs = fz_tell_output(ctx, opts->out);
@@ -3561,6 +4265,10 @@ void pdf_write_document(fz_context *ctx, pdf_document *doc, fz_output *out, pdf_
 		fz_throw(ctx, FZ_ERROR_GENERIC, "Can't do incremental writes with linearisation");
 	if (in_opts->do_incremental && in_opts->do_encrypt != PDF_ENCRYPT_KEEP)
 		fz_throw(ctx, FZ_ERROR_GENERIC, "Can't do incremental writes when changing encryption");
+	if (in_opts->do_incremental && in_opts->do_use_objstms)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "Can't do incremental writes with object streams");
+	if (in_opts->do_linear && in_opts->do_use_objstms)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "Can't use object streams with linearisation");
 	if (pdf_has_unsaved_sigs(ctx, doc) && !fz_output_supports_stream(ctx, out))
 		fz_throw(ctx, FZ_ERROR_GENERIC, "Can't write pdf that has unsaved sigs to a fz_output unless it supports fz_stream_from_output!");
 
@@ -3592,6 +4300,10 @@ void pdf_save_document(fz_context *ctx, pdf_document *doc, const char *filename,
 		fz_throw(ctx, FZ_ERROR_GENERIC, "Can't do incremental writes with linearisation");
 	if (in_opts->do_incremental && in_opts->do_encrypt != PDF_ENCRYPT_KEEP)
 		fz_throw(ctx, FZ_ERROR_GENERIC, "Can't do incremental writes when changing encryption");
+	if (in_opts->do_incremental && in_opts->do_use_objstms)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "Can't do incremental writes with object streams");
+	if (in_opts->do_linear && in_opts->do_use_objstms)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "Can't use object streams with linearisation");
 
 	if (in_opts->do_appearance > 0)
 	{
@@ -3677,6 +4389,14 @@ pdf_format_write_options(fz_context *ctx, char *buffer, size_t buffer_len, const
 		ADD_OPT("sanitize=yes");
 	if (opts->do_incremental)
 		ADD_OPT("incremental=yes");
+	if (opts->do_use_objstms)
+		ADD_OPT("objstms=yes");
+	if (opts->compress_threads > 0)
+	{
+		char threads[40];
+		fz_snprintf(threads, sizeof threads, "compress-threads=%d", opts->compress_threads);
+		ADD_OPT(threads);
+	}
 	if (opts->do_encrypt == PDF_ENCRYPT_NONE)
 		ADD_OPT("decrypt=yes");
 	else if (opts->do_encrypt == PDF_ENCRYPT_KEEP)
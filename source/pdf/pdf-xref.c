@@ -511,6 +511,8 @@ void pdf_replace_xref(fz_context *ctx, pdf_document *doc, pdf_xref_entry *entrie
 	fz_var(xref_index);
 	fz_var(xref);
 
+	pdf_invalidate_page_map(ctx, doc, 0);
+
 	fz_try(ctx)
 	{
 		xref_index = fz_calloc(ctx, n, sizeof(int));
@@ -550,6 +552,8 @@ void pdf_forget_xref(fz_context *ctx, pdf_document *doc)
 {
 	pdf_obj *trailer = pdf_keep_obj(ctx, pdf_trailer(ctx, doc));
 
+	pdf_invalidate_page_map(ctx, doc, 0);
+
 	if (doc->saved_xref_sections)
 		pdf_drop_xref_sections_imp(ctx, doc, doc->saved_xref_sections, doc->saved_num_xref_sections);
 
@@ -1373,22 +1377,423 @@ pdf_load_linear(fz_context *ctx, pdf_document *doc)
 	}
 }
 
+/*
+ * accelerator data
+ *
+ * The xref sections as loaded (or repaired) from the file, followed by
+ * where each page is in the page tree, so that opening the same file
+ * again need not read through them all. The file is recognised by its
+ * length, where it says its last xref is, and a digest of its final
+ * bytes (which hold the trailer and its ID in files with old style
+ * xrefs; files with xref streams have the ID checked too).
+ */
+
+#define MAGIC_ACCELERATOR 0xacce1e7a
+#define MAGIC_ACCEL_PDF   0x66645070
+#define ACCEL_VERSION     0x00010002
+
+typedef struct
+{
+	int64_t file_size;
+	int64_t startxref;
+	unsigned char digest[16];
+} pdf_accel_key;
+
+static void
+pdf_read_accel_key(fz_context *ctx, pdf_document *doc, pdf_accel_key *key)
+{
+	unsigned char buf[1024];
+	fz_md5 md5;
+	size_t n;
+
+	fz_seek(ctx, doc->file, 0, SEEK_END);
+	key->file_size = fz_tell(ctx, doc->file);
+	fz_seek(ctx, doc->file, fz_maxi64(0, key->file_size - (int64_t)sizeof buf), SEEK_SET);
+	n = fz_read(ctx, doc->file, buf, sizeof buf);
+	fz_md5_init(&md5);
+	fz_md5_update(&md5, buf, n);
+	fz_md5_final(&md5, key->digest);
+
+	/* Files that needed repairing may not have one. */
+	fz_try(ctx)
+	{
+		pdf_read_start_xref(ctx, doc);
+		key->startxref = doc->startxref;
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow_if(ctx, FZ_ERROR_TRYLATER);
+		key->startxref = 0;
+	}
+}
+
+/* Check the ID of a file whose last xref is a stream, as that need not
+ * be among the final bytes of the file. */
+static int
+pdf_accel_id_matches(fz_context *ctx, pdf_document *doc, int64_t startxref, pdf_obj *trailer)
+{
+	pdf_obj *dict;
+	int num, gen, match;
+	int64_t stm_ofs;
+
+	fz_seek(ctx, doc->file, startxref, SEEK_SET);
+	fz_skip_space(ctx, doc->file);
+	if (fz_peek_byte(ctx, doc->file) == 'x')
+		return 1;
+
+	dict = pdf_parse_ind_obj(ctx, doc, doc->file, &doc->lexbuf.base, &num, &gen, &stm_ofs, NULL);
+	match = !pdf_objcmp(ctx, pdf_dict_get(ctx, dict, PDF_NAME(ID)), pdf_dict_get(ctx, trailer, PDF_NAME(ID)));
+	pdf_drop_obj(ctx, dict);
+	return match;
+}
+
+static void
+read_accel_data(fz_context *ctx, fz_stream *accel, unsigned char *data, size_t n)
+{
+	if (fz_read(ctx, accel, data, n) != n)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "truncated accelerator");
+}
+
+static inline uint32_t get_uint32_le(const unsigned char *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline int64_t get_int64_le(const unsigned char *p)
+{
+	return (int64_t)(get_uint32_le(p) | ((uint64_t)get_uint32_le(p + 4) << 32));
+}
+
+static inline void put_uint32_le(unsigned char *p, uint32_t x)
+{
+	p[0] = x;
+	p[1] = x >> 8;
+	p[2] = x >> 16;
+	p[3] = x >> 24;
+}
+
+static inline void put_int64_le(unsigned char *p, int64_t x)
+{
+	put_uint32_le(p, (uint32_t)x);
+	put_uint32_le(p + 4, (uint32_t)((uint64_t)x >> 32));
+}
+
+enum
+{
+	/* type, gen, num, ofs and stm_ofs */
+	ACCEL_ENTRY_SIZE = 1 + 2 + 4 + 8 + 8,
+	ACCEL_ENTRY_CHUNK = 256
+};
+
+static void
+write_int64_le(fz_context *ctx, fz_output *out, int64_t x)
+{
+	fz_write_uint32_le(ctx, out, (unsigned int)x);
+	fz_write_uint32_le(ctx, out, (unsigned int)((uint64_t)x >> 32));
+}
+
+static void
+write_accel_obj(fz_context *ctx, fz_output *out, pdf_obj *obj)
+{
+	char buf[1024];
+	char *ptr;
+	size_t n;
+
+	if (obj == NULL)
+	{
+		fz_write_int32_le(ctx, out, 0);
+		return;
+	}
+
+	ptr = pdf_sprint_obj(ctx, buf, sizeof buf, &n, obj, 1, 0);
+	fz_try(ctx)
+	{
+		fz_write_int32_le(ctx, out, (int)n);
+		fz_write_data(ctx, out, ptr, n);
+	}
+	fz_always(ctx)
+		if (ptr != buf)
+			fz_free(ctx, ptr);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+static pdf_obj *
+read_accel_obj(fz_context *ctx, pdf_document *doc, fz_stream *accel)
+{
+	int n = fz_read_int32_le(ctx, accel);
+	unsigned char *data;
+	fz_stream *stm = NULL;
+	pdf_obj *obj = NULL;
+
+	if (n == 0)
+		return NULL;
+	if (n < 0 || n > (1<<24))
+		fz_throw(ctx, FZ_ERROR_GENERIC, "bad object in accelerator");
+
+	data = fz_malloc(ctx, n);
+
+	fz_var(stm);
+
+	fz_try(ctx)
+	{
+		read_accel_data(ctx, accel, data, n);
+		stm = fz_open_memory(ctx, data, n);
+		obj = pdf_parse_stm_obj(ctx, doc, stm, &doc->lexbuf.base);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_stream(ctx, stm);
+		fz_free(ctx, data);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	if (!pdf_is_dict(ctx, obj))
+	{
+		pdf_drop_obj(ctx, obj);
+		fz_throw(ctx, FZ_ERROR_GENERIC, "bad trailer in accelerator");
+	}
+
+	return obj;
+}
+
+static void
+read_accel_xref(fz_context *ctx, pdf_document *doc, fz_stream *accel, pdf_xref *xref, int64_t file_size)
+{
+	unsigned char buf[ACCEL_ENTRY_CHUNK * ACCEL_ENTRY_SIZE];
+	pdf_xref_subsec **tail = &xref->subsec;
+	int i, j, k, n;
+
+	xref->num_objects = fz_read_int32_le(ctx, accel);
+	if (xref->num_objects < 0 || xref->num_objects > PDF_MAX_OBJECT_NUMBER + 1)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "bad xref in accelerator");
+	xref->end_ofs = fz_read_int64_le(ctx, accel);
+	xref->trailer = read_accel_obj(ctx, doc, accel);
+	xref->pre_repair_trailer = read_accel_obj(ctx, doc, accel);
+
+	n = fz_read_int32_le(ctx, accel);
+	if (n < 0)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "bad xref in accelerator");
+	for (k = 0; k < n; k++)
+	{
+		pdf_xref_subsec *sub = fz_malloc_struct(ctx, pdf_xref_subsec);
+		*tail = sub;
+		tail = &sub->next;
+
+		sub->start = fz_read_int32_le(ctx, accel);
+		sub->len = fz_read_int32_le(ctx, accel);
+		if (sub->start < 0 || sub->len < 0 || sub->len > xref->num_objects - sub->start)
+		{
+			sub->len = 0;
+			fz_throw(ctx, FZ_ERROR_GENERIC, "bad xref in accelerator");
+		}
+		sub->table = fz_malloc_array(ctx, sub->len, pdf_xref_entry);
+		memset(sub->table, 0, sub->len * sizeof(pdf_xref_entry));
+
+		for (i = 0; i < sub->len; i += ACCEL_ENTRY_CHUNK)
+		{
+			int m = fz_mini(sub->len - i, ACCEL_ENTRY_CHUNK);
+			read_accel_data(ctx, accel, buf, (size_t)m * ACCEL_ENTRY_SIZE);
+			for (j = 0; j < m; j++)
+			{
+				pdf_xref_entry *entry = &sub->table[i + j];
+				unsigned char *p = &buf[j * ACCEL_ENTRY_SIZE];
+				entry->type = p[0];
+				entry->gen = p[1] | (p[2] << 8);
+				entry->num = (int)get_uint32_le(p + 3);
+				entry->ofs = get_int64_le(p + 7);
+				entry->stm_ofs = get_int64_le(p + 15);
+				if (entry->type != 0 && entry->type != 'f' && entry->type != 'n' && entry->type != 'o')
+					fz_throw(ctx, FZ_ERROR_GENERIC, "bad xref entry in accelerator");
+				if (entry->type == 'n' && (entry->ofs < 0 || entry->ofs >= file_size))
+					fz_throw(ctx, FZ_ERROR_GENERIC, "bad xref entry in accelerator");
+				if (entry->type == 'o' && (entry->ofs <= 0 || entry->ofs > PDF_MAX_OBJECT_NUMBER))
+					fz_throw(ctx, FZ_ERROR_GENERIC, "bad xref entry in accelerator");
+			}
+		}
+	}
+}
+
+static void
+drop_accelerated_xref(fz_context *ctx, pdf_document *doc)
+{
+	pdf_drop_xref_sections(ctx, doc);
+	if (doc->xref_index)
+		memset(doc->xref_index, 0, sizeof(int) * doc->max_xref_len);
+}
+
+/* Load the xref sections from the accelerator, if it was made for this
+ * file, returning 0 (with nothing loaded) if it cannot be used. Errors
+ * other than a bad accelerator are passed on. */
+static int
+pdf_load_accelerator(fz_context *ctx, pdf_document *doc, fz_stream *accel)
+{
+	pdf_accel_key key;
+	int64_t file_size, startxref;
+	unsigned char digest[16];
+	int has_xref_streams, has_old_style_xrefs, repaired;
+	int i, n, len;
+	int ok = 0;
+
+	fz_try(ctx)
+	{
+		if (fz_read_int32_le(ctx, accel) != (int32_t)MAGIC_ACCELERATOR)
+			break;
+		if (fz_read_int32_le(ctx, accel) != MAGIC_ACCEL_PDF)
+			break;
+		if (fz_read_int32_le(ctx, accel) != ACCEL_VERSION)
+			break;
+
+		file_size = fz_read_int64_le(ctx, accel);
+		startxref = fz_read_int64_le(ctx, accel);
+		read_accel_data(ctx, accel, digest, sizeof digest);
+		pdf_read_accel_key(ctx, doc, &key);
+		if (key.file_size != file_size || key.startxref != startxref || memcmp(key.digest, digest, sizeof digest))
+			break;
+
+		has_xref_streams = fz_read_int32_le(ctx, accel);
+		has_old_style_xrefs = fz_read_int32_le(ctx, accel);
+		repaired = fz_read_int32_le(ctx, accel);
+
+		n = fz_read_int32_le(ctx, accel);
+		if (n <= 0 || n > 65536)
+			break;
+		len = 0;
+		for (i = 0; i < n; i++)
+		{
+			pdf_populate_next_xref_level(ctx, doc);
+			read_accel_xref(ctx, doc, accel, &doc->xref_sections[i], file_size);
+			len = fz_maxi(len, doc->xref_sections[i].num_objects);
+		}
+		if (len == 0 || !doc->xref_sections[0].trailer)
+			break;
+
+		if (!repaired && !pdf_accel_id_matches(ctx, doc, startxref, doc->xref_sections[0].trailer))
+			break;
+
+		if (doc->max_xref_len < len)
+			extend_xref_index(ctx, doc, len);
+		pdf_prime_xref_index(ctx, doc);
+
+		doc->file_size = file_size;
+		doc->startxref = startxref;
+		doc->has_xref_streams = has_xref_streams;
+		doc->has_old_style_xrefs = has_old_style_xrefs;
+		doc->repair_attempted = repaired;
+		ok = 1;
+	}
+	fz_catch(ctx)
+	{
+		/* Running out of memory, or needing more of the file, would
+		 * happen just the same when loading the file as usual, so
+		 * only a bad or stale accelerator is ignored. */
+		if (fz_caught(ctx) == FZ_ERROR_TRYLATER || fz_caught(ctx) == FZ_ERROR_MEMORY)
+		{
+			drop_accelerated_xref(ctx, doc);
+			fz_rethrow(ctx);
+		}
+		fz_warn(ctx, "ignoring accelerator: %s", fz_caught_message(ctx));
+	}
+
+	if (!ok)
+		drop_accelerated_xref(ctx, doc);
+
+	return ok;
+}
+
+static void
+pdf_output_accelerator(fz_context *ctx, fz_document *doc_, fz_output *out)
+{
+	pdf_document *doc = (pdf_document*)doc_;
+	unsigned char buf[ACCEL_ENTRY_CHUNK * ACCEL_ENTRY_SIZE];
+	pdf_accel_key key;
+	int x, i, j;
+
+	fz_try(ctx)
+	{
+		if (!doc->file || doc->file_reading_linearly)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "No accelerator data to write");
+
+		pdf_read_accel_key(ctx, doc, &key);
+
+		fz_write_int32_le(ctx, out, MAGIC_ACCELERATOR);
+		fz_write_int32_le(ctx, out, MAGIC_ACCEL_PDF);
+		fz_write_int32_le(ctx, out, ACCEL_VERSION);
+		write_int64_le(ctx, out, key.file_size);
+		write_int64_le(ctx, out, key.startxref);
+		fz_write_data(ctx, out, key.digest, sizeof key.digest);
+
+		fz_write_int32_le(ctx, out, doc->has_xref_streams);
+		fz_write_int32_le(ctx, out, doc->has_old_style_xrefs);
+		fz_write_int32_le(ctx, out, doc->repair_attempted);
+
+		/* Only the sections read from the file; not any changes made since. */
+		fz_write_int32_le(ctx, out, doc->num_xref_sections - doc->num_incremental_sections);
+		for (x = doc->num_incremental_sections; x < doc->num_xref_sections; x++)
+		{
+			pdf_xref *xref = &doc->xref_sections[x];
+			pdf_xref_subsec *sub;
+
+			fz_write_int32_le(ctx, out, xref->num_objects);
+			write_int64_le(ctx, out, xref->end_ofs);
+			write_accel_obj(ctx, out, xref->trailer);
+			write_accel_obj(ctx, out, xref->pre_repair_trailer);
+
+			i = 0;
+			for (sub = xref->subsec; sub != NULL; sub = sub->next)
+				i++;
+			fz_write_int32_le(ctx, out, i);
+			for (sub = xref->subsec; sub != NULL; sub = sub->next)
+			{
+				fz_write_int32_le(ctx, out, sub->start);
+				fz_write_int32_le(ctx, out, sub->len);
+				for (i = 0; i < sub->len; i += ACCEL_ENTRY_CHUNK)
+				{
+					int m = fz_mini(sub->len - i, ACCEL_ENTRY_CHUNK);
+					for (j = 0; j < m; j++)
+					{
+						pdf_xref_entry *entry = &sub->table[i + j];
+						unsigned char *p = &buf[j * ACCEL_ENTRY_SIZE];
+						p[0] = entry->type;
+						p[1] = entry->gen;
+						p[2] = entry->gen >> 8;
+						put_uint32_le(p + 3, entry->num);
+						put_int64_le(p + 7, entry->ofs);
+						put_int64_le(p + 15, entry->stm_ofs);
+					}
+					fz_write_data(ctx, out, buf, (size_t)m * ACCEL_ENTRY_SIZE);
+				}
+			}
+		}
+
+		pdf_write_page_map(ctx, doc, out);
+
+		fz_close_output(ctx, out);
+	}
+	fz_always(ctx)
+		fz_drop_output(ctx, out);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
 /*
  * Initialize and load xref tables.
  * If password is not null, try to decrypt.
  */
 
 static void
-pdf_init_document(fz_context *ctx, pdf_document *doc)
+pdf_init_document(fz_context *ctx, pdf_document *doc, fz_stream *accel)
 {
 	pdf_obj *encrypt, *id;
 	pdf_obj *dict = NULL;
 	pdf_obj *obj;
 	pdf_obj *nobj = NULL;
-	int i, repaired = 0;
+	int i, repaired = 0, accelerated = 0;
 
 	fz_var(dict);
 	fz_var(nobj);
+	fz_var(accelerated);
 
 	fz_try(ctx)
 	{
@@ -1410,15 +1815,20 @@ pdf_init_document(fz_context *ctx, pdf_document *doc)
 		if (doc->file_reading_linearly)
 			pdf_load_linear(ctx, doc);
 		else
+		{
 			/* Even if we're not in progressive mode, check to see
 			 * if the file claims to be linearized. This is important
 			 * for checking signatures later on. */
 			pdf_check_linear(ctx, doc);
 
+			if (accel && pdf_load_accelerator(ctx, doc, accel))
+				accelerated = 1;
+		}
+
 		/* If we aren't in progressive mode (or the linear load failed
 		 * and has set us back to non-progressive mode), load normally.
 		 */
-		if (!doc->file_reading_linearly)
+		if (!doc->file_reading_linearly && !accelerated)
 			pdf_load_xref(ctx, doc, &doc->lexbuf.base);
 	}
 	fz_catch(ctx)
@@ -1450,6 +1860,11 @@ pdf_init_document(fz_context *ctx, pdf_document *doc)
 		/* Allow lazy clients to read encrypted files with a blank password */
 		pdf_authenticate_password(ctx, doc, "");
 
+		/* What follows in the accelerator is where the pages are,
+		 * which can only be checked once objects can be read. */
+		if (accelerated && !pdf_needs_password(ctx, doc))
+			pdf_read_page_map(ctx, doc, accel);
+
 		if (repaired)
 		{
 			int xref_len = pdf_xref_len(ctx, doc);
@@ -1609,6 +2024,9 @@ pdf_drop_document_imp(fz_context *ctx, pdf_document *doc)
 	fz_free(ctx, doc->orphans);
 
 	fz_free(ctx, doc->rev_page_map);
+	pdf_invalidate_page_map(ctx, doc, 0);
+
+	pdf_disable_obj_arenas(ctx, doc);
 
 	fz_defer_reap_end(ctx);
 
@@ -2212,6 +2630,8 @@ pdf_delete_object(fz_context *ctx, pdf_document *doc, int num)
 		return;
 	}
 
+	pdf_invalidate_page_map(ctx, doc, num);
+
 	x = pdf_get_incremental_xref_entry(ctx, doc, num);
 
 	fz_drop_buffer(ctx, x->stm_buf);
@@ -2243,6 +2663,8 @@ pdf_update_object(fz_context *ctx, pdf_document *doc, int num, pdf_obj *newobj)
 		return;
 	}
 
+	pdf_invalidate_page_map(ctx, doc, num);
+
 	x = pdf_get_incremental_xref_entry(ctx, doc, num);
 
 	pdf_drop_obj(ctx, x->obj);
@@ -2359,6 +2781,7 @@ pdf_new_document(fz_context *ctx, fz_stream *file)
 	doc->super.count_pages = pdf_count_pages_imp;
 	doc->super.load_page = pdf_load_page_imp;
 	doc->super.lookup_metadata = (fz_document_lookup_metadata_fn*)pdf_lookup_metadata;
+	doc->super.output_accelerator = pdf_output_accelerator;
 
 	pdf_lexbuf_init(ctx, &doc->lexbuf.base, PDF_LEXBUF_LARGE);
 	doc->file = fz_keep_stream(ctx, file);
@@ -2367,12 +2790,12 @@ pdf_new_document(fz_context *ctx, fz_stream *file)
 }
 
 pdf_document *
-pdf_open_document_with_stream(fz_context *ctx, fz_stream *file)
+pdf_open_accel_document_with_stream(fz_context *ctx, fz_stream *file, fz_stream *accel)
 {
 	pdf_document *doc = pdf_new_document(ctx, file);
 	fz_try(ctx)
 	{
-		pdf_init_document(ctx, doc);
+		pdf_init_document(ctx, doc, accel);
 	}
 	fz_catch(ctx)
 	{
@@ -2387,22 +2810,39 @@ pdf_open_document_with_stream(fz_context *ctx, fz_stream *file)
 }
 
 pdf_document *
-pdf_open_document(fz_context *ctx, const char *filename)
+pdf_open_document_with_stream(fz_context *ctx, fz_stream *file)
+{
+	return pdf_open_accel_document_with_stream(ctx, file, NULL);
+}
+
+pdf_document *
+pdf_open_accel_document(fz_context *ctx, const char *filename, const char *accel)
 {
 	fz_stream *file = NULL;
+	fz_stream *afile = NULL;
 	pdf_document *doc = NULL;
 
 	fz_var(file);
+	fz_var(afile);
 	fz_var(doc);
 
 	fz_try(ctx)
 	{
 		file = fz_open_file(ctx, filename);
+		if (accel)
+		{
+			/* A missing accelerator just means a slower open. */
+			fz_try(ctx)
+				afile = fz_open_file(ctx, accel);
+			fz_catch(ctx)
+				fz_warn(ctx, "cannot open accelerator: %s", accel);
+		}
 		doc = pdf_new_document(ctx, file);
-		pdf_init_document(ctx, doc);
+		pdf_init_document(ctx, doc, afile);
 	}
 	fz_always(ctx)
 	{
+		fz_drop_stream(ctx, afile);
 		fz_drop_stream(ctx, file);
 	}
 	fz_catch(ctx)
@@ -2413,6 +2853,12 @@ pdf_open_document(fz_context *ctx, const char *filename)
 	return doc;
 }
 
+pdf_document *
+pdf_open_document(fz_context *ctx, const char *filename)
+{
+	return pdf_open_accel_document(ctx, filename, NULL);
+}
+
 static void
 pdf_load_hints(fz_context *ctx, pdf_document *doc, int objnum)
 {
@@ -2881,8 +3327,8 @@ fz_document_handler pdf_document_handler =
 	(fz_document_open_with_stream_fn*)pdf_open_document_with_stream,
 	pdf_extensions,
 	pdf_mimetypes,
-	NULL,
-	NULL
+	(fz_document_open_accel_fn*)pdf_open_accel_document,
+	(fz_document_open_accel_with_stream_fn*)pdf_open_accel_document_with_stream
 };
 
 void pdf_mark_xref(fz_context *ctx, pdf_document *doc)
@@ -265,25 +265,6 @@ static fz_locks_context *init_mudraw_locks(void)
 
 #endif
 
-typedef struct worker_t {
-	fz_context *ctx;
-	int num;
-	int band; /* -1 to shutdown, or band to render */
-	int error;
-	int running; /* set to 1 by main thread when it thinks the worker is running, 0 when it thinks it is not running */
-	fz_display_list *list;
-	fz_matrix ctm;
-	fz_rect tbounds;
-	fz_pixmap *pix;
-	fz_bitmap *bit;
-	fz_cookie cookie;
-#ifndef DISABLE_MUTHREADS
-	mu_semaphore start;
-	mu_semaphore stop;
-	mu_thread thread;
-#endif
-} worker_t;
-
 static char *output = NULL;
 static fz_output *out = NULL;
 static int output_pagenum = 0;
@@ -305,10 +286,14 @@ static float layout_em = FZ_DEFAULT_LAYOUT_EM;
 static char *layout_css = NULL;
 static int layout_use_doc_css = 1;
 static float min_line_width = 0.0f;
+static size_t glyph_cache_size = 0;
+static int glyph_cache_max_glyph = 0;
 
 static int showfeatures = 0;
 static int showtime = 0;
 static int showmemory = 0;
+static int showstore = 0;
+static fz_store_policy store_policy = FZ_STORE_POLICY_LRU;
 static int showmd5 = 0;
 
 #if FZ_ENABLE_PDF
@@ -344,7 +329,7 @@ static int useaccel = 1;
 static char *filename;
 static int files = 0;
 static int num_workers = 0;
-static worker_t *workers;
+static fz_render_threads *render_threads = NULL;
 static fz_band_writer *bander = NULL;
 
 static const char *layer_config = NULL;
@@ -408,6 +393,9 @@ static void usage(void)
 		"\t\tt - show timings\n"
 		"\t\tf - show page features\n"
 		"\t\t5 - show md5 checksum of rendered image\n"
+		"\t\ts - show resource store statistics\n"
+		"\t-E -\tresource store eviction policy: lru (default) or gds\n"
+		"\t\t(keep items that are costly to recreate for longer)\n"
 		"\n"
 		"\t-R -\trotate clockwise (default: 0 degrees)\n"
 		"\t-r -\tresolution in dpi (default: 72)\n"
@@ -416,7 +404,9 @@ static void usage(void)
 		"\t-f -\tfit width and/or height exactly; ignore original aspect ratio\n"
 		"\t-B -\tmaximum band_height (pXm, pcl, pclm, ocr.pdf, ps, psd and png output only)\n"
 #ifndef DISABLE_MUTHREADS
-		"\t-T -\tnumber of threads to use for rendering (banded mode only)\n"
+		"\t-T -\tnumber of threads to use for rendering (banded mode only),\n"
+		"\t\tand for other work that can be split up (such as repairs\n"
+		"\t\tand image scaling)\n"
 #else
 		"\t-T -\tnumber of threads to use for rendering (disabled in this non-threading build)\n"
 #endif
@@ -436,6 +426,8 @@ static void usage(void)
 		"\t-A -\tnumber of bits of antialiasing (0 to 8)\n"
 		"\t-A -/-\tnumber of bits of antialiasing (0 to 8) (graphics, text)\n"
 		"\t-l -\tminimum stroked line width (in pixels)\n"
+		"\t-g -\tglyph cache size (in bytes, default 1MB)\n"
+		"\t-g -/-\tglyph cache size, and largest glyph cached (in pixels, default 256)\n"
 		"\t-D\tdisable use of display list\n"
 		"\t-i\tignore errors\n"
 		"\t-L\tlow memory mode (avoid caching, clear objects after each page)\n"
@@ -603,6 +595,42 @@ static void drawband(fz_context *ctx, fz_page *page, fz_display_list *list, fz_m
 	}
 }
 
+static void write_page_header(fz_context *ctx, fz_pixmap *pix, int totalheight)
+{
+	fz_write_header(ctx, bander, pix->w, totalheight, pix->n, pix->alpha, pix->xres, pix->yres, output_pagenum++, pix->colorspace, pix->seps);
+}
+
+typedef struct
+{
+	fz_rect tbounds;
+	int totalheight;
+	fz_pixmap **last;
+} band_info;
+
+static void drawband_threaded(fz_context *ctx, void *arg, fz_display_list *list, fz_render_band *band, fz_cookie *cookie)
+{
+	band_info *info = (band_info *)arg;
+
+	fz_set_pixmap_resolution(ctx, band->pix, resolution, resolution);
+	drawband(ctx, NULL, list, band->ctm, info->tbounds, cookie, band->y, band->pix, &band->bit);
+}
+
+static void writeband_threaded(fz_context *ctx, void *arg, fz_render_band *band)
+{
+	band_info *info = (band_info *)arg;
+
+	if (bander)
+	{
+		if (band->num == 0)
+			write_page_header(ctx, band->pix, info->totalheight);
+		fz_write_band(ctx, bander, band->bit ? band->bit->stride : band->pix->stride, band->h, band->bit ? band->bit->samples : band->pix->samples);
+	}
+
+	/* Hang on to the last band for showmd5. */
+	fz_drop_pixmap(ctx, *info->last);
+	*info->last = fz_keep_pixmap(ctx, band->pix);
+}
+
 static void dodrawpage(fz_context *ctx, fz_page *page, fz_display_list *list, int pagenum, fz_cookie *cookie, int start, int interptime, char *fname, int bg, fz_separations *seps)
 {
 	fz_rect mediabox;
@@ -976,28 +1004,8 @@ static void dodrawpage(fz_context *ctx, fz_page *page, fz_display_list *list, in
 				DEBUG_THREADS(("Using %d Bands\n", bands));
 			}
 
-			if (num_workers > 0)
-			{
-				for (band = 0; band < fz_mini(num_workers, bands); band++)
-				{
-					workers[band].band = band;
-					workers[band].error = 0;
-					workers[band].ctm = ctm;
-					workers[band].tbounds = tbounds;
-					memset(&workers[band].cookie, 0, sizeof(fz_cookie));
-					workers[band].list = list;
-					workers[band].pix = fz_new_pixmap_with_bbox(ctx, colorspace, band_ibounds, seps, alpha);
-					fz_set_pixmap_resolution(ctx, workers[band].pix, resolution, resolution);
-					workers[band].running = 1;
-#ifndef DISABLE_MUTHREADS
-					DEBUG_THREADS(("Worker %d, Pre-triggering band %d\n", band, band));
-					mu_trigger_semaphore(&workers[band].start);
-#endif
-					ctm.f -= drawheight;
-				}
-				pix = workers[0].pix;
-			}
-			else
+			/* With threads, the band pixmaps belong to the renderer. */
+			if (!render_threads)
 			{
 				pix = fz_new_pixmap_with_bbox(ctx, colorspace, band_ibounds, seps, alpha);
 				fz_set_pixmap_resolution(ctx, pix, resolution, resolution);
@@ -1034,32 +1042,26 @@ static void dodrawpage(fz_context *ctx, fz_page *page, fz_display_list *list, in
 					else
 						bander = fz_new_color_pcl_band_writer(ctx, out, NULL);
 				}
-				if (bander)
-				{
-					fz_write_header(ctx, bander, pix->w, totalheight, pix->n, pix->alpha, pix->xres, pix->yres, output_pagenum++, pix->colorspace, pix->seps);
-				}
+				if (bander && pix)
+					write_page_header(ctx, pix, totalheight);
+			}
+
+			if (render_threads)
+			{
+				band_info info;
+
+				info.tbounds = tbounds;
+				info.totalheight = totalheight;
+				info.last = &pix;
+				fz_render_display_list_bands(ctx, render_threads, list, ctm, ibounds,
+					band_ibounds.y1 - band_ibounds.y0, colorspace, seps, alpha,
+					drawband_threaded, writeband_threaded, &info, cookie);
+				bands = 0; /* all drawn and written */
 			}
 
 			for (band = 0; band < bands; band++)
 			{
-				if (num_workers > 0)
-				{
-					worker_t *w = &workers[band % num_workers];
-#ifndef DISABLE_MUTHREADS
-					DEBUG_THREADS(("Waiting for worker %d to complete band %d\n", w->num, band));
-					mu_wait_semaphore(&w->stop);
-#endif
-					w->running = 0;
-					cookie->errors += w->cookie.errors;
-					pix = w->pix;
-					bit = w->bit;
-					w->bit = NULL;
-
-					if (w->error)
-						fz_throw(ctx, FZ_ERROR_GENERIC, "worker %d failed to render band %d", w->num, band);
-				}
-				else
-					drawband(ctx, page, list, ctm, tbounds, cookie, band * band_height, pix, &bit);
+				drawband(ctx, page, list, ctm, tbounds, cookie, band * band_height, pix, &bit);
 
 				if (output)
 				{
@@ -1068,20 +1070,6 @@ static void dodrawpage(fz_context *ctx, fz_page *page, fz_display_list *list, in
 					fz_drop_bitmap(ctx, bit);
 					bit = NULL;
 				}
-
-				if (num_workers > 0 && band + num_workers < bands)
-				{
-					worker_t *w = &workers[band % num_workers];
-					w->band = band + num_workers;
-					w->ctm = ctm;
-					w->tbounds = tbounds;
-					memset(&w->cookie, 0, sizeof(fz_cookie));
-					w->running = 1;
-#ifndef DISABLE_MUTHREADS
-					DEBUG_THREADS(("Triggering worker %d for band %d\n", w->num, w->band));
-					mu_trigger_semaphore(&w->start);
-#endif
-				}
 				ctm.f -= drawheight;
 			}
 
@@ -1110,28 +1098,7 @@ static void dodrawpage(fz_context *ctx, fz_page *page, fz_display_list *list, in
 			}
 			fz_drop_bitmap(ctx, bit);
 			bit = NULL;
-			if (num_workers > 0)
-			{
-				int i;
-				DEBUG_THREADS(("Stopping workers and removing their pixmaps\n"));
-				for (i = 0; i < num_workers; i++)
-				{
-					if (workers[i].running)
-					{
-#ifndef DISABLE_MUTHREADS
-						DEBUG_THREADS(("Waiting on worker %d to finish processing\n", i));
-						mu_wait_semaphore(&workers[i].stop);
-#endif
-						workers[i].running = 0;
-					}
-					else
-						DEBUG_THREADS(("Worker %d not processing anything\n", i));
-					fz_drop_pixmap(ctx, workers[i].pix);
-					workers[i].pix = NULL;
-				}
-			}
-			else
-				fz_drop_pixmap(ctx, pix);
+			fz_drop_pixmap(ctx, pix);
 		}
 		fz_catch(ctx)
 		{
@@ -1279,6 +1246,9 @@ static void drawpage(fz_context *ctx, fz_document *doc, int pagenum)
 				fz_enable_device_hints(ctx, dev, FZ_NO_CACHE);
 			fz_run_page(ctx, page, dev, fz_identity, &cookie);
 			fz_close_device(ctx, dev);
+			/* Each band runs the whole list; let them skip what lies outside. */
+			if (band_height)
+				fz_index_display_list(ctx, list);
 		}
 		fz_always(ctx)
 		{
@@ -1563,36 +1533,6 @@ trace_realloc(void *arg, void *p_, size_t size)
 }
 
 #ifndef DISABLE_MUTHREADS
-static void worker_thread(void *arg)
-{
-	worker_t *me = (worker_t *)arg;
-	int band;
-
-	do
-	{
-		DEBUG_THREADS(("Worker %d waiting\n", me->num));
-		mu_wait_semaphore(&me->start);
-		band = me->band;
-		DEBUG_THREADS(("Worker %d woken for band %d\n", me->num, band));
-		if (band >= 0)
-		{
-			fz_try(me->ctx)
-			{
-				drawband(me->ctx, NULL, me->list, me->ctm, me->tbounds, &me->cookie, band * band_height, me->pix, &me->bit);
-				DEBUG_THREADS(("Worker %d completed band %d\n", me->num, band));
-			}
-			fz_catch(me->ctx)
-			{
-				DEBUG_THREADS(("Worker %d failed on band %d\n", me->num, band));
-				me->error = 1;
-			}
-		}
-		mu_trigger_semaphore(&me->stop);
-	}
-	while (band >= 0);
-	DEBUG_THREADS(("Worker %d shutting down\n", me->num));
-}
-
 static void bgprint_worker(void *arg)
 {
 	fz_cookie cookie = { 0 };
@@ -1742,44 +1682,6 @@ static void apply_layer_config(fz_context *ctx, fz_document *doc, const char *lc
 #endif
 }
 
-static int convert_to_accel_path(fz_context *ctx, char outname[], char *absname, size_t len)
-{
-	char *tmpdir;
-	char *s;
-
-	tmpdir = getenv("TEMP");
-	if (!tmpdir)
-		tmpdir = getenv("TMP");
-	if (!tmpdir)
-		tmpdir = "/var/tmp";
-	if (!fz_is_directory(ctx, tmpdir))
-		tmpdir = "/tmp";
-
-	if (absname[0] == '/' || absname[0] == '\\')
-		++absname;
-
-	s = absname;
-	while (*s) {
-		if (*s == '/' || *s == '\\' || *s == ':')
-			*s = '%';
-		++s;
-	}
-
-	if (fz_snprintf(outname, len, "%s/%s.accel", tmpdir, absname) >= len)
-		return 0;
-	return 1;
-}
-
-static int get_accelerator_filename(fz_context *ctx, char outname[], size_t len, const char *fname)
-{
-	char absname[PATH_MAX];
-	if (!fz_realpath(fname, absname))
-		return 0;
-	if (!convert_to_accel_path(ctx, outname, absname, len))
-		return 0;
-	return 1;
-}
-
 static void save_accelerator(fz_context *ctx, fz_document *doc, const char *fname)
 {
 	char absname[PATH_MAX];
@@ -1788,7 +1690,13 @@ static void save_accelerator(fz_context *ctx, fz_document *doc, const char *fnam
 		return;
 	if (!fz_document_supports_accelerator(ctx, doc))
 		return;
-	if (!get_accelerator_filename(ctx, absname, sizeof(absname), fname))
+#if FZ_ENABLE_PDF
+	/* PDF accelerators are only made when asked for, with mutool accel,
+	 * but are used if they are there. */
+	if (pdf_specifics(ctx, doc))
+		return;
+#endif
+	if (!fz_default_accelerator_filename(ctx, absname, sizeof(absname), fname))
 		return;
 
 	fz_save_accelerator(ctx, doc, absname);
@@ -1812,7 +1720,7 @@ int mudraw_main(int argc, char **argv)
 
 	fz_var(doc);
 
-	while ((c = fz_getopt(argc, argv, "qp:o:F:R:r:w:h:fB:c:e:G:Is:A:DiW:H:S:T:t:U:XLvPl:y:NO:am:")) != -1)
+	while ((c = fz_getopt(argc, argv, "qp:o:F:R:r:w:h:fB:c:e:G:Is:E:A:DiW:H:S:T:t:U:XLvPl:g:y:NO:am:")) != -1)
 	{
 		switch (c)
 		{
@@ -1853,10 +1761,17 @@ int mudraw_main(int argc, char **argv)
 		case 's':
 			if (strchr(fz_optarg, 't')) ++showtime;
 			if (strchr(fz_optarg, 'm')) ++showmemory;
+			if (strchr(fz_optarg, 's')) ++showstore;
 			if (strchr(fz_optarg, 'f')) ++showfeatures;
 			if (strchr(fz_optarg, '5')) ++showmd5;
 			break;
 
+		case 'E':
+			store_policy = fz_lookup_store_policy(fz_optarg);
+			if (strcmp(fz_store_policy_name(store_policy), fz_optarg))
+				usage();
+			break;
+
 		case 'A':
 		{
 			char *sep;
@@ -1870,6 +1785,15 @@ int mudraw_main(int argc, char **argv)
 		}
 		case 'D': uselist = 0; break;
 		case 'l': min_line_width = fz_atof(fz_optarg); break;
+		case 'g':
+		{
+			char *sep;
+			glyph_cache_size = fz_atoi64(fz_optarg);
+			sep = strchr(fz_optarg, '/');
+			if (sep)
+				glyph_cache_max_glyph = atoi(sep+1);
+			break;
+		}
 		case 'i': ignore_errors = 1; break;
 		case 'N': no_icc = 1; break;
 
@@ -1955,6 +1879,9 @@ int mudraw_main(int argc, char **argv)
 		exit(1);
 	}
 
+	fz_set_store_policy(ctx, store_policy);
+	fz_set_glyph_cache_limits(ctx, glyph_cache_size, glyph_cache_max_glyph, 0);
+
 	fz_try(ctx)
 	{
 		if (proof_filename)
@@ -1989,22 +1916,16 @@ int mudraw_main(int argc, char **argv)
 
 		if (num_workers > 0)
 		{
-			int i;
-			int fail = 0;
-			workers = fz_calloc(ctx, num_workers, sizeof(*workers));
-			for (i = 0; i < num_workers; i++)
-			{
-				workers[i].ctx = fz_clone_context(ctx);
-				workers[i].num = i;
-				fail |= mu_create_semaphore(&workers[i].start);
-				fail |= mu_create_semaphore(&workers[i].stop);
-				fail |= mu_create_thread(&workers[i].thread, worker_thread, &workers[i]);
-			}
-			if (fail)
+			fz_thread_pool pool;
+			fz_try(ctx)
+				render_threads = fz_new_render_threads(ctx, num_workers);
+			fz_catch(ctx)
 			{
 				fprintf(stderr, "worker startup failed\n");
 				exit(1);
 			}
+			pool = fz_render_thread_pool(ctx, render_threads);
+			fz_tune_thread_pool(ctx, &pool);
 		}
 #endif /* DISABLE_MUTHREADS */
 
@@ -2293,7 +2214,7 @@ int mudraw_main(int argc, char **argv)
 					if (!useaccel)
 						accel = NULL;
 					/* If there was an accelerator to load, what would it be called? */
-					else if (get_accelerator_filename(ctx, accelpath, sizeof(accelpath), filename))
+					else if (fz_default_accelerator_filename(ctx, accelpath, sizeof(accelpath), filename))
 					{
 						/* Check whether that file exists, and isn't older than
 						 * the document. */
@@ -2368,7 +2289,8 @@ int mudraw_main(int argc, char **argv)
 					if (bgprint.error)
 						fz_throw(ctx, FZ_ERROR_GENERIC, "failed to parse page");
 
-					if (useaccel)
+					/* Don't rewrite an accelerator that is up to date. */
+					if (useaccel && !accel)
 						save_accelerator(ctx, doc, filename);
 				}
 				fz_always(ctx)
@@ -2447,22 +2369,8 @@ int mudraw_main(int argc, char **argv)
 		}
 
 #ifndef DISABLE_MUTHREADS
-		if (num_workers > 0)
-		{
-			int i;
-			DEBUG_THREADS(("Asking workers to shutdown, then destroy their resources\n"));
-			for (i = 0; i < num_workers; i++)
-			{
-				workers[i].band = -1;
-				mu_trigger_semaphore(&workers[i].start);
-				mu_wait_semaphore(&workers[i].stop);
-				mu_destroy_semaphore(&workers[i].start);
-				mu_destroy_semaphore(&workers[i].stop);
-				mu_destroy_thread(&workers[i].thread);
-				fz_drop_context(workers[i].ctx);
-			}
-			fz_free(ctx, workers);
-		}
+		fz_tune_thread_pool(ctx, NULL);
+		fz_drop_render_threads(ctx, render_threads);
 
 		if (bgprint.active)
 		{
@@ -2489,6 +2397,9 @@ int mudraw_main(int argc, char **argv)
 		}
 	}
 
+	if (showstore)
+		fz_print_store_stats(ctx, fz_stderr(ctx));
+
 	fz_drop_context(ctx);
 
 #ifndef DISABLE_MUTHREADS
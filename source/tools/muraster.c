@@ -350,23 +350,6 @@ static fz_locks_context *init_muraster_locks(void)
 #error "Can't have MURASTER_CONFIG_BGPRINT > 0 without having a threading library!"
 #endif
 
-typedef struct worker_t {
-	fz_context *ctx;
-	int started;
-	int status;
-	int num;
-	int band_start; /* -1 to shutdown, or offset of band to render */
-	fz_display_list *list;
-	fz_matrix ctm;
-	fz_rect tbounds;
-	fz_pixmap *pix;
-	fz_bitmap *bit;
-	fz_cookie cookie;
-	mu_semaphore start;
-	mu_semaphore stop;
-	mu_thread thread;
-} worker_t;
-
 static char *output = NULL;
 static fz_output *out = NULL;
 
@@ -389,6 +372,8 @@ static int layout_use_doc_css = 1;
 
 static int showtime = 0;
 static int showmemory = 0;
+static int showstore = 0;
+static fz_store_policy store_policy = FZ_STORE_POLICY_LRU;
 
 static int ignore_errors = 0;
 static int alphabits_text = 8;
@@ -401,7 +386,9 @@ static int errored = 0;
 static fz_colorspace *colorspace;
 static char *filename;
 static int num_workers = 0;
-static worker_t *workers;
+static fz_render_threads *render_threads = NULL;
+
+typedef struct band_info band_info;
 
 typedef struct render_details
 {
@@ -436,9 +423,9 @@ typedef struct render_details
 	 * how many 'min_band_heights' have been safely rendered. */
 	int bands_rendered;
 
-	/* The maximum number of workers we'll try to use. This
-	 * will start at the maximum value, and may drop to 0
-	 * if we have problems with memory. */
+	/* The number of workers we'll try to use. This will
+	 * start at the maximum value, and drop to 0 if we have
+	 * problems with memory (or have no display list). */
 	int num_workers;
 
 	/* The band writer to output the page */
@@ -446,6 +433,17 @@ typedef struct render_details
 
 	/* Number of components in image */
 	int n;
+
+	/* The bands queued on the render threads (if any), started
+	 * as soon as the page is interpreted, and the details the
+	 * threads work from. */
+	fz_render_job *job;
+	band_info *info;
+
+	/* Time spent drawing bands on the render threads, and the
+	 * time taken to write them all out (in microseconds). */
+	int64_t busy;
+	int64_t wall;
 } render_details;
 
 enum
@@ -477,8 +475,26 @@ static struct {
 	int minpage, maxpage;
 	char *minfilename;
 	char *maxfilename;
+	int start;
+	int64_t busy;
 } timing;
 
+/* Without bgprint, a page whose bands are queued on the render threads
+ * is held back here until the next page has been interpreted and
+ * queued in turn. The threads can then go straight on to the bands of
+ * the next page while the last bands of this one are written. */
+typedef struct
+{
+	int active;
+	int pagenum;
+	char *filename;
+	int interptime;
+	fz_cookie cookie;
+	render_details render;
+} pending_page;
+
+static pending_page pending;
+
 #define stringify(A) #A
 
 static void usage(void)
@@ -495,6 +511,9 @@ static void usage(void)
 		"\t-s -\tshow extra information:\n"
 		"\t\tm - show memory use\n"
 		"\t\tt - show timings\n"
+		"\t\ts - show resource store statistics\n"
+		"\t-E -\tresource store eviction policy: lru (default) or gds\n"
+		"\t\t(keep items that are costly to recreate for longer)\n"
 		"\n"
 		"\t-R {auto,0,90,180,270}\n"
 		"\t\trotate clockwise (default: auto)\n"
@@ -537,6 +556,13 @@ static int gettime(void)
 	return (now.tv_sec - first.tv_sec) * 1000 + (now.tv_usec - first.tv_usec) / 1000;
 }
 
+static int64_t gettime_us(void)
+{
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	return (int64_t)now.tv_sec * 1000000 + now.tv_usec;
+}
+
 static int drawband(fz_context *ctx, fz_page *page, fz_display_list *list, fz_matrix ctm, fz_rect tbounds, fz_cookie *cookie, int band_start, fz_pixmap *pix, fz_bitmap **bit)
 {
 	fz_device *dev = NULL;
@@ -569,6 +595,96 @@ static int drawband(fz_context *ctx, fz_page *page, fz_display_list *list, fz_ma
 	return RENDER_OK;
 }
 
+struct band_info
+{
+	/* Set when the bands are written, as the render details may
+	 * have been copied (to bgprint, or the pending page) since the
+	 * bands were queued. */
+	render_details *render;
+	int *errors_are_fatal;
+
+	fz_rect tbounds;
+	fz_cookie cookie;
+
+	/* Time taken to draw each band, filled in by the render threads,
+	 * and totalled as the bands are written. */
+	int *band_time;
+	int64_t busy;
+	int64_t start;
+};
+
+static void drawband_threaded(fz_context *ctx, void *arg, fz_display_list *list, fz_render_band *band, fz_cookie *cookie)
+{
+	band_info *info = (band_info *)arg;
+	int64_t start = gettime_us();
+	int status;
+
+	fz_set_pixmap_resolution(ctx, band->pix, x_resolution, y_resolution);
+	status = drawband(ctx, NULL, list, band->ctm, info->tbounds, cookie, band->y, band->pix, &band->bit);
+	info->band_time[band->num] = (int)(gettime_us() - start);
+	if (status != RENDER_OK)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "Render failed");
+}
+
+static void writeband_threaded(fz_context *ctx, void *arg, fz_render_band *band)
+{
+	band_info *info = (band_info *)arg;
+	render_details *render = info->render;
+
+	render->bands_rendered += render->band_height_multiple;
+	info->busy += info->band_time[band->num];
+
+	if (out)
+	{
+		/* If we get any errors while outputting the bands, retrying won't help. */
+		*info->errors_are_fatal = 1;
+		fz_write_band(ctx, render->bander, band->bit ? band->bit->stride : band->pix->stride, band->h, band->bit ? band->bit->samples : band->pix->samples);
+		*info->errors_are_fatal = 0;
+	}
+}
+
+static void drop_threaded_render(fz_context *ctx, render_details *render)
+{
+	fz_drop_render_job(ctx, render->job);
+	render->job = NULL;
+	if (render->info)
+	{
+		fz_free(ctx, render->info->band_time);
+		fz_free(ctx, render->info);
+		render->info = NULL;
+	}
+}
+
+/* Queue the bands of a page on the render threads as soon as it has
+ * been interpreted, so that threads with nothing left to do on the
+ * last page can make a start on this one. If the bands cannot be
+ * queued, the page is rendered without threads. */
+static void begin_threaded_render(fz_context *ctx, render_details *render)
+{
+	int band_height = min_band_height * render->band_height_multiple;
+	int bands = (render->ibounds.y1 - render->ibounds.y0 + band_height - 1) / band_height;
+	band_info *info;
+
+	if (!render_threads || render->num_workers == 0 || !render->list)
+		return;
+
+	fz_try(ctx)
+	{
+		info = render->info = fz_malloc_struct(ctx, band_info);
+		info->band_time = fz_malloc_array(ctx, bands, int);
+		info->tbounds = render->tbounds;
+		info->tbounds.y1 = info->tbounds.y0 + band_height + 2;
+		info->start = gettime_us();
+		render->job = fz_begin_render_display_list_bands(ctx, render_threads, render->list, render->ctm, render->ibounds, band_height,
+			colorspace, NULL, 0, drawband_threaded, writeband_threaded, info, &info->cookie);
+	}
+	fz_catch(ctx)
+	{
+		drop_threaded_render(ctx, render);
+		render->num_workers = 0;
+	}
+}
+
 static int dodrawpage(fz_context *ctx, int pagenum, fz_cookie *cookie, render_details *render)
 {
 	fz_pixmap *pix = NULL;
@@ -596,35 +712,21 @@ static int dodrawpage(fz_context *ctx, int pagenum, fz_cookie *cookie, render_de
 		ibounds.y1 = ibounds.y0 + band_height;
 		tbounds.y1 = tbounds.y0 + band_height + 2;
 		DEBUG_THREADS(("Using %d Bands\n", bands));
-		ctm.f += start_offset;
 
-		if (render->num_workers > 0)
+		if (render->job)
 		{
-			for (band = 0; band < fz_mini(render->num_workers, bands); band++)
-			{
-				int band_start = start_offset + band * band_height;
-				worker_t *w = &workers[band];
-				w->band_start = band_start;
-				w->ctm = ctm;
-				w->tbounds = tbounds;
-				memset(&w->cookie, 0, sizeof(fz_cookie));
-				w->list = render->list;
-				if (remaining_height < band_height)
-					ibounds.y1 = ibounds.y0 + remaining_height;
-				remaining_height -= band_height;
-				w->pix = fz_new_pixmap_with_bbox(ctx, colorspace, ibounds, NULL, 0);
-				fz_set_pixmap_resolution(ctx, w->pix, x_resolution, y_resolution);
-				DEBUG_THREADS(("Worker %d, Pre-triggering band %d\n", band, band));
-				w->started = 1;
-				mu_trigger_semaphore(&w->start);
-				ctm.f -= band_height;
-			}
-			pix = workers[0].pix;
+			/* The bands were queued when the page was interpreted
+			 * (see begin_threaded_render); collect and write them. */
+			render->info->render = render;
+			render->info->errors_are_fatal = &errors_are_fatal;
+			fz_finish_render_display_list_bands(ctx, render->job);
+			bands = 0; /* all drawn and written */
 		}
 		else
 		{
 			pix = fz_new_pixmap_with_bbox(ctx, colorspace, ibounds, NULL, 0);
 			fz_set_pixmap_resolution(ctx, pix, x_resolution, y_resolution);
+			ctm.f -= start_offset;
 		}
 
 		for (band = 0; band < bands; band++)
@@ -636,20 +738,7 @@ static int dodrawpage(fz_context *ctx, int pagenum, fz_cookie *cookie, render_de
 			if (draw_height > band_height)
 				draw_height = band_height;
 
-			if (render->num_workers > 0)
-			{
-				worker_t *w = &workers[band % render->num_workers];
-				DEBUG_THREADS(("Waiting for worker %d to complete band %d\n", w->num, band));
-				mu_wait_semaphore(&w->stop);
-				w->started = 0;
-				status = w->status;
-				pix = w->pix;
-				bit = w->bit;
-				w->bit = NULL;
-				cookie->errors += w->cookie.errors;
-			}
-			else
-				status = drawband(ctx, render->page, render->list, ctm, tbounds, cookie, band_start, pix, &bit);
+			status = drawband(ctx, render->page, render->list, ctm, tbounds, cookie, band_start, pix, &bit);
 
 			if (status != RENDER_OK)
 				fz_throw(ctx, FZ_ERROR_GENERIC, "Render failed");
@@ -665,18 +754,6 @@ static int dodrawpage(fz_context *ctx, int pagenum, fz_cookie *cookie, render_de
 			}
 			fz_drop_bitmap(ctx, bit);
 			bit = NULL;
-
-			if (render->num_workers > 0 && band + render->num_workers < bands)
-			{
-				worker_t *w = &workers[band % render->num_workers];
-				w->band_start = band_start;
-				w->ctm = ctm;
-				w->tbounds = tbounds;
-				memset(&w->cookie, 0, sizeof(fz_cookie));
-				DEBUG_THREADS(("Triggering worker %d for band_start= %d\n", w->num, w->band_start));
-				w->started = 1;
-				mu_trigger_semaphore(&w->start);
-			}
 			ctm.f -= draw_height;
 		}
 	}
@@ -684,23 +761,15 @@ static int dodrawpage(fz_context *ctx, int pagenum, fz_cookie *cookie, render_de
 	{
 		fz_drop_bitmap(ctx, bit);
 		bit = NULL;
-		if (render->num_workers > 0)
+		fz_drop_pixmap(ctx, pix);
+		if (render->job)
 		{
-			int band;
-			for (band = 0; band < fz_mini(render->num_workers, bands); band++)
-			{
-				worker_t *w = &workers[band];
-				w->cookie.abort = 1;
-				if (w->started)
-				{
-					mu_wait_semaphore(&w->stop);
-					w->started = 0;
-				}
-				fz_drop_pixmap(ctx, w->pix);
-			}
+			/* Any retry is done without threads. */
+			cookie->errors += render->info->cookie.errors;
+			render->busy = render->info->busy;
+			render->wall = gettime_us() - render->info->start;
+			drop_threaded_render(ctx, render);
 		}
-		else
-			fz_drop_pixmap(ctx, pix);
 	}
 	fz_catch(ctx)
 	{
@@ -733,6 +802,7 @@ static int try_render_page(fz_context *ctx, int pagenum, fz_cookie *cookie, int
 		fz_catch(ctx)
 		{
 			/* Failure! */
+			drop_threaded_render(ctx, render);
 			return RENDER_FATAL;
 		}
 	}
@@ -750,11 +820,11 @@ static int try_render_page(fz_context *ctx, int pagenum, fz_cookie *cookie, int
 			return RENDER_RETRY; /* Avoids all the cleanup below! */
 		}
 
-		/* Try again with fewer threads */
-		if (render->num_workers > 1)
+		/* Try again without threads (and their extra bands) */
+		if (render->num_workers > 0)
 		{
-			render->num_workers >>= 1;
-			DEBUG_THREADS(("Render failure; trying again with %d render threads\n", render->num_workers));
+			render->num_workers = 0;
+			DEBUG_THREADS(("Render failure; trying again with no render threads\n"));
 			continue;
 		}
 
@@ -780,6 +850,7 @@ static int try_render_page(fz_context *ctx, int pagenum, fz_cookie *cookie, int
 		break;
 	}
 
+	drop_threaded_render(ctx, render);
 	fz_drop_page(ctx, render->page);
 	fz_drop_display_list(ctx, render->list);
 	fz_drop_band_writer(ctx, render->bander);
@@ -808,7 +879,7 @@ static int try_render_page(fz_context *ctx, int pagenum, fz_cookie *cookie, int
 			timing.total += diff + interptime;
 			timing.count ++;
 
-			fprintf(stderr, " %dms (interpretation) %dms (rendering) %dms (total)\n", interptime, diff, diff + interptime);
+			fprintf(stderr, " %dms (interpretation) %dms (rendering) %dms (total)", interptime, diff, diff + interptime);
 		}
 		else
 		{
@@ -827,8 +898,13 @@ static int try_render_page(fz_context *ctx, int pagenum, fz_cookie *cookie, int
 			timing.total += diff;
 			timing.count ++;
 
-			fprintf(stderr, " %dms\n", diff);
+			fprintf(stderr, " %dms", diff);
 		}
+
+		timing.busy += render->busy;
+		if (render->wall > 0)
+			fprintf(stderr, " (render threads %d%% busy)", (int)(100 * render->busy / (render->wall * fz_count_render_threads(ctx, render_threads))));
+		fprintf(stderr, "\n");
 	}
 
 	if (showmemory)
@@ -861,6 +937,10 @@ get_page_render_details(fz_context *ctx, fz_page *page, render_details *render)
 	render->page = page;
 	render->list = NULL;
 	render->num_workers = num_workers;
+	render->job = NULL;
+	render->info = NULL;
+	render->busy = 0;
+	render->wall = 0;
 
 	render->bounds = fz_bound_page(ctx, page);
 	page_width = (render->bounds.x1 - render->bounds.x0)/72;
@@ -1021,6 +1101,43 @@ initialise_banding(fz_context *ctx, render_details *render, int color)
 	}
 }
 
+static int render_pending_page(fz_context *ctx, pending_page *p)
+{
+	int start;
+
+	if (!p->active)
+		return RENDER_OK;
+
+	if (showtime)
+		fprintf(stderr, "page %s %d", p->filename, p->pagenum);
+	start = (showtime ? gettime() - p->interptime : 0);
+	return try_render_page(ctx, p->pagenum, &p->cookie, start, 0, p->filename, 0, 0, &p->render);
+}
+
+/* Write out the page held back for the render threads (if any). This
+ * is also called when giving up on a document after an error, so that
+ * the pages before the error are all written, as they would be without
+ * the render threads. */
+static int finish_pending(fz_context *ctx)
+{
+	pending_page last = pending;
+
+	pending.active = 0;
+	return render_pending_page(ctx, &last);
+}
+
+static void drop_pending(fz_context *ctx)
+{
+	if (!pending.active)
+		return;
+
+	drop_threaded_render(ctx, &pending.render);
+	fz_drop_page(ctx, pending.render.page);
+	fz_drop_display_list(ctx, pending.render.list);
+	fz_drop_band_writer(ctx, pending.render.bander);
+	pending.active = 0;
+}
+
 static void drawpage(fz_context *ctx, fz_document *doc, int pagenum)
 {
 	fz_page *page;
@@ -1063,6 +1180,8 @@ static void drawpage(fz_context *ctx, fz_document *doc, int pagenum)
 			fz_run_page(ctx, page, list_dev, fz_identity, &cookie);
 #endif
 			fz_close_device(ctx, list_dev);
+			/* Each band runs the whole list; let them skip what lies outside. */
+			fz_index_display_list(ctx, list);
 		}
 		fz_always(ctx)
 		{
@@ -1077,7 +1196,7 @@ static void drawpage(fz_context *ctx, fz_document *doc, int pagenum)
 			list = NULL;
 			/* Just continue with no list. Also, we can't do multiple
 			 * threads if we have no list. */
-			render.num_workers = 1;
+			render.num_workers = 0;
 		}
 		render.list = list;
 
@@ -1139,7 +1258,9 @@ static void drawpage(fz_context *ctx, fz_document *doc, int pagenum)
 		/* Figure out banding */
 		initialise_banding(ctx, &render, is_color);
 
-		if (bgprint.active && showtime)
+		begin_threaded_render(ctx, &render);
+
+		if ((bgprint.active || render.job) && showtime)
 		{
 			int end = gettime();
 			start = end - start;
@@ -1161,6 +1282,7 @@ static void drawpage(fz_context *ctx, fz_document *doc, int pagenum)
 		/* The bgprint in the background failed! This might have been because
 		 * we were using memory etc in the foreground. We'd better ditch
 		 * everything we can and try again. */
+		drop_threaded_render(ctx, &render);
 		fz_drop_display_list(ctx, list);
 		fz_drop_page(ctx, page);
 
@@ -1182,7 +1304,7 @@ static void drawpage(fz_context *ctx, fz_document *doc, int pagenum)
 	}
 	while (1);
 
-	if (showtime)
+	if (showtime && (bgprint.active || !render.job))
 	{
 		fprintf(stderr, "page %s %d", filename, pagenum);
 	}
@@ -1196,8 +1318,36 @@ static void drawpage(fz_context *ctx, fz_document *doc, int pagenum)
 		bgprint.interptime = start;
 		mu_trigger_semaphore(&bgprint.start);
 	}
+	else if (render.job)
+	{
+		/* Hold this page back, and write out the last one while the
+		 * threads make a start on it. */
+		pending_page last = pending;
+
+		pending.active = 1;
+		pending.pagenum = pagenum;
+		pending.filename = filename;
+		pending.interptime = start;
+		pending.cookie = cookie;
+		pending.render = render;
+
+		if (render_pending_page(ctx, &last))
+		{
+			/* Hard failure */
+			drop_pending(ctx);
+			fz_throw(ctx, FZ_ERROR_GENERIC, "Failed to render page");
+		}
+	}
 	else
 	{
+		if (finish_pending(ctx))
+		{
+			/* Hard failure */
+			fz_drop_page(ctx, render.page);
+			fz_drop_display_list(ctx, render.list);
+			fz_drop_band_writer(ctx, render.bander);
+			fz_throw(ctx, FZ_ERROR_GENERIC, "Failed to render page");
+		}
 		if (try_render_page(ctx, pagenum, &cookie, start, 0, filename, 0, 0, &render))
 		{
 			/* Hard failure */
@@ -1255,6 +1405,10 @@ static void drawrange(fz_context *ctx, fz_document *doc, const char *range)
 			for (page = spage; page >= epage; page--)
 				drawpage(ctx, doc, page);
 	}
+
+	/* The pages cannot outlive the document. */
+	if (finish_pending(ctx))
+		fz_throw(ctx, FZ_ERROR_GENERIC, "Failed to render page");
 }
 
 typedef struct
@@ -1330,26 +1484,6 @@ trace_realloc(void *arg, void *p_, size_t size)
 }
 
 #ifndef DISABLE_MUTHREADS
-static void worker_thread(void *arg)
-{
-	worker_t *me = (worker_t *)arg;
-	int band_start;
-
-	do
-	{
-		DEBUG_THREADS(("Worker %d waiting\n", me->num));
-		mu_wait_semaphore(&me->start);
-		band_start = me->band_start;
-		DEBUG_THREADS(("Worker %d woken for band_start %d\n", me->num, me->band_start));
-		me->status = RENDER_OK;
-		if (band_start >= 0)
-			me->status = drawband(me->ctx, NULL, me->list, me->ctm, me->tbounds, &me->cookie, band_start, me->pix, &me->bit);
-		DEBUG_THREADS(("Worker %d completed band_start %d (status=%d)\n", me->num, band_start, me->status));
-		mu_trigger_semaphore(&me->stop);
-	}
-	while (band_start >= 0);
-}
-
 static void bgprint_worker(void *arg)
 {
 	fz_cookie cookie = { 0 };
@@ -1438,7 +1572,7 @@ int main(int argc, char **argv)
 	x_resolution = X_RESOLUTION;
 	y_resolution = Y_RESOLUTION;
 
-	while ((c = fz_getopt(argc, argv, "p:o:F:R:r:w:h:fB:M:s:A:iW:H:S:T:U:XvP")) != -1)
+	while ((c = fz_getopt(argc, argv, "p:o:F:R:r:w:h:fB:M:s:E:A:iW:H:S:T:U:XvP")) != -1)
 	{
 		switch (c)
 		{
@@ -1466,6 +1600,13 @@ int main(int argc, char **argv)
 		case 's':
 			if (strchr(fz_optarg, 't')) ++showtime;
 			if (strchr(fz_optarg, 'm')) ++showmemory;
+			if (strchr(fz_optarg, 's')) ++showstore;
+			break;
+
+		case 'E':
+			store_policy = fz_lookup_store_policy(fz_optarg);
+			if (strcmp(fz_store_policy_name(store_policy), fz_optarg))
+				usage();
 			break;
 
 		case 'A':
@@ -1530,6 +1671,8 @@ int main(int argc, char **argv)
 		exit(1);
 	}
 
+	fz_set_store_policy(ctx, store_policy);
+
 	fz_set_text_aa_level(ctx, alphabits_text);
 	fz_set_graphics_aa_level(ctx, alphabits_graphics);
 
@@ -1550,18 +1693,9 @@ int main(int argc, char **argv)
 
 	if (num_workers > 0)
 	{
-		int i;
-		int fail = 0;
-		workers = fz_calloc(ctx, num_workers, sizeof(*workers));
-		for (i = 0; i < num_workers; i++)
-		{
-			workers[i].ctx = fz_clone_context(ctx);
-			workers[i].num = i;
-			fail |= mu_create_semaphore(&workers[i].start);
-			fail |= mu_create_semaphore(&workers[i].stop);
-			fail |= mu_create_thread(&workers[i].thread, worker_thread, &workers[i]);
-		}
-		if (fail)
+		fz_try(ctx)
+			render_threads = fz_new_render_threads(ctx, num_workers);
+		fz_catch(ctx)
 		{
 			fprintf(stderr, "worker startup failed\n");
 			exit(1);
@@ -1648,6 +1782,8 @@ int main(int argc, char **argv)
 	timing.maxpage = 0;
 	timing.minfilename = "";
 	timing.maxfilename = "";
+	timing.start = gettime();
+	timing.busy = 0;
 
 	fz_try(ctx)
 	{
@@ -1682,6 +1818,7 @@ int main(int argc, char **argv)
 				if (!ignore_errors)
 					fz_rethrow(ctx);
 
+				finish_pending(ctx);
 				fz_drop_document(ctx, doc);
 				doc = NULL;
 				fz_warn(ctx, "ignoring error in '%s'", filename);
@@ -1691,6 +1828,7 @@ int main(int argc, char **argv)
 	}
 	fz_catch(ctx)
 	{
+		finish_pending(ctx);
 		fz_drop_document(ctx, doc);
 		fprintf(stderr, "error: cannot draw '%s'\n", filename);
 		errored = 1;
@@ -1702,25 +1840,18 @@ int main(int argc, char **argv)
 			timing.total, timing.count, timing.total / timing.count);
 		fprintf(stderr, "fastest page %d: %dms\n", timing.minpage, timing.min);
 		fprintf(stderr, "slowest page %d: %dms\n", timing.maxpage, timing.max);
-	}
-
-#ifndef DISABLE_MUTHREADS
-	if (num_workers > 0)
-	{
-		int i;
-		for (i = 0; i < num_workers; i++)
+		if (timing.busy > 0)
 		{
-			workers[i].band_start = -1;
-			mu_trigger_semaphore(&workers[i].start);
-			mu_wait_semaphore(&workers[i].stop);
-			mu_destroy_semaphore(&workers[i].start);
-			mu_destroy_semaphore(&workers[i].stop);
-			mu_destroy_thread(&workers[i].thread);
-			fz_drop_context(workers[i].ctx);
+			int elapsed = gettime() - timing.start;
+			int count = fz_count_render_threads(ctx, render_threads);
+			if (elapsed > 0)
+				fprintf(stderr, "render threads %d%% busy\n", (int)(timing.busy / ((int64_t)10 * elapsed * count)));
 		}
-		fz_free(ctx, workers);
 	}
 
+#ifndef DISABLE_MUTHREADS
+	/* Stop bgprint first, as it may still be writing a page from the
+	 * render threads if we stopped early. */
 	if (bgprint.active)
 	{
 		bgprint.pagenum = -1;
@@ -1731,12 +1862,17 @@ int main(int argc, char **argv)
 		mu_destroy_thread(&bgprint.thread);
 		fz_drop_context(bgprint.ctx);
 	}
+
+	fz_drop_render_threads(ctx, render_threads);
 #endif /* DISABLE_MUTHREADS */
 
 	fz_close_output(ctx, out);
 	fz_drop_output(ctx, out);
 	out = NULL;
 
+	if (showstore)
+		fz_print_store_stats(ctx, fz_stderr(ctx));
+
 	fz_drop_context(ctx);
 #ifndef DISABLE_MUTHREADS
 	fin_muraster_locks();
@@ -16,6 +16,7 @@ int mudraw_main(int argc, char *argv[]);
 int mutrace_main(int argc, char *argv[]);
 int murun_main(int argc, char *argv[]);
 
+int pdfaccel_main(int argc, char *argv[]);
 int pdfclean_main(int argc, char *argv[]);
 int pdfextract_main(int argc, char *argv[]);
 int pdfinfo_main(int argc, char *argv[]);
@@ -34,6 +35,7 @@ static struct {
 	char *desc;
 } tools[] = {
 #if FZ_ENABLE_PDF
+	{ pdfaccel_main, "accel", "save data to open a pdf file faster" },
 	{ pdfclean_main, "clean", "rewrite pdf file" },
 #endif
 	{ muconvert_main, "convert", "convert document" },
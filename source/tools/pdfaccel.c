@@ -0,0 +1,88 @@
+/*
+ * Accelerator tool.
+ * Save the cross reference and page tree data of a pdf, so that later
+ * opens of the same file can skip reading them.
+ */
+
+#include "mupdf/fitz.h"
+#include "mupdf/pdf.h"
+
+#include <limits.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#ifndef PATH_MAX
+#define PATH_MAX 4096
+#endif
+
+static void
+accelusage(void)
+{
+	fprintf(stderr,
+		"usage: mutool accel [options] input.pdf [output]\n"
+		"\t-p -\tpassword for decryption\n"
+		"\toutput\taccelerator file to write; by default, the one\n"
+		"\t\tthat mutool draw looks for in the temporary directory\n"
+		);
+	exit(1);
+}
+
+int pdfaccel_main(int argc, char **argv)
+{
+	char accelpath[PATH_MAX];
+	char *infile;
+	char *outfile;
+	char *password = "";
+	pdf_document *doc = NULL;
+	fz_context *ctx;
+	int ret = 0;
+	int c;
+
+	while ((c = fz_getopt(argc, argv, "p:")) != -1)
+	{
+		switch (c)
+		{
+		case 'p': password = fz_optarg; break;
+		default: accelusage(); break;
+		}
+	}
+
+	if (fz_optind == argc || argc - fz_optind > 2)
+		accelusage();
+
+	infile = argv[fz_optind++];
+	outfile = fz_optind < argc ? argv[fz_optind++] : NULL;
+
+	ctx = fz_new_context(NULL, NULL, FZ_STORE_UNLIMITED);
+	if (!ctx)
+	{
+		fprintf(stderr, "cannot initialise context\n");
+		exit(1);
+	}
+
+	fz_var(doc);
+
+	fz_try(ctx)
+	{
+		if (!outfile)
+		{
+			if (!fz_default_accelerator_filename(ctx, accelpath, sizeof accelpath, infile))
+				fz_throw(ctx, FZ_ERROR_GENERIC, "cannot make accelerator file name for: %s", infile);
+			outfile = accelpath;
+		}
+
+		doc = pdf_open_document(ctx, infile);
+		if (pdf_needs_password(ctx, doc))
+			if (!pdf_authenticate_password(ctx, doc, password))
+				fz_throw(ctx, FZ_ERROR_GENERIC, "cannot authenticate password: %s", infile);
+
+		fz_save_accelerator(ctx, &doc->super, outfile);
+	}
+	fz_always(ctx)
+		pdf_drop_document(ctx, doc);
+	fz_catch(ctx)
+		ret = 1;
+
+	fz_drop_context(ctx);
+	return ret;
+}
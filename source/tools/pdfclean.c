@@ -36,6 +36,8 @@ static void usage(void)
 		"\t-z\tdeflate uncompressed streams\n"
 		"\t-f\tcompress font streams\n"
 		"\t-i\tcompress image streams\n"
+		"\t-Z\tuse object streams and cross reference streams\n"
+		"\t-T -\tnumber of threads to compress streams on\n"
 		"\t-c\tclean content streams\n"
 		"\t-s\tsanitize content streams\n"
 		"\t-A\tcreate appearance streams for annotations\n"
@@ -64,7 +66,7 @@ int pdfclean_main(int argc, char **argv)
 	int errors = 0;
 	fz_context *ctx;
 
-	while ((c = fz_getopt(argc, argv, "adfgilp:sczDAE:O:U:P:")) != -1)
+	while ((c = fz_getopt(argc, argv, "adfgilp:sczDAE:O:U:P:ZT:")) != -1)
 	{
 		switch (c)
 		{
@@ -74,6 +76,8 @@ int pdfclean_main(int argc, char **argv)
 		case 'z': opts.do_compress += 1; break;
 		case 'f': opts.do_compress_fonts += 1; break;
 		case 'i': opts.do_compress_images += 1; break;
+		case 'Z': opts.do_use_objstms += 1; break;
+		case 'T': opts.compress_threads = fz_atoi(fz_optarg); break;
 		case 'a': opts.do_ascii += 1; break;
 		case 'g': opts.do_garbage += 1; break;
 		case 'l': opts.do_linear += 1; break;
@@ -15,6 +15,7 @@ static fz_output *out = NULL;
 static int showbinary = 0;
 static int showdecode = 1;
 static int tight = 0;
+static int arenas = 0;
 static int showcolumn;
 
 static void usage(void)
@@ -26,6 +27,7 @@ static void usage(void)
 		"\t-e\tleave stream contents in their original form\n"
 		"\t-b\tprint only stream contents, as raw binary data\n"
 		"\t-g\tprint only object, one line per object, suitable for grep\n"
+		"\t-a\tload objects into arenas (faster for files with many objects)\n"
 		"\tpath: path to an object, starting with either an object number,\n"
 		"\t\t'pages', 'trailer', or a property in the trailer;\n"
 		"\t\tpath elements separated by '.' or '/'. Path elements must be\n"
@@ -568,7 +570,7 @@ int pdfshow_main(int argc, char **argv)
 		exit(1);
 	}
 
-	while ((c = fz_getopt(argc, argv, "p:o:beg")) != -1)
+	while ((c = fz_getopt(argc, argv, "p:o:bega")) != -1)
 	{
 		switch (c)
 		{
@@ -577,6 +579,7 @@ int pdfshow_main(int argc, char **argv)
 		case 'b': showbinary = 1; break;
 		case 'e': showdecode = 0; break;
 		case 'g': tight = 1; break;
+		case 'a': arenas = 1; break;
 		default: usage(); break;
 		}
 	}
@@ -595,6 +598,8 @@ int pdfshow_main(int argc, char **argv)
 	fz_try(ctx)
 	{
 		doc = pdf_open_document(ctx, filename);
+		if (arenas)
+			pdf_enable_obj_arenas(ctx, doc);
 		if (pdf_needs_password(ctx, doc))
 			if (!pdf_authenticate_password(ctx, doc, password))
 				fz_warn(ctx, "cannot authenticate password: %s", filename);